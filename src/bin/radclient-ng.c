@@ -36,11 +36,16 @@ RCSID("$Id$")
 #include <freeradius-devel/radius/list.h>
 #include <freeradius-devel/radius/radius.h>
 #include <freeradius-devel/util/chap.h>
+#include <freeradius-devel/util/metrics.h>
 #include <freeradius-devel/bio/fd.h>
+#include <freeradius-devel/radius/client.h>
 #ifdef HAVE_OPENSSL_SSL_H
 #include <openssl/ssl.h>
 #endif
 #include <ctype.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
 
 #ifdef HAVE_GETOPT_H
 #  include <getopt.h>
@@ -154,11 +159,17 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -F                                Print the file name, packet number and reply code.\n");
 	fprintf(stderr, "  -h                                Print usage help information.\n");
 	fprintf(stderr, "  -i <id>                           Set request id to 'id'.  Values may be 0..255\n");
+	fprintf(stderr, "  -j <file>                         Write load test results as JSON to 'file' (defaults to stdout).\n");
+	fprintf(stderr, "  -l <duration>                     Run the load test for 'duration' seconds (defaults to 10).\n");
+	fprintf(stderr, "  -L <rate>[:<end_rate>]            Load test.  Send 'rate' packets per second, regardless of replies.\n");
+	fprintf(stderr, "                                    If 'end_rate' is given, the rate ramps linearly to it.\n");
+	fprintf(stderr, "  -N <sockets>                      Number of sockets (source ports) per load test thread.\n");
 	fprintf(stderr, "  -P <proto>                        Use proto (tcp or udp) for transport.\n");
 	fprintf(stderr, "  -r <retries>                      If timeout, retry sending the packet 'retries' times.\n");
 	fprintf(stderr, "  -s                                Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>                         read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>                      Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <threads>                      Number of load test threads.\n");
 	fprintf(stderr, "  -v                                Show program version information.\n");
 	fprintf(stderr, "  -x                                Debugging mode.\n");
 
@@ -1054,6 +1065,434 @@ packet_done:
 	return 0;
 }
 
+/*
+ *	Open-loop load generation.
+ *
+ *	Packets are sent on a schedule, whether or not the server has
+ *	replied to the earlier ones.  Latency is measured from when the
+ *	schedule said each packet should be sent, not from when it was
+ *	actually sent.  A sender which falls behind then still reports
+ *	the delay a real client would have seen, instead of quietly
+ *	sending less (i.e. the results are corrected for coordinated
+ *	omission).
+ */
+#define LOAD_MAX_BURST		(64)		//!< Most packets sent before checking for replies.
+
+typedef struct {
+	fr_radius_packet_t	*packet;	//!< Packet code, and talloc ctx for the pairs.
+	fr_pair_list_t		pairs;
+} rc_load_template_t;
+
+typedef struct {
+	fr_dlist_t		entry;		//!< In the thread's list of outstanding packets.
+	fr_radius_packet_t	*packet;
+	fr_bio_packet_t		*client;	//!< Socket the packet was sent on.
+	fr_time_t		intended;	//!< When the schedule said the packet should be sent.
+	fr_time_t		sent;		//!< When it was actually sent.
+} rc_load_packet_t;
+
+typedef struct {
+	unsigned int		num;		//!< Thread number, from 0.
+	pthread_t		pthread;
+	TALLOC_CTX		*ctx;		//!< Only used by this thread once it's started.
+
+	rc_load_template_t	*templates;	//!< This thread's copy of the packets to send.
+	size_t			num_templates;
+
+	fr_bio_packet_t		**clients;	//!< One per socket.
+	struct pollfd		*pfds;
+
+	fr_dlist_head_t		outstanding;	//!< Packets waiting for a reply, in the order they were sent.
+
+	uint64_t		sent;
+	uint64_t		send_failed;	//!< No free IDs, or the write failed.
+	uint64_t		received;
+	uint64_t		timeouts;
+	uint64_t		replies[FR_RADIUS_CODE_MAX];
+} rc_load_thread_t;
+
+static double		load_rate_start = 0;		//!< Packets per second at the start of the run.
+static double		load_rate_end = 0;		//!< Packets per second at the end of the run.
+static fr_time_delta_t	load_duration = fr_time_delta_wrap((int64_t)10 * NSEC);	/* 10 seconds */
+static unsigned int	load_num_threads = 1;
+static unsigned int	load_num_sockets = 1;		//!< Per thread.
+static char const	*load_json = "-";
+static fr_time_t	load_start;
+static fr_metric_t	*load_latency;
+
+/** When the Nth packet of the run should be sent
+ *
+ * The rate ramps linearly from load_rate_start to load_rate_end, so the
+ * number of packets due by time t is r0 * t + (r1 - r0) * t^2 / 2D.
+ * Solve that for t.
+ */
+static fr_time_t load_schedule(uint64_t n)
+{
+	double	duration = (double) fr_time_delta_unwrap(load_duration) / NSEC;
+	double	a = (load_rate_end - load_rate_start) / (2 * duration);
+	double	t, disc;
+
+	if (fabs(a) < 1e-9) {
+		t = n / load_rate_start;
+	} else {
+		disc = (load_rate_start * load_rate_start) + (4 * a * n);
+		if (disc < 0) return fr_time_add(load_start, fr_time_delta_add(load_duration, load_duration));
+
+		t = (sqrt(disc) - load_rate_start) / (2 * a);
+	}
+
+	return fr_time_add(load_start, fr_time_delta_wrap((int64_t)(t * NSEC)));
+}
+
+/** Set the password, in whichever form the template wants it
+ *
+ * Unlike the normal send path this is done once, so CHAP always uses
+ * a CHAP-Challenge, as the Request Authenticator changes with each packet.
+ */
+static void load_template_password(rc_load_template_t *tmpl, fr_pair_t const *password)
+{
+	fr_pair_t *vp;
+
+	if ((vp = fr_pair_find_by_da(&tmpl->pairs, NULL, attr_user_password)) != NULL) {
+		fr_pair_value_strdup(vp, password->vp_strvalue, false);
+
+	} else if ((vp = fr_pair_find_by_da(&tmpl->pairs, NULL, attr_chap_password)) != NULL) {
+		uint8_t		buffer[17];
+		fr_pair_t	*challenge;
+
+		challenge = fr_pair_find_by_da(&tmpl->pairs, NULL, attr_chap_challenge);
+		if (!challenge || (challenge->vp_length != RADIUS_AUTH_VECTOR_LENGTH)) {
+			uint8_t vector[RADIUS_AUTH_VECTOR_LENGTH];
+
+			fr_pair_delete_by_da(&tmpl->pairs, attr_chap_challenge);
+
+			MEM(challenge = fr_pair_afrom_da(tmpl->packet, attr_chap_challenge));
+			fr_rand_buffer(vector, sizeof(vector));
+			fr_pair_value_memdup(challenge, vector, sizeof(vector), false);
+			fr_pair_append(&tmpl->pairs, challenge);
+		}
+
+		fr_chap_encode(buffer,
+			       fr_rand() & 0xff, challenge->vp_octets, RADIUS_AUTH_VECTOR_LENGTH,
+			       password->vp_strvalue,
+			       password->vp_length);
+		fr_pair_value_memdup(vp, buffer, sizeof(buffer), false);
+
+	} else if (fr_pair_find_by_da_nested(&tmpl->pairs, NULL, attr_ms_chap_password) != NULL) {
+		mschapv1_encode(tmpl->packet, &tmpl->pairs, password->vp_strvalue);
+	}
+}
+
+/** Open a thread's sockets, and copy the packets it will send
+ *
+ * This is done before the thread starts, so errors are easy to report.
+ */
+static int load_thread_init(rc_load_thread_t *t, unsigned int num)
+{
+	fr_radius_client_config_t	client_config = {
+		.verify = {
+			.secret = (uint8_t const *) secret,
+			.secret_len = strlen(secret),
+		},
+	};
+	unsigned int			i = 0;
+
+	t->num = num;
+	MEM(t->ctx = talloc_init_const("load_thread"));
+	fr_dlist_talloc_init(&t->outstanding, rc_load_packet_t, entry);
+
+	MEM(t->clients = talloc_array(t->ctx, fr_bio_packet_t *, load_num_sockets));
+	MEM(t->pfds = talloc_array(t->ctx, struct pollfd, load_num_sockets));
+
+	for (i = 0; i < load_num_sockets; i++) {
+		fr_bio_fd_config_t	my_config = fd_config;
+		fr_bio_fd_info_t const	*info;
+
+		/*
+		 *	If we were given a source port, each socket
+		 *	gets the next one along.
+		 */
+		if (fd_config.src_port) my_config.src_port = fd_config.src_port + (num * load_num_sockets) + i;
+
+		t->clients[i] = fr_radius_client_bio_alloc(t->ctx, &client_config, &my_config);
+		if (!t->clients[i]) {
+			ERROR("Failed opening socket");
+			return -1;
+		}
+
+		info = fr_bio_fd_info(fr_radius_client_bio_get_fd(t->clients[i]));
+		t->pfds[i] = (struct pollfd) { .fd = info->socket.fd, .events = POLLIN };
+	}
+
+	/*
+	 *	Each thread gets its own copy of the pairs,
+	 *	so the threads share nothing while running.
+	 */
+	t->num_templates = fr_dlist_num_elements(&rc_request_list);
+	MEM(t->templates = talloc_zero_array(t->ctx, rc_load_template_t, t->num_templates));
+
+	i = 0;
+	fr_dlist_foreach(&rc_request_list, rc_request_t, request) {
+		rc_load_template_t *tmpl = &t->templates[i++];
+
+		MEM(tmpl->packet = fr_radius_packet_alloc(t->ctx, false));
+		tmpl->packet->code = request->packet->code;
+
+		fr_pair_list_init(&tmpl->pairs);
+		if (fr_pair_list_copy(tmpl->packet, &tmpl->pairs, &request->request_pairs) < 0) {
+			ERROR("Failed copying request pairs");
+			return -1;
+		}
+
+		if (request->password) load_template_password(tmpl, request->password);
+	}
+
+	return 0;
+}
+
+static void load_send(rc_load_thread_t *t, uint64_t k, fr_time_t intended)
+{
+	rc_load_template_t	*tmpl = &t->templates[k % t->num_templates];
+	rc_load_packet_t	*lp;
+
+	MEM(lp = talloc_zero(t->ctx, rc_load_packet_t));
+	MEM(lp->packet = fr_radius_packet_alloc(lp, true));
+	lp->packet->code = tmpl->packet->code;
+	lp->packet->uctx = lp;
+	lp->client = t->clients[k % load_num_sockets];
+	lp->intended = intended;
+
+	if (fr_bio_packet_write(lp->client, lp, lp->packet, &tmpl->pairs) < 0) {
+		t->send_failed++;
+		talloc_free(lp);
+		return;
+	}
+
+	lp->sent = fr_time();
+	fr_dlist_insert_tail(&t->outstanding, lp);
+	t->sent++;
+}
+
+static void load_recv(rc_load_thread_t *t, fr_bio_packet_t *client)
+{
+	while (true) {
+		fr_radius_packet_t	*reply = NULL;
+		fr_pair_list_t		reply_pairs;
+		rc_load_packet_t	*lp;
+
+		fr_pair_list_init(&reply_pairs);
+
+		if ((fr_bio_packet_read(client, t, &reply, &reply_pairs) <= 0) || !reply) return;
+
+		lp = talloc_get_type_abort(reply->uctx, rc_load_packet_t);
+		fr_metric_observe(load_latency, fr_time_sub(fr_time(), lp->intended));
+
+		t->received++;
+		t->replies[reply->code]++;
+
+		fr_pair_list_free(&reply_pairs);
+		fr_dlist_remove(&t->outstanding, lp);
+		talloc_free(lp);	/* Also frees the reply */
+	}
+}
+
+/** Give up on requests which have had no reply within the timeout
+ *
+ * They're recorded in the latency histogram as if the reply arrived
+ * when they timed out, so that the quantiles don't improve as the
+ * server falls over.
+ */
+static void load_expire(rc_load_thread_t *t, fr_time_t now)
+{
+	rc_load_packet_t *lp;
+
+	while ((lp = fr_dlist_head(&t->outstanding)) && fr_time_lteq(fr_time_add(lp->sent, timeout), now)) {
+		fr_metric_observe(load_latency, fr_time_sub(fr_time_add(lp->sent, timeout), lp->intended));
+
+		(void) fr_bio_packet_release(lp->client, lp, lp->packet);
+		fr_dlist_remove(&t->outstanding, lp);
+		t->timeouts++;
+		talloc_free(lp);
+	}
+}
+
+static void *load_thread(void *arg)
+{
+	rc_load_thread_t	*t = arg;
+	fr_time_t		end = fr_time_add(load_start, load_duration);
+	uint64_t		k = 0;
+	fr_time_t		next;
+
+	/*
+	 *	Threads take turns, so packet k of this thread
+	 *	is packet (k * threads) + num of the whole run.
+	 */
+	next = load_schedule(t->num);
+
+	while (true) {
+		fr_time_t		now = fr_time();
+		fr_time_t		wake;
+		fr_time_delta_t		wait;
+		rc_load_packet_t	*lp;
+		unsigned int		i, burst = 0;
+
+		while (fr_time_lt(next, end) && fr_time_lteq(next, now) && (burst++ < LOAD_MAX_BURST)) {
+			load_send(t, k, next);
+			k++;
+			next = load_schedule((k * load_num_threads) + t->num);
+		}
+
+		load_expire(t, now);
+
+		if (fr_time_gteq(next, end) && (fr_dlist_num_elements(&t->outstanding) == 0)) break;
+
+		/*
+		 *	Wait until the next packet is due, or the
+		 *	oldest outstanding one times out.
+		 */
+		wake = fr_time_lt(next, end) ? next : fr_time_add(now, timeout);
+		lp = fr_dlist_head(&t->outstanding);
+		if (lp && fr_time_lt(fr_time_add(lp->sent, timeout), wake)) wake = fr_time_add(lp->sent, timeout);
+		wait = fr_time_sub(wake, now);
+
+		/*
+		 *	poll() only has millisecond resolution, so we
+		 *	spin for anything shorter.
+		 */
+		if (poll(t->pfds, load_num_sockets, fr_time_delta_ispos(wait) ? fr_time_delta_to_msec(wait) : 0) <= 0) continue;
+
+		for (i = 0; i < load_num_sockets; i++) {
+			if (t->pfds[i].revents & POLLIN) load_recv(t, t->clients[i]);
+		}
+	}
+
+	return NULL;
+}
+
+static void load_print(FILE *fp, rc_load_thread_t *threads, fr_time_delta_t elapsed)
+{
+	uint64_t	sent = 0, send_failed = 0, received = 0, timeouts = 0;
+	uint64_t	replies[FR_RADIUS_CODE_MAX] = { 0 };
+	double		duration = (double) fr_time_delta_unwrap(load_duration) / NSEC;
+	char		buffer[FR_IPADDR_STRLEN];
+	char const	*sep = "";
+	unsigned int	i, code;
+
+	for (i = 0; i < load_num_threads; i++) {
+		sent += threads[i].sent;
+		send_failed += threads[i].send_failed;
+		received += threads[i].received;
+		timeouts += threads[i].timeouts;
+
+		for (code = 0; code < FR_RADIUS_CODE_MAX; code++) replies[code] += threads[i].replies[code];
+	}
+
+	fr_inet_ntop(buffer, sizeof(buffer), &fd_config.dst_ipaddr);
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"server\": \"%s\",\n", buffer);
+	fprintf(fp, "\t\"port\": %u,\n", fd_config.dst_port);
+	fprintf(fp, "\t\"threads\": %u,\n", load_num_threads);
+	fprintf(fp, "\t\"sockets\": %u,\n", load_num_threads * load_num_sockets);
+	fprintf(fp, "\t\"schedule\": {\n");
+	fprintf(fp, "\t\t\"start_rate\": %g,\n", load_rate_start);
+	fprintf(fp, "\t\t\"end_rate\": %g,\n", load_rate_end);
+	fprintf(fp, "\t\t\"duration\": %.3f\n", duration);
+	fprintf(fp, "\t},\n");
+	fprintf(fp, "\t\"elapsed\": %.3f,\n", (double) fr_time_delta_unwrap(elapsed) / NSEC);
+	fprintf(fp, "\t\"sent\": %" PRIu64 ",\n", sent);
+	fprintf(fp, "\t\"send_failed\": %" PRIu64 ",\n", send_failed);
+	fprintf(fp, "\t\"received\": %" PRIu64 ",\n", received);
+	fprintf(fp, "\t\"timeouts\": %" PRIu64 ",\n", timeouts);
+	fprintf(fp, "\t\"rate\": %.1f,\n", sent / duration);
+
+	fprintf(fp, "\t\"replies\": {");
+	for (code = 1; code < FR_RADIUS_CODE_MAX; code++) {
+		if (!replies[code]) continue;
+
+		fprintf(fp, "%s\n\t\t\"%s\": %" PRIu64, sep, fr_radius_packet_names[code], replies[code]);
+		sep = ",";
+	}
+	fprintf(fp, "%s},\n", sep[0] ? "\n\t" : "");
+
+	fprintf(fp, "\t\"latency\": {\n");
+	fprintf(fp, "\t\t\"count\": %" PRIu64 ",\n", fr_metric_count(load_latency));
+	fprintf(fp, "\t\t\"p50\": %.6f,\n", (double) fr_time_delta_unwrap(fr_metric_quantile(load_latency, 0.5)) / NSEC);
+	fprintf(fp, "\t\t\"p90\": %.6f,\n", (double) fr_time_delta_unwrap(fr_metric_quantile(load_latency, 0.9)) / NSEC);
+	fprintf(fp, "\t\t\"p99\": %.6f,\n", (double) fr_time_delta_unwrap(fr_metric_quantile(load_latency, 0.99)) / NSEC);
+	fprintf(fp, "\t\t\"p999\": %.6f\n", (double) fr_time_delta_unwrap(fr_metric_quantile(load_latency, 0.999)) / NSEC);
+	fprintf(fp, "\t}\n");
+	fprintf(fp, "}\n");
+}
+
+/** Run a load test, and print the results
+ *
+ */
+static int load_run(void)
+{
+	rc_load_thread_t	*threads;
+	unsigned int		i;
+	int			ret;
+	FILE			*fp = stdout;
+
+	/*
+	 *	Open the results file first, so that a bad path
+	 *	doesn't throw away the whole run.
+	 */
+	if (strcmp(load_json, "-") != 0) {
+		fp = fopen(load_json, "w");
+		if (!fp) {
+			ERROR("Error opening %s: %s", load_json, fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	load_latency = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "radclient_latency_seconds",
+					  "Time from when a request was due to be sent, to receiving its reply or timing out.", NULL);
+	if (!load_latency) {
+		ERROR("Failed creating latency histogram");
+		if (fp != stdout) fclose(fp);
+		return -1;
+	}
+
+	MEM(threads = talloc_zero_array(NULL, rc_load_thread_t, load_num_threads));
+
+	for (i = 0; i < load_num_threads; i++) {
+		if (load_thread_init(&threads[i], i) < 0) {
+			for (i = 0; i < load_num_threads; i++) talloc_free(threads[i].ctx);
+			talloc_free(threads);
+			if (fp != stdout) fclose(fp);
+			return -1;
+		}
+	}
+
+	/*
+	 *	Give the threads time to start, so the first
+	 *	packets aren't all late.
+	 */
+	load_start = fr_time_add(fr_time(), fr_time_delta_from_msec(10));
+
+	for (i = 0; i < load_num_threads; i++) {
+		ret = pthread_create(&threads[i].pthread, NULL, load_thread, &threads[i]);
+		if (ret != 0) {
+			fr_strerror_printf("%s", fr_syserror(ret));
+			ERROR("Failed creating thread");
+			fr_exit_now(EXIT_FAILURE);
+		}
+	}
+
+	for (i = 0; i < load_num_threads; i++) pthread_join(threads[i].pthread, NULL);
+
+	load_print(fp, threads, fr_time_sub(fr_time(), load_start));
+
+	if (fp != stdout) fclose(fp);
+
+	for (i = 0; i < load_num_threads; i++) talloc_free(threads[i].ctx);
+	talloc_free(threads);
+
+	return 0;
+}
+
 /**
  *
  * @hidecallgraph
@@ -1127,7 +1566,7 @@ int main(int argc, char **argv)
 	};
 
 
-	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:P:r:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46c:C:d:D:f:Fhi:j:l:L:N:P:r:sS:t:T:vx")) != -1) switch (c) {
 		case '4':
 			fd_config.dst_ipaddr.af = AF_INET;
 			break;
@@ -1222,6 +1661,35 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'j':
+			load_json = optarg;
+			break;
+
+		case 'l':
+			if ((fr_time_delta_from_str(&load_duration, optarg, strlen(optarg), FR_TIME_RES_SEC) < 0) ||
+			    !fr_time_delta_ispos(load_duration)) {
+				fr_perror("Failed parsing load test duration");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			break;
+
+		case 'L':
+		{
+			char *end;
+
+			load_rate_start = load_rate_end = strtod(optarg, &end);
+			if (*end == ':') load_rate_end = strtod(end + 1, &end);
+			if (*end || (load_rate_start < 0) || (load_rate_end < 0) ||
+			    ((load_rate_start == 0) && (load_rate_end == 0))) usage();
+		}
+			break;
+
+		case 'N':
+			if (!isdigit((uint8_t) *optarg)) usage();
+			load_num_sockets = atoi(optarg);
+			if ((load_num_sockets == 0) || (load_num_sockets > 1024)) usage();
+			break;
+
 		case 'P':
 			if (!strcmp(optarg, "tcp")) {
 				fd_config.socket_type = SOCK_STREAM;
@@ -1281,6 +1749,12 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'T':
+			if (!isdigit((uint8_t) *optarg)) usage();
+			load_num_threads = atoi(optarg);
+			if ((load_num_threads == 0) || (load_num_threads > 1024)) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1405,6 +1879,30 @@ int main(int argc, char **argv)
 
 	openssl3_init();
 
+	/*
+	 *	Load tests don't use any of the normal send and
+	 *	receive machinery.
+	 */
+	if ((load_rate_start > 0) || (load_rate_end > 0)) {
+		if (ipproto != IPPROTO_UDP) {
+			ERROR("Load tests are only supported over UDP");
+			fr_exit_now(1);
+		}
+
+		if (fd_config.src_port &&
+		    ((fd_config.src_port + (load_num_threads * load_num_sockets)) > 65536)) {
+			ERROR("Too many sockets for source port %u", fd_config.src_port);
+			fr_exit_now(1);
+		}
+
+		fr_dlist_foreach(&rc_request_list, rc_request_t, this) {
+			if (radclient_sane(this) != 0) fr_exit_now(1);
+		}
+
+		if (load_run() < 0) ret = EXIT_FAILURE;
+		goto done;
+	}
+
 	bio = fr_bio_fd_alloc(autofree, NULL, &fd_config, 0);
 	if (!bio) {
 		ERROR("Failed opening socket: %s", fr_strerror());
@@ -1528,6 +2026,7 @@ int main(int argc, char **argv)
 
 	fr_packet_list_free(packet_list);
 
+done:
 	fr_dlist_talloc_free(&rc_request_list);
 
 	talloc_free(secret);
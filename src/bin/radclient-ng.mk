@@ -2,6 +2,11 @@ TARGET		:= radclient-ng$(E)
 SOURCES		:= radclient-ng.c ${top_srcdir}/src/modules/rlm_mschap/smbdes.c \
 		   ${top_srcdir}/src/modules/rlm_mschap/mschap.c \
 		   ${top_srcdir}/src/lib/server/packet.c \
+		   ${top_srcdir}/src/protocols/radius/bio.c \
+		   ${top_srcdir}/src/protocols/radius/client.c \
+		   ${top_srcdir}/src/protocols/radius/client_tcp.c \
+		   ${top_srcdir}/src/protocols/radius/client_udp.c \
+		   ${top_srcdir}/src/protocols/radius/id.c
 
 TGT_PREREQS	:= libfreeradius-radius$(L) libfreeradius-bio$(L)
 
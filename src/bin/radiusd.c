@@ -32,6 +32,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/dependency.h>
 #include <freeradius-devel/server/map_proc.h>
+#include <freeradius-devel/server/metrics_http.h>
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/radmin.h>
 #include <freeradius-devel/server/state.h>
@@ -787,6 +788,44 @@ int main(int argc, char *argv[])
 	 */
 	radius_pid = getpid();
 
+	/*
+	 *  Start the log writer.  Like the crypto threads,
+	 *  this must be done after forking.
+	 */
+	if (config->log_async) switch (default_log.dst) {
+	case L_DST_FILES:
+	case L_DST_STDOUT:
+	case L_DST_STDERR:
+		if (fr_log_async_start(config->log_async_buffer_size, config->log_async_overflow) < 0) {
+			PERROR("Failed starting async log writer");
+			EXIT_WITH_FAILURE;
+		}
+		default_log.async = true;
+		break;
+
+	default:
+		break;
+	}
+
+	/*
+	 *  Start the metrics exporter.
+	 */
+	if (config->metrics_port && (metrics_http_start(&config->metrics_ipaddr, config->metrics_port) < 0)) {
+		PERROR("Failed starting metrics exporter");
+		EXIT_WITH_FAILURE;
+	}
+
+#ifdef WITH_TLS
+	/*
+	 *  Start the crypto threads.  This must be done after
+	 *  forking, and before any TLS contexts are created.
+	 */
+	if (config->openssl_crypto_threads && (fr_tls_keyop_pool_start(config->openssl_crypto_threads) < 0)) {
+		PERROR("Failed starting crypto threads");
+		EXIT_WITH_FAILURE;
+	}
+#endif
+
 	/*
 	 *	Initialise the interpreter, registering operations.
 	 */
@@ -839,6 +878,7 @@ int main(int argc, char *argv[])
 #define COPY(_x) schedule->worker._x = config->_x
 		COPY(max_requests);
 		COPY(max_request_time);
+		COPY(pair_cache_size);
 
 		/*
 		 *	Single server mode: use the global event list.
@@ -1077,6 +1117,15 @@ cleanup:
 	 */
 	(void) fr_schedule_destroy(&sc);
 
+	/*
+	 *	Write out anything the workers logged, and
+	 *	go back to writing log messages directly.
+	 */
+	fr_log_async_stop();
+	default_log.async = false;
+
+	metrics_http_stop();
+
 	/*
 	 *	Ensure all thread local memory is cleaned up
 	 *	before we start cleaning up global resources.
@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/radmin.h>
 
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/metrics.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/socket.h>
 
@@ -496,6 +497,12 @@ static int cmd_stats_memory(FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_inf
 	return -1;
 }
 
+static int cmd_stats_metrics(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_metrics_print(fp);
+	return 0;
+}
+
 static int cmd_set_debug_level(UNUSED FILE *fp, FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
 {
 	int level = atoi(info->argv[0]);
@@ -994,6 +1001,14 @@ static fr_cmd_table_t cmd_table[] = {
 		.read_only = true,
 	},
 
+	{
+		.parent = "stats",
+		.name = "metrics",
+		.func = cmd_stats_metrics,
+		.help = "Show counters and latency histograms, in Prometheus text format.",
+		.read_only = true,
+	},
+
 	{
 		.parent = "set",
 		.name = "debug",
@@ -35,6 +35,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/conf.h>
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/file.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/pair_legacy.h>
@@ -48,15 +49,34 @@ RCSID("$Id$")
 
 #include "radsniff.h"
 
+#ifdef RS_HAVE_RING
+#  include <stdatomic.h>
+#  include <sys/ioctl.h>
+#  include <sys/mman.h>
+#  include <net/if.h>
+#  include <net/if_arp.h>
+#  include <linux/filter.h>
+#  include <linux/if_ether.h>
+#endif
+
 #define RS_ASSERT(_x) if (!(_x) && !fr_cond_assert(_x)) exit(1)
 
 static rs_t *conf;
-static struct timeval start_pcap = {0, 0};
-static char timestr[50];
 
-static fr_rb_tree_t *request_tree = NULL;
-static fr_rb_tree_t *link_tree = NULL;
+/*
+ *	Per-thread so that ring capture threads can each
+ *	track their own share of the traffic.
+ */
+static _Thread_local struct timeval start_pcap = {0, 0};
+static _Thread_local char timestr[50];
+
+static _Thread_local fr_hash_table_t *request_table = NULL;
+static _Thread_local fr_hash_table_t *link_table = NULL;
+
 static fr_event_list_t *events;
+#ifdef RS_HAVE_RING
+static rs_ring_t *rings = NULL;
+#endif
 static bool cleanup;
 static int packets_count = 1; // Used in '$PATH/${packet}.txt.${count}'
 
@@ -839,6 +859,66 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	fprintf(stdout , "%s\n", buffer);
 }
 
+#ifdef RS_HAVE_RING
+/** Merge the interval stats from each of the ring capture threads
+ *
+ * @param[in] stats	to merge into.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the kernel dropped packets since we last checked.
+ */
+static int rs_ring_stats_merge(rs_stats_t *stats)
+{
+	rs_ring_t	*ring;
+	int		ret = 0;
+
+	for (ring = rings; ring; ring = ring->next) {
+		struct tpacket_stats_v3	tp_stats;
+		socklen_t		len = sizeof(tp_stats);
+		size_t			i;
+
+		/*
+		 *	The kernel resets the counters each time they're read.
+		 */
+		if ((getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &tp_stats, &len) == 0) &&
+		    (tp_stats.tp_drops > 0)) {
+			ERROR("Ring %i dropped %u packets: Buffer exhaustion", ring->num, tp_stats.tp_drops);
+			ret = -1;
+		}
+
+		pthread_mutex_lock(&ring->mutex);
+		for (i = 0; i < NUM_ELEMENTS(stats->exchange); i++) {
+			rs_latency_t	*to = &stats->exchange[i];
+			rs_latency_t	*from = &ring->stats->exchange[i];
+			int		j;
+
+			to->interval.received_total += from->interval.received_total;
+			to->interval.linked_total += from->interval.linked_total;
+			to->interval.unlinked_total += from->interval.unlinked_total;
+			to->interval.reused_total += from->interval.reused_total;
+			to->interval.lost_total += from->interval.lost_total;
+			for (j = 0; j <= RS_RETRANSMIT_MAX; j++) to->interval.rt_total[j] += from->interval.rt_total[j];
+
+			to->interval.latency_total += from->interval.latency_total;
+			if (from->interval.latency_high > to->interval.latency_high) {
+				to->interval.latency_high = from->interval.latency_high;
+			}
+			if (from->interval.latency_low &&
+			    (!to->interval.latency_low || (from->interval.latency_low < to->interval.latency_low))) {
+				to->interval.latency_low = from->interval.latency_low;
+			}
+
+			memset(&from->interval, 0, sizeof(from->interval));
+		}
+
+		if (timercmp(&ring->stats->quiet, &stats->quiet, >)) stats->quiet = ring->stats->quiet;
+		pthread_mutex_unlock(&ring->mutex);
+	}
+
+	return ret;
+}
+#endif
+
 /** Process stats for a single interval
  *
  */
@@ -871,6 +951,15 @@ static void rs_stats_process(fr_event_list_t *el, fr_time_t now_t, void *ctx)
 		}
 	}
 
+#ifdef RS_HAVE_RING
+	if (rs_ring_stats_merge(stats) < 0) {
+		ERROR("Muting stats for the next %i milliseconds", conf->stats.timeout);
+
+		rs_tv_add_ms(&now, conf->stats.timeout, &stats->quiet);
+		goto clear;
+	}
+#endif
+
 	/*
 	 *	Stats temporarily muted
 	 */
@@ -1031,16 +1120,16 @@ static int _request_free(rs_request_t *request)
 	int ret;
 
 	/*
-	 *	If we're attempting to cleanup the request, and it's no longer in the request_tree
+	 *	If we're attempting to cleanup the request, and it's no longer in the request_table
 	 *	something has gone very badly wrong.
 	 */
-	if (request->in_request_tree) {
-		ret = fr_rb_delete(request_tree, request);
+	if (request->in_request_table) {
+		ret = fr_hash_table_delete(request_table, request);
 		RS_ASSERT(ret);
 	}
 
-	if (request->in_link_tree) {
-		ret = fr_rb_delete(link_tree, request);
+	if (request->in_link_table) {
+		ret = fr_hash_table_delete(link_table, request);
 		RS_ASSERT(ret);
 	}
 
@@ -1149,6 +1238,47 @@ static int8_t rs_packet_cmp(void const *one, void const *two)
 	return fr_packet_cmp(a->expect, b->expect);
 }
 
+/** Hash an IP address, consistently with fr_ipaddr_cmp
+ *
+ */
+static uint32_t rs_ipaddr_hash(fr_ipaddr_t const *ipaddr, uint32_t hash)
+{
+	size_t len = ((ipaddr->prefix + 7) & -8) >> 3;
+
+	hash = fr_hash_update(&ipaddr->af, sizeof(ipaddr->af), hash);
+	hash = fr_hash_update(&ipaddr->prefix, sizeof(ipaddr->prefix), hash);
+
+	switch (ipaddr->af) {
+	case AF_INET:
+		return fr_hash_update(&ipaddr->addr.v4, len, hash);
+
+	case AF_INET6:
+		hash = fr_hash_update(&ipaddr->scope_id, sizeof(ipaddr->scope_id), hash);
+		return fr_hash_update(&ipaddr->addr.v6, len, hash);
+
+	default:
+		return hash;
+	}
+}
+
+/** Hash the fields of the expected packet which rs_packet_cmp compares
+ *
+ */
+static uint32_t rs_packet_hash(void const *one)
+{
+	rs_request_t const		*a = one;
+	fr_radius_packet_t const	*packet = a->expect;
+	uint32_t			hash;
+
+	hash = fr_hash(&packet->id, sizeof(packet->id));
+	hash = fr_hash_update(&packet->socket.fd, sizeof(packet->socket.fd), hash);
+	hash = fr_hash_update(&packet->socket.inet.src_port, sizeof(packet->socket.inet.src_port), hash);
+	hash = fr_hash_update(&packet->socket.inet.dst_port, sizeof(packet->socket.inet.dst_port), hash);
+	hash = rs_ipaddr_hash(&packet->socket.inet.src_ipaddr, hash);
+
+	return rs_ipaddr_hash(&packet->socket.inet.dst_ipaddr, hash);
+}
+
 static inline int rs_response_to_pcap(rs_event_t *event, rs_request_t *request, struct pcap_pkthdr const *header,
 				      uint8_t const *data)
 {
@@ -1261,6 +1391,77 @@ static rs_request_t *rs_request_alloc(TALLOC_CTX *ctx)
 
 static const uint8_t zeros[RADIUS_AUTH_VECTOR_LENGTH] = {};
 
+/** Decode the attributes in a packet
+ *
+ * Unless we're printing packets, we only need the attributes used for
+ * filtering, linking and listing.  Decoding is by far the most expensive
+ * part of processing a packet, so skip everything else.
+ *
+ * @param[in] ctx	to allocate pairs in.
+ * @param[out] out	Where to write the decoded pairs.
+ * @param[in] packet	to decode.  Must have been checked with fr_radius_packet_ok().
+ * @param[in] vector	Request authenticator, or NULL if the packet is a request.
+ * @return
+ *	- The length of the packet on success.
+ *	- <0 on failure.
+ */
+static ssize_t rs_decode(TALLOC_CTX *ctx, fr_pair_list_t *out, fr_radius_packet_t *packet, uint8_t const *vector)
+{
+	fr_radius_ctx_t		common_ctx = {};
+	fr_radius_decode_ctx_t	packet_ctx = {};
+	uint8_t const		*attr, *end;
+	ssize_t			slen = 0;
+
+	if (conf->decode_all) {
+		return fr_radius_decode_simple(ctx, out, packet->data, packet->data_len, vector, conf->radius_secret);
+	}
+
+	if (!vector) switch (packet->code) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		vector = packet->data + 4;
+		break;
+
+	default:
+		vector = zeros;
+		break;
+	}
+
+	common_ctx.secret = conf->radius_secret;
+	common_ctx.secret_length = strlen(conf->radius_secret);
+
+	packet_ctx.common = &common_ctx;
+	packet_ctx.tmp_ctx = talloc(ctx, uint8_t);
+	packet_ctx.request_authenticator = vector;
+	packet_ctx.end = packet->data + packet->data_len;
+
+	attr = packet->data + RADIUS_HEADER_LENGTH;
+	end = packet->data + packet->data_len;
+
+	/*
+	 *	fr_radius_packet_ok() has already checked the
+	 *	attribute lengths, so we can just skip over
+	 *	the ones we don't care about.
+	 */
+	while (attr < end) {
+		if (!conf->decode_attr[attr[0]]) {
+			attr += attr[1];
+			continue;
+		}
+
+		slen = fr_radius_decode_pair(ctx, out, attr, end - attr, &packet_ctx);
+		if (slen < 0) break;
+
+		attr += slen;
+		talloc_free_children(packet_ctx.tmp_ctx);
+	}
+	talloc_free(packet_ctx.tmp_ctx);
+
+	if (slen < 0) return slen;
+
+	return packet->data_len;
+}
+
 static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkthdr const *header, uint8_t const *data)
 {
 	rs_stats_t		*stats = event->stats;
@@ -1280,7 +1481,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	bool			response;		/* Was it a response code */
 
 	decode_fail_t		reason;			/* Why we failed decoding the packet */
-	static uint64_t		captured = 0;
+	static _Thread_local uint64_t captured = 0;
 
 	rs_status_t		status = RS_NORMAL;	/* Any special conditions (RTX, Unlinked, ID-Reused) */
 	fr_radius_packet_t	*packet;		/* Current packet were processing */
@@ -1391,7 +1592,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	packet = fr_radius_packet_alloc(conf, false);
+	packet = fr_radius_packet_alloc(event->ctx, false);
 	if (!packet) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1409,16 +1610,20 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 */
 	if (ip) {
 		packet->socket.inet.src_ipaddr.af = AF_INET;
+		packet->socket.inet.src_ipaddr.prefix = 32;
 		packet->socket.inet.src_ipaddr.addr.v4.s_addr = ip->ip_src.s_addr;
 
 		packet->socket.inet.dst_ipaddr.af = AF_INET;
+		packet->socket.inet.dst_ipaddr.prefix = 32;
 		packet->socket.inet.dst_ipaddr.addr.v4.s_addr = ip->ip_dst.s_addr;
 	} else {
 		packet->socket.inet.src_ipaddr.af = AF_INET6;
+		packet->socket.inet.src_ipaddr.prefix = 128;
 		memcpy(packet->socket.inet.src_ipaddr.addr.v6.s6_addr, ip6->ip_src.s6_addr,
 		       sizeof(packet->socket.inet.src_ipaddr.addr.v6.s6_addr));
 
 		packet->socket.inet.dst_ipaddr.af = AF_INET6;
+		packet->socket.inet.dst_ipaddr.prefix = 128;
 		memcpy(packet->socket.inet.dst_ipaddr.addr.v6.s6_addr, ip6->ip_dst.s6_addr,
 		       sizeof(packet->socket.inet.dst_ipaddr.addr.v6.s6_addr));
 	}
@@ -1450,7 +1655,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	{
 		/* look for a matching request and use it for decoding */
 		search.expect = packet;
-		original = fr_rb_find(request_tree, &search);
+		original = fr_hash_table_find(request_table, &search);
 
 		/*
 		 *	Verify this code is allowed
@@ -1492,11 +1697,9 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			if (fr_debug_lvl >= L_DBG_LVL_4) fr_radius_packet_log_hex(&default_log, packet);
 #endif
 
-			ret = fr_radius_decode_simple(packet, &decoded,
-						      packet->data, packet->data_len,
-						      (original && original->expect && original->expect->data) ?
-							original->expect->data + 4 : zeros,
-						      conf->radius_secret);
+			ret = rs_decode(packet, &decoded, packet,
+					(original && original->expect && original->expect->data) ?
+						original->expect->data + 4 : zeros);
 			if (ret < 0) {
 				fr_radius_packet_free(&packet);		/* Also frees vps */
 				REDEBUG("Failed decoding");
@@ -1540,7 +1743,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 			/*
 			 *	Insert a callback to remove the request and response
-			 *	from the tree after the timeout period.
+			 *	from the table after the timeout period.
 			 *	The delay is so we can detect retransmissions.
 			 */
 			original->linked = talloc_steal(original, packet);
@@ -1632,9 +1835,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			FILE *log_fp = fr_log_fp;
 
 			fr_log_fp = NULL;
-			ret = fr_radius_decode_simple(packet, &decoded,
-						      packet->data, packet->data_len, NULL,
-						      conf->radius_secret);
+			ret = rs_decode(packet, &decoded, packet, NULL);
 			fr_log_fp = log_fp;
 
 			if (ret < 0) {
@@ -1673,18 +1874,18 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		}
 
 		/*
-		 *	If we have linking attributes set, attempt to find a request in the linking tree.
+		 *	If we have linking attributes set, attempt to find a request in the link table.
 		 */
 		if (!fr_pair_list_empty(&search.link_vps)) {
 			rs_request_t *tuple;
 
-			original = fr_rb_find(link_tree, &search);
-			tuple = fr_rb_find(request_tree, &search);
+			original = fr_hash_table_find(link_table, &search);
+			tuple = fr_hash_table_find(request_table, &search);
 
 			/*
 			 *	If the packet we matched using attributes is not the same
-			 *	as the packet in the request tree, then we need to clean up
-			 *	the packet in the request tree.
+			 *	as the packet in the request table, then we need to clean up
+			 *	the packet in the request table.
 			 */
 			if (tuple && (original != tuple)) {
 				RS_CLEANUP_NOW(tuple, true);
@@ -1693,7 +1894,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	Detect duplicates using the normal 5-tuple of src/dst ips/ports id
 		 */
 		} else {
-			original = fr_rb_find(request_tree, &search);
+			original = fr_hash_table_find(request_table, &search);
 			if (original && (memcmp(original->expect->vector, packet->vector,
 			    			sizeof(original->expect->vector)) != 0)) {
 				/*
@@ -1743,7 +1944,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 			/* Request may need to be reinserted as the 5 tuple of the response may of changed */
 			if (rs_packet_cmp(original, &search) != 0) {
-				fr_rb_delete(request_tree, original);
+				fr_hash_table_delete(request_table, original);
 			}
 
 			/* replace expected packets and vps */
@@ -1758,7 +1959,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = rs_request_alloc(conf);
+			original = rs_request_alloc(event->ctx);
 			original->id = count;
 			original->in = event->in;
 			original->stats_req = &stats->exchange[packet->code];
@@ -1784,9 +1985,9 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 				fr_pair_list_append(&original->link_vps, &search.link_vps);
 
 				/* We should never have conflicts */
-				ret = fr_rb_insert(link_tree, original);
+				ret = fr_hash_table_insert(link_table, original);
 				RS_ASSERT(ret);
-				original->in_link_tree = true;
+				original->in_link_table = true;
 			}
 
 			/*
@@ -1800,17 +2001,17 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 			}
 		}
 
-		if (!original->in_request_tree) {
+		if (!original->in_request_table) {
 			bool ret;
 
 			/* We should never have conflicts */
-			ret = fr_rb_insert(request_tree, original);
+			ret = fr_hash_table_insert(request_table, original);
 			RS_ASSERT(ret);
-			original->in_request_tree = true;
+			original->in_request_table = true;
 		}
 
 		/*
-		 *	Insert a callback to remove the request from the tree
+		 *	Insert a callback to remove the request from the table
 		 */
 		original->packet->timestamp = fr_time_from_timeval(&header->ts);
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &original->when);
@@ -1924,6 +2125,59 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	}
 }
 
+/** Load a capture file into memory, then process it as fast as possible
+ *
+ * Reading the whole file first means the time we record is only the
+ * time spent decoding and matching packets.
+ */
+static void rs_benchmark_file(fr_event_list_t *el, rs_event_t *event, uint64_t *count)
+{
+	TALLOC_CTX		*ctx;
+	rs_capture_t		*captures = NULL;
+	size_t			num = 0, i;
+	struct pcap_pkthdr	*header;
+	uint8_t const		*data;
+	fr_time_t		start;
+	int			ret;
+
+	/*
+	 *	Requests still reference the packet data until
+	 *	they're cleaned up, so this lives as long as conf.
+	 */
+	MEM(ctx = talloc_new(conf));
+
+	while ((ret = pcap_next_ex(event->in->handle, &header, &data)) == 1) {
+		if ((num % 1024) == 0) MEM(captures = talloc_realloc(ctx, captures, rs_capture_t, num + 1024));
+
+		MEM(captures[num].header = talloc_memdup(ctx, header, sizeof(*header)));
+		MEM(captures[num].data = talloc_memdup(ctx, data, header->caplen));
+		num++;
+	}
+	if (ret == -1) ERROR("Error requesting next packet, got (%i): %s", ret, pcap_geterr(event->in->handle));
+
+	DEBUG("Loaded %zu packets (%s)", num, event->in->name);
+
+	if (conf->stats.interval && (num > 0)) {
+		struct timeval first = captures[0].header->ts;
+
+		rs_install_stats_processor(event->stats, el, NULL, &first, false);
+	}
+
+	start = fr_time();
+	for (i = 0; (i < num) && !fr_event_loop_exiting(el); i++) {
+		fr_time_t now;
+
+		do {
+			now = fr_time_from_timeval(&captures[i].header->ts);
+		} while (fr_event_timer_run(el, &now) == 1);
+
+		rs_packet_process(++(*count), event, captures[i].header, captures[i].data);
+	}
+
+	conf->benchmark.elapsed = fr_time_delta_add(conf->benchmark.elapsed, fr_time_sub(fr_time(), start));
+	conf->benchmark.packets += i;
+}
+
 static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *ctx)
 {
 	static uint64_t		count = 0;	/* Packets seen */
@@ -1955,6 +2209,11 @@ static void rs_got_packet(fr_event_list_t *el, int fd, UNUSED int flags, void *c
 	if ((event->in->type == PCAP_FILE_IN) || (event->in->type == PCAP_STDIO_IN)) {
 		bool stats_started = false;
 
+		if (conf->benchmark.enabled) {
+			rs_benchmark_file(el, event, &count);
+			goto done_file;
+		}
+
 		while (!fr_event_loop_exiting(el)) {
 			fr_time_t now;
 
@@ -2059,6 +2318,51 @@ static int8_t rs_rtx_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
+/** Hash a list of pairs, consistently with fr_pair_list_cmp
+ *
+ */
+static uint32_t rs_pair_list_hash(fr_pair_list_t const *list, uint32_t hash)
+{
+	fr_pair_t *vp;
+
+	for (vp = fr_pair_list_head(list);
+	     vp;
+	     vp = fr_pair_list_next(list, vp)) {
+		uint32_t value;
+
+		hash = fr_hash_update(&vp->da, sizeof(vp->da), hash);
+
+		switch (vp->vp_type) {
+		case FR_TYPE_STRUCTURAL:
+			hash = rs_pair_list_hash(&vp->vp_group, hash);
+			break;
+
+		default:
+			value = fr_value_box_hash(&vp->data);
+			hash = fr_hash_update(&value, sizeof(value), hash);
+			break;
+		}
+	}
+
+	return hash;
+}
+
+/** Hash the fields rs_rtx_cmp compares
+ *
+ */
+static uint32_t rs_rtx_hash(void const *one)
+{
+	rs_request_t const	*a = one;
+	uint32_t		hash;
+
+	hash = fr_hash(&a->expect->code, sizeof(a->expect->code));
+	hash = fr_hash_update(&a->expect->socket.fd, sizeof(a->expect->socket.fd), hash);
+	hash = rs_ipaddr_hash(&a->expect->socket.inet.src_ipaddr, hash);
+	hash = rs_ipaddr_hash(&a->expect->socket.inet.dst_ipaddr, hash);
+
+	return rs_pair_list_hash(&a->link_vps, hash);
+}
+
 static int rs_build_dict_list(fr_dict_attr_t const **out, size_t len, char *list)
 {
 	size_t i = 0;
@@ -2150,26 +2454,407 @@ static int rs_build_event_flags(int *flags, fr_table_num_sorted_t const *map, si
 	return i;
 }
 
-/** Callback for when the request is removed from the request tree
+/** Callback for when the request is removed from the request table
  *
  * @param request being removed.
  */
 static void _unmark_request(void *request)
 {
 	rs_request_t *this = request;
-	this->in_request_tree = false;
+	this->in_request_table = false;
 }
 
-/** Callback for when the request is removed from the link tree
+/** Callback for when the request is removed from the link table
  *
  * @param request being removed.
  */
 static void _unmark_link(void *request)
 {
 	rs_request_t *this = request;
-	this->in_link_tree = false;
+	this->in_link_table = false;
+}
+
+/** Mark the top level attribute containing da as one we need to decode
+ *
+ */
+static void rs_decode_attr_add(fr_dict_attr_t const *da)
+{
+	if (fr_dict_by_da(da) != dict_radius) return;
+
+	while (!fr_dict_attr_is_top_level(da)) {
+		if (!da->parent) return;
+		da = da->parent;
+	}
+
+	if (da->attr <= UINT8_MAX) conf->decode_attr[da->attr] = true;
+}
+
+/** Allocate the tables used to match requests to responses, and to detect retransmissions
+ *
+ * These are per-thread, each ring capture thread calls this for itself.
+ */
+static int rs_tables_alloc(TALLOC_CTX *ctx)
+{
+	if (conf->link_da_num > 0) {
+		link_table = fr_hash_table_talloc_alloc(ctx, rs_request_t, rs_rtx_hash, rs_rtx_cmp, _unmark_link);
+		if (!link_table) {
+			ERROR("Failed creating RTX table");
+			return -1;
+		}
+	}
+
+	request_table = fr_hash_table_talloc_alloc(ctx, rs_request_t, rs_packet_hash, rs_packet_cmp, _unmark_request);
+	if (!request_table) {
+		ERROR("Failed creating request table");
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef RS_HAVE_RING
+/** Process all the blocks the kernel has released to us
+ *
+ */
+static void rs_ring_got_packet(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rs_ring_t	*ring = talloc_get_type_abort(uctx, rs_ring_t);
+	unsigned int	i;
+
+	for (i = 0; i < RS_RING_BLOCKS; i++) {
+		struct tpacket_block_desc	*block;
+		struct tpacket3_hdr		*hdr;
+		uint32_t			j;
+
+		block = (struct tpacket_block_desc *)(ring->map + ((size_t)ring->block * RS_RING_BLOCK_SIZE));
+		if (!(((struct tpacket_block_desc volatile *)block)->hdr.bh1.block_status & TP_STATUS_USER)) break;
+		atomic_thread_fence(memory_order_acquire);
+
+		hdr = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+		for (j = 0; j < block->hdr.bh1.num_pkts; j++) {
+			struct sockaddr_ll		*sll = (struct sockaddr_ll *)((uint8_t *)hdr +
+										  TPACKET_ALIGN(sizeof(*hdr)));
+			struct pcap_pkthdr header = {
+				.ts = { .tv_sec = hdr->tp_sec, .tv_usec = hdr->tp_nsec / 1000 },
+				.caplen = hdr->tp_snaplen,
+				.len = hdr->tp_len
+			};
+
+			/*
+			 *	Same as libpcap, ignore the outgoing copy
+			 *	of packets on loopback, or we'd see every
+			 *	packet twice.
+			 */
+			if (!ring->loopback || (sll->sll_pkttype != PACKET_OUTGOING)) {
+				rs_packet_process(++ring->count, ring->event, &header, (uint8_t *)hdr + hdr->tp_mac);
+			}
+			hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+		}
+
+		/*
+		 *	Hand the block back to the kernel
+		 */
+		atomic_thread_fence(memory_order_release);
+		block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		ring->block = (ring->block + 1) % RS_RING_BLOCKS;
+	}
+}
+
+/** Tell a ring capture thread's event loop to exit
+ *
+ */
+static void rs_ring_control(fr_event_list_t *el, int fd, UNUSED int flags, UNUSED void *uctx)
+{
+	char buff;
+
+	if (read(fd, &buff, sizeof(buff)) < 0) ERROR("Failed reading from control pipe: %s", fr_syserror(errno));
+
+	fr_event_loop_exit(el, 1);
+}
+
+/** Run the event loop for a single ring
+ *
+ * Everything which touches the thread's stats runs while holding the
+ * ring's mutex, so the main thread can merge them safely.
+ */
+static void *rs_ring_thread(void *arg)
+{
+	rs_ring_t	*ring = arg;
+
+	if (rs_tables_alloc(ring->event->ctx) < 0) return NULL;
+
+	while (!fr_event_loop_exiting(ring->el)) {
+		if (fr_event_corral(ring->el, fr_time(), true) < 0) break;
+
+		pthread_mutex_lock(&ring->mutex);
+		fr_event_service(ring->el);
+		pthread_mutex_unlock(&ring->mutex);
+	}
+
+	/*
+	 *	Free the tables first, so the request destructors
+	 *	don't try to remove themselves from them.
+	 */
+	TALLOC_FREE(link_table);
+	TALLOC_FREE(request_table);
+	TALLOC_FREE(ring->event->ctx);
+
+	return NULL;
+}
+
+static int _rs_ring_free(rs_ring_t *ring)
+{
+	if (ring->map) munmap(ring->map, ring->map_len);
+	if (ring->fd >= 0) close(ring->fd);
+	if (ring->control[0] >= 0) close(ring->control[0]);
+	if (ring->control[1] >= 0) close(ring->control[1]);
+	pthread_mutex_destroy(&ring->mutex);
+
+	return 0;
+}
+
+/** Open an AF_PACKET socket with a TPACKET_V3 receive ring, and join the fanout group
+ *
+ * The filter is attached, and the ring is setup before the socket
+ * is bound, so we never see packets we're not interested in.
+ */
+static int rs_ring_open(rs_ring_t *ring, int ifindex, int group, struct sock_fprog const *filter)
+{
+	int			version = TPACKET_V3;
+	int			fanout = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+	struct tpacket_req3	req = {
+		.tp_block_size = RS_RING_BLOCK_SIZE,
+		.tp_block_nr = RS_RING_BLOCKS,
+		.tp_frame_size = RS_RING_FRAME_SIZE,
+		.tp_frame_nr = (RS_RING_BLOCK_SIZE / RS_RING_FRAME_SIZE) * RS_RING_BLOCKS,
+		.tp_retire_blk_tov = RS_RING_RETIRE_MS
+	};
+	struct sockaddr_ll	sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_ALL),
+		.sll_ifindex = ifindex
+	};
+
+	ring->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (ring->fd < 0) {
+		ERROR("Failed creating AF_PACKET socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		ERROR("Failed setting TPACKET_V3: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+		ERROR("Failed creating capture ring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	ring->map_len = (size_t)req.tp_block_size * req.tp_block_nr;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		ERROR("Failed mapping capture ring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (filter && (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, filter, sizeof(*filter)) < 0)) {
+		ERROR("Failed attaching filter: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (bind(ring->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		ERROR("Failed binding to interface: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (conf->promiscuous) {
+		struct packet_mreq mreq = {
+			.mr_ifindex = ifindex,
+			.mr_type = PACKET_MR_PROMISC
+		};
+
+		if (setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+			ERROR("Failed enabling promiscuous mode: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) < 0) {
+		ERROR("Failed joining fanout group: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Open a capture ring for each thread
+ *
+ * @param[in] in	The interface to capture on.  Only used for its
+ *			name and link layer, it's never opened.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rs_ring_open_all(fr_pcap_t *in)
+{
+	rs_ring_t		**last = &rings;
+	struct ifreq		ifr = {};
+	struct bpf_program	bpf = {};
+	struct sock_fprog	fprog;
+	pcap_t			*dead;
+	unsigned int		ifindex;
+	int			group = getpid() & 0xffff;
+	int			i, ret = -1;
+	bool			loopback = false;
+
+	ifindex = if_nametoindex(in->name);
+	if (!ifindex) {
+		ERROR("Unknown interface \"%s\"", in->name);
+		return -1;
+	}
+
+	/*
+	 *	The rings give us whole frames, so we need the
+	 *	filter in the same form libpcap would apply it.
+	 */
+	in->link_layer = DLT_EN10MB;
+	dead = pcap_open_dead(in->link_layer, UINT16_MAX);
+	if (!dead) {
+		ERROR("Failed allocating filter compiler");
+		return -1;
+	}
+
+	if ((!conf->pcap_filter_vlan ||
+	     (pcap_compile(dead, &bpf, conf->pcap_filter_vlan, 1, PCAP_NETMASK_UNKNOWN) < 0)) &&
+	    (pcap_compile(dead, &bpf, conf->pcap_filter, 1, PCAP_NETMASK_UNKNOWN) < 0)) {
+		ERROR("Failed compiling filter \"%s\": %s", conf->pcap_filter, pcap_geterr(dead));
+		pcap_close(dead);
+		return -1;
+	}
+	pcap_close(dead);
+
+	fprog.len = bpf.bf_len;
+	fprog.filter = (struct sock_filter *)bpf.bf_insns;
+
+	for (i = 0; i < conf->ring_threads; i++) {
+		rs_ring_t *ring;
+
+		MEM(ring = talloc_zero(conf, rs_ring_t));
+		ring->num = i;
+		ring->fd = -1;
+		ring->control[0] = ring->control[1] = -1;
+		pthread_mutex_init(&ring->mutex, NULL);
+		talloc_set_destructor(ring, _rs_ring_free);
+
+		*last = ring;
+		last = &ring->next;
+
+		if (rs_ring_open(ring, ifindex, group, &fprog) < 0) goto finish;
+
+		/*
+		 *	We only decode ethernet frames
+		 */
+		if (i == 0) {
+			strlcpy(ifr.ifr_name, in->name, sizeof(ifr.ifr_name));
+			if (ioctl(ring->fd, SIOCGIFHWADDR, &ifr) < 0) {
+				ERROR("Failed getting hardware type of \"%s\": %s", in->name, fr_syserror(errno));
+				goto finish;
+			}
+
+			if ((ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) && (ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK)) {
+				ERROR("Ring capture is only supported on ethernet interfaces");
+				goto finish;
+			}
+			loopback = (ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK);
+		}
+		ring->loopback = loopback;
+
+		if (pipe(ring->control) < 0) {
+			ERROR("Couldn't open control pipe: %s", fr_syserror(errno));
+			goto finish;
+		}
+
+		MEM(ring->stats = talloc_zero(ring, rs_stats_t));
+		ring->el = fr_event_list_alloc(ring, NULL, NULL);
+		if (!ring->el) {
+			fr_perror("Failed allocating event list");
+			goto finish;
+		}
+
+		MEM(ring->event = talloc_zero(ring, rs_event_t));
+		ring->event->list = ring->el;
+		ring->event->in = in;
+		ring->event->stats = ring->stats;
+		MEM(ring->event->ctx = talloc_new(ring));
+
+		if ((fr_event_fd_insert(ring, ring->el, ring->control[0], rs_ring_control, NULL, NULL, ring) < 0) ||
+		    (fr_event_fd_insert(ring, ring->el, ring->fd, rs_ring_got_packet, NULL, NULL, ring) < 0)) {
+			fr_perror("Failed inserting ring file descriptors");
+			goto finish;
+		}
+	}
+
+	DEBUG("Capturing on %s with %i ring(s)", in->name, conf->ring_threads);
+	ret = 0;
+
+finish:
+	pcap_freecode(&bpf);
+
+	return ret;
 }
 
+/** Start a thread for each ring
+ *
+ * Must be called after daemonizing.
+ */
+static int rs_ring_run(void)
+{
+	rs_ring_t *ring;
+
+	for (ring = rings; ring; ring = ring->next) {
+		int ret;
+
+		ret = pthread_create(&ring->thread, NULL, rs_ring_thread, ring);
+		if (ret != 0) {
+			ERROR("Failed creating ring thread: %s", fr_syserror(ret));
+			return -1;
+		}
+		ring->running = true;
+	}
+
+	return 0;
+}
+
+/** Signal the ring threads to exit, and wait for them
+ *
+ */
+static void rs_ring_stop(void)
+{
+	rs_ring_t *ring;
+
+	for (ring = rings; ring; ring = ring->next) {
+		if (ring->running && (write(ring->control[1], "x", 1) < 0)) {
+			ERROR("Failed signalling ring thread: %s", fr_syserror(errno));
+		}
+	}
+
+	for (ring = rings; ring; ring = ring->next) {
+		if (ring->running) {
+			pthread_join(ring->thread, NULL);
+			ring->running = false;
+		}
+
+		/*
+		 *	Free the event list before the destructor
+		 *	closes the descriptors it's watching.
+		 */
+		TALLOC_FREE(ring->el);
+	}
+}
+#endif
+
 /** Exit the event loop after a given timeout.
  *
  */
@@ -2267,6 +2952,7 @@ static NEVER_RETURNS void usage(int status)
 	fprintf(output, "Usage: radsniff [options][stats options] -- [pcap files]\n");
 	fprintf(output, "options:\n");
 	fprintf(output, "  -a                    List all interfaces available for capture.\n");
+	fprintf(output, "  -B                    Process capture files as fast as possible, and report the packet rate.\n");
 	fprintf(output, "  -c <count>            Number of packets to capture.\n");
 	fprintf(output, "  -C <checksum_type>    Enable checksum validation. (Specify 'udp' or 'radius')\n");
 	fprintf(output, "  -d <raddb>            Set configuration directory (defaults to " RADDBDIR ").\n");
@@ -2285,6 +2971,9 @@ static NEVER_RETURNS void usage(int status)
 	fprintf(output, "  -h                    This help message.\n");
 	fprintf(output, "  -i <interface>        Capture packets from interface (defaults to all if supported).\n");
 	fprintf(output, "  -I <file>             Read packets from <file>\n");
+#ifdef RS_HAVE_RING
+	fprintf(output, "  -j <threads>          Capture with <threads> AF_PACKET rings sharing a fanout group.\n");
+#endif
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
@@ -2384,7 +3073,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((c = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:St:vw:xXW:T:P:N:O:Z:")) != -1) {
+	while ((c = getopt(argc, argv, "ab:Bc:C:d:D:e:Ef:hi:I:j:l:L:mp:P:qr:R:s:St:vw:xXW:T:P:N:O:Z:")) != -1) {
 		switch (c) {
 		case 'a':
 		{
@@ -2425,6 +3114,10 @@ int main(int argc, char *argv[])
 			}
 			break;
 
+		case 'B':
+			conf->benchmark.enabled = true;
+			break;
+
 		/* UDP/RADIUS checksum validation */
 		case 'C':
 			if (strcmp(optarg, "udp") == 0) {
@@ -2460,6 +3153,16 @@ int main(int argc, char *argv[])
 			conf->pcap_filter = optarg;
 			break;
 
+#ifdef RS_HAVE_RING
+		case 'j':
+			conf->ring_threads = atoi(optarg);
+			if ((conf->ring_threads <= 0) || (conf->ring_threads > RS_RING_MAX_THREADS)) {
+				ERROR("Number of ring threads must be between 1 and %i", RS_RING_MAX_THREADS);
+				usage(64);
+			}
+			break;
+#endif
+
 		case 'h':
 			usage(0);	/* never returns */
 
@@ -2647,6 +3350,28 @@ int main(int argc, char *argv[])
 		conf->from_stdin = false;
 	}
 
+	if (conf->benchmark.enabled && !conf->from_file) {
+		ERROR("Benchmarking (-B) requires capture files");
+		usage(64);
+	}
+
+	/*
+	 *	Ring capture threads share the filters and the
+	 *	capture handle, but nothing else.
+	 */
+	if (conf->ring_threads) {
+		if (!conf->from_dev || !in || in->next) {
+			ERROR("Ring capture (-j) requires exactly one interface (-i)");
+			usage(64);
+		}
+
+		if (conf->limit || conf->verify_radius_authenticator || conf->to_file || conf->to_stdout ||
+		    conf->to_output_dir) {
+			ERROR("Ring capture (-j) can't be used with -c, -C radius, -S, -w or -Z");
+			usage(64);
+		}
+	}
+
 	/* Writing to file overrides stdout */
 	if (conf->to_file && conf->to_stdout) {
 		conf->to_stdout = false;
@@ -2692,6 +3417,15 @@ int main(int argc, char *argv[])
 		conf->logger = rs_packet_print_fancy;
 	}
 
+	/*
+	 *	We're measuring how fast we can process packets,
+	 *	not how fast we can print them.
+	 */
+	if (conf->benchmark.enabled) {
+		conf->logger = NULL;
+		conf->print_packet = false;
+	}
+
 #if !defined(HAVE_PCAP_FOPEN_OFFLINE) || !defined(HAVE_PCAP_DUMP_FOPEN)
 	if (conf->from_stdin || conf->to_stdout) {
 		ERROR("PCAP streams not supported");
@@ -2757,12 +3491,6 @@ int main(int argc, char *argv[])
 		if (conf->link_da_num < 0) {
 			usage(64);
 		}
-
-		link_tree = fr_rb_inline_talloc_alloc(conf, rs_request_t, link_node, rs_rtx_cmp, _unmark_link);
-		if (!link_tree) {
-			ERROR("Failed creating RTX tree");
-			goto finish;
-		}
 	}
 
 	if (conf->filter_request) {
@@ -2814,14 +3542,33 @@ int main(int argc, char *argv[])
 	}
 
 	/*
-	 *	Setup the request tree
+	 *	Only printing packets and saving them to files needs
+	 *	every attribute.  Otherwise we just decode the top level
+	 *	attributes we filter, link, or list on.
 	 */
-	request_tree = fr_rb_inline_talloc_alloc(conf, rs_request_t, request_node, rs_packet_cmp, _unmark_request);
-	if (!request_tree) {
-		ERROR("Failed creating request tree");
-		goto finish;
+	if (conf->to_output_dir || (conf->print_packet && !conf->list_attributes && (fr_debug_lvl >= L_DBG_LVL_2))) {
+		conf->decode_all = true;
+	} else {
+		int		i;
+		fr_pair_t	*vp;
+
+		for (i = 0; i < conf->list_da_num; i++) rs_decode_attr_add(conf->list_da[i]);
+		for (i = 0; i < conf->link_da_num; i++) rs_decode_attr_add(conf->link_da[i]);
+
+		for (vp = fr_pair_list_head(&conf->filter_request_vps);
+		     vp;
+		     vp = fr_pair_list_next(&conf->filter_request_vps, vp)) rs_decode_attr_add(vp->da);
+
+		for (vp = fr_pair_list_head(&conf->filter_response_vps);
+		     vp;
+		     vp = fr_pair_list_next(&conf->filter_response_vps, vp)) rs_decode_attr_add(vp->da);
 	}
 
+	/*
+	 *	Setup the request and link tables
+	 */
+	if (rs_tables_alloc(conf) < 0) goto finish;
+
 	/*
 	 *	Get the default capture device
 	 */
@@ -2945,8 +3692,10 @@ int main(int argc, char *argv[])
 
 	/*
 	 *	This actually opens the capture interfaces/files (we just allocated the memory earlier)
+	 *
+	 *	Ring capture threads open their own sockets.
 	 */
-	{
+	if (!conf->ring_threads) {
 		fr_pcap_t *tmp;
 		fr_pcap_t **tmp_p = &tmp;
 
@@ -3072,13 +3821,17 @@ int main(int argc, char *argv[])
 		 */
 		if (conf->stats.interval && conf->from_dev) {
 			now = fr_time_to_timeval(fr_time());
-			rs_install_stats_processor(stats, events, in, &now, false);
+			rs_install_stats_processor(stats, events, conf->ring_threads ? NULL : in, &now, false);
 		}
 
+#ifdef RS_HAVE_RING
+		if (conf->ring_threads && (rs_ring_open_all(in) < 0)) goto finish;
+#endif
+
 		/*
 		 *  Now add fd's for each of the pcap sessions we opened
 		 */
-		for (in_p = in;
+		for (in_p = conf->ring_threads ? NULL : in;
 		     in_p;
 		     in_p = in_p->next) {
 			rs_event_t *event;
@@ -3088,6 +3841,7 @@ int main(int argc, char *argv[])
 			event->in = in_p;
 			event->out = out;
 			event->stats = stats;
+			event->ctx = conf;
 
 			/*
 			 *	kevent() doesn't indicate that the
@@ -3123,7 +3877,7 @@ int main(int argc, char *argv[])
 	/*
 	 *	If we just have the pipe, then exit.
 	 */
-	if (fr_event_list_num_fds(events) == 1) goto finish;
+	if (!conf->ring_threads && (fr_event_list_num_fds(events) == 1)) goto finish;
 
 	/*
 	 *	Do this as late as possible so we can return an error code if something went wrong.
@@ -3142,6 +3896,10 @@ int main(int argc, char *argv[])
 #ifdef SIGQUIT
 	fr_set_signal(SIGQUIT, rs_signal_self);
 #endif
+#ifdef RS_HAVE_RING
+	if (rs_ring_run() < 0) goto finish;
+#endif
+
 	DEBUG2("Entering event loop");
 
 	fr_event_loop(events);	/* Enter the main event loop */
@@ -3151,6 +3909,17 @@ int main(int argc, char *argv[])
 finish:
 	cleanup = true;
 
+#ifdef RS_HAVE_RING
+	rs_ring_stop();
+#endif
+
+	if (conf->benchmark.enabled) {
+		double seconds = fr_time_delta_unwrap(conf->benchmark.elapsed) / (double)NSEC;
+
+		INFO("Processed %" PRIu64 " packets in %.3f seconds (%.0f packets/s)",
+		     conf->benchmark.packets, seconds, (seconds > 0) ? (conf->benchmark.packets / seconds) : 0);
+	}
+
 	if (conf->daemonize) unlink(conf->pidfile);
 
 	/*
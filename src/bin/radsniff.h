@@ -37,6 +37,18 @@ RCSIDH(radsniff_h, "$Id$")
 #  include <collectd/client.h>
 #endif
 
+/*
+ *	AF_PACKET TPACKET_V3 rings with fanout, for capturing at
+ *	rates libpcap can't keep up with.
+ */
+#ifdef HAVE_LINUX_IF_PACKET_H
+#  include <linux/if_packet.h>
+#  if defined(TPACKET3_HDRLEN) && defined(PACKET_FANOUT)
+#    define RS_HAVE_RING 1
+#    include <pthread.h>
+#  endif
+#endif
+
 #define RS_DEFAULT_PREFIX	"radsniff"	//!< Default instance
 #define RS_DEFAULT_SECRET	"testing123"	//!< Default secret
 #define RS_DEFAULT_TIMEOUT	5200		//!< Standard timeout of 5s + 300ms to cover network latency
@@ -44,6 +56,11 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_RING_MAX_THREADS	64		//!< Maximum number of ring capture threads.
+#define RS_RING_BLOCK_SIZE	(1 << 22)	//!< Size of each block in a capture ring.
+#define RS_RING_BLOCKS		16		//!< Number of blocks in each capture ring.
+#define RS_RING_FRAME_SIZE	2048		//!< Nominal frame size, only used to size the ring.
+#define RS_RING_RETIRE_MS	10		//!< Hand a partially filled block to userland after this long.
 
 /*
  *	Logging macros
@@ -212,10 +229,8 @@ typedef struct {
 							//!< ignore stats about packet loss.
 
 
-	fr_rb_node_t		request_node;
-	fr_rb_node_t		link_node;
-	bool			in_request_tree;	//!< Whether the request is currently in the request tree.
-	bool			in_link_tree;		//!< Whether the request is currently in the linked tree.
+	bool			in_request_table;	//!< Whether the request is currently in the request table.
+	bool			in_link_table;		//!< Whether the request is currently in the link table.
 } rs_request_t;
 
 /** Statistic write/print event
@@ -228,8 +243,45 @@ typedef struct {
 	fr_pcap_t		*out;			//!< Where to write output.
 
 	rs_stats_t		*stats;			//!< Where to write stats.
+
+	TALLOC_CTX		*ctx;			//!< Where to allocate packets and requests.
 } rs_event_t;
 
+#ifdef RS_HAVE_RING
+typedef struct rs_ring_s rs_ring_t;
+
+/** One AF_PACKET capture ring, and the thread which decodes packets from it
+ *
+ * Every ring joins the same fanout group, and the kernel hashes each flow
+ * to a ring.  The flow hash is symmetric, so requests and their responses
+ * end up being processed by the same thread.  Each thread has its own
+ * event list, request tables and stats.  The main thread merges the stats.
+ */
+struct rs_ring_s {
+	int			num;			//!< Thread number.
+	pthread_t		thread;			//!< Thread decoding packets from this ring.
+	bool			running;		//!< Whether the thread has been started.
+	int			fd;			//!< AF_PACKET socket.
+	int			control[2];		//!< Pipe used to tell the thread to exit.
+
+	uint8_t			*map;			//!< The mmapped ring.
+	size_t			map_len;		//!< Length of the ring.
+	unsigned int		block;			//!< Next block we expect the kernel to release to us.
+	bool			loopback;		//!< Capturing on loopback, where the kernel gives
+							//!< us both the outgoing and incoming copy of a packet.
+	uint64_t		count;			//!< Packets processed by this thread.
+
+	fr_event_list_t		*el;			//!< Event list for request cleanup timers.
+	rs_event_t		*event;			//!< Passed to the packet processor.
+
+	pthread_mutex_t		mutex;			//!< Held while processing packets and timers,
+							//!< and while the main thread merges stats.
+	rs_stats_t		*stats;			//!< Stats for this thread.
+
+	rs_ring_t		*next;			//!< Next ring.
+};
+#endif
+
 typedef struct rs_update rs_update_t;
 
 /** Callback for printing stats header.
@@ -302,9 +354,21 @@ struct rs {
 	rs_status_t		event_flags;		//!< Events we log and capture on.
 	rs_packet_logger_t	logger;			//!< Packet logger
 
+	bool			decode_all;		//!< Decode every attribute, not just the ones in decode_attr.
+	bool			decode_attr[UINT8_MAX + 1];	//!< Top level attributes needed for filtering,
+								//!< linking, or listing.
+
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
 
+	int			ring_threads;		//!< Number of AF_PACKET ring capture threads.
+
+	struct {
+		bool			enabled;		//!< Process pcap files as fast as we can.
+		uint64_t		packets;		//!< Packets processed.
+		fr_time_delta_t		elapsed;		//!< Time spent processing them.
+	} benchmark;
+
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
 		stats_out_t		out;			//!< Where to write stats.
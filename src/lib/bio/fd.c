@@ -698,7 +698,7 @@ static ssize_t fr_bio_fd_try_connect(fr_bio_fd_t *my)
 	}
 
 	if (rcode < 0) {
-		fr_bio_shutdown(&my->bio);
+		fr_bio_shutdown_intermediate(&my->bio);
 		return fr_bio_error(GENERIC);
 	}
 
@@ -743,7 +743,7 @@ retry:
         }
 
 fail:
-	fr_bio_shutdown(&my->bio);
+	fr_bio_shutdown_intermediate(&my->bio);
         return fr_bio_error(IO);
 }
 
@@ -945,7 +945,7 @@ retry:
 		/*
 		 *	Some other error, it's fatal.
 		 */
-		fr_bio_shutdown(&my->bio);
+		fr_bio_shutdown_intermediate(&my->bio);
 		break;
 	}
 
@@ -1137,7 +1137,7 @@ int fr_bio_fd_connect(fr_bio_t *bio)
 	 */
 	if (getsockopt(my->info.socket.fd, SOL_SOCKET, SO_ERROR, (void *)&error, &socklen) < 0) {
 	fail:
-		fr_bio_shutdown(bio);
+		fr_bio_shutdown_intermediate(bio);
 		return fr_bio_error(IO);
 	}
 
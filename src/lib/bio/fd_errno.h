@@ -24,6 +24,6 @@ default:
 	/*
 	 *	Some other error, it's fatal.
 	 */
-	fr_bio_shutdown(&my->bio);
+	fr_bio_shutdown_intermediate(&my->bio);
 	break;
 }
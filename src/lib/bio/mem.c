@@ -328,6 +328,11 @@ static ssize_t fr_bio_mem_read_verify_datagram(fr_bio_t *bio, void *packet_ctx,
 	 */
 	if (rcode == 0) return 0;
 
+	/*
+	 *	There's no more data to read for now.  That's not an error.
+	 */
+	if (rcode == fr_bio_error(IO_WOULD_BLOCK)) return rcode;
+
 	/*
 	 *	The next bio returned an error.  Whatever it is, it's fatal.  We can read from the memory
 	 *	buffer until it's empty, but we can no longer write to the memory buffer.  Any data written to
@@ -17,6 +17,7 @@
 #include <freeradius-devel/io/base.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/time_tracking.h>
+#include <freeradius-devel/util/metrics.h>
 
 /** Describes a path data takes to/from the wire to/from fr_pair_ts
  *
@@ -50,6 +51,9 @@ struct fr_listen {
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+
+	fr_metric_t		*request_time;		//!< Time from receiving a packet to sending the reply.
+							///< Connected sockets share their parent's.
 };
 
 /**
@@ -1535,8 +1535,8 @@ do_read:
 			/*
 			 *	Look up the allowed networks.
 			 */
-			network = fr_trie_lookup_by_key(inst->networks, &address.socket.inet.src_ipaddr.addr,
-						 address.socket.inet.src_ipaddr.prefix);
+			network = fr_lpm_lookup_by_key(inst->networks_lpm, &address.socket.inet.src_ipaddr.addr,
+						       address.socket.inet.src_ipaddr.prefix);
 			if (!network) {
 				DEBUG3("Source IP %pV is outside of 'allowed' network range",
 				       fr_box_ipaddr(address.socket.inet.src_ipaddr));
@@ -2668,6 +2668,19 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 		inst->app_io->network_get(inst->app_io_instance, &inst->ipproto, &inst->dynamic_clients, &inst->networks);
 	}
 
+	/*
+	 *	The networks don't change after bootstrap, so
+	 *	packets are checked against a compiled copy.
+	 */
+	if (inst->networks) {
+		inst->networks_lpm = fr_lpm_afrom_trie(inst, UNCONST(fr_trie_t *, inst->networks));
+		if (!inst->networks_lpm) {
+			cf_log_perr(inst->app_io_conf, "Failed compiling allowed networks for proto_%s",
+				    inst->app_io->common.name);
+			return -1;
+		}
+	}
+
 	if ((inst->ipproto == IPPROTO_TCP) && !inst->app_io->connection_set) {
 		cf_log_err(inst->app_io_conf, "Missing 'connection set' API for proto_%s", inst->app_io->common.name);
 		return -1;
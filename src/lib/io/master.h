@@ -28,6 +28,7 @@ RCSIDH(master_h, "$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/io/application.h>
+#include <freeradius-devel/util/lpm.h>
 #include <freeradius-devel/util/trie.h>
 #include <freeradius-devel/util/talloc.h>
 
@@ -99,6 +100,7 @@ typedef struct {
 	char const			*transport;			//!< transport, typically name of IP proto
 
 	fr_trie_t const			*networks;     			//!< trie of allowed networks
+	fr_lpm_t const			*networks_lpm;			//!< compiled table of allowed networks, for lookups.
 } fr_io_instance_t;
 
 extern fr_app_io_t fr_master_app_io;
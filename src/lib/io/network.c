@@ -237,6 +237,18 @@ int fr_network_listen_add(fr_network_t *nr, fr_listen_t *li)
 {
 	fr_ring_buffer_t *rb;
 
+	/*
+	 *	Register the metric before the listener is handed
+	 *	to the network thread.
+	 */
+	if (!li->request_time) {
+		li->request_time = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "freeradius_request_duration_seconds",
+						      "Time from receiving a request to sending the reply.",
+						      "server", li->server_cs ? cf_section_name2(li->server_cs) : "",
+						      "listener", li->name ? li->name : "",
+						      NULL);
+	}
+
 	/*
 	 *	Skip a bunch of work if we're already in the network thread.
 	 */
@@ -0,0 +1,950 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/trunk_shared.c
+ * @brief Trunks shared between worker threads.
+ *
+ * Normally every worker thread has its own trunk, and so its own set of
+ * connections to each backend.  Here a small number of I/O threads own
+ * the trunks, and workers pass requests to them through atomic queues.
+ * The number of backend connections then depends on the number of I/O
+ * threads, not on the number of workers.
+ *
+ * The I/O functions which deal with connections (connection_alloc, mux,
+ * demux, cancel, conn_release etc.) run in the I/O thread.  The
+ * request_complete, request_fail and request_free callbacks are passed
+ * back to, and run in, the worker which submitted the request, so they
+ * can resume it.
+ *
+ * Whilst a request is with an I/O thread, the worker must not touch the
+ * request, the preq or the rctx.  The preq must be allocated in the
+ * context of the #fr_trunk_shared_request_t.
+ *
+ * Cancellation is asynchronous.  #fr_trunk_shared_request_signal_cancel
+ * passes the cancellation to the I/O thread and returns immediately.  If
+ * the I/O thread may still be using the request_t, the worker holds it
+ * with #request_hold, so it (and anything allocated in it) isn't freed
+ * until the I/O thread returns the request.  The preq remains valid until
+ * request_free is called for it, which happens with a NULL request_t for
+ * cancelled requests.
+ *
+ * I/O threads are started when the first worker attaches, and stopped
+ * when the last one detaches.
+ *
+ * Only rlm_tacacs_tcp uses shared trunks so far.  The LDAP trunks aren't
+ * shared, as they're created on demand per (URI, identity) from thread
+ * local lookups, including whilst chasing referrals in demux, and all of
+ * that would need to move into the I/O threads.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/atomic_queue.h>
+#include <freeradius-devel/io/trunk_shared.h>
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+/** How long a detaching worker waits for its I/O thread to return its requests
+ *
+ */
+#define TRUNK_SHARED_DETACH_TIMEOUT	fr_time_delta_from_sec(5)
+
+/** Which thread a request is with, and whether it's been cancelled
+ *
+ */
+typedef enum {
+	TRUNK_SHARED_REQUEST_NEW = 0,			//!< In the I/O thread's queue.
+	TRUNK_SHARED_REQUEST_QUEUED,			//!< Enqueued with the I/O thread's trunk.
+	TRUNK_SHARED_REQUEST_DONE,			//!< Released by the trunk, on its way back to the worker.
+	TRUNK_SHARED_REQUEST_CANCEL_NEW,		//!< Cancelled before the I/O thread saw it.
+	TRUNK_SHARED_REQUEST_CANCEL_QUEUED		//!< Cancelled whilst enqueued with the trunk.
+} fr_trunk_shared_request_state_t;
+
+typedef enum {
+	TRUNK_SHARED_RESULT_NONE = 0,
+	TRUNK_SHARED_RESULT_COMPLETE,			//!< Call request_complete.
+	TRUNK_SHARED_RESULT_FAILED			//!< Call request_fail.
+} fr_trunk_shared_result_t;
+
+/** An I/O thread, and the trunk it owns
+ *
+ */
+typedef struct {
+	fr_trunk_shared_t	*shared;		//!< What we belong to.
+	unsigned int		id;			//!< Of this I/O thread.
+
+	pthread_t		thread;			//!< Thread servicing the trunk.
+	bool			running;		//!< Whether the thread has been started.
+	atomic_bool		exiting;		//!< Thread should exit.
+
+	fr_event_list_t		*el;			//!< Used by the I/O thread.
+	fr_event_user_t		*ev;			//!< Triggered when requests are queued.
+	fr_event_user_t		*exit_ev;		//!< Triggered when the thread should exit.
+	atomic_bool		signalled;		//!< Whether ev has been triggered and not yet serviced.
+
+	fr_atomic_queue_t	*aq;			//!< Requests, and cancellations, from workers.
+
+	fr_trunk_t		*trunk;			//!< Owned by this thread.
+	void			*uctx;			//!< Passed to the trunk I/O functions.
+
+	fr_dlist_head_t		overflow;		//!< Requests which couldn't be returned to workers
+							///< because their queues were full.
+	fr_event_timer_t const	*overflow_ev;		//!< Retry returning overflowed requests.
+
+	pthread_mutex_t		mutex;			//!< Protects startup.
+	pthread_cond_t		cond;			//!< Signalled when startup completes.
+	bool			started;		//!< Thread has finished starting.
+	int			start_ret;		//!< Whether the thread started successfully.
+} fr_trunk_shared_io_t;
+
+struct fr_trunk_shared_s {
+	char const		*log_prefix;		//!< Passed to the trunks.
+
+	fr_trunk_io_funcs_t	funcs;			//!< As provided by the caller.
+	fr_trunk_io_funcs_t	io_funcs;		//!< Used by the I/O thread trunks.
+	fr_trunk_conf_t		conf;			//!< Used by the I/O thread trunks.
+
+	fr_trunk_shared_uctx_alloc_t uctx_alloc;	//!< Allocates the uctx for each I/O thread.
+	void			*uctx;			//!< Passed to uctx_alloc.
+
+	fr_trunk_shared_io_t	*io;			//!< Array of I/O threads.
+	uint32_t		num_io;			//!< How many I/O threads there are.
+
+	pthread_mutex_t		mutex;			//!< Protects workers and next_io.
+	uint32_t		workers;		//!< How many workers are attached.
+	uint32_t		next_io;		//!< Used to assign workers to I/O threads.
+};
+
+struct fr_trunk_shared_worker_s {
+	fr_trunk_shared_t	*shared;		//!< What we're attached to.
+	fr_trunk_shared_io_t	*io;			//!< Which I/O thread our requests go to.
+
+	fr_event_list_t		*el;			//!< The worker's event list.
+	fr_event_user_t		*ev;			//!< Triggered when requests are returned.
+	atomic_bool		signalled;		//!< Whether ev has been triggered and not yet serviced.
+
+	fr_atomic_queue_t	*aq;			//!< Requests returned by the I/O thread.
+
+	fr_dlist_head_t		cancelled;		//!< Cancellations which didn't fit in the I/O
+							///< thread's queue.
+	fr_event_timer_t const	*cancel_ev;		//!< Retry passing cancellations to the I/O thread.
+
+	uint64_t		outstanding;		//!< Requests which haven't been returned yet.
+};
+
+struct fr_trunk_shared_request_s {
+	fr_trunk_shared_worker_t *worker;		//!< Which submitted the request.
+	fr_trunk_shared_io_t	*io;			//!< Which is processing the request.
+
+	request_t		*request;		//!< Passed to the trunk.
+	void			*preq;			//!< Passed to the trunk.
+	void			*rctx;			//!< Passed to the trunk.
+
+	_Atomic(fr_trunk_shared_request_state_t) state;	//!< Updated by both threads.
+
+	/** @name Only used by the I/O thread
+	 * @{
+ 	 */
+	fr_dlist_t		entry;			//!< Entry in the overflow list.
+	fr_trunk_request_t	*treq;			//!< Trunk request.
+	bool			freed;			//!< The trunk has freed treq.
+	bool			in_trunk;		//!< Within a trunk call that may free treq.
+	bool			cancel_seen;		//!< Cancellation has been received.
+	fr_trunk_shared_result_t result;		//!< What the trunk told us.
+	fr_trunk_request_state_t failed_state;		//!< State the request was in when it failed.
+	/** @} */
+
+	/** @name Only used by the worker
+	 * @{
+ 	 */
+	bool			cancelled;		//!< The worker has cancelled the request.
+	bool			held;			//!< We hold the request_t until the I/O thread
+							///< returns the request.
+	fr_dlist_t		cancel_entry;		//!< Entry in the worker's list of cancellations.
+	/** @} */
+};
+
+static inline CC_HINT(always_inline) void trunk_shared_io_signal(fr_trunk_shared_io_t *io)
+{
+	if (atomic_exchange(&io->signalled, true)) return;
+
+	(void) fr_event_user_trigger(io->el, io->ev);
+}
+
+static inline CC_HINT(always_inline) void trunk_shared_worker_signal(fr_trunk_shared_worker_t *worker)
+{
+	if (atomic_exchange(&worker->signalled, true)) return;
+
+	(void) fr_event_user_trigger(worker->el, worker->ev);
+}
+
+/** Find the shared request a preq belongs to
+ *
+ */
+static inline CC_HINT(always_inline) fr_trunk_shared_request_t *trunk_shared_request(void *preq)
+{
+	return talloc_get_type_abort(talloc_parent(preq), fr_trunk_shared_request_t);
+}
+
+static void _trunk_shared_io_overflow(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Pass a request back to the worker that submitted it
+ *
+ */
+static void trunk_shared_request_return(fr_trunk_shared_io_t *io, fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_shared_worker_t *worker = sreq->worker;
+
+	if (!fr_dlist_empty(&io->overflow) || !fr_atomic_queue_push(worker->aq, sreq)) {
+		fr_dlist_insert_tail(&io->overflow, sreq);
+		if (!io->overflow_ev) {
+			(void) fr_event_timer_in(NULL, io->el, &io->overflow_ev, fr_time_delta_from_msec(1),
+						 _trunk_shared_io_overflow, io);
+		}
+		return;
+	}
+
+	trunk_shared_worker_signal(worker);
+}
+
+/** Retry returning requests to workers whose queues were full
+ *
+ */
+static void _trunk_shared_io_overflow(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_shared_io_t		*io = uctx;
+	fr_trunk_shared_request_t	*sreq;
+
+	while ((sreq = fr_dlist_head(&io->overflow))) {
+		if (!fr_atomic_queue_push(sreq->worker->aq, sreq)) {
+			(void) fr_event_timer_in(NULL, io->el, &io->overflow_ev, fr_time_delta_from_msec(1),
+						 _trunk_shared_io_overflow, io);
+			return;
+		}
+		fr_dlist_remove(&io->overflow, sreq);
+		trunk_shared_worker_signal(sreq->worker);
+	}
+}
+
+/** The trunk has freed the treq, return the request to the worker if that's safe
+ *
+ * If the worker has cancelled the request, and we've not yet seen the
+ * cancellation, the cancellation is still in our queue and references
+ * the request.  It'll be returned when we process the cancellation.
+ */
+static void trunk_shared_request_done(fr_trunk_shared_io_t *io, fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_shared_request_state_t expected = TRUNK_SHARED_REQUEST_QUEUED;
+
+	if (atomic_compare_exchange_strong(&sreq->state, &expected, TRUNK_SHARED_REQUEST_DONE)) {
+		trunk_shared_request_return(io, sreq);
+		return;
+	}
+
+	fr_assert(expected == TRUNK_SHARED_REQUEST_CANCEL_QUEUED);
+
+	if (sreq->cancel_seen) trunk_shared_request_return(io, sreq);
+}
+
+static void _trunk_shared_request_complete(UNUSED request_t *request, void *preq, UNUSED void *rctx, UNUSED void *uctx)
+{
+	fr_trunk_shared_request_t *sreq = trunk_shared_request(preq);
+
+	sreq->result = TRUNK_SHARED_RESULT_COMPLETE;
+}
+
+static void _trunk_shared_request_fail(UNUSED request_t *request, void *preq, UNUSED void *rctx,
+				       fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	fr_trunk_shared_request_t *sreq = trunk_shared_request(preq);
+
+	sreq->result = TRUNK_SHARED_RESULT_FAILED;
+	sreq->failed_state = state;
+}
+
+static void _trunk_shared_request_free(UNUSED request_t *request, void *preq, UNUSED void *uctx)
+{
+	fr_trunk_shared_request_t *sreq = trunk_shared_request(preq);
+
+	sreq->treq = NULL;
+	sreq->freed = true;
+
+	if (!sreq->in_trunk) trunk_shared_request_done(sreq->io, sreq);
+}
+
+/** Enqueue a request received from a worker with our trunk
+ *
+ */
+static void trunk_shared_request_enqueue(fr_trunk_shared_io_t *io, fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_request_t	*treq;
+
+	treq = fr_trunk_request_alloc(io->trunk, sreq->request);
+	if (!treq) {
+		sreq->result = TRUNK_SHARED_RESULT_FAILED;
+		sreq->failed_state = FR_TRUNK_REQUEST_STATE_UNASSIGNED;
+		sreq->freed = true;
+		trunk_shared_request_done(io, sreq);
+		return;
+	}
+
+	sreq->treq = treq;
+	sreq->in_trunk = true;
+	switch (fr_trunk_request_enqueue(&treq, io->trunk, sreq->request, sreq->preq, sreq->rctx)) {
+	case FR_TRUNK_ENQUEUE_OK:
+	case FR_TRUNK_ENQUEUE_IN_BACKLOG:
+		break;
+
+	default:
+		sreq->result = TRUNK_SHARED_RESULT_FAILED;
+		sreq->failed_state = FR_TRUNK_REQUEST_STATE_UNASSIGNED;
+		fr_trunk_request_free(&treq);
+		break;
+	}
+	sreq->in_trunk = false;
+
+	if (sreq->freed) trunk_shared_request_done(io, sreq);
+}
+
+/** Process requests and cancellations from workers
+ *
+ */
+static void _trunk_shared_io_requests(UNUSED fr_event_list_t *el, void *uctx)
+{
+	fr_trunk_shared_io_t	*io = uctx;
+	void			*ptr;
+
+	/*
+	 *	Clear first, so anything pushed whilst
+	 *	we're draining the queue triggers us again.
+	 */
+	atomic_store(&io->signalled, false);
+
+	while (fr_atomic_queue_pop(io->aq, &ptr)) {
+		fr_trunk_shared_request_t	*sreq = talloc_get_type_abort(ptr, fr_trunk_shared_request_t);
+		fr_trunk_shared_request_state_t	expected = TRUNK_SHARED_REQUEST_NEW;
+
+		if (atomic_compare_exchange_strong(&sreq->state, &expected, TRUNK_SHARED_REQUEST_QUEUED)) {
+			trunk_shared_request_enqueue(io, sreq);
+			continue;
+		}
+
+		switch (expected) {
+		/*
+		 *	Cancelled before we got to it, so we
+		 *	never used the request_t.
+		 */
+		case TRUNK_SHARED_REQUEST_CANCEL_NEW:
+			trunk_shared_request_return(io, sreq);
+			break;
+
+		/*
+		 *	Cancelled after we enqueued it.  This
+		 *	is the second time we've seen this sreq.
+		 */
+		case TRUNK_SHARED_REQUEST_CANCEL_QUEUED:
+			sreq->cancel_seen = true;
+			if (!sreq->freed) {
+				sreq->in_trunk = true;
+				fr_trunk_request_signal_cancel(sreq->treq);
+				sreq->in_trunk = false;
+			}
+
+			/*
+			 *	If the treq is still around it's
+			 *	waiting for the cancel mux, and the
+			 *	request is returned when it's freed.
+			 */
+			if (sreq->freed) trunk_shared_request_done(io, sreq);
+			break;
+
+		default:
+			fr_assert_msg(0, "Bad shared request state %u", expected);
+			break;
+		}
+	}
+}
+
+static void _trunk_shared_io_exit(UNUSED fr_event_list_t *el, void *uctx)
+{
+	fr_trunk_shared_io_t *io = uctx;
+
+	atomic_store(&io->exiting, true);
+}
+
+/** Tell whoever started us whether we managed to allocate our trunk
+ *
+ */
+static void trunk_shared_io_started(fr_trunk_shared_io_t *io, int ret)
+{
+	pthread_mutex_lock(&io->mutex);
+	io->start_ret = ret;
+	io->started = true;
+	pthread_cond_broadcast(&io->cond);
+	pthread_mutex_unlock(&io->mutex);
+}
+
+/** Own a trunk, and service its event list until told to exit
+ *
+ */
+static void *trunk_shared_io_thread(void *arg)
+{
+	fr_trunk_shared_io_t	*io = arg;
+	fr_trunk_shared_t	*shared = io->shared;
+	TALLOC_CTX		*ctx;
+
+	ctx = talloc_init("%s - I/O thread %u", shared->log_prefix, io->id);
+	if (!ctx) {
+	error:
+		trunk_shared_io_started(io, -1);
+		talloc_free(ctx);
+		return NULL;
+	}
+
+	io->el = fr_event_list_alloc(ctx, NULL, NULL);
+	if (!io->el) {
+		PERROR("%s - Failed allocating event list for I/O thread %u", shared->log_prefix, io->id);
+		goto error;
+	}
+
+	if ((fr_event_user_insert(ctx, io->el, &io->ev, false, _trunk_shared_io_requests, io) < 0) ||
+	    (fr_event_user_insert(ctx, io->el, &io->exit_ev, false, _trunk_shared_io_exit, io) < 0)) {
+		PERROR("%s - Failed adding events for I/O thread %u", shared->log_prefix, io->id);
+		goto error;
+	}
+
+	io->aq = fr_atomic_queue_alloc(ctx, FR_TRUNK_SHARED_QUEUE_SIZE);
+	if (!io->aq) {
+		ERROR("%s - Failed allocating queue for I/O thread %u", shared->log_prefix, io->id);
+		goto error;
+	}
+	fr_dlist_init(&io->overflow, fr_trunk_shared_request_t, entry);
+
+	if (shared->uctx_alloc) {
+		io->uctx = shared->uctx_alloc(ctx, io->el, shared->uctx);
+		if (!io->uctx) goto error;
+	}
+
+	io->trunk = fr_trunk_alloc(ctx, io->el, &shared->io_funcs, &shared->conf,
+				   shared->log_prefix, io->uctx, false);
+	if (!io->trunk) {
+		PERROR("%s - Failed allocating trunk for I/O thread %u", shared->log_prefix, io->id);
+		goto error;
+	}
+
+	DEBUG2("%s - I/O thread %u started", shared->log_prefix, io->id);
+	trunk_shared_io_started(io, 0);
+
+	while (!atomic_load(&io->exiting)) {
+		if (fr_event_corral(io->el, fr_time(), true) < 0) break;
+		fr_event_service(io->el);
+	}
+
+	/*
+	 *	All workers have detached, so there are no
+	 *	requests left.  This closes the connections.
+	 */
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+/** Stop all I/O threads
+ *
+ * @note shared->mutex must be held.
+ */
+static void trunk_shared_io_stop(fr_trunk_shared_t *shared)
+{
+	uint32_t i;
+
+	for (i = 0; i < shared->num_io; i++) {
+		fr_trunk_shared_io_t *io = &shared->io[i];
+
+		if (!io->running) continue;
+
+		if (fr_event_user_trigger(io->el, io->exit_ev) < 0) {
+			PERROR("%s - Failed stopping I/O thread %u", shared->log_prefix, io->id);
+			continue;
+		}
+		pthread_join(io->thread, NULL);
+		io->running = false;
+	}
+}
+
+/** Start all I/O threads, waiting until they've allocated their trunks
+ *
+ * @note shared->mutex must be held.
+ */
+static int trunk_shared_io_start(fr_trunk_shared_t *shared)
+{
+	uint32_t i;
+
+	for (i = 0; i < shared->num_io; i++) {
+		fr_trunk_shared_io_t	*io = &shared->io[i];
+		int			ret;
+
+		io->started = false;
+		io->start_ret = -1;
+		atomic_store(&io->exiting, false);
+		atomic_store(&io->signalled, false);
+
+		ret = pthread_create(&io->thread, NULL, trunk_shared_io_thread, io);
+		if (ret != 0) {
+			ERROR("%s - Failed creating I/O thread %u: %s", shared->log_prefix, i, fr_syserror(ret));
+		error:
+			trunk_shared_io_stop(shared);
+			return -1;
+		}
+
+		pthread_mutex_lock(&io->mutex);
+		while (!io->started) pthread_cond_wait(&io->cond, &io->mutex);
+		pthread_mutex_unlock(&io->mutex);
+
+		if (io->start_ret < 0) {
+			pthread_join(io->thread, NULL);
+			goto error;
+		}
+		io->running = true;
+	}
+
+	return 0;
+}
+
+static int _trunk_shared_free(fr_trunk_shared_t *shared)
+{
+	uint32_t i;
+
+	fr_assert_msg(shared->workers == 0, "Shared trunk freed with %u workers attached", shared->workers);
+
+	for (i = 0; i < shared->num_io; i++) {
+		pthread_cond_destroy(&shared->io[i].cond);
+		pthread_mutex_destroy(&shared->io[i].mutex);
+	}
+	pthread_mutex_destroy(&shared->mutex);
+
+	return 0;
+}
+
+/** Allocate a trunk which is shared between workers
+ *
+ * No threads are started until the first worker attaches with
+ * #fr_trunk_shared_worker_alloc.
+ *
+ * @param[in] ctx		to allocate the shared trunk in.
+ * @param[in] funcs		I/O functions, as would be passed to #fr_trunk_alloc.
+ *				request_complete and request_fail are mandatory.
+ * @param[in] conf		trunk configuration.  Applies to each I/O thread's trunk.
+ * @param[in] log_prefix	to prepend to log messages.
+ * @param[in] io_threads	how many I/O threads, and so trunks, to create.
+ * @param[in] uctx_alloc	Called in each I/O thread to allocate the uctx for
+ *				the I/O functions.  May be NULL.
+ * @param[in] uctx		passed to uctx_alloc.
+ * @return
+ *	- A new shared trunk.
+ *	- NULL on error.
+ */
+fr_trunk_shared_t *fr_trunk_shared_alloc(TALLOC_CTX *ctx, fr_trunk_io_funcs_t const *funcs,
+					 fr_trunk_conf_t const *conf, char const *log_prefix,
+					 uint32_t io_threads,
+					 fr_trunk_shared_uctx_alloc_t uctx_alloc, void *uctx)
+{
+	fr_trunk_shared_t	*shared;
+	uint32_t		i;
+
+	if (io_threads == 0) {
+		fr_strerror_const("At least one I/O thread is required");
+		return NULL;
+	}
+
+	if (!funcs->request_complete || !funcs->request_fail) {
+		fr_strerror_const("Shared trunks require request_complete and request_fail functions");
+		return NULL;
+	}
+
+	MEM(shared = talloc_zero(ctx, fr_trunk_shared_t));
+	shared->log_prefix = talloc_strdup(shared, log_prefix);
+
+	shared->funcs = *funcs;
+	shared->io_funcs = *funcs;
+	shared->io_funcs.request_complete = _trunk_shared_request_complete;
+	shared->io_funcs.request_fail = _trunk_shared_request_fail;
+	shared->io_funcs.request_free = _trunk_shared_request_free;
+	shared->conf = *conf;
+
+	shared->uctx_alloc = uctx_alloc;
+	shared->uctx = uctx;
+
+	shared->num_io = io_threads;
+	MEM(shared->io = talloc_zero_array(shared, fr_trunk_shared_io_t, io_threads));
+	for (i = 0; i < io_threads; i++) {
+		shared->io[i].shared = shared;
+		shared->io[i].id = i;
+		pthread_mutex_init(&shared->io[i].mutex, NULL);
+		pthread_cond_init(&shared->io[i].cond, NULL);
+	}
+	pthread_mutex_init(&shared->mutex, NULL);
+	talloc_set_destructor(shared, _trunk_shared_free);
+
+	return shared;
+}
+
+/** Pass returned requests to the callbacks provided by the API client
+ *
+ */
+static void trunk_shared_request_finish(fr_trunk_shared_worker_t *worker, fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_shared_t	*shared = worker->shared;
+	void			*uctx = worker->io->uctx;
+
+	if (!sreq->cancelled) {
+		switch (sreq->result) {
+		case TRUNK_SHARED_RESULT_COMPLETE:
+			shared->funcs.request_complete(sreq->request, sreq->preq, sreq->rctx, uctx);
+			break;
+
+		case TRUNK_SHARED_RESULT_FAILED:
+			shared->funcs.request_fail(sreq->request, sreq->preq, sreq->rctx, sreq->failed_state, uctx);
+			break;
+
+		/*
+		 *	The trunk was freed out from under the request
+		 */
+		case TRUNK_SHARED_RESULT_NONE:
+			shared->funcs.request_fail(sreq->request, sreq->preq, sreq->rctx,
+						   FR_TRUNK_REQUEST_STATE_UNASSIGNED, uctx);
+			break;
+		}
+	}
+
+	if (shared->funcs.request_free) {
+		shared->funcs.request_free(sreq->cancelled ? NULL : sreq->request, sreq->preq, uctx);
+	}
+
+	/*
+	 *	The I/O thread is done with the request_t, so
+	 *	it can be freed if the worker has finished with it.
+	 */
+	if (sreq->held) request_release(sreq->request);
+
+	talloc_free(sreq);
+}
+
+/** Process requests returned by the I/O thread
+ *
+ */
+static void _trunk_shared_worker_responses(UNUSED fr_event_list_t *el, void *uctx)
+{
+	fr_trunk_shared_worker_t	*worker = uctx;
+	void				*ptr;
+
+	atomic_store(&worker->signalled, false);
+
+	while (fr_atomic_queue_pop(worker->aq, &ptr)) {
+		fr_trunk_shared_request_t *sreq = talloc_get_type_abort(ptr, fr_trunk_shared_request_t);
+
+		fr_assert(worker->outstanding > 0);
+		worker->outstanding--;
+
+		trunk_shared_request_finish(worker, sreq);
+	}
+}
+
+/** Stop the I/O threads if the last worker has detached
+ *
+ */
+static void trunk_shared_worker_detach(fr_trunk_shared_t *shared)
+{
+	pthread_mutex_lock(&shared->mutex);
+	if (--shared->workers == 0) trunk_shared_io_stop(shared);
+	pthread_mutex_unlock(&shared->mutex);
+}
+
+/** Wait for the I/O thread to return the worker's requests, then detach
+ *
+ * If they're not returned within #TRUNK_SHARED_DETACH_TIMEOUT, the worker
+ * handle is leaked rather than freed, as the I/O thread may still use it.
+ */
+static int _trunk_shared_worker_free(fr_trunk_shared_worker_t *worker)
+{
+	fr_trunk_shared_t		*shared = worker->shared;
+	fr_trunk_shared_request_t	*sreq;
+	void				*ptr;
+	fr_time_t			deadline = fr_time_add(fr_time(), TRUNK_SHARED_DETACH_TIMEOUT);
+
+	/*
+	 *	Any requests still outstanding were cancelled
+	 *	as the worker exited.  Our event loop has stopped,
+	 *	so pass on any cancellations still waiting for
+	 *	room in the I/O thread's queue, and wait for the
+	 *	I/O thread to return everything.  We can't free
+	 *	our queue until it has.
+	 */
+	if (worker->cancel_ev) fr_event_timer_delete(&worker->cancel_ev);
+	while ((sreq = fr_dlist_head(&worker->cancelled))) {
+		if (!fr_atomic_queue_push(worker->io->aq, sreq)) {
+			if (fr_time_gt(fr_time(), deadline)) goto timeout;
+
+			trunk_shared_io_signal(worker->io);
+			sched_yield();
+			continue;
+		}
+		fr_dlist_remove(&worker->cancelled, sreq);
+	}
+	trunk_shared_io_signal(worker->io);
+
+	while (worker->outstanding > 0) {
+		if (!fr_atomic_queue_pop(worker->aq, &ptr)) {
+			if (fr_time_gt(fr_time(), deadline)) goto timeout;
+
+			sched_yield();
+			continue;
+		}
+		worker->outstanding--;
+
+		sreq = talloc_get_type_abort(ptr, fr_trunk_shared_request_t);
+		if (sreq->held) request_release(sreq->request);
+		talloc_free(sreq);
+	}
+
+	trunk_shared_worker_detach(shared);
+
+	return 0;
+
+timeout:
+	/*
+	 *	The I/O thread may still write to our queue,
+	 *	and to the requests, so neither can be freed.
+	 *	Leak them, but detach anyway, so the I/O
+	 *	threads stop if we're the last worker.
+	 *
+	 *	Moving the handle to the NULL ctx stops talloc
+	 *	from freeing it along with our parent's parent.
+	 */
+	ERROR("%s - Timed out waiting for I/O thread %u to return %" PRIu64 " request(s), leaking them",
+	      shared->log_prefix, worker->io->id, worker->outstanding);
+	talloc_steal(NULL, worker);
+	trunk_shared_worker_detach(shared);
+
+	return -1;
+}
+
+/** Attach a worker to a shared trunk
+ *
+ * Starts the I/O threads if this is the first worker.
+ *
+ * @param[in] ctx	to allocate the worker handle in.  Usually module thread instance data.
+ * @param[in] shared	trunk to attach to.
+ * @param[in] el	the worker's event list.  Requests are returned to the
+ *			worker via this event list.
+ * @return
+ *	- A handle for submitting requests.
+ *	- NULL on error.
+ */
+fr_trunk_shared_worker_t *fr_trunk_shared_worker_alloc(TALLOC_CTX *ctx, fr_trunk_shared_t *shared,
+						       fr_event_list_t *el)
+{
+	fr_trunk_shared_worker_t	*worker;
+
+	MEM(worker = talloc_zero(ctx, fr_trunk_shared_worker_t));
+	worker->shared = shared;
+	worker->el = el;
+
+	fr_dlist_talloc_init(&worker->cancelled, fr_trunk_shared_request_t, cancel_entry);
+
+	worker->aq = fr_atomic_queue_alloc(worker, FR_TRUNK_SHARED_QUEUE_SIZE);
+	if (!worker->aq) {
+		fr_strerror_const("Failed allocating response queue");
+	error:
+		talloc_free(worker);
+		return NULL;
+	}
+
+	if (fr_event_user_insert(worker, el, &worker->ev, false, _trunk_shared_worker_responses, worker) < 0) {
+		fr_strerror_const_push("Failed adding response event");
+		goto error;
+	}
+
+	pthread_mutex_lock(&shared->mutex);
+	if ((shared->workers == 0) && (trunk_shared_io_start(shared) < 0)) {
+		pthread_mutex_unlock(&shared->mutex);
+		fr_strerror_printf("Failed starting I/O threads for %s", shared->log_prefix);
+		goto error;
+	}
+	shared->workers++;
+	worker->io = &shared->io[shared->next_io++ % shared->num_io];
+	pthread_mutex_unlock(&shared->mutex);
+
+	talloc_set_destructor(worker, _trunk_shared_worker_free);
+
+	return worker;
+}
+
+/** Allocate a shared request
+ *
+ * The preq passed to #fr_trunk_shared_request_enqueue must be allocated in
+ * the context of the shared request.
+ *
+ * @param[in] worker	the request is being submitted from.
+ * @param[in] request	to associate with the shared request.
+ * @return
+ *	- A new shared request.
+ *	- NULL on error.
+ */
+fr_trunk_shared_request_t *fr_trunk_shared_request_alloc(fr_trunk_shared_worker_t *worker, request_t *request)
+{
+	fr_trunk_shared_request_t *sreq;
+
+	sreq = talloc_zero(worker, fr_trunk_shared_request_t);
+	if (!sreq) return NULL;
+
+	sreq->worker = worker;
+	sreq->io = worker->io;
+	sreq->request = request;
+	atomic_init(&sreq->state, TRUNK_SHARED_REQUEST_NEW);
+
+	return sreq;
+}
+
+/** Pass a request to the worker's I/O thread
+ *
+ * On success the shared request belongs to the I/O thread until one of the
+ * request_complete or request_fail callbacks is called in this worker,
+ * followed by request_free, after which the shared request is freed.
+ *
+ * On failure the caller should free the shared request.
+ *
+ * @param[in] sreq	to enqueue.
+ * @param[in] preq	Protocol request.  Must be allocated in the context of sreq.
+ * @param[in] rctx	Resume context.
+ * @return
+ *	- FR_TRUNK_ENQUEUE_OK the request was passed to the I/O thread.
+ *	- FR_TRUNK_ENQUEUE_NO_CAPACITY the I/O thread's queue is full.
+ */
+fr_trunk_enqueue_t fr_trunk_shared_request_enqueue(fr_trunk_shared_request_t *sreq, void *preq, void *rctx)
+{
+	fr_trunk_shared_worker_t *worker = sreq->worker;
+
+	fr_assert_msg(talloc_parent(preq) == sreq, "preq must be allocated in the context of the shared request");
+
+	sreq->preq = preq;
+	sreq->rctx = rctx;
+
+	if (!fr_atomic_queue_push(sreq->io->aq, sreq)) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
+	worker->outstanding++;
+
+	trunk_shared_io_signal(sreq->io);
+
+	return FR_TRUNK_ENQUEUE_OK;
+}
+
+static void _trunk_shared_worker_cancel_retry(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Pass a cancellation to the I/O thread
+ *
+ * If the I/O thread's queue is full the cancellation is kept, and retried
+ * from a timer, rather than blocking the worker.
+ */
+static void trunk_shared_cancel_push(fr_trunk_shared_worker_t *worker, fr_trunk_shared_request_t *sreq)
+{
+	if (fr_dlist_empty(&worker->cancelled) && fr_atomic_queue_push(worker->io->aq, sreq)) {
+		trunk_shared_io_signal(worker->io);
+		return;
+	}
+
+	fr_dlist_insert_tail(&worker->cancelled, sreq);
+	trunk_shared_io_signal(worker->io);
+
+	if (!worker->cancel_ev) {
+		(void) fr_event_timer_in(NULL, worker->el, &worker->cancel_ev, fr_time_delta_from_msec(1),
+					 _trunk_shared_worker_cancel_retry, worker);
+	}
+}
+
+/** Retry passing cancellations to an I/O thread whose queue was full
+ *
+ */
+static void _trunk_shared_worker_cancel_retry(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	fr_trunk_shared_worker_t	*worker = uctx;
+	fr_trunk_shared_request_t	*sreq;
+
+	while ((sreq = fr_dlist_head(&worker->cancelled))) {
+		if (!fr_atomic_queue_push(worker->io->aq, sreq)) {
+			(void) fr_event_timer_in(NULL, worker->el, &worker->cancel_ev, fr_time_delta_from_msec(1),
+						 _trunk_shared_worker_cancel_retry, worker);
+			break;
+		}
+		fr_dlist_remove(&worker->cancelled, sreq);
+	}
+
+	trunk_shared_io_signal(worker->io);
+}
+
+/** Cancel a shared request
+ *
+ * Returns immediately.  Neither request_complete nor request_fail will be
+ * called for the request.  request_free will be called, with a NULL
+ * request_t, once the I/O thread returns the request.
+ *
+ * If the I/O thread may still be using the request_t, it's held until
+ * then, so the request_t, and anything allocated in it (such as the
+ * rctx), remain valid even if the worker finishes with the request first.
+ *
+ * @param[in] sreq	to cancel.
+ */
+void fr_trunk_shared_request_signal_cancel(fr_trunk_shared_request_t *sreq)
+{
+	fr_trunk_shared_request_state_t	expected;
+
+	if (sreq->cancelled) return;
+	sreq->cancelled = true;
+
+	/*
+	 *	The I/O thread hasn't seen the request yet,
+	 *	and now won't touch the request_t.
+	 */
+	expected = TRUNK_SHARED_REQUEST_NEW;
+	if (atomic_compare_exchange_strong(&sreq->state, &expected, TRUNK_SHARED_REQUEST_CANCEL_NEW)) return;
+
+	/*
+	 *	The trunk has already released the request.
+	 */
+	if (expected != TRUNK_SHARED_REQUEST_QUEUED) return;
+
+	expected = TRUNK_SHARED_REQUEST_QUEUED;
+	if (!atomic_compare_exchange_strong(&sreq->state, &expected, TRUNK_SHARED_REQUEST_CANCEL_QUEUED)) return;
+
+	/*
+	 *	The I/O thread may be using the request_t right
+	 *	now.  Keep it around until the I/O thread returns
+	 *	the request to _trunk_shared_worker_responses.
+	 */
+	if (sreq->request) {
+		request_hold(sreq->request);
+		sreq->held = true;
+	}
+
+	trunk_shared_cancel_push(sreq->worker, sreq);
+}
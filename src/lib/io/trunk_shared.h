@@ -0,0 +1,77 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/trunk_shared.h
+ * @brief Trunks shared between worker threads.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(trunk_shared_h, "$Id$")
+
+#include <freeradius-devel/server/trunk.h>
+#include <freeradius-devel/util/event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of requests which can be waiting to be passed between threads
+ *
+ * Applies to each I/O thread, and to each worker.
+ */
+#define FR_TRUNK_SHARED_QUEUE_SIZE	(4096)
+
+typedef struct fr_trunk_shared_s fr_trunk_shared_t;
+typedef struct fr_trunk_shared_worker_s fr_trunk_shared_worker_t;
+typedef struct fr_trunk_shared_request_s fr_trunk_shared_request_t;
+
+/** Allocate the uctx passed to the trunk I/O functions of an I/O thread
+ *
+ * Called from within the I/O thread, before its trunk is allocated.
+ *
+ * @param[in] ctx	to allocate the uctx in.  Freed when the I/O thread exits.
+ * @param[in] el	the I/O thread's event list.
+ * @param[in] uctx	passed to #fr_trunk_shared_alloc.
+ * @return
+ *	- The uctx for the trunk.
+ *	- NULL on failure.
+ */
+typedef void *(*fr_trunk_shared_uctx_alloc_t)(TALLOC_CTX *ctx, fr_event_list_t *el, void *uctx);
+
+fr_trunk_shared_t		*fr_trunk_shared_alloc(TALLOC_CTX *ctx, fr_trunk_io_funcs_t const *funcs,
+						       fr_trunk_conf_t const *conf, char const *log_prefix,
+						       uint32_t io_threads,
+						       fr_trunk_shared_uctx_alloc_t uctx_alloc, void *uctx)
+						       CC_HINT(nonnull(2,3,4));
+
+fr_trunk_shared_worker_t	*fr_trunk_shared_worker_alloc(TALLOC_CTX *ctx, fr_trunk_shared_t *shared,
+							      fr_event_list_t *el) CC_HINT(nonnull);
+
+fr_trunk_shared_request_t	*fr_trunk_shared_request_alloc(fr_trunk_shared_worker_t *worker,
+							       request_t *request) CC_HINT(nonnull(1));
+
+fr_trunk_enqueue_t		fr_trunk_shared_request_enqueue(fr_trunk_shared_request_t *sreq,
+								void *preq, void *rctx) CC_HINT(nonnull(1,2));
+
+void				fr_trunk_shared_request_signal_cancel(fr_trunk_shared_request_t *sreq) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
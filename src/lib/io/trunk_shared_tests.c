@@ -0,0 +1,553 @@
+static void test_init(void);
+static void test_free(void);
+#  define TEST_INIT  test_init()
+#  define TEST_FINI  test_free()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/io/trunk_shared.h>
+#include <freeradius-devel/server/connection.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/dict_test.h>
+#include <freeradius-devel/util/misc.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <pthread.h>
+
+#define TEST_REQUESTS	1000
+
+static TALLOC_CTX	*autofree;
+
+typedef struct {
+	pthread_t		worker;			//!< Thread which submitted the requests.
+	bool			wrong_thread;		//!< A callback ran outside of the worker.
+	bool			timeout;		//!< Requests took too long to come back.
+	uint64_t		completed;		//!< Count of requests that completed.
+	uint64_t		failed;			//!< Count of requests that failed.
+	uint64_t		freed;			//!< Count of requests that were freed.
+} test_proto_stats_t;
+
+typedef struct {
+	uint32_t		id;			//!< Written to the socket pair.
+	test_proto_stats_t	*stats;			//!< Updated by the worker callbacks.
+} test_proto_request_t;
+
+/** Per I/O thread state
+ *
+ */
+typedef struct {
+	fr_trunk_request_t	*tracking[TEST_REQUESTS];	//!< Requests which have been sent.
+} test_proto_io_t;
+
+#define DEBUG_LVL_SET if (acutest_verbose_level_ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+/** Write the IDs of all pending requests in one go
+ *
+ * Writing each ID separately would fill the socket buffer
+ * with tiny messages.
+ */
+static void test_mux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_connection_t *conn, void *uctx)
+{
+	test_proto_io_t		*io = uctx;
+	fr_trunk_request_t	*treq;
+	int			fd = *(talloc_get_type_abort(conn->h, int));
+	uint32_t		ids[TEST_REQUESTS];
+	size_t			count = 0;
+	ssize_t			slen;
+
+	while ((count < NUM_ELEMENTS(ids)) && (fr_trunk_connection_pop_request(&treq, tconn) == 0)) {
+		test_proto_request_t	*preq = talloc_get_type_abort(treq->preq, test_proto_request_t);
+
+		ids[count++] = preq->id;
+		io->tracking[preq->id] = treq;
+		fr_trunk_request_signal_sent(treq);
+	}
+	if (!count) return;
+
+	slen = write(fd, ids, count * sizeof(ids[0]));
+	if (slen < (ssize_t)(count * sizeof(ids[0]))) abort();
+}
+
+static void test_demux(UNUSED fr_event_list_t *el, UNUSED fr_trunk_connection_t *tconn, fr_connection_t *conn, void *uctx)
+{
+	test_proto_io_t		*io = uctx;
+	int			fd = *(talloc_get_type_abort(conn->h, int));
+	uint32_t		id;
+	ssize_t			slen;
+
+	for (;;) {
+		fr_trunk_request_t *treq;
+
+		slen = read(fd, &id, sizeof(id));
+		if (slen <= 0) break;
+
+		TEST_CHECK(slen == sizeof(id));
+		TEST_CHECK(id < TEST_REQUESTS);
+
+		/*
+		 *	Cancelled after it was sent
+		 */
+		treq = io->tracking[id];
+		if (!treq) continue;
+		io->tracking[id] = NULL;
+
+		TEST_CHECK(treq->state == FR_TRUNK_REQUEST_STATE_SENT);
+		fr_trunk_request_signal_complete(treq);
+	}
+}
+
+static void _conn_io_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+			   UNUSED int fd_errno, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+
+	fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+}
+
+static void _conn_io_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t *tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_trunk_connection_signal_readable(tconn);
+}
+
+static void _conn_io_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t *tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	fr_trunk_connection_signal_writable(tconn);
+}
+
+static void _conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *conn,
+			 fr_event_list_t *el,
+			 fr_trunk_connection_event_t notify_on, UNUSED void *uctx)
+{
+	int fd = *(talloc_get_type_abort(conn->h, int));
+
+	switch (notify_on) {
+	case FR_TRUNK_CONN_EVENT_NONE:
+		fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO);
+		break;
+
+	case FR_TRUNK_CONN_EVENT_READ:
+		TEST_CHECK(fr_event_fd_insert(conn, el, fd, _conn_io_read, NULL, _conn_io_error, tconn) == 0);
+		break;
+
+	case FR_TRUNK_CONN_EVENT_WRITE:
+		TEST_CHECK(fr_event_fd_insert(conn, el, fd, NULL, _conn_io_write, _conn_io_error, tconn) == 0);
+		break;
+
+	case FR_TRUNK_CONN_EVENT_BOTH:
+		TEST_CHECK(fr_event_fd_insert(conn, el, fd, _conn_io_read, _conn_io_write, _conn_io_error, tconn) == 0);
+		break;
+
+	default:
+		fr_assert(0);
+	}
+}
+
+/** Runs in the I/O thread
+ *
+ */
+static void test_request_cancel(UNUSED fr_connection_t *conn, void *preq,
+				UNUSED fr_trunk_cancel_reason_t reason, void *uctx)
+{
+	test_proto_io_t		*io = uctx;
+	test_proto_request_t	*our_preq = talloc_get_type_abort(preq, test_proto_request_t);
+
+	io->tracking[our_preq->id] = NULL;
+}
+
+/** Runs in the worker
+ *
+ */
+static void test_request_complete(UNUSED request_t *request, void *preq, UNUSED void *rctx, UNUSED void *uctx)
+{
+	test_proto_request_t	*our_preq = talloc_get_type_abort(preq, test_proto_request_t);
+
+	if (!pthread_equal(pthread_self(), our_preq->stats->worker)) our_preq->stats->wrong_thread = true;
+	our_preq->stats->completed++;
+}
+
+static void test_request_fail(UNUSED request_t *request, void *preq, UNUSED void *rctx,
+			      UNUSED fr_trunk_request_state_t state, UNUSED void *uctx)
+{
+	test_proto_request_t	*our_preq = talloc_get_type_abort(preq, test_proto_request_t);
+
+	if (!pthread_equal(pthread_self(), our_preq->stats->worker)) our_preq->stats->wrong_thread = true;
+	our_preq->stats->failed++;
+}
+
+static void test_request_free(UNUSED request_t *request, void *preq, UNUSED void *uctx)
+{
+	test_proto_request_t	*our_preq = talloc_get_type_abort(preq, test_proto_request_t);
+
+	if (!pthread_equal(pthread_self(), our_preq->stats->worker)) our_preq->stats->wrong_thread = true;
+	our_preq->stats->freed++;
+}
+
+/** Whenever the second socket in a socket pair is readable, read all pending data, and write it back
+ *
+ */
+static void _conn_io_loopback(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	int		*our_h = talloc_get_type_abort(uctx, int);
+	uint8_t		buff[4096];
+	ssize_t		slen;
+
+	fr_assert(fd == our_h[1]);
+
+	while (true) {
+		slen = read(fd, buff, sizeof(buff));
+		if (slen <= 0) return;
+
+		if (write(our_h[1], buff, (size_t)slen) < slen) abort();
+	}
+}
+
+static void _conn_close(UNUSED fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	int *our_h = talloc_get_type_abort(h, int);
+
+	talloc_free_children(our_h);	/* Clear the IO handlers */
+
+	close(our_h[0]);
+	close(our_h[1]);
+
+	talloc_free(our_h);
+}
+
+static fr_connection_state_t _conn_open(fr_event_list_t *el, void *h, UNUSED void *uctx)
+{
+	int *our_h = talloc_get_type_abort(h, int);
+
+	TEST_CHECK(fr_event_fd_insert(our_h, el, our_h[1], _conn_io_loopback, NULL, NULL, our_h) == 0);
+
+	return FR_CONNECTION_STATE_CONNECTED;
+}
+
+static fr_connection_state_t _conn_init(void **h_out, fr_connection_t *conn, UNUSED void *uctx)
+{
+	int *h;
+
+	h = talloc_array(conn, int, 2);
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, h) < 0) return FR_CONNECTION_STATE_FAILED;
+
+	fr_nonblock(h[0]);
+	fr_nonblock(h[1]);
+	fr_connection_signal_on_fd(conn, h[0]);
+	*h_out = h;
+
+	return FR_CONNECTION_STATE_CONNECTING;
+}
+
+static fr_connection_t *test_setup_socket_pair_connection_alloc(fr_trunk_connection_t *tconn,
+								fr_event_list_t *el,
+								UNUSED fr_connection_conf_t const *conn_conf,
+								char const *log_prefix, UNUSED void *uctx)
+{
+	return fr_connection_alloc(tconn, el,
+				   &(fr_connection_funcs_t){
+				   	.init = _conn_init,
+				   	.open = _conn_open,
+				   	.close = _conn_close
+				   },
+				   &(fr_connection_conf_t){ 0 },
+				   log_prefix, tconn);
+}
+
+static void *test_io_alloc(TALLOC_CTX *ctx, UNUSED fr_event_list_t *el, UNUSED void *uctx)
+{
+	return talloc_zero(ctx, test_proto_io_t);
+}
+
+static fr_trunk_shared_t *test_setup_shared(TALLOC_CTX *ctx, uint32_t io_threads)
+{
+	fr_trunk_io_funcs_t	io_funcs = {
+					.connection_alloc = test_setup_socket_pair_connection_alloc,
+					.connection_notify = _conn_notify,
+					.request_prioritise = fr_pointer_cmp,
+					.request_mux = test_mux,
+					.request_demux = test_demux,
+					.request_cancel = test_request_cancel,
+					.request_complete = test_request_complete,
+					.request_fail = test_request_fail,
+					.request_free = test_request_free
+				};
+	fr_trunk_conf_t		conf = {
+					.start = 1,
+					.min = 1,
+					.max = 2,
+					.manage_interval = fr_time_delta_from_msec(500)
+				};
+
+	return fr_trunk_shared_alloc(ctx, &io_funcs, &conf, "test_shared", io_threads, test_io_alloc, NULL);
+}
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	fr_dict_t *test_dict;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("trunk_shared_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+static void test_free(void)
+{
+	request_global_free();
+}
+
+static void _test_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	test_proto_stats_t *stats = uctx;
+
+	stats->timeout = true;
+}
+
+/** Service the worker's event list until all requests have been returned
+ *
+ */
+static void test_wait_for_requests(fr_event_list_t *el, test_proto_stats_t *stats)
+{
+	fr_event_timer_t const *ev = NULL;
+
+	TEST_CHECK(fr_event_timer_in(NULL, el, &ev, fr_time_delta_from_sec(10), _test_timeout, stats) == 0);
+
+	while ((stats->freed < TEST_REQUESTS) && !stats->timeout) {
+		if (fr_event_corral(el, fr_time(), true) < 0) break;
+		fr_event_service(el);
+	}
+
+	TEST_CHECK(!stats->timeout);
+	fr_event_timer_delete(&ev);
+}
+
+static fr_trunk_shared_request_t *test_enqueue(fr_trunk_shared_worker_t *worker, request_t *request,
+					       test_proto_stats_t *stats, uint32_t id)
+{
+	fr_trunk_shared_request_t	*sreq;
+	test_proto_request_t		*preq;
+
+	sreq = fr_trunk_shared_request_alloc(worker, request);
+	TEST_CHECK(sreq != NULL);
+
+	preq = talloc_zero(sreq, test_proto_request_t);
+	preq->id = id;
+	preq->stats = stats;
+
+	TEST_CHECK(fr_trunk_shared_request_enqueue(sreq, preq, stats) == FR_TRUNK_ENQUEUE_OK);
+
+	return sreq;
+}
+
+static void test_shared_enqueue(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_event_list_t			*el;
+	fr_trunk_shared_t		*shared;
+	fr_trunk_shared_worker_t	*worker;
+	test_proto_stats_t		stats = { .worker = pthread_self() };
+	uint32_t			i;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	shared = test_setup_shared(ctx, 2);
+	TEST_CHECK(shared != NULL);
+
+	worker = fr_trunk_shared_worker_alloc(ctx, shared, el);
+	TEST_CHECK(worker != NULL);
+
+	for (i = 0; i < TEST_REQUESTS; i++) test_enqueue(worker, NULL, &stats, i);
+
+	test_wait_for_requests(el, &stats);
+
+	TEST_CHECK_LEN(stats.completed, TEST_REQUESTS);
+	TEST_CHECK_LEN(stats.failed, 0);
+	TEST_CHECK_LEN(stats.freed, TEST_REQUESTS);
+	TEST_CHECK(!stats.wrong_thread);
+
+	talloc_free(worker);
+	talloc_free(ctx);
+}
+
+static void test_shared_cancel(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_event_list_t			*el;
+	fr_trunk_shared_t		*shared;
+	fr_trunk_shared_worker_t	*worker;
+	test_proto_stats_t		stats = { .worker = pthread_self() };
+	uint32_t			i;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	shared = test_setup_shared(ctx, 1);
+	TEST_CHECK(shared != NULL);
+
+	worker = fr_trunk_shared_worker_alloc(ctx, shared, el);
+	TEST_CHECK(worker != NULL);
+
+	/*
+	 *	Cancel every other request.  Depending on how
+	 *	far the I/O thread has got, they'll be cancelled
+	 *	before they're enqueued with the trunk, whilst
+	 *	they're enqueued, or after they've been released.
+	 */
+	for (i = 0; i < TEST_REQUESTS; i++) {
+		fr_trunk_shared_request_t *sreq;
+
+		sreq = test_enqueue(worker, NULL, &stats, i);
+		if (i & 0x01) fr_trunk_shared_request_signal_cancel(sreq);
+	}
+
+	test_wait_for_requests(el, &stats);
+
+	TEST_CHECK_LEN(stats.completed, TEST_REQUESTS / 2);
+	TEST_CHECK_LEN(stats.failed, 0);
+	TEST_CHECK_LEN(stats.freed, TEST_REQUESTS);
+	TEST_CHECK(!stats.wrong_thread);
+
+	talloc_free(worker);
+	talloc_free(ctx);
+}
+
+static int _test_request_data_free(bool **freed)
+{
+	**freed = true;
+	return 0;
+}
+
+/** Allocate a request, setting freed when it's really freed
+ *
+ */
+static request_t *test_request_alloc(TALLOC_CTX *ctx, bool *freed)
+{
+	request_t	*request;
+	bool		**marker;
+
+	request = request_local_alloc_external(ctx, NULL);
+	MEM(marker = talloc(request, bool *));
+	*marker = freed;
+	*freed = false;
+	talloc_set_destructor(marker, _test_request_data_free);
+
+	return request;
+}
+
+/*
+ *	Requests being finished by the worker before the I/O
+ *	thread has returned the cancelled shared requests.
+ */
+static void test_shared_cancel_hold(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_event_list_t			*el;
+	fr_trunk_shared_t		*shared;
+	fr_trunk_shared_worker_t	*worker;
+	test_proto_stats_t		stats = { .worker = pthread_self() };
+	request_t			*request;
+	bool				freed;
+	uint32_t			i;
+
+	DEBUG_LVL_SET;
+
+	/*
+	 *	Freeing a held request is deferred until the
+	 *	last hold is released.
+	 */
+	request = test_request_alloc(ctx, &freed);
+
+	request_hold(request);
+	request_hold(request);
+	TEST_CHECK(talloc_free(request) < 0);
+	request_release(request);
+	TEST_CHECK(!freed);
+	request_release(request);
+	TEST_CHECK(freed);
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	shared = test_setup_shared(ctx, 1);
+	TEST_CHECK(shared != NULL);
+
+	worker = fr_trunk_shared_worker_alloc(ctx, shared, el);
+	TEST_CHECK(worker != NULL);
+
+	request = test_request_alloc(ctx, &freed);
+
+	/*
+	 *	Cancel everything, and free the request straight
+	 *	away, as the worker would.  The request must not
+	 *	actually be freed until the I/O thread is done with it.
+	 */
+	for (i = 0; i < TEST_REQUESTS; i++) fr_trunk_shared_request_signal_cancel(test_enqueue(worker, request, &stats, i));
+	talloc_free(request);
+
+	test_wait_for_requests(el, &stats);
+
+	TEST_CHECK_LEN(stats.completed, 0);
+	TEST_CHECK_LEN(stats.failed, 0);
+	TEST_CHECK_LEN(stats.freed, TEST_REQUESTS);
+	TEST_CHECK(!stats.wrong_thread);
+	TEST_CHECK(freed);
+
+	talloc_free(worker);
+	talloc_free(ctx);
+}
+
+/*
+ *	Workers detaching whilst they have outstanding requests
+ */
+static void test_shared_detach(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_event_list_t			*el;
+	fr_trunk_shared_t		*shared;
+	fr_trunk_shared_worker_t	*worker;
+	test_proto_stats_t		stats = { .worker = pthread_self() };
+	uint32_t			i;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	shared = test_setup_shared(ctx, 1);
+	TEST_CHECK(shared != NULL);
+
+	/*
+	 *	Attach and detach twice, to check
+	 *	the I/O threads are restarted.
+	 */
+	for (i = 0; i < 2; i++) {
+		uint32_t j;
+
+		worker = fr_trunk_shared_worker_alloc(ctx, shared, el);
+		TEST_CHECK(worker != NULL);
+
+		for (j = 0; j < TEST_REQUESTS; j++) fr_trunk_shared_request_signal_cancel(test_enqueue(worker, NULL, &stats, j));
+
+		talloc_free(worker);
+	}
+
+	TEST_CHECK_LEN(stats.completed, 0);
+	TEST_CHECK_LEN(stats.failed, 0);
+	TEST_CHECK(!stats.wrong_thread);
+
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "Shared - Enqueue",				test_shared_enqueue },
+	{ "Shared - Cancellation",			test_shared_cancel },
+	{ "Shared - Cancellation holds request",	test_shared_cancel_hold },
+	{ "Shared - Detach",				test_shared_detach },
+	{ NULL }
+};
@@ -710,6 +710,7 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 	 */
 	fr_time_elapsed_update(&worker->cpu_time, now, fr_time_add(now, reply->reply.processing_time));
 	fr_time_elapsed_update(&worker->wall_clock, reply->reply.request_time, now);
+	if (reply->listen) fr_metric_observe(reply->listen->request_time, fr_time_sub(now, reply->reply.request_time));
 
 	RDEBUG("Finished request");
 
@@ -1372,6 +1373,16 @@ nomem:
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG_TIME_DELTA(max_request_time, fr_time_delta_from_sec(5), fr_time_delta_from_sec(120));
 
+	/*
+	 *	Pairs freed by this thread are kept for reuse.
+	 *	Each has enough space for a short string value.
+	 */
+	if (worker->config.pair_cache_size &&
+	    (fr_pair_thread_cache_init(worker->config.pair_cache_size, FR_PAIR_CACHE_VALUE_SIZE) < 0)) {
+		talloc_free(worker);
+		return NULL;
+	}
+
 	worker->channel = talloc_zero_array(worker, fr_worker_channel_t, worker->config.max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
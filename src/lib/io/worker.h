@@ -66,6 +66,8 @@ typedef struct {
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
 
 	size_t		talloc_pool_size;	//!< for each request
+
+	uint32_t	pair_cache_size;	//!< freed pairs to keep for reuse
 } fr_worker_config_t;
 
 fr_worker_t	*fr_worker_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const *name,
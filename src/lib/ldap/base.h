@@ -373,6 +373,36 @@ typedef struct {
 	int		count;				//!< Index on next free element.
 } fr_ldap_map_exp_t;
 
+/** In-memory copy of a subset of the directory, fed by LDAP sync
+ *
+ */
+typedef struct fr_ldap_replica_s fr_ldap_replica_t;
+
+/** An attribute of a replicated entry
+ *
+ */
+typedef struct {
+	char const		*name;			//!< Attribute name.
+	struct berval		**values;		//!< NULL terminated array of values.
+} fr_ldap_replica_attr_t;
+
+/** Copy of an entry retrieved from a directory replica
+ *
+ */
+typedef struct {
+	char const		*dn;			//!< DN of the entry, normalised with #fr_ldap_util_normalise_dn.
+	fr_ldap_replica_attr_t	*attrs;			//!< Array of attributes.
+} fr_ldap_replica_entry_t;
+
+/** Result of a replica search
+ *
+ */
+typedef enum {
+	LDAP_REPLICA_UNAVAILABLE = -1,			//!< Replica can't answer the search, ask the directory.
+	LDAP_REPLICA_NOT_FOUND = 0,			//!< Replica is complete and nothing matched.
+	LDAP_REPLICA_FOUND				//!< A single entry matched.
+} fr_ldap_replica_rcode_t;
+
 /** Thread specific structure to manage LDAP trunk connections.
  *
  */
@@ -850,6 +880,10 @@ int		fr_ldap_map_expand(TALLOC_CTX *ctx, fr_ldap_map_exp_t *expanded, request_t
 int		fr_ldap_map_do(request_t *request,
 			       char const *valuepair_attr, fr_ldap_map_exp_t const *expanded, LDAPMessage *entry);
 
+int		fr_ldap_map_do_replica(request_t *request,
+				       char const *valuepair_attr, fr_ldap_map_exp_t const *expanded,
+				       fr_ldap_replica_entry_t const *entry);
+
 /*
  *	connection.c - Connection configuration functions
  */
@@ -961,7 +995,48 @@ int		fr_ldap_referral_next(fr_ldap_thread_t *thread, request_t *request, fr_ldap
  */
 typedef int	(*filter_attr_check_t)(char const *attr, void *uctx);
 
+/** Retrieve the values of an attribute, for filter evaluation
+ *
+ * @param[in] uctx	Source of the values.
+ * @param[in] attr	to retrieve values for.
+ * @return
+ *	- NULL terminated array of values.
+ *	- NULL if the attribute has no values.
+ */
+typedef struct berval **(*fr_ldap_filter_values_t)(void *uctx, char const *attr);
+
 fr_slen_t	fr_ldap_filter_parse(TALLOC_CTX *ctx, fr_dlist_head_t **root, fr_sbuff_t *filter,
 		filter_attr_check_t attr_check, void *uctx);
 
 bool		fr_ldap_filter_eval(fr_dlist_head_t *root, fr_ldap_connection_t *conn, LDAPMessage *msg);
+
+bool		fr_ldap_filter_eval_values(fr_dlist_head_t *root, fr_ldap_filter_values_t get, void *uctx);
+
+/*
+ *	replica.c - In-memory directory replica
+ */
+fr_ldap_replica_t	*fr_ldap_replica_alloc(TALLOC_CTX *ctx, char const *name);
+
+int		fr_ldap_replica_source_add(fr_ldap_replica_t *replica, void const *source,
+					   char const *base_dn, int scope, char const *filter, char const * const *attrs);
+
+int		fr_ldap_replica_index_add(fr_ldap_replica_t *replica, char const *attr);
+
+void		fr_ldap_replica_source_ready(fr_ldap_replica_t *replica, void const *source, bool ready);
+
+bool		fr_ldap_replica_ready(fr_ldap_replica_t *replica);
+
+void		fr_ldap_replica_clear(fr_ldap_replica_t *replica, void const *source);
+
+int		fr_ldap_replica_entry_update(fr_ldap_replica_t *replica, void const *source,
+					     uint8_t const *uuid, size_t uuid_len, LDAP *handle, LDAPMessage *msg);
+
+void		fr_ldap_replica_entry_delete(fr_ldap_replica_t *replica,
+					     uint8_t const *uuid, size_t uuid_len, char const *dn);
+
+struct berval	**fr_ldap_replica_entry_values(void *uctx, char const *attr);
+
+fr_ldap_replica_rcode_t fr_ldap_replica_search(TALLOC_CTX *ctx, fr_ldap_replica_entry_t **out,
+					       fr_ldap_replica_t *replica,
+					       char const *base_dn, int scope, char const *filter,
+					       char const * const *attrs);
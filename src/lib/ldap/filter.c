@@ -362,19 +362,27 @@ fr_slen_t fr_ldap_filter_parse(TALLOC_CTX *ctx, fr_dlist_head_t **root, fr_sbuff
 	return ret;
 }
 
-static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *conn, LDAPMessage *msg, int depth);
+/** Where to get attribute values from when evaluating a filter
+ *
+ */
+typedef struct {
+	fr_ldap_filter_values_t	get;			//!< Retrieve the values of an attribute.
+	void			(*free)(struct berval **values);	//!< Free retrieved values, may be NULL.
+	void			*uctx;			//!< Passed to get.
+} ldap_filter_source_t;
+
+static bool ldap_filter_node_eval(ldap_filter_t *node, ldap_filter_source_t const *src, int depth);
 
 /** Evaluate a group of LDAP filters
  *
  * Groups have a logical operator of &, | or !
  *
  * @param[in] group	to evaluate.
- * @param[in] conn	LDAP connection the message being filtered was returned on
- * @param[in] msg	to filter
+ * @param[in] src	of attribute values.
  * @param[in] depth	to indent debug messages, reflecting group nesting
  * @return true or false result of the group evaluation
  */
-static bool ldap_filter_group_eval(ldap_filter_t *group, fr_ldap_connection_t *conn, LDAPMessage *msg, int depth)
+static bool ldap_filter_group_eval(ldap_filter_t *group, ldap_filter_source_t const *src, int depth)
 {
 	ldap_filter_t	*node = NULL;
 	bool		filter_state = false;
@@ -384,10 +392,10 @@ static bool ldap_filter_group_eval(ldap_filter_t *group, fr_ldap_connection_t *c
 	while ((node = fr_dlist_next(&group->children, node))) {
 		switch (node->filter_type) {
 		case LDAP_FILTER_GROUP:
-			filter_state = ldap_filter_group_eval(node, conn, msg, depth);
+			filter_state = ldap_filter_group_eval(node, src, depth);
 			break;
 		case LDAP_FILTER_NODE:
-			filter_state = ldap_filter_node_eval(node, conn, msg, depth);
+			filter_state = ldap_filter_node_eval(node, src, depth);
 			break;
 		}
 
@@ -417,12 +425,11 @@ static bool ldap_filter_group_eval(ldap_filter_t *group, fr_ldap_connection_t *c
 /** Evaluate a single LDAP filter node
  *
  * @param[in] node	to evaluate.
- * @param[in] conn	LDAP connection the message being filtered was returned on.
- * @param[in] msg	to filter.
+ * @param[in] src	of attribute values.
  * @param[in] depth	to indent debug messages, reflecting group nesting.
  * @return true or false result of the node evaluation.
  */
-static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *conn, LDAPMessage *msg, int depth)
+static bool ldap_filter_node_eval(ldap_filter_t *node, ldap_filter_source_t const *src, int depth)
 {
 	struct berval	**values;
 	int		count, i;
@@ -430,11 +437,11 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
 
 	switch (node->filter_type) {
 	case LDAP_FILTER_GROUP:
-		return ldap_filter_group_eval(node, conn, msg, depth);
+		return ldap_filter_group_eval(node, src, depth);
 
 	case LDAP_FILTER_NODE:
 		DEBUG3("%*sEvaluating LDAP filter (%s)", depth, "", node->orig);
-		values = ldap_get_values_len(conn->handle, msg, node->attr);
+		values = src->get(src->uctx, node->attr);
 		count = ldap_count_values_len(values);
 
 		switch (node->op) {
@@ -565,7 +572,7 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
 
 		}
 
-		ldap_value_free_len(values);
+		if (values && src->free) src->free(values);
 	}
 
 	DEBUG3("%*sLDAP filter returns %s", depth, "", (filter_state ? "TRUE" : "FALSE"));
@@ -573,6 +580,18 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
 	return filter_state;
 }
 
+typedef struct {
+	fr_ldap_connection_t	*conn;
+	LDAPMessage		*msg;
+} ldap_filter_msg_t;
+
+static struct berval **ldap_filter_msg_values(void *uctx, char const *attr)
+{
+	ldap_filter_msg_t	*msg = uctx;
+
+	return ldap_get_values_len(msg->conn->handle, msg->msg, attr);
+}
+
 /** Evaluate an LDAP filter
  *
  * @param[in] root	of the LDAP filter to evaluate.
@@ -581,5 +600,29 @@ static bool ldap_filter_node_eval(ldap_filter_t *node, fr_ldap_connection_t *con
  * @return true or false result of the node evaluation.
  */
 bool fr_ldap_filter_eval(fr_dlist_head_t *root, fr_ldap_connection_t *conn, LDAPMessage *msg) {
-	return ldap_filter_node_eval(fr_dlist_head(root), conn, msg, 0);
+	ldap_filter_msg_t	uctx = { .conn = conn, .msg = msg };
+
+	return ldap_filter_node_eval(fr_dlist_head(root),
+				     &(ldap_filter_source_t){
+					.get = ldap_filter_msg_values,
+					.free = ldap_value_free_len,
+					.uctx = &uctx
+				     }, 0);
+}
+
+/** Evaluate an LDAP filter against values from an arbitrary source
+ *
+ * @param[in] root	of the LDAP filter to evaluate.
+ * @param[in] get	callback to retrieve the values of an attribute.
+ *			The values returned are owned by the caller, and are not freed.
+ * @param[in] uctx	passed to get.
+ * @return true or false result of the node evaluation.
+ */
+bool fr_ldap_filter_eval_values(fr_dlist_head_t *root, fr_ldap_filter_values_t get, void *uctx)
+{
+	return ldap_filter_node_eval(fr_dlist_head(root),
+				     &(ldap_filter_source_t){
+					.get = get,
+					.uctx = uctx
+				     }, 0);
 }
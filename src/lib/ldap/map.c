@@ -306,22 +306,19 @@ int fr_ldap_map_expand(TALLOC_CTX *ctx, fr_ldap_map_exp_t *expanded, request_t *
 
 
 /** Convert attribute map into valuepairs
- *
- * Use the attribute map built earlier to convert LDAP values into valuepairs and insert them into whichever
- * list they need to go into.
- *
- * This is *NOT* atomic, but there's no condition for which we should error out...
  *
  * @param[in] request		Current request.
  * @param[in] valuepair_attr	Treat attribute with this name as holding complete AVP definitions.
  * @param[in] expanded		attributes (rhs of map).
- * @param[in] entry		to retrieve attributes from.
+ * @param[in] get		callback to retrieve the values of an attribute.
+ * @param[in] free_values	callback to free retrieved values, may be NULL.
+ * @param[in] uctx		passed to get.
  * @return
  *	- Number of maps successfully applied.
  *	- -1 on failure.
  */
-int fr_ldap_map_do(request_t *request,
-		   char const *valuepair_attr, fr_ldap_map_exp_t const *expanded, LDAPMessage *entry)
+static int ldap_map_do(request_t *request, char const *valuepair_attr, fr_ldap_map_exp_t const *expanded,
+		       fr_ldap_filter_values_t get, void (*free_values)(struct berval **values), void *uctx)
 {
 	map_t const		*map = NULL;
 	unsigned int		total = 0;
@@ -329,7 +326,6 @@ int fr_ldap_map_do(request_t *request,
 
 	fr_ldap_result_t	result;
 	char const		*name;
-	LDAP			*handle = fr_ldap_handle_thread_local();
 
 	while ((map = map_list_next(expanded->maps, map))) {
 		int ret;
@@ -339,7 +335,7 @@ int fr_ldap_map_do(request_t *request,
 		/*
 		 *	Binary safe
 		 */
-		result.values = ldap_get_values_len(handle, entry, name);
+		result.values = get(uctx, name);
 		if (!result.values) {
 			RDEBUG3("Attribute \"%s\" not found in LDAP object", name);
 
@@ -358,7 +354,10 @@ int fr_ldap_map_do(request_t *request,
 		 *	request context
 		 */
 		ret = map_to_request(request, map, fr_ldap_map_getvalue, &result);
-		if (ret == -1) return -1;	/* Fail */
+		if (ret == -1) {
+			if (free_values) free_values(result.values);
+			return -1;	/* Fail */
+		}
 
 		/*
 		 *	How many maps we've processed
@@ -366,7 +365,7 @@ int fr_ldap_map_do(request_t *request,
 		applied++;
 
 	next:
-		ldap_value_free_len(result.values);
+		if (result.values && free_values) free_values(result.values);
 	}
 
 
@@ -378,7 +377,7 @@ int fr_ldap_map_do(request_t *request,
 		struct berval	**values;
 		int		count, i;
 
-		values = ldap_get_values_len(handle, entry, valuepair_attr);
+		values = get(uctx, valuepair_attr);
 		count = ldap_count_values_len(values);
 
 		for (i = 0; i < count; i++) {
@@ -414,8 +413,52 @@ int fr_ldap_map_do(request_t *request,
 			talloc_free(attr);
 			talloc_free(value);
 		}
-		ldap_value_free_len(values);
+		if (values && free_values) free_values(values);
 	}
 
 	return applied;
 }
+
+static struct berval **ldap_map_entry_values(void *uctx, char const *attr)
+{
+	return ldap_get_values_len(fr_ldap_handle_thread_local(), uctx, attr);
+}
+
+/** Convert attribute map into valuepairs
+ *
+ * Use the attribute map built earlier to convert LDAP values into valuepairs and insert them into whichever
+ * list they need to go into.
+ *
+ * This is *NOT* atomic, but there's no condition for which we should error out...
+ *
+ * @param[in] request		Current request.
+ * @param[in] valuepair_attr	Treat attribute with this name as holding complete AVP definitions.
+ * @param[in] expanded		attributes (rhs of map).
+ * @param[in] entry		to retrieve attributes from.
+ * @return
+ *	- Number of maps successfully applied.
+ *	- -1 on failure.
+ */
+int fr_ldap_map_do(request_t *request,
+		   char const *valuepair_attr, fr_ldap_map_exp_t const *expanded, LDAPMessage *entry)
+{
+	return ldap_map_do(request, valuepair_attr, expanded, ldap_map_entry_values, ldap_value_free_len, entry);
+}
+
+/** Convert attribute map into valuepairs, using an entry from a directory replica
+ *
+ * @param[in] request		Current request.
+ * @param[in] valuepair_attr	Treat attribute with this name as holding complete AVP definitions.
+ * @param[in] expanded		attributes (rhs of map).
+ * @param[in] entry		to retrieve attributes from.
+ * @return
+ *	- Number of maps successfully applied.
+ *	- -1 on failure.
+ */
+int fr_ldap_map_do_replica(request_t *request,
+			   char const *valuepair_attr, fr_ldap_map_exp_t const *expanded,
+			   fr_ldap_replica_entry_t const *entry)
+{
+	return ldap_map_do(request, valuepair_attr, expanded, fr_ldap_replica_entry_values, NULL,
+			   UNCONST(fr_ldap_replica_entry_t *, entry));
+}
@@ -0,0 +1,1045 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/replica.c
+ * @brief In-memory copy of a subset of the directory, kept up to date by LDAP sync.
+ *
+ * proto_ldap_sync applies the changes reported by the directory to a replica,
+ * and rlm_ldap can then answer searches from the replica with no network I/O.
+ *
+ * Replicas are identified by name, and are shared between all threads, and
+ * between all the listeners and modules which reference them.  A replica may be
+ * fed by several syncs (sources).  It is only used to answer searches once every
+ * source has completed its initial refresh, until then it is "cold" and callers
+ * must go to the directory.
+ *
+ * Entries are found either by DN, or via an index of the values of one of the
+ * configured attributes.
+ *
+ * @copyright 2024 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/ldap/base.h>
+
+#include <pthread.h>
+
+typedef struct ldap_replica_entry_s ldap_replica_entry_t;
+
+/** A sync which feeds entries into the replica
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;				//!< Entry in the list of sources.
+	void const		*source;			//!< Identifies the source.
+	char const		*base_dn;			//!< Normalised base DN the sync retrieves entries from.
+	int			scope;				//!< Scope of the sync.
+	fr_dlist_head_t		*filter;			//!< Parsed filter of the sync, NULL if it
+								///< retrieves every entry within scope.
+	char const		**attrs;			//!< Attributes the source provides.
+	bool			all_attrs;			//!< Source provides all attributes.
+	bool			ready;				//!< Initial refresh has completed.
+} ldap_replica_source_t;
+
+/** Index of the values of an attribute
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;				//!< Entry in the list of indexes.
+	char const		*attr;				//!< Attribute whose values are indexed.
+	fr_rb_tree_t		*keys;				//!< Distinct values of the attribute.
+} ldap_replica_index_t;
+
+/** A distinct (case insensitive) value of an indexed attribute
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;				//!< Entry in the index.
+	char const		*value;				//!< The value.
+	size_t			len;				//!< Length of the value.
+	fr_dlist_head_t		refs;				//!< Entries with this value.
+} ldap_replica_key_t;
+
+/** Links an entry to one of its index keys
+ *
+ */
+typedef struct {
+	fr_dlist_t		key_entry;			//!< Entry in the key's list of entries.
+	fr_dlist_t		entry_entry;			//!< Entry in the entry's list of keys.
+	ldap_replica_index_t	*index;				//!< The key belongs to.
+	ldap_replica_key_t	*key;				//!< The entry is indexed by.
+	ldap_replica_entry_t	*entry;				//!< Indexed entry.
+} ldap_replica_ref_t;
+
+struct ldap_replica_entry_s {
+	fr_ldap_replica_entry_t	pub;				//!< DN and attributes.
+
+	fr_rb_node_t		dn_node;			//!< Entry in the tree of entries by DN.
+	fr_rb_node_t		uuid_node;			//!< Entry in the tree of entries by UUID.
+	uint8_t const		*uuid;				//!< UUID provided by the directory, may be NULL.
+	size_t			uuid_len;			//!< Length of the UUID.
+
+	ldap_replica_source_t	*source;			//!< Which provided the entry.
+	fr_dlist_head_t		refs;				//!< Index keys referencing this entry.
+};
+
+struct fr_ldap_replica_s {
+	fr_rb_node_t		node;				//!< Entry in the tree of replicas.
+	char const		*name;				//!< Of the replica.
+	uint32_t		refs;				//!< How many listeners and modules use the replica.
+								///< Protected by the registry mutex.
+
+	pthread_rwlock_t	lock;				//!< Protects everything below.
+	fr_rb_tree_t		*by_dn;				//!< Entries by DN.
+	fr_rb_tree_t		*by_uuid;			//!< Entries by UUID.
+	fr_dlist_head_t		indexes;			//!< Indexes of attribute values.
+	fr_dlist_head_t		sources;			//!< Syncs feeding the replica.
+};
+
+static pthread_mutex_t	replica_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_rb_tree_t	*replica_tree;				//!< Replicas by name.
+
+/** Case insensitive comparison of binary safe values
+ *
+ */
+static int8_t replica_value_cmp(char const *a, size_t a_len, char const *b, size_t b_len)
+{
+	size_t i, len = (a_len < b_len) ? a_len : b_len;
+
+	for (i = 0; i < len; i++) {
+		int8_t ret = CMP(tolower((uint8_t) a[i]), tolower((uint8_t) b[i]));
+		if (ret != 0) return ret;
+	}
+
+	return CMP(a_len, b_len);
+}
+
+static int8_t replica_cmp(void const *one, void const *two)
+{
+	fr_ldap_replica_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->name, b->name), 0);
+}
+
+static int8_t replica_key_cmp(void const *one, void const *two)
+{
+	ldap_replica_key_t const *a = one, *b = two;
+
+	return replica_value_cmp(a->value, a->len, b->value, b->len);
+}
+
+static int8_t replica_dn_cmp(void const *one, void const *two)
+{
+	ldap_replica_entry_t const *a = one, *b = two;
+
+	return CMP(strcasecmp(a->pub.dn, b->pub.dn), 0);
+}
+
+static int8_t replica_uuid_cmp(void const *one, void const *two)
+{
+	ldap_replica_entry_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->uuid_len, b->uuid_len);
+	if (ret != 0) return ret;
+
+	return CMP(memcmp(a->uuid, b->uuid, a->uuid_len), 0);
+}
+
+/** Allocate a normalised copy of a DN
+ *
+ */
+static char *replica_dn_normalise(TALLOC_CTX *ctx, char const *dn)
+{
+	char *out;
+
+	MEM(out = talloc_strdup(ctx, dn));
+	fr_ldap_util_normalise_dn(out, out);
+
+	return out;
+}
+
+static int _replica_free(fr_ldap_replica_t *replica)
+{
+	pthread_rwlock_destroy(&replica->lock);
+
+	return 0;
+}
+
+/** Release a reference to a replica, freeing it if it's no longer used
+ *
+ */
+static int _replica_ref_free(fr_ldap_replica_t **ref)
+{
+	fr_ldap_replica_t *replica = *ref;
+
+	pthread_mutex_lock(&replica_mutex);
+	if (--replica->refs == 0) {
+		fr_rb_remove(replica_tree, replica);
+		talloc_free(replica);
+
+		if (fr_rb_num_elements(replica_tree) == 0) TALLOC_FREE(replica_tree);
+	}
+	pthread_mutex_unlock(&replica_mutex);
+
+	return 0;
+}
+
+/** Find or allocate a replica
+ *
+ * @param[in] ctx	The replica remains available until ctx is freed.
+ * @param[in] name	of the replica.  All callers using the same name share the replica.
+ * @return
+ *	- The replica.
+ *	- NULL on error.
+ */
+fr_ldap_replica_t *fr_ldap_replica_alloc(TALLOC_CTX *ctx, char const *name)
+{
+	fr_ldap_replica_t	*replica, **ref;
+
+	pthread_mutex_lock(&replica_mutex);
+	if (!replica_tree) {
+		replica_tree = fr_rb_inline_talloc_alloc(NULL, fr_ldap_replica_t, node, replica_cmp, NULL);
+		if (!replica_tree) {
+		error:
+			pthread_mutex_unlock(&replica_mutex);
+			fr_strerror_const("Failed allocating LDAP replica");
+			return NULL;
+		}
+	}
+
+	replica = fr_rb_find(replica_tree, &(fr_ldap_replica_t){ .name = name });
+	if (!replica) {
+		MEM(replica = talloc_zero(NULL, fr_ldap_replica_t));
+		replica->name = talloc_strdup(replica, name);
+		if (pthread_rwlock_init(&replica->lock, NULL) != 0) {
+			talloc_free(replica);
+			goto error;
+		}
+		talloc_set_destructor(replica, _replica_free);
+
+		replica->by_dn = fr_rb_inline_talloc_alloc(replica, ldap_replica_entry_t, dn_node, replica_dn_cmp, NULL);
+		replica->by_uuid = fr_rb_inline_talloc_alloc(replica, ldap_replica_entry_t, uuid_node,
+							     replica_uuid_cmp, NULL);
+		if (!replica->by_dn || !replica->by_uuid) {
+			talloc_free(replica);
+			goto error;
+		}
+		fr_dlist_talloc_init(&replica->indexes, ldap_replica_index_t, entry);
+		fr_dlist_talloc_init(&replica->sources, ldap_replica_source_t, entry);
+
+		fr_rb_insert(replica_tree, replica);
+	}
+
+	MEM(ref = talloc(ctx, fr_ldap_replica_t *));
+	*ref = replica;
+	replica->refs++;
+	talloc_set_destructor(ref, _replica_ref_free);
+	pthread_mutex_unlock(&replica_mutex);
+
+	return replica;
+}
+
+/** Whether an attribute is in a NULL terminated list of attributes
+ *
+ */
+static bool replica_attr_in_list(char const * const *attrs, char const *attr)
+{
+	char const * const *p;
+
+	for (p = attrs; *p; p++) if (strcasecmp(*p, attr) == 0) return true;
+
+	return false;
+}
+
+/** Whether every source provides an attribute
+ *
+ * @note Called with the lock held.
+ */
+static bool replica_provides(fr_ldap_replica_t *replica, char const *attr)
+{
+	ldap_replica_source_t *src = NULL;
+
+	while ((src = fr_dlist_next(&replica->sources, src))) {
+		if (src->all_attrs) continue;
+		if (!replica_attr_in_list(src->attrs, attr)) return false;
+	}
+
+	return true;
+}
+
+static ldap_replica_source_t *replica_source_find(fr_ldap_replica_t *replica, void const *source)
+{
+	ldap_replica_source_t *src = NULL;
+
+	while ((src = fr_dlist_next(&replica->sources, src))) if (src->source == source) return src;
+
+	return NULL;
+}
+
+/** Register a sync which will feed entries into the replica
+ *
+ * The base DN, scope and filter determine which searches the replica can
+ * answer authoritatively.  Searches for entries the sync may not retrieve
+ * are always sent to the directory.
+ *
+ * @param[in] replica	to feed.
+ * @param[in] source	identifies the sync.
+ * @param[in] base_dn	the sync retrieves entries from.
+ * @param[in] scope	of the sync.
+ * @param[in] filter	of the sync, may be NULL.
+ * @param[in] attrs	NULL terminated list of attributes the sync retrieves.
+ *			NULL or "*" mean all attributes.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_source_add(fr_ldap_replica_t *replica, void const *source,
+			       char const *base_dn, int scope, char const *filter, char const * const *attrs)
+{
+	ldap_replica_source_t	*src;
+	fr_dlist_head_t		*root = NULL;
+	size_t			i, count = 0;
+
+	if (filter && *filter &&
+	    (fr_ldap_filter_parse(NULL, &root, &FR_SBUFF_IN(filter, strlen(filter)), NULL, NULL) < 0)) {
+		fr_strerror_printf_push("Failed parsing sync filter \"%s\"", filter);
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&replica->lock);
+	src = replica_source_find(replica, source);
+	if (!src) {
+		MEM(src = talloc_zero(replica, ldap_replica_source_t));
+		src->source = source;
+		fr_dlist_insert_tail(&replica->sources, src);
+	}
+
+	talloc_const_free(src->base_dn);
+	src->base_dn = replica_dn_normalise(src, base_dn);
+	src->scope = scope;
+	TALLOC_FREE(src->filter);
+	if (root) src->filter = talloc_steal(src, root);
+
+	TALLOC_FREE(src->attrs);
+	src->all_attrs = !attrs || replica_attr_in_list(attrs, "*");
+	if (!src->all_attrs) {
+		while (attrs[count]) count++;
+
+		MEM(src->attrs = talloc_array(src, char const *, count + 1));
+		for (i = 0; i < count; i++) src->attrs[i] = talloc_strdup(src->attrs, attrs[i]);
+		src->attrs[count] = NULL;
+	}
+	pthread_rwlock_unlock(&replica->lock);
+
+	return 0;
+}
+
+/** Mark a source as having completed, or needing to repeat, its initial refresh
+ *
+ */
+void fr_ldap_replica_source_ready(fr_ldap_replica_t *replica, void const *source, bool ready)
+{
+	ldap_replica_source_t	*src;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	src = replica_source_find(replica, source);
+	if (src && (src->ready != ready)) {
+		src->ready = ready;
+		DEBUG2("LDAP replica \"%s\" source %s, %u entries", replica->name,
+		       ready ? "ready" : "refreshing", fr_rb_num_elements(replica->by_dn));
+	}
+	pthread_rwlock_unlock(&replica->lock);
+}
+
+/** Whether the replica can answer searches
+ *
+ * @note Called with the lock held.
+ */
+static bool replica_ready(fr_ldap_replica_t *replica)
+{
+	ldap_replica_source_t *src = NULL;
+
+	if (fr_dlist_empty(&replica->sources)) return false;
+
+	while ((src = fr_dlist_next(&replica->sources, src))) if (!src->ready) return false;
+
+	return true;
+}
+
+/** Whether the replica can answer searches
+ *
+ * @param[in] replica	to check.
+ * @return true if every source has completed its initial refresh.
+ */
+bool fr_ldap_replica_ready(fr_ldap_replica_t *replica)
+{
+	bool ready;
+
+	pthread_rwlock_rdlock(&replica->lock);
+	ready = replica_ready(replica);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return ready;
+}
+
+/** Return the values of an attribute of an entry
+ *
+ */
+static struct berval **replica_entry_attr_values(fr_ldap_replica_entry_t const *entry, char const *attr)
+{
+	size_t i, count = talloc_array_length(entry->attrs);
+
+	for (i = 0; i < count; i++) {
+		if (strcasecmp(entry->attrs[i].name, attr) == 0) return entry->attrs[i].values;
+	}
+
+	return NULL;
+}
+
+/** Add an entry's values to an index
+ *
+ * @note Called with the write lock held.
+ */
+static void replica_entry_index(ldap_replica_index_t *index, ldap_replica_entry_t *entry)
+{
+	struct berval		**values = replica_entry_attr_values(&entry->pub, index->attr);
+	ldap_replica_key_t	*key;
+	ldap_replica_ref_t	*ref;
+
+	if (!values) return;
+
+	for (; *values; values++) {
+		key = fr_rb_find(index->keys, &(ldap_replica_key_t){
+					.value = (*values)->bv_val,
+					.len = (*values)->bv_len
+				 });
+		if (!key) {
+			MEM(key = talloc_zero(index, ldap_replica_key_t));
+			key->value = talloc_memdup(key, (*values)->bv_val, (*values)->bv_len);
+			key->len = (*values)->bv_len;
+			fr_dlist_init(&key->refs, ldap_replica_ref_t, key_entry);
+			fr_rb_insert(index->keys, key);
+		} else {
+			/*
+			 *	Values only differing in case, the entry is already indexed.
+			 */
+			ref = fr_dlist_tail(&key->refs);
+			if (ref && (ref->entry == entry)) continue;
+		}
+
+		MEM(ref = talloc_zero(entry, ldap_replica_ref_t));
+		ref->index = index;
+		ref->key = key;
+		ref->entry = entry;
+		fr_dlist_insert_tail(&key->refs, ref);
+		fr_dlist_insert_tail(&entry->refs, ref);
+	}
+}
+
+/** Remove an entry from the indexes and trees, and free it
+ *
+ * @note Called with the write lock held.
+ */
+static void replica_entry_free(fr_ldap_replica_t *replica, ldap_replica_entry_t *entry)
+{
+	ldap_replica_ref_t *ref;
+
+	while ((ref = fr_dlist_pop_head(&entry->refs))) {
+		ldap_replica_key_t *key = ref->key;
+
+		fr_dlist_remove(&key->refs, ref);
+		if (fr_dlist_empty(&key->refs)) {
+			fr_rb_remove(ref->index->keys, key);
+			talloc_free(key);
+		}
+	}
+
+	fr_rb_remove(replica->by_dn, entry);
+	if (entry->uuid) fr_rb_remove(replica->by_uuid, entry);
+	talloc_free(entry);
+}
+
+/** Index the values of an attribute
+ *
+ * Only attributes which have been indexed can be used to find entries,
+ * other than by DN.
+ *
+ * @param[in] replica	to add the index to.
+ * @param[in] attr	whose values should be indexed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_index_add(fr_ldap_replica_t *replica, char const *attr)
+{
+	ldap_replica_index_t	*index = NULL;
+	ldap_replica_entry_t	*entry;
+	fr_rb_iter_inorder_t	iter;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	while ((index = fr_dlist_next(&replica->indexes, index))) {
+		if (strcasecmp(index->attr, attr) == 0) {
+			pthread_rwlock_unlock(&replica->lock);
+			return 0;
+		}
+	}
+
+	MEM(index = talloc_zero(replica, ldap_replica_index_t));
+	index->attr = talloc_strdup(index, attr);
+	index->keys = fr_rb_inline_talloc_alloc(index, ldap_replica_key_t, node, replica_key_cmp, NULL);
+	if (!index->keys) {
+		talloc_free(index);
+		pthread_rwlock_unlock(&replica->lock);
+		fr_strerror_printf("Failed allocating index for \"%s\"", attr);
+		return -1;
+	}
+
+	for (entry = fr_rb_iter_init_inorder(&iter, replica->by_dn);
+	     entry;
+	     entry = fr_rb_iter_next_inorder(&iter)) replica_entry_index(index, entry);
+
+	fr_dlist_insert_tail(&replica->indexes, index);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return 0;
+}
+
+/** Remove all the entries provided by a source
+ *
+ * Used when a sync restarts without a cookie, and the directory will send
+ * every entry again.  The source is no longer ready until its refresh completes.
+ *
+ * @param[in] replica	to remove entries from.
+ * @param[in] source	whose entries should be removed.
+ */
+void fr_ldap_replica_clear(fr_ldap_replica_t *replica, void const *source)
+{
+	ldap_replica_source_t	*src;
+	ldap_replica_entry_t	*entry, **to_free;
+	fr_rb_iter_inorder_t	iter;
+	size_t			i, count = 0;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	src = replica_source_find(replica, source);
+	if (!src) goto done;
+
+	src->ready = false;
+
+	MEM(to_free = talloc_array(NULL, ldap_replica_entry_t *, fr_rb_num_elements(replica->by_dn)));
+	for (entry = fr_rb_iter_init_inorder(&iter, replica->by_dn);
+	     entry;
+	     entry = fr_rb_iter_next_inorder(&iter)) {
+		if (entry->source == src) to_free[count++] = entry;
+	}
+	for (i = 0; i < count; i++) replica_entry_free(replica, to_free[i]);
+	talloc_free(to_free);
+
+	DEBUG2("LDAP replica \"%s\" cleared %zu entries", replica->name, count);
+
+done:
+	pthread_rwlock_unlock(&replica->lock);
+}
+
+/** Add or replace an entry
+ *
+ * The new entry is built from the message before the lock is taken, so
+ * readers are only blocked while the entry is swapped in.
+ *
+ * @param[in] replica	to update.
+ * @param[in] source	which provided the entry.
+ * @param[in] uuid	of the entry, may be NULL if the directory doesn't provide them.
+ * @param[in] uuid_len	length of the UUID.
+ * @param[in] handle	the message was received on.
+ * @param[in] msg	containing the entry.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_ldap_replica_entry_update(fr_ldap_replica_t *replica, void const *source,
+				 uint8_t const *uuid, size_t uuid_len, LDAP *handle, LDAPMessage *msg)
+{
+	ldap_replica_entry_t	*entry, *old;
+	ldap_replica_index_t	*index = NULL;
+	BerElement		*ber = NULL;
+	char			*dn, *attr;
+	size_t			count = 0;
+
+	dn = ldap_get_dn(handle, msg);
+	if (!dn) {
+		fr_strerror_const("Entry has no DN");
+		return -1;
+	}
+
+	MEM(entry = talloc_zero(NULL, ldap_replica_entry_t));
+	entry->pub.dn = replica_dn_normalise(entry, dn);
+	ldap_memfree(dn);
+	if (uuid) {
+		entry->uuid = talloc_memdup(entry, uuid, uuid_len);
+		entry->uuid_len = uuid_len;
+	}
+	fr_dlist_init(&entry->refs, ldap_replica_ref_t, entry_entry);
+
+	/*
+	 *	Copy all the attributes the directory returned
+	 */
+	MEM(entry->pub.attrs = talloc_array(entry, fr_ldap_replica_attr_t, 0));
+	for (attr = ldap_first_attribute(handle, msg, &ber);
+	     attr;
+	     attr = ldap_next_attribute(handle, msg, ber)) {
+		struct berval	**values;
+		int		i, num;
+
+		values = ldap_get_values_len(handle, msg, attr);
+		num = ldap_count_values_len(values);
+		if (num == 0) goto next;
+
+		MEM(entry->pub.attrs = talloc_realloc(entry, entry->pub.attrs, fr_ldap_replica_attr_t, count + 1));
+		entry->pub.attrs[count].name = talloc_strdup(entry->pub.attrs, attr);
+		MEM(entry->pub.attrs[count].values = talloc_array(entry->pub.attrs, struct berval *, num + 1));
+		for (i = 0; i < num; i++) {
+			struct berval *bv;
+
+			MEM(bv = talloc(entry->pub.attrs[count].values, struct berval));
+			bv->bv_len = values[i]->bv_len;
+			MEM(bv->bv_val = talloc_memdup(bv, values[i]->bv_val, values[i]->bv_len));
+			entry->pub.attrs[count].values[i] = bv;
+		}
+		entry->pub.attrs[count].values[num] = NULL;
+		count++;
+
+	next:
+		ldap_value_free_len(values);
+		ldap_memfree(attr);
+	}
+	if (ber) ber_free(ber, 0);
+
+	pthread_rwlock_wrlock(&replica->lock);
+	entry->source = replica_source_find(replica, source);
+
+	/*
+	 *	Remove the previous version of the entry, which may have had
+	 *	a different DN if it was renamed.
+	 */
+	if (entry->uuid && (old = fr_rb_find(replica->by_uuid, entry))) replica_entry_free(replica, old);
+	if ((old = fr_rb_find(replica->by_dn, entry))) replica_entry_free(replica, old);
+
+	talloc_steal(replica, entry);
+	fr_rb_insert(replica->by_dn, entry);
+	if (entry->uuid) fr_rb_insert(replica->by_uuid, entry);
+
+	while ((index = fr_dlist_next(&replica->indexes, index))) replica_entry_index(index, entry);
+	pthread_rwlock_unlock(&replica->lock);
+
+	return 0;
+}
+
+/** Remove an entry
+ *
+ * @param[in] replica	to remove the entry from.
+ * @param[in] uuid	of the entry, may be NULL.
+ * @param[in] uuid_len	length of the UUID.
+ * @param[in] dn	of the entry, used if there's no UUID, or nothing matched it.  May be NULL.
+ */
+void fr_ldap_replica_entry_delete(fr_ldap_replica_t *replica, uint8_t const *uuid, size_t uuid_len, char const *dn)
+{
+	ldap_replica_entry_t	*entry = NULL;
+	char			*normalised = dn ? replica_dn_normalise(NULL, dn) : NULL;
+
+	pthread_rwlock_wrlock(&replica->lock);
+	if (uuid) entry = fr_rb_find(replica->by_uuid, &(ldap_replica_entry_t){ .uuid = uuid, .uuid_len = uuid_len });
+	if (!entry && normalised) entry = fr_rb_find(replica->by_dn, &(ldap_replica_entry_t){ .pub.dn = normalised });
+	if (entry) replica_entry_free(replica, entry);
+	pthread_rwlock_unlock(&replica->lock);
+
+	talloc_free(normalised);
+}
+
+/** Return the values of an attribute of a replica entry
+ *
+ * Suitable for use with #fr_ldap_filter_eval_values.  The values belong to the entry.
+ *
+ * @param[in] uctx	#fr_ldap_replica_entry_t to retrieve values from.
+ * @param[in] attr	to retrieve values for.
+ * @return
+ *	- NULL terminated array of values.
+ *	- NULL if the entry doesn't have the attribute.
+ */
+struct berval **fr_ldap_replica_entry_values(void *uctx, char const *attr)
+{
+	return replica_entry_attr_values(uctx, attr);
+}
+
+/** Check whether a DN is within the scope of a search
+ *
+ */
+static bool replica_dn_in_scope(char const *dn, char const *base_dn, int scope)
+{
+	size_t		dn_len = strlen(dn), base_len = strlen(base_dn), prefix_len;
+	char const	*p;
+
+	if (base_len == 0) {
+		prefix_len = dn_len;
+	} else {
+		if (dn_len == base_len) {
+			if (strcasecmp(dn, base_dn) != 0) return false;
+			return (scope == LDAP_SCOPE_BASE) || (scope == LDAP_SCOPE_SUB);
+		}
+
+		if (dn_len < (base_len + 1)) return false;
+
+		prefix_len = dn_len - base_len - 1;
+		if ((dn[prefix_len] != ',') || ((prefix_len > 0) && (dn[prefix_len - 1] == '\\'))) return false;
+		if (strcasecmp(dn + prefix_len + 1, base_dn) != 0) return false;
+	}
+
+	switch (scope) {
+	case LDAP_SCOPE_BASE:
+		return false;
+
+	case LDAP_SCOPE_ONELEVEL:
+		for (p = dn; p < (dn + prefix_len); p++) {
+			if (*p == '\\') {
+				p++;
+				continue;
+			}
+			if (*p == ',') return false;
+		}
+		return true;
+
+	default:
+		return true;
+	}
+}
+
+/** Check whether an entry matches the scope and filter of a search
+ *
+ */
+static bool replica_entry_match(ldap_replica_entry_t *entry, char const *base_dn, int scope, fr_dlist_head_t *root)
+{
+	if (!replica_dn_in_scope(entry->pub.dn, base_dn, scope)) return false;
+
+	return !root || fr_ldap_filter_eval_values(root, fr_ldap_replica_entry_values, &entry->pub);
+}
+
+/** Whether two parsed filter nodes are equivalent
+ *
+ */
+static bool replica_filter_equal(ldap_filter_t const *a, ldap_filter_t const *b)
+{
+	ldap_filter_t const *a_child = NULL, *b_child = NULL;
+
+	if (a->filter_type != b->filter_type) return false;
+
+	if (a->filter_type == LDAP_FILTER_GROUP) {
+		if (a->logic_op != b->logic_op) return false;
+		if (fr_dlist_num_elements(&a->children) != fr_dlist_num_elements(&b->children)) return false;
+
+		while ((a_child = fr_dlist_next(&a->children, a_child)) &&
+		       (b_child = fr_dlist_next(&b->children, b_child))) {
+			if (!replica_filter_equal(a_child, b_child)) return false;
+		}
+		return true;
+	}
+
+	if ((a->op != b->op) || (strcasecmp(a->attr, b->attr) != 0)) return false;
+	if (a->op == LDAP_FILTER_OP_PRESENT) return true;
+	if (a->value->type != b->value->type) return false;
+
+	if (a->value->type == FR_TYPE_STRING) {
+		return replica_value_cmp(a->value->vb_strvalue, a->value->vb_length,
+					 b->value->vb_strvalue, b->value->vb_length) == 0;
+	}
+
+	return fr_value_box_cmp(a->value, b->value) == 0;
+}
+
+/** Whether a filter node is one of the conditions a filter requires all entries to satisfy
+ *
+ */
+static bool replica_filter_requires(ldap_filter_t const *root, ldap_filter_t const *node)
+{
+	ldap_filter_t const *child = NULL;
+
+	if (replica_filter_equal(root, node)) return true;
+
+	if ((root->filter_type != LDAP_FILTER_GROUP) || (root->logic_op != LDAP_FILTER_LOGIC_AND)) return false;
+
+	while ((child = fr_dlist_next(&root->children, child))) if (replica_filter_requires(child, node)) return true;
+
+	return false;
+}
+
+/** Whether an entry matching a search must also match the filter of a source
+ *
+ * This is deliberately conservative.  Each condition of the source's filter
+ * must also be a condition of the search's filter.  "(objectClass=*)" matches
+ * every entry, so is ignored.
+ */
+static bool replica_filter_covers(fr_dlist_head_t *src_root, fr_dlist_head_t *root)
+{
+	ldap_filter_t const *src_node, *child = NULL;
+
+	if (!src_root) return true;
+	src_node = fr_dlist_head(src_root);
+
+	if ((src_node->filter_type == LDAP_FILTER_NODE) && (src_node->op == LDAP_FILTER_OP_PRESENT) &&
+	    (strcasecmp(src_node->attr, "objectClass") == 0)) return true;
+
+	if (!root) return false;
+
+	if ((src_node->filter_type == LDAP_FILTER_GROUP) && (src_node->logic_op == LDAP_FILTER_LOGIC_AND)) {
+		while ((child = fr_dlist_next(&src_node->children, child))) {
+			if (!replica_filter_requires(fr_dlist_head(root), child)) return false;
+		}
+		return true;
+	}
+
+	return replica_filter_requires(fr_dlist_head(root), src_node);
+}
+
+/** Whether every entry a search could match falls within the base DN and scope of a source
+ *
+ */
+static bool replica_scope_covers(ldap_replica_source_t const *src, char const *base_dn, int scope)
+{
+	switch (src->scope) {
+	case LDAP_SCOPE_SUB:
+		return replica_dn_in_scope(base_dn, src->base_dn, LDAP_SCOPE_SUB);
+
+	case LDAP_SCOPE_ONELEVEL:
+		if (strcasecmp(base_dn, src->base_dn) == 0) return (scope == LDAP_SCOPE_ONELEVEL);
+
+		return (scope == LDAP_SCOPE_BASE) && replica_dn_in_scope(base_dn, src->base_dn, LDAP_SCOPE_ONELEVEL);
+
+	case LDAP_SCOPE_BASE:
+		return (scope == LDAP_SCOPE_BASE) && (strcasecmp(base_dn, src->base_dn) == 0);
+
+	default:
+		return false;
+	}
+}
+
+/** Whether the replica holds every entry a search could match
+ *
+ * A search is covered if one of the syncs feeding the replica retrieves
+ * every entry within the search's scope which matches its filter.
+ *
+ * @note Called with the lock held.
+ */
+static bool replica_covers(fr_ldap_replica_t *replica, char const *base_dn, int scope, fr_dlist_head_t *root)
+{
+	ldap_replica_source_t *src = NULL;
+
+	while ((src = fr_dlist_next(&replica->sources, src))) {
+		if (replica_scope_covers(src, base_dn, scope) && replica_filter_covers(src->filter, root)) return true;
+	}
+
+	return false;
+}
+
+/** Check every attribute referenced by a filter is replicated, and the values can be compared
+ *
+ * Filter values are compared as they appear in the filter, so any containing
+ * escape sequences can't be evaluated against the replica.
+ *
+ * @note Called with the lock held.
+ */
+static bool replica_filter_usable(fr_ldap_replica_t *replica, ldap_filter_t *node)
+{
+	ldap_filter_t *child = NULL;
+
+	if (node->filter_type == LDAP_FILTER_GROUP) {
+		while ((child = fr_dlist_next(&node->children, child))) {
+			if (!replica_filter_usable(replica, child)) return false;
+		}
+		return true;
+	}
+
+	if (!replica_provides(replica, node->attr)) return false;
+
+	if ((node->value->type == FR_TYPE_STRING) &&
+	    memchr(node->value->vb_strvalue, '\\', node->value->vb_length)) return false;
+
+	return true;
+}
+
+/** Find an equality match on an indexed attribute, which every matching entry must satisfy
+ *
+ * @note Called with the lock held.
+ */
+static ldap_replica_index_t *replica_filter_index(fr_ldap_replica_t *replica, ldap_filter_t *node,
+						  fr_value_box_t const **value)
+{
+	ldap_replica_index_t	*index = NULL;
+	ldap_filter_t		*child = NULL;
+
+	if (node->filter_type == LDAP_FILTER_GROUP) {
+		if (node->logic_op != LDAP_FILTER_LOGIC_AND) return NULL;
+
+		while ((child = fr_dlist_next(&node->children, child))) {
+			index = replica_filter_index(replica, child, value);
+			if (index) return index;
+		}
+		return NULL;
+	}
+
+	if (node->op != LDAP_FILTER_OP_EQ) return NULL;
+
+	while ((index = fr_dlist_next(&replica->indexes, index))) {
+		if (strcasecmp(index->attr, node->attr) == 0) {
+			*value = node->value;
+			return index;
+		}
+	}
+
+	return NULL;
+}
+
+/** Copy an entry, and the requested attributes, out of the replica
+ *
+ * @note Called with the lock held.
+ */
+static fr_ldap_replica_entry_t *replica_entry_copy(TALLOC_CTX *ctx, fr_ldap_replica_entry_t const *in,
+						   char const * const *attrs)
+{
+	fr_ldap_replica_entry_t	*out;
+	size_t			i, j, count = 0, in_count = talloc_array_length(in->attrs);
+
+	MEM(out = talloc_zero(ctx, fr_ldap_replica_entry_t));
+	out->dn = talloc_strdup(out, in->dn);
+
+	MEM(out->attrs = talloc_array(out, fr_ldap_replica_attr_t, in_count));
+	for (i = 0; i < in_count; i++) {
+		size_t num = talloc_array_length(in->attrs[i].values);
+
+		if (attrs && !replica_attr_in_list(attrs, in->attrs[i].name)) continue;
+
+		out->attrs[count].name = talloc_strdup(out->attrs, in->attrs[i].name);
+		MEM(out->attrs[count].values = talloc_array(out->attrs, struct berval *, num));
+		for (j = 0; in->attrs[i].values[j]; j++) {
+			struct berval *bv;
+
+			MEM(bv = talloc(out->attrs[count].values, struct berval));
+			bv->bv_len = in->attrs[i].values[j]->bv_len;
+			MEM(bv->bv_val = talloc_memdup(bv, in->attrs[i].values[j]->bv_val, bv->bv_len));
+			out->attrs[count].values[j] = bv;
+		}
+		out->attrs[count].values[j] = NULL;
+		count++;
+	}
+	if (count < in_count) MEM(out->attrs = talloc_realloc(out, out->attrs, fr_ldap_replica_attr_t, count));
+
+	return out;
+}
+
+/** Search the replica for a single entry
+ *
+ * Searches can only be answered if:
+ *	- Every source has completed its initial refresh.
+ *	- A source retrieves every entry the search could match, i.e. the search's
+ *	  base DN and scope are within those of the source, and the search's filter
+ *	  includes every condition of the source's filter.
+ *	- Every attribute in the filter, and every requested attribute, is replicated.
+ *	- The scope is "base", or the filter contains an equality match on an
+ *	  indexed attribute which every matching entry must satisfy.
+ *
+ * Otherwise the caller should search the directory.  Searches matching multiple
+ * entries are also passed back to the caller, so the directory can give an
+ * authoritative answer.
+ *
+ * @param[in] ctx	to allocate the copy of the entry in.
+ * @param[out] out	Where to write the matching entry.
+ * @param[in] replica	to search.
+ * @param[in] base_dn	of the search.
+ * @param[in] scope	of the search.
+ * @param[in] filter	to apply, may be NULL.
+ * @param[in] attrs	NULL terminated list of attributes to return.  NULL means all attributes.
+ * @return
+ *	- LDAP_REPLICA_FOUND - a single entry matched, and was written to out.
+ *	- LDAP_REPLICA_NOT_FOUND - no entries matched.
+ *	- LDAP_REPLICA_UNAVAILABLE - the replica can't answer the search.
+ */
+fr_ldap_replica_rcode_t fr_ldap_replica_search(TALLOC_CTX *ctx, fr_ldap_replica_entry_t **out,
+					       fr_ldap_replica_t *replica,
+					       char const *base_dn, int scope, char const *filter,
+					       char const * const *attrs)
+{
+	fr_dlist_head_t		*root = NULL;
+	ldap_replica_index_t	*index = NULL;
+	fr_value_box_t const	*value = NULL;
+	ldap_replica_entry_t	*entry, *found = NULL;
+	ldap_replica_ref_t	*ref = NULL;
+	ldap_replica_key_t	*key;
+	fr_ldap_replica_rcode_t	rcode = LDAP_REPLICA_UNAVAILABLE;
+	char const * const	*p;
+	char			*normalised;
+
+	*out = NULL;
+
+	if (filter && *filter &&
+	    (fr_ldap_filter_parse(NULL, &root, &FR_SBUFF_IN(filter, strlen(filter)), NULL, NULL) < 0)) return rcode;
+
+	normalised = replica_dn_normalise(NULL, base_dn);
+	base_dn = normalised;
+
+	pthread_rwlock_rdlock(&replica->lock);
+	if (!replica_ready(replica)) goto finish;
+
+	if (!replica_covers(replica, base_dn, scope, root)) goto finish;
+
+	if (attrs) for (p = attrs; *p; p++) if (!replica_provides(replica, *p)) goto finish;
+
+	if (root) {
+		if (!replica_filter_usable(replica, fr_dlist_head(root))) goto finish;
+		index = replica_filter_index(replica, fr_dlist_head(root), &value);
+	}
+
+	if (index) {
+		key = fr_rb_find(index->keys, &(ldap_replica_key_t){
+					.value = value->vb_strvalue,
+					.len = value->vb_length
+				 });
+		while (key && (ref = fr_dlist_next(&key->refs, ref))) {
+			if (!replica_entry_match(ref->entry, base_dn, scope, root)) continue;
+			if (found) goto finish;		/* Multiple matches */
+			found = ref->entry;
+		}
+	} else if (scope == LDAP_SCOPE_BASE) {
+		entry = fr_rb_find(replica->by_dn, &(ldap_replica_entry_t){ .pub.dn = base_dn });
+		if (entry && replica_entry_match(entry, base_dn, scope, root)) found = entry;
+	} else {
+		goto finish;
+	}
+
+	if (found) {
+		*out = replica_entry_copy(ctx, &found->pub, attrs);
+		rcode = LDAP_REPLICA_FOUND;
+	} else {
+		rcode = LDAP_REPLICA_NOT_FOUND;
+	}
+
+finish:
+	pthread_rwlock_unlock(&replica->lock);
+	talloc_free(root);
+	talloc_free(normalised);
+
+	return rcode;
+}
@@ -27,6 +27,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/server/trunk.h>
 #include <freeradius-devel/unlang/xlat.h>
 
 /** Initialize src/lib/server/
@@ -50,6 +51,11 @@ int server_init(CONF_SECTION *cs)
 	 */
 	if (trigger_exec_init(cs) < 0) return -1;
 
+	/*
+	 *	Load the attributes passed to trunk connection triggers
+	 */
+	if (fr_trunk_global_init() < 0) return -1;
+
 	/*
 	 *	Set up dictionaries and attributes for password comparisons
 	 */
@@ -136,6 +142,11 @@ void server_free(void)
 	 */
 	trigger_exec_free();
 
+	/*
+	 *	Free the attributes used by trunk triggers
+	 */
+	fr_trunk_global_free();
+
 	/*
 	 *	Free the internal dictionaries the request uses
 	 */
@@ -37,6 +37,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/base16.h>
+#include <freeradius-devel/util/lpm.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/trie.h>
 
@@ -58,6 +59,11 @@ struct fr_client_list_s {
 	fr_trie_t	*v6_tcp;
 #else
 	fr_rb_tree_t	*tree[129];
+
+	fr_lpm_t	*lpm[4];		//!< Compiled tables for lookups of complete addresses,
+						///< indexed by client_lpm_index().  Only used once the
+						///< list has been compiled.
+	bool		compiled;		//!< Keep the compiled tables up to date.
 #endif
 };
 
@@ -81,6 +87,105 @@ static int8_t client_cmp(void const *one, void const *two)
 	return CMP(a->proto, b->proto);
 }
 
+/** Return the compiled table used for an address family and protocol
+ *
+ * @return
+ *	- The index of the table.
+ *	- -1 if there's no table, i.e. for wildcard protocol lookups.
+ */
+static inline int client_lpm_index(int af, int proto)
+{
+	int idx;
+
+	switch (proto) {
+	case IPPROTO_UDP:
+		idx = 0;
+		break;
+
+	case IPPROTO_TCP:
+		idx = 1;
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (af == AF_INET6) idx += 2;
+
+	return idx;
+}
+
+/** Rebuild the compiled lookup tables for a client list
+ *
+ * The tables contain the same clients as the trees, and give the same
+ * results for lookups of complete addresses.  But a lookup is a few
+ * array accesses, instead of a tree search for every prefix length.
+ *
+ * Clients with "proto = *" are added to the tables for both protocols.
+ *
+ * @param[in] clients	to compile.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.  The list is left uncompiled, and lookups use the trees.
+ */
+static int client_list_compile(fr_client_list_t *clients)
+{
+	fr_lpm_t		*lpm[NUM_ELEMENTS(clients->lpm)] = { NULL };
+	size_t			i;
+	int			prefix;
+
+	for (i = 0; i < NUM_ELEMENTS(lpm); i++) {
+		lpm[i] = fr_lpm_alloc(clients);
+		if (!lpm[i]) goto error;
+	}
+
+	for (prefix = 0; prefix <= 128; prefix++) {
+		fr_rb_iter_inorder_t	iter;
+		fr_client_t		*client;
+
+		if (!clients->tree[prefix]) continue;
+
+		for (client = fr_rb_iter_init_inorder(&iter, clients->tree[prefix]);
+		     client;
+		     client = fr_rb_iter_next_inorder(&iter)) {
+			int idx;
+
+			if (client->proto == IPPROTO_IP) {
+				if ((fr_lpm_insert_by_key(lpm[client_lpm_index(client->ipaddr.af, IPPROTO_UDP)],
+							  &client->ipaddr.addr, client->ipaddr.prefix, client) < 0) ||
+				    (fr_lpm_insert_by_key(lpm[client_lpm_index(client->ipaddr.af, IPPROTO_TCP)],
+							  &client->ipaddr.addr, client->ipaddr.prefix, client) < 0)) goto error;
+				continue;
+			}
+
+			idx = client_lpm_index(client->ipaddr.af, client->proto);
+			if (idx < 0) continue;
+
+			if (fr_lpm_insert_by_key(lpm[idx], &client->ipaddr.addr, client->ipaddr.prefix, client) < 0) goto error;
+		}
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(lpm); i++) {
+		if (fr_lpm_compile(lpm[i]) < 0) goto error;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(lpm); i++) {
+		talloc_free(clients->lpm[i]);
+		clients->lpm[i] = lpm[i];
+	}
+	clients->compiled = true;
+
+	return 0;
+
+error:
+	for (i = 0; i < NUM_ELEMENTS(lpm); i++) {
+		talloc_free(lpm[i]);
+		TALLOC_FREE(clients->lpm[i]);
+	}
+	clients->compiled = false;
+
+	return -1;
+}
 #endif
 
 void client_list_free(void)
@@ -337,6 +442,12 @@ bool client_add(fr_client_list_t *clients, fr_client_t *client)
 	 */
 	(void) talloc_steal(clients, client); /* reparent it */
 
+#ifndef WITH_TRIE
+	if (clients->compiled && (client_list_compile(clients) < 0)) {
+		PWARN("Failed recompiling client list %s, falling back to slower lookups", clients->name);
+	}
+#endif
+
 	return true;
 }
 
@@ -365,6 +476,15 @@ void client_delete(fr_client_list_t *clients, fr_client_t *client)
 	if (!clients->tree[client->ipaddr.prefix]) return;
 
 	(void) fr_rb_delete(clients->tree[client->ipaddr.prefix], client);
+
+	/*
+	 *	The compiled tables must not refer to the client
+	 *	after it's freed, so failing to rebuild them
+	 *	disables them.
+	 */
+	if (clients->compiled && (client_list_compile(clients) < 0)) {
+		PWARN("Failed recompiling client list %s, falling back to slower lookups", clients->name);
+	}
 #endif
 }
 
@@ -396,6 +516,16 @@ fr_client_t *client_find(fr_client_list_t const *clients, fr_ipaddr_t const *ipa
 	return fr_trie_lookup_by_key(trie, &ipaddr->addr, ipaddr->prefix);
 #else
 
+	/*
+	 *	Lookups of complete addresses use the compiled
+	 *	tables.  Anything else searches the trees.
+	 */
+	if (clients->compiled && (ipaddr->prefix == ((ipaddr->af == AF_INET6) ? 128 : 32))) {
+		int idx = client_lpm_index(ipaddr->af, proto);
+
+		if (idx >= 0) return fr_lpm_lookup_by_key(clients->lpm[idx], &ipaddr->addr, ipaddr->prefix);
+	}
+
 	if (proto == AF_INET) {
 		max = 32;
 	} else {
@@ -580,6 +710,17 @@ fr_client_list_t *client_list_parse_section(CONF_SECTION *section, int proto, TL
 
 	}
 
+#ifndef WITH_TRIE
+	/*
+	 *	The list is complete, so compile the tables used
+	 *	for lookups.  If that fails, lookups still work,
+	 *	they're just slower.
+	 */
+	if (client_list_compile(clients) < 0) {
+		cf_log_pwarn(section, "Failed compiling clients, falling back to slower lookups");
+	}
+#endif
+
 	/*
 	 *	Associate the clients structure with the section.
 	 */
@@ -0,0 +1,221 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/detail.h
+ * @brief Layout of binary detail files.
+ *
+ * A binary detail file starts with a #FR_DETAIL_FILE_HDR_LEN byte file
+ * header, followed by zero or more records.  Each record is a
+ * #FR_DETAIL_RECORD_HDR_LEN byte header, followed by the request pairs
+ * encoded with the internal protocol encoder.
+ *
+ * All integers are in network byte order.  The status byte of a record
+ * is rewritten in place by the detail reader, once the record has been
+ * processed.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(server_detail_h, "$Id$")
+
+#include <freeradius-devel/util/inet.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/time.h>
+
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FR_DETAIL_FILE_MAGIC		"FRDETAIL"	//!< First bytes of every binary detail file.
+#define FR_DETAIL_FILE_VERSION		1
+#define FR_DETAIL_FILE_HDR_LEN		16
+
+#define FR_DETAIL_RECORD_MAGIC		0xfd		//!< Never printable, so never the start of a text record.
+#define FR_DETAIL_RECORD_HDR_LEN	64
+
+/*
+ *	Offsets of fields within the record header which the reader
+ *	updates in place.
+ */
+#define FR_DETAIL_RECORD_STATUS_OFFSET	1
+#define FR_DETAIL_RECORD_COUNT_OFFSET	24
+
+typedef enum {
+	FR_DETAIL_RECORD_PENDING = 0,				//!< Not yet processed.
+	FR_DETAIL_RECORD_DONE = 1				//!< Processed, and should be skipped.
+} fr_detail_record_status_t;
+
+/** Decoded form of a binary record header
+ *
+ */
+typedef struct {
+	fr_detail_record_status_t	status;			//!< Whether the record has been processed.
+	uint32_t			length;			//!< Of the encoded pairs following the header.
+	fr_unix_time_t			timestamp;		//!< When the original packet was received.
+	uint32_t			protocol;		//!< Number of the protocol dictionary.
+	uint32_t			code;			//!< Packet code, or 0 if it wasn't recorded.
+	uint32_t			transmit_count;		//!< How many times the record has been replayed.
+	fr_ipaddr_t			src_ipaddr;		//!< Of the client which sent the original packet.
+	fr_ipaddr_t			dst_ipaddr;		//!< Where the original packet was sent to.
+	uint16_t			src_port;
+	uint16_t			dst_port;
+} fr_detail_record_t;
+
+/** Write the file header for a binary detail file
+ *
+ * @param[out] out	Where to write the header.
+ */
+static inline void fr_detail_file_hdr_encode(uint8_t out[static FR_DETAIL_FILE_HDR_LEN])
+{
+	memset(out, 0, FR_DETAIL_FILE_HDR_LEN);
+	memcpy(out, FR_DETAIL_FILE_MAGIC, sizeof(FR_DETAIL_FILE_MAGIC) - 1);
+	out[sizeof(FR_DETAIL_FILE_MAGIC) - 1] = FR_DETAIL_FILE_VERSION;
+}
+
+/** Check whether data is the start of a binary detail file
+ *
+ * @param[in] data	from the start of the file.
+ * @param[in] data_len	length of data.
+ * @return
+ *	- true if the file is a binary detail file we understand.
+ *	- false if the file is something else, usually a text detail file.
+ */
+static inline bool fr_detail_file_is_binary(uint8_t const *data, size_t data_len)
+{
+	if (data_len < FR_DETAIL_FILE_HDR_LEN) return false;
+
+	if (memcmp(data, FR_DETAIL_FILE_MAGIC, sizeof(FR_DETAIL_FILE_MAGIC) - 1) != 0) return false;
+
+	return (data[sizeof(FR_DETAIL_FILE_MAGIC) - 1] == FR_DETAIL_FILE_VERSION);
+}
+
+/** Check whether data is a binary detail record
+ *
+ */
+static inline bool fr_detail_record_is_binary(uint8_t const *data, size_t data_len)
+{
+	return (data_len >= FR_DETAIL_RECORD_HDR_LEN) && (data[0] == FR_DETAIL_RECORD_MAGIC);
+}
+
+static inline void _detail_ipaddr_encode(uint8_t *af, uint8_t out[static 16], fr_ipaddr_t const *ipaddr)
+{
+	memset(out, 0, 16);
+
+	switch (ipaddr->af) {
+	case AF_INET:
+		*af = 4;
+		memcpy(out, &ipaddr->addr.v4.s_addr, 4);
+		break;
+
+	case AF_INET6:
+		*af = 6;
+		memcpy(out, ipaddr->addr.v6.s6_addr, 16);
+		break;
+
+	default:
+		*af = 0;
+		break;
+	}
+}
+
+static inline void _detail_ipaddr_decode(fr_ipaddr_t *ipaddr, uint8_t af, uint8_t const in[static 16])
+{
+	memset(ipaddr, 0, sizeof(*ipaddr));
+
+	switch (af) {
+	case 4:
+		ipaddr->af = AF_INET;
+		ipaddr->prefix = 32;
+		memcpy(&ipaddr->addr.v4.s_addr, in, 4);
+		break;
+
+	case 6:
+		ipaddr->af = AF_INET6;
+		ipaddr->prefix = 128;
+		memcpy(ipaddr->addr.v6.s6_addr, in, 16);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/** Encode a record header
+ *
+ * Both addresses must be of the same address family, or unset.
+ *
+ * @param[out] out	Where to write the header.
+ * @param[in] rec	to encode.
+ */
+static inline void fr_detail_record_hdr_encode(uint8_t out[static FR_DETAIL_RECORD_HDR_LEN], fr_detail_record_t const *rec)
+{
+	uint8_t src_af, dst_af;
+
+	memset(out, 0, FR_DETAIL_RECORD_HDR_LEN);
+
+	out[0] = FR_DETAIL_RECORD_MAGIC;
+	out[FR_DETAIL_RECORD_STATUS_OFFSET] = rec->status;
+	fr_nbo_from_uint32(out + 4, rec->length);
+	fr_nbo_from_uint64(out + 8, (uint64_t) fr_unix_time_unwrap(rec->timestamp));
+	fr_nbo_from_uint32(out + 16, rec->protocol);
+	fr_nbo_from_uint32(out + 20, rec->code);
+	fr_nbo_from_uint32(out + FR_DETAIL_RECORD_COUNT_OFFSET, rec->transmit_count);
+	fr_nbo_from_uint16(out + 28, rec->src_port);
+	fr_nbo_from_uint16(out + 30, rec->dst_port);
+
+	_detail_ipaddr_encode(&src_af, out + 32, &rec->src_ipaddr);
+	_detail_ipaddr_encode(&dst_af, out + 48, &rec->dst_ipaddr);
+	out[2] = src_af ? src_af : dst_af;
+}
+
+/** Decode a record header
+ *
+ * @param[out] rec	the decoded header.
+ * @param[in] data	start of the record.
+ * @param[in] data_len	bytes available from the start of the record.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the data is not a valid record header.
+ */
+static inline int fr_detail_record_hdr_decode(fr_detail_record_t *rec, uint8_t const *data, size_t data_len)
+{
+	if (!fr_detail_record_is_binary(data, data_len)) return -1;
+
+	if (data[FR_DETAIL_RECORD_STATUS_OFFSET] > FR_DETAIL_RECORD_DONE) return -1;
+
+	rec->status = data[FR_DETAIL_RECORD_STATUS_OFFSET];
+	rec->length = fr_nbo_to_uint32(data + 4);
+	rec->timestamp = fr_unix_time_wrap((int64_t) fr_nbo_to_uint64(data + 8));
+	rec->protocol = fr_nbo_to_uint32(data + 16);
+	rec->code = fr_nbo_to_uint32(data + 20);
+	rec->transmit_count = fr_nbo_to_uint32(data + FR_DETAIL_RECORD_COUNT_OFFSET);
+	rec->src_port = fr_nbo_to_uint16(data + 28);
+	rec->dst_port = fr_nbo_to_uint16(data + 30);
+
+	_detail_ipaddr_decode(&rec->src_ipaddr, data[2], data + 32);
+	_detail_ipaddr_decode(&rec->dst_ipaddr, data[2], data + 48);
+
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
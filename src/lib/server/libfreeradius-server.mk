@@ -21,6 +21,7 @@ SOURCES	:= \
 	map.c \
 	map_async.c \
 	map_proc.c \
+	metrics_http.c \
 	module.c \
 	module_rlm.c \
 	packet.c \
@@ -153,9 +153,26 @@ static const conf_parser_t log_config[] = {
 	{ FR_CONF_OFFSET("line_number", main_config_t, log_line_number) },
 	{ FR_CONF_OFFSET("timestamp", main_config_t, log_timestamp) },
 	{ FR_CONF_OFFSET("use_utc", main_config_t, log_dates_utc) },
+	{ FR_CONF_OFFSET("async", main_config_t, log_async) },
+	{ FR_CONF_OFFSET_TYPE_FLAGS("async_buffer_size", FR_TYPE_SIZE, 0, main_config_t, log_async_buffer_size), .dflt = "65536" },
+	{ FR_CONF_OFFSET("async_overflow", main_config_t, log_async_overflow), .dflt = "drop",
+		.func = cf_table_parse_int,
+			.uctx = &(cf_table_parse_ctx_t){
+				.table = fr_log_async_overflow_table,
+				.len = &fr_log_async_overflow_table_len
+			}
+		},
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Built-in metrics exporter.
+ */
+static const conf_parser_t metrics_config[] = {
+	{ FR_CONF_OFFSET_TYPE_FLAGS("ipaddr", FR_TYPE_COMBO_IP_ADDR, 0, main_config_t, metrics_ipaddr), .dflt = "127.0.0.1" },
+	{ FR_CONF_OFFSET("port", main_config_t, metrics_port), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
 
 static const conf_parser_t resources[] = {
 	/*
@@ -176,9 +193,12 @@ static const conf_parser_t thread_config[] = {
 
 	{ FR_CONF_OFFSET_TYPE_FLAGS("stats_interval", FR_TYPE_TIME_DELTA | CONF_FLAG_HIDDEN, 0, main_config_t, stats_interval), },
 
+	{ FR_CONF_OFFSET("pair_cache_size", main_config_t, pair_cache_size), .dflt = "0" },
+
 #ifdef WITH_TLS
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_init", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_max", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_max), .dflt = "1024" },
+	{ FR_CONF_OFFSET("openssl_crypto_threads", main_config_t, openssl_crypto_threads), .dflt = "0" },
 #endif
 
 	CONF_PARSER_TERMINATOR
@@ -230,6 +250,8 @@ static const conf_parser_t server_config[] = {
 
 	{ FR_CONF_POINTER("log", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) log_config },
 
+	{ FR_CONF_POINTER("metrics", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) metrics_config },
+
 	{ FR_CONF_POINTER("resources", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) resources },
 
 	{ FR_CONF_POINTER("thread", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) thread_config, .name2 = CF_IDENT_ANY },
@@ -1468,6 +1490,12 @@ void hup_logfile(main_config_t *config)
 		 */
 		old_fd = default_log.fd;
 		default_log.fd = fd;
+
+		/*
+		 *	Messages queued for the async writer
+		 *	still reference the old FD.
+		 */
+		fr_log_async_flush();
 		close(old_fd);
 	}
 }
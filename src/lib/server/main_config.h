@@ -42,6 +42,7 @@ extern main_config_t const *main_config;		//!< Global configuration singleton.
 #include <freeradius-devel/server/tmpl.h>
 
 #include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/log_async.h>
 
 
 /** Main server configuration
@@ -89,6 +90,13 @@ struct main_config_s {
 	bool		log_timestamp;
 	bool		log_timestamp_is_set;
 
+	bool		log_async;			//!< Write log messages from a dedicated thread.
+	size_t		log_async_buffer_size;		//!< Per-thread buffer for messages waiting to be written.
+	fr_log_async_overflow_t	log_async_overflow;	//!< What to do when a thread's buffer is full.
+
+	fr_ipaddr_t	metrics_ipaddr;			//!< Address to serve metrics on.
+	uint16_t	metrics_port;			//!< Port to serve metrics on.  0 disables it.
+
 	int32_t		syslog_facility;
 
 	char const	*dict_dir;			//!< Where to load dictionaries from.
@@ -97,6 +105,8 @@ struct main_config_s {
 
 	uint32_t	max_requests;			//!< maximum number of requests outstanding
 
+	uint32_t	pair_cache_size;		//!< How many freed pairs each worker keeps for reuse.
+
 	bool		write_pid;			//!< write the PID file
 
 #ifdef HAVE_SETUID
@@ -121,6 +131,9 @@ struct main_config_s {
 
 	size_t		openssl_async_pool_max;		//!< Tuning option to set the maximum number of requests
 							///< in the async ctx pool.
+
+	uint32_t	openssl_crypto_threads;		//!< How many threads to use for private key operations.
+							///< 0 means they're performed by the worker threads.
 #endif
 
 	fr_dict_t	*dict;				//!< Main dictionary.
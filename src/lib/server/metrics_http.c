@@ -0,0 +1,212 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file metrics_http.c
+ * @brief Serve metrics over HTTP, for Prometheus and compatible scrapers.
+ *
+ * This is deliberately minimal.  A single thread accepts connections,
+ * answers one GET request on each, and closes it.  Scrapes are
+ * infrequent, so there's no need for anything more.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/server/metrics_http.h>
+
+#include <freeradius-devel/util/metrics.h>
+#include <freeradius-devel/util/socket.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define METRICS_HTTP_POLL_MS	(100)		//!< How often the thread checks whether it should exit.
+#define METRICS_HTTP_TIMEOUT	(1)		//!< Seconds to wait for a client to send or receive.
+
+static struct {
+	int		fd;
+	pthread_t	thread;
+	atomic_bool	stop;
+	bool		running;
+} metrics_http = {
+	.fd = -1
+};
+
+static void metrics_http_write(int fd, char const *data, size_t len)
+{
+	while (len > 0) {
+		ssize_t slen;
+
+		slen = write(fd, data, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+
+		data += slen;
+		len -= slen;
+	}
+}
+
+/** Read a request, and send the metrics, or an error
+ *
+ */
+static void metrics_http_respond(int fd)
+{
+	char		request[1024];
+	size_t		used = 0;
+	char		*body = NULL;
+	size_t		body_len = 0;
+	char		header[256];
+	int		header_len;
+	FILE		*fp;
+	struct timeval	tv = { .tv_sec = METRICS_HTTP_TIMEOUT };
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	(void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/*
+	 *	We only care about the request line, but read
+	 *	the whole header so the client sees a clean close.
+	 */
+	while (used < (sizeof(request) - 1)) {
+		ssize_t slen;
+
+		slen = read(fd, request + used, sizeof(request) - 1 - used);
+		if (slen <= 0) break;
+
+		used += slen;
+		request[used] = '\0';
+		if (strstr(request, "\r\n\r\n")) break;
+	}
+	request[used] = '\0';
+
+	if ((strncmp(request, "GET /metrics ", 13) != 0) && (strncmp(request, "GET / ", 6) != 0)) {
+		static char const not_found[] = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+		metrics_http_write(fd, not_found, sizeof(not_found) - 1);
+		return;
+	}
+
+	fp = open_memstream(&body, &body_len);
+	if (!fp) return;
+	fr_metrics_print(fp);
+	fclose(fp);
+
+	header_len = snprintf(header, sizeof(header),
+			      "HTTP/1.0 200 OK\r\n"
+			      "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			      "Content-Length: %zu\r\n"
+			      "Connection: close\r\n"
+			      "\r\n", body_len);
+
+	metrics_http_write(fd, header, (size_t)header_len);
+	metrics_http_write(fd, body, body_len);
+	free(body);
+}
+
+static void *metrics_http_thread(UNUSED void *arg)
+{
+	while (!atomic_load(&metrics_http.stop)) {
+		struct pollfd	pfd = { .fd = metrics_http.fd, .events = POLLIN };
+		int		client;
+
+		if (poll(&pfd, 1, METRICS_HTTP_POLL_MS) <= 0) continue;
+
+		client = accept(metrics_http.fd, NULL, NULL);
+		if (client < 0) continue;
+
+		/*
+		 *	The listening socket is non-blocking, and
+		 *	on some platforms accepted sockets inherit that.
+		 */
+		(void) fr_blocking(client);
+
+		metrics_http_respond(client);
+		close(client);
+	}
+
+	return NULL;
+}
+
+/** Start serving metrics over HTTP
+ *
+ * Must be called after forking.
+ *
+ * @param[in] ipaddr	to listen on.
+ * @param[in] port	to listen on.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int metrics_http_start(fr_ipaddr_t const *ipaddr, uint16_t port)
+{
+	fr_ipaddr_t	my_ipaddr = *ipaddr;
+	uint16_t	my_port = port;
+	int		ret;
+
+	if (metrics_http.running) return 0;
+
+	metrics_http.fd = fr_socket_server_tcp(&my_ipaddr, &my_port, NULL, true);
+	if (metrics_http.fd < 0) {
+	error:
+		fr_strerror_printf_push("Failed opening metrics socket on %pV port %u",
+					fr_box_ipaddr(*ipaddr), port);
+		if (metrics_http.fd >= 0) close(metrics_http.fd);
+		metrics_http.fd = -1;
+		return -1;
+	}
+
+	if (fr_socket_bind(metrics_http.fd, NULL, &my_ipaddr, &my_port) < 0) goto error;
+
+	if (listen(metrics_http.fd, 8) < 0) {
+		fr_strerror_printf("Failed listening: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	atomic_store(&metrics_http.stop, false);
+	ret = pthread_create(&metrics_http.thread, NULL, metrics_http_thread, NULL);
+	if (ret != 0) {
+		fr_strerror_printf("Failed creating metrics thread: %s", fr_syserror(ret));
+		goto error;
+	}
+	metrics_http.running = true;
+
+	INFO("Serving metrics on http://%pV:%u/metrics", fr_box_ipaddr(*ipaddr), port);
+
+	return 0;
+}
+
+/** Stop serving metrics
+ *
+ */
+void metrics_http_stop(void)
+{
+	if (!metrics_http.running) return;
+
+	atomic_store(&metrics_http.stop, true);
+	pthread_join(metrics_http.thread, NULL);
+	metrics_http.running = false;
+
+	close(metrics_http.fd);
+	metrics_http.fd = -1;
+}
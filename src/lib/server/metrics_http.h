@@ -0,0 +1,40 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/metrics_http.h
+ * @brief Serve metrics over HTTP.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(metrics_http_h, "$Id$")
+
+#include <freeradius-devel/util/inet.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int	metrics_http_start(fr_ipaddr_t const *ipaddr, uint16_t port) CC_HINT(nonnull);
+
+void	metrics_http_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -714,6 +714,10 @@ int module_instantiate(module_instance_t *instance)
 			PERROR("Failed registering radmin commands for module %s", mi->name);
 			return -1;
 		}
+
+		mi->call_time = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "freeradius_module_call_duration_seconds",
+						   "Time from calling a module to it returning a result.",
+						   "module", mi->name, NULL);
 	}
 
 	/*
@@ -37,6 +37,7 @@ extern "C" {
 #include <freeradius-devel/unlang/compile.h>
 #include <freeradius-devel/unlang/call_env.h>
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/metrics.h>
 
 typedef struct module_s				module_t;
 typedef struct module_method_name_s		module_method_name_t;
@@ -104,6 +105,30 @@ typedef int (*module_thread_instantiate_t)(module_thread_inst_ctx_t const *mctx)
  */
 typedef int (*module_thread_detach_t)(module_thread_inst_ctx_t const *mctx);
 
+/** How busy a module instance is, as seen by the current thread
+ *
+ */
+typedef struct {
+	uint64_t			outstanding;	//!< Requests waiting for a result.
+	fr_time_delta_t			latency;	//!< Smoothed time taken to get a result.
+							///< 0 if not yet known.
+} module_load_t;
+
+/** Module load report callback
+ *
+ * Used by load-balance sections to choose between module instances.
+ * Must be cheap, as it's called for every request passing through the
+ * section.
+ *
+ * @param[out] out		Where to write the load.
+ * @param[in] mctx		Holds global instance data, and thread
+ *				instance data.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the load is not available.
+ */
+typedef int (*module_load_report_t)(module_load_t *out, module_ctx_t const *mctx);
+
 #ifdef __cplusplus
 }
 #endif
@@ -149,6 +174,8 @@ struct module_s {
 	module_thread_detach_t		thread_detach;
 	char const			*thread_inst_type;
 	size_t				thread_inst_size;
+
+	module_load_report_t		load_report;	//!< Report the module's load to load-balance sections.
 };
 
 /** What state the module instance is currently in
@@ -194,6 +221,9 @@ struct module_instance_s {
 
 	module_instance_state_t		state;		//!< What's been done with this module so far.
 
+	fr_metric_t			*call_time;	//!< Time from calling the module, to it returning
+							///< a final rcode, including any time spent yielded.
+
 	/** @name Return code overrides
 	 * @{
  	 */
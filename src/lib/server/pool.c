@@ -36,6 +36,26 @@ RCSID("$Id$")
 
 #include <time.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Number of affinity slots per pool
+ *
+ * Threads are assigned a slot the first time they use any pool.  If there
+ * are more threads than slots, some threads share a slot.
+ */
+#define POOL_AFFINITY_SLOTS	(64)
+
+/** Maximum number of connections, across all pools, a thread can release without the mutex
+ *
+ */
+#define POOL_THREAD_RESERVED	(8)
+
+#define POOL_CACHE_LINE_SIZE	(64)
+
 typedef struct fr_pool_connection_s fr_pool_connection_t;
 
 static int connection_check(fr_pool_t *pool, request_t *request);
@@ -73,6 +93,36 @@ struct fr_pool_connection_s {
 #endif
 };
 
+/** An idle connection kept for the threads using a slot
+ *
+ * Connections in a slot remain 'in_use' as far as the rest of the pool is
+ * concerned.  Whoever swaps the connection out of the slot owns it.
+ */
+typedef struct CC_HINT(aligned(POOL_CACHE_LINE_SIZE)) {
+	_Atomic(fr_pool_connection_t *)	conn;	//!< Parked connection, or NULL.
+} fr_pool_affinity_slot_t;
+
+/** A connection reserved by this thread
+ *
+ * Allows the connection to be found on release without walking the
+ * connection list.
+ */
+typedef struct {
+	fr_pool_t		*pool;		//!< Pool the connection was reserved from.
+	uint64_t		generation;	//!< Of the pool when the connection was reserved.
+	void			*conn;		//!< Connection handle returned to the caller.
+	fr_pool_connection_t	*this;		//!< Connection the handle belongs to.
+} fr_pool_reserved_t;
+
+static _Thread_local fr_pool_reserved_t	pool_thread_reserved[POOL_THREAD_RESERVED];
+static _Thread_local uint64_t		pool_thread_reserved_epoch;	//!< Value of pool_free_epoch when
+									///< pool_thread_reserved was last checked.
+static _Thread_local unsigned int	pool_thread_slot;	//!< 0 if not yet assigned, else slot + 1.
+static atomic_uint			pool_thread_slot_next;
+
+static atomic_uint_fast64_t		pool_generation_next;	//!< Source of pool generation numbers.
+static atomic_uint_fast64_t		pool_free_epoch;	//!< Incremented whenever a pool is freed.
+
 /** A connection pool
  *
  * Defines the configuration of the connection pool, all the counters and
@@ -109,6 +159,16 @@ struct fr_pool_s {
 
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
+	bool		affinity;		//!< If true threads keep the connection they
+						//!< released last, and reuse it without the mutex.
+
+	fr_pool_affinity_slot_t	*slots;		//!< Connections parked by threads, when affinity
+						//!< is enabled.
+	_Atomic(uint64_t)	generation;	//!< Changed whenever a connection is closed.  Entries
+						///< in pool_thread_reserved from an earlier generation
+						///< may point to freed connections, and are ignored.
+	_Atomic(int64_t)	next_check;	//!< When connection_check next needs to run.  Until then
+						//!< connections can be parked without the mutex.
 
 	fr_heap_t	*heap;			//!< For the next connection heap
 
@@ -163,6 +223,7 @@ static const conf_parser_t pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("affinity", fr_pool_t, affinity), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -315,6 +376,236 @@ static fr_pool_connection_t *connection_find(fr_pool_t *pool, void *conn)
 	return NULL;
 }
 
+/** Forget all the connections this thread has reserved, if any pool has been freed
+ *
+ * A new pool may have been allocated at the same address as the one
+ * which was freed, so the entries can't be trusted.  Any connections
+ * still reserved are found with connection_find when they're released.
+ */
+static inline void connection_reserved_expire(void)
+{
+	uint64_t epoch = atomic_load_explicit(&pool_free_epoch, memory_order_acquire);
+
+	if (likely(epoch == pool_thread_reserved_epoch)) return;
+
+	memset(pool_thread_reserved, 0, sizeof(pool_thread_reserved));
+	pool_thread_reserved_epoch = epoch;
+}
+
+/** Remember a connection this thread has reserved
+ *
+ * If all the entries are in use, the connection is found with
+ * connection_find when it's released.
+ *
+ * @param[in] pool	the connection was reserved from.
+ * @param[in] this	connection that was reserved.
+ */
+static inline void connection_reserved_add(fr_pool_t *pool, fr_pool_connection_t *this)
+{
+	size_t		i;
+	uint64_t	generation;
+
+	if (!pool->affinity) return;
+
+	connection_reserved_expire();
+
+	generation = atomic_load(&pool->generation);
+	for (i = 0; i < NUM_ELEMENTS(pool_thread_reserved); i++) {
+		fr_pool_reserved_t *entry = &pool_thread_reserved[i];
+
+		/*
+		 *	Entries for this pool can be replaced if they're
+		 *	from an earlier generation, or for the same
+		 *	connection.  The latter happens when a connection
+		 *	was released by a different thread.
+		 */
+		if (entry->pool &&
+		    ((entry->pool != pool) ||
+		     ((entry->generation == generation) && (entry->conn != this->connection)))) continue;
+
+		*entry = (fr_pool_reserved_t){
+			.pool = pool,
+			.generation = generation,
+			.conn = this->connection,
+			.this = this
+		};
+		return;
+	}
+}
+
+/** Find, and forget, a connection this thread has reserved
+ *
+ * @param[in] pool	the connection was reserved from.
+ * @param[in] conn	handle to search for.
+ * @return
+ *	- Connection containing the specified handle.
+ *	- NULL if this thread didn't record the connection.
+ */
+static inline fr_pool_connection_t *connection_reserved_remove(fr_pool_t *pool, void *conn)
+{
+	size_t i;
+
+	if (!pool || !conn || !pool->affinity) return NULL;
+
+	connection_reserved_expire();
+
+	for (i = 0; i < NUM_ELEMENTS(pool_thread_reserved); i++) {
+		fr_pool_connection_t	*this;
+		uint64_t		generation;
+
+		if ((pool_thread_reserved[i].pool != pool) || (pool_thread_reserved[i].conn != conn)) continue;
+
+		this = pool_thread_reserved[i].this;
+		generation = pool_thread_reserved[i].generation;
+		pool_thread_reserved[i] = (fr_pool_reserved_t){ 0 };
+
+		/*
+		 *	A connection has been closed since this one was
+		 *	reserved, and this may be a different connection
+		 *	with the same handle.  Let connection_find check.
+		 */
+		if (generation != atomic_load(&pool->generation)) return NULL;
+
+		fr_assert(this->in_use == true);
+		return this;
+	}
+
+	return NULL;
+}
+
+/** Return the affinity slot used by this thread
+ *
+ */
+static inline fr_pool_affinity_slot_t *connection_affinity_slot(fr_pool_t *pool)
+{
+	if (unlikely(!pool_thread_slot)) {
+		pool_thread_slot = (atomic_fetch_add(&pool_thread_slot_next, 1) % POOL_AFFINITY_SLOTS) + 1;
+	}
+
+	return &pool->slots[pool_thread_slot - 1];
+}
+
+/** Return parked connections to the heap
+ *
+ * @note Must be called with the mutex held.
+ *
+ * @param[in] pool	to flush.
+ * @return The number of connections returned to the heap.
+ */
+static unsigned int connection_affinity_flush(fr_pool_t *pool)
+{
+	unsigned int		i, count = 0;
+
+	if (!pool->affinity) return 0;
+
+	for (i = 0; i < POOL_AFFINITY_SLOTS; i++) {
+		fr_pool_connection_t *this;
+
+		this = atomic_exchange(&pool->slots[i].conn, NULL);
+		if (!this) continue;
+
+		fr_assert(this->in_use == true);
+		this->in_use = false;
+
+		fr_assert(pool->state.active != 0);
+		pool->state.active--;
+
+		fr_heap_insert(&pool->heap, this);
+		count++;
+	}
+
+	return count;
+}
+
+/** Reserve the connection parked in this thread's slot
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @param[in] pool	to reserve the connection from.
+ * @param[in] now	Current time.
+ * @return
+ *	- A reserved connection.
+ *	- NULL if there was no usable connection in the slot.
+ */
+static fr_pool_connection_t *connection_affinity_get(fr_pool_t *pool, fr_time_t now)
+{
+	fr_pool_connection_t	*this;
+
+	if (!pool->affinity) return NULL;
+
+	this = atomic_exchange(&connection_affinity_slot(pool)->conn, NULL);
+	if (!this) return NULL;
+
+	/*
+	 *	Expired, hand it back to the heap, where
+	 *	connection_manage will close it.
+	 */
+	if (this->needs_reconnecting ||
+	    ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) ||
+	    (fr_time_delta_ispos(pool->lifetime) && fr_time_lt(fr_time_add(this->created, pool->lifetime), now)) ||
+	    (fr_time_delta_ispos(pool->idle_timeout) &&
+	     fr_time_lt(fr_time_add(this->last_released, pool->idle_timeout), now))) {
+		pthread_mutex_lock(&pool->mutex);
+		this->in_use = false;
+		fr_assert(pool->state.active != 0);
+		pool->state.active--;
+		fr_heap_insert(&pool->heap, this);
+		pthread_mutex_unlock(&pool->mutex);
+
+		return NULL;
+	}
+
+	this->num_uses++;
+	this->last_reserved = now;
+
+#ifdef PTHREAD_DEBUG
+	this->pthread_id = pthread_self();
+#endif
+
+	return this;
+}
+
+/** Park a connection in this thread's slot
+ *
+ * The connection stays reserved, so it doesn't need to be inserted into
+ * the heap, and the mutex isn't needed.
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @param[in] pool	to release the connection to.
+ * @param[in] this	connection to park.
+ * @param[in] now	Current time.
+ * @return
+ *	- true if the connection was parked.
+ *	- false if it needs to be released with the mutex held.
+ */
+static bool connection_affinity_release(fr_pool_t *pool, fr_pool_connection_t *this, fr_time_t now)
+{
+	fr_pool_connection_t	*expected = NULL;
+
+	/*
+	 *	Pool maintenance, and the held triggers,
+	 *	need the mutex.
+	 */
+	if (fr_time_gteq(now, fr_time_wrap(atomic_load_explicit(&pool->next_check, memory_order_relaxed)))) return false;
+	if (fr_time_delta_ispos(pool->held_trigger_min)) return false;
+
+	if (this->needs_reconnecting) return false;
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return false;
+
+	this->last_released = now;
+
+	if (!atomic_compare_exchange_strong(&connection_affinity_slot(pool)->conn, &expected, this)) return false;
+
+	/*
+	 *	Not protected by the mutex, but readers of
+	 *	the pool state don't take the mutex either.
+	 */
+	pool->state.last_released = now;
+
+	return true;
+}
+
 /** Spawns a new connection
  *
  * Spawns a new connection using the create callback, and returns it for
@@ -569,6 +860,12 @@ static void connection_close_internal(fr_pool_t *pool, fr_pool_connection_t *thi
 
 	fr_pool_trigger_exec(pool, "close");
 
+	/*
+	 *	Stop any thread matching this connection from its
+	 *	record of reserved connections.
+	 */
+	atomic_store(&pool->generation, atomic_fetch_add(&pool_generation_next, 1) + 1);
+
 	connection_unlink(pool, this);
 
 	fr_assert(pool->state.num > 0);
@@ -663,6 +960,12 @@ static int connection_check(fr_pool_t *pool, request_t *request)
 		return 1;
 	}
 
+	/*
+	 *	Parked connections count as in use.  Put them back
+	 *	in the heap, so the limits apply to them too.
+	 */
+	connection_affinity_flush(pool);
+
 	/*
 	 *	Get "real" number of connections, and count pending
 	 *	connections as spare.
@@ -810,6 +1113,8 @@ manage_connections:
 	}
 
 	pool->state.last_checked = now;
+	atomic_store_explicit(&pool->next_check,
+			      fr_time_unwrap(fr_time_add(now, fr_time_delta_from_sec(1))), memory_order_relaxed);
 
 done:
 	pthread_mutex_unlock(&pool->mutex);
@@ -835,19 +1140,40 @@ static void *connection_get_internal(fr_pool_t *pool, request_t *request, bool s
 
 	if (!pool) return NULL;
 
-	pthread_mutex_lock(&pool->mutex);
-
 	now = fr_time();
 
+	/*
+	 *	Reuse the connection this thread released
+	 *	last, without touching the mutex.
+	 */
+	this = connection_affinity_get(pool, now);
+	if (this) {
+		connection_reserved_add(pool, this);
+
+		ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
+
+		return this->connection;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
 	/*
 	 *	Grab the link with the lowest latency, and check it
 	 *	for limits.  If "connection manage" says the link is
 	 *	no longer usable, go grab another one.
+	 *
+	 *	If the heap is empty, take back any connections
+	 *	parked by other threads.
 	 */
-	do {
+	for (;;) {
 		this = fr_heap_peek(pool->heap);
-		if (!this) break;
-	} while (!connection_manage(pool, request, this, now));
+		if (!this) {
+			if (connection_affinity_flush(pool) == 0) break;
+			continue;
+		}
+
+		if (connection_manage(pool, request, this, now)) break;
+	}
 
 	/*
 	 *	We have a working connection.  Extract it from the
@@ -906,6 +1232,8 @@ do_return:
 #endif
 	pthread_mutex_unlock(&pool->mutex);
 
+	connection_reserved_add(pool, this);
+
 	ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
 
 	return this->connection;
@@ -1042,6 +1370,8 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 		fr_pool_free(pool);
 		return NULL;
 	}
+	MEM(pool->slots = talloc_zero_array(pool, fr_pool_affinity_slot_t, POOL_AFFINITY_SLOTS));
+	atomic_init(&pool->generation, atomic_fetch_add(&pool_generation_next, 1) + 1);
 
 	pool->log_prefix = log_prefix ? talloc_typed_strdup(pool, log_prefix) : "core";
 	pthread_mutex_init(&pool->mutex, NULL);
@@ -1098,6 +1428,13 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 */
 	FR_TIME_DELTA_BOUND_CHECK("connect_timeout", pool->connect_timeout, >=, fr_time_delta_from_msec(100));
 
+	/*
+	 *	Spreading requests over the connections means
+	 *	always taking the one released longest ago, which
+	 *	is the opposite of what affinity does.
+	 */
+	if (pool->spread) pool->affinity = false;
+
 	/*
 	 *	Don't open any connections.  Instead, force the limits
 	 *	to only 1 connection.
@@ -1257,6 +1594,8 @@ int fr_pool_reconnect(fr_pool_t *pool, request_t *request)
 	 */
 	while (pool->state.pending) pthread_cond_wait(&pool->done_spawn, &pool->mutex);
 
+	connection_affinity_flush(pool);
+
 	/*
 	 *	We want to ensure at least 'start' connections
 	 *	have been reconnected. We can't call reconnect
@@ -1340,6 +1679,8 @@ void fr_pool_free(fr_pool_t *pool)
 
 	pthread_mutex_lock(&pool->mutex);
 
+	connection_affinity_flush(pool);
+
 	/*
 	 *	Don't loop over the list.  Just keep removing the head
 	 *	until they're all gone.
@@ -1361,6 +1702,12 @@ void fr_pool_free(fr_pool_t *pool)
 	pthread_cond_destroy(&pool->done_spawn);
 	pthread_cond_destroy(&pool->done_reconnecting);
 
+	/*
+	 *	Invalidate every thread's record of reserved
+	 *	connections, as they may refer to this pool.
+	 */
+	atomic_fetch_add_explicit(&pool_free_epoch, 1, memory_order_release);
+
 	talloc_free(pool);
 }
 
@@ -1403,17 +1750,31 @@ void fr_pool_connection_release(fr_pool_t *pool, request_t *request, void *conn)
 {
 	fr_pool_connection_t	*this;
 	fr_time_delta_t		held;
+	fr_time_t		now = fr_time();
 	bool			trigger_min = false, trigger_max = false;
 
-	this = connection_find(pool, conn);
-	if (!this) return;
+	/*
+	 *	Keep the connection for this thread if we can,
+	 *	otherwise release it to the heap.
+	 */
+	this = connection_reserved_remove(pool, conn);
+	if (this) {
+		if (connection_affinity_release(pool, this, now)) {
+			ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ")", this->number);
+			return;
+		}
+		pthread_mutex_lock(&pool->mutex);
+	} else {
+		this = connection_find(pool, conn);
+		if (!this) return;
+	}
 
 	this->in_use = false;
 
 	/*
 	 *	Record when the connection was last released
 	 */
-	this->last_released = fr_time();
+	this->last_released = now;
 	pool->state.last_released = this->last_released;
 
 	/*
@@ -1498,6 +1859,8 @@ void *fr_pool_connection_reconnect(fr_pool_t *pool, request_t *request, void *co
 
 	if (!pool || !conn) return NULL;
 
+	(void) connection_reserved_remove(pool, conn);
+
 	/*
 	 *	If connection_find is successful the pool is now locked
 	 */
@@ -1533,6 +1896,8 @@ int fr_pool_connection_close(fr_pool_t *pool, request_t *request, void *conn)
 {
 	fr_pool_connection_t *this;
 
+	(void) connection_reserved_remove(pool, conn);
+
 	this = connection_find(pool, conn);
 	if (!this) return 0;
 
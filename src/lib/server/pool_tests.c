@@ -0,0 +1,307 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/pool.h>
+
+#include <pthread.h>
+
+#define TEST_THREADS		16
+#define TEST_ITERATIONS		50000
+
+#define DEBUG_LVL_SET if (acutest_verbose_level_ >= 3) fr_debug_lvl = L_DBG_LVL_4 + 1
+
+typedef struct {
+	fr_pool_t		*pool;
+	void			*conn;		//!< Connection to release.
+	bool			failed;		//!< Failed to reserve a connection.
+	bool			shared;		//!< Two threads reserved the same connection.
+} test_thread_ctx_t;
+
+static void *test_connection_create(TALLOC_CTX *ctx, UNUSED void *opaque, UNUSED fr_time_delta_t timeout)
+{
+	return talloc_zero(ctx, bool);
+}
+
+static fr_pool_t *test_setup_pool(TALLOC_CTX *ctx, CONF_SECTION **cs_out, char const *max, bool affinity)
+{
+	static int	opaque;
+	CONF_SECTION	*cs;
+	fr_pool_t	*pool;
+
+	cs = cf_section_alloc(ctx, NULL, "pool", NULL);
+	cf_pair_alloc(cs, "start", "0", T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+	cf_pair_alloc(cs, "min", "0", T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+	cf_pair_alloc(cs, "max", max, T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+	cf_pair_alloc(cs, "spare", "0", T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+	cf_pair_alloc(cs, "affinity", affinity ? "yes" : "no", T_OP_EQ, T_BARE_WORD, T_BARE_WORD);
+
+	pool = fr_pool_init(NULL, cs, &opaque, test_connection_create, NULL, "test_pool");
+	TEST_CHECK(pool != NULL);
+	TEST_CHECK(fr_pool_start(pool) == 0);
+
+	*cs_out = cs;
+
+	return pool;
+}
+
+static void test_reserve_release(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	CONF_SECTION	*cs;
+	fr_pool_t	*pool;
+	void		*conn, *again;
+
+	DEBUG_LVL_SET;
+
+	pool = test_setup_pool(ctx, &cs, "4", true);
+
+	conn = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(conn != NULL);
+	TEST_CHECK_LEN(fr_pool_state(pool)->num, 1);
+	TEST_CHECK_LEN(fr_pool_state(pool)->active, 1);
+	fr_pool_connection_release(pool, NULL, conn);
+
+	/*
+	 *	Should get back the connection we just released
+	 */
+	again = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(again == conn);
+	fr_pool_connection_release(pool, NULL, again);
+
+	/*
+	 *	Two at once
+	 */
+	conn = fr_pool_connection_get(pool, NULL);
+	again = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(conn != NULL);
+	TEST_CHECK(again != NULL);
+	TEST_CHECK(conn != again);
+	TEST_CHECK_LEN(fr_pool_state(pool)->num, 2);
+	fr_pool_connection_release(pool, NULL, conn);
+	fr_pool_connection_release(pool, NULL, again);
+
+	/*
+	 *	Closing a reserved connection
+	 */
+	conn = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(fr_pool_connection_close(pool, NULL, conn) == 1);
+	TEST_CHECK_LEN(fr_pool_state(pool)->num, 1);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+static void *test_reserve_and_park(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+	void			*conn;
+
+	conn = fr_pool_connection_get(tctx->pool, NULL);
+	if (!conn) {
+		tctx->failed = true;
+		return NULL;
+	}
+	fr_pool_connection_release(tctx->pool, NULL, conn);
+
+	return NULL;
+}
+
+/*
+ *	A connection kept by one thread must be usable by another
+ *	when it's the only one left.
+ */
+static void test_steal(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	CONF_SECTION		*cs;
+	test_thread_ctx_t	tctx = { 0 };
+	pthread_t		thread;
+	void			*conn;
+
+	DEBUG_LVL_SET;
+
+	tctx.pool = test_setup_pool(ctx, &cs, "1", true);
+
+	/*
+	 *	Release once from this thread so the connection
+	 *	check has run, and later releases are parked.
+	 */
+	conn = fr_pool_connection_get(tctx.pool, NULL);
+	TEST_CHECK(conn != NULL);
+	fr_pool_connection_release(tctx.pool, NULL, conn);
+
+	TEST_CHECK(pthread_create(&thread, NULL, test_reserve_and_park, &tctx) == 0);
+	pthread_join(thread, NULL);
+	TEST_CHECK(!tctx.failed);
+
+	/*
+	 *	At max, so this only succeeds if the
+	 *	parked connection is taken back.
+	 */
+	conn = fr_pool_connection_get(tctx.pool, NULL);
+	TEST_CHECK(conn != NULL);
+	TEST_CHECK_LEN(fr_pool_state(tctx.pool)->num, 1);
+	TEST_CHECK_LEN(fr_pool_state(tctx.pool)->active, 1);
+	fr_pool_connection_release(tctx.pool, NULL, conn);
+
+	fr_pool_free(tctx.pool);
+	talloc_free(ctx);
+}
+
+static void *test_release(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+
+	fr_pool_connection_release(tctx->pool, NULL, tctx->conn);
+
+	return NULL;
+}
+
+/*
+ *	Connections released by another thread, or belonging to
+ *	a pool which has been freed, must not be found in this
+ *	thread's record of reserved connections.
+ */
+static void test_stale_reserved(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	CONF_SECTION		*cs;
+	test_thread_ctx_t	tctx = { 0 };
+	pthread_t		thread;
+	fr_pool_t		*pool;
+	void			*conn;
+
+	DEBUG_LVL_SET;
+
+	tctx.pool = test_setup_pool(ctx, &cs, "2", true);
+
+	tctx.conn = fr_pool_connection_get(tctx.pool, NULL);
+	TEST_CHECK(tctx.conn != NULL);
+	TEST_CHECK(pthread_create(&thread, NULL, test_release, &tctx) == 0);
+	pthread_join(thread, NULL);
+	TEST_CHECK_LEN(fr_pool_state(tctx.pool)->active, 0);
+
+	/*
+	 *	Same connection again, with the old record
+	 *	still present in this thread.
+	 */
+	conn = fr_pool_connection_get(tctx.pool, NULL);
+	TEST_CHECK(conn == tctx.conn);
+	TEST_CHECK(fr_pool_connection_close(tctx.pool, NULL, conn) == 1);
+
+	/*
+	 *	Free a pool with a connection still reserved.
+	 */
+	conn = fr_pool_connection_get(tctx.pool, NULL);
+	TEST_CHECK(conn != NULL);
+	fr_pool_free(tctx.pool);
+
+	pool = test_setup_pool(ctx, &cs, "2", true);
+	conn = fr_pool_connection_get(pool, NULL);
+	TEST_CHECK(conn != NULL);
+	TEST_CHECK_LEN(fr_pool_state(pool)->active, 1);
+	fr_pool_connection_release(pool, NULL, conn);
+	TEST_CHECK_LEN(fr_pool_state(pool)->num, 1);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+}
+
+static void *test_contend(void *arg)
+{
+	test_thread_ctx_t	*tctx = arg;
+	size_t			i;
+
+	for (i = 0; i < TEST_ITERATIONS; i++) {
+		bool *conn;
+
+		conn = fr_pool_connection_get(tctx->pool, NULL);
+		if (!conn) {
+			tctx->failed = true;
+			continue;
+		}
+
+		if (*conn) tctx->shared = true;
+		*conn = true;
+		*conn = false;
+
+		fr_pool_connection_release(tctx->pool, NULL, conn);
+	}
+
+	return NULL;
+}
+
+static fr_time_delta_t test_contention_run(bool affinity)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	CONF_SECTION		*cs;
+	fr_pool_t		*pool;
+	test_thread_ctx_t	tctx[TEST_THREADS];
+	pthread_t		threads[TEST_THREADS];
+	fr_time_t		start;
+	fr_time_delta_t		elapsed;
+	size_t			i;
+
+	pool = test_setup_pool(ctx, &cs, STRINGIFY(TEST_THREADS), affinity);
+
+	start = fr_time();
+	for (i = 0; i < TEST_THREADS; i++) {
+		tctx[i] = (test_thread_ctx_t){ .pool = pool };
+		TEST_CHECK(pthread_create(&threads[i], NULL, test_contend, &tctx[i]) == 0);
+	}
+	for (i = 0; i < TEST_THREADS; i++) pthread_join(threads[i], NULL);
+	elapsed = fr_time_sub(fr_time(), start);
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		TEST_CHECK(!tctx[i].failed);
+		TEST_CHECK(!tctx[i].shared);
+	}
+	TEST_CHECK(fr_pool_state(pool)->num <= TEST_THREADS);
+
+	/*
+	 *	Parked connections count as active until
+	 *	the next connection check.
+	 */
+	if (!affinity) TEST_CHECK_LEN(fr_pool_state(pool)->active, 0);
+
+	fr_pool_free(pool);
+	talloc_free(ctx);
+
+	return elapsed;
+}
+
+/*
+ *	Many threads reserving and releasing connections from the same pool
+ */
+static void test_contention_speed(void)
+{
+	fr_time_delta_t	locked, affinity;
+	uint64_t	ops = (uint64_t)TEST_THREADS * TEST_ITERATIONS;
+
+	DEBUG_LVL_SET;
+
+	TEST_CASE("Without affinity");
+	locked = test_contention_run(false);
+
+	TEST_CASE("With affinity");
+	affinity = test_contention_run(true);
+
+	if (acutest_verbose_level_ >= 1) {
+		INFO("%u threads, without affinity %pV (%u ops/s)", TEST_THREADS,
+		     fr_box_time_delta(locked), (uint32_t)(ops / ((float)(fr_time_delta_unwrap(locked)) / NSEC)));
+		INFO("%u threads, with affinity %pV (%u ops/s)", TEST_THREADS,
+		     fr_box_time_delta(affinity), (uint32_t)(ops / ((float)(fr_time_delta_unwrap(affinity)) / NSEC)));
+	}
+}
+
+TEST_LIST = {
+	{ "Pool - Reserve and release",			test_reserve_release },
+	{ "Pool - Steal parked connection",		test_steal },
+	{ "Pool - Stale reserved connections",		test_stale_reserved },
+
+	/*
+	 *	Performance tests
+	 */
+	{ "Speed Test - Contended reserve and release",	test_contention_speed },
+	{ NULL }
+};
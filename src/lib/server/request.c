@@ -354,6 +354,15 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
  */
 static int _request_free(request_t *request)
 {
+	/*
+	 *	Something in another thread may still be using the
+	 *	request.  It's freed when the last hold is released.
+	 */
+	if (unlikely(request->holds > 0)) {
+		request->free_pending = true;
+		return -1;
+	}
+
 	fr_assert_msg(!fr_heap_entry_inserted(request->time_order_id),
 		      "alloced %s:%i: %s still in the time_order heap ID %i",
 		      request->alloc_file,
@@ -556,6 +565,11 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx,
 
 static int _request_local_free(request_t *request)
 {
+	if (unlikely(request->holds > 0)) {
+		request->free_pending = true;
+		return -1;
+	}
+
 	/*
 	 *	Ensure anything that might reference the request is
 	 *	freed before it is.
@@ -692,6 +706,38 @@ int request_detach(request_t *child)
 	return 0;
 }
 
+/** Stop a request from being freed
+ *
+ * Used when something outside of the worker, e.g. an I/O thread, may still
+ * access the request after it has been cancelled.  If the request is freed
+ * whilst held, the free is deferred until the last hold is released.
+ *
+ * Holds must be taken and released in the thread which owns the request.
+ *
+ * @param[in] request	to hold.
+ */
+void request_hold(request_t *request)
+{
+	request->holds++;
+}
+
+/** Release a hold on a request, freeing it if that was deferred
+ *
+ * @param[in] request	to release.  Must not be used after this call
+ *			if the request may have been freed whilst held.
+ */
+void request_release(request_t *request)
+{
+	fr_assert(request->holds > 0);
+
+	if (--request->holds > 0) return;
+
+	if (request->free_pending) {
+		request->free_pending = false;
+		talloc_free(request);
+	}
+}
+
 int request_global_init(void)
 {
 	if (fr_dict_autoload(request_dict) < 0) {
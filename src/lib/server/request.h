@@ -247,6 +247,10 @@ struct request_s {
 
 	fr_dlist_t		listen_entry;	//!< request's entry in the list for this listener / socket
 	fr_dlist_t		free_entry;	//!< Request's entry in the free list.
+
+	uint32_t		holds;		//!< Things which still need the request, even though
+						///< it's done.  See #request_hold.
+	bool			free_pending;	//!< The request was freed whilst held.
 };				/* request_t typedef */
 
 /** Optional arguments for initialising requests
@@ -332,6 +336,10 @@ fr_pair_t	*request_state_replace(request_t *request, fr_pair_t *state) CC_HINT(n
 
 int		request_detach(request_t *child);
 
+void		request_hold(request_t *request) CC_HINT(nonnull);
+
+void		request_release(request_t *request) CC_HINT(nonnull);
+
 int		request_global_init(void);
 void		request_global_free(void);
 
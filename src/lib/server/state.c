@@ -42,6 +42,11 @@
           \-> reply                 \-> reply                 \-> access-reject/access-accept
  * @endverbatim
  *
+ * Entries are spread over a number of shards, selected by a hash of the
+ * state value, each with its own mutex, tree and expiry list.  Workers
+ * handling different sessions will then rarely contend for the same lock.
+ * The limit on the number of sessions applies across all shards.
+ *
  * @copyright 2014 The FreeRADIUS server project
  */
 RCSID("$Id$")
@@ -58,6 +63,12 @@ RCSID("$Id$")
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rand.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -142,19 +153,38 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
+/** A partition of the state tree
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free, ordered
+								///< by cleanup time.
+} fr_state_shard_t;
+
+/** Number of shards to use for thread safe state trees
+ *
+ * Must be a power of 2.
+ */
+#define STATE_SHARDS		32
+
 struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast64_t	timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	atomic_uint_fast32_t	used_sessions;			//!< How many sessions are currently in progress,
+								///< across all shards.
+
+	fr_state_shard_t	*shards;			//!< Array of shards.
+	uint32_t		num_shards;			//!< How many shards have been initialised.
+	uint32_t		shard_mask;			//!< Mask to apply to the hash of a state value
+								///< to get its shard.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entries.
 
-	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	bool			thread_safe;			//!< Whether we lock the shards whilst modifying them.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -166,7 +196,7 @@ struct fr_state_tree_s {
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -180,27 +210,41 @@ static int8_t state_entry_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
+/** Return the shard a state value belongs in
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & state->shard_mask];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -224,12 +268,15 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	num_shards = thread_safe ? STATE_SHARDS : 1;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
 
 	/*
 	 *	Create a break in the contexts.
@@ -240,55 +287,68 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->shards = talloc_zero_array(state, fr_state_shard_t, num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
+	state->shard_mask = num_shards - 1;
+	talloc_set_destructor(state, _state_tree_free);
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
+	for (i = 0; i < num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
+		state->num_shards++;
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
 
 /** Unlink an entry and remove if from the tree
  *
+ * @note Called with the shard's mutex held.
  */
 static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
+	fr_rb_delete(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
 
-/** Frees any data associated with a state
+/** Free any data associated with a state
  *
  */
-static int _state_entry_free(fr_state_entry_t *entry)
+static void state_entry_clear(fr_state_entry_t *entry)
 {
 #ifdef WITH_VERIFY_PTR
 	fr_dcursor_t cursor;
@@ -317,17 +377,118 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	 *	Should also free any state attributes
 	 */
 	if (entry->ctx) TALLOC_FREE(entry->ctx);
+}
+
+/** Frees any data associated with a state, and releases its session
+ *
+ */
+static int _state_entry_free(fr_state_entry_t *entry)
+{
+	state_entry_clear(entry);
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
+/** Unlink any expired entries from a shard
+ *
+ * @note Called with the shard's mutex held.
+ *
+ * @param[in] shard	to expire entries in.
+ * @param[out] to_free	list to add the expired entries to.  These should
+ *			be freed after the mutex is released, as freeing
+ *			may involve significantly more work than just
+ *			freeing the data.
+ * @param[in] now	The current time.
+ * @return The number of entries expired.
+ */
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_dlist_head_t *to_free, fr_time_t now)
+{
+	fr_state_entry_t	*entry;
+	uint64_t		timed_out = 0;
+
+	/*
+	 *	Entries are ordered by cleanup time, so
+	 *	stop at the first one which is still valid.
+	 */
+	while ((entry = fr_dlist_head(&shard->to_expire)) && fr_time_lt(entry->cleanup, now)) {
+		state_entry_unlink(shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
+	}
+
+	return timed_out;
+}
+
+/** Free entries unlinked by #state_shard_expire
+ *
+ * If there's request data that was persisted it will now
+ * be freed also, and it may have complex destructors associated
+ * with it.
+ */
+static void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_pop_head(to_free))) talloc_free(entry);
+}
+
+/** Expire entries in every shard
+ *
+ * Entries are normally only expired from the shard a new entry is being
+ * inserted into.  When we hit the session limit, expired entries in other
+ * shards may be what's holding the sessions.
+ */
+static void state_expire_all(fr_state_tree_t *state, request_t *request, fr_time_t now)
+{
+	fr_dlist_head_t		to_free;
+	uint64_t		timed_out = 0;
+	uint32_t		i;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		PTHREAD_MUTEX_LOCK(&shard->mutex);
+		timed_out += state_shard_expire(shard, &to_free, now);
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+	}
+
+	if (timed_out > 0) {
+		atomic_fetch_add_explicit(&state->timed_out, timed_out, memory_order_relaxed);
+		RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	}
+
+	state_entries_free(&to_free);
+}
+
+/** Reserve a session, without exceeding max_sessions
+ *
+ * @return
+ *	- true if a session was reserved.
+ *	- false if we're at the session limit.
+ */
+static bool state_session_reserve(fr_state_tree_t *state)
+{
+	uint_fast32_t used = atomic_load_explicit(&state->used_sessions, memory_order_relaxed);
+
+	do {
+		if (used >= state->max_sessions) return false;
+	} while (!atomic_compare_exchange_weak_explicit(&state->used_sessions, &used, used + 1,
+							memory_order_relaxed, memory_order_relaxed));
+
+	return true;
+}
+
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * The entry is not inserted into the state tree, that's done with #state_entry_insert.
+ *
+ * @note Called with no mutexes held.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
 					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
@@ -336,13 +497,10 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	fr_state_entry_t	*entry;
 
 	uint8_t			old_state[sizeof(old->state)];
 	int			old_tries = 0;
-	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
 
 	/*
 	 *	Shouldn't be in any lists if it's being reused
@@ -351,87 +509,38 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		  (!fr_dlist_entry_in_list(&old->expire_entry) &&
 		   !fr_rb_node_inline_in_tree(&old->node)));
 
-	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
-
-	/*
-	 *	Clean up expired entries
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
- 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
-
-		if (entry == old) continue;
-
+	if (!old) {
 		/*
-		 *	Too old, we can delete it.
+		 *	Expired entries are only cleaned up when
+		 *	an entry is inserted into the same shard,
+		 *	so sweep every shard before giving up.
 		 */
-		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
-
-		break;
-	}
+		if (!state_session_reserve(state)) {
+			state_expire_all(state, request, now);
 
-	state->timed_out += timed_out;
-
-	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
-	} else {
-		old_tries = old->tries;
-		memcpy(old_state, old->state, sizeof(old_state));
-	}
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
-
-	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
-	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
-	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+			if (!state_session_reserve(state)) {
+				RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+				       state->max_sessions);
+				return NULL;
+			}
+		}
 
-	/*
-	 *	Allocation doesn't need to occur inside the critical region
-	 *	and would add significantly to contention.
-	 */
-	if (!old) {
+		/*
+		 *	Allocation doesn't need to occur inside the critical region
+		 *	and would add significantly to contention.
+		 */
 		MEM(entry = talloc_zero(NULL, fr_state_entry_t));
 		talloc_set_destructor(entry, _state_entry_free);
 		/* tree->used_sessions incremented above */
 	/*
 	 *	Reuse the old state entry cleaning up any memory associated
-	 *	with it.
+	 *	with it.  It keeps the session it was created with.
 	 */
 	} else {
-		_state_entry_free(old);
+		old_tries = old->tries;
+		memcpy(old_state, old->state, sizeof(old_state));
+
+		state_entry_clear(old);
 		talloc_free_children(old);
 		memset(old, 0, sizeof(*old));
 		entry = old;
@@ -441,7 +550,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -531,8 +640,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -541,20 +648,53 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
 
-	if (!fr_rb_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
-		fr_pair_delete_by_da(reply_list, state->da);
-		talloc_free(entry);
-		return NULL;
-	}
+	return entry;
+}
+
+/** Insert a state entry into its shard, expiring any old entries
+ *
+ * @note Called with no mutexes held.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if an entry with the same state value already exists.
+ */
+static int state_entry_insert(fr_state_tree_t *state, request_t *request, fr_state_entry_t *entry)
+{
+	fr_state_shard_t	*shard = state_shard(state, entry);
+	fr_dlist_head_t		to_free;
+	uint64_t		timed_out;
+	int			ret = 0;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
 
 	/*
-	 *	Link it to the end of the list, which is implicitly
-	 *	ordered by cleanup time.
+	 *	Clean up expired entries
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	timed_out = state_shard_expire(shard, &to_free, fr_time());
 
-	return entry;
+	if (!fr_rb_insert(shard->tree, entry)) {
+		ret = -1;
+	} else {
+		/*
+		 *	Link it to the end of the list, which is implicitly
+		 *	ordered by cleanup time.
+		 */
+		fr_dlist_insert_tail(&shard->to_expire, entry);
+	}
+
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
+
+	if (timed_out > 0) {
+		atomic_fetch_add_explicit(&state->timed_out, timed_out, memory_order_relaxed);
+		RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	}
+
+	state_entries_free(&to_free);
+
+	return ret;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
@@ -562,7 +702,8 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
  */
 static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
 	/*
 	 *	Assume our own State first.
@@ -591,11 +732,15 @@ static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = fr_rb_remove(shard->tree, &my_entry);
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		fr_dlist_remove(&shard->to_expire, entry);
 	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	return entry;
 }
@@ -611,13 +756,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 	vp = fr_pair_find_by_da(&request->request_pairs, NULL, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (!entry) return;
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -672,14 +812,11 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching &request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
@@ -761,20 +898,12 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	}
 
 	MEM(state_ctx = request_state_replace(request, NULL));
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 
 	/*
 	 *	Reuses old if possible
 	 */
 	entry = state_entry_create(state, request, &request->reply_pairs, old);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		RERROR("Creating state entry failed");
-
-		talloc_free(request_state_replace(request, state_ctx));
-		request_data_restore(request, &data);	/* Put it back again */
-		return -1;
-	}
+	if (!entry) goto error;
 
 	fr_assert(entry->ctx == NULL);
 	fr_assert(request->session_state_ctx);
@@ -782,12 +911,33 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	entry->seq_start = request->seq_start;
 	entry->ctx = state_ctx;
 	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+
+	if (state_entry_insert(state, request, entry) < 0) {
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		fr_pair_delete_by_da(&request->reply_pairs, state->da);
+
+		/*
+		 *	Take back the session state, so it
+		 *	isn't freed with the entry.
+		 */
+		state_ctx = entry->ctx;
+		entry->ctx = NULL;
+		fr_dlist_move(&data, &entry->data);
+		talloc_free(entry);
+		goto error;
+	}
 
 	RDEBUG3("%s - saved", state->da->name);
 	REQUEST_VERIFY(request);
 
 	return 0;
+
+error:
+	RERROR("Creating state entry failed");
+
+	talloc_free(request_state_replace(request, state_ctx));
+	request_data_restore(request, &data);	/* Put it back again */
+	return -1;
 }
 
 /** Free any subrequest request data if the dlist head is freed
@@ -924,7 +1074,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -932,7 +1082,7 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	return atomic_load_explicit(&state->timed_out, memory_order_relaxed);
 }
 
 /** Return number of entries we're currently tracking
@@ -940,5 +1090,10 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	tracked = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) tracked += fr_rb_num_elements(state->shards[i].tree);
+
+	return tracked;
 }
@@ -333,6 +333,9 @@ struct tmpl_xlat_rules_s {
 	fr_event_list_t		*runtime_el;		//!< The eventlist to use for runtime instantiation
 							///< of xlats.
 	bool			new_functions;		//!< new function syntax
+	bool			disallow_thread_funcs;	//!< Reject functions which need per-thread instance
+							///< data, including all module xlats.  Used where
+							///< one ephemeral instance is shared by every worker.
 };
 
 /** Optional arguments passed to vp_tmpl functions
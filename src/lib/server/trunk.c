@@ -43,6 +43,8 @@ typedef struct fr_trunk_s fr_trunk_t;
 #include <freeradius-devel/util/table.h>
 #include <freeradius-devel/util/minmax_heap.h>
 
+#include <math.h>
+
 #ifdef HAVE_STDATOMIC_H
 #  include <stdatomic.h>
 #else
@@ -51,6 +53,25 @@ typedef struct fr_trunk_s fr_trunk_t;
 
 static atomic_uint_fast64_t request_counter = ATOMIC_VAR_INIT(1);
 
+static fr_dict_t const *dict_freeradius;
+
+extern fr_dict_autoload_t trunk_dict[];
+fr_dict_autoload_t trunk_dict[] = {
+	{ .out = &dict_freeradius, .proto = "freeradius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_trunk_connection_limit;
+static fr_dict_attr_t const *attr_trunk_connection_latency;
+
+extern fr_dict_attr_autoload_t trunk_dict_attr[];
+fr_dict_attr_autoload_t trunk_dict_attr[] = {
+	{ .out = &attr_trunk_connection_limit, .name = "Trunk-Connection-Limit", .type = FR_TYPE_UINT32, .dict = &dict_freeradius },
+	{ .out = &attr_trunk_connection_latency, .name = "Trunk-Connection-Latency", .type = FR_TYPE_TIME_DELTA, .dict = &dict_freeradius },
+
+	{ NULL }
+};
+
 #ifdef TESTING_TRUNK
 static fr_time_t test_time_base = fr_time_wrap(1);
 
@@ -110,6 +131,8 @@ struct fr_trunk_request_s {
 
 	fr_time_t		last_freed;		//!< Last time this request was freed.
 
+	fr_time_t		last_sent;		//!< Last time this request was sent.
+
 	bool			bound_to_conn;		//!< Fail the request if there's an attempt to
 							///< re-enqueue it.
 
@@ -162,6 +185,12 @@ struct fr_trunk_connection_s {
  	 */
  	uint64_t		sent_count;		//!< The number of requests that have been sent using
  							///< this connection.
+
+	fr_time_delta_t		latency_long;		//!< Long term smoothed latency.  Compared with
+							///< the short term value to see if the other end
+							///< is becoming congested.
+
+	double			adaptive_limit;		//!< Unrounded per connection request limit.
  	/** @} */
 
 	/** @name Timers
@@ -292,6 +321,10 @@ static conf_parser_t const fr_trunk_config_request[] = {
 	{ FR_CONF_OFFSET("per_connection_target", fr_trunk_conf_t, target_req_per_conn), .dflt = "1000" },
 	{ FR_CONF_OFFSET("free_delay", fr_trunk_conf_t, req_cleanup_delay), .dflt = "10.0" },
 
+	{ FR_CONF_OFFSET("adaptive", fr_trunk_conf_t, adaptive), .dflt = "no" },
+	{ FR_CONF_OFFSET("adaptive_min", fr_trunk_conf_t, adaptive_min), .dflt = "4" },
+	{ FR_CONF_OFFSET("adaptive_tolerance", fr_trunk_conf_t, adaptive_tolerance), .dflt = "1.5" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -416,12 +449,42 @@ static fr_table_num_ordered_t const fr_trunk_connection_events[] = {
 };
 static size_t fr_trunk_connection_events_len = NUM_ELEMENTS(fr_trunk_connection_events);
 
+/** Send a connection trigger, with the connection's request limit and latency as arguments
+ *
+ * @param[in] tconn	the connection changing state.
+ * @param[in] state	the connection is entering.
+ */
+static void trunk_connection_trigger(fr_trunk_connection_t *tconn, fr_trunk_connection_state_t state)
+{
+	fr_pair_list_t		args;
+	fr_pair_t		*vp;
+
+	fr_pair_list_init(&args);
+
+	/*
+	 *	Only missing if fr_trunk_global_init() wasn't
+	 *	called, in which case the trigger gets no
+	 *	arguments.
+	 */
+	if (unlikely(!attr_trunk_connection_limit)) goto exec;
+
+	MEM(vp = fr_pair_afrom_da(NULL, attr_trunk_connection_limit));
+	vp->vp_uint32 = tconn->pub.limit;
+	fr_pair_append(&args, vp);
+
+	MEM(vp = fr_pair_afrom_da(NULL, attr_trunk_connection_latency));
+	vp->vp_time_delta = tconn->pub.latency;
+	fr_pair_append(&args, vp);
+
+exec:
+	trigger_exec(unlang_interpret_get_thread_default(),
+		     NULL, fr_table_str_by_value(fr_trunk_conn_trigger_names, state, "<INVALID>"), true, &args);
+
+	fr_pair_list_free(&args);
+}
+
 #define CONN_TRIGGER(_state) do { \
-	if (trunk->pub.triggers) { \
-		trigger_exec(unlang_interpret_get_thread_default(), \
-			     NULL, fr_table_str_by_value(fr_trunk_conn_trigger_names, _state, \
-							 "<INVALID>"), true, NULL); \
-	} \
+	if (trunk->pub.triggers) trunk_connection_trigger(tconn, _state); \
 } while (0)
 
 #define CONN_STATE_TRANSITION(_new, _log) \
@@ -888,6 +951,8 @@ static uint64_t trunk_requests_per_connection(uint16_t *conn_count_out, uint32_t
 static int trunk_connection_spawn(fr_trunk_t *trunk, fr_time_t now);
 static inline void trunk_connection_auto_full(fr_trunk_connection_t *tconn);
 static inline void trunk_connection_auto_unfull(fr_trunk_connection_t *tconn);
+static void trunk_latency_sample(fr_trunk_t *trunk, fr_time_delta_t latency);
+static void trunk_connection_latency_sample(fr_trunk_connection_t *tconn, fr_time_delta_t latency);
 static inline void trunk_connection_readable(fr_trunk_connection_t *tconn);
 static inline void trunk_connection_writable(fr_trunk_connection_t *tconn);
 static void trunk_connection_event_update(fr_trunk_connection_t *tconn);
@@ -1006,6 +1071,14 @@ static void trunk_request_remove_from_conn(fr_trunk_request_t *treq)
 		FALL_THROUGH;
 
 	case FR_TRUNK_CONN_ACTIVE:
+		/*
+		 *	The adaptive limit may have been
+		 *	reduced below what's outstanding.
+		 */
+		if (trunk->conf.adaptive) {
+			trunk_connection_auto_full(tconn);
+			if (tconn->pub.state == FR_TRUNK_CONN_FULL) break;
+		}
 		CONN_REORDER(tconn);
 		break;
 
@@ -1255,6 +1328,7 @@ static void trunk_request_enter_sent(fr_trunk_request_t *treq)
 	 *	Update the connection's sent stats
 	 */
 	tconn->sent_count++;
+	treq->last_sent = fr_time();
 
 	/*
 	 *	Enforces max_uses
@@ -1465,6 +1539,9 @@ static void trunk_request_enter_complete(fr_trunk_request_t *treq)
 
 	switch (treq->pub.state) {
 	case FR_TRUNK_REQUEST_STATE_SENT:
+		trunk_connection_latency_sample(tconn, fr_time_sub(fr_time(), treq->last_sent));
+		FALL_THROUGH;
+
 	case FR_TRUNK_REQUEST_STATE_PENDING:
 		trunk_request_remove_from_conn(treq);
 		break;
@@ -1499,6 +1576,20 @@ static void trunk_request_enter_failed(fr_trunk_request_t *treq)
 		REQUEST_EXTRACT_BACKLOG(treq);
 		break;
 
+	case FR_TRUNK_REQUEST_STATE_SENT:
+		/*
+		 *	Usually a timeout.  The other end took at
+		 *	least this long, so don't let the connection's
+		 *	latency suggest otherwise, and let the adaptive
+		 *	limit back off.
+		 */
+		if (tconn) {
+			trunk_connection_latency_sample(tconn, fr_time_sub(fr_time(), treq->last_sent));
+		} else {
+			trunk_latency_sample(trunk, fr_time_sub(fr_time(), treq->last_sent));
+		}
+		FALL_THROUGH;
+
 	default:
 		trunk_request_remove_from_conn(treq);
 		break;
@@ -2642,9 +2733,9 @@ fr_trunk_enqueue_t fr_trunk_request_enqueue_on_conn(fr_trunk_request_t **treq_ou
 	 *	Limits check
 	 */
 	if (!ignore_limits) {
-		if (trunk->conf.max_req_per_conn &&
+		if (tconn->pub.limit &&
 		    (fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL) >=
-		     trunk->conf.max_req_per_conn)) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
+		     tconn->pub.limit)) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
 
 		if (tconn->pub.state != FR_TRUNK_CONN_ACTIVE) return FR_TRUNK_ENQUEUE_NO_CAPACITY;
 	}
@@ -2784,17 +2875,16 @@ uint32_t fr_trunk_request_count_by_connection(fr_trunk_connection_t const *tconn
  */
 static inline void trunk_connection_auto_full(fr_trunk_connection_t *tconn)
 {
-	fr_trunk_t	*trunk = tconn->pub.trunk;
 	uint32_t	count;
 
 	if (tconn->pub.state != FR_TRUNK_CONN_ACTIVE) return;
 
 	/*
-	 *	Enforces max_req_per_conn
+	 *	Enforces max_req_per_conn, or the adaptive limit
 	 */
-	if (trunk->conf.max_req_per_conn > 0) {
+	if (tconn->pub.limit > 0) {
 		count = fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL);
-		if (count >= trunk->conf.max_req_per_conn) trunk_connection_enter_full(tconn);
+		if (count >= tconn->pub.limit) trunk_connection_enter_full(tconn);
 	}
 }
 
@@ -2807,14 +2897,13 @@ static inline void trunk_connection_auto_full(fr_trunk_connection_t *tconn)
  */
 static inline bool trunk_connection_is_full(fr_trunk_connection_t *tconn)
 {
-	fr_trunk_t	*trunk = tconn->pub.trunk;
 	uint32_t	count;
 
 	/*
-	 *	Enforces max_req_per_conn
+	 *	Enforces max_req_per_conn, or the adaptive limit
 	 */
 	count = fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL);
-	if ((trunk->conf.max_req_per_conn == 0) || (count < trunk->conf.max_req_per_conn)) return false;
+	if ((tconn->pub.limit == 0) || (count < tconn->pub.limit)) return false;
 
 	return true;
 }
@@ -2833,6 +2922,150 @@ static inline void trunk_connection_auto_unfull(fr_trunk_connection_t *tconn)
 	if (!trunk_connection_is_full(tconn)) trunk_connection_enter_active(tconn);
 }
 
+/** Change a connection's request limit, keeping the trunk's total up to date
+ *
+ * @param[in] tconn	to change the limit of.
+ * @param[in] limit	New limit.  0 means no limit.
+ */
+static inline void trunk_connection_limit_set(fr_trunk_connection_t *tconn, uint32_t limit)
+{
+	fr_trunk_t *trunk = tconn->pub.trunk;
+
+	trunk->pub.limit -= tconn->pub.limit;
+	trunk->pub.limit += limit;
+	tconn->pub.limit = limit;
+}
+
+/** Reset a connection's latency statistics and request limit
+ *
+ * With adaptive limits enabled, connections start at target_req_per_conn
+ * and latency samples move the limit from there.
+ *
+ * @param[in] tconn	to reset.
+ */
+static void trunk_connection_limit_reset(fr_trunk_connection_t *tconn)
+{
+	fr_trunk_t	*trunk = tconn->pub.trunk;
+	uint32_t	limit;
+
+	tconn->pub.latency = fr_time_delta_wrap(0);
+	tconn->latency_long = fr_time_delta_wrap(0);
+
+	if (!trunk->conf.adaptive) {
+		trunk_connection_limit_set(tconn, trunk->conf.max_req_per_conn);
+		return;
+	}
+
+	limit = trunk->conf.target_req_per_conn;
+	if (limit < trunk->conf.adaptive_min) limit = trunk->conf.adaptive_min;
+	if (trunk->conf.max_req_per_conn && (limit > trunk->conf.max_req_per_conn)) limit = trunk->conf.max_req_per_conn;
+
+	tconn->adaptive_limit = limit;
+	trunk_connection_limit_set(tconn, limit);
+}
+
+/** Record how long a request took to complete, across all connections in the trunk
+ *
+ * @param[in] trunk	the request completed on.
+ * @param[in] latency	between the request being sent and the response arriving.
+ */
+static void trunk_latency_sample(fr_trunk_t *trunk, fr_time_delta_t latency)
+{
+	int64_t		sample = fr_time_delta_unwrap(latency);
+	int64_t		avg = fr_time_delta_unwrap(trunk->pub.latency);
+
+	if (sample <= 0) sample = 1;
+
+	if (avg == 0) {
+		avg = sample;
+	} else {
+		avg += (sample - avg) / 8;
+		if (avg <= 0) avg = 1;
+	}
+
+	trunk->pub.latency = fr_time_delta_wrap(avg);
+}
+
+/** Record how long a request took to complete, and adjust the connection's request limit
+ *
+ * Two moving averages of latency are kept.  A short term one which
+ * tracks the current state of the other end, and a long term one which
+ * approximates its uncongested latency.  The ratio of the two gives a
+ * gradient which is used to shrink the limit when latency rises, and
+ * a small additive term (the square root of the limit) lets the limit
+ * grow when latency is flat.
+ *
+ * The connection is marked full by #trunk_request_remove_from_conn if the
+ * limit drops below the number of outstanding requests.  Requests over the
+ * limit stay in the trunk's backlog, and the connection management code
+ * opens additional connections if all of them are full.
+ *
+ * @param[in] tconn	the request completed on.
+ * @param[in] latency	between the request being sent and the response arriving.
+ */
+static void trunk_connection_latency_sample(fr_trunk_connection_t *tconn, fr_time_delta_t latency)
+{
+	fr_trunk_t	*trunk = tconn->pub.trunk;
+	int64_t		sample = fr_time_delta_unwrap(latency);
+	int64_t		short_term, long_term;
+	double		gradient, limit, max;
+	uint32_t	count;
+
+	trunk_latency_sample(trunk, latency);
+
+	if (sample <= 0) sample = 1;
+
+	/*
+	 *	Seed both averages with the first sample
+	 */
+	short_term = fr_time_delta_unwrap(tconn->pub.latency);
+	if (short_term == 0) {
+		short_term = long_term = sample;
+	} else {
+		long_term = fr_time_delta_unwrap(tconn->latency_long);
+		short_term += (sample - short_term) / 8;
+		long_term += (sample - long_term) / 128;
+		if (short_term <= 0) short_term = 1;
+		if (long_term <= 0) long_term = 1;
+	}
+
+	/*
+	 *	The other end has recovered from whatever
+	 *	slowed it down, let the long term average
+	 *	catch up quickly.
+	 */
+	if (long_term > (short_term * 2)) long_term = (long_term * 95) / 100;
+
+	tconn->pub.latency = fr_time_delta_wrap(short_term);
+	tconn->latency_long = fr_time_delta_wrap(long_term);
+
+	if (!trunk->conf.adaptive) return;
+
+	gradient = (trunk->conf.adaptive_tolerance * (double)long_term) / (double)short_term;
+	if (gradient > 1.0) {
+		gradient = 1.0;
+	} else if (gradient < 0.5) {
+		gradient = 0.5;
+	}
+
+	/*
+	 *	Don't grow the limit of connections which
+	 *	aren't making use of what they've already got.
+	 */
+	count = fr_trunk_request_count_by_connection(tconn, FR_TRUNK_REQUEST_STATE_ALL);
+	if ((gradient >= 1.0) && (count < (tconn->adaptive_limit / 2))) return;
+
+	limit = (tconn->adaptive_limit * gradient) + sqrt(tconn->adaptive_limit);
+	limit = (tconn->adaptive_limit * 0.8) + (limit * 0.2);
+
+	max = trunk->conf.max_req_per_conn ? trunk->conf.max_req_per_conn : UINT32_MAX;
+	if (limit > max) limit = max;
+	if (limit < trunk->conf.adaptive_min) limit = trunk->conf.adaptive_min;
+
+	tconn->adaptive_limit = limit;
+	trunk_connection_limit_set(tconn, (uint32_t)limit);
+}
+
 /** A connection is readable.  Call the request_demux function to read pending requests
  *
  */
@@ -3432,6 +3665,7 @@ static void _trunk_connection_on_closed(UNUSED fr_connection_t *conn,
 	 *	Clear statistics and flags
 	 */
 	tconn->sent_count = 0;
+	trunk_connection_limit_reset(tconn);
 
 	/*
 	 *	Remove the reconnect event
@@ -3556,6 +3790,8 @@ static int _trunk_connection_free(fr_trunk_connection_t *tconn)
 	fr_assert(tconn->pub.state == FR_TRUNK_CONN_HALTED);
 	fr_assert(!fr_dlist_entry_in_list(&tconn->entry));	/* Should not be in a list */
 
+	trunk_connection_limit_set(tconn, 0);
+
 	/*
 	 *	Loop over all the requests we gathered
 	 *	and transition them to the failed state,
@@ -3641,6 +3877,7 @@ static int trunk_connection_spawn(fr_trunk_t *trunk, fr_time_t now)
 	fr_dlist_talloc_init(&tconn->sent, fr_trunk_request_t, entry);
 	fr_dlist_talloc_init(&tconn->cancel, fr_trunk_request_t, entry);
 	fr_dlist_talloc_init(&tconn->cancel_sent, fr_trunk_request_t, entry);
+	trunk_connection_limit_reset(tconn);
 
 	/*
 	 *	OK, we have the connection, now setup watch
@@ -4738,6 +4975,32 @@ static int _trunk_free(fr_trunk_t *trunk)
 	return 0;
 }
 
+/** Load the attributes passed to connection triggers
+ *
+ * @note Call #fr_trunk_global_free when the server is done to avoid leaks.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_trunk_global_init(void)
+{
+	if (fr_dict_autoload(trunk_dict) < 0) {
+	error:
+		fr_perror("fr_trunk_global_init");
+		return -1;
+	}
+
+	if (fr_dict_attr_autoload(trunk_dict_attr) < 0) goto error;
+
+	return 0;
+}
+
+void fr_trunk_global_free(void)
+{
+	fr_dict_autofree(trunk_dict);
+}
+
 /** Allocate a new collection of connections
  *
  * This function should be called first to allocate a new trunk connection.
@@ -4787,6 +5050,13 @@ fr_trunk_t *fr_trunk_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
 	if (!trunk->funcs.request_prioritise) trunk->funcs.request_prioritise = fr_pointer_cmp;
 
 	memcpy(&trunk->conf, conf, sizeof(trunk->conf));
+	if (trunk->conf.adaptive) {
+		if (trunk->conf.adaptive_min == 0) trunk->conf.adaptive_min = 1;
+		if (trunk->conf.max_req_per_conn && (trunk->conf.adaptive_min > trunk->conf.max_req_per_conn)) {
+			trunk->conf.adaptive_min = trunk->conf.max_req_per_conn;
+		}
+		if (trunk->conf.adaptive_tolerance < 1.0) trunk->conf.adaptive_tolerance = 1.0;
+	}
 
 	memcpy(&trunk->uctx, &uctx, sizeof(trunk->uctx));
 	talloc_set_destructor(trunk, _trunk_free);
@@ -230,6 +230,17 @@ typedef struct {
 							///< Used to determine if we need to create new connections
 							///< and whether we can enqueue new requests.
 
+	bool			adaptive;		//!< Vary the number of requests allowed on each
+							///< connection based on observed response latency.
+							///< When set, max_req_per_conn becomes the upper bound
+							///< on the per connection limit.
+
+	uint32_t		adaptive_min;		//!< Lowest the adaptive per connection limit can go.
+
+	double			adaptive_tolerance;	//!< How far short term latency may rise above
+							///< the long term average before the per connection
+							///< limit is reduced.
+
 	uint64_t		max_uses;		//!< The maximum time a connection can be used.
 
 	fr_time_delta_t		lifetime;		//!< Time between reconnects.
@@ -309,6 +320,17 @@ struct fr_trunk_pub_s {
 	uint64_t _CONST		req_alloc_new;		//!< How many requests we've allocated.
 
 	uint64_t _CONST		req_alloc_reused;	//!< How many requests were reused.
+
+	fr_time_delta_t _CONST	latency;		//!< Smoothed time between requests being sent and
+							///< their responses arriving, across all connections.
+							///< Requests which fail after being sent count as having
+							///< taken as long as they waited.  0 until the first
+							///< response.
+
+	uint64_t _CONST		limit;			//!< Sum of the request limits of all connections.
+							///< With adaptive limits, how many requests can be
+							///< outstanding before requests are backlogged.
+							///< Connections without a limit don't count.
 	/** @} */
 
 	bool _CONST		triggers;		//!< do we run the triggers?
@@ -352,6 +374,16 @@ struct fr_trunk_connection_pub_s {
 	fr_connection_t		* _CONST conn;		//!< The underlying connection.
 
 	fr_trunk_t		* _CONST trunk;		//!< Trunk this connection belongs to.
+
+	/** @name Statistics
+	 * @{
+ 	 */
+	fr_time_delta_t _CONST	latency;		//!< Smoothed time between a request being sent
+							///< on this connection and its response arriving.
+
+	uint32_t _CONST		limit;			//!< How many requests may currently be outstanding
+							///< on this connection.  0 means no limit.
+	/** @} */
 };
 
 #ifndef TRUNK_TESTS
@@ -876,6 +908,10 @@ void		fr_trunk_reconnect(fr_trunk_t *trunk, int state, fr_connection_reason_t re
 /** @name Trunk allocation
  * @{
  */
+int		fr_trunk_global_init(void);
+
+void		fr_trunk_global_free(void);
+
 int		fr_trunk_start(fr_trunk_t *trunk) CC_HINT(nonnull);
 
 void		fr_trunk_connection_manage_start(fr_trunk_t *trunk) CC_HINT(nonnull);
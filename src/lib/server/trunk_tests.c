@@ -1830,6 +1830,103 @@ static void test_connection_levels_alternating_edges(void)
 	talloc_free(ctx);
 }
 
+static void test_connection_adaptive_limit(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_trunk_t		*trunk;
+	fr_event_list_t		*el;
+	fr_trunk_conf_t		conf = {
+					.start = 1,
+					.min = 1,
+					.max = 1,
+					.max_req_per_conn = 100,
+					.target_req_per_conn = 40,
+					.adaptive = true,
+					.adaptive_min = 4,
+					.adaptive_tolerance = 1.5,
+					.manage_interval = fr_time_delta_from_nsec(NSEC * 0.5)
+				};
+	test_proto_request_t	*preq;
+	fr_trunk_connection_t	*tconn;
+	fr_trunk_request_t	*treq;
+	uint32_t		shrunk, grown;
+	int			i;
+
+	DEBUG_LVL_SET;
+
+	el = fr_event_list_alloc(ctx, NULL, NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	trunk = test_setup_trunk(ctx, el, &conf, false, NULL);
+	preq = talloc_zero(ctx, test_proto_request_t);
+
+	/*
+	 *	Allow the connection to open
+	 */
+	fr_event_corral(el, test_time_base, false);
+	fr_event_service(el);
+
+	tconn = fr_minmax_heap_min_peek(trunk->active);
+	TEST_CHECK(tconn != NULL);
+	if (!tconn) {
+		talloc_free(ctx);
+		return;
+	}
+
+	TEST_CASE("C1 connected - Limit starts at target");
+	TEST_CHECK_LEN(tconn->pub.limit, 40);
+	TEST_CHECK_LEN(trunk->pub.limit, 40);
+
+	TEST_CASE("C1 connected, R0 - Flat latency must not grow an idle connection's limit");
+	for (i = 0; i < 100; i++) trunk_connection_latency_sample(tconn, fr_time_delta_from_msec(1));
+	TEST_CHECK_LEN(tconn->pub.limit, 40);
+	TEST_CHECK(fr_time_delta_eq(tconn->pub.latency, fr_time_delta_from_msec(1)));
+	TEST_CHECK(fr_time_delta_eq(trunk->pub.latency, fr_time_delta_from_msec(1)));
+
+	TEST_CASE("C1 connected, R0 - Rising latency shrinks the limit");
+	for (i = 0; i < 100; i++) trunk_connection_latency_sample(tconn, fr_time_delta_from_msec(10));
+	shrunk = tconn->pub.limit;
+	TEST_CHECK(fr_time_delta_gt(trunk->pub.latency, fr_time_delta_from_msec(9)));
+	TEST_CHECK(shrunk < 40);
+	TEST_MSG("Expected limit < 40, got %u", shrunk);
+	TEST_CHECK(shrunk >= conf.adaptive_min);
+	TEST_CHECK_LEN(trunk->pub.limit, shrunk);
+
+	/*
+	 *	Load the connection up to just below its limit
+	 */
+	for (i = 0; i < (int)shrunk - 1; i++) {
+		treq = NULL;
+		TEST_CHECK(fr_trunk_request_enqueue_on_conn(&treq, tconn, NULL, preq, NULL, false) == FR_TRUNK_ENQUEUE_OK);
+	}
+	TEST_CHECK(tconn->pub.state == FR_TRUNK_CONN_ACTIVE);
+
+	TEST_CASE("C1 active, R(limit - 1) - Flat latency under load grows the limit");
+	for (i = 0; i < 2000; i++) trunk_connection_latency_sample(tconn, fr_time_delta_from_msec(10));
+	TEST_CHECK(tconn->pub.limit > shrunk);
+	TEST_MSG("Expected limit > %u, got %u", shrunk, tconn->pub.limit);
+	TEST_CHECK(tconn->pub.limit <= conf.max_req_per_conn);
+	TEST_CHECK_LEN(trunk->pub.limit, tconn->pub.limit);
+
+	TEST_CASE("C1 active, R(limit - 1) - Timeouts shrink the limit");
+	grown = tconn->pub.limit;
+	for (i = 0; i < 10; i++) {
+		treq = fr_heap_peek(tconn->pending);
+		if (!TEST_CHECK(treq != NULL)) break;
+
+		trunk_request_enter_sent(treq);
+		test_time_base = fr_time_add_time_delta(test_time_base, fr_time_delta_from_sec(1));
+		fr_trunk_request_signal_fail(treq);
+	}
+	TEST_CHECK(tconn->pub.limit < grown);
+	TEST_MSG("Expected limit < %u, got %u", grown, tconn->pub.limit);
+	TEST_CHECK(tconn->pub.limit >= conf.adaptive_min);
+	TEST_CHECK(fr_time_delta_gt(tconn->pub.latency, fr_time_delta_from_msec(100)));
+	TEST_CHECK_LEN(trunk->pub.limit, tconn->pub.limit);
+
+	talloc_free(ctx);
+}
+
 #undef fr_time	/* Need to the real time */
 static void test_enqueue_and_io_speed(void)
 {
@@ -1977,6 +2074,11 @@ TEST_LIST = {
 	{ "Spawn - Connection levels max",		test_connection_levels_max },
 	{ "Spawn - Connection levels alternating edges",test_connection_levels_alternating_edges },
 
+	/*
+	 *	Adaptive request limits
+	 */
+	{ "Adaptive - Limit follows latency",		test_connection_adaptive_limit },
+
 	/*
 	 *	Performance tests
 	 */
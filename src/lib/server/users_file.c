@@ -37,8 +37,8 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <fcntl.h>
 
-static int pairlist_read_internal(TALLOC_CTX *ctx, fr_dict_t const *dict, char const *file, PAIR_LIST_LIST *list,
-				  bool complain, int *order);
+static int pairlist_read_internal(TALLOC_CTX *ctx, fr_event_list_t *el, fr_dict_t const *dict, char const *file,
+				  PAIR_LIST_LIST *list, bool complain, int *order);
 
 static inline void line_error_marker(char const *src_file, int src_line,
 				     char const *user_file, int user_line,
@@ -140,8 +140,8 @@ static fr_sbuff_parse_rules_t const rhs_term = {
 /*
  *	Caller saw a $INCLUDE at the start of a line.
  */
-static int users_include(TALLOC_CTX *ctx, fr_dict_t const *dict, fr_sbuff_t *sbuff, PAIR_LIST_LIST *list,
-			 char const *file, int lineno, int *order)
+static int users_include(TALLOC_CTX *ctx, fr_event_list_t *el, fr_dict_t const *dict, fr_sbuff_t *sbuff,
+			 PAIR_LIST_LIST *list, char const *file, int lineno, int *order)
 {
 	size_t		len;
 	char		*newfile, *p, c;
@@ -221,7 +221,7 @@ static int users_include(TALLOC_CTX *ctx, fr_dict_t const *dict, fr_sbuff_t *sbu
 	/*
 	 *	Read the $INCLUDEd file recursively.
 	 */
-	if (pairlist_read_internal(ctx, dict, newfile, list, false, order) != 0) {
+	if (pairlist_read_internal(ctx, el, dict, newfile, list, false, order) != 0) {
 		ERROR("%s[%d]: Could not read included file %s: %s",
 		      file, lineno, newfile, fr_syserror(errno));
 		talloc_free(newfile);
@@ -236,13 +236,42 @@ int pairlist_read(TALLOC_CTX *ctx, fr_dict_t const *dict, char const *file, PAIR
 {
 	int order = 0;
 
-	return pairlist_read_internal(ctx, dict, file, list, true, &order);
+	return pairlist_read_internal(ctx, NULL, dict, file, list, true, &order);
+}
+
+/** Read a users file whose data may be replaced while the server is running
+ *
+ * Any xlats are instantiated immediately using the event list passed in,
+ * instead of being registered for instantiation with the rest of the
+ * configuration.  The resulting instances are shared by every worker, so
+ * expansion functions which need per-thread data (including all module
+ * functions) are rejected.
+ *
+ * Callers should use this both for the initial read and for any re-reads,
+ * so that the same files are accepted in both cases.
+ *
+ * @param[in] ctx	to allocate entries in.
+ * @param[in] el	to pass to xlat instantiation functions.
+ * @param[in] dict	to resolve attribute references in.
+ * @param[in] file	to read.
+ * @param[out] list	to add entries to.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int pairlist_read_shared(TALLOC_CTX *ctx, fr_event_list_t *el, fr_dict_t const *dict, char const *file,
+			 PAIR_LIST_LIST *list)
+{
+	int order = 0;
+
+	return pairlist_read_internal(ctx, el, dict, file, list, true, &order);
 }
 
 /*
  *	Read the users file. Return a PAIR_LIST.
  */
-static int pairlist_read_internal(TALLOC_CTX *ctx, fr_dict_t const *dict, char const *file, PAIR_LIST_LIST *list, bool complain, int *order)
+static int pairlist_read_internal(TALLOC_CTX *ctx, fr_event_list_t *el, fr_dict_t const *dict, char const *file,
+				  PAIR_LIST_LIST *list, bool complain, int *order)
 {
 	char			*q;
 	int			lineno		= 1;
@@ -273,7 +302,12 @@ static int pairlist_read_internal(TALLOC_CTX *ctx, fr_dict_t const *dict, char c
 			.prefix = TMPL_ATTR_REF_PREFIX_AUTO,
 			.list_def = request_attr_request,
 			.list_presence = TMPL_ATTR_LIST_ALLOW,
-		}
+		},
+		.xlat = {
+			.runtime_el = el,
+			.disallow_thread_funcs = (el != NULL),
+		},
+		.at_runtime = (el != NULL)
 	};
 	rhs_rules = (tmpl_rules_t) {
 		.attr = {
@@ -281,7 +315,12 @@ static int pairlist_read_internal(TALLOC_CTX *ctx, fr_dict_t const *dict, char c
 			.prefix = TMPL_ATTR_REF_PREFIX_YES,
 			.list_def = request_attr_request,
 			.list_presence = TMPL_ATTR_LIST_ALLOW,
-		}
+		},
+		.xlat = {
+			.runtime_el = el,
+			.disallow_thread_funcs = (el != NULL),
+		},
+		.at_runtime = (el != NULL)
 	};
 
 	while (true) {
@@ -321,7 +360,7 @@ static int pairlist_read_internal(TALLOC_CTX *ctx, fr_dict_t const *dict, char c
 		 *	the tail of the current list.
 		 */
 		if (fr_sbuff_is_str(&sbuff, "$INCLUDE", 8)) {
-			if (users_include(ctx, dict, &sbuff, list, file, lineno, order) < 0) goto fail;
+			if (users_include(ctx, el, dict, &sbuff, list, file, lineno, order) < 0) goto fail;
 
 			if (fr_sbuff_next_if_char(&sbuff, '\n')) {
 				lineno++;
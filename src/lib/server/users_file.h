@@ -55,6 +55,8 @@ typedef struct pair_list_list {
 
 /* users_file.c */
 int		pairlist_read(TALLOC_CTX *ctx, fr_dict_t const *dict, char const *file, PAIR_LIST_LIST *list);
+int		pairlist_read_shared(TALLOC_CTX *ctx, fr_event_list_t *el, fr_dict_t const *dict, char const *file,
+				     PAIR_LIST_LIST *list);
 
 static inline void pairlist_list_init(PAIR_LIST_LIST *list)
 {
@@ -36,6 +36,9 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/unlang/subrequest.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/metrics.h>
+#include <freeradius-devel/util/rb.h>
 
 #include "attrs.h"
 #include "base.h"
@@ -47,6 +50,8 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <openssl/ssl.h>
 #include <openssl/kdf.h>
 
+#include <pthread.h>
+
 /** Retrieve session ID (in binary form) from the session
  *
  * @param[in] ctx	Where to allocate the array to hold the session id.
@@ -160,6 +165,255 @@ void _tls_cache_clear_state_reset(request_t *request, fr_tls_cache_t *cache, cha
 }
 #define tls_cache_clear_state_reset(_request, _cache) _tls_cache_clear_state_reset(_request, _cache, __FUNCTION__)
 
+/** A session held in the in-memory cache
+ *
+ * Sessions are stored in their serialised form, so that no
+ * OpenSSL structures are shared between threads.
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of sessions.
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+
+	uint8_t			*id;			//!< Session ID.
+	size_t			id_len;			//!< Length of the session ID.
+
+	uint8_t			*data;			//!< DER encoded SSL_SESSION.
+	size_t			data_len;		//!< Length of the session data.
+
+	fr_time_t		expires;		//!< When the session can no longer be resumed.
+} tls_cache_local_entry_t;
+
+/** In-memory session cache, shared between all threads using a TLS configuration
+ *
+ */
+struct fr_tls_cache_local_s {
+	pthread_mutex_t		mutex;			//!< Protects the tree, LRU list and stats.
+	fr_rb_tree_t		*tree;			//!< Sessions ordered by session ID.
+	fr_dlist_head_t		lru;			//!< Least recently used sessions at the tail.
+	uint32_t		max_entries;		//!< Maximum number of sessions to hold.
+	fr_tls_cache_local_stats_t stats;		//!< Hit, miss and eviction counters.
+
+	fr_metric_t		*hits;			//!< Exported copies of the counters.
+	fr_metric_t		*misses;
+	fr_metric_t		*stores;
+	fr_metric_t		*evictions;
+	fr_metric_t		*expired;
+};
+
+/** Increment one of the cache's counters, and its exported copy
+ *
+ * Must be called with the cache mutex held.
+ */
+#define TLS_CACHE_LOCAL_COUNT(_cache, _counter) \
+do { \
+	(_cache)->stats._counter++; \
+	fr_metric_inc((_cache)->_counter, 1); \
+} while (0)
+
+static int8_t tls_cache_local_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_local_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, id, id_len);
+
+	return 0;
+}
+
+static void tls_cache_local_entry_remove(fr_tls_cache_local_t *cache, tls_cache_local_entry_t *entry)
+{
+	fr_rb_delete(cache->tree, entry);
+	fr_dlist_remove(&cache->lru, entry);
+	talloc_free(entry);
+}
+
+static int _tls_cache_local_free(fr_tls_cache_local_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a new in-memory session cache
+ *
+ * The cache's counters are also registered as metrics, labelled with
+ * the name of the TLS configuration, so that they can be read with
+ * "stats metrics" in radmin.
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of sessions to hold.
+ * @param[in] name		of the TLS configuration using the cache.
+ * @return A new session cache.
+ */
+fr_tls_cache_local_t *fr_tls_cache_local_alloc(TALLOC_CTX *ctx, uint32_t max_entries, char const *name)
+{
+	fr_tls_cache_local_t *cache;
+
+	MEM(cache = talloc_zero(ctx, fr_tls_cache_local_t));
+	MEM(cache->tree = fr_rb_inline_talloc_alloc(cache, tls_cache_local_entry_t, node,
+						    tls_cache_local_entry_cmp, NULL));
+	fr_dlist_talloc_init(&cache->lru, tls_cache_local_entry_t, entry);
+	cache->max_entries = max_entries;
+
+	/*
+	 *	Registering the same name again (e.g. on HUP)
+	 *	returns the existing metrics, so the counts
+	 *	carry on from where they were.
+	 */
+	cache->hits = fr_metric_register(FR_METRIC_TYPE_COUNTER, "freeradius_tls_session_cache_hits_total",
+					 "Sessions found in the in-memory TLS session cache.",
+					 "tls", name, NULL);
+	cache->misses = fr_metric_register(FR_METRIC_TYPE_COUNTER, "freeradius_tls_session_cache_misses_total",
+					   "Sessions not found in the in-memory TLS session cache.",
+					   "tls", name, NULL);
+	cache->stores = fr_metric_register(FR_METRIC_TYPE_COUNTER, "freeradius_tls_session_cache_stores_total",
+					   "Sessions added to the in-memory TLS session cache.",
+					   "tls", name, NULL);
+	cache->evictions = fr_metric_register(FR_METRIC_TYPE_COUNTER, "freeradius_tls_session_cache_evictions_total",
+					      "Sessions removed from the in-memory TLS session cache to make room.",
+					      "tls", name, NULL);
+	cache->expired = fr_metric_register(FR_METRIC_TYPE_COUNTER, "freeradius_tls_session_cache_expired_total",
+					    "Sessions removed from the in-memory TLS session cache after their lifetime elapsed.",
+					    "tls", name, NULL);
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _tls_cache_local_free);
+
+	return cache;
+}
+
+/** Retrieve a copy of the in-memory cache counters
+ *
+ * @param[out] out		Where to write the counters.
+ * @param[in] cache		to retrieve the counters for.
+ */
+void fr_tls_cache_local_stats(fr_tls_cache_local_stats_t *out, fr_tls_cache_local_t *cache)
+{
+	pthread_mutex_lock(&cache->mutex);
+	*out = cache->stats;
+	out->entries = fr_rb_num_elements(cache->tree);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Find a session in the in-memory cache
+ *
+ * @param[in] cache		to search in.
+ * @param[in] id		Session ID.
+ * @param[in] id_len		Length of the session ID.
+ * @return
+ *	- A deserialised session.  Must be freed with SSL_SESSION_free().
+ *	- NULL if no session was found, or it has expired.
+ */
+static SSL_SESSION *tls_cache_local_find(fr_tls_cache_local_t *cache, uint8_t const *id, size_t id_len)
+{
+	tls_cache_local_entry_t	*entry;
+	SSL_SESSION		*sess = NULL;
+	uint8_t const		*p;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(tls_cache_local_entry_t){ .id = UNCONST(uint8_t *, id), .id_len = id_len });
+	if (!entry) goto done;
+
+	if (fr_time_lteq(entry->expires, fr_time())) {
+		TLS_CACHE_LOCAL_COUNT(cache, expired);
+		tls_cache_local_entry_remove(cache, entry);
+		goto done;
+	}
+
+	p = entry->data;
+	sess = d2i_SSL_SESSION(NULL, &p, entry->data_len);
+	if (!sess) {
+		tls_cache_local_entry_remove(cache, entry);
+		goto done;
+	}
+
+	fr_dlist_remove(&cache->lru, entry);
+	fr_dlist_insert_head(&cache->lru, entry);
+
+done:
+	if (sess) {
+		TLS_CACHE_LOCAL_COUNT(cache, hits);
+	} else {
+		TLS_CACHE_LOCAL_COUNT(cache, misses);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return sess;
+}
+
+/** Add a session to the in-memory cache, evicting the least recently used session if the cache is full
+ *
+ * @param[in] cache		to add the session to.
+ * @param[in] id		Session ID.
+ * @param[in] id_len		Length of the session ID.
+ * @param[in] data		DER encoded SSL_SESSION.
+ * @param[in] data_len		Length of the session data.
+ * @param[in] expires		When the session can no longer be resumed.
+ */
+static void tls_cache_local_insert(fr_tls_cache_local_t *cache, uint8_t const *id, size_t id_len,
+				   uint8_t const *data, size_t data_len, fr_time_t expires)
+{
+	tls_cache_local_entry_t	*entry, *old;
+
+	/*
+	 *	Copy outside of the lock
+	 */
+	MEM(entry = talloc_zero(NULL, tls_cache_local_entry_t));
+	MEM(entry->id = talloc_memdup(entry, id, id_len));
+	entry->id_len = id_len;
+	MEM(entry->data = talloc_memdup(entry, data, data_len));
+	entry->data_len = data_len;
+	entry->expires = expires;
+
+	pthread_mutex_lock(&cache->mutex);
+	old = fr_rb_find(cache->tree, entry);
+	if (old) {
+		tls_cache_local_entry_remove(cache, old);
+	} else {
+		while (fr_rb_num_elements(cache->tree) >= cache->max_entries) {
+			old = fr_dlist_tail(&cache->lru);
+			if (fr_time_lteq(old->expires, fr_time())) {
+				TLS_CACHE_LOCAL_COUNT(cache, expired);
+			} else {
+				TLS_CACHE_LOCAL_COUNT(cache, evictions);
+			}
+			tls_cache_local_entry_remove(cache, old);
+		}
+	}
+
+	talloc_steal(cache, entry);
+	fr_rb_insert(cache->tree, entry);
+	fr_dlist_insert_head(&cache->lru, entry);
+	TLS_CACHE_LOCAL_COUNT(cache, stores);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Remove a session from the in-memory cache
+ *
+ * @param[in] cache		to remove the session from.
+ * @param[in] id		Session ID.
+ * @param[in] id_len		Length of the session ID.
+ */
+static void tls_cache_local_delete(fr_tls_cache_local_t *cache, uint8_t const *id, size_t id_len)
+{
+	tls_cache_local_entry_t	*entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(tls_cache_local_entry_t){ .id = UNCONST(uint8_t *, id), .id_len = id_len });
+	if (entry) tls_cache_local_entry_remove(cache, entry);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Whether `store session { ... }` and `clear session { ... }` should be called
+ *
+ */
+static inline CC_HINT(always_inline)
+bool tls_cache_write_through(fr_tls_conf_t const *conf)
+{
+	if (!conf->cache.use_virtual_server) return false;
+
+	return !conf->cache.local_cache || conf->cache.local.write_through;
+}
+
 /** Serialize the session-state list and store it in the SSL_SESSION *
  *
  */
@@ -284,6 +538,7 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 {
 	fr_tls_session_t	*tls_session;
 	fr_tls_cache_t		*tls_cache;
+	fr_tls_conf_t		*conf;
 	request_t		*request;
 
 	tls_session = talloc_get_type_abort(SSL_SESSION_get_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION), fr_tls_session_t);
@@ -291,6 +546,7 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 	if (!tls_session->cache) return;
 
 	request = fr_tls_session_request(tls_session->ssl);
+	conf = fr_tls_session_conf(tls_session->ssl);
 	tls_cache = tls_session->cache;
 
 	/*
@@ -298,6 +554,30 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 	 */
 	if (unlang_request_is_cancelled(request)) return;
 
+	/*
+	 *	The in-memory copy can be removed immediately
+	 */
+	if (conf->cache.local_cache) {
+		unsigned int	len;
+		uint8_t const	*id;
+
+		id = SSL_SESSION_get_id(sess, &len);
+		if (id) tls_cache_local_delete(conf->cache.local_cache, id, len);
+
+		if (!tls_cache_write_through(conf)) {
+			RDEBUG3("Session ID %pV - Cleared session from memory", fr_box_octets(id, len));
+
+			/*
+			 *	Don't store the session we've just cleared
+			 */
+			if ((tls_cache->store.state == FR_TLS_CACHE_STORE_REQUESTED) &&
+			    (tls_cache->store.sess == sess)) tls_cache_store_state_reset(request, tls_cache);
+
+			if (tls_session->session == sess) tls_session->session = NULL;
+			return;
+		}
+	}
+
 	fr_assert(tls_cache->clear.state == FR_TLS_CACHE_CLEAR_INIT);
 
 	/*
@@ -345,6 +625,7 @@ static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSE
 {
 	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
 	fr_tls_cache_t		*tls_cache = tls_session->cache;
+	fr_tls_conf_t		*conf = fr_tls_session_conf(tls_session->ssl);
 	fr_pair_t		*vp;
 	uint8_t const		*q, **p;
 	SSL_SESSION		*sess;
@@ -391,6 +672,21 @@ static unlang_action_t tls_cache_load_result(UNUSED rlm_rcode_t *p_result, UNUSE
 	 */
 	SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, fr_tls_session(tls_session->ssl));
 
+	/*
+	 *	Keep a copy in memory so the next
+	 *	resumption doesn't need to call the
+	 *	virtual server.
+	 */
+	if (conf->cache.local_cache) {
+		fr_time_t	expires = fr_time_from_sec((time_t)(SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess)));
+
+		if (fr_time_gt(expires, fr_time())) {
+			tls_cache_local_insert(conf->cache.local_cache,
+					       tls_cache->load.id, talloc_array_length(tls_cache->load.id),
+					       vp->vp_octets, vp->vp_length, expires);
+		}
+	}
+
 	tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
 	tls_cache->load.sess = sess;	/* This is consumed in tls_cache_load_cb */
 
@@ -512,29 +808,6 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	 */
 	if (tls_cache_app_data_set(request, sess) < 0) return UNLANG_ACTION_FAIL;
 
-	MEM(child = unlang_subrequest_alloc(request, dict_tls));
-	request = child;
-
-	/*
-	 *	Setup the child request for storing
-	 *	session resumption data.
-	 */
-	MEM(pair_prepend_request(&vp, attr_tls_packet_type) >= 0);
-	vp->vp_uint32 = enum_tls_packet_type_store_session->vb_uint32;
-
-	/*
-	 *	Add the session identifier we're trying
-	 *	to store.
-	 */
-	MEM(pair_update_request(&vp, attr_tls_session_id) >= 0);
-	fr_pair_value_memdup_buffer_shallow(vp, fr_tls_cache_id(vp, sess), true);
-
-	/*
-	 *	How long the session has to live
-	 */
-	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
-	vp->vp_time_delta = fr_time_sub(expires, now);
-
 	/*
 	 *	Serialize the session
 	 */
@@ -549,12 +822,10 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 			 "required buffer length", &id);
 	error:
 		tls_cache_store_state_reset(request, tls_cache);
-		talloc_free(child);
 		return UNLANG_ACTION_FAIL;
 	}
 
-	MEM(pair_update_request(&vp, attr_tls_session_data) >= 0);
-	MEM(data = talloc_array(vp, uint8_t, len));
+	MEM(data = talloc_array(NULL, uint8_t, len));
 
 	/* openssl mutates &p */
 	p = data;
@@ -568,14 +839,63 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 		talloc_free(data);
 		goto error;
 	}
-	fr_pair_value_memdup_buffer_shallow(vp, data, true);
+
+	if (conf->cache.local_cache) {
+		unsigned int	id_len;
+		uint8_t const	*id;
+
+		id = SSL_SESSION_get_id(sess, &id_len);
+		tls_cache_local_insert(conf->cache.local_cache, id, id_len, data, len, expires);
+
+		RDEBUG3("Session ID %pV - Stored session in memory", fr_box_octets(id, id_len));
+
+		/*
+		 *	The in-memory cache is authoritative
+		 */
+		if (!tls_cache_write_through(conf)) {
+			talloc_free(data);
+			tls_cache_store_state_reset(request, tls_cache);
+			tls_cache->store.state = FR_TLS_CACHE_STORE_PERSISTED;	/* Avoid spurious clear calls */
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+	}
+
+	MEM(child = unlang_subrequest_alloc(request, dict_tls));
+	request = child;
+
+	/*
+	 *	Setup the child request for storing
+	 *	session resumption data.
+	 */
+	MEM(pair_prepend_request(&vp, attr_tls_packet_type) >= 0);
+	vp->vp_uint32 = enum_tls_packet_type_store_session->vb_uint32;
+
+	/*
+	 *	Add the session identifier we're trying
+	 *	to store.
+	 */
+	MEM(pair_update_request(&vp, attr_tls_session_id) >= 0);
+	fr_pair_value_memdup_buffer_shallow(vp, fr_tls_cache_id(vp, sess), true);
+
+	/*
+	 *	How long the session has to live
+	 */
+	MEM(pair_update_request(&vp, attr_tls_session_ttl) >= 0);
+	vp->vp_time_delta = fr_time_sub(expires, now);
+
+	MEM(pair_update_request(&vp, attr_tls_session_data) >= 0);
+	fr_pair_value_memdup_buffer_shallow(vp, talloc_steal(vp, data), true);
 
 	/*
 	 *	Allocate a child, and set it up to call
 	 *      the TLS virtual server.
 	 */
 	ua = fr_tls_call_push(child, tls_cache_store_result, conf, tls_session);
-	if (ua < 0) goto error;
+	if (ua < 0) {
+		tls_cache_store_state_reset(request, tls_cache);
+		talloc_free(child);
+		return UNLANG_ACTION_FAIL;
+	}
 
 	return ua;
 }
@@ -772,10 +1092,12 @@ static SSL_SESSION *tls_cache_load_cb(SSL *ssl,
 {
 	fr_tls_session_t	*tls_session;
 	fr_tls_cache_t		*tls_cache;
+	fr_tls_conf_t		*conf;
 	request_t		*request;
 
 	tls_session = fr_tls_session(ssl);
 	request = fr_tls_session_request(tls_session->ssl);
+	conf = fr_tls_session_conf(tls_session->ssl);
 	tls_cache = tls_session->cache;
 
 	/*
@@ -807,6 +1129,28 @@ again:
 	case FR_TLS_CACHE_LOAD_INIT:
 		fr_assert(!tls_cache->load.id);
 
+		/*
+		 *	Check the in-memory cache first, and only
+		 *	call the virtual server if that misses.
+		 */
+		if (conf->cache.local_cache) {
+			SSL_SESSION *sess;
+
+			sess = tls_cache_local_find(conf->cache.local_cache, key, key_len);
+			if (sess) {
+				RDEBUG3("Session ID %pV - Found session in memory", fr_box_octets(key, key_len));
+
+				SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, tls_session);
+				tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
+				tls_cache->load.sess = sess;
+				goto again;
+			}
+
+			RDEBUG3("Session ID %pV - Session not found in memory", fr_box_octets(key, key_len));
+		}
+
+		if (!conf->cache.use_virtual_server) return NULL;
+
 		tls_cache->load.state = FR_TLS_CACHE_LOAD_REQUESTED;
 		MEM(tls_cache->load.id = talloc_typed_memdup(tls_cache, (uint8_t const *)key, key_len));
 
@@ -881,6 +1225,12 @@ again:
 			return NULL;
 		}
 
+		/*
+		 *	Without a virtual server there's nothing
+		 *	to re-validate the certificate with.
+		 */
+		if (!conf->virtual_server) goto resume;
+
 		/*
 		 *	This sets the validation state of the tls_session
 		 *	so that when we call ASYNC_pause_job(), and execution
@@ -922,6 +1272,8 @@ again:
 			RDEBUG2("Certificate re-validation failed, denying session resumption via session-id");
 			goto verify_error;
 		}
+
+	resume:
 		sess = tls_cache->load.sess;
 
 		/*
@@ -91,6 +91,18 @@ typedef struct {
 	} clear;
 } fr_tls_cache_t;
 
+/** Counters for the in-memory session cache
+ *
+ */
+typedef struct {
+	uint64_t	hits;				//!< Sessions found in memory.
+	uint64_t	misses;				//!< Sessions not found in memory.
+	uint64_t	stores;				//!< Sessions added to memory.
+	uint64_t	evictions;			//!< Sessions removed to make room for new ones.
+	uint64_t	expired;			//!< Sessions removed because their lifetime elapsed.
+	uint32_t	entries;			//!< Sessions currently held in memory.
+} fr_tls_cache_local_stats_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -113,6 +125,10 @@ void		fr_tls_cache_session_alloc(fr_tls_session_t *tls_session);
 
 int		fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf);
 
+fr_tls_cache_local_t *fr_tls_cache_local_alloc(TALLOC_CTX *ctx, uint32_t max_entries, char const *name);
+
+void		fr_tls_cache_local_stats(fr_tls_cache_local_stats_t *out, fr_tls_cache_local_t *cache);
+
 #ifdef __cplusplus
 }
 #endif
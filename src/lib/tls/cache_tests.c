@@ -0,0 +1,177 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "cache.c"
+
+/*
+ *	The dictionaries and attributes in attrs.h aren't exported from
+ *	libfreeradius-tls, so our copy of cache.c needs
+ *	its own.  The in-memory cache doesn't use them.
+ */
+fr_dict_t const *dict_tls;
+
+fr_dict_attr_t const *attr_allow_session_resumption;
+fr_dict_attr_t const *attr_tls_packet_type;
+fr_dict_attr_t const *attr_tls_session_data;
+fr_dict_attr_t const *attr_tls_session_id;
+fr_dict_attr_t const *attr_tls_session_ttl;
+
+/** Return a cipher to put in sessions, as they can't be serialised without one
+ *
+ */
+static SSL_CIPHER const *test_cipher(void)
+{
+	static SSL_CIPHER const	*cipher;
+	SSL_CTX			*ssl_ctx;
+	SSL			*ssl;
+
+	if (cipher) return cipher;
+
+	ssl_ctx = SSL_CTX_new(TLS_method());
+	if (!ssl_ctx) return NULL;
+
+	ssl = SSL_new(ssl_ctx);
+	if (ssl) {
+		cipher = sk_SSL_CIPHER_value(SSL_get_ciphers(ssl), 0);
+		SSL_free(ssl);
+	}
+	SSL_CTX_free(ssl_ctx);
+
+	return cipher;
+}
+
+/** Add a session with the given ID to the cache
+ *
+ */
+static void test_cache_insert(fr_tls_cache_local_t *cache, char const *id, fr_time_t expires)
+{
+	static uint8_t const	master_key[48] = { 0x01 };
+	SSL_SESSION		*sess;
+	uint8_t			*data = NULL;
+	int			len;
+
+	sess = SSL_SESSION_new();
+	if (!TEST_CHECK(sess != NULL)) return;
+
+	TEST_CHECK(SSL_SESSION_set1_id(sess, (uint8_t const *)id, strlen(id)) == 1);
+	TEST_CHECK(SSL_SESSION_set_protocol_version(sess, TLS1_2_VERSION) == 1);
+	TEST_CHECK(SSL_SESSION_set_cipher(sess, test_cipher()) == 1);
+	TEST_CHECK(SSL_SESSION_set1_master_key(sess, master_key, sizeof(master_key)) == 1);
+
+	len = i2d_SSL_SESSION(sess, &data);
+	if (TEST_CHECK(len > 0)) tls_cache_local_insert(cache, (uint8_t const *)id, strlen(id), data, len, expires);
+
+	OPENSSL_free(data);
+	SSL_SESSION_free(sess);
+}
+
+/** Look up a session, returning whether it was found
+ *
+ */
+static bool test_cache_find(fr_tls_cache_local_t *cache, char const *id)
+{
+	SSL_SESSION		*sess;
+	unsigned int		len;
+	uint8_t const		*found;
+	bool			ret;
+
+	sess = tls_cache_local_find(cache, (uint8_t const *)id, strlen(id));
+	if (!sess) return false;
+
+	found = SSL_SESSION_get_id(sess, &len);
+	ret = TEST_CHECK((len == strlen(id)) && (memcmp(found, id, len) == 0));
+	SSL_SESSION_free(sess);
+
+	return ret;
+}
+
+static void test_cache_hit_evict(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_tls_cache_local_t		*cache = fr_tls_cache_local_alloc(ctx, 2, "test_hit_evict");
+	fr_tls_cache_local_stats_t	stats;
+	fr_time_t			expires = fr_time_add(fr_time(), fr_time_delta_from_sec(60));
+
+	TEST_CASE("Stored sessions are found");
+	test_cache_insert(cache, "one", expires);
+	test_cache_insert(cache, "two", expires);
+	TEST_CHECK(test_cache_find(cache, "one"));
+	TEST_CHECK(!test_cache_find(cache, "three"));
+
+	TEST_CASE("The least recently used session is evicted when the cache is full");
+	test_cache_insert(cache, "three", expires);
+	TEST_CHECK(!test_cache_find(cache, "two"));
+	TEST_CHECK(test_cache_find(cache, "one"));
+	TEST_CHECK(test_cache_find(cache, "three"));
+
+	TEST_CASE("Counters are updated");
+	fr_tls_cache_local_stats(&stats, cache);
+	TEST_CHECK(stats.hits == 3);
+	TEST_MSG("expected 3 hits, got %" PRIu64, stats.hits);
+	TEST_CHECK(stats.misses == 2);
+	TEST_CHECK(stats.stores == 3);
+	TEST_CHECK(stats.evictions == 1);
+	TEST_CHECK(stats.expired == 0);
+	TEST_CHECK(stats.entries == 2);
+
+	TEST_CASE("Counters are exported as metrics");
+	TEST_CHECK(fr_metric_count(cache->hits) == 3);
+	TEST_CHECK(fr_metric_count(cache->misses) == 2);
+	TEST_CHECK(fr_metric_count(cache->stores) == 3);
+	TEST_CHECK(fr_metric_count(cache->evictions) == 1);
+
+	talloc_free(ctx);
+}
+
+static void test_cache_expire(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	fr_tls_cache_local_t		*cache = fr_tls_cache_local_alloc(ctx, 2, "test_expire");
+	fr_tls_cache_local_stats_t	stats;
+
+	TEST_CASE("Expired sessions aren't found");
+	test_cache_insert(cache, "old", fr_time_sub(fr_time(), fr_time_delta_from_sec(1)));
+	TEST_CHECK(!test_cache_find(cache, "old"));
+
+	fr_tls_cache_local_stats(&stats, cache);
+	TEST_CHECK(stats.expired == 1);
+	TEST_CHECK(stats.misses == 1);
+	TEST_CHECK(stats.entries == 0);
+	TEST_CHECK(fr_metric_count(cache->expired) == 1);
+
+	talloc_free(ctx);
+}
+
+static void test_cache_metrics_print(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	fr_tls_cache_local_t	*cache = fr_tls_cache_local_alloc(ctx, 1, "test_print");
+	char			*buff = NULL;
+	size_t			len = 0;
+	FILE			*fp;
+
+	test_cache_insert(cache, "one", fr_time_add(fr_time(), fr_time_delta_from_sec(60)));
+	test_cache_insert(cache, "two", fr_time_add(fr_time(), fr_time_delta_from_sec(60)));
+	TEST_CHECK(test_cache_find(cache, "two"));
+
+	TEST_CASE("Counters are printed, labelled with the TLS configuration");
+	fp = open_memstream(&buff, &len);
+	if (!TEST_CHECK(fp != NULL)) goto finish;
+	fr_metrics_print(fp);
+	fclose(fp);
+
+	TEST_CHECK(strstr(buff, "freeradius_tls_session_cache_hits_total{tls=\"test_print\"} 1\n") != NULL);
+	TEST_CHECK(strstr(buff, "freeradius_tls_session_cache_evictions_total{tls=\"test_print\"} 1\n") != NULL);
+	TEST_MSG("%s", buff);
+
+finish:
+	free(buff);
+	talloc_free(ctx);
+}
+
+TEST_LIST = {
+	{ "Local cache - Hits and evictions",	test_cache_hit_evict },
+	{ "Local cache - Expiry",		test_cache_expire },
+	{ "Local cache - Metrics",		test_cache_metrics_print },
+	{ NULL }
+};
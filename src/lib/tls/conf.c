@@ -80,7 +80,20 @@ static fr_table_num_sorted_t const verify_mode_table[] = {
 };
 static size_t verify_mode_table_len = NUM_ELEMENTS(verify_mode_table);
 
+static conf_parser_t tls_cache_local_config[] = {
+	{ FR_CONF_OFFSET("max_entries", fr_tls_cache_local_conf_t, max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("write_through", fr_tls_cache_local_conf_t, write_through), .dflt = "yes" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static conf_parser_t tls_cache_config[] = {
+	/*
+	 *	Must be parsed before "mode", as whether the
+	 *	virtual server is required depends on it.
+	 */
+	{ FR_CONF_OFFSET_SUBSECTION("local", 0, fr_tls_cache_conf_t, local, tls_cache_local_config) },
+
 	{ FR_CONF_OFFSET("mode", fr_tls_cache_conf_t, mode),
 			 .func = tls_conf_parse_cache_mode,
 			 .uctx = &(cf_table_parse_ctx_t){
@@ -155,6 +168,22 @@ static conf_parser_t tls_verify_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+#ifdef HAVE_OPENSSL_OCSP_H
+static conf_parser_t tls_ocsp_config[] = {
+	{ FR_CONF_OFFSET("enable", fr_tls_ocsp_conf_t, enable), .dflt = "no" },
+
+	{ FR_CONF_OFFSET("override_cert_url", fr_tls_ocsp_conf_t, override_url), .dflt = "no" },
+	{ FR_CONF_OFFSET("url", fr_tls_ocsp_conf_t, url) },
+	{ FR_CONF_OFFSET("use_nonce", fr_tls_ocsp_conf_t, use_nonce), .dflt = "yes" },
+	{ FR_CONF_OFFSET("timeout", fr_tls_ocsp_conf_t, timeout), .dflt = "5" },
+	{ FR_CONF_OFFSET("softfail", fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
+	{ FR_CONF_OFFSET("verifycert", fr_tls_ocsp_conf_t, verifycert), .dflt = "yes" },
+	{ FR_CONF_OFFSET("cache_max_entries", fr_tls_ocsp_conf_t, cache_max_entries), .dflt = "1024" },
+
+	CONF_PARSER_TERMINATOR
+};
+#endif
+
 conf_parser_t fr_tls_server_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("virtual_server", FR_TYPE_VOID, 0, fr_tls_conf_t, virtual_server), .func = virtual_server_cf_parse },
 
@@ -200,6 +229,12 @@ conf_parser_t fr_tls_server_config[] = {
 
 	{ FR_CONF_OFFSET_SUBSECTION("verify", 0, fr_tls_conf_t, verify, tls_verify_config) },
 
+#ifdef HAVE_OPENSSL_OCSP_H
+	{ FR_CONF_OFFSET_SUBSECTION("ocsp", 0, fr_tls_conf_t, ocsp, tls_ocsp_config) },
+
+	{ FR_CONF_OFFSET_SUBSECTION("staple", 0, fr_tls_conf_t, staple, tls_ocsp_config) },
+#endif
+
 	{ FR_CONF_DEPRECATED("check_cert_issuer", fr_tls_conf_t, check_cert_issuer) },
 	{ FR_CONF_DEPRECATED("check_cert_cn", fr_tls_conf_t, check_cert_cn) },
 	CONF_PARSER_TERMINATOR
@@ -262,12 +297,24 @@ static int tls_conf_parse_cache_mode(TALLOC_CTX *ctx, void *out, void *parent, C
 		break;
 
 	case FR_TLS_CACHE_STATEFUL:
-		if (!conf->virtual_server) {
-			cf_log_err(ci, "A virtual_server must be set when cache.mode = \"stateful\"");
+		if (conf->tls_min_version >= (float)1.3) {
+			cf_log_err(ci, "cache.mode = \"stateful\" is not supported with tls_min_version >= 1.3");
 		error:
 			return -1;
 		}
 
+		/*
+		 *	The in-memory cache can provide stateful
+		 *	session resumption on its own.
+		 */
+		if (!conf->virtual_server) {
+			if (conf->cache.local.max_entries > 0) break;
+
+			cf_log_err(ci, "A virtual_server or local.max_entries must be set "
+				   "when cache.mode = \"stateful\"");
+			goto error;
+		}
+
 		if (!cf_section_find(conf->virtual_server, "load", "session")) {
 			cf_log_err(ci, "Specified virtual_server must contain a \"load session { ... }\" section "
 				   "when cache.mode = \"stateful\"");
@@ -285,19 +332,17 @@ static int tls_conf_parse_cache_mode(TALLOC_CTX *ctx, void *out, void *parent, C
 			           "when cache.mode = \"stateful\"");
 			goto error;
 		}
-
-		if (conf->tls_min_version >= (float)1.3) {
-			cf_log_err(ci, "cache.mode = \"stateful\" is not supported with tls_min_version >= 1.3");
-			goto error;
-		}
+		conf->cache.use_virtual_server = true;
 		break;
 
 	case FR_TLS_CACHE_AUTO:
 		if (!conf->virtual_server) {
-			WARN("A virtual_server must be provided for stateful caching. "
+			if (conf->cache.local.max_entries > 0) break;
+
+			WARN("A virtual_server or local.max_entries must be provided for stateful caching. "
 			     "cache.mode = \"auto\" rewritten to cache.mode = \"stateless\"");
 		cache_stateless:
-			conf->cache.mode = FR_TLS_CACHE_STATELESS;
+			cache_mode = FR_TLS_CACHE_STATELESS;
 			break;
 		}
 
@@ -327,6 +372,19 @@ static int tls_conf_parse_cache_mode(TALLOC_CTX *ctx, void *out, void *parent, C
 		break;
 	}
 
+	/*
+	 *	The in-memory cache is shared between all the
+	 *	threads using this configuration.
+	 */
+	if ((cache_mode & FR_TLS_CACHE_STATEFUL) && (conf->cache.local.max_entries > 0)) {
+		CONF_SECTION	*tls_cs = cf_item_to_section(cf_parent(cf_parent(ci)));
+		char const	*name = cf_section_name2(tls_cs);
+
+		if (!name) name = cf_section_name1(tls_cs);
+
+		conf->cache.local_cache = fr_tls_cache_local_alloc(conf, conf->cache.local.max_entries, name);
+	}
+
 	/*
 	 *	Generate random, ephemeral, session-ticket keys.
 	 */
@@ -448,6 +506,13 @@ static X509_STORE *conf_ocsp_revocation_store(fr_tls_conf_t *conf)
  */
 static int _conf_server_free(fr_tls_conf_t *conf)
 {
+#ifdef HAVE_OPENSSL_OCSP_H
+	if (conf->ocsp.store) X509_STORE_free(conf->ocsp.store);
+	conf->ocsp.store = NULL;
+	if (conf->staple.store) X509_STORE_free(conf->staple.store);
+	conf->staple.store = NULL;
+#endif
+
 	memset(conf, 0, sizeof(*conf));
 	return 0;
 }
@@ -487,7 +552,7 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 
 	if ((cf_section_parse(conf, conf, cs) < 0) ||
 	    (cf_section_parse_pass2(conf, cs) < 0)) {
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(HAVE_OPENSSL_OCSP_H)
 	error:
 #endif
 		talloc_free(conf);
@@ -505,6 +570,44 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf_cert_admin_password(conf) < 0) goto error;
 #endif
 
+#ifdef HAVE_OPENSSL_OCSP_H
+	/*
+	 *	The stores initialized here are for validating
+	 *	OCSP responses.  They have nothing to do with
+	 *	verifying other certificates.
+	 */
+	if (conf->ocsp.enable) {
+		conf->ocsp.store = conf_ocsp_revocation_store(conf);
+		if (!conf->ocsp.store) goto error;
+	}
+
+	if (conf->staple.enable) {
+		/*
+		 *	Stapled responses are always served from the
+		 *	response cache, as the stapling callback
+		 *	can't yield.
+		 */
+		if (!conf->staple.cache_max_entries) {
+			cf_log_err(cs, "OCSP stapling requires staple.cache_max_entries > 0");
+			goto error;
+		}
+
+		conf->staple.store = conf_ocsp_revocation_store(conf);
+		if (!conf->staple.store) goto error;
+	}
+
+	/*
+	 *	Responses are shared between all threads.
+	 */
+	if (conf->ocsp.enable && conf->ocsp.cache_max_entries) {
+		conf->ocsp.response_cache = fr_tls_ocsp_cache_alloc(conf, conf->ocsp.cache_max_entries);
+	}
+
+	if (conf->staple.enable) {
+		conf->staple.response_cache = fr_tls_ocsp_cache_alloc(conf, conf->staple.cache_max_entries);
+	}
+#endif
+
 	/*
 	 *	Cache conf in cs in case we're asked to parse this again.
 	 */
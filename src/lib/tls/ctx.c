@@ -305,6 +305,16 @@ static int tls_ctx_load_cert_chain(SSL_CTX *ctx, fr_tls_chain_conf_t *chain, boo
 		return -1;
 	}
 
+	/*
+	 *	Hand private key operations off to the
+	 *	crypto threads (if they're running).
+	 */
+	if (fr_tls_keyop_ctx_wrap(ctx) < 0) {
+		fr_tls_log(NULL, "Failed preparing private key \"%s\" for use by the crypto threads",
+			   chain->private_key_file);
+		return -1;
+	}
+
 	{
 		size_t		extra_cnt, i;
 		/*
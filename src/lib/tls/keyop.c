@@ -0,0 +1,1094 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/keyop.c
+ * @brief Offload private key operations to a pool of crypto threads.
+ *
+ * Signing and decrypting with an RSA or EC private key are the most
+ * expensive parts of a TLS handshake.  Normally they're performed by
+ * the worker thread running the handshake, which means every other
+ * request on that worker waits for them to complete.
+ *
+ * When the crypto thread pool is running, the private keys of our
+ * SSL_CTXs are replaced with keys from a small OpenSSL provider.  The
+ * provider's keys wrap the original key, and the provider's signature
+ * and asymmetric cipher operations hand the actual work off to the pool.
+ *
+ * The handshake runs inside an OpenSSL async job (see SSL_MODE_ASYNC),
+ * so while the operation is in progress the job is paused, SSL_read()
+ * returns SSL_ERROR_WANT_ASYNC, and the request yields.  When the crypto
+ * thread completes the operation it writes to a pipe registered with the
+ * job's wait context.  The worker's event loop sees the pipe become
+ * readable, marks the request as runnable, and the handshake continues.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls"
+
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/unlang/function.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <poll.h>
+
+#include "base.h"
+#include "keyop.h"
+#include "log.h"
+#include "strerror.h"
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/async.h>
+#  include <openssl/core_dispatch.h>
+#  include <openssl/core_names.h>
+#  include <openssl/params.h>
+#  include <openssl/provider.h>
+
+/** Name of our builtin provider
+ *
+ * Must sort after "default", so that the default provider's
+ * implementations are preferred when no provider is specified.
+ */
+#define KEYOP_PROVIDER_NAME	"freeradius_keyop"
+
+/** Only used when fetching implementations from our provider
+ *
+ */
+#define KEYOP_PROPQ		"provider=" KEYOP_PROVIDER_NAME
+
+/** Used for all operations on the original key
+ *
+ */
+#define KEYOP_INNER_PROPQ	"provider=default"
+
+/** Parameter used to pass the original key to our keymgmt import function
+ *
+ * This isn't something that can be exported by any other provider, so
+ * keys holding private key material can only be created by
+ * fr_tls_keyop_ctx_wrap().
+ */
+#define KEYOP_PARAM_PKEY	"freeradius-keyop-pkey"
+
+/** A key managed by our provider
+ *
+ */
+typedef struct {
+	char const		*type;			//!< "RSA" or "EC".
+	EVP_PKEY		*pkey;			//!< The original key, from the default provider.
+	bool			private;		//!< Whether pkey contains private key material.
+} tls_keyop_key_t;
+
+/** A signature or asymmetric cipher operation
+ *
+ */
+typedef struct {
+	tls_keyop_key_t		*key;			//!< Key the operation is being performed with.
+	EVP_MD_CTX		*mdctx;			//!< Used for digest sign operations.
+	EVP_PKEY_CTX		*pctx;			//!< Operation ctx from the default provider.
+							///< Owned by mdctx if that's set.
+} tls_keyop_ctx_t;
+
+typedef struct tls_keyop_s tls_keyop_t;
+
+typedef int (*tls_keyop_func_t)(tls_keyop_t *op);
+
+/** An operation queued for the crypto threads
+ *
+ * Lives on the stack of the async job which requested it.
+ */
+struct tls_keyop_s {
+	fr_dlist_t		entry;			//!< Entry in the queue of operations.
+
+	tls_keyop_func_t	func;			//!< Performs the operation.
+	tls_keyop_ctx_t		*ctx;			//!< Operation ctx.
+
+	unsigned char		*out;			//!< Where to write the signature or plaintext.
+	size_t			*outlen;		//!< Length of the output.
+	unsigned char const	*in;			//!< Data to sign or decrypt.
+	size_t			inlen;			//!< Length of the input.
+
+	int			ret;			//!< What func returned.
+	int			fd[2];			//!< Pipe used to signal completion.
+};
+
+/** The crypto thread pool
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the queue.
+	pthread_cond_t		cond;			//!< Signalled when operations are queued.
+	fr_dlist_head_t		queue;			//!< Operations waiting for a crypto thread.
+
+	pthread_t		*threads;		//!< The crypto threads.
+	uint32_t		num_threads;		//!< How many were started.
+	bool			stop;			//!< Tells the threads to exit.
+} tls_keyop_pool_t;
+
+static tls_keyop_pool_t		*keyop_pool;
+static OSSL_PROVIDER		*keyop_provider;
+
+static void tls_keyop_queue(tls_keyop_t *op)
+{
+	pthread_mutex_lock(&keyop_pool->mutex);
+	fr_dlist_insert_tail(&keyop_pool->queue, op);
+	pthread_cond_signal(&keyop_pool->cond);
+	pthread_mutex_unlock(&keyop_pool->mutex);
+}
+
+/** Wait for a crypto thread to complete an operation
+ *
+ * The byte written to the pipe is the only thing which tells us the
+ * operation is complete.  The crypto thread doesn't touch the op after
+ * writing it, so once it's been read, the op can be freed.
+ */
+static bool tls_keyop_complete(tls_keyop_t *op)
+{
+	uint8_t	c;
+
+	return read(op->fd[0], &c, sizeof(c)) == 1;
+}
+
+/** Perform an operation, on a crypto thread if we can
+ *
+ * If we're running inside an async job, the operation is queued for
+ * the crypto threads, and the job is paused until it completes.
+ * Otherwise the operation is performed immediately.
+ */
+static int tls_keyop_run(tls_keyop_t *op)
+{
+	ASYNC_JOB	*job;
+	ASYNC_WAIT_CTX	*waitctx;
+
+	job = ASYNC_get_current_job();
+	if (!job || !keyop_pool) return op->func(op);
+
+	waitctx = ASYNC_get_wait_ctx(job);
+	if (!waitctx) return op->func(op);
+
+	if (pipe(op->fd) < 0) return op->func(op);
+
+	if ((fr_nonblock(op->fd[0]) < 0) ||
+	    (ASYNC_WAIT_CTX_set_wait_fd(waitctx, op, op->fd[0], NULL, NULL) != 1)) {
+		close(op->fd[0]);
+		close(op->fd[1]);
+		return op->func(op);
+	}
+
+	fr_dlist_entry_init(&op->entry);
+	tls_keyop_queue(op);
+
+	/*
+	 *	The job may be resumed for reasons that have
+	 *	nothing to do with us, so keep pausing until
+	 *	we're done.
+	 */
+	while (!tls_keyop_complete(op)) {
+		if (ASYNC_pause_job() != 1) {
+			struct pollfd pfd = { .fd = op->fd[0], .events = POLLIN };
+
+			/*
+			 *	Can't go back to the caller until the
+			 *	crypto thread is done with the op.
+			 */
+			while (!tls_keyop_complete(op)) (void)poll(&pfd, 1, 100);
+			break;
+		}
+	}
+
+	ASYNC_WAIT_CTX_clear_fd(waitctx, op);
+	close(op->fd[0]);
+	close(op->fd[1]);
+
+	return op->ret;
+}
+
+static void *tls_keyop_thread(void *uctx)
+{
+	tls_keyop_pool_t	*pool = uctx;
+	tls_keyop_t		*op;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		op = fr_dlist_pop_head(&pool->queue);
+		if (!op) {
+			if (pool->stop) break;
+
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		op->ret = op->func(op);
+		ERR_clear_error();	/* Errors can't be passed back to the worker */
+
+		/*
+		 *	The op may be freed as soon as this
+		 *	write completes.
+		 */
+		if (write(op->fd[1], "", 1) < 0) {
+			fr_assert_msg(0, "Failed signalling private key operation completion: %s",
+				      fr_syserror(errno));
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	OPENSSL_thread_stop();
+
+	return NULL;
+}
+
+/*
+ *	Key management
+ */
+static void *tls_keyop_keymgmt_new(char const *type)
+{
+	tls_keyop_key_t *key;
+
+	key = talloc_zero(NULL, tls_keyop_key_t);
+	if (!key) return NULL;
+	key->type = type;
+
+	return key;
+}
+
+static void *tls_keyop_keymgmt_rsa_new(UNUSED void *provctx)
+{
+	return tls_keyop_keymgmt_new("RSA");
+}
+
+static void *tls_keyop_keymgmt_ec_new(UNUSED void *provctx)
+{
+	return tls_keyop_keymgmt_new("EC");
+}
+
+static void tls_keyop_keymgmt_free(void *keydata)
+{
+	tls_keyop_key_t *key = keydata;
+
+	if (!key) return;
+
+	EVP_PKEY_free(key->pkey);
+	talloc_free(key);
+}
+
+static int tls_keyop_keymgmt_has(void const *keydata, int selection)
+{
+	tls_keyop_key_t const *key = keydata;
+
+	if (!key || !key->pkey) return 0;
+	if ((selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) && !key->private) return 0;
+
+	return 1;
+}
+
+static int tls_keyop_keymgmt_match(void const *keydata1, void const *keydata2, UNUSED int selection)
+{
+	tls_keyop_key_t const *a = keydata1, *b = keydata2;
+
+	if (!a->pkey || !b->pkey) return 0;
+
+	return EVP_PKEY_eq(a->pkey, b->pkey) == 1;
+}
+
+/** Import a key
+ *
+ * Private keys can only be imported via #KEYOP_PARAM_PKEY.  Anything
+ * else is imported as a public key, which is enough to allow
+ * comparisons with public keys from certificates.
+ */
+static int tls_keyop_keymgmt_import(void *keydata, int selection, OSSL_PARAM const params[])
+{
+	tls_keyop_key_t		*key = keydata;
+	OSSL_PARAM const	*p;
+	EVP_PKEY_CTX		*pctx;
+	int			ret;
+
+	if (!key || key->pkey) return 0;
+
+	p = OSSL_PARAM_locate_const(params, KEYOP_PARAM_PKEY);
+	if (p) {
+		EVP_PKEY	*pkey;
+
+		if ((p->data_type != OSSL_PARAM_OCTET_STRING) || (p->data_size != sizeof(pkey))) return 0;
+		memcpy(&pkey, p->data, sizeof(pkey));
+
+		if (!EVP_PKEY_is_a(pkey, key->type) || !EVP_PKEY_up_ref(pkey)) return 0;
+		key->pkey = pkey;
+		key->private = true;
+
+		return 1;
+	}
+
+	pctx = EVP_PKEY_CTX_new_from_name(NULL, key->type, KEYOP_INNER_PROPQ);
+	if (!pctx) return 0;
+
+	selection &= ~OSSL_KEYMGMT_SELECT_PRIVATE_KEY;
+	ret = (EVP_PKEY_fromdata_init(pctx) == 1) &&
+	      (EVP_PKEY_fromdata(pctx, &key->pkey,
+				 (selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) ? EVP_PKEY_PUBLIC_KEY : EVP_PKEY_KEY_PARAMETERS,
+				 UNCONST(OSSL_PARAM *, params)) == 1);
+	EVP_PKEY_CTX_free(pctx);
+
+	return ret;
+}
+
+static OSSL_PARAM const *tls_keyop_keymgmt_types(char const *type, int selection)
+{
+	EVP_PKEY_CTX		*pctx;
+	OSSL_PARAM const	*params = NULL;
+
+	/*
+	 *	The parameter lists are static data in the
+	 *	default provider, so they outlive the ctx.
+	 */
+	pctx = EVP_PKEY_CTX_new_from_name(NULL, type, KEYOP_INNER_PROPQ);
+	if (!pctx) return NULL;
+	if (EVP_PKEY_fromdata_init(pctx) == 1) params = EVP_PKEY_fromdata_settable(pctx, selection);
+	EVP_PKEY_CTX_free(pctx);
+
+	return params;
+}
+
+/*
+ *	Used for both import and export types, the default
+ *	provider imports and exports the same parameters.
+ */
+static OSSL_PARAM const *tls_keyop_keymgmt_rsa_types(int selection)
+{
+	return tls_keyop_keymgmt_types("RSA", selection);
+}
+
+static OSSL_PARAM const *tls_keyop_keymgmt_ec_types(int selection)
+{
+	return tls_keyop_keymgmt_types("EC", selection);
+}
+
+/** Export the public components of a key
+ *
+ * Private key material is never exported.  This stops OpenSSL from
+ * copying the key to the default provider, and forces it to use our
+ * implementations of the private key operations.
+ */
+static int tls_keyop_keymgmt_export(void *keydata, int selection, OSSL_CALLBACK *param_cb, void *cbarg)
+{
+	tls_keyop_key_t	*key = keydata;
+	OSSL_PARAM	*params = NULL;
+	int		ret;
+
+	if (!key || !key->pkey || (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY)) return 0;
+
+	if (EVP_PKEY_todata(key->pkey, selection, &params) != 1) return 0;
+	ret = param_cb(params, cbarg);
+	OSSL_PARAM_free(params);
+
+	return ret;
+}
+
+static int tls_keyop_keymgmt_get_params(void *keydata, OSSL_PARAM params[])
+{
+	tls_keyop_key_t *key = keydata;
+
+	if (!key || !key->pkey) return 0;
+
+	return EVP_PKEY_get_params(key->pkey, params);
+}
+
+static OSSL_PARAM const *tls_keyop_keymgmt_gettable_params(char const *type)
+{
+	EVP_KEYMGMT		*keymgmt;
+	OSSL_PARAM const	*params;
+
+	keymgmt = EVP_KEYMGMT_fetch(NULL, type, KEYOP_INNER_PROPQ);
+	if (!keymgmt) return NULL;
+	params = EVP_KEYMGMT_gettable_params(keymgmt);
+	EVP_KEYMGMT_free(keymgmt);
+
+	return params;
+}
+
+static OSSL_PARAM const *tls_keyop_keymgmt_rsa_gettable_params(UNUSED void *provctx)
+{
+	return tls_keyop_keymgmt_gettable_params("RSA");
+}
+
+static OSSL_PARAM const *tls_keyop_keymgmt_ec_gettable_params(UNUSED void *provctx)
+{
+	return tls_keyop_keymgmt_gettable_params("EC");
+}
+
+static char const *tls_keyop_keymgmt_ec_query_operation_name(int operation_id)
+{
+	switch (operation_id) {
+	case OSSL_OP_SIGNATURE:
+		return "ECDSA";
+
+	default:
+		return NULL;
+	}
+}
+
+#define KEYOP_FUNC(_id, _func) { _id, (void (*)(void))(_func) }
+
+static OSSL_DISPATCH const tls_keyop_keymgmt_rsa[] = {
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_NEW, tls_keyop_keymgmt_rsa_new),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_FREE, tls_keyop_keymgmt_free),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_HAS, tls_keyop_keymgmt_has),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_MATCH, tls_keyop_keymgmt_match),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_IMPORT, tls_keyop_keymgmt_import),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_IMPORT_TYPES, tls_keyop_keymgmt_rsa_types),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_EXPORT, tls_keyop_keymgmt_export),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_EXPORT_TYPES, tls_keyop_keymgmt_rsa_types),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_GET_PARAMS, tls_keyop_keymgmt_get_params),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, tls_keyop_keymgmt_rsa_gettable_params),
+	{ 0, NULL }
+};
+
+static OSSL_DISPATCH const tls_keyop_keymgmt_ec[] = {
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_NEW, tls_keyop_keymgmt_ec_new),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_FREE, tls_keyop_keymgmt_free),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_HAS, tls_keyop_keymgmt_has),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_MATCH, tls_keyop_keymgmt_match),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_IMPORT, tls_keyop_keymgmt_import),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_IMPORT_TYPES, tls_keyop_keymgmt_ec_types),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_EXPORT, tls_keyop_keymgmt_export),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_EXPORT_TYPES, tls_keyop_keymgmt_ec_types),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_GET_PARAMS, tls_keyop_keymgmt_get_params),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, tls_keyop_keymgmt_ec_gettable_params),
+	KEYOP_FUNC(OSSL_FUNC_KEYMGMT_QUERY_OPERATION_NAME, tls_keyop_keymgmt_ec_query_operation_name),
+	{ 0, NULL }
+};
+
+/*
+ *	Operation ctxs, shared by signatures and asymmetric ciphers
+ */
+static void *tls_keyop_newctx(UNUSED void *provctx, UNUSED char const *propq)
+{
+	return talloc_zero(NULL, tls_keyop_ctx_t);
+}
+
+static void tls_keyop_freectx(void *vctx)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx) return;
+
+	if (ctx->mdctx) {
+		EVP_MD_CTX_free(ctx->mdctx);
+	} else {
+		EVP_PKEY_CTX_free(ctx->pctx);
+	}
+	talloc_free(ctx);
+}
+
+static void *tls_keyop_dupctx(void *vctx)
+{
+	tls_keyop_ctx_t *ctx = vctx, *dup;
+
+	dup = talloc_zero(NULL, tls_keyop_ctx_t);
+	if (!dup) return NULL;
+	dup->key = ctx->key;
+
+	if (ctx->mdctx) {
+		dup->mdctx = EVP_MD_CTX_new();
+		if (!dup->mdctx || (EVP_MD_CTX_copy_ex(dup->mdctx, ctx->mdctx) != 1)) goto error;
+		dup->pctx = EVP_MD_CTX_get_pkey_ctx(dup->mdctx);
+	} else if (ctx->pctx) {
+		dup->pctx = EVP_PKEY_CTX_dup(ctx->pctx);
+		if (!dup->pctx) goto error;
+	}
+
+	return dup;
+
+error:
+	tls_keyop_freectx(dup);
+	return NULL;
+}
+
+/** Reset a ctx so it can be used for a new operation
+ *
+ */
+static int tls_keyop_ctx_init(tls_keyop_ctx_t *ctx, void *provkey)
+{
+	tls_keyop_key_t *key = provkey;
+
+	if (!key || !key->private) return 0;
+
+	if (ctx->mdctx) {
+		EVP_MD_CTX_free(ctx->mdctx);
+		ctx->mdctx = NULL;
+	} else {
+		EVP_PKEY_CTX_free(ctx->pctx);
+	}
+	ctx->pctx = NULL;
+	ctx->key = key;
+
+	return 1;
+}
+
+static int tls_keyop_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx->pctx) return 0;
+
+	return EVP_PKEY_CTX_get_params(ctx->pctx, params);
+}
+
+static OSSL_PARAM const *tls_keyop_gettable_ctx_params(void *vctx, UNUSED void *provctx)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx || !ctx->pctx) return NULL;
+
+	return EVP_PKEY_CTX_gettable_params(ctx->pctx);
+}
+
+static int tls_keyop_set_ctx_params(void *vctx, OSSL_PARAM const params[])
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx->pctx) return 0;
+
+	return EVP_PKEY_CTX_set_params(ctx->pctx, params);
+}
+
+static OSSL_PARAM const *tls_keyop_settable_ctx_params(void *vctx, UNUSED void *provctx)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx || !ctx->pctx) return NULL;
+
+	return EVP_PKEY_CTX_settable_params(ctx->pctx);
+}
+
+/*
+ *	Signatures
+ */
+static int tls_keyop_sign_init(void *vctx, void *provkey, OSSL_PARAM const params[])
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!tls_keyop_ctx_init(ctx, provkey)) return 0;
+
+	ctx->pctx = EVP_PKEY_CTX_new_from_pkey(NULL, ctx->key->pkey, KEYOP_INNER_PROPQ);
+	if (!ctx->pctx) return 0;
+
+	return EVP_PKEY_sign_init_ex(ctx->pctx, params);
+}
+
+static int _tls_keyop_sign(tls_keyop_t *op)
+{
+	return EVP_PKEY_sign(op->ctx->pctx, op->out, op->outlen, op->in, op->inlen);
+}
+
+static int tls_keyop_sign(void *vctx, unsigned char *sig, size_t *siglen, size_t sigsize,
+			  unsigned char const *tbs, size_t tbslen)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	/*
+	 *	Size queries are cheap
+	 */
+	if (!sig) return EVP_PKEY_sign(ctx->pctx, NULL, siglen, tbs, tbslen);
+
+	*siglen = sigsize;
+
+	return tls_keyop_run(&(tls_keyop_t){
+				.func = _tls_keyop_sign,
+				.ctx = ctx,
+				.out = sig,
+				.outlen = siglen,
+				.in = tbs,
+				.inlen = tbslen
+			     });
+}
+
+static int tls_keyop_digest_sign_init(void *vctx, char const *mdname, void *provkey, OSSL_PARAM const params[])
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!tls_keyop_ctx_init(ctx, provkey)) return 0;
+
+	ctx->mdctx = EVP_MD_CTX_new();
+	if (!ctx->mdctx) return 0;
+
+	return EVP_DigestSignInit_ex(ctx->mdctx, &ctx->pctx, mdname, NULL, KEYOP_INNER_PROPQ,
+				     ctx->key->pkey, params);
+}
+
+static int tls_keyop_digest_sign_update(void *vctx, unsigned char const *data, size_t datalen)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx->mdctx) return 0;
+
+	return EVP_DigestSignUpdate(ctx->mdctx, data, datalen);
+}
+
+static int _tls_keyop_digest_sign_final(tls_keyop_t *op)
+{
+	return EVP_DigestSignFinal(op->ctx->mdctx, op->out, op->outlen);
+}
+
+static int tls_keyop_digest_sign_final(void *vctx, unsigned char *sig, size_t *siglen, size_t sigsize)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx->mdctx) return 0;
+
+	if (!sig) return EVP_DigestSignFinal(ctx->mdctx, NULL, siglen);
+
+	*siglen = sigsize;
+
+	return tls_keyop_run(&(tls_keyop_t){
+				.func = _tls_keyop_digest_sign_final,
+				.ctx = ctx,
+				.out = sig,
+				.outlen = siglen
+			     });
+}
+
+static OSSL_DISPATCH const tls_keyop_signature[] = {
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_NEWCTX, tls_keyop_newctx),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_FREECTX, tls_keyop_freectx),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_DUPCTX, tls_keyop_dupctx),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_SIGN_INIT, tls_keyop_sign_init),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_SIGN, tls_keyop_sign),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_DIGEST_SIGN_INIT, tls_keyop_digest_sign_init),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_DIGEST_SIGN_UPDATE, tls_keyop_digest_sign_update),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_DIGEST_SIGN_FINAL, tls_keyop_digest_sign_final),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_GET_CTX_PARAMS, tls_keyop_get_ctx_params),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_GETTABLE_CTX_PARAMS, tls_keyop_gettable_ctx_params),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_SET_CTX_PARAMS, tls_keyop_set_ctx_params),
+	KEYOP_FUNC(OSSL_FUNC_SIGNATURE_SETTABLE_CTX_PARAMS, tls_keyop_settable_ctx_params),
+	{ 0, NULL }
+};
+
+/*
+ *	Asymmetric ciphers (RSA key exchange)
+ */
+static int tls_keyop_decrypt_init(void *vctx, void *provkey, OSSL_PARAM const params[])
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!tls_keyop_ctx_init(ctx, provkey)) return 0;
+
+	ctx->pctx = EVP_PKEY_CTX_new_from_pkey(NULL, ctx->key->pkey, KEYOP_INNER_PROPQ);
+	if (!ctx->pctx) return 0;
+
+	return EVP_PKEY_decrypt_init_ex(ctx->pctx, params);
+}
+
+static int _tls_keyop_decrypt(tls_keyop_t *op)
+{
+	return EVP_PKEY_decrypt(op->ctx->pctx, op->out, op->outlen, op->in, op->inlen);
+}
+
+static int tls_keyop_decrypt(void *vctx, unsigned char *out, size_t *outlen, size_t outsize,
+			     unsigned char const *in, size_t inlen)
+{
+	tls_keyop_ctx_t *ctx = vctx;
+
+	if (!ctx->pctx) return 0;
+
+	if (!out) return EVP_PKEY_decrypt(ctx->pctx, NULL, outlen, in, inlen);
+
+	*outlen = outsize;
+
+	return tls_keyop_run(&(tls_keyop_t){
+				.func = _tls_keyop_decrypt,
+				.ctx = ctx,
+				.out = out,
+				.outlen = outlen,
+				.in = in,
+				.inlen = inlen
+			     });
+}
+
+static OSSL_DISPATCH const tls_keyop_asym_cipher[] = {
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_NEWCTX, tls_keyop_newctx),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_FREECTX, tls_keyop_freectx),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_DUPCTX, tls_keyop_dupctx),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_DECRYPT_INIT, tls_keyop_decrypt_init),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_DECRYPT, tls_keyop_decrypt),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_GET_CTX_PARAMS, tls_keyop_get_ctx_params),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_GETTABLE_CTX_PARAMS, tls_keyop_gettable_ctx_params),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_SET_CTX_PARAMS, tls_keyop_set_ctx_params),
+	KEYOP_FUNC(OSSL_FUNC_ASYM_CIPHER_SETTABLE_CTX_PARAMS, tls_keyop_settable_ctx_params),
+	{ 0, NULL }
+};
+
+/*
+ *	The provider itself
+ */
+#define KEYOP_RSA_NAMES		"RSA:rsaEncryption:1.2.840.113549.1.1.1"
+#define KEYOP_EC_NAMES		"EC:id-ecPublicKey:1.2.840.10045.2.1"
+
+static OSSL_ALGORITHM const tls_keyop_keymgmt_algs[] = {
+	{ KEYOP_RSA_NAMES, KEYOP_PROPQ, tls_keyop_keymgmt_rsa, "Offloaded RSA keys" },
+	{ KEYOP_EC_NAMES, KEYOP_PROPQ, tls_keyop_keymgmt_ec, "Offloaded EC keys" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static OSSL_ALGORITHM const tls_keyop_signature_algs[] = {
+	{ KEYOP_RSA_NAMES, KEYOP_PROPQ, tls_keyop_signature, "Offloaded RSA signatures" },
+	{ "ECDSA", KEYOP_PROPQ, tls_keyop_signature, "Offloaded ECDSA signatures" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static OSSL_ALGORITHM const tls_keyop_asym_cipher_algs[] = {
+	{ KEYOP_RSA_NAMES, KEYOP_PROPQ, tls_keyop_asym_cipher, "Offloaded RSA decryption" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static OSSL_ALGORITHM const *tls_keyop_provider_query(UNUSED void *provctx, int operation_id, int *no_cache)
+{
+	*no_cache = 0;
+
+	switch (operation_id) {
+	case OSSL_OP_KEYMGMT:
+		return tls_keyop_keymgmt_algs;
+
+	case OSSL_OP_SIGNATURE:
+		return tls_keyop_signature_algs;
+
+	case OSSL_OP_ASYM_CIPHER:
+		return tls_keyop_asym_cipher_algs;
+
+	default:
+		return NULL;
+	}
+}
+
+static OSSL_DISPATCH const tls_keyop_provider_dispatch[] = {
+	KEYOP_FUNC(OSSL_FUNC_PROVIDER_QUERY_OPERATION, tls_keyop_provider_query),
+	{ 0, NULL }
+};
+
+static int tls_keyop_provider_init(UNUSED OSSL_CORE_HANDLE const *handle, UNUSED OSSL_DISPATCH const *in,
+				   OSSL_DISPATCH const **out, void **provctx)
+{
+	*out = tls_keyop_provider_dispatch;
+	*provctx = NULL;
+
+	return 1;
+}
+
+static void _tls_keyop_provider_free(void)
+{
+	if (keyop_provider && !OSSL_PROVIDER_unload(keyop_provider)) {
+		fr_tls_log(NULL, "Failed unloading key offload provider");
+	}
+	keyop_provider = NULL;
+}
+
+/** Start the crypto thread pool
+ *
+ * Must be called after any calls to fork(), and before any SSL_CTXs
+ * are allocated.  Private keys loaded into SSL_CTXs after the pool has
+ * been started will have their operations offloaded to the pool.
+ *
+ * @param[in] num_threads	How many crypto threads to start.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_tls_keyop_pool_start(uint32_t num_threads)
+{
+	tls_keyop_pool_t	*pool;
+	uint32_t		i;
+	int			ret;
+
+	if (keyop_pool) return 0;
+
+	if (EVP_default_properties_is_fips_enabled(NULL)) {
+		fr_strerror_const("Crypto threads cannot be used in FIPS mode");
+		return -1;
+	}
+
+	if (!keyop_provider) {
+		if (OSSL_PROVIDER_add_builtin(NULL, KEYOP_PROVIDER_NAME, tls_keyop_provider_init) != 1) {
+			fr_tls_strerror_printf("Failed registering key offload provider");
+			return -1;
+		}
+
+		keyop_provider = OSSL_PROVIDER_load(NULL, KEYOP_PROVIDER_NAME);
+		if (!keyop_provider) {
+			fr_tls_strerror_printf("Failed loading key offload provider");
+			return -1;
+		}
+
+		/*
+		 *	Must be unloaded after all of the keys
+		 *	which reference it have been freed.
+		 */
+		OPENSSL_atexit(_tls_keyop_provider_free);
+	}
+
+	MEM(pool = talloc_zero(NULL, tls_keyop_pool_t));
+	MEM(pool->threads = talloc_array(pool, pthread_t, num_threads));
+	fr_dlist_init(&pool->queue, tls_keyop_t, entry);
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_create(&pool->threads[i], NULL, tls_keyop_thread, pool);
+		if (ret != 0) {
+			fr_strerror_printf("Failed starting crypto thread: %s", fr_syserror(ret));
+			keyop_pool = pool;
+			pool->num_threads = i;
+			fr_tls_keyop_pool_stop();
+			return -1;
+		}
+	}
+	pool->num_threads = num_threads;
+	keyop_pool = pool;
+
+	return 0;
+}
+
+/** Stop the crypto thread pool
+ *
+ * Any operations which have already been queued are completed before
+ * the threads exit.  Keys which were wrapped while the pool was running
+ * continue to work, but their operations are performed by the calling
+ * thread.
+ */
+void fr_tls_keyop_pool_stop(void)
+{
+	tls_keyop_pool_t	*pool = keyop_pool;
+	uint32_t		i;
+
+	if (!pool) return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	keyop_pool = NULL;
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	talloc_free(pool);
+}
+
+/** Whether the crypto thread pool is running
+ *
+ */
+bool fr_tls_keyop_pool_running(void)
+{
+	return keyop_pool != NULL;
+}
+
+/** Replace the current private key of an SSL_CTX with one whose operations are offloaded
+ *
+ * Should be called after each private key is loaded.  Keys of types we
+ * can't offload are left alone.
+ *
+ * @param[in] ctx	containing the key.
+ * @return
+ *	- 0 on success (or if the key can't be offloaded).
+ *	- -1 on failure.  Errors are left on the OpenSSL error stack.
+ */
+int fr_tls_keyop_ctx_wrap(SSL_CTX *ctx)
+{
+	EVP_PKEY	*pkey, *wrapped = NULL;
+	EVP_PKEY_CTX	*pctx;
+	char const	*type;
+	OSSL_PARAM	params[2];
+	int		ret;
+
+	if (!keyop_pool) return 0;
+
+	pkey = SSL_CTX_get0_privatekey(ctx);
+	if (!pkey) return 0;
+
+	if (EVP_PKEY_is_a(pkey, "RSA")) {
+		type = "RSA";
+	} else if (EVP_PKEY_is_a(pkey, "EC")) {
+		type = "EC";
+	} else {
+		DEBUG2("Private key type %s is not supported by the crypto threads, "
+		       "operations will be performed by the worker threads", EVP_PKEY_get0_type_name(pkey));
+		return 0;
+	}
+
+	pctx = EVP_PKEY_CTX_new_from_name(NULL, type, KEYOP_PROPQ);
+	if (!pctx) return -1;
+
+	params[0] = OSSL_PARAM_construct_octet_string(KEYOP_PARAM_PKEY, &pkey, sizeof(pkey));
+	params[1] = OSSL_PARAM_construct_end();
+
+	ret = (EVP_PKEY_fromdata_init(pctx) == 1) &&
+	      (EVP_PKEY_fromdata(pctx, &wrapped, EVP_PKEY_KEYPAIR, params) == 1);
+	EVP_PKEY_CTX_free(pctx);
+	if (!ret) return -1;
+
+	/*
+	 *	Checks that the key matches the certificate
+	 *	and replaces the original key.
+	 */
+	ret = SSL_CTX_use_PrivateKey(ctx, wrapped);
+	EVP_PKEY_free(wrapped);
+
+	return (ret == 1) ? 0 : -1;
+}
+
+/*
+ *	Waiting for offloaded operations
+ */
+typedef struct {
+	request_t		*request;
+	fr_event_list_t		*el;
+	int			fd;			//!< Registered with the event loop, or -1.
+} tls_keyop_wait_t;
+
+static int _tls_keyop_wait_free(tls_keyop_wait_t *wait)
+{
+	if (wait->fd >= 0) (void)fr_event_fd_delete(wait->el, wait->fd, FR_EVENT_FILTER_IO);
+
+	return 0;
+}
+
+static void tls_keyop_wait_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	tls_keyop_wait_t *wait = talloc_get_type_abort(uctx, tls_keyop_wait_t);
+
+	(void)fr_event_fd_delete(wait->el, fd, FR_EVENT_FILTER_IO);
+	wait->fd = -1;
+
+	unlang_interpret_mark_runnable(wait->request);
+}
+
+static unlang_action_t tls_keyop_wait_yield(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					    UNUSED request_t *request, UNUSED void *uctx)
+{
+	return UNLANG_ACTION_YIELD;
+}
+
+static unlang_action_t tls_keyop_wait_resume(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					     UNUSED request_t *request, void *uctx)
+{
+	talloc_free(uctx);
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+static void tls_keyop_wait_signal(UNUSED request_t *request, UNUSED fr_signal_t action, void *uctx)
+{
+	/*
+	 *	The handshake's signal handler waits for
+	 *	the operation to complete, we just need
+	 *	to stop watching the fd.
+	 */
+	talloc_free(uctx);
+}
+
+/** Yield until an offloaded private key operation completes
+ *
+ * Should be called when SSL_read() returns SSL_ERROR_WANT_ASYNC, after
+ * any other pending async actions have been serviced.
+ *
+ * @param[in] request		the current request.
+ * @param[in] tls_session	whose async job is paused.
+ * @return
+ *	- UNLANG_ACTION_CALCULATE_RESULT if the job isn't waiting on a crypto thread.
+ *	- UNLANG_ACTION_PUSHED_CHILD if the request should wait.
+ *	- UNLANG_ACTION_FAIL on error.
+ */
+unlang_action_t fr_tls_keyop_pending_push(request_t *request, fr_tls_session_t *tls_session)
+{
+	tls_keyop_wait_t	*wait;
+	OSSL_ASYNC_FD		fd;
+	size_t			numfds = 0;
+
+	if (!keyop_pool) return UNLANG_ACTION_CALCULATE_RESULT;
+
+	/*
+	 *	We only ever register a single fd per job
+	 */
+	if ((SSL_get_all_async_fds(tls_session->ssl, NULL, &numfds) != 1) || (numfds != 1) ||
+	    (SSL_get_all_async_fds(tls_session->ssl, &fd, &numfds) != 1)) {
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	MEM(wait = talloc(unlang_interpret_frame_talloc_ctx(request), tls_keyop_wait_t));
+	*wait = (tls_keyop_wait_t){
+		.request = request,
+		.el = unlang_interpret_event_list(request),
+		.fd = -1
+	};
+
+	if (fr_event_fd_insert(wait, wait->el, fd, tls_keyop_wait_read, NULL, NULL, wait) < 0) {
+		RPERROR("Failed watching crypto thread fd");
+		talloc_free(wait);
+		return UNLANG_ACTION_FAIL;
+	}
+	wait->fd = fd;
+	talloc_set_destructor(wait, _tls_keyop_wait_free);
+
+	RDEBUG3("Waiting for crypto thread to complete private key operation");
+
+	if (unlang_function_push(request, tls_keyop_wait_yield, tls_keyop_wait_resume,
+				 tls_keyop_wait_signal, ~FR_SIGNAL_CANCEL, UNLANG_SUB_FRAME, wait) < 0) {
+		talloc_free(wait);
+		return UNLANG_ACTION_FAIL;
+	}
+
+	return UNLANG_ACTION_PUSHED_CHILD;
+}
+#else
+int fr_tls_keyop_pool_start(UNUSED uint32_t num_threads)
+{
+	fr_strerror_const("Crypto threads require OpenSSL >= 3.0");
+	return -1;
+}
+
+void fr_tls_keyop_pool_stop(void)
+{
+}
+
+bool fr_tls_keyop_pool_running(void)
+{
+	return false;
+}
+
+int fr_tls_keyop_ctx_wrap(UNUSED SSL_CTX *ctx)
+{
+	return 0;
+}
+
+unlang_action_t fr_tls_keyop_pending_push(UNUSED request_t *request, UNUSED fr_tls_session_t *tls_session)
+{
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+#endif
+#endif /* WITH_TLS */
@@ -0,0 +1,54 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifdef WITH_TLS
+/**
+ * $Id$
+ *
+ * @file lib/tls/keyop.h
+ * @brief Offload private key operations to a pool of crypto threads.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(keyop_h, "$Id$")
+
+#include "openssl_user_macros.h"
+
+#include <openssl/ssl.h>
+
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/unlang/action.h>
+
+#include "session.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int		fr_tls_keyop_pool_start(uint32_t num_threads);
+
+void		fr_tls_keyop_pool_stop(void);
+
+bool		fr_tls_keyop_pool_running(void);
+
+int		fr_tls_keyop_ctx_wrap(SSL_CTX *ctx);
+
+unlang_action_t	fr_tls_keyop_pending_push(request_t *request, fr_tls_session_t *tls_session);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* WITH_TLS */
@@ -0,0 +1,453 @@
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "keyop.c"
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/ec.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+/*
+ *	Enough for the signatures and plaintexts below
+ */
+#define TEST_BUFFER_SIZE	512
+
+static uint8_t const test_data[] = "Offloaded private key operation";
+
+typedef struct test_op_s test_op_t;
+
+typedef int (*test_op_func_t)(test_op_t *op);
+
+/** A private key operation to perform, possibly inside an async job
+ *
+ */
+struct test_op_s {
+	test_op_func_t		func;			//!< Performs the operation.
+	EVP_PKEY		*pkey;			//!< Key to perform it with.
+
+	uint8_t			in[TEST_BUFFER_SIZE];	//!< Ciphertext to decrypt.
+	size_t			inlen;
+
+	uint8_t			out[TEST_BUFFER_SIZE];	//!< Signature or plaintext.
+	size_t			outlen;
+};
+
+/** Keeps the only crypto thread busy
+ *
+ * Operations queued while the thread is busy can't complete until it's
+ * released, so whatever performs them has to wait, whichever thread the
+ * scheduler happens to run first.
+ */
+typedef struct {
+	tls_keyop_t		op;			//!< Queued for the crypto thread.
+	int			release[2];		//!< Written to, to release the thread.
+	bool			released;
+} test_block_t;
+
+static int _test_block(tls_keyop_t *op)
+{
+	test_block_t	*block = (test_block_t *)op;
+	uint8_t		c;
+
+	return read(block->release[0], &c, sizeof(c)) == 1;
+}
+
+static void test_block_start(test_block_t *block)
+{
+	*block = (test_block_t){ .op = { .func = _test_block } };
+
+	TEST_CHECK(pipe(block->op.fd) == 0);
+	TEST_CHECK(pipe(block->release) == 0);
+
+	fr_dlist_entry_init(&block->op.entry);
+	tls_keyop_queue(&block->op);
+}
+
+static void test_block_release(test_block_t *block)
+{
+	if (block->released) return;
+
+	TEST_CHECK(write(block->release[1], "", 1) == 1);
+	block->released = true;
+}
+
+/** Release the crypto thread, and wait for it to be done with the block
+ *
+ */
+static void test_block_finish(test_block_t *block)
+{
+	uint8_t c;
+
+	test_block_release(block);
+	TEST_CHECK(read(block->op.fd[0], &c, sizeof(c)) == 1);
+
+	close(block->op.fd[0]);
+	close(block->op.fd[1]);
+	close(block->release[0]);
+	close(block->release[1]);
+}
+
+/** Create an SSL_CTX holding a key and a self-signed certificate for it
+ *
+ * The key is wrapped, so that its operations are offloaded.
+ */
+static SSL_CTX *test_ctx_alloc(EVP_PKEY *pkey)
+{
+	SSL_CTX		*ctx;
+	X509		*cert;
+	X509_NAME	*name;
+
+	cert = X509_new();
+	if (!TEST_CHECK(cert != NULL)) return NULL;
+
+	name = X509_get_subject_name(cert);
+	TEST_CHECK(X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+					      (unsigned char const *)"keyop_tests", -1, -1, 0) == 1);
+	TEST_CHECK(X509_set_issuer_name(cert, name) == 1);
+	TEST_CHECK(ASN1_INTEGER_set(X509_get_serialNumber(cert), 1) == 1);
+	TEST_CHECK(X509_gmtime_adj(X509_getm_notBefore(cert), 0) != NULL);
+	TEST_CHECK(X509_gmtime_adj(X509_getm_notAfter(cert), 3600) != NULL);
+	TEST_CHECK(X509_set_pubkey(cert, pkey) == 1);
+	TEST_CHECK(X509_sign(cert, pkey, EVP_sha256()) > 0);
+
+	ctx = SSL_CTX_new(TLS_method());
+	if (!TEST_CHECK(ctx != NULL)) {
+		X509_free(cert);
+		return NULL;
+	}
+
+	TEST_CHECK(SSL_CTX_use_certificate(ctx, cert) == 1);
+	TEST_CHECK(SSL_CTX_use_PrivateKey(ctx, pkey) == 1);
+	X509_free(cert);
+
+	TEST_CHECK(fr_tls_keyop_ctx_wrap(ctx) == 0);
+
+	return ctx;
+}
+
+/** Return whether the private key of an SSL_CTX is one of ours
+ *
+ */
+static bool test_ctx_wrapped(SSL_CTX *ctx)
+{
+	OSSL_PROVIDER const *prov = EVP_PKEY_get0_provider(SSL_CTX_get0_privatekey(ctx));
+
+	return prov && (strcmp(OSSL_PROVIDER_get0_name(prov), KEYOP_PROVIDER_NAME) == 0);
+}
+
+/** Wait for one of the fds in an async job's wait context to become readable
+ *
+ */
+static void test_async_wait(ASYNC_WAIT_CTX *waitctx)
+{
+	OSSL_ASYNC_FD	fds[4];
+	struct pollfd	pfds[4];
+	size_t		num = 0, i;
+
+	if (!TEST_CHECK(ASYNC_WAIT_CTX_get_all_fds(waitctx, NULL, &num) == 1)) return;
+	if (!TEST_CHECK((num > 0) && (num <= NUM_ELEMENTS(fds)))) return;
+	ASYNC_WAIT_CTX_get_all_fds(waitctx, fds, &num);
+
+	for (i = 0; i < num; i++) pfds[i] = (struct pollfd){ .fd = fds[i], .events = POLLIN };
+
+	TEST_CHECK(poll(pfds, num, 5000) > 0);
+}
+
+static int _test_job(void *arg)
+{
+	test_op_t *op = *(test_op_t **)arg;
+
+	return op->func(op);
+}
+
+/** Run an operation in an async job, as the TLS code does for handshakes
+ *
+ * The crypto thread is kept busy until the job pauses.
+ *
+ * @param[in] op	to run.
+ * @param[out] paused	Whether the job paused, waiting for the crypto thread.
+ * @return What the operation returned.
+ */
+static int test_job_run(test_op_t *op, bool *paused)
+{
+	ASYNC_WAIT_CTX	*waitctx;
+	ASYNC_JOB	*job = NULL;
+	test_block_t	block;
+	int		ret = 0;
+
+	*paused = false;
+
+	waitctx = ASYNC_WAIT_CTX_new();
+	if (!TEST_CHECK(waitctx != NULL)) return 0;
+
+	test_block_start(&block);
+
+	for (;;) {
+		switch (ASYNC_start_job(&job, waitctx, &ret, _test_job, &op, sizeof(op))) {
+		case ASYNC_PAUSE:
+			*paused = true;
+			test_block_release(&block);
+			test_async_wait(waitctx);
+			continue;
+
+		case ASYNC_FINISH:
+			break;
+
+		default:
+			TEST_MSG("Failed running async job");
+			ret = 0;
+			break;
+		}
+		break;
+	}
+
+	test_block_finish(&block);
+	ASYNC_WAIT_CTX_free(waitctx);
+
+	return ret;
+}
+
+static int _test_sign(test_op_t *op)
+{
+	EVP_MD_CTX	*mdctx;
+	int		ret;
+
+	mdctx = EVP_MD_CTX_new();
+	if (!mdctx) return 0;
+
+	op->outlen = sizeof(op->out);
+	ret = (EVP_DigestSignInit_ex(mdctx, NULL, "SHA256", NULL, NULL, op->pkey, NULL) == 1) &&
+	      (EVP_DigestSign(mdctx, op->out, &op->outlen, test_data, sizeof(test_data)) == 1);
+	EVP_MD_CTX_free(mdctx);
+
+	return ret;
+}
+
+/** Check a signature created by _test_sign
+ *
+ */
+static bool test_verify(EVP_PKEY *pkey, test_op_t *op)
+{
+	EVP_MD_CTX	*mdctx;
+	bool		ret;
+
+	mdctx = EVP_MD_CTX_new();
+	if (!mdctx) return false;
+
+	ret = (EVP_DigestVerifyInit_ex(mdctx, NULL, "SHA256", NULL, NULL, pkey, NULL) == 1) &&
+	      (EVP_DigestVerify(mdctx, op->out, op->outlen, test_data, sizeof(test_data)) == 1);
+	EVP_MD_CTX_free(mdctx);
+
+	return ret;
+}
+
+static int _test_decrypt(test_op_t *op)
+{
+	EVP_PKEY_CTX	*pctx;
+	int		ret;
+
+	pctx = EVP_PKEY_CTX_new_from_pkey(NULL, op->pkey, NULL);
+	if (!pctx) return 0;
+
+	op->outlen = sizeof(op->out);
+	ret = (EVP_PKEY_decrypt_init(pctx) == 1) &&
+	      (EVP_PKEY_decrypt(pctx, op->out, &op->outlen, op->in, op->inlen) == 1);
+	EVP_PKEY_CTX_free(pctx);
+
+	return ret;
+}
+
+/** Sign with the wrapped key of an SSL_CTX, in and out of an async job
+ *
+ */
+static void test_sign(EVP_PKEY *pkey)
+{
+	SSL_CTX		*ctx;
+	test_op_t	op = { .func = _test_sign };
+	bool		paused;
+
+	TEST_CASE("Keys are wrapped when the pool is running");
+	if (!TEST_CHECK(fr_tls_keyop_pool_start(1) == 0)) return;
+
+	ctx = test_ctx_alloc(pkey);
+	if (!ctx) goto finish;
+	TEST_CHECK(test_ctx_wrapped(ctx));
+	op.pkey = SSL_CTX_get0_privatekey(ctx);
+
+	TEST_CASE("Signing in an async job is performed by a crypto thread");
+	TEST_CHECK(test_job_run(&op, &paused) == 1);
+	TEST_CHECK(paused);
+	TEST_CHECK(test_verify(pkey, &op));
+
+	TEST_CASE("Signing outside an async job is performed immediately");
+	memset(op.out, 0, sizeof(op.out));
+	TEST_CHECK(_test_sign(&op) == 1);
+	TEST_CHECK(test_verify(pkey, &op));
+
+	SSL_CTX_free(ctx);
+
+finish:
+	fr_tls_keyop_pool_stop();
+}
+
+static void test_sign_rsa(void)
+{
+	EVP_PKEY *pkey = EVP_RSA_gen(2048);
+
+	if (!TEST_CHECK(pkey != NULL)) return;
+	test_sign(pkey);
+	EVP_PKEY_free(pkey);
+}
+
+static void test_sign_ec(void)
+{
+	EVP_PKEY *pkey = EVP_EC_gen("P-256");
+
+	if (!TEST_CHECK(pkey != NULL)) return;
+	test_sign(pkey);
+	EVP_PKEY_free(pkey);
+}
+
+static void test_decrypt_rsa(void)
+{
+	EVP_PKEY	*pkey;
+	EVP_PKEY_CTX	*pctx = NULL;
+	SSL_CTX		*ctx = NULL;
+	test_op_t	op = { .func = _test_decrypt };
+	bool		paused;
+
+	pkey = EVP_RSA_gen(2048);
+	if (!TEST_CHECK(pkey != NULL)) return;
+
+	if (!TEST_CHECK(fr_tls_keyop_pool_start(1) == 0)) goto finish;
+
+	ctx = test_ctx_alloc(pkey);
+	if (!ctx) goto finish;
+	TEST_CHECK(test_ctx_wrapped(ctx));
+	op.pkey = SSL_CTX_get0_privatekey(ctx);
+
+	pctx = EVP_PKEY_CTX_new_from_pkey(NULL, pkey, NULL);
+	if (!TEST_CHECK(pctx != NULL)) goto finish;
+
+	op.inlen = sizeof(op.in);
+	if (!TEST_CHECK((EVP_PKEY_encrypt_init(pctx) == 1) &&
+			(EVP_PKEY_encrypt(pctx, op.in, &op.inlen, test_data, sizeof(test_data)) == 1))) goto finish;
+
+	TEST_CASE("Decrypting in an async job is performed by a crypto thread");
+	TEST_CHECK(test_job_run(&op, &paused) == 1);
+	TEST_CHECK(paused);
+	TEST_CHECK((op.outlen == sizeof(test_data)) && (memcmp(op.out, test_data, op.outlen) == 0));
+
+finish:
+	EVP_PKEY_CTX_free(pctx);
+	SSL_CTX_free(ctx);
+	fr_tls_keyop_pool_stop();
+	EVP_PKEY_free(pkey);
+}
+
+/** Perform a handshake with a server using a wrapped key, in async mode
+ *
+ * The crypto thread is kept busy until the server has to wait for it.
+ *
+ * @param[in] pkey	for the server to use.
+ * @param[out] waited	Whether the server had to wait for the crypto thread.
+ * @return Whether the handshake completed.
+ */
+static bool test_handshake(EVP_PKEY *pkey, bool *waited)
+{
+	SSL_CTX		*server_ctx, *client_ctx = NULL;
+	SSL		*server = NULL, *client = NULL;
+	BIO		*server_bio, *client_bio;
+	test_block_t	block;
+	int		i, ret;
+	bool		done = false;
+
+	*waited = false;
+
+	server_ctx = test_ctx_alloc(pkey);
+	if (!server_ctx) return false;
+	test_block_start(&block);
+	SSL_CTX_set_mode(server_ctx, SSL_MODE_ASYNC);
+
+	client_ctx = SSL_CTX_new(TLS_method());
+	if (!TEST_CHECK(client_ctx != NULL)) goto finish;
+
+	server = SSL_new(server_ctx);
+	client = SSL_new(client_ctx);
+	if (!TEST_CHECK(server && client)) goto finish;
+
+	if (!TEST_CHECK(BIO_new_bio_pair(&server_bio, 0, &client_bio, 0) == 1)) goto finish;
+	SSL_set_bio(server, server_bio, server_bio);
+	SSL_set_bio(client, client_bio, client_bio);
+
+	SSL_set_accept_state(server);
+	SSL_set_connect_state(client);
+
+	for (i = 0; i < 100; i++) {
+		bool client_done, server_done;
+
+		client_done = (SSL_do_handshake(client) == 1);
+
+		ret = SSL_do_handshake(server);
+		server_done = (ret == 1);
+		if (!server_done && (SSL_get_error(server, ret) == SSL_ERROR_WANT_ASYNC)) {
+			OSSL_ASYNC_FD	fd;
+			size_t		num = 1;
+			struct pollfd	pfd;
+
+			*waited = true;
+			test_block_release(&block);
+
+			if (!TEST_CHECK(SSL_get_all_async_fds(server, &fd, &num) == 1) || !TEST_CHECK(num == 1)) break;
+			pfd = (struct pollfd){ .fd = fd, .events = POLLIN };
+			TEST_CHECK(poll(&pfd, 1, 5000) == 1);
+		}
+
+		if (client_done && server_done) {
+			done = true;
+			break;
+		}
+	}
+
+finish:
+	test_block_finish(&block);
+	SSL_free(client);
+	SSL_free(server);
+	SSL_CTX_free(client_ctx);
+	SSL_CTX_free(server_ctx);
+
+	return done;
+}
+
+static void test_handshake_rsa(void)
+{
+	EVP_PKEY	*pkey;
+	bool		waited;
+
+	pkey = EVP_RSA_gen(2048);
+	if (!TEST_CHECK(pkey != NULL)) return;
+
+	if (!TEST_CHECK(fr_tls_keyop_pool_start(1) == 0)) goto finish;
+
+	TEST_CASE("Handshakes wait for the crypto thread to sign");
+	TEST_CHECK(test_handshake(pkey, &waited));
+	TEST_CHECK(waited);
+
+finish:
+	fr_tls_keyop_pool_stop();
+	EVP_PKEY_free(pkey);
+}
+
+TEST_LIST = {
+	{ "Crypto threads - RSA signing",	test_sign_rsa },
+	{ "Crypto threads - ECDSA signing",	test_sign_ec },
+	{ "Crypto threads - RSA decryption",	test_decrypt_rsa },
+	{ "Crypto threads - Handshake",		test_handshake_rsa },
+	{ NULL }
+};
+#else
+TEST_LIST = {
+	{ NULL }
+};
+#endif
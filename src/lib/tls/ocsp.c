@@ -0,0 +1,1605 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/ocsp.c
+ * @brief Validate client certificates using an OCSP service.
+ *
+ * @copyright 2006-2016 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#ifdef HAVE_OPENSSL_OCSP_H
+#define LOG_PREFIX "tls - ocsp"
+
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/server/pair.h>
+#include <freeradius-devel/util/debug.h>
+
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/rb.h>
+
+#include <freeradius-devel/unlang/function.h>
+#include <freeradius-devel/unlang/interpret.h>
+
+#include <freeradius-devel/tls/openssl_user_macros.h>
+#include <openssl/ocsp.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/http.h>
+#else
+/*
+ *	Older versions of OpenSSL provide the same non-blocking
+ *	HTTP exchange, but only for OCSP requests.
+ */
+typedef OCSP_REQ_CTX OSSL_HTTP_REQ_CTX;
+#  define OSSL_HTTP_REQ_CTX_free(_rctx)				OCSP_REQ_CTX_free(_rctx)
+#  define OSSL_HTTP_REQ_CTX_add1_header(_rctx, _name, _value)	OCSP_REQ_CTX_add1_header(_rctx, _name, _value)
+#  define OSSL_HTTP_REQ_CTX_set1_req(_rctx, _type, _it, _req)	OCSP_REQ_CTX_set1_req(_rctx, (OCSP_REQUEST *)(_req))
+#  define OSSL_HTTP_REQ_CTX_nbio_d2i(_rctx, _resp, _it)		OCSP_sendreq_nbio((OCSP_RESPONSE **)(_resp), _rctx)
+#endif
+
+#include <pthread.h>
+
+#include "attrs.h"
+#include "base.h"
+#include "log.h"
+#include "ocsp.h"
+#include "utils.h"
+
+/** Rcodes returned by the OCSP check function
+ */
+typedef enum {
+	OCSP_STATUS_FAILED	= 0,
+	OCSP_STATUS_OK		= 1,
+	OCSP_STATUS_SKIPPED	= 2,
+} ocsp_status_t;
+
+/** Maximum leeway in validity period of OCSP response
+ *
+ * Default 5 minutes.
+ */
+#define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
+
+/** A cached OCSP response
+ *
+ * Responses are stored in their DER form, and are re-parsed and
+ * re-verified every time they're used.  This means we don't need to
+ * worry about OpenSSL structures being shared between threads.
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of responses.
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+
+	uint8_t			*key;			//!< DER encoded OCSP_CERTID.  Contains hashes
+							///< of the issuer name and key, and the serial
+							///< number of the certificate.
+	size_t			key_len;		//!< Length of the key.
+
+	uint8_t			*resp;			//!< DER encoded OCSP_RESPONSE.  NULL if a fetch
+							///< is in progress for this certificate.
+	size_t			resp_len;		//!< Length of the response.
+
+	time_t			expires;		//!< When the response should no longer be used.
+							///< The nextUpdate value from the response, or
+							///< the fetch timeout if a fetch is in progress.
+} ocsp_cache_entry_t;
+
+/** Cache of OCSP responses, shared between all threads
+ *
+ */
+struct fr_tls_ocsp_cache_s {
+	pthread_mutex_t		mutex;			//!< Protects the tree and LRU list.
+	fr_rb_tree_t		*tree;			//!< Responses ordered by certificate ID.
+	fr_dlist_head_t		lru;			//!< Least recently used entries at the tail.
+	uint32_t		max_entries;		//!< Maximum number of responses to hold.
+};
+
+static int8_t ocsp_cache_entry_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+
+	MEMCMP_RETURN(a, b, key, key_len);
+
+	return 0;
+}
+
+static void ocsp_cache_entry_remove(fr_tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	fr_rb_delete(cache->tree, entry);
+	fr_dlist_remove(&cache->lru, entry);
+	talloc_free(entry);
+}
+
+static int _ocsp_cache_free(fr_tls_ocsp_cache_t *cache)
+{
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a new OCSP response cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of responses to cache.
+ * @return A new response cache.
+ */
+fr_tls_ocsp_cache_t *fr_tls_ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries)
+{
+	fr_tls_ocsp_cache_t *cache;
+
+	MEM(cache = talloc_zero(ctx, fr_tls_ocsp_cache_t));
+	MEM(cache->tree = fr_rb_inline_talloc_alloc(cache, ocsp_cache_entry_t, node, ocsp_cache_entry_cmp, NULL));
+	fr_dlist_talloc_init(&cache->lru, ocsp_cache_entry_t, entry);
+	cache->max_entries = max_entries;
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	return cache;
+}
+
+/** Retrieve a cached OCSP response
+ *
+ * @param[out] out		The response.  Must be freed with OCSP_RESPONSE_free().
+ * @param[in] cache		to search in.
+ * @param[in] key		DER encoded OCSP_CERTID.
+ * @param[in] key_len		Length of the key.
+ * @return
+ *	- 1 if a response was found.
+ *	- 0 if no response was found.
+ *	- -1 if no response was found, but one is currently being fetched.
+ */
+static int ocsp_cache_find(OCSP_RESPONSE **out, fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len)
+{
+	ocsp_cache_entry_t	*entry;
+	time_t			now = fr_unix_time_to_sec(fr_time_to_unix_time(fr_time()));
+	uint8_t const		*p;
+	int			ret = 0;
+
+	*out = NULL;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(ocsp_cache_entry_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (!entry) goto done;
+
+	if (entry->expires <= now) {
+		ocsp_cache_entry_remove(cache, entry);
+		goto done;
+	}
+
+	if (!entry->resp) {
+		ret = -1;
+		goto done;
+	}
+
+	p = entry->resp;
+	*out = d2i_OCSP_RESPONSE(NULL, &p, entry->resp_len);
+	if (*out) {
+		fr_dlist_remove(&cache->lru, entry);
+		fr_dlist_insert_head(&cache->lru, entry);
+		ret = 1;
+	}
+
+done:
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/** Find or create a cache entry, evicting the least recently used entry if the cache is full
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static ocsp_cache_entry_t *ocsp_cache_entry_get(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len)
+{
+	ocsp_cache_entry_t	*entry;
+
+	entry = fr_rb_find(cache->tree, &(ocsp_cache_entry_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (entry) {
+		fr_dlist_remove(&cache->lru, entry);
+		fr_dlist_insert_head(&cache->lru, entry);
+		return entry;
+	}
+
+	if (fr_rb_num_elements(cache->tree) >= cache->max_entries) {
+		ocsp_cache_entry_remove(cache, fr_dlist_tail(&cache->lru));
+	}
+
+	MEM(entry = talloc_zero(cache, ocsp_cache_entry_t));
+	MEM(entry->key = talloc_memdup(entry, key, key_len));
+	entry->key_len = key_len;
+
+	fr_rb_insert(cache->tree, entry);
+	fr_dlist_insert_head(&cache->lru, entry);
+
+	return entry;
+}
+
+/** Record that a response for a certificate is being fetched
+ *
+ * Stops multiple fetches being started for the same certificate.
+ *
+ * @param[in] cache		to add the placeholder to.
+ * @param[in] key		DER encoded OCSP_CERTID.
+ * @param[in] key_len		Length of the key.
+ * @param[in] timeout		How long the fetch may take.
+ * @return
+ *	- true if the caller should fetch the response.
+ *	- false if a response is already cached, or is being fetched.
+ */
+static bool ocsp_cache_reserve(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len, fr_time_delta_t timeout)
+{
+	ocsp_cache_entry_t	*entry;
+	time_t			now = fr_unix_time_to_sec(fr_time_to_unix_time(fr_time()));
+	bool			ret = false;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = ocsp_cache_entry_get(cache, key, key_len);
+	if (entry->expires <= now) {
+		TALLOC_FREE(entry->resp);
+		entry->resp_len = 0;
+		entry->expires = now + fr_time_delta_to_sec(timeout) + 1;
+		ret = true;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/** Release a placeholder added by ocsp_cache_reserve() if the fetch failed
+ *
+ */
+static void ocsp_cache_release(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len)
+{
+	ocsp_cache_entry_t	*entry;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = fr_rb_find(cache->tree, &(ocsp_cache_entry_t){ .key = UNCONST(uint8_t *, key), .key_len = key_len });
+	if (entry && !entry->resp) ocsp_cache_entry_remove(cache, entry);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Add a response to the cache
+ *
+ * @param[in] cache		to add the response to.
+ * @param[in] key		DER encoded OCSP_CERTID.
+ * @param[in] key_len		Length of the key.
+ * @param[in] resp		to cache.
+ * @param[in] expires		The nextUpdate time of the response.
+ */
+static void ocsp_cache_insert(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+			      OCSP_RESPONSE *resp, time_t expires)
+{
+	ocsp_cache_entry_t	*entry;
+	uint8_t			*der = NULL, *p;
+	int			len;
+
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) return;
+
+	/*
+	 *	Serialise outside of the lock
+	 */
+	MEM(der = talloc_array(NULL, uint8_t, len));
+	p = der;
+	if (i2d_OCSP_RESPONSE(resp, &p) != len) {
+		talloc_free(der);
+		return;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = ocsp_cache_entry_get(cache, key, key_len);
+	talloc_free(entry->resp);
+	entry->resp = talloc_steal(entry, der);
+	entry->resp_len = len;
+	entry->expires = expires;
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Produce the key used to find responses for a certificate
+ *
+ * @param[in] ctx		to allocate the key in.
+ * @param[out] out		Where to write the key.
+ * @param[in] certid		to encode.
+ * @return
+ *	- Length of the key.
+ *	- 0 on error.
+ */
+static size_t ocsp_cache_key(TALLOC_CTX *ctx, uint8_t **out, OCSP_CERTID *certid)
+{
+	uint8_t		*key, *p;
+	int		len;
+
+	len = i2d_OCSP_CERTID(certid, NULL);
+	if (len <= 0) return 0;
+
+	MEM(key = talloc_array(ctx, uint8_t, len));
+	p = key;
+	if (i2d_OCSP_CERTID(certid, &p) != len) {
+		talloc_free(key);
+		return 0;
+	}
+	*out = key;
+
+	return len;
+}
+
+DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
+DIAG_OFF(used-but-marked-unused)	/* fix spurious warnings for sk macros */
+/** Extract components of OCSP responder URL from a certificate
+ *
+ * @param[in] cert to extract URL from.
+ * @param[out] host_out Portion of the URL (must be freed with free()).
+ * @param[out] port_out Port portion of the URL (must be freed with free()).
+ * @param[out] path_out Path portion of the URL (must be freed with free()).
+ * @param[out] is_https Whether the responder should be contacted using https.
+ * @return
+ *	- 0 if no valid URL is contained in the certificate.
+ *	- 1 if a URL was found and parsed.
+ *	- -1 if at least one URL was found, but none could be parsed.
+ */
+static int ocsp_cert_url_parse(X509 *cert, char **host_out, char **port_out, char **path_out, int *is_https)
+{
+	int			i;
+	bool			found_uri = false;
+
+	AUTHORITY_INFO_ACCESS	*aia;
+	ACCESS_DESCRIPTION	*ad;
+
+	aia = X509_get_ext_d2i(cert, NID_info_access, NULL, NULL);
+
+	for (i = 0; i < sk_ACCESS_DESCRIPTION_num(aia); i++) {
+		ad = sk_ACCESS_DESCRIPTION_value(aia, i);
+		if (OBJ_obj2nid(ad->method) != NID_ad_OCSP) continue;
+		if (ad->location->type != GEN_URI) continue;
+		found_uri = true;
+
+		if (OCSP_parse_url((char *) ad->location->d.ia5->data, host_out,
+				   port_out, path_out, is_https)) return 1;
+	}
+	return found_uri ? -1 : 0;
+}
+DIAG_ON(used-but-marked-unused)
+DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
+
+/** Set the OCSP TLS stapling extension for a SSL session, from cached response data
+ *
+ * @param ssl		The current SSL session.
+ * @param vp		containing the response.
+ * @return
+ *	- -1 on error.
+ *	- 0 on success.
+ */
+static int ocsp_staple_from_pair(request_t *request, SSL *ssl, fr_pair_t *vp)
+{
+	uint8_t *p;
+
+	/*
+	 *	OpenSSL should free the buffer itself.
+	 */
+	p = OPENSSL_malloc(vp->vp_length);
+	if (!p) return -1;
+
+	memcpy(p, vp->vp_octets, vp->vp_length);
+
+	RDEBUG2("Adding OCSP stapling extension");
+	if (SSL_set_tlsext_status_ocsp_resp(ssl, p, vp->vp_length) == 0) {
+		OPENSSL_free(p);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Store OCSP response as a TLS-OCSP-Response attribute
+ *
+ * @note Adds &request.TLS-OCSP-Response to the current request, and adds
+ *	stapling data to the current SSL session.
+ *
+ * @param out		Where to write the TLS-OCSP-Response attribute.  Will also
+ *			have been added to the request list of the current request.
+ * @param request 	The current request.
+ * @param resp		to serialize.
+ * @return
+ *	- -1 on error.
+ *	- 0 on success.
+ */
+static int ocsp_staple_to_pair(fr_pair_t **out, request_t *request, OCSP_RESPONSE *resp)
+{
+	fr_pair_t	*vp;
+	size_t		len;
+	uint8_t		*p;
+
+	if (!resp) {
+		REDEBUG("No OCSP response available");
+		return -1;
+	}
+
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) {
+		REDEBUG("Failed getting OCSP response length");
+		return -1;
+	}
+
+	MEM(pair_update_request(&vp, attr_tls_ocsp_response) >= 0);
+	MEM(fr_pair_value_mem_alloc(vp, &p, len, true) == 0);
+	len = i2d_OCSP_RESPONSE(resp, &p);
+	if (len <= 0) {
+		REDEBUG("Failed serialising OCSP response");
+		pair_delete_request(vp);
+		return -1;
+	}
+
+	RDEBUG2("Serializing OCSP response");
+	RINDENT();
+	RDEBUG2("&%pP", vp);
+	REXDENT();
+
+	*out = vp;
+
+	return 0;
+}
+
+/** State of an in progress fetch from an OCSP responder
+ *
+ */
+typedef struct ocsp_fetch_s ocsp_fetch_t;
+
+/** Called when a fetch completes, fails, or times out
+ *
+ * @param[in] fetch	that finished.  fetch->resp will be NULL on failure,
+ *			and fetch->error will say why.
+ * @param[in] uctx	passed to ocsp_fetch_start().
+ */
+typedef void (*ocsp_fetch_done_t)(ocsp_fetch_t *fetch, void *uctx);
+
+struct ocsp_fetch_s {
+	fr_event_list_t		*el;			//!< Event list servicing the connection.
+	fr_event_timer_t const	*ev;			//!< Fetch timeout.
+
+	BIO			*conn;			//!< Connection to the responder.
+	OSSL_HTTP_REQ_CTX	*req_ctx;		//!< HTTP exchange with the responder.
+	int			fd;			//!< Socket of the connection, or -1 if the
+							///< socket isn't in the event list.
+
+	OCSP_REQUEST		*req;			//!< Request we sent.  Kept so the nonce
+							///< and certificate ID can be checked.
+	OCSP_RESPONSE		*resp;			//!< Response we received, or NULL.
+	char const		*error;			//!< Why the fetch failed.
+
+	ocsp_fetch_done_t	done;			//!< Called when the fetch finishes.
+	void			*uctx;			//!< Passed to done.
+};
+
+static int _ocsp_fetch_free(ocsp_fetch_t *fetch)
+{
+	if (fetch->fd >= 0) (void) fr_event_fd_delete(fetch->el, fetch->fd, FR_EVENT_FILTER_IO);
+	OSSL_HTTP_REQ_CTX_free(fetch->req_ctx);
+	BIO_free_all(fetch->conn);
+	OCSP_REQUEST_free(fetch->req);
+	OCSP_RESPONSE_free(fetch->resp);
+
+	return 0;
+}
+
+/** Stop servicing the connection, and tell the owner of the fetch that it's finished
+ *
+ */
+static void ocsp_fetch_finish(ocsp_fetch_t *fetch, char const *error)
+{
+	if (fetch->fd >= 0) {
+		(void) fr_event_fd_delete(fetch->el, fetch->fd, FR_EVENT_FILTER_IO);
+		fetch->fd = -1;
+	}
+	if (fetch->ev) fr_event_timer_delete(&fetch->ev);
+
+	fetch->error = error;
+	fetch->done(fetch, fetch->uctx);
+}
+
+static void _ocsp_fetch_io(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx);
+
+static void _ocsp_fetch_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	ocsp_fetch_t	*fetch = talloc_get_type_abort(uctx, ocsp_fetch_t);
+
+	ocsp_fetch_finish(fetch, fd_errno == ECONNREFUSED ?
+			  "Connection to OCSP responder refused" :
+			  "Connection to OCSP responder failed");
+}
+
+/** Advance the HTTP exchange with the responder
+ *
+ * If the exchange can't progress without blocking, the socket is
+ * inserted into the event list, waiting for whichever of read or
+ * write OpenSSL needs next.
+ */
+static void ocsp_fetch_step(ocsp_fetch_t *fetch)
+{
+	int	rc;
+	bool	want_read;
+
+	rc = OSSL_HTTP_REQ_CTX_nbio_d2i(fetch->req_ctx, (ASN1_VALUE **)&fetch->resp, ASN1_ITEM_rptr(OCSP_RESPONSE));
+	if (rc == 1) {
+		ocsp_fetch_finish(fetch, NULL);
+		return;
+	}
+
+	if ((rc == 0) || !BIO_should_retry(fetch->conn)) {
+		fetch->resp = NULL;
+		ocsp_fetch_finish(fetch, "Couldn't get OCSP response");
+		return;
+	}
+
+	want_read = BIO_should_read(fetch->conn);
+	if (fr_event_fd_insert(fetch, fetch->el, fetch->fd,
+			       want_read ? _ocsp_fetch_io : NULL,
+			       want_read ? NULL : _ocsp_fetch_io,
+			       _ocsp_fetch_error, fetch) < 0) {
+		ocsp_fetch_finish(fetch, "Failed inserting OCSP responder socket into event list");
+	}
+}
+
+static void _ocsp_fetch_io(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	ocsp_fetch_step(talloc_get_type_abort(uctx, ocsp_fetch_t));
+}
+
+static void _ocsp_fetch_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	ocsp_fetch_t	*fetch = talloc_get_type_abort(uctx, ocsp_fetch_t);
+
+	ocsp_fetch_finish(fetch, "Response timed out");
+}
+
+/** Start fetching an OCSP response without blocking
+ *
+ * The connection to the responder is serviced by the event list.  When
+ * the fetch finishes, or times out, the done callback is called.  The
+ * done callback is never called before this function returns.
+ *
+ * @param[in] ctx		to allocate the fetch in.
+ * @param[in] el		to service the connection with.
+ * @param[in] req		to send.  Freed with the fetch, or immediately on error.
+ * @param[in] host		of the responder.
+ * @param[in] port		of the responder.
+ * @param[in] path		of the responder.
+ * @param[in] timeout		How long to wait for the response.
+ * @param[in] done		Called when the fetch finishes.
+ * @param[in] uctx		passed to done.
+ * @return
+ *	- A new fetch on success.
+ *	- NULL on error, with an error on the thread local error stack.
+ */
+static ocsp_fetch_t *ocsp_fetch_start(TALLOC_CTX *ctx, fr_event_list_t *el, OCSP_REQUEST *req,
+				      char const *host, char const *port, char const *path,
+				      fr_time_delta_t timeout, ocsp_fetch_done_t done, void *uctx)
+{
+	ocsp_fetch_t	*fetch;
+	char		host_header[1024];
+
+	MEM(fetch = talloc_zero(ctx, ocsp_fetch_t));
+	fetch->el = el;
+	fetch->fd = -1;
+	fetch->req = req;
+	fetch->done = done;
+	fetch->uctx = uctx;
+	talloc_set_destructor(fetch, _ocsp_fetch_free);
+
+	/* Check host and port length are sane, then create Host: HTTP header */
+	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
+		fr_strerror_const("Host and port too long");
+	error:
+		talloc_free(fetch);
+		return NULL;
+	}
+	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
+
+	/* Setup BIO socket to OCSP responder */
+	fetch->conn = BIO_new_connect(host);
+	if (!fetch->conn) {
+		fr_strerror_const("Couldn't create connection to OCSP responder");
+		goto error;
+	}
+	BIO_set_conn_port(fetch->conn, port);
+	BIO_set_nbio(fetch->conn, 1);
+
+	if ((BIO_do_connect(fetch->conn) <= 0) && !BIO_should_retry(fetch->conn)) {
+		fr_strerror_const("Couldn't connect to OCSP responder");
+		goto error;
+	}
+
+	if ((BIO_get_fd(fetch->conn, &fetch->fd) < 0) || (fetch->fd < 0)) {
+		fetch->fd = -1;
+		fr_strerror_const("Couldn't get socket for OCSP responder connection");
+		goto error;
+	}
+
+	fetch->req_ctx = OCSP_sendreq_new(fetch->conn, path, NULL, -1);
+	if (!fetch->req_ctx) {
+		fr_strerror_const("Couldn't create OCSP request");
+		goto error;
+	}
+
+	if (!OSSL_HTTP_REQ_CTX_add1_header(fetch->req_ctx, "Host", host_header)) {
+		fr_strerror_const("Couldn't set Host header");
+		goto error;
+	}
+
+	if (!OSSL_HTTP_REQ_CTX_set1_req(fetch->req_ctx, "application/ocsp-request",
+					ASN1_ITEM_rptr(OCSP_REQUEST), (ASN1_VALUE const *)req)) {
+		fr_strerror_const("Couldn't add data to OCSP request");
+		goto error;
+	}
+
+	/*
+	 *	The connection is either established, or in
+	 *	progress.  Either way the socket becomes writable
+	 *	when we can send the request.
+	 */
+	if (fr_event_fd_insert(fetch, el, fetch->fd, NULL, _ocsp_fetch_io, _ocsp_fetch_error, fetch) < 0) {
+		fetch->fd = -1;
+		fr_strerror_const_push("Failed inserting OCSP responder socket into event list");
+		goto error;
+	}
+
+	if (fr_event_timer_in(fetch, el, &fetch->ev, timeout, _ocsp_fetch_timeout, fetch) < 0) {
+		fr_strerror_const_push("Failed inserting OCSP response timeout");
+		goto error;
+	}
+
+	return fetch;
+}
+
+/** Get the responder URL for a certificate
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if no usable URL was found.
+ */
+static int ocsp_url(request_t *request, char **host, char **port, char **path,
+		    X509 *cert, fr_tls_ocsp_conf_t const *conf)
+{
+	int	use_ssl = -1;
+
+	/* Get OCSP responder URL */
+	if (conf->override_url) {
+		char *url;
+
+	use_url:
+		memcpy(&url, &conf->url, sizeof(url));
+		/* Reading the libssl src, they do a strdup on the URL, so it could of been const *sigh* */
+		OCSP_parse_url(url, host, port, path, &use_ssl);
+		if (!*host || !*port || !*path) {
+			RWDEBUG("Host or port or path missing from configured URL \"%s\".  Not doing OCSP", url);
+			return -1;
+		}
+	} else {
+		int ret;
+
+		ret = ocsp_cert_url_parse(cert, host, port, path, &use_ssl);
+		switch (ret) {
+		case -1:
+			RWDEBUG("Invalid URL in certificate.  Not doing OCSP");
+			return -1;
+
+		case 0:
+			if (conf->url) {
+				RWDEBUG("No OCSP URL in certificate, falling back to configured URL");
+				goto use_url;
+			}
+			RWDEBUG("No OCSP URL in certificate.  Not doing OCSP");
+			return -1;
+
+		case 1:
+			fr_assert(*host && *port && *path);
+			break;
+		}
+	}
+
+	RDEBUG2("Using responder URL \"http://%s:%s%s\"", *host, *port, *path);
+
+	return 0;
+}
+
+/** Get the time after which a response should no longer be used
+ *
+ * @param[out] out	nextUpdate from the response.
+ * @param[in] req	The request we sent, or NULL to skip the nonce check.
+ * @param[in] certid	of the certificate being checked.
+ * @param[in] resp	to get the nextUpdate time from.
+ * @return
+ *	- 0 if the response can be cached.
+ *	- -1 if the response can't be cached.
+ */
+static int ocsp_response_expires(time_t *out, OCSP_REQUEST *req, OCSP_CERTID *certid, OCSP_RESPONSE *resp)
+{
+	OCSP_BASICRESP		*bresp;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	int			status, reason;
+	int			ret = -1;
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) return -1;
+
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp) return -1;
+
+	if (req && (OCSP_check_nonce(req, bresp) <= 0)) goto finish;
+
+	if (!OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update)) goto finish;
+
+	/*
+	 *	No nextUpdate means newer information is always
+	 *	available, so the response must not be reused.
+	 */
+	if (!next_update) goto finish;
+
+	if (fr_tls_utils_asn1time_to_epoch(out, next_update) < 0) goto finish;
+
+	ret = 0;
+
+finish:
+	OCSP_BASICRESP_free(bresp);
+
+	return ret;
+}
+
+/** Check what an OCSP response says about a certificate
+ *
+ * @param[in] request		The current request.
+ * @param[in] conf		OCSP configuration.
+ * @param[in] store		to verify the response signature with.
+ * @param[in] req		The request we sent, or NULL if the response came
+ *				from the response cache.
+ * @param[in] certid		of the certificate being checked.
+ * @param[in] resp		to check.
+ * @param[in] ssl_log		BIO to use for formatting log messages.
+ * @return The status of the certificate.
+ */
+static ocsp_status_t ocsp_response_check(request_t *request, fr_tls_ocsp_conf_t const *conf, X509_STORE *store,
+					 OCSP_REQUEST *req, OCSP_CERTID *certid, OCSP_RESPONSE *resp, BIO *ssl_log)
+{
+	OCSP_BASICRESP		*bresp = NULL;
+	ocsp_status_t		ocsp_status = OCSP_STATUS_FAILED;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	long			this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
+	int			status, reason;
+	fr_pair_t		*vp;
+
+	/* Verify OCSP response status */
+	status = OCSP_response_status(resp);
+	if (status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		REDEBUG("Response status: %s", OCSP_response_status_str(status));
+		goto finish;
+	}
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp) {
+		REDEBUG("Response contained no basic response");
+		goto finish;
+	}
+
+	/*
+	 *	Nonces are only checked for responses we fetched
+	 *	ourselves.  Cached responses were checked when they
+	 *	were fetched.
+	 */
+	if (req && conf->use_nonce && OCSP_check_nonce(req, bresp) != 1) {
+		REDEBUG("Response has wrong nonce value");
+		goto finish;
+	}
+
+	if (conf->verifycert) {
+		if (OCSP_basic_verify(bresp, NULL, store, 0) != 1){
+			REDEBUG("Couldn't verify OCSP basic response");
+			goto finish;
+		}
+	}
+
+	/*	Verify OCSP cert status */
+	if (!OCSP_resp_find_status(bresp, certid, &status, &reason, &rev, &this_update, &next_update)) {
+		REDEBUG("No Status found");
+		goto finish;
+	}
+
+	/*
+	 *	Here we check the fields 'thisUpdate' and 'nextUpdate'
+	 *	from the OCSP response against the server's time.
+	 *
+	 *	this_fudge is the number of seconds +- between the current
+	 *	time and this_update.
+	 *
+	 *	The default for this_fudge is 300, defined by OCSP_MAX_VALIDITY_PERIOD.
+	 */
+	if (!OCSP_check_validity(this_update, next_update, this_fudge, this_max_age)) {
+		/*
+		 *	We want this to show up in the global log
+		 *	so someone will fix it...
+		 */
+		RATE_LIMIT_GLOBAL(RERROR, "Delta +/- between OCSP response time and our time is greater than %li "
+				  "seconds.  Check servers are synchronised to a common time source",
+				  this_fudge);
+		FR_OPENSSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		goto finish;
+	}
+
+	/*
+	 *	Print any messages we may have accumulated
+	 */
+	FR_OPENSSL_DRAIN_ERROR_QUEUE(RDEBUG2, "", ssl_log);
+	if (RDEBUG_ENABLED) {
+		RDEBUG2("OCSP response valid from:");
+		ASN1_GENERALIZEDTIME_print(ssl_log, this_update);
+		RINDENT();
+		FR_OPENSSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
+		REXDENT();
+
+		if (next_update) {
+			RDEBUG2("New information available at:");
+			ASN1_GENERALIZEDTIME_print(ssl_log, next_update);
+			RINDENT();
+			FR_OPENSSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
+			REXDENT();
+		}
+	}
+
+	/*
+	 *	When an OCSP validation command is used with OpenSSL
+	 *	next_update is NULL.
+	 */
+	if (next_update) {
+		time_t	now, next;
+
+		now = fr_unix_time_to_sec(fr_time_to_unix_time(fr_time()));
+
+		if (fr_tls_utils_asn1time_to_epoch(&next, next_update) < 0) {
+			RPEDEBUG("Failed parsing next_update time");
+			ocsp_status = OCSP_STATUS_SKIPPED;
+			goto finish;
+		}
+		if (now < next){
+			RDEBUG2("Adding OCSP TTL attribute");
+
+			MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
+			vp->vp_uint32 = next - now;
+			RINDENT();
+			RDEBUG2("&%pP", vp);
+			REXDENT();
+		} else {
+			RDEBUG2("Update time is in the past.  Not adding &TLS-OCSP-Next-Update");
+		}
+	} else {
+		RDEBUG2("Update time not provided.  Not adding &TLS-OCSP-Next-Update");
+	}
+
+	switch (status) {
+	case V_OCSP_CERTSTATUS_GOOD:
+		RDEBUG2("Cert status: good");
+		ocsp_status = OCSP_STATUS_OK;
+		break;
+
+	default:
+		/* REVOKED / UNKNOWN */
+		REDEBUG("Cert status: %s", OCSP_cert_status_str(status));
+		if (reason != -1) REDEBUG("Reason: %s", OCSP_crl_reason_str(reason));
+
+		/*
+		 *	Print any messages we may have accumulated
+		 */
+		FR_OPENSSL_DRAIN_LOG_QUEUE(RDEBUG, "", ssl_log);
+		if (RDEBUG_ENABLED2) {
+			RDEBUG2("Revocation time:");
+			ASN1_GENERALIZEDTIME_print(ssl_log, rev);
+			RINDENT();
+			FR_OPENSSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
+			REXDENT();
+		}
+		break;
+	}
+
+finish:
+	OCSP_BASICRESP_free(bresp);
+
+	return ocsp_status;
+}
+
+/** Create an OCSP request for a certificate, and the key used to find cached responses for it
+ *
+ * @param[in] ctx		to allocate the key in.
+ * @param[out] key		Where to write the cache key.
+ * @param[out] key_len		Length of the cache key.
+ * @param[out] certid		The certificate ID in the request.
+ * @param[in] issuer_cert	Issuer of the certificate.
+ * @param[in] cert		to check.
+ * @param[in] use_nonce		Whether to add a nonce to the request.
+ * @return
+ *	- A new OCSP request.
+ *	- NULL on error.
+ */
+static OCSP_REQUEST *ocsp_request_alloc(TALLOC_CTX *ctx, uint8_t **key, size_t *key_len, OCSP_CERTID **certid,
+					X509 *issuer_cert, X509 *cert, bool use_nonce)
+{
+	OCSP_REQUEST	*req;
+
+	*certid = OCSP_cert_to_id(NULL, cert, issuer_cert);
+	if (!*certid) return NULL;
+
+	req = OCSP_REQUEST_new();
+	if (!req) {
+		OCSP_CERTID_free(*certid);
+		return NULL;
+	}
+	OCSP_request_add0_id(req, *certid);	/* req now owns the certid */
+	if (use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
+
+	*key_len = ocsp_cache_key(ctx, key, *certid);
+	if (!*key_len) {
+		OCSP_REQUEST_free(req);
+		return NULL;
+	}
+
+	return req;
+}
+
+/** Fetch a response for a stapling certificate in the background
+ *
+ */
+typedef struct {
+	fr_tls_ocsp_cache_t	*cache;			//!< To add the response to.
+	uint8_t			*key;			//!< Cache key of the certificate.
+	size_t			key_len;		//!< Length of the key.
+	OCSP_CERTID		*certid;		//!< Owned by the OCSP request in the fetch.
+	bool			use_nonce;		//!< Whether the request contained a nonce.
+	ocsp_fetch_t		*fetch;			//!< Fetch in progress.
+} ocsp_prefetch_t;
+
+static void _ocsp_prefetch_done(ocsp_fetch_t *fetch, void *uctx)
+{
+	ocsp_prefetch_t	*prefetch = talloc_get_type_abort(uctx, ocsp_prefetch_t);
+	time_t		expires;
+
+	if (!fetch->resp) {
+		WARN("Failed fetching OCSP response for stapling: %s", fetch->error);
+	release:
+		ocsp_cache_release(prefetch->cache, prefetch->key, prefetch->key_len);
+		talloc_free(prefetch);
+		return;
+	}
+
+	if (ocsp_response_expires(&expires, prefetch->use_nonce ? fetch->req : NULL,
+				  prefetch->certid, fetch->resp) < 0) {
+		WARN("OCSP response for stapling can't be cached");
+		goto release;
+	}
+
+	DEBUG2("Caching OCSP response for stapling");
+	ocsp_cache_insert(prefetch->cache, prefetch->key, prefetch->key_len, fetch->resp, expires);
+	talloc_free(prefetch);
+}
+
+/** Set the stapled OCSP response for the server certificate
+ *
+ * The stapling callback can't yield, so stapled responses are always
+ * served from the response cache.  If there's no cached response, one
+ * is fetched in the background and no response is stapled this time.
+ *
+ * @return
+ *	- OCSP_STATUS_OK if a response was stapled.
+ *	- OCSP_STATUS_FAILED if the server certificate is invalid.
+ *	- OCSP_STATUS_SKIPPED if no response was stapled.
+ */
+static ocsp_status_t ocsp_staple(request_t *request, SSL *ssl, X509_STORE *store, X509 *issuer_cert, X509 *cert,
+				 fr_tls_ocsp_conf_t *conf)
+{
+	OCSP_REQUEST	*req;
+	OCSP_CERTID	*certid;
+	OCSP_RESPONSE	*resp = NULL;
+	uint8_t		*key = NULL;
+	size_t		key_len;
+	char		*host = NULL, *port = NULL, *path = NULL;
+	BIO		*ssl_log = NULL;
+	ocsp_status_t	ocsp_status = OCSP_STATUS_SKIPPED;
+	fr_pair_t	*vp;
+
+	/*
+	 *	Allow the stapled response to be provided externally
+	 */
+	vp = fr_pair_find_by_da(&request->control_pairs, NULL, attr_tls_ocsp_cert_valid);
+	if (vp && (vp->vp_uint32 == 1)) {
+		vp = fr_pair_find_by_da(&request->control_pairs, NULL, attr_tls_ocsp_response);
+		if (vp) {
+			RDEBUG2("Found &control.TLS-OCSP-Response, using it as the stapled response");
+			if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
+				RWDEBUG("Failed setting OCSP staple response in SSL session");
+				return OCSP_STATUS_FAILED;
+			}
+			return OCSP_STATUS_OK;
+		}
+	}
+
+	if (!conf->response_cache) {
+		RWDEBUG("OCSP stapling requires the response cache, not stapling");
+		return OCSP_STATUS_SKIPPED;
+	}
+
+	req = ocsp_request_alloc(request, &key, &key_len, &certid, issuer_cert, cert, conf->use_nonce);
+	if (!req) {
+		REDEBUG("Failed creating OCSP request");
+		return OCSP_STATUS_SKIPPED;
+	}
+
+	switch (ocsp_cache_find(&resp, conf->response_cache, key, key_len)) {
+	case 1:
+		break;
+
+	case -1:
+		RDEBUG2("OCSP response for stapling is being fetched, not stapling");
+		goto finish;
+
+	default:
+		if (!ocsp_cache_reserve(conf->response_cache, key, key_len, conf->timeout)) goto finish;
+
+		if (ocsp_url(request, &host, &port, &path, cert, conf) < 0) {
+			ocsp_cache_release(conf->response_cache, key, key_len);
+			goto finish;
+		}
+
+		{
+			ocsp_prefetch_t		*prefetch;
+			fr_event_list_t		*el = unlang_interpret_event_list(request);
+
+			/*
+			 *	The fetch outlives the request, so
+			 *	bind it to the event list instead.
+			 */
+			MEM(prefetch = talloc_zero(el, ocsp_prefetch_t));
+			prefetch->cache = conf->response_cache;
+			prefetch->key = talloc_steal(prefetch, key);
+			prefetch->key_len = key_len;
+			prefetch->certid = certid;
+			prefetch->use_nonce = conf->use_nonce;
+			key = NULL;
+
+			prefetch->fetch = ocsp_fetch_start(prefetch, el, req, host, port, path,
+							   conf->timeout, _ocsp_prefetch_done, prefetch);
+			req = NULL;	/* Owned by the fetch, or freed */
+			if (!prefetch->fetch) {
+				RPWDEBUG("Failed fetching OCSP response for stapling");
+				ocsp_cache_release(conf->response_cache, prefetch->key, prefetch->key_len);
+				talloc_free(prefetch);
+				goto finish;
+			}
+		}
+
+		RDEBUG2("No cached OCSP response for stapling, fetching one in the background");
+		goto finish;
+	}
+
+	ssl_log = BIO_new(BIO_s_mem());
+	if (!ssl_log) {
+		REDEBUG("Failed creating log queue");
+		goto finish;
+	}
+
+	RDEBUG2("Found cached OCSP response for stapling");
+	ocsp_status = ocsp_response_check(request, conf, store, NULL, certid, resp, ssl_log);
+	if (ocsp_status == OCSP_STATUS_OK) {
+		if ((ocsp_staple_to_pair(&vp, request, resp) < 0) ||
+		    (ocsp_staple_from_pair(request, ssl, vp) < 0)) {
+			RWDEBUG("Failed setting OCSP staple response in SSL session");
+			ocsp_status = OCSP_STATUS_SKIPPED;
+		}
+	}
+
+finish:
+	OCSP_REQUEST_free(req);
+	OCSP_RESPONSE_free(resp);
+	OPENSSL_free(host);
+	OPENSSL_free(port);
+	OPENSSL_free(path);
+	BIO_free(ssl_log);
+	talloc_free(key);
+
+	return ocsp_status;
+}
+
+DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
+DIAG_OFF(used-but-marked-unused)	/* fix spurious warnings for sk macros */
+/** Callback used to get stapling data for the current server cert
+ *
+ * @param ssl	Current SSL session.
+ * @param data	OCSP configuration.
+ */
+int fr_tls_ocsp_staple_cb(SSL *ssl, void *data)
+{
+	fr_tls_ocsp_conf_t	*conf = data;	/* Alloced as part of fr_tls_conf_t (not talloced) */
+	request_t		*request = fr_tls_session_request(ssl);
+
+	X509			*cert;
+	X509			*issuer_cert;
+	X509_STORE		*server_store = NULL;
+	X509_STORE_CTX		*server_store_ctx = NULL;
+
+	STACK_OF(X509)		*our_chain = NULL;
+
+	int			ret;
+
+	cert = SSL_get_certificate(ssl);
+	if (!cert) {
+		fr_tls_log(request, "No server certificate found in SSL session");
+	error:
+		X509_STORE_CTX_free(server_store_ctx);
+		X509_STORE_free(server_store);
+
+		return conf->softfail ? SSL_TLSEXT_ERR_NOACK : SSL_TLSEXT_ERR_ALERT_FATAL;
+	}
+
+	/*
+	 *	Ignore the return code for older versions of
+	 *	OpenSSL.
+	 *
+	 *	https://github.com/openssl/openssl/pull/9395
+	 */
+	(void)SSL_get0_chain_certs(ssl, &our_chain);
+	if (!our_chain) {
+		fr_tls_log(request, "Failed retrieving chain certificates from current SSL session");
+		goto error;
+	}
+
+	/*
+	 *	Print out the current chain in the certificate store
+	 *	to help with debugging issues where we can't find the
+	 *	server cert's issuer.
+	 */
+	if (RDEBUG_ENABLED3) {
+		RDEBUG3("Current SSL session cert store contents");
+		RINDENT();
+		fr_tls_chain_log(request, L_DBG, our_chain, cert);
+		REXDENT();
+	}
+
+	MEM(server_store = X509_STORE_new());
+	X509_STORE_set_trust(server_store, 1);	/* All certs are trusted */
+
+	/*
+	 *	Add the chain certificates from the current SSL*
+	 *	to the trusted store so that we can determine
+	 *	the issuer cert of the certificate we presented.
+	 */
+	{
+		int num = sk_X509_num(our_chain);
+		int i;
+
+		for (i = 0; i < num; i++) {
+			if (X509_STORE_add_cert(server_store, sk_X509_value(our_chain, i)) != 1) {
+				fr_tls_log(request, "Failed adding certificate to trusted store");
+				goto error;
+			}
+		}
+	}
+
+	/*
+	 *	This is what OpenSSL uses to construct SSL chains
+	 *	for validation.  We just need to use it to find
+	 *	who issued our server certificate.
+	 */
+	MEM(server_store_ctx = X509_STORE_CTX_new());
+	if (X509_STORE_CTX_init(server_store_ctx, server_store, NULL, NULL) == 0) {
+		fr_tls_log(request, "Failed initialising SSL session cert store ctx");
+		goto error;
+	}
+
+	ret = X509_STORE_CTX_get1_issuer(&issuer_cert, server_store_ctx, cert);
+	if (ret != 1) {
+		X509_NAME	*subject;
+		X509_NAME	*issuer;
+		char		*subject_str;
+		char		*issuer_str;
+
+ 		subject = X509_get_subject_name(cert);
+		if (!subject) {
+			fr_tls_log(request, "Couldn't retrieve subject name of SSL session cert");
+			goto error;
+		}
+		MEM(subject_str = X509_NAME_oneline(subject, NULL, 0));
+
+		issuer = X509_get_issuer_name(cert);
+		if (!issuer) {
+			fr_tls_log(request, "Couldn't retrieve issuer name of SSL session cert");
+			OPENSSL_free(subject_str);
+			goto error;
+		}
+		MEM(issuer_str = X509_NAME_oneline(issuer, NULL, 0));
+
+		switch (ret) {
+		case 0:
+			fr_tls_log(request, "Issuer \"%s\" of \"%s\" not found in certificate store",
+				      issuer_str, subject_str);
+			break;
+		default:
+			fr_tls_log(request, "Error retrieving issuer \"%s\" of \"%s\" from certificate store",
+				      issuer_str, subject_str);
+			break;
+		}
+
+		OPENSSL_free(subject_str);
+		OPENSSL_free(issuer_str);
+		goto error;
+	}
+
+	fr_assert(issuer_cert);
+
+	switch (ocsp_staple(request, ssl, server_store, issuer_cert, cert, conf)) {
+	default:
+	case OCSP_STATUS_FAILED:	/* server cert is invalid */
+		ret = SSL_TLSEXT_ERR_ALERT_FATAL;
+		break;
+
+	case OCSP_STATUS_OK:
+		ret = SSL_TLSEXT_ERR_OK;
+		break;
+
+	case OCSP_STATUS_SKIPPED:
+		ret = SSL_TLSEXT_ERR_NOACK;
+		break;
+	}
+
+	X509_free(issuer_cert);	/* Decrement reference count on issuer cert */
+	X509_STORE_CTX_free(server_store_ctx);
+	X509_STORE_free(server_store);
+
+	return ret;
+}
+DIAG_ON(used-but-marked-unused)
+DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
+
+/** State of an OCSP check of a client certificate
+ *
+ */
+typedef struct {
+	request_t		*request;		//!< The current request.
+	SSL			*ssl;			//!< The current SSL session.
+	X509_STORE		*store;			//!< To verify responses with.
+	fr_tls_ocsp_conf_t	*conf;			//!< OCSP configuration.
+	bool			staple_response;	//!< Add the response to the SSL session.
+
+	OCSP_REQUEST		*req;			//!< Request for the certificate, until it's
+							///< handed to the fetch.
+	OCSP_CERTID		*certid;		//!< Owned by the OCSP request.
+	uint8_t			*key;			//!< Response cache key of the certificate.
+	size_t			key_len;		//!< Length of the key.
+
+	OCSP_RESPONSE		*resp;			//!< Response from the response cache.
+	ocsp_fetch_t		*fetch;			//!< Fetch from the responder.
+	bool			fetched;		//!< The fetch has finished.
+
+	ocsp_status_t		status;			//!< Result of the check.
+	bool			decided;		//!< The result was decided without
+							///< an OCSP response.
+} ocsp_check_t;
+
+static int _ocsp_check_free(ocsp_check_t *check)
+{
+	OCSP_REQUEST_free(check->req);
+	OCSP_RESPONSE_free(check->resp);
+
+	return 0;
+}
+
+static void _ocsp_check_fetch_done(UNUSED ocsp_fetch_t *fetch, void *uctx)
+{
+	ocsp_check_t	*check = talloc_get_type_abort(uctx, ocsp_check_t);
+
+	check->fetched = true;
+	unlang_interpret_mark_runnable(check->request);
+}
+
+/** Record the result of the OCSP check in the request
+ *
+ */
+static ocsp_status_t ocsp_check_result(request_t *request, ocsp_check_t *check,
+				       ocsp_status_t ocsp_status, OCSP_RESPONSE *resp, BIO *ssl_log)
+{
+	fr_tls_ocsp_conf_t	*conf = check->conf;
+	fr_pair_t		*vp;
+
+	switch (ocsp_status) {
+	case OCSP_STATUS_OK:
+		RDEBUG2("Certificate is valid");
+
+		if (check->staple_response) {
+			/*
+			 *	Convert the OCSP response to a fr_pair_t
+			 *	and add it to the current request.
+			 */
+			if (ocsp_staple_to_pair(&vp, request, resp) < 0) goto skipped;
+
+			/*
+			 *	Set the stapled response for the current
+			 *	SSL session.
+			 */
+			if (ocsp_staple_from_pair(request, check->ssl, vp) < 0) return OCSP_STATUS_FAILED;
+			vp = NULL;	/* It's in the request, don't need to free it! */
+		}
+
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 1;	/* yes */
+		ocsp_status = OCSP_STATUS_OK;
+
+		break;
+
+	case OCSP_STATUS_SKIPPED:
+	skipped:
+		FR_OPENSSL_DRAIN_ERROR_QUEUE(RWDEBUG, "", ssl_log);
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 2;	/* skipped */
+		if (conf->softfail) {
+			RWDEBUG("Unable to check certificate: %s",
+				check->staple_response ?
+					"Cannot provide TLS client with stapled OCSP response":
+					"TLS clients presenting revoked certificates may be granted access");
+
+			ocsp_status = OCSP_STATUS_OK;
+
+			/* Remove OpenSSL errors from queue or handshake will fail */
+			while (ERR_get_error());	/* Not always debugging */
+		} else {
+			REDEBUG("Unable to check certificate, failing");
+			ocsp_status = OCSP_STATUS_FAILED;
+		}
+		break;
+
+	default:
+		FR_OPENSSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 0;	/* no */
+		REDEBUG("Failed to validate certificate");
+		break;
+	}
+
+	return ocsp_status;
+}
+
+/** Yield until the response has been fetched
+ *
+ */
+static unlang_action_t ocsp_check_fetch(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+					UNUSED request_t *request, void *uctx)
+{
+	ocsp_check_t	*check = talloc_get_type_abort(uctx, ocsp_check_t);
+
+	if (check->fetch && !check->fetched) return UNLANG_ACTION_YIELD;
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+/** Check the response, and record the result
+ *
+ */
+static unlang_action_t ocsp_check_resume(rlm_rcode_t *p_result, UNUSED int *priority,
+					 request_t *request, void *uctx)
+{
+	ocsp_check_t	*check = talloc_get_type_abort(uctx, ocsp_check_t);
+	fr_tls_ocsp_conf_t *conf = check->conf;
+	OCSP_RESPONSE	*resp = check->resp;
+	BIO		*ssl_log = NULL;
+	ocsp_status_t	ocsp_status = check->status;
+
+	if (check->decided) goto done;
+
+	/*
+	 *	Setup logging for this OCSP operation
+	 */
+	ssl_log = BIO_new(BIO_s_mem());
+	if (!ssl_log) {
+		REDEBUG("Failed creating log queue");
+		ocsp_status = OCSP_STATUS_SKIPPED;
+		goto finish;
+	}
+
+	if (check->fetch) {
+		time_t expires;
+
+		resp = check->fetch->resp;
+		if (!resp) {
+			REDEBUG("%s", check->fetch->error);
+			FR_OPENSSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+			ocsp_status = OCSP_STATUS_SKIPPED;
+			goto finish;
+		}
+
+		ocsp_status = ocsp_response_check(request, conf, check->store,
+						  check->fetch->req, check->certid, resp, ssl_log);
+
+		/*
+		 *	Cache definitive answers until the responder
+		 *	says newer information will be available.
+		 */
+		if (conf->response_cache && (ocsp_status != OCSP_STATUS_SKIPPED) &&
+		    (ocsp_response_expires(&expires, NULL, check->certid, resp) == 0)) {
+			RDEBUG2("Caching OCSP response");
+			ocsp_cache_insert(conf->response_cache, check->key, check->key_len, resp, expires);
+		}
+	} else if (resp) {
+		RDEBUG2("Using cached OCSP response");
+		ocsp_status = ocsp_response_check(request, conf, check->store, NULL, check->certid, resp, ssl_log);
+	}
+
+finish:
+	ocsp_status = ocsp_check_result(request, check, ocsp_status, resp, ssl_log);
+	BIO_free(ssl_log);
+
+done:
+	*p_result = (ocsp_status == OCSP_STATUS_OK) ? RLM_MODULE_OK : RLM_MODULE_REJECT;
+	talloc_free(check);
+
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+/** Stop waiting for the response
+ *
+ */
+static void ocsp_check_signal(UNUSED request_t *request, UNUSED fr_signal_t action, void *uctx)
+{
+	ocsp_check_t	*check = talloc_get_type_abort(uctx, ocsp_check_t);
+
+	talloc_free(check);
+}
+
+/** Push an OCSP check for a certificate
+ *
+ * Responses are taken from the response cache where possible.  Otherwise
+ * the request yields while the response is fetched from the responder,
+ * so other requests on the same worker continue to be processed.
+ *
+ * The result is available in &request.TLS-OCSP-Cert-Valid, and as the
+ * rcode of the pushed frame, `ok` if the certificate is valid (or the check
+ * was skipped with softfail enabled), else `reject`.
+ *
+ * @param[in] request		The current request.
+ * @param[in] ssl		The current SSL session.
+ * @param[in] store		to verify OCSP responses with.
+ * @param[in] issuer_cert	Issuer of the certificate.
+ * @param[in] client_cert	to check.
+ * @param[in] conf		OCSP configuration.
+ * @param[in] staple_response	Add the OCSP response to the SSL session.
+ * @return
+ *	- UNLANG_ACTION_PUSHED_CHILD on success.
+ *	- UNLANG_ACTION_FAIL on failure.
+ */
+unlang_action_t fr_tls_ocsp_check_push(request_t *request, SSL *ssl,
+				       X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
+				       fr_tls_ocsp_conf_t *conf, bool staple_response)
+{
+	ocsp_check_t	*check;
+	char		*host = NULL;
+	char		*port = NULL;
+	char		*path = NULL;
+	fr_pair_t	*vp;
+
+	MEM(check = talloc_zero(request, ocsp_check_t));
+	*check = (ocsp_check_t){
+		.request = request,
+		.ssl = ssl,
+		.store = store,
+		.conf = conf,
+		.staple_response = staple_response,
+		.status = OCSP_STATUS_FAILED
+	};
+	talloc_set_destructor(check, _ocsp_check_free);
+
+	/*
+	 *	Allow us to cache the OCSP verified state externally
+	 */
+	vp = fr_pair_find_by_da(&request->control_pairs, NULL, attr_tls_ocsp_cert_valid);
+	if (vp) switch (vp->vp_uint32) {
+	case 0:	/* no */
+		RDEBUG2("Found &control.TLS-OCSP-Cert-Valid = no, forcing OCSP failure");
+		check->decided = true;
+		goto push;
+
+	case 1: /* yes */
+		RDEBUG2("Found &control.TLS-OCSP-Cert-Valid = yes, forcing OCSP success");
+
+		/*
+		 *	If this fails, and an OCSP stapled response is required,
+		 *	we need to run the full OCSP check.
+		 */
+		if (staple_response) {
+			vp = fr_pair_find_by_da(&request->control_pairs, NULL, attr_tls_ocsp_response);
+			if (!vp) {
+				RDEBUG2("No &control.TLS-OCSP-Response attribute found, performing full OCSP check");
+				break;
+			}
+			if (ocsp_staple_from_pair(request, ssl, vp) < 0) {
+				RWDEBUG("Failed setting OCSP staple response in SSL session");
+				check->decided = true;
+				goto push;
+			}
+		}
+
+		check->status = OCSP_STATUS_OK;
+		check->decided = true;
+		goto push;
+
+	case 2: /* skipped */
+		RDEBUG2("Found &control.TLS-OCSP-Cert-Valid = skipped, skipping OCSP check");
+		check->status = conf->softfail ? OCSP_STATUS_OK : OCSP_STATUS_FAILED;
+		check->decided = true;
+		goto push;
+
+	case 3: /* unknown */
+	default:
+		break;
+	}
+
+	if (issuer_cert == NULL) {
+		RWDEBUG("Could not get issuer certificate");
+	skipped:
+		check->status = OCSP_STATUS_SKIPPED;
+		goto push;
+	}
+
+	/*
+	 *	Create OCSP Request
+	 */
+	check->req = ocsp_request_alloc(check, &check->key, &check->key_len, &check->certid,
+					issuer_cert, client_cert, conf->use_nonce);
+	if (!check->req) {
+		REDEBUG("Failed creating OCSP request");
+		goto skipped;
+	}
+
+	/*
+	 *	Repeat validations of the same certificate
+	 *	don't need to contact the responder.
+	 */
+	if (conf->response_cache &&
+	    (ocsp_cache_find(&check->resp, conf->response_cache, check->key, check->key_len) == 1)) goto push;
+
+	if (ocsp_url(request, &host, &port, &path, client_cert, conf) < 0) goto skipped;
+
+	/*
+	 *	Send OCSP Request and get OCSP Response
+	 */
+	check->fetch = ocsp_fetch_start(check, unlang_interpret_event_list(request), check->req,
+					host, port, path, conf->timeout, _ocsp_check_fetch_done, check);
+	check->req = NULL;	/* Owned by the fetch, or freed */
+
+	OPENSSL_free(host);
+	OPENSSL_free(port);
+	OPENSSL_free(path);
+
+	if (!check->fetch) {
+		RPEDEBUG("Failed sending OCSP request");
+		goto skipped;
+	}
+
+push:
+	return unlang_function_push(request,
+				    ocsp_check_fetch,
+				    ocsp_check_resume,
+				    ocsp_check_signal,
+				    ~FR_SIGNAL_CANCEL,
+				    UNLANG_SUB_FRAME,
+				    check);
+}
+#endif /* HAVE_OPENSSL_OCSP_H */
+#endif /* WITH_TLS */
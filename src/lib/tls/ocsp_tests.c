@@ -0,0 +1,504 @@
+static void test_init(void);
+static void test_free(void);
+#  define TEST_INIT  test_init()
+#  define TEST_FINI  test_free()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/conf.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include "ocsp.c"
+
+#include <openssl/pem.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/*
+ *	Override with OPENSSL=/path/to/openssl
+ */
+#define TEST_OPENSSL_DEFAULT	"openssl"
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*dict_internal;
+
+/*
+ *	The attributes in attrs.h aren't exported from
+ *	libfreeradius-tls, so our copy of ocsp.c needs
+ *	its own.
+ */
+static fr_dict_t const *dict_test_freeradius;
+
+static fr_dict_autoload_t test_tls_dict[] = {
+	{ .out = &dict_test_freeradius, .proto = "freeradius" },
+	{ NULL }
+};
+
+fr_dict_attr_t const *attr_tls_ocsp_cert_valid;
+fr_dict_attr_t const *attr_tls_ocsp_next_update;
+fr_dict_attr_t const *attr_tls_ocsp_response;
+
+static fr_dict_attr_autoload_t test_tls_dict_attr[] = {
+	{ .out = &attr_tls_ocsp_cert_valid, .name = "TLS-OCSP-Cert-Valid", .type = FR_TYPE_UINT32, .dict = &dict_test_freeradius },
+	{ .out = &attr_tls_ocsp_next_update, .name = "TLS-OCSP-Next-Update", .type = FR_TYPE_UINT32, .dict = &dict_test_freeradius },
+	{ .out = &attr_tls_ocsp_response, .name = "TLS-OCSP-Response", .type = FR_TYPE_OCTETS, .dict = &dict_test_freeradius },
+	{ NULL }
+};
+
+/** An `openssl ocsp` responder, and the certificates it knows about
+ *
+ */
+typedef struct {
+	char			dir[64];		//!< Holding the CA, certificates and index.
+	char			port[8];		//!< The responder is listening on.
+	pid_t			pid;			//!< Of the responder.
+	int			log_fd;			//!< Responder's stderr.
+
+	X509			*ca;			//!< Issuer of the certificates, and the
+							///< signer of OCSP responses.
+	X509			*good;			//!< Certificate with status good.
+	X509			*revoked;		//!< Certificate with status revoked.
+	X509_STORE		*store;			//!< Containing the CA, for verifying responses.
+
+	fr_tls_ocsp_conf_t	conf;			//!< Pointing at the responder.
+} test_responder_t;
+
+/** Run the openssl CLI in the responder's directory
+ *
+ */
+static int test_openssl(test_responder_t *tr, char const *args)
+{
+	char const	*openssl = getenv("OPENSSL");
+	char		*cmd;
+	int		ret;
+
+	if (!openssl) openssl = TEST_OPENSSL_DEFAULT;
+
+	cmd = talloc_asprintf(NULL, "cd %s && %s %s > /dev/null 2>&1", tr->dir, openssl, args);
+	ret = system(cmd);
+	talloc_free(cmd);
+
+	if (!WIFEXITED(ret) || (WEXITSTATUS(ret) != 0)) return -1;
+
+	return 0;
+}
+
+static X509 *test_cert_load(test_responder_t *tr, char const *name)
+{
+	char	path[128];
+	FILE	*fp;
+	X509	*cert;
+
+	snprintf(path, sizeof(path), "%s/%s", tr->dir, name);
+
+	fp = fopen(path, "r");
+	if (!fp) return NULL;
+
+	cert = PEM_read_X509(fp, NULL, NULL, NULL);
+	fclose(fp);
+
+	return cert;
+}
+
+/** Find a port nothing is listening on
+ *
+ */
+static int test_port_pick(test_responder_t *tr)
+{
+	struct sockaddr_in	sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t		len = sizeof(sin);
+	int			fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	if ((bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+	    (getsockname(fd, (struct sockaddr *)&sin, &len) < 0)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	snprintf(tr->port, sizeof(tr->port), "%u", ntohs(sin.sin_port));
+
+	return 0;
+}
+
+/** Wait for the responder to accept connections
+ *
+ * The responder handles one connection at a time, so we can't probe it
+ * with a connection of our own.  Instead wait for it to say it's ready.
+ */
+static int test_responder_wait(test_responder_t *tr)
+{
+	char		buff[1024];
+	size_t		used = 0;
+	fr_time_t	end = fr_time_add(fr_time(), fr_time_delta_from_sec(5));
+
+	while (fr_time_lt(fr_time(), end)) {
+		struct pollfd	pfd = { .fd = tr->log_fd, .events = POLLIN };
+		ssize_t		len;
+
+		if (poll(&pfd, 1, 100) <= 0) continue;
+
+		len = read(tr->log_fd, buff + used, sizeof(buff) - used - 1);
+		if (len <= 0) return -1;	/* Responder exited */
+
+		used += len;
+		buff[used] = '\0';
+		if (strstr(buff, "waiting for OCSP client connections")) return 0;
+		if (used == (sizeof(buff) - 1)) used = 0;
+	}
+
+	return -1;
+}
+
+static int _test_responder_free(test_responder_t *tr)
+{
+	char *cmd;
+
+	if (tr->pid > 0) {
+		kill(tr->pid, SIGTERM);
+		waitpid(tr->pid, NULL, 0);
+	}
+	if (tr->log_fd >= 0) close(tr->log_fd);
+
+	X509_free(tr->ca);
+	X509_free(tr->good);
+	X509_free(tr->revoked);
+	X509_STORE_free(tr->store);
+
+	cmd = talloc_asprintf(NULL, "rm -rf %s", tr->dir);
+	if (system(cmd) != 0) fprintf(stderr, "Failed removing %s\n", tr->dir);
+	talloc_free(cmd);
+
+	return 0;
+}
+
+/** Create a CA with one good and one revoked certificate, and start a responder for them
+ *
+ */
+static test_responder_t *test_responder_alloc(TALLOC_CTX *ctx)
+{
+	test_responder_t	*tr;
+	FILE			*fp;
+	char			path[128];
+	char			*args;
+	char const		*openssl;
+	int			log_pipe[2];
+
+	MEM(tr = talloc_zero(ctx, test_responder_t));
+	tr->log_fd = -1;
+	strlcpy(tr->dir, "/tmp/ocsp_tests.XXXXXX", sizeof(tr->dir));
+	if (!mkdtemp(tr->dir)) {
+		talloc_free(tr);
+		return NULL;
+	}
+	talloc_set_destructor(tr, _test_responder_free);
+
+	if ((test_openssl(tr, "req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes "
+			  "-keyout ca.key -out ca.pem -subj /CN=ocsp_tests_ca -days 2") < 0) ||
+	    (test_openssl(tr, "req -new -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes "
+			  "-keyout good.key -out good.csr -subj /CN=good") < 0) ||
+	    (test_openssl(tr, "x509 -req -in good.csr -CA ca.pem -CAkey ca.key -set_serial 1 -days 1 "
+			  "-out good.pem") < 0) ||
+	    (test_openssl(tr, "req -new -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes "
+			  "-keyout revoked.key -out revoked.csr -subj /CN=revoked") < 0) ||
+	    (test_openssl(tr, "x509 -req -in revoked.csr -CA ca.pem -CAkey ca.key -set_serial 2 -days 1 "
+			  "-out revoked.pem") < 0)) {
+		TEST_MSG("Failed creating certificates with the openssl CLI");
+	error:
+		talloc_free(tr);
+		return NULL;
+	}
+
+	snprintf(path, sizeof(path), "%s/index.txt", tr->dir);
+	fp = fopen(path, "w");
+	if (!fp) goto error;
+	fprintf(fp, "V\t491231235959Z\t\t01\tunknown\t/CN=good\n");
+	fprintf(fp, "R\t491231235959Z\t240101000000Z\t02\tunknown\t/CN=revoked\n");
+	fclose(fp);
+
+	tr->ca = test_cert_load(tr, "ca.pem");
+	tr->good = test_cert_load(tr, "good.pem");
+	tr->revoked = test_cert_load(tr, "revoked.pem");
+	if (!tr->ca || !tr->good || !tr->revoked) goto error;
+
+	MEM(tr->store = X509_STORE_new());
+	X509_STORE_add_cert(tr->store, tr->ca);
+
+	if (test_port_pick(tr) < 0) goto error;
+
+	/*
+	 *	-ndays gives responses a nextUpdate time,
+	 *	so they can be cached.
+	 */
+	openssl = getenv("OPENSSL");
+	if (!openssl) openssl = TEST_OPENSSL_DEFAULT;
+
+	if (pipe(log_pipe) < 0) goto error;
+
+	tr->pid = fork();
+	if (tr->pid < 0) {
+		close(log_pipe[0]);
+		close(log_pipe[1]);
+		goto error;
+	}
+	if (tr->pid == 0) {
+		int devnull = open("/dev/null", O_WRONLY);
+
+		if ((chdir(tr->dir) < 0) || (devnull < 0)) _exit(1);
+		dup2(devnull, STDOUT_FILENO);
+		dup2(log_pipe[1], STDERR_FILENO);
+		close(log_pipe[0]);
+
+		execlp(openssl, openssl, "ocsp", "-index", "index.txt", "-port", tr->port,
+		       "-rsigner", "ca.pem", "-rkey", "ca.key", "-CA", "ca.pem", "-ndays", "1", (char *)NULL);
+		_exit(1);
+	}
+	close(log_pipe[1]);
+	tr->log_fd = log_pipe[0];
+
+	if (test_responder_wait(tr) < 0) {
+		TEST_MSG("openssl ocsp responder didn't start");
+		goto error;
+	}
+
+	args = talloc_asprintf(tr, "http://127.0.0.1:%s/", tr->port);
+	tr->conf = (fr_tls_ocsp_conf_t){
+		.enable = true,
+		.override_url = true,
+		.url = args,
+		.use_nonce = true,
+		.timeout = fr_time_delta_from_sec(5),
+		.verifycert = true
+	};
+
+	return tr;
+}
+
+static void _test_fetch_done(UNUSED ocsp_fetch_t *fetch, void *uctx)
+{
+	bool *done = uctx;
+
+	*done = true;
+}
+
+/** Fetch a response for a certificate from the responder, servicing the event list until it arrives
+ *
+ */
+static ocsp_fetch_t *test_fetch(TALLOC_CTX *ctx, request_t *request, fr_event_list_t *el,
+				test_responder_t *tr, X509 *cert, OCSP_CERTID **certid,
+				uint8_t **key, size_t *key_len)
+{
+	OCSP_REQUEST	*req;
+	ocsp_fetch_t	*fetch;
+	char		*host = NULL, *port = NULL, *path = NULL;
+	bool		done = false;
+
+	req = ocsp_request_alloc(ctx, key, key_len, certid, tr->ca, cert, tr->conf.use_nonce);
+	if (!TEST_CHECK(req != NULL)) return NULL;
+
+	if (!TEST_CHECK(ocsp_url(request, &host, &port, &path, cert, &tr->conf) == 0)) {
+		OCSP_REQUEST_free(req);
+		return NULL;
+	}
+
+	fetch = ocsp_fetch_start(ctx, el, req, host, port, path, tr->conf.timeout, _test_fetch_done, &done);
+	OPENSSL_free(host);
+	OPENSSL_free(port);
+	OPENSSL_free(path);
+	if (!TEST_CHECK(fetch != NULL)) {
+		TEST_MSG("%s", fr_strerror());
+		return NULL;
+	}
+
+	while (!done) {
+		if (fr_event_corral(el, fr_time(), true) < 0) break;
+		fr_event_service(el);
+	}
+	TEST_CHECK(done);
+
+	return fetch;
+}
+
+static void test_ocsp_good(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	request_t		*request = request_local_alloc_external(ctx, NULL);
+	fr_event_list_t		*el = fr_event_list_alloc(ctx, NULL, NULL);
+	BIO			*ssl_log = BIO_new(BIO_s_mem());
+	test_responder_t	*tr;
+	ocsp_fetch_t		*fetch;
+	OCSP_CERTID		*certid;
+	uint8_t			*key;
+	size_t			key_len;
+
+	tr = test_responder_alloc(ctx);
+	if (!TEST_CHECK(tr != NULL)) goto finish;
+
+	TEST_CASE("Response for a good certificate is fetched");
+	fetch = test_fetch(ctx, request, el, tr, tr->good, &certid, &key, &key_len);
+	if (!TEST_CHECK(fetch && fetch->resp)) goto finish;
+
+	TEST_CASE("Certificate is valid");
+	TEST_CHECK(ocsp_response_check(request, &tr->conf, tr->store, fetch->req, certid,
+				       fetch->resp, ssl_log) == OCSP_STATUS_OK);
+	TEST_CHECK(fr_pair_find_by_da(&request->request_pairs, NULL, attr_tls_ocsp_next_update) != NULL);
+
+	TEST_CASE("Responses signed by an unknown CA are rejected");
+	{
+		X509_STORE *empty = X509_STORE_new();
+
+		TEST_CHECK(ocsp_response_check(request, &tr->conf, empty, fetch->req, certid,
+					       fetch->resp, ssl_log) == OCSP_STATUS_FAILED);
+		X509_STORE_free(empty);
+	}
+
+finish:
+	BIO_free(ssl_log);
+	talloc_free(ctx);
+}
+
+static void test_ocsp_revoked(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	request_t		*request = request_local_alloc_external(ctx, NULL);
+	fr_event_list_t		*el = fr_event_list_alloc(ctx, NULL, NULL);
+	BIO			*ssl_log = BIO_new(BIO_s_mem());
+	test_responder_t	*tr;
+	ocsp_fetch_t		*fetch;
+	OCSP_CERTID		*certid;
+	uint8_t			*key;
+	size_t			key_len;
+
+	tr = test_responder_alloc(ctx);
+	if (!TEST_CHECK(tr != NULL)) goto finish;
+
+	TEST_CASE("Response for a revoked certificate is fetched");
+	fetch = test_fetch(ctx, request, el, tr, tr->revoked, &certid, &key, &key_len);
+	if (!TEST_CHECK(fetch && fetch->resp)) goto finish;
+
+	TEST_CASE("Certificate is invalid");
+	TEST_CHECK(ocsp_response_check(request, &tr->conf, tr->store, fetch->req, certid,
+				       fetch->resp, ssl_log) == OCSP_STATUS_FAILED);
+
+finish:
+	BIO_free(ssl_log);
+	talloc_free(ctx);
+}
+
+static void test_ocsp_cache(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	request_t		*request = request_local_alloc_external(ctx, NULL);
+	fr_event_list_t		*el = fr_event_list_alloc(ctx, NULL, NULL);
+	fr_tls_ocsp_cache_t	*cache = fr_tls_ocsp_cache_alloc(ctx, 8);
+	BIO			*ssl_log = BIO_new(BIO_s_mem());
+	test_responder_t	*tr;
+	ocsp_fetch_t		*fetch;
+	OCSP_CERTID		*certid;
+	OCSP_RESPONSE		*resp = NULL;
+	uint8_t			*key, *revoked_key;
+	size_t			key_len, revoked_key_len;
+	OCSP_REQUEST		*req;
+	time_t			expires;
+
+	tr = test_responder_alloc(ctx);
+	if (!TEST_CHECK(tr != NULL)) goto finish;
+
+	fetch = test_fetch(ctx, request, el, tr, tr->good, &certid, &key, &key_len);
+	if (!TEST_CHECK(fetch && fetch->resp)) goto finish;
+
+	TEST_CASE("Responses with a nextUpdate time can be cached");
+	TEST_CHECK(ocsp_response_expires(&expires, fetch->req, certid, fetch->resp) == 0);
+	TEST_CHECK(expires > time(NULL));
+	ocsp_cache_insert(cache, key, key_len, fetch->resp, expires);
+
+	TEST_CASE("Cached response is found, and is valid");
+	if (!TEST_CHECK(ocsp_cache_find(&resp, cache, key, key_len) == 1)) goto finish;
+	TEST_CHECK(ocsp_response_check(request, &tr->conf, tr->store, NULL, certid, resp, ssl_log) == OCSP_STATUS_OK);
+	OCSP_RESPONSE_free(resp);
+
+	TEST_CASE("Other certificates aren't found");
+	req = ocsp_request_alloc(ctx, &revoked_key, &revoked_key_len, &certid, tr->ca, tr->revoked, false);
+	if (!TEST_CHECK(req != NULL)) goto finish;
+	TEST_CHECK(ocsp_cache_find(&resp, cache, revoked_key, revoked_key_len) == 0);
+	OCSP_REQUEST_free(req);
+
+finish:
+	BIO_free(ssl_log);
+	talloc_free(ctx);
+}
+
+static void test_ocsp_refused(void)
+{
+	TALLOC_CTX		*ctx = talloc_init_const("test");
+	request_t		*request = request_local_alloc_external(ctx, NULL);
+	fr_event_list_t		*el = fr_event_list_alloc(ctx, NULL, NULL);
+	test_responder_t	*tr;
+	ocsp_fetch_t		*fetch;
+	OCSP_CERTID		*certid;
+	uint8_t			*key;
+	size_t			key_len;
+
+	tr = test_responder_alloc(ctx);
+	if (!TEST_CHECK(tr != NULL)) goto finish;
+
+	/*
+	 *	Stop the responder, so nothing is listening
+	 */
+	kill(tr->pid, SIGTERM);
+	waitpid(tr->pid, NULL, 0);
+	tr->pid = 0;
+
+	TEST_CASE("Fetch finishes without a response when the responder is down");
+	fetch = test_fetch(ctx, request, el, tr, tr->good, &certid, &key, &key_len);
+	if (!TEST_CHECK(fetch != NULL)) goto finish;
+	TEST_CHECK(fetch->resp == NULL);
+	TEST_CHECK(fetch->error != NULL);
+
+finish:
+	talloc_free(ctx);
+}
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	fr_dict_t *test_dict;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("ocsp_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (fr_dict_internal_afrom_file(&dict_internal, FR_DICTIONARY_INTERNAL_DIR, __FILE__) < 0) goto error;
+
+	if (fr_dict_autoload(test_tls_dict) < 0) goto error;
+
+	if (fr_dict_attr_autoload(test_tls_dict_attr) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+static void test_free(void)
+{
+	request_global_free();
+	fr_dict_autofree(test_tls_dict);
+	fr_dict_free(&dict_internal, __FILE__);
+}
+
+TEST_LIST = {
+	{ "OCSP - Good certificate",		test_ocsp_good },
+	{ "OCSP - Revoked certificate",		test_ocsp_revoked },
+	{ "OCSP - Response cache",		test_ocsp_cache },
+	{ "OCSP - Responder down",		test_ocsp_refused },
+	{ NULL }
+};
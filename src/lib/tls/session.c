@@ -1428,7 +1428,7 @@ DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 	 *	asynchronously.
 	 */
 	switch (err = SSL_get_error(tls_session->ssl, tls_session->last_ret)) {
-	case SSL_ERROR_WANT_ASYNC:	/* Certification validation or cache loads */
+	case SSL_ERROR_WANT_ASYNC:	/* Certification validation, cache loads or private key operations */
 	{
 		unlang_action_t ua;
 
@@ -1470,6 +1470,24 @@ DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
 			IGNORE(unlang_function_clear(request), int);
 			goto error;
 
+		case UNLANG_ACTION_PUSHED_CHILD:
+			return ua;
+
+		default:
+			break;
+		}
+
+		/*
+		 *	Finally wait for any private key
+		 *	operations being performed by the
+		 *	crypto threads.
+		 */
+		ua = fr_tls_keyop_pending_push(request, tls_session);
+		switch (ua) {
+		case UNLANG_ACTION_FAIL:
+			IGNORE(unlang_function_clear(request), int);
+			goto error;
+
 		default:
 			return ua;
 		}
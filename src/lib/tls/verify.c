@@ -64,6 +64,12 @@ bool verify_applies(fr_tls_verify_mode_t mode, int depth, int untrusted)
 	return false;
 }
 
+#ifdef HAVE_OPENSSL_OCSP_H
+#  define TLS_VERIFY_OCSP(_conf) ((_conf)->ocsp.enable)
+#else
+#  define TLS_VERIFY_OCSP(_conf) false
+#endif
+
 DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
 DIAG_OFF(used-but-marked-unused)	/* fix spurious warnings for sk macros */
 
@@ -279,7 +285,7 @@ done:
 	 *	have been added by this point.
 	 */
 	if (my_ok && (depth == 0)) {
-		if (conf->virtual_server && tls_session->verify_client_cert) {
+		if (tls_session->verify_client_cert && (conf->virtual_server || TLS_VERIFY_OCSP(conf))) {
 			RDEBUG2("Requesting certificate validation");
 
 			/*
@@ -291,6 +297,8 @@ done:
 			 *	the unlang stack.
 			 */
 			fr_tls_verify_cert_request(tls_session, SSL_session_reused(tls_session->ssl));
+			tls_session->validate.cert = cert;
+			tls_session->validate.issuer = X509_STORE_CTX_get0_current_issuer(x509_ctx);
 
 			/*
 			 *	Jumps back to SSL_read() in session.c
@@ -481,6 +489,49 @@ static unlang_action_t tls_verify_client_cert_push(request_t *request, fr_tls_se
 	return ua;
 }
 
+#ifdef HAVE_OPENSSL_OCSP_H
+/** Process the result of the OCSP check, then call `verify certificate { ... }`
+ *
+ */
+static unlang_action_t tls_verify_client_cert_ocsp_result(rlm_rcode_t *p_result, UNUSED int *priority,
+							  request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	fr_tls_conf_t		*conf = fr_tls_session_conf(tls_session->ssl);
+
+	fr_assert(tls_session->validate.state == FR_TLS_VALIDATION_REQUESTED);
+
+	if (*p_result != RLM_MODULE_OK) {
+		REDEBUG("Certificate failed OCSP validation");
+		tls_session->validate.state = FR_TLS_VALIDATION_FAILED;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	if (!conf->virtual_server) {
+		tls_session->validate.state = FR_TLS_VALIDATION_SUCCESS;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+	}
+
+	return tls_verify_client_cert_push(request, tls_session);
+}
+
+/** Check the client certificate with an OCSP responder
+ *
+ */
+static unlang_action_t tls_verify_client_cert_ocsp(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+						   request_t *request, void *uctx)
+{
+	fr_tls_session_t	*tls_session = talloc_get_type_abort(uctx, fr_tls_session_t);
+	fr_tls_conf_t		*conf = fr_tls_session_conf(tls_session->ssl);
+
+	RDEBUG2("Checking certificate status with OCSP");
+
+	return fr_tls_ocsp_check_push(request, tls_session->ssl, conf->ocsp.store,
+				      tls_session->validate.issuer, tls_session->validate.cert,
+				      &conf->ocsp, false);
+}
+#endif
+
 /** Clear any previous validation result
  *
  * Should be called by the validation requestor to get the result and reset
@@ -500,6 +551,8 @@ bool fr_tls_verify_cert_result(fr_tls_session_t *tls_session)
 
 	tls_session->validate.state = FR_TLS_VALIDATION_INIT;
 	tls_session->validate.resumed = false;
+	tls_session->validate.cert = NULL;
+	tls_session->validate.issuer = NULL;
 
 	return result;
 }
@@ -511,6 +564,8 @@ void fr_tls_verify_cert_reset(fr_tls_session_t *tls_session)
 {
 	tls_session->validate.state = FR_TLS_VALIDATION_INIT;
 	tls_session->validate.resumed  = false;
+	tls_session->validate.cert = NULL;
+	tls_session->validate.issuer = NULL;
 }
 
 /** Setup a verification request
@@ -525,6 +580,10 @@ void fr_tls_verify_cert_request(fr_tls_session_t *tls_session, bool session_resu
 }
 
 /** Push a `verify certificate { ... }` section
+ *
+ * If OCSP is enabled, the client certificate is checked with the OCSP
+ * responder first, and `verify certificate { ... }` is only called if
+ * the certificate is valid.
  *
  * @param[in] request		The current request.
  * @Param[in] tls_session	The current TLS session.
@@ -535,6 +594,32 @@ void fr_tls_verify_cert_request(fr_tls_session_t *tls_session, bool session_resu
 unlang_action_t fr_tls_verify_cert_pending_push(request_t *request, fr_tls_session_t *tls_session)
 {
 	if (tls_session->validate.state == FR_TLS_VALIDATION_REQUESTED) {
+#ifdef HAVE_OPENSSL_OCSP_H
+		fr_tls_conf_t *conf = fr_tls_session_conf(tls_session->ssl);
+
+		/*
+		 *	Certificates from resumed sessions aren't
+		 *	available here, and were checked when the
+		 *	session was created.
+		 */
+		if (conf->ocsp.enable && tls_session->validate.cert) {
+			return unlang_function_push(request,
+						    tls_verify_client_cert_ocsp,
+						    tls_verify_client_cert_ocsp_result,
+						    NULL, 0,
+						    UNLANG_SUB_FRAME,
+						    tls_session);
+		}
+
+		/*
+		 *	Nothing to call, the certificate was
+		 *	only requested for the OCSP check.
+		 */
+		if (!conf->virtual_server) {
+			tls_session->validate.state = FR_TLS_VALIDATION_SUCCESS;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+		}
+#endif
 		return tls_verify_client_cert_push(request, tls_session);
 	}
 
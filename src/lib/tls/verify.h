@@ -64,6 +64,10 @@ typedef struct {
 							///< certificate validation.
 
 	bool				resumed;	//!< Whether we're validating a resumed session.
+
+	X509				*cert;		//!< Client certificate being validated.  Only set
+							///< while OpenSSL's verify callback is paused.
+	X509				*issuer;	//!< Issuer of the client certificate.
 } fr_tls_verify_t;
 
 #ifdef __cplusplus
@@ -3783,6 +3783,33 @@ static unlang_t *compile_load_balance_subsection(unlang_t *parent, unlang_compil
 		if (strcmp(cf_section_name1(cf_item_to_section(cf_parent(cs))), "modules") == 0) name2 = NULL;
 	}
 
+	/*
+	 *	Or a policy which chooses children using the
+	 *	statistics reported by their modules.
+	 */
+	if (name2 && (cf_section_name2_quote(cs) == T_BARE_WORD)) {
+		unlang_load_balance_policy_t policy;
+
+		policy = fr_table_value_by_str(unlang_load_balance_policy_table, name2, UNLANG_LOAD_BALANCE_RANDOM);
+		if (policy != UNLANG_LOAD_BALANCE_RANDOM) {
+			unlang_t *child;
+
+			for (child = g->children; child != NULL; child = child->next) {
+				if ((child->type != UNLANG_TYPE_MODULE) ||
+				    !unlang_generic_to_module(child)->instance->module->load_report) {
+					cf_log_err(cs, "Policy '%s' needs every entry to be a call to a module "
+						   "which reports its load, '%s' is not", name2, child->debug_name);
+					talloc_free(g);
+					return NULL;
+				}
+			}
+
+			gext = unlang_group_to_load_balance(g);
+			gext->policy = policy;
+			name2 = NULL;
+		}
+	}
+
 	if (name2) {
 		fr_token_t type;
 		ssize_t slen;
@@ -30,6 +30,138 @@
 
 #define unlang_redundant_load_balance unlang_load_balance
 
+/*
+ *	The tests call load_balance_choose() with modules which
+ *	were never instantiated, and so have no thread data.
+ */
+#ifdef TESTING_LOAD_BALANCE
+#  define load_balance_thread_data(_mi) NULL
+#else
+#  define load_balance_thread_data(_mi) module_thread(_mi)->data
+#endif
+
+fr_table_num_sorted_t const unlang_load_balance_policy_table[] = {
+	{ L("least-latency"),			UNLANG_LOAD_BALANCE_LEAST_LATENCY },
+	{ L("least-outstanding"),		UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING },
+	{ L("power-of-two-latency"),		UNLANG_LOAD_BALANCE_POWER_OF_TWO_LATENCY },
+	{ L("power-of-two-outstanding"),	UNLANG_LOAD_BALANCE_POWER_OF_TWO_OUTSTANDING }
+};
+size_t unlang_load_balance_policy_table_len = NUM_ELEMENTS(unlang_load_balance_policy_table);
+
+/** Score a child by how loaded its module is, lower is better
+ *
+ * The compiler ensures every child is a call to a module which
+ * can report its load.
+ *
+ * @param[in] request	The current request.
+ * @param[in] policy	the load-balance section uses.
+ * @param[in] child	to score.
+ * @return the score.  Children whose load isn't available score UINT64_MAX.
+ */
+static uint64_t load_balance_score(request_t *request, unlang_load_balance_policy_t policy, unlang_t *child)
+{
+	module_instance_t	*mi = unlang_generic_to_module(child)->instance;
+	module_load_t		load = { .outstanding = 0 };
+	uint64_t		latency;
+
+	if (mi->module->load_report(&load, MODULE_CTX(mi->dl_inst, load_balance_thread_data(mi), NULL, NULL)) < 0) {
+		RDEBUG3("%s - load not available", child->debug_name);
+		return UINT64_MAX;
+	}
+
+	RDEBUG3("%s - outstanding %" PRIu64 ", latency %pV", child->debug_name,
+		load.outstanding, fr_box_time_delta(load.latency));
+
+	switch (policy) {
+	case UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING:
+	case UNLANG_LOAD_BALANCE_POWER_OF_TWO_OUTSTANDING:
+		return load.outstanding;
+
+	default:
+		break;
+	}
+
+	/*
+	 *	Expected wait for one more request.  Children which
+	 *	haven't responded yet have no latency, and so are
+	 *	preferred until they do.
+	 */
+	if (!fr_time_delta_ispos(load.latency)) return 0;
+	latency = (uint64_t)fr_time_delta_unwrap(load.latency);
+
+	if (load.outstanding >= ((UINT64_MAX - 1) / latency)) return UINT64_MAX - 1;
+
+	return latency * (load.outstanding + 1);
+}
+
+/** Choose a child using the statistics reported by its module
+ *
+ * @param[in] request	The current request.
+ * @param[in] g		the load-balance section.
+ * @param[in] policy	to choose with.
+ * @return the child to start with.
+ */
+static unlang_t *load_balance_choose(request_t *request, unlang_group_t *g, unlang_load_balance_policy_t policy)
+{
+	unlang_t	*child, *found = NULL;
+	uint64_t	best = UINT64_MAX;
+	uint32_t	ties = 0;
+
+	switch (policy) {
+	case UNLANG_LOAD_BALANCE_POWER_OF_TWO_OUTSTANDING:
+	case UNLANG_LOAD_BALANCE_POWER_OF_TWO_LATENCY:
+	{
+		uint32_t	a, b, i;
+		unlang_t	*first = NULL, *second = NULL;
+
+		if (g->num_children == 1) return g->children;
+
+		/*
+		 *	Two different children, chosen at random.
+		 */
+		a = fr_rand() % g->num_children;
+		b = fr_rand() % (g->num_children - 1);
+		if (b >= a) b++;
+
+		for (child = g->children, i = 0; child != NULL; child = child->next, i++) {
+			if (i == a) first = child;
+			if (i == b) second = child;
+		}
+		fr_assert(first && second);
+
+		if (load_balance_score(request, policy, second) < load_balance_score(request, policy, first)) {
+			return second;
+		}
+		return first;
+	}
+
+	default:
+		break;
+	}
+
+	/*
+	 *	Check every child, breaking ties at random, so
+	 *	idle children share the load.
+	 */
+	for (child = g->children; child != NULL; child = child->next) {
+		uint64_t score = load_balance_score(request, policy, child);
+
+		if (!found || (score < best)) {
+			found = child;
+			best = score;
+			ties = 1;
+			continue;
+		}
+
+		if (score == best) {
+			ties++;
+			if ((fr_rand() % ties) == 0) found = child;
+		}
+	}
+
+	return found;
+}
+
 static unlang_action_t unlang_load_balance_next(rlm_rcode_t *p_result, request_t *request,
 						unlang_stack_frame_t *frame)
 {
@@ -124,7 +256,12 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 	redundant = talloc_get_type_abort(frame->state,
 					  unlang_frame_state_redundant_t);
 
-	if (gext && gext->vpt) {
+	if (gext->policy != UNLANG_LOAD_BALANCE_RANDOM) {
+		redundant->found = load_balance_choose(request, g, gext->policy);
+
+		RDEBUG3("load-balance chose %s", redundant->found->debug_name);
+
+	} else if (gext->vpt) {
 		uint32_t hash, start;
 		ssize_t slen;
 		char const *p = NULL;
@@ -198,18 +335,9 @@ static unlang_action_t unlang_load_balance(rlm_rcode_t *p_result, request_t *req
 		count = 0;
 
 		/*
-		 *	Choose a child at random.
-		 *
-		 *	@todo - leverage the "power of 2", as per
-		 *      lib/io/network.c.  This is good enough for
-		 *      most purposes.  However, in order to do this,
-		 *      we need to track active callers across
-		 *      *either* multiple modules in one thread, *or*
-		 *      across multiple threads.
-		 *
-		 *	We don't have thread-specific instance data
-		 *	for this load-balance section.  So for now,
-		 *	just pick a random child.
+		 *	Choose a child at random.  Sections with a
+		 *	policy use the statistics reported by the
+		 *	modules instead.
 		 */
 		for (redundant->child = redundant->found = g->children;
 		     redundant->child != NULL;
@@ -29,11 +29,26 @@ extern "C" {
 #include "unlang_priv.h"
 #include <freeradius-devel/server/tmpl.h>
 
+/** How a load-balance section chooses a child
+ *
+ */
+typedef enum {
+	UNLANG_LOAD_BALANCE_RANDOM = 0,				//!< Random child, or a hash of the key.
+	UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING,			//!< Child with the fewest outstanding requests.
+	UNLANG_LOAD_BALANCE_LEAST_LATENCY,			//!< Child with the lowest expected wait.
+	UNLANG_LOAD_BALANCE_POWER_OF_TWO_OUTSTANDING,		//!< Fewest outstanding requests, of two random children.
+	UNLANG_LOAD_BALANCE_POWER_OF_TWO_LATENCY		//!< Lowest expected wait, of two random children.
+} unlang_load_balance_policy_t;
+
 typedef struct {
-	unlang_group_t	group;
-	tmpl_t		*vpt;
+	unlang_group_t			group;
+	tmpl_t				*vpt;
+	unlang_load_balance_policy_t	policy;
 } unlang_load_balance_t;
 
+extern fr_table_num_sorted_t const unlang_load_balance_policy_table[];
+extern size_t unlang_load_balance_policy_table_len;
+
 /** State of a redundant operation
  *
  */
@@ -0,0 +1,294 @@
+static void test_init(void);
+static void test_free(void);
+#  define TEST_INIT  test_init()
+#  define TEST_FINI  test_free()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include "load_balance.c"
+
+#define TEST_CHILDREN	4
+#define TEST_CHOICES	1000
+
+static TALLOC_CTX	*autofree;
+
+/** What a stub module reports
+ */
+typedef struct {
+	module_load_t		load;			//!< Load to report.
+	bool			unavailable;		//!< Say the load isn't available.
+} test_load_t;
+
+/** A load-balance section, and the modules it calls
+ */
+typedef struct {
+	unlang_group_t		g;			//!< Section being balanced.
+	unlang_module_t		*child[TEST_CHILDREN];	//!< Calls to the stub modules.
+	module_instance_t	mi[TEST_CHILDREN];	//!< Stub module instances.
+	test_load_t		load[TEST_CHILDREN];	//!< What each stub reports.
+} test_section_t;
+
+/** Report whatever the test put in the instance data
+ */
+static int test_load_report(module_load_t *out, module_ctx_t const *mctx)
+{
+	test_load_t const *tl = mctx->inst->data;
+
+	if (tl->unavailable) return -1;
+
+	*out = tl->load;
+
+	return 0;
+}
+
+static module_t const test_module = {
+	.name		= "test_load",
+	.load_report	= test_load_report
+};
+
+static test_section_t *test_section_alloc(TALLOC_CTX *ctx, size_t num)
+{
+	test_section_t		*ts;
+	unlang_t		**tail;
+	size_t			i;
+
+	MEM(ts = talloc_zero(ctx, test_section_t));
+
+	tail = &ts->g.children;
+	for (i = 0; i < num; i++) {
+		MEM(ts->mi[i].dl_inst = talloc(ts, dl_module_inst_t));
+		memcpy(ts->mi[i].dl_inst, &(dl_module_inst_t){ .name = "test_load", .data = &ts->load[i] },
+		       sizeof(*ts->mi[i].dl_inst));
+		ts->mi[i].name = ts->mi[i].dl_inst->name;
+		ts->mi[i].module = &test_module;
+
+		MEM(ts->child[i] = talloc_zero(ts, unlang_module_t));
+		ts->child[i]->self.type = UNLANG_TYPE_MODULE;
+		ts->child[i]->self.name = ts->child[i]->self.debug_name = talloc_asprintf(ts->child[i], "test_load%zu", i);
+		ts->child[i]->instance = &ts->mi[i];
+
+		*tail = &ts->child[i]->self;
+		tail = &ts->child[i]->self.next;
+		ts->g.num_children++;
+	}
+
+	return ts;
+}
+
+/** Choose a child repeatedly, recording how often each one was picked
+ */
+static void test_choose(request_t *request, test_section_t *ts, unlang_load_balance_policy_t policy,
+			uint32_t chosen[static TEST_CHILDREN])
+{
+	size_t		i, j;
+	unlang_t	*found;
+
+	memset(chosen, 0, sizeof(uint32_t) * TEST_CHILDREN);
+
+	for (i = 0; i < TEST_CHOICES; i++) {
+		found = load_balance_choose(request, &ts->g, policy);
+		if (!TEST_CHECK(found != NULL)) return;
+
+		for (j = 0; j < (size_t)ts->g.num_children; j++) {
+			if (found == &ts->child[j]->self) break;
+		}
+		if (!TEST_CHECK(j < (size_t)ts->g.num_children)) return;
+
+		chosen[j]++;
+	}
+}
+
+static void test_least_outstanding(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	request_t	*request = request_local_alloc_external(ctx, NULL);
+	test_section_t	*ts = test_section_alloc(ctx, TEST_CHILDREN);
+	uint32_t	chosen[TEST_CHILDREN];
+
+	ts->load[0].load.outstanding = 5;
+	ts->load[1].load.outstanding = 1;
+	ts->load[2].load.outstanding = 3;
+	ts->load[3].load.outstanding = 2;
+
+	TEST_CASE("Least loaded child is always chosen");
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING, chosen);
+	TEST_CHECK_LEN(chosen[1], TEST_CHOICES);
+
+	TEST_CASE("Latency is ignored");
+	ts->load[1].load.latency = fr_time_delta_from_sec(10);
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING, chosen);
+	TEST_CHECK_LEN(chosen[1], TEST_CHOICES);
+
+	TEST_CASE("Ties are shared");
+	ts->load[3].load.outstanding = 1;
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING, chosen);
+	TEST_CHECK_LEN(chosen[0], 0);
+	TEST_CHECK_LEN(chosen[2], 0);
+	TEST_CHECK(chosen[1] > 0);
+	TEST_CHECK(chosen[3] > 0);
+	TEST_CHECK_LEN(chosen[1] + chosen[3], TEST_CHOICES);
+
+	TEST_CASE("Children whose load isn't available are avoided");
+	ts->load[1].unavailable = true;
+	ts->load[3].unavailable = true;
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING, chosen);
+	TEST_CHECK_LEN(chosen[2], TEST_CHOICES);
+
+	talloc_free(ctx);
+}
+
+static void test_least_latency(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	request_t	*request = request_local_alloc_external(ctx, NULL);
+	test_section_t	*ts = test_section_alloc(ctx, 3);
+	uint32_t	chosen[TEST_CHILDREN];
+
+	ts->load[0].load.outstanding = 0;
+	ts->load[0].load.latency = fr_time_delta_from_msec(10);
+	ts->load[1].load.outstanding = 5;
+	ts->load[1].load.latency = fr_time_delta_from_msec(1);
+	ts->load[2].load.outstanding = 1;
+	ts->load[2].load.latency = fr_time_delta_from_msec(4);
+
+	TEST_CASE("Lowest expected wait is chosen");
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_LATENCY, chosen);
+	TEST_CHECK_LEN(chosen[1], TEST_CHOICES);
+
+	TEST_CASE("Children with no latency yet are preferred");
+	ts->load[2].load.latency = fr_time_delta_wrap(0);
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_LATENCY, chosen);
+	TEST_CHECK_LEN(chosen[2], TEST_CHOICES);
+
+	talloc_free(ctx);
+}
+
+static void test_power_of_two(void)
+{
+	TALLOC_CTX	*ctx = talloc_init_const("test");
+	request_t	*request = request_local_alloc_external(ctx, NULL);
+	test_section_t	*ts = test_section_alloc(ctx, TEST_CHILDREN);
+	uint32_t	chosen[TEST_CHILDREN];
+	size_t		i;
+
+	for (i = 0; i < TEST_CHILDREN; i++) ts->load[i].load.outstanding = i;
+
+	/*
+	 *	Every pair includes a child less loaded than the
+	 *	most loaded one, so it's never chosen.  Everything
+	 *	else wins at least one pairing.
+	 */
+	TEST_CASE("Most loaded child is never chosen by outstanding");
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_POWER_OF_TWO_OUTSTANDING, chosen);
+	TEST_CHECK_LEN(chosen[TEST_CHILDREN - 1], 0);
+	for (i = 0; i < (TEST_CHILDREN - 1); i++) {
+		TEST_CHECK(chosen[i] > 0);
+		TEST_MSG("child %zu never chosen", i);
+	}
+
+	/*
+	 *	The least loaded child is in half the pairings
+	 *	and wins all of them.
+	 */
+	TEST_CHECK(chosen[0] > chosen[1]);
+	TEST_CHECK(chosen[1] > chosen[2]);
+
+	TEST_CASE("Most loaded child is never chosen by latency");
+	for (i = 0; i < TEST_CHILDREN; i++) {
+		ts->load[i].load.outstanding = 0;
+		ts->load[i].load.latency = fr_time_delta_from_msec(TEST_CHILDREN - i);
+	}
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_POWER_OF_TWO_LATENCY, chosen);
+	TEST_CHECK_LEN(chosen[0], 0);
+	for (i = 1; i < TEST_CHILDREN; i++) {
+		TEST_CHECK(chosen[i] > 0);
+		TEST_MSG("child %zu never chosen", i);
+	}
+
+	talloc_free(ctx);
+
+	TEST_CASE("A single child is always chosen");
+	ctx = talloc_init_const("test");
+	request = request_local_alloc_external(ctx, NULL);
+	ts = test_section_alloc(ctx, 1);
+	ts->load[0].unavailable = true;
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_POWER_OF_TWO_OUTSTANDING, chosen);
+	TEST_CHECK_LEN(chosen[0], TEST_CHOICES);
+
+	talloc_free(ctx);
+}
+
+/** Children with no load available, e.g. with no active connections, are skipped by every policy
+ */
+static void test_unavailable(void)
+{
+	TALLOC_CTX			*ctx = talloc_init_const("test");
+	request_t			*request = request_local_alloc_external(ctx, NULL);
+	test_section_t			*ts = test_section_alloc(ctx, TEST_CHILDREN);
+	uint32_t			chosen[TEST_CHILDREN];
+	unlang_load_balance_policy_t	policy;
+	size_t				i;
+
+	/*
+	 *	Child 0 looks idle, but has nothing to send on.
+	 */
+	for (i = 0; i < TEST_CHILDREN; i++) {
+		ts->load[i].load.outstanding = i + 1;
+		ts->load[i].load.latency = fr_time_delta_from_msec(i + 1);
+	}
+	ts->load[0].load.outstanding = 0;
+	ts->load[0].unavailable = true;
+
+	for (policy = UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING;
+	     policy <= UNLANG_LOAD_BALANCE_POWER_OF_TWO_LATENCY;
+	     policy++) {
+		TEST_CASE(fr_table_str_by_value(unlang_load_balance_policy_table, policy, "<INVALID>"));
+		test_choose(request, ts, policy, chosen);
+		TEST_CHECK_LEN(chosen[0], 0);
+		TEST_CHECK(chosen[1] > 0);
+		TEST_MSG("least loaded available child never chosen");
+	}
+
+	TEST_CASE("A child is still chosen when none are available");
+	for (i = 0; i < TEST_CHILDREN; i++) ts->load[i].unavailable = true;
+	test_choose(request, ts, UNLANG_LOAD_BALANCE_LEAST_OUTSTANDING, chosen);
+	for (i = 0; i < TEST_CHILDREN; i++) {
+		TEST_CHECK(chosen[i] > 0);
+		TEST_MSG("child %zu never chosen", i);
+	}
+
+	talloc_free(ctx);
+}
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	fr_dict_t *test_dict;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("load_balance_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+static void test_free(void)
+{
+	request_global_free();
+}
+
+TEST_LIST = {
+	{ "Load balance - Least outstanding",	test_least_outstanding },
+	{ "Load balance - Least latency",	test_least_latency },
+	{ "Load balance - Power of two",	test_power_of_two },
+	{ "Load balance - Unavailable",		test_unavailable },
+	{ NULL }
+};
@@ -0,0 +1,10 @@
+TARGET		:= load_balance_tests$(E)
+SOURCES		:= load_balance_tests.c
+
+TGT_LDLIBS	:= $(LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS)
+
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L)
+SRC_CFLAGS	+= -DTESTING_LOAD_BALANCE
+
+TGT_INSTALLDIR	:=
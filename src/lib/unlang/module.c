@@ -674,6 +674,12 @@ static unlang_action_t unlang_module_done(rlm_rcode_t *p_result, request_t *requ
 	*p_result = rcode;
 	request->module = state->previous_module;
 
+	if (fr_time_ispos(state->start)) {
+		fr_metric_observe(unlang_generic_to_module(frame->instruction)->instance->call_time,
+				  fr_time_sub(fr_time(), state->start));
+		state->start = fr_time_wrap(0);
+	}
+
 	return UNLANG_ACTION_CALCULATE_RESULT;
 }
 
@@ -952,6 +958,8 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request,
 	 */
 	if (fr_time_delta_ispos(frame->instruction->actions.retry.irt)) now = fr_time();
 
+	if (mc->instance->call_time) state->start = fr_time_ispos(now) ? now : fr_time();
+
 	request->module = mc->instance->name;
 	safe_lock(mc->instance);	/* Noop unless instance->mutex set */
 	ua = mc->method(&state->rcode,
@@ -53,6 +53,8 @@ typedef struct {
 	call_env_result_t		env_result;		//!< Result of the previous call environment expansion.
 	void				*env_data;		//!< Expanded per call "call environment" tmpls.
 
+	fr_time_t			start;			//!< When the module was called, for metrics.
+
 #ifndef NDEBUG
 	int				unlang_indent;		//!< Record what this was when we entered the module.
 #endif
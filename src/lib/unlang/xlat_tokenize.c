@@ -278,6 +278,14 @@ int xlat_validate_function_args(xlat_exp_t *node)
 	return 0;
 }
 
+/** Whether a function needs instance data for each thread it's called from
+ *
+ */
+static inline CC_HINT(always_inline) bool xlat_func_needs_thread(xlat_t const *func)
+{
+	return func->mctx || func->thread_instantiate || func->thread_inst_size;
+}
+
 /** Parse an xlat function and its child arguments
  *
  * Parses a function call string in the format
@@ -327,6 +335,12 @@ int xlat_tokenize_function_args(xlat_exp_head_t *head, fr_sbuff_t *in, tmpl_rule
 		xlat_exp_set_type(node, XLAT_FUNC_UNRESOLVED);
 		node->flags.needs_resolving = true;	/* Needs resolution during pass2 */
 	} else {
+		if (t_rules && t_rules->xlat.disallow_thread_funcs && xlat_func_needs_thread(func)) {
+			fr_strerror_printf("Expansion function '%s' needs per-thread data, and is not allowed here",
+					   func->name);
+			goto error;
+		}
+
 		if (func->input_type != XLAT_INPUT_ARGS) {
 			fr_strerror_const("Function should be called using %{func:arg} syntax");
 		error:
@@ -489,6 +503,14 @@ static int xlat_tokenize_function_new(xlat_exp_head_t *head, fr_sbuff_t *in, tmp
 		xlat_exp_set_type(node, XLAT_FUNC_UNRESOLVED);
 		node->flags.needs_resolving = true;	/* Needs resolution during pass2 */
 	} else {
+		if (t_rules && t_rules->xlat.disallow_thread_funcs && xlat_func_needs_thread(func)) {
+			fr_strerror_printf("Expansion function '%s' needs per-thread data, and is not allowed here",
+					   func->name);
+			talloc_free(node);
+			fr_sbuff_set(in, &m_s);		/* backtrack */
+			fr_sbuff_marker_release(&m_s);
+			return -1;
+		}
 		node->call.func = func;
 		if (t_rules) node->call.dict = t_rules->attr.dict_def;
 		node->flags = func->flags;
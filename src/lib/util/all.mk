@@ -8,7 +8,10 @@ SUBMAKEFILES := \
 	heap_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
+	log_async_tests.mk \
+	lpm_tests.mk \
 	lst_tests.mk \
+	metrics_tests.mk \
 	minmax_heap_tests.mk \
 	pair_legacy_tests.mk \
 	pair_list_perf_test.mk \
@@ -23,6 +23,7 @@
  */
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/log_async.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 
@@ -953,6 +954,12 @@ NEVER_RETURNS void fr_fault(int sig)
 	 */
 	memset(cmd, 0, sizeof(cmd));
 
+	/*
+	 *	Get the messages leading up to the fault
+	 *	into the log before we add our own.
+	 */
+	fr_log_async_fault_flush();
+
 	FR_FAULT_LOG("CAUGHT SIGNAL: %s", strsignal(sig));
 
 	/*
@@ -50,9 +50,12 @@ SOURCES		:= \
 		   iovec.c \
 		   isaac.c \
 		   log.c \
+		   log_async.c \
+		   lpm.c \
 		   lst.c \
 		   machine.c \
 		   md4.c \
+		   metrics.c \
 		   md5.c \
 		   minmax_heap.c \
 		   misc.c \
@@ -24,6 +24,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/log.h>
+#include <freeradius-devel/util/log_async.h>
 #include <freeradius-devel/util/print.h>
 #include <freeradius-devel/util/sbuff.h>
 #include <freeradius-devel/util/syserror.h>
@@ -572,8 +573,10 @@ void fr_vlog(fr_log_t const *log, fr_log_type_t type, char const *file, int line
 				 	 colourise ? VTC_RESET : "");
 
 		len = talloc_array_length(buffer) - 1;
+		if (log->async && (fr_log_async_write(log->fd, buffer, len) == 0)) break;
+
 		wrote = write(log->fd, buffer, len);
-		if (wrote < len) return;
+		if (wrote < len) break;
 	}
 		break;
 
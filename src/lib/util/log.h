@@ -105,6 +105,8 @@ typedef struct {
 
 	bool			suppress_secrets; //!< suppress secrets when printing to this destination
 
+	bool			async;		//!< Hand messages to the async log writer, if it's running.
+
 	fr_log_timestamp_t	timestamp;	//!< Prefix log messages with timestamps.
 
 	int			fd;		//!< File descriptor to write messages to.
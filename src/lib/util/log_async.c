@@ -0,0 +1,736 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Asynchronous log writer
+ *
+ * Moves the write() of formatted log messages off the threads which
+ * produce them.  Each thread copies its messages into its own single
+ * producer, single consumer ring buffer.  A dedicated writer thread
+ * drains all the rings, and writes runs of messages destined for the
+ * same file descriptor with a single writev().
+ *
+ * Messages from one thread are written in the order they were logged.
+ * There is no ordering between messages from different threads.
+ *
+ * When a ring is full, the message is either discarded and counted, or
+ * the producing thread waits for the writer to make space, depending on
+ * the overflow policy passed to #fr_log_async_start.
+ *
+ * @file src/lib/util/log_async.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/log_async.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
+
+fr_table_num_sorted_t const fr_log_async_overflow_table[] = {
+	{ L("block"),	FR_LOG_ASYNC_OVERFLOW_BLOCK	},
+	{ L("drop"),	FR_LOG_ASYNC_OVERFLOW_DROP	}
+};
+size_t fr_log_async_overflow_table_len = NUM_ELEMENTS(fr_log_async_overflow_table);
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+
+#define LOG_ASYNC_RING_MIN	(4096)			//!< Smallest ring we'll allocate.
+#define LOG_ASYNC_IOV_MAX	(64)			//!< Most messages passed to a single writev().
+#define LOG_ASYNC_WRAP		UINT32_MAX		//!< Record length marking the rest of the ring as unused.
+#define LOG_ASYNC_IDLE_USEC	(100000)		//!< How long the writer sleeps when there's nothing to do.
+#define LOG_ASYNC_WAIT_USEC	(100)			//!< How long a blocked producer waits before checking again.
+
+/** Header preceding every message in a ring
+ *
+ * Records are padded to a multiple of the header size, so headers
+ * are always aligned, and there's always space for a wrap marker at
+ * the end of the ring.
+ */
+typedef struct {
+	uint32_t		len;			//!< Of the message, or #LOG_ASYNC_WRAP.
+	int32_t			fd;			//!< To write the message to.
+} log_async_hdr_t;
+
+#define LOG_ASYNC_RECORD_SIZE(_len) (sizeof(log_async_hdr_t) + ROUND_UP((_len), sizeof(log_async_hdr_t)))
+
+typedef struct log_async_ring_s log_async_ring_t;
+
+/** A single thread's messages, waiting to be written
+ *
+ * head and tail are byte positions which only ever increase.  The offset
+ * into the ring is the position masked by the ring size.
+ */
+struct log_async_ring_s {
+	_Atomic(uint64_t)	head;			//!< Next byte the producer will write.  Only the
+							///< producer modifies this.
+	_Atomic(uint64_t)	tail;			//!< Next byte the writer will read.  Only the writer
+							///< modifies this.
+
+	size_t			size;			//!< Of the ring, always a power of 2.
+	size_t			max_msg;		//!< Largest message we accept, anything larger is
+							///< written synchronously by the caller.
+
+	bool			orphaned;		//!< The producing thread has exited.  Protected by
+							///< log_async.rings_mutex.
+	uint64_t		id;			//!< Unique, and increasing in the order rings are
+							///< created, so the list is in descending id order.
+
+	log_async_ring_t	*next;			//!< Next ring in the list.
+	uint8_t			*data;
+};
+
+/** State of the writer
+ *
+ */
+static struct {
+	_Atomic(log_async_ring_t *)	rings;		//!< All rings.  Inserted at the head by producers
+							///< holding rings_mutex, walked without the mutex
+							///< by the writer.
+	pthread_mutex_t			rings_mutex;	//!< Serialises changes to the ring list.
+
+	pthread_mutex_t			mutex;		//!< Protects the condition variable.
+	pthread_cond_t			cond;		//!< Signalled to wake the writer.
+	atomic_bool			sleeping;	//!< The writer is about to wait, or waiting, on cond.
+
+	atomic_flag			consuming;	//!< Held by whoever is draining the rings.
+
+	atomic_bool			running;	//!< Whether new messages are accepted.
+	atomic_bool			stop;		//!< Tells the writer to exit, once the rings are empty.
+	bool				managed;	//!< Writer owns the rings, so exiting threads only
+							///< mark them orphaned.  Protected by rings_mutex.
+	uint64_t			next_id;	//!< For new rings.  Protected by rings_mutex.
+
+	size_t				ring_size;	//!< For new rings.
+	fr_log_async_overflow_t		overflow;	//!< What to do when a ring is full.
+
+	_Atomic(uint64_t)		dropped;	//!< Messages discarded because their ring was full.
+	uint64_t			reported;	//!< Drops we've already told the admin about.
+	atomic_int			drop_fd;	//!< Where the last discarded message should have gone.
+
+	pthread_t			thread;
+} log_async = {
+	.rings_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.consuming = ATOMIC_FLAG_INIT,
+	.drop_fd = -1
+};
+
+static _Thread_local log_async_ring_t *log_ring;
+
+static void log_async_ring_unlink(log_async_ring_t *ring)
+{
+	log_async_ring_t	*prev = NULL, *p;
+
+	for (p = atomic_load(&log_async.rings); p; prev = p, p = p->next) {
+		if (p != ring) continue;
+
+		if (!prev) {
+			atomic_store(&log_async.rings, ring->next);
+		} else {
+			prev->next = ring->next;
+		}
+		break;
+	}
+}
+
+/** Called when the thread which owns a ring exits
+ *
+ * If the writer is running, it may still be draining the ring, so leave
+ * it for the writer to free.  Otherwise free it here.
+ */
+static int _log_async_ring_orphan(void *uctx)
+{
+	log_async_ring_t *ring = talloc_get_type_abort(uctx, log_async_ring_t);
+
+	pthread_mutex_lock(&log_async.rings_mutex);
+	if (log_async.managed) {
+		ring->orphaned = true;
+		ring = NULL;
+	} else {
+		log_async_ring_unlink(ring);
+	}
+	pthread_mutex_unlock(&log_async.rings_mutex);
+
+	log_ring = NULL;
+
+	return talloc_free(ring);
+}
+
+/** Allocate a ring for the current thread, and add it to the list the writer drains
+ *
+ */
+static log_async_ring_t *log_async_ring_alloc(void)
+{
+	log_async_ring_t	*ring;
+
+	if (fr_atexit_is_exiting()) return NULL;	/* No new rings if we're exiting */
+
+	ring = talloc_zero(NULL, log_async_ring_t);
+	if (unlikely(!ring)) return NULL;
+
+	ring->size = log_async.ring_size;
+	ring->max_msg = (ring->size / 2) - sizeof(log_async_hdr_t);
+	ring->data = talloc_array(ring, uint8_t, ring->size);
+	if (unlikely(!ring->data)) {
+		talloc_free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&log_async.rings_mutex);
+	ring->id = log_async.next_id++;
+	ring->next = atomic_load(&log_async.rings);
+	atomic_store(&log_async.rings, ring);
+	pthread_mutex_unlock(&log_async.rings_mutex);
+
+	fr_atexit_thread_local(log_ring, _log_async_ring_orphan, ring);
+
+	return ring;
+}
+
+static void log_async_wake(void)
+{
+	pthread_mutex_lock(&log_async.mutex);
+	pthread_cond_signal(&log_async.cond);
+	pthread_mutex_unlock(&log_async.mutex);
+}
+
+/** Wait for the writer to drain the calling thread's ring
+ *
+ * Only the thread which owns the ring may call this, as the ring
+ * can't be freed while its owner is alive.
+ */
+static void log_async_ring_wait(log_async_ring_t *ring)
+{
+	uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	while (atomic_load_explicit(&ring->tail, memory_order_acquire) != head) {
+		log_async_wake();
+		usleep(LOG_ASYNC_WAIT_USEC);
+	}
+}
+
+/** Write a batch of messages, dealing with short writes
+ *
+ * There's nowhere to report errors to, so messages which can't be
+ * written are discarded.
+ */
+static void log_async_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0) {
+		ssize_t slen;
+
+		slen = writev(fd, iov, iovcnt);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+		if (slen == 0) return;
+
+		while ((iovcnt > 0) && ((size_t)slen >= iov->iov_len)) {
+			slen -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = (uint8_t *)iov->iov_base + slen;
+			iov->iov_len -= slen;
+		}
+	}
+}
+
+/** Write out everything currently in a ring
+ *
+ * @param[in] ring	to drain.
+ * @return the number of messages written.
+ */
+static size_t log_async_ring_drain(log_async_ring_t *ring)
+{
+	uint64_t	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint64_t	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t		mask = ring->size - 1;
+	size_t		count = 0;
+
+	while (tail != head) {
+		struct iovec	iov[LOG_ASYNC_IOV_MAX];
+		int		iovcnt = 0;
+		int		fd = -1;
+
+		/*
+		 *	Gather a run of messages for the same fd
+		 */
+		while ((tail != head) && (iovcnt < LOG_ASYNC_IOV_MAX)) {
+			log_async_hdr_t *hdr = (log_async_hdr_t *)(ring->data + (tail & mask));
+
+			if (hdr->len == LOG_ASYNC_WRAP) {
+				tail += ring->size - (tail & mask);
+				continue;
+			}
+
+			if (iovcnt && (hdr->fd != fd)) break;
+
+			fd = hdr->fd;
+			iov[iovcnt].iov_base = (uint8_t *)(hdr + 1);
+			iov[iovcnt].iov_len = hdr->len;
+			iovcnt++;
+
+			tail += LOG_ASYNC_RECORD_SIZE(hdr->len);
+		}
+
+		if (iovcnt > 0) log_async_writev(fd, iov, iovcnt);
+		count += iovcnt;
+
+		/*
+		 *	Only release the space once the messages
+		 *	have been written, so flushes can rely on
+		 *	head == tail meaning the ring is on disk.
+		 */
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	return count;
+}
+
+/** Drain all rings
+ *
+ * The caller must hold log_async.consuming.
+ *
+ * @param[in] reap	free rings whose threads have exited.
+ * @return the number of messages written.
+ */
+static size_t log_async_drain(bool reap)
+{
+	log_async_ring_t	*ring, *next;
+	size_t			count = 0;
+
+	for (ring = atomic_load(&log_async.rings); ring; ring = next) {
+		next = ring->next;
+
+		count += log_async_ring_drain(ring);
+
+		if (!reap) continue;
+
+		pthread_mutex_lock(&log_async.rings_mutex);
+		if (ring->orphaned && (atomic_load(&ring->head) == atomic_load(&ring->tail))) {
+			log_async_ring_unlink(ring);
+			talloc_free(ring);
+		}
+		pthread_mutex_unlock(&log_async.rings_mutex);
+	}
+
+	return count;
+}
+
+/** Tell the admin that messages were discarded
+ *
+ * The caller must hold log_async.consuming.
+ *
+ * drop_fd is -1 once #fr_log_async_flush has been called for it, as
+ * the caller may since have closed it.  The drops are then reported
+ * alongside the next ones which have somewhere to go.
+ */
+static void log_async_report_dropped(void)
+{
+	uint64_t	dropped = atomic_load(&log_async.dropped);
+	int		fd = atomic_load(&log_async.drop_fd);
+	char		buffer[64];
+	int		len;
+
+	if ((dropped == log_async.reported) || (fd < 0)) return;
+
+	len = snprintf(buffer, sizeof(buffer), "Dropped %" PRIu64 " log messages, buffer full\n",
+		       dropped - log_async.reported);
+	log_async.reported = dropped;
+
+	if (write(fd, buffer, (size_t)len) < 0) { /* nothing we can do */ }
+}
+
+/** Whether any ring has messages waiting
+ *
+ */
+static bool log_async_pending(void)
+{
+	log_async_ring_t *ring;
+
+	for (ring = atomic_load(&log_async.rings); ring; ring = ring->next) {
+		if (atomic_load(&ring->head) != atomic_load(&ring->tail)) return true;
+	}
+
+	return false;
+}
+
+static void *log_async_thread(UNUSED void *arg)
+{
+	for (;;) {
+		size_t count;
+
+		while (atomic_flag_test_and_set(&log_async.consuming)) sched_yield();
+		count = log_async_drain(true);
+		log_async_report_dropped();
+		atomic_flag_clear(&log_async.consuming);
+
+		if (count > 0) continue;
+
+		if (atomic_load(&log_async.stop)) break;
+
+		/*
+		 *	Producers store head, then check sleeping.  We
+		 *	store sleeping, then check head.  One side or the
+		 *	other is guaranteed to see the other's store, so
+		 *	we can't sleep on a message which was missed.
+		 */
+		pthread_mutex_lock(&log_async.mutex);
+		atomic_store(&log_async.sleeping, true);
+		if (!log_async_pending() && !atomic_load(&log_async.stop)) {
+			struct timespec ts;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += LOG_ASYNC_IDLE_USEC * 1000;
+			if (ts.tv_nsec >= NSEC) {
+				ts.tv_sec++;
+				ts.tv_nsec -= NSEC;
+			}
+			pthread_cond_timedwait(&log_async.cond, &log_async.mutex, &ts);
+		}
+		atomic_store(&log_async.sleeping, false);
+		pthread_mutex_unlock(&log_async.mutex);
+	}
+
+	return NULL;
+}
+
+/** Start the log writer thread
+ *
+ * Must be called after any fork(), as the writer thread won't survive it.
+ *
+ * @param[in] ring_size		Bytes of buffer space for each thread.  Rounded up to a power of 2.
+ * @param[in] overflow		What to do when a thread's buffer is full.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_log_async_start(size_t ring_size, fr_log_async_overflow_t overflow)
+{
+	int ret;
+
+	if (atomic_load(&log_async.running)) {
+		fr_strerror_const("Async log writer already running");
+		return -1;
+	}
+
+	if (ring_size < LOG_ASYNC_RING_MIN) ring_size = LOG_ASYNC_RING_MIN;
+	if (ring_size > (UINT32_MAX / 2)) {
+		fr_strerror_const("Async log buffer size must be less than 2G");
+		return -1;
+	}
+
+	log_async.ring_size = (size_t)1 << fr_high_bit_pos(ring_size - 1);
+	log_async.overflow = overflow;
+	atomic_store(&log_async.stop, false);
+
+	pthread_mutex_lock(&log_async.rings_mutex);
+	log_async.managed = true;
+	pthread_mutex_unlock(&log_async.rings_mutex);
+
+	ret = pthread_create(&log_async.thread, NULL, log_async_thread, NULL);
+	if (ret != 0) {
+		pthread_mutex_lock(&log_async.rings_mutex);
+		log_async.managed = false;
+		pthread_mutex_unlock(&log_async.rings_mutex);
+
+		fr_strerror_printf("Failed creating async log writer thread: %s", fr_syserror(ret));
+		return -1;
+	}
+
+	atomic_store(&log_async.running, true);
+
+	return 0;
+}
+
+/** Whether messages are currently being written asynchronously
+ *
+ */
+bool fr_log_async_running(void)
+{
+	return atomic_load_explicit(&log_async.running, memory_order_relaxed);
+}
+
+/** Queue a formatted message for the writer thread
+ *
+ * @param[in] fd	to write the message to.
+ * @param[in] buffer	containing the message.
+ * @param[in] len	of the message.
+ * @return
+ *	- 0 if the message was queued, or discarded because the buffer was full.
+ *	- -1 if the caller should write the message itself.
+ */
+int fr_log_async_write(int fd, char const *buffer, size_t len)
+{
+	log_async_ring_t	*ring;
+	uint64_t		head;
+	size_t			mask, to_end, need;
+
+	if (!atomic_load_explicit(&log_async.running, memory_order_acquire)) return -1;
+
+	ring = log_ring;
+	if (unlikely(!ring)) {
+		ring = log_async_ring_alloc();
+		if (!ring) return -1;
+	}
+
+	/*
+	 *	The caller writes oversized messages itself, so
+	 *	let the writer catch up first, or this message
+	 *	would overtake the ones already queued.
+	 */
+	if (len > ring->max_msg) {
+		log_async_ring_wait(ring);
+		return -1;
+	}
+
+	mask = ring->size - 1;
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	to_end = ring->size - (head & mask);
+
+	need = LOG_ASYNC_RECORD_SIZE(len);
+	if (need > to_end) need += to_end;	/* Skip the unusable space at the end of the ring */
+
+	while ((ring->size - (head - atomic_load_explicit(&ring->tail, memory_order_acquire))) < need) {
+		if (log_async.overflow == FR_LOG_ASYNC_OVERFLOW_DROP) {
+			atomic_store_explicit(&log_async.drop_fd, fd, memory_order_relaxed);
+			atomic_fetch_add_explicit(&log_async.dropped, 1, memory_order_relaxed);
+			return 0;
+		}
+
+		if (!atomic_load(&log_async.running)) return -1;
+
+		log_async_wake();
+		usleep(LOG_ASYNC_WAIT_USEC);
+	}
+
+	if (LOG_ASYNC_RECORD_SIZE(len) > to_end) {
+		((log_async_hdr_t *)(ring->data + (head & mask)))->len = LOG_ASYNC_WRAP;
+		head += to_end;
+	}
+
+	{
+		log_async_hdr_t *hdr = (log_async_hdr_t *)(ring->data + (head & mask));
+
+		hdr->len = (uint32_t)len;
+		hdr->fd = fd;
+		memcpy(hdr + 1, buffer, len);
+	}
+
+	atomic_store(&ring->head, head + LOG_ASYNC_RECORD_SIZE(len));
+
+	if (atomic_load(&log_async.sleeping)) log_async_wake();
+
+	return 0;
+}
+
+/** Position of a ring's head when a flush started
+ *
+ */
+typedef struct {
+	uint64_t		id;			//!< Of the ring.
+	uint64_t		head;			//!< What the ring's tail must reach.
+} log_async_mark_t;
+
+/** Whether the writer has reached all the marks
+ *
+ * Both the ring list and the marks are in descending id order.  Rings
+ * without a mark were created after the flush started, and marks
+ * without a ring belong to rings which were drained and freed.
+ */
+static bool log_async_marks_reached(log_async_mark_t const *marks, size_t count)
+{
+	log_async_ring_t	*ring;
+	size_t			i = 0;
+	bool			reached = true;
+
+	pthread_mutex_lock(&log_async.rings_mutex);
+	for (ring = atomic_load(&log_async.rings); ring && (i < count); ring = ring->next) {
+		while ((i < count) && (marks[i].id > ring->id)) i++;
+		if ((i == count) || (marks[i].id != ring->id)) continue;
+
+		if (atomic_load_explicit(&ring->tail, memory_order_acquire) < marks[i].head) {
+			reached = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&log_async.rings_mutex);
+
+	return reached;
+}
+
+/** Wait until every message queued so far has been written
+ *
+ * Should be called before closing a file descriptor messages may
+ * have been queued for.  Messages queued after the call starts aren't
+ * waited for, so busy producers can't hold up the caller indefinitely.
+ *
+ * Discarded messages are reported before returning, and aren't
+ * reported to the previous file descriptor again.
+ */
+void fr_log_async_flush(void)
+{
+	log_async_ring_t	*ring;
+	log_async_mark_t	*marks;
+	size_t			i, count = 0;
+	int			fd;
+
+	if (!atomic_load(&log_async.running)) return;
+
+	pthread_mutex_lock(&log_async.rings_mutex);
+	for (ring = atomic_load(&log_async.rings); ring; ring = ring->next) count++;
+
+	marks = talloc_array(NULL, log_async_mark_t, count);
+	if (unlikely(!marks)) {
+		pthread_mutex_unlock(&log_async.rings_mutex);
+		return;
+	}
+
+	for (ring = atomic_load(&log_async.rings), i = 0; ring; ring = ring->next, i++) {
+		marks[i] = (log_async_mark_t){
+			.id = ring->id,
+			.head = atomic_load_explicit(&ring->head, memory_order_acquire)
+		};
+	}
+	pthread_mutex_unlock(&log_async.rings_mutex);
+
+	while (!log_async_marks_reached(marks, count)) {
+		log_async_wake();
+		usleep(LOG_ASYNC_WAIT_USEC);
+	}
+	talloc_free(marks);
+
+	while (atomic_flag_test_and_set(&log_async.consuming)) sched_yield();
+	fd = atomic_load(&log_async.drop_fd);
+	log_async_report_dropped();
+	atomic_compare_exchange_strong(&log_async.drop_fd, &fd, -1);
+	atomic_flag_clear(&log_async.consuming);
+}
+
+/** Write out whatever is queued, from a fatal signal handler
+ *
+ * If the writer is in the middle of draining the rings, give it a
+ * little time to finish.  If it doesn't, assume it's the writer which
+ * faulted, and give up, as the rings may be inconsistent.
+ */
+void fr_log_async_fault_flush(void)
+{
+	int i;
+
+	if (!atomic_load(&log_async.running)) return;
+
+	for (i = 0; i < 100; i++) {
+		if (!atomic_flag_test_and_set(&log_async.consuming)) {
+			log_async_drain(false);
+			atomic_flag_clear(&log_async.consuming);
+			return;
+		}
+		usleep(1000);
+	}
+}
+
+/** Number of messages discarded because a buffer was full
+ *
+ */
+uint64_t fr_log_async_dropped(void)
+{
+	return atomic_load(&log_async.dropped);
+}
+
+/** Flush all queued messages, and stop the writer thread
+ *
+ * Threads logging after this point write their messages synchronously.
+ */
+void fr_log_async_stop(void)
+{
+	log_async_ring_t *ring, *next;
+
+	if (!atomic_load(&log_async.running)) return;
+
+	atomic_store(&log_async.running, false);
+	atomic_store(&log_async.stop, true);
+	log_async_wake();
+	pthread_join(log_async.thread, NULL);
+
+	/*
+	 *	Catch anything queued by producers which
+	 *	passed the running check before we cleared it.
+	 */
+	log_async_drain(false);
+	log_async_report_dropped();
+
+	/*
+	 *	Rings belonging to live threads are freed
+	 *	when those threads exit.
+	 */
+	pthread_mutex_lock(&log_async.rings_mutex);
+	log_async.managed = false;
+	for (ring = atomic_load(&log_async.rings); ring; ring = next) {
+		next = ring->next;
+		if (!ring->orphaned) continue;
+
+		log_async_ring_unlink(ring);
+		talloc_free(ring);
+	}
+	pthread_mutex_unlock(&log_async.rings_mutex);
+}
+#else
+int fr_log_async_start(UNUSED size_t ring_size, UNUSED fr_log_async_overflow_t overflow)
+{
+	fr_strerror_const("Async logging requires pthreads");
+	return -1;
+}
+
+bool fr_log_async_running(void)
+{
+	return false;
+}
+
+int fr_log_async_write(UNUSED int fd, UNUSED char const *buffer, UNUSED size_t len)
+{
+	return -1;
+}
+
+void fr_log_async_flush(void)
+{
+}
+
+void fr_log_async_fault_flush(void)
+{
+}
+
+uint64_t fr_log_async_dropped(void)
+{
+	return 0;
+}
+
+void fr_log_async_stop(void)
+{
+}
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Asynchronous log writer
+ *
+ * @file src/lib/util/log_async.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(log_async_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/table.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** What to do when a thread's log buffer is full
+ *
+ */
+typedef enum {
+	FR_LOG_ASYNC_OVERFLOW_DROP = 0,		//!< Discard the message, and count it.
+	FR_LOG_ASYNC_OVERFLOW_BLOCK		//!< Wait for the writer to make room.
+} fr_log_async_overflow_t;
+
+extern fr_table_num_sorted_t const fr_log_async_overflow_table[];
+extern size_t fr_log_async_overflow_table_len;
+
+int		fr_log_async_start(size_t ring_size, fr_log_async_overflow_t overflow);
+
+bool		fr_log_async_running(void);
+
+int		fr_log_async_write(int fd, char const *buffer, size_t len) CC_HINT(nonnull);
+
+void		fr_log_async_flush(void);
+
+void		fr_log_async_fault_flush(void);
+
+uint64_t	fr_log_async_dropped(void);
+
+void		fr_log_async_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
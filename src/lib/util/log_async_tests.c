@@ -0,0 +1,273 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the asynchronous log writer
+ *
+ * @file src/lib/util/log_async_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/log_async.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_TEST_THREADS	4
+#define LOG_TEST_MESSAGES	5000
+
+typedef struct {
+	int		fd;
+	unsigned int	id;
+} log_test_thread_t;
+
+static void *log_test_producer(void *arg)
+{
+	log_test_thread_t	*t = arg;
+	char			buffer[64];
+	unsigned int		i;
+
+	for (i = 0; i < LOG_TEST_MESSAGES; i++) {
+		int len;
+
+		len = snprintf(buffer, sizeof(buffer), "thread %u message %u\n", t->id, i);
+		if (fr_log_async_write(t->fd, buffer, (size_t)len) < 0) {
+			if (write(t->fd, buffer, (size_t)len) < 0) return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/** Every message from every thread must arrive, in order for each thread
+ *
+ * The ring is small enough that producers wrap around it many times,
+ * and have to wait for the writer.
+ */
+static void log_async_test_threads(void)
+{
+	pthread_t		threads[LOG_TEST_THREADS];
+	log_test_thread_t	args[LOG_TEST_THREADS];
+	unsigned int		next[LOG_TEST_THREADS] = { 0 };
+	char			path[] = "/tmp/log_async_tests.XXXXXX";
+	char			line[64];
+	unsigned int		i, lines = 0;
+	int			fd;
+	FILE			*fp;
+
+	fd = mkstemp(path);
+	TEST_ASSERT(fd >= 0);
+	unlink(path);
+
+	TEST_CHECK(fr_log_async_start(4096, FR_LOG_ASYNC_OVERFLOW_BLOCK) == 0);
+	TEST_CHECK(fr_log_async_running());
+
+	for (i = 0; i < LOG_TEST_THREADS; i++) {
+		args[i] = (log_test_thread_t){ .fd = fd, .id = i };
+		TEST_CHECK(pthread_create(&threads[i], NULL, log_test_producer, &args[i]) == 0);
+	}
+	for (i = 0; i < LOG_TEST_THREADS; i++) pthread_join(threads[i], NULL);
+
+	fr_log_async_stop();
+	TEST_CHECK(!fr_log_async_running());
+
+	TEST_ASSERT(lseek(fd, 0, SEEK_SET) == 0);
+	fp = fdopen(fd, "r");
+	TEST_ASSERT(fp != NULL);
+
+	while (fgets(line, sizeof(line), fp)) {
+		unsigned int id, msg;
+
+		if (!TEST_CHECK(sscanf(line, "thread %u message %u", &id, &msg) == 2)) break;
+		if (!TEST_CHECK(id < LOG_TEST_THREADS)) break;
+
+		TEST_CHECK(msg == next[id]);
+		TEST_MSG("thread %u: expected message %u, got %u", id, next[id], msg);
+		next[id] = msg + 1;
+		lines++;
+	}
+	fclose(fp);
+
+	TEST_CHECK(lines == (LOG_TEST_THREADS * LOG_TEST_MESSAGES));
+	TEST_MSG("expected %u lines, got %u", LOG_TEST_THREADS * LOG_TEST_MESSAGES, lines);
+}
+
+/** Messages which don't fit in the ring are discarded and counted
+ *
+ * Nothing reads the pipe, so the writer stalls once the pipe is full,
+ * and the ring fills up behind it.
+ */
+static void log_async_test_drop(void)
+{
+	char		buffer[128];
+	uint64_t	dropped;
+	unsigned int	i;
+	int		fds[2];
+
+	signal(SIGPIPE, SIG_IGN);
+	TEST_ASSERT(pipe(fds) == 0);
+
+	memset(buffer, 'x', sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = '\n';
+
+	dropped = fr_log_async_dropped();
+
+	TEST_CHECK(fr_log_async_start(4096, FR_LOG_ASYNC_OVERFLOW_DROP) == 0);
+
+	/*
+	 *	Far more than the pipe and the ring can hold.
+	 */
+	for (i = 0; i < 4096; i++) TEST_CHECK(fr_log_async_write(fds[1], buffer, sizeof(buffer)) == 0);
+
+	TEST_CHECK(fr_log_async_dropped() > dropped);
+	TEST_MSG("expected messages to be dropped");
+
+	/*
+	 *	Unblock the writer, it'll discard the rest.
+	 */
+	close(fds[0]);
+	fr_log_async_stop();
+	close(fds[1]);
+}
+
+/** Messages too large for the ring are left to the caller
+ *
+ */
+static void log_async_test_too_big(void)
+{
+	static char	buffer[8192];
+	int		fd;
+
+	fd = open("/dev/null", O_WRONLY);
+	TEST_ASSERT(fd >= 0);
+
+	TEST_CHECK(fr_log_async_write(fd, "hello\n", 6) < 0);
+	TEST_MSG("expected writes to be refused when the writer isn't running");
+
+	TEST_CHECK(fr_log_async_start(4096, FR_LOG_ASYNC_OVERFLOW_DROP) == 0);
+	TEST_CHECK(fr_log_async_start(4096, FR_LOG_ASYNC_OVERFLOW_DROP) < 0);
+
+	TEST_CHECK(fr_log_async_write(fd, buffer, sizeof(buffer)) < 0);
+	TEST_CHECK(fr_log_async_write(fd, "hello\n", 6) == 0);
+
+	fr_log_async_flush();
+	fr_log_async_stop();
+	close(fd);
+}
+
+static atomic_bool log_test_stop;
+
+static void *log_test_busy(void *arg)
+{
+	int fd = *(int *)arg;
+
+	while (!atomic_load(&log_test_stop)) {
+		if (fr_log_async_write(fd, "busy\n", 5) < 0) break;
+	}
+
+	return NULL;
+}
+
+/** A flush returns even though another thread never stops logging
+ *
+ */
+static void log_async_test_flush_busy(void)
+{
+	pthread_t	thread;
+	int		fd;
+
+	fd = open("/dev/null", O_WRONLY);
+	TEST_ASSERT(fd >= 0);
+
+	atomic_store(&log_test_stop, false);
+	TEST_CHECK(fr_log_async_start(4096, FR_LOG_ASYNC_OVERFLOW_BLOCK) == 0);
+	TEST_CHECK(pthread_create(&thread, NULL, log_test_busy, &fd) == 0);
+
+	usleep(10000);
+	fr_log_async_flush();
+	fr_log_async_flush();
+
+	atomic_store(&log_test_stop, true);
+	pthread_join(thread, NULL);
+
+	fr_log_async_stop();
+	close(fd);
+}
+
+/** Oversized messages written by the caller don't overtake queued ones
+ *
+ */
+static void log_async_test_too_big_order(void)
+{
+	static char	buffer[4096];
+	char		path[] = "/tmp/log_async_tests.XXXXXX";
+	char		line[sizeof(buffer) + 1];
+	unsigned int	i;
+	int		fd;
+	FILE		*fp;
+
+	fd = mkstemp(path);
+	TEST_ASSERT(fd >= 0);
+	unlink(path);
+
+	memset(buffer, 'x', sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = '\n';
+
+	TEST_CHECK(fr_log_async_start(4096, FR_LOG_ASYNC_OVERFLOW_BLOCK) == 0);
+
+	for (i = 0; i < 10; i++) {
+		char	msg[32];
+		int	len;
+
+		len = snprintf(msg, sizeof(msg), "message %u\n", i);
+		TEST_CHECK(fr_log_async_write(fd, msg, (size_t)len) == 0);
+	}
+
+	TEST_CHECK(fr_log_async_write(fd, buffer, sizeof(buffer)) < 0);
+	TEST_CHECK(write(fd, buffer, sizeof(buffer)) == sizeof(buffer));
+
+	fr_log_async_stop();
+
+	TEST_ASSERT(lseek(fd, 0, SEEK_SET) == 0);
+	fp = fdopen(fd, "r");
+	TEST_ASSERT(fp != NULL);
+
+	for (i = 0; i < 10; i++) {
+		unsigned int msg;
+
+		TEST_ASSERT(fgets(line, sizeof(line), fp) != NULL);
+		TEST_CHECK((sscanf(line, "message %u", &msg) == 1) && (msg == i));
+		TEST_MSG("expected message %u, got \"%s\"", i, line);
+	}
+	TEST_ASSERT(fgets(line, sizeof(line), fp) != NULL);
+	TEST_CHECK(line[0] == 'x');
+	fclose(fp);
+}
+
+TEST_LIST = {
+	{ "log_async_test_threads",	log_async_test_threads },
+	{ "log_async_test_drop",	log_async_test_drop },
+	{ "log_async_test_too_big",	log_async_test_too_big },
+	{ "log_async_test_flush_busy",	log_async_test_flush_busy },
+	{ "log_async_test_too_big_order",	log_async_test_too_big_order },
+	{ NULL }
+};
@@ -0,0 +1,581 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Compiled longest prefix match tables
+ *
+ * A read-optimised, immutable alternative to #fr_trie_t for address
+ * lookups.  Prefixes are added to the table, and the table is then
+ * compiled.  Once compiled, the table cannot be changed, and must
+ * instead be rebuilt.
+ *
+ * The compiled table is a poptrie.  The first bits of the key index a
+ * direct pointing array, which contains either a leaf, or the index of
+ * a node.  Each node consumes #LPM_STRIDE bits of the key, and holds
+ * two bitmaps.  One marks the slots which have child nodes, the other
+ * marks the slots where a new run of leaves starts.  Children and
+ * leaves are stored contiguously, and are found by counting the bits
+ * set in the bitmaps.  Nodes and leaves are held in flat arrays, so a
+ * lookup touches only a few cache lines, and follows no pointers.
+ *
+ * @file src/lib/util/lpm.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/lpm.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/strerror.h>
+
+#define LPM_MAX_KEY_BITS	(128)
+
+/*
+ *	Bits of the key consumed by each node.  2^6 slots fit the
+ *	64bit bitmaps.
+ */
+#define LPM_STRIDE		(6)
+
+/*
+ *	Bits of the key used to index the direct pointing array.
+ *	Small tables use a smaller array, so that tables with only a
+ *	few entries don't waste memory.
+ */
+#define LPM_DIR_BITS		(16)
+#define LPM_DIR_BITS_SMALL	(8)
+#define LPM_DIR_SMALL_MAX	(1024)
+
+/*
+ *	Direct pointing entries with this bit set are leaves,
+ *	otherwise they're the index of a node.
+ */
+#define LPM_LEAF		((uint32_t) 1 << 31)
+
+typedef struct {
+	uint64_t		key[2];		//!< Key bits, most significant first.  Bits after
+						///< keylen are always zero.
+	unsigned int		keylen;		//!< Length of the prefix in bits.
+	void const		*data;		//!< User data.
+} lpm_prefix_t;
+
+typedef struct {
+	uint64_t		vector;		//!< Slots which have a child node.
+	uint64_t		leafvec;	//!< Slots which start a new run of leaves.
+	uint32_t		base0;		//!< Index of the first leaf of this node.
+	uint32_t		base1;		//!< Index of the first child of this node.
+} lpm_node_t;
+
+struct fr_lpm_s {
+	lpm_prefix_t		*prefixes;	//!< Prefixes in the table.  Sorted by key,
+						///< then by length, once compiled.
+	unsigned int		num_prefixes;	//!< Number of prefixes in the table.
+	unsigned int		max_keylen;	//!< Length of the longest prefix.
+
+	bool			compiled;	//!< Lookups use the compiled table.
+
+	unsigned int		dir_bits;	//!< Bits used to index the direct pointing array.
+	uint32_t		*dir;		//!< Direct pointing array.
+
+	lpm_node_t		*nodes;		//!< All nodes.
+	uint32_t		num_nodes;
+
+	uint32_t		*leaves;	//!< All leaves.  0 means no match, otherwise
+						///< the index of the prefix + 1.
+	uint32_t		num_leaves;
+};
+
+/** Slots for one level of the table
+ *
+ */
+typedef struct {
+	uint32_t		leaf;		//!< Longest prefix which covers the slot.
+	uint32_t		lo;		//!< First prefix which needs a child node.
+	uint32_t		hi;		//!< One past the last prefix which needs a child node.
+} lpm_slot_t;
+
+/** Convert a key to the internal representation
+ *
+ */
+static inline CC_HINT(always_inline) void lpm_key(uint64_t out[static 2], void const *key, size_t keylen)
+{
+	uint8_t buffer[LPM_MAX_KEY_BITS / 8] = { 0 };
+	size_t bytes = (keylen + 7) / 8;
+
+	memcpy(buffer, key, bytes);
+	if (keylen & 0x07) buffer[bytes - 1] &= (uint8_t) (0xff << (8 - (keylen & 0x07)));
+
+	out[0] = fr_nbo_to_uint64(buffer);
+	out[1] = fr_nbo_to_uint64(buffer + 8);
+}
+
+/** Return "bits" bits from a key, starting at "offset"
+ *
+ * offset MUST be less than #LPM_MAX_KEY_BITS.
+ */
+static inline CC_HINT(always_inline) unsigned int lpm_key_bits(uint64_t const key[static 2],
+								unsigned int offset, unsigned int bits)
+{
+	uint64_t word;
+
+	if (offset >= 64) {
+		word = key[1] << (offset - 64);
+	} else if (offset == 0) {
+		word = key[0];
+	} else {
+		word = (key[0] << offset) | (key[1] >> (64 - offset));
+	}
+
+	return word >> (64 - bits);
+}
+
+/** Whether the first "keylen" bits of two keys are the same
+ *
+ */
+static inline bool lpm_key_match(uint64_t const a[static 2], uint64_t const b[static 2], unsigned int keylen)
+{
+	if (keylen == 0) return true;
+
+	if (keylen <= 64) return ((a[0] ^ b[0]) >> (64 - keylen)) == 0;
+
+	if (a[0] != b[0]) return false;
+
+	return ((a[1] ^ b[1]) >> (128 - keylen)) == 0;
+}
+
+static inline unsigned int lpm_popcount(uint64_t num)
+{
+	return __builtin_popcountll(num);
+}
+
+/** Allocate a new, empty, prefix table
+ *
+ * Prefixes should be added with #fr_lpm_insert_by_key, and the table
+ * compiled with #fr_lpm_compile before any lookups are done.
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @return
+ *	- A new table on success.
+ *	- NULL on error.
+ */
+fr_lpm_t *fr_lpm_alloc(TALLOC_CTX *ctx)
+{
+	fr_lpm_t *lpm;
+
+	lpm = talloc_zero(ctx, fr_lpm_t);
+	if (!lpm) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+
+	return lpm;
+}
+
+/** Add a prefix to a table which has not yet been compiled
+ *
+ * @param[in] lpm	to add the prefix to.
+ * @param[in] key	the prefix.
+ * @param[in] keylen	length of the prefix in bits.
+ * @param[in] data	to return from lookups which match the prefix.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_lpm_insert_by_key(fr_lpm_t *lpm, void const *key, size_t keylen, void const *data)
+{
+	lpm_prefix_t *p;
+
+	if (lpm->compiled) {
+		fr_strerror_const("Cannot add prefixes to a compiled table");
+		return -1;
+	}
+
+	if (keylen > LPM_MAX_KEY_BITS) {
+		fr_strerror_printf("Prefix length %zu is too long", keylen);
+		return -1;
+	}
+
+	if (lpm->num_prefixes == talloc_array_length(lpm->prefixes)) {
+		lpm_prefix_t *prefixes;
+
+		prefixes = talloc_realloc(lpm, lpm->prefixes, lpm_prefix_t,
+					  lpm->num_prefixes ? (lpm->num_prefixes * 2) : 16);
+		if (!prefixes) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+		lpm->prefixes = prefixes;
+	}
+
+	p = &lpm->prefixes[lpm->num_prefixes++];
+	lpm_key(p->key, key, keylen);
+	p->keylen = keylen;
+	p->data = data;
+
+	if (keylen > lpm->max_keylen) lpm->max_keylen = keylen;
+
+	return 0;
+}
+
+static int8_t lpm_prefix_cmp(void const *one, void const *two)
+{
+	lpm_prefix_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->key[0], b->key[0]);
+	if (ret != 0) return ret;
+
+	ret = CMP(a->key[1], b->key[1]);
+	if (ret != 0) return ret;
+
+	return CMP(a->keylen, b->keylen);
+}
+
+static int _lpm_prefix_cmp(void const *one, void const *two)
+{
+	return lpm_prefix_cmp(one, two);
+}
+
+/** Fill in the slots for one level of the table
+ *
+ * All of the prefixes in the range [lo, hi) share the bits before "offset".
+ * Prefixes which end within this level set the leaf for the slots they
+ * cover.  Prefixes which are longer need a child node, and are recorded
+ * against their slot.
+ *
+ * The prefixes are sorted by key, then by length.  So a prefix which
+ * covers another is always seen first, and longer prefixes correctly
+ * overwrite the leaves set by shorter ones.
+ */
+static void lpm_slots_fill(fr_lpm_t *lpm, lpm_slot_t *slots, unsigned int num_slots,
+			   uint32_t lo, uint32_t hi, unsigned int offset, unsigned int bits, uint32_t dflt)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < num_slots; i++) {
+		slots[i] = (lpm_slot_t) { .leaf = dflt };
+	}
+
+	for (i = lo; i < hi; i++) {
+		lpm_prefix_t const *p = &lpm->prefixes[i];
+		unsigned int v;
+
+		/*
+		 *	Already handled by a parent.  Only zero
+		 *	length prefixes end at the root.
+		 */
+		if (offset && (p->keylen <= offset)) continue;
+
+		v = lpm_key_bits(p->key, offset, bits);
+
+		if (p->keylen > (offset + bits)) {
+			if (!slots[v].hi) slots[v].lo = i;
+			slots[v].hi = i + 1;
+			continue;
+		}
+
+		/*
+		 *	The bits after the prefix length are zero,
+		 *	so "v" is the first slot covered.
+		 */
+		for (j = 0; j < (1U << (offset + bits - p->keylen)); j++) {
+			slots[v + j].leaf = i + 1;
+		}
+	}
+}
+
+/** Reserve space for nodes
+ *
+ */
+static int lpm_nodes_reserve(fr_lpm_t *lpm, uint32_t *out, uint32_t num)
+{
+	size_t size = talloc_array_length(lpm->nodes);
+
+	if ((lpm->num_nodes + num) > size) {
+		lpm_node_t *nodes;
+
+		while ((lpm->num_nodes + num) > size) size = size ? (size * 2) : 64;
+
+		nodes = talloc_realloc(lpm, lpm->nodes, lpm_node_t, size);
+		if (!nodes) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+		lpm->nodes = nodes;
+	}
+
+	*out = lpm->num_nodes;
+	lpm->num_nodes += num;
+
+	return 0;
+}
+
+static int lpm_leaf_add(fr_lpm_t *lpm, uint32_t leaf)
+{
+	size_t size = talloc_array_length(lpm->leaves);
+
+	if (lpm->num_leaves == size) {
+		uint32_t *leaves;
+
+		leaves = talloc_realloc(lpm, lpm->leaves, uint32_t, size ? (size * 2) : 64);
+		if (!leaves) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+		lpm->leaves = leaves;
+	}
+
+	lpm->leaves[lpm->num_leaves++] = leaf;
+
+	return 0;
+}
+
+/** Build a node, and all of its children
+ *
+ * @param[in] lpm	being compiled.
+ * @param[in] idx	of the node, which has already been reserved.
+ * @param[in] lo	first prefix which may be under this node.
+ * @param[in] hi	one past the last prefix which may be under this node.
+ * @param[in] offset	of the first key bit consumed by this node.
+ * @param[in] dflt	leaf for slots which no prefix covers.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int lpm_node_build(fr_lpm_t *lpm, uint32_t idx, uint32_t lo, uint32_t hi, unsigned int offset, uint32_t dflt)
+{
+	lpm_slot_t	slots[1 << LPM_STRIDE];
+	lpm_node_t	node = { .base0 = lpm->num_leaves };
+	unsigned int	i, num_children = 0;
+	bool		first = true;
+	uint32_t	prev = 0;
+
+	lpm_slots_fill(lpm, slots, NUM_ELEMENTS(slots), lo, hi, offset, LPM_STRIDE, dflt);
+
+	for (i = 0; i < NUM_ELEMENTS(slots); i++) {
+		if (slots[i].hi) {
+			node.vector |= ((uint64_t) 1) << i;
+			num_children++;
+			continue;
+		}
+
+		if (!first && (slots[i].leaf == prev)) continue;
+
+		node.leafvec |= ((uint64_t) 1) << i;
+		if (lpm_leaf_add(lpm, slots[i].leaf) < 0) return -1;
+		prev = slots[i].leaf;
+		first = false;
+	}
+
+	/*
+	 *	Children of a node are contiguous, so they all
+	 *	have to be reserved before any are built.
+	 */
+	if (num_children && (lpm_nodes_reserve(lpm, &node.base1, num_children) < 0)) return -1;
+
+	lpm->nodes[idx] = node;
+
+	for (i = 0, num_children = 0; i < NUM_ELEMENTS(slots); i++) {
+		if (!slots[i].hi) continue;
+
+		if (lpm_node_build(lpm, node.base1 + num_children++, slots[i].lo, slots[i].hi,
+				   offset + LPM_STRIDE, slots[i].leaf) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Compile a prefix table, so that lookups can be done
+ *
+ * @param[in] lpm	to compile.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error, including duplicate prefixes.
+ */
+int fr_lpm_compile(fr_lpm_t *lpm)
+{
+	lpm_slot_t	*slots;
+	unsigned int	i, num_slots;
+
+	if (lpm->compiled) {
+		fr_strerror_const("Table has already been compiled");
+		return -1;
+	}
+
+	if (lpm->num_prefixes > 1) {
+		qsort(lpm->prefixes, lpm->num_prefixes, sizeof(lpm->prefixes[0]), _lpm_prefix_cmp);
+
+		for (i = 1; i < lpm->num_prefixes; i++) {
+			if (lpm_prefix_cmp(&lpm->prefixes[i - 1], &lpm->prefixes[i]) != 0) continue;
+
+			fr_strerror_printf("Duplicate prefix with length %u", lpm->prefixes[i].keylen);
+			return -1;
+		}
+	}
+
+	lpm->dir_bits = (lpm->num_prefixes > LPM_DIR_SMALL_MAX) ? LPM_DIR_BITS : LPM_DIR_BITS_SMALL;
+	num_slots = 1U << lpm->dir_bits;
+
+	lpm->dir = talloc_array(lpm, uint32_t, num_slots);
+	slots = talloc_array(NULL, lpm_slot_t, num_slots);
+	if (!lpm->dir || !slots) {
+		talloc_free(slots);
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	lpm_slots_fill(lpm, slots, num_slots, 0, lpm->num_prefixes, 0, lpm->dir_bits, 0);
+
+	for (i = 0; i < num_slots; i++) {
+		uint32_t idx;
+
+		if (!slots[i].hi) {
+			lpm->dir[i] = LPM_LEAF | slots[i].leaf;
+			continue;
+		}
+
+		if ((lpm_nodes_reserve(lpm, &idx, 1) < 0) ||
+		    (lpm_node_build(lpm, idx, slots[i].lo, slots[i].hi, lpm->dir_bits, slots[i].leaf) < 0)) {
+			talloc_free(slots);
+			return -1;
+		}
+		lpm->dir[i] = idx;
+	}
+
+	talloc_free(slots);
+
+	lpm->compiled = true;
+
+	return 0;
+}
+
+static int _lpm_trie_insert(uint8_t const *key, size_t keylen, void *data, void *uctx)
+{
+	return fr_lpm_insert_by_key(uctx, key, keylen, data);
+}
+
+/** Build a compiled prefix table from a trie
+ *
+ * The table is a snapshot of the trie.  Later changes to the trie are
+ * not reflected in the table, which must instead be rebuilt.
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] trie	to copy prefixes and data from.
+ * @return
+ *	- A compiled table on success.
+ *	- NULL on error.
+ */
+fr_lpm_t *fr_lpm_afrom_trie(TALLOC_CTX *ctx, fr_trie_t *trie)
+{
+	fr_lpm_t *lpm;
+
+	lpm = fr_lpm_alloc(ctx);
+	if (!lpm) return NULL;
+
+	if ((fr_trie_walk(trie, lpm, _lpm_trie_insert) < 0) || (fr_lpm_compile(lpm) < 0)) {
+		talloc_free(lpm);
+		return NULL;
+	}
+
+	return lpm;
+}
+
+/** Look up a key by linear search
+ *
+ * Used when the key is shorter than some prefixes in the table, as the
+ * compiled table has been expanded to the length of the longest prefix.
+ */
+static void *lpm_lookup_slow(fr_lpm_t const *lpm, uint64_t const key[static 2], unsigned int keylen)
+{
+	lpm_prefix_t const *found = NULL;
+	unsigned int i;
+
+	for (i = 0; i < lpm->num_prefixes; i++) {
+		lpm_prefix_t const *p = &lpm->prefixes[i];
+
+		if (p->keylen > keylen) continue;
+
+		if (found && (found->keylen >= p->keylen)) continue;
+
+		if (!lpm_key_match(p->key, key, p->keylen)) continue;
+
+		found = p;
+	}
+
+	if (!found) return NULL;
+
+	return UNCONST(void *, found->data);
+}
+
+/** Find the longest prefix which matches a key
+ *
+ * Lookups with keys which are at least as long as the longest prefix
+ * in the table, e.g. full IP addresses, use the compiled table.  Shorter
+ * keys are supported, but are much slower.
+ *
+ * @param[in] lpm	to search in.
+ * @param[in] key	to search for.
+ * @param[in] keylen	length of the key in bits.
+ * @return
+ *	- The data associated with the longest matching prefix.
+ *	- NULL if no prefix matched, or the table has not been compiled.
+ */
+void *fr_lpm_lookup_by_key(fr_lpm_t const *lpm, void const *key, size_t keylen)
+{
+	uint64_t		k[2];
+	uint32_t		entry;
+	lpm_node_t const	*node;
+	unsigned int		offset;
+
+	if (unlikely(!lpm->compiled || (keylen > LPM_MAX_KEY_BITS))) return NULL;
+
+	lpm_key(k, key, keylen);
+
+	if (unlikely(keylen < lpm->max_keylen)) return lpm_lookup_slow(lpm, k, keylen);
+
+	entry = lpm->dir[k[0] >> (64 - lpm->dir_bits)];
+	if (entry & LPM_LEAF) {
+		entry &= ~LPM_LEAF;
+		goto done;
+	}
+
+	node = &lpm->nodes[entry];
+	offset = lpm->dir_bits;
+
+	for (;;) {
+		unsigned int	v = lpm_key_bits(k, offset, LPM_STRIDE);
+		uint64_t	mask = (((uint64_t) 2) << v) - 1;
+
+		if (!(node->vector & (((uint64_t) 1) << v))) {
+			entry = lpm->leaves[node->base0 + lpm_popcount(node->leafvec & mask) - 1];
+			break;
+		}
+
+		node = &lpm->nodes[node->base1 + lpm_popcount(node->vector & mask) - 1];
+		offset += LPM_STRIDE;
+	}
+
+done:
+	if (!entry) return NULL;
+
+	return UNCONST(void *, lpm->prefixes[entry - 1].data);
+}
+
+/** Return the number of prefixes in the table
+ *
+ */
+unsigned int fr_lpm_num_elements(fr_lpm_t const *lpm)
+{
+	return lpm->num_prefixes;
+}
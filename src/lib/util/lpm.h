@@ -0,0 +1,55 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Compiled longest prefix match tables
+ *
+ * @file src/lib/util/lpm.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(lpm_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/trie.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fr_lpm_s fr_lpm_t;
+
+fr_lpm_t	*fr_lpm_alloc(TALLOC_CTX *ctx);
+
+int		fr_lpm_insert_by_key(fr_lpm_t *lpm, void const *key, size_t keylen, void const *data) CC_HINT(nonnull);
+
+int		fr_lpm_compile(fr_lpm_t *lpm) CC_HINT(nonnull);
+
+fr_lpm_t	*fr_lpm_afrom_trie(TALLOC_CTX *ctx, fr_trie_t *trie) CC_HINT(nonnull(2));
+
+void		*fr_lpm_lookup_by_key(fr_lpm_t const *lpm, void const *key, size_t keylen) CC_HINT(nonnull);
+
+unsigned int	fr_lpm_num_elements(fr_lpm_t const *lpm) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,375 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and lookup benchmarks for compiled prefix tables
+ *
+ * @file src/lib/util/lpm_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/lpm.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/time.h>
+
+typedef struct {
+	uint8_t		key[16];
+	unsigned int	keylen;
+} lpm_test_prefix_t;
+
+static void key_randomise(fr_fast_rand_t *rand_ctx, uint8_t *key, size_t bytes)
+{
+	size_t i;
+
+	for (i = 0; i < bytes; i++) key[i] = fr_fast_rand(rand_ctx) & 0xff;
+}
+
+static void key_mask(uint8_t *key, size_t bytes, unsigned int keylen)
+{
+	size_t i;
+
+	for (i = 0; i < bytes; i++) {
+		if (keylen >= 8) {
+			keylen -= 8;
+			continue;
+		}
+
+		key[i] &= (uint8_t) (0xff << (8 - keylen));
+		keylen = 0;
+	}
+}
+
+/** Populate a trie and an lpm table with the same random prefixes
+ *
+ * Prefix lengths are between min and max bits.
+ */
+static lpm_test_prefix_t *prefixes_alloc(fr_fast_rand_t *rand_ctx, fr_trie_t **trie_out, fr_lpm_t **lpm_out,
+					 unsigned int num, unsigned int bits, unsigned int min, unsigned int max)
+{
+	lpm_test_prefix_t	*prefixes;
+	fr_trie_t		*trie;
+	fr_lpm_t		*lpm;
+	unsigned int		i;
+
+	prefixes = talloc_zero_array(NULL, lpm_test_prefix_t, num);
+	trie = fr_trie_alloc(prefixes, NULL, NULL);
+	lpm = fr_lpm_alloc(prefixes);
+	TEST_ASSERT(prefixes && trie && lpm);
+
+	for (i = 0; i < num; i++) {
+		lpm_test_prefix_t *p = &prefixes[i];
+
+		do {
+			key_randomise(rand_ctx, p->key, bits / 8);
+			p->keylen = min + (fr_fast_rand(rand_ctx) % (max - min + 1));
+			key_mask(p->key, bits / 8, p->keylen);
+		} while (fr_trie_match_by_key(trie, p->key, p->keylen));
+
+		TEST_CHECK(fr_trie_insert_by_key(trie, p->key, p->keylen, p) == 0);
+		TEST_CHECK(fr_lpm_insert_by_key(lpm, p->key, p->keylen, p) == 0);
+	}
+
+	TEST_CHECK(fr_lpm_compile(lpm) == 0);
+	TEST_MSG("compile failed - %s", fr_strerror());
+
+	*trie_out = trie;
+	*lpm_out = lpm;
+
+	return prefixes;
+}
+
+/** Create keys to look up
+ *
+ * Half are under one of the prefixes, the rest are random.
+ */
+static uint8_t *keys_alloc(fr_fast_rand_t *rand_ctx, lpm_test_prefix_t const *prefixes, unsigned int num_prefixes,
+			   unsigned int num, unsigned int bits)
+{
+	uint8_t		*keys;
+	unsigned int	i, j, bytes = bits / 8;
+
+	keys = talloc_array(NULL, uint8_t, num * bytes);
+	TEST_ASSERT(keys != NULL);
+
+	for (i = 0; i < num; i++) {
+		uint8_t *key = keys + (i * bytes);
+
+		key_randomise(rand_ctx, key, bytes);
+		if (i & 0x01) continue;
+
+		/*
+		 *	Copy the prefix bits over the random bits.
+		 */
+		{
+			lpm_test_prefix_t const *p = &prefixes[fr_fast_rand(rand_ctx) % num_prefixes];
+			uint8_t mask[16];
+
+			memset(mask, 0xff, sizeof(mask));
+			key_mask(mask, bytes, p->keylen);
+
+			for (j = 0; j < bytes; j++) key[j] = (key[j] & ~mask[j]) | p->key[j];
+		}
+	}
+
+	return keys;
+}
+
+static void lpm_compare(unsigned int num_prefixes, unsigned int bits, unsigned int min, unsigned int max)
+{
+	fr_fast_rand_t		rand_ctx = { .a = fr_rand(), .b = fr_rand() };
+	lpm_test_prefix_t	*prefixes;
+	fr_trie_t		*trie;
+	fr_lpm_t		*lpm;
+	uint8_t			*keys;
+	unsigned int		i, num_keys = 20000, found = 0;
+
+	prefixes = prefixes_alloc(&rand_ctx, &trie, &lpm, num_prefixes, bits, min, max);
+	keys = keys_alloc(&rand_ctx, prefixes, num_prefixes, num_keys, bits);
+
+	TEST_CASE("Full length keys");
+	for (i = 0; i < num_keys; i++) {
+		uint8_t const	*key = keys + (i * (bits / 8));
+		void		*expected, *got;
+
+		expected = fr_trie_lookup_by_key(trie, key, bits);
+		got = fr_lpm_lookup_by_key(lpm, key, bits);
+		if (expected) found++;
+
+		TEST_CHECK(got == expected);
+		TEST_MSG("Key %u, expected %p, got %p", i, expected, got);
+		if (got != expected) break;
+	}
+
+	TEST_CHECK(found > 0);
+
+	TEST_CASE("Short keys");
+	for (i = 0; i < 1000; i++) {
+		uint8_t		key[16];
+		unsigned int	keylen = fr_fast_rand(&rand_ctx) % (bits + 1);
+		void		*expected, *got;
+
+		memcpy(key, keys + (i * (bits / 8)), bits / 8);
+		key_mask(key, bits / 8, keylen);
+
+		expected = fr_trie_lookup_by_key(trie, key, keylen);
+		got = fr_lpm_lookup_by_key(lpm, key, keylen);
+
+		TEST_CHECK(got == expected);
+		TEST_MSG("Key %u/%u, expected %p, got %p", i, keylen, expected, got);
+		if (got != expected) break;
+	}
+
+	talloc_free(keys);
+	talloc_free(prefixes);
+}
+
+static void lpm_test_basic(void)
+{
+	fr_lpm_t	*lpm;
+	uint8_t		any[4] = { 0, 0, 0, 0 };
+	uint8_t		net10[4] = { 10, 0, 0, 0 };
+	uint8_t		net10_1[4] = { 10, 1, 0, 0 };
+	uint8_t		host[4] = { 10, 1, 2, 3 };
+	uint8_t		key[4];
+	char const	*data_any = "any", *data_10 = "10/8", *data_10_1 = "10.1/16", *data_host = "host";
+
+	lpm = fr_lpm_alloc(NULL);
+	TEST_ASSERT(lpm != NULL);
+
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, host, 32, data_host) == 0);
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, net10_1, 16, data_10_1) == 0);
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, net10, 8, data_10) == 0);
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, any, 0, data_any) == 0);
+
+	TEST_CASE("Lookups fail before compilation");
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 32) == NULL);
+
+	TEST_CHECK(fr_lpm_compile(lpm) == 0);
+	TEST_CHECK(fr_lpm_num_elements(lpm) == 4);
+
+	TEST_CASE("Compiled tables can't be changed");
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, host, 24, data_host) < 0);
+
+	TEST_CASE("Longest prefix wins");
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 32) == data_host);
+
+	memcpy(key, host, sizeof(key));
+	key[3] = 4;
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, key, 32) == data_10_1);
+
+	key[1] = 2;
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, key, 32) == data_10);
+
+	key[0] = 192;
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, key, 32) == data_any);
+
+	TEST_CASE("Short keys");
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 24) == data_10_1);
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 12) == data_10);
+
+	talloc_free(lpm);
+}
+
+static void lpm_test_duplicate(void)
+{
+	fr_lpm_t	*lpm;
+	uint8_t		net10[4] = { 10, 0, 0, 0 };
+
+	lpm = fr_lpm_alloc(NULL);
+	TEST_ASSERT(lpm != NULL);
+
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, net10, 8, net10) == 0);
+	TEST_CHECK(fr_lpm_insert_by_key(lpm, net10, 8, net10) == 0);
+	TEST_CHECK(fr_lpm_compile(lpm) < 0);
+
+	talloc_free(lpm);
+}
+
+static void lpm_test_empty(void)
+{
+	fr_lpm_t	*lpm;
+	uint8_t		host[4] = { 10, 1, 2, 3 };
+
+	lpm = fr_lpm_alloc(NULL);
+	TEST_ASSERT(lpm != NULL);
+	TEST_CHECK(fr_lpm_compile(lpm) == 0);
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 32) == NULL);
+
+	talloc_free(lpm);
+}
+
+static void lpm_test_from_trie(void)
+{
+	fr_trie_t	*trie;
+	fr_lpm_t	*lpm;
+	uint8_t		net10[4] = { 10, 0, 0, 0 };
+	uint8_t		net10_1[4] = { 10, 1, 0, 0 };
+	uint8_t		host[4] = { 10, 1, 2, 3 };
+	char const	*data_10 = "10/8", *data_10_1 = "10.1/16";
+
+	trie = fr_trie_alloc(NULL, NULL, NULL);
+	TEST_ASSERT(trie != NULL);
+
+	TEST_CHECK(fr_trie_insert_by_key(trie, net10, 8, data_10) == 0);
+	TEST_CHECK(fr_trie_insert_by_key(trie, net10_1, 16, data_10_1) == 0);
+
+	lpm = fr_lpm_afrom_trie(trie, trie);
+	TEST_ASSERT(lpm != NULL);
+
+	TEST_CHECK(fr_lpm_num_elements(lpm) == 2);
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 32) == data_10_1);
+
+	host[1] = 2;
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 32) == data_10);
+
+	host[0] = 11;
+	TEST_CHECK(fr_lpm_lookup_by_key(lpm, host, 32) == NULL);
+
+	talloc_free(trie);
+}
+
+static void lpm_test_ipv4_small(void)
+{
+	lpm_compare(100, 32, 1, 32);
+}
+
+static void lpm_test_ipv4_large(void)
+{
+	lpm_compare(5000, 32, 8, 32);
+}
+
+static void lpm_test_ipv6_small(void)
+{
+	lpm_compare(100, 128, 1, 128);
+}
+
+static void lpm_test_ipv6_large(void)
+{
+	lpm_compare(5000, 128, 16, 128);
+}
+
+/** Compare lookup times for a trie and a compiled table
+ *
+ */
+static void lpm_bench(unsigned int num_prefixes, unsigned int bits, unsigned int min, unsigned int max)
+{
+	fr_fast_rand_t		rand_ctx = { .a = fr_rand(), .b = fr_rand() };
+	lpm_test_prefix_t	*prefixes;
+	fr_trie_t		*trie;
+	fr_lpm_t		*lpm;
+	uint8_t			*keys;
+	unsigned int		i, j, num_keys = 100000, rounds = 10;
+	fr_time_t		start, end_build, end_trie, end_lpm;
+	uintptr_t		sum_trie = 0, sum_lpm = 0;
+
+	prefixes = prefixes_alloc(&rand_ctx, &trie, &lpm, num_prefixes, bits, min, max);
+	keys = keys_alloc(&rand_ctx, prefixes, num_prefixes, num_keys, bits);
+
+	start = fr_time();
+	talloc_free(fr_lpm_afrom_trie(NULL, trie));
+	end_build = fr_time();
+
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < num_keys; i++) {
+			sum_trie += (uintptr_t) fr_trie_lookup_by_key(trie, keys + (i * (bits / 8)), bits);
+		}
+	}
+	end_trie = fr_time();
+
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < num_keys; i++) {
+			sum_lpm += (uintptr_t) fr_lpm_lookup_by_key(lpm, keys + (i * (bits / 8)), bits);
+		}
+	}
+	end_lpm = fr_time();
+
+	TEST_CHECK(sum_trie == sum_lpm);
+
+	TEST_MSG_ALWAYS("\nprefixes: %u, prefix length %u-%u, lookups: %u\n", num_prefixes, min, max, num_keys * rounds);
+	TEST_MSG_ALWAYS("build: %"PRIu64" μs\n", fr_time_delta_unwrap(fr_time_sub(end_build, start)) / 1000);
+	TEST_MSG_ALWAYS("trie: %.1f ns/lookup\n",
+			fr_time_delta_unwrap(fr_time_sub(end_trie, end_build)) / (double) (num_keys * rounds));
+	TEST_MSG_ALWAYS("lpm: %.1f ns/lookup\n",
+			fr_time_delta_unwrap(fr_time_sub(end_lpm, end_trie)) / (double) (num_keys * rounds));
+
+	talloc_free(keys);
+	talloc_free(prefixes);
+}
+
+static void lpm_bench_ipv4(void)
+{
+	lpm_bench(150000, 32, 20, 32);
+}
+
+static void lpm_bench_ipv6(void)
+{
+	lpm_bench(50000, 128, 32, 128);
+}
+
+TEST_LIST = {
+	{ "lpm_test_basic",		lpm_test_basic },
+	{ "lpm_test_duplicate",		lpm_test_duplicate },
+	{ "lpm_test_empty",		lpm_test_empty },
+	{ "lpm_test_from_trie",		lpm_test_from_trie },
+	{ "lpm_test_ipv4_small",	lpm_test_ipv4_small },
+	{ "lpm_test_ipv4_large",	lpm_test_ipv4_large },
+	{ "lpm_test_ipv6_small",	lpm_test_ipv6_small },
+	{ "lpm_test_ipv6_large",	lpm_test_ipv6_large },
+	{ "lpm_bench_ipv4",		lpm_bench_ipv4 },
+	{ "lpm_bench_ipv6",		lpm_bench_ipv6 },
+	{ NULL }
+};
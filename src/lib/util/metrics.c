@@ -0,0 +1,584 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Per-thread counters and latency histograms
+ *
+ * Metrics are registered once, by name and labels, and updated by any
+ * thread without locks.  Each thread writes only to its own copy of
+ * every metric.  The copies live in per-thread chunks, which are
+ * allocated on cache line boundaries, so threads never write to the
+ * same cache line.  Readers sum the copies from all threads.
+ *
+ * Histograms are log-linear.  Each power of 2 is split into
+ * #METRIC_HIST_SUB linear buckets, so any recorded duration is within
+ * 12.5% of its true value.  Quantiles are calculated from the buckets
+ * when the metric is read.
+ *
+ * The registry mutex (metrics.mutex) is only taken when metrics are
+ * registered, when threads first record a value or exit, and by
+ * readers.
+ *
+ * @file src/lib/util/metrics.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/atexit.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/metrics.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#define METRIC_CACHE_LINE	(64)
+#define METRIC_CHUNK_SIZE	(64 * 1024)		//!< Bytes of metric storage per chunk.
+#define METRIC_MAX_CHUNKS	(256)			//!< Limits each thread to 16M of metrics.
+
+#define METRIC_HIST_SHIFT	(10)			//!< Smallest bucket is 1024ns.
+#define METRIC_HIST_SUB_BITS	(3)
+#define METRIC_HIST_SUB		(1 << METRIC_HIST_SUB_BITS)
+#define METRIC_HIST_BUCKETS	(METRIC_HIST_SUB * 28)	//!< Up to ~18 minutes.
+
+/*
+ *	Layout of a histogram's slots.
+ */
+#define METRIC_HIST_COUNT	(0)
+#define METRIC_HIST_SUM		(1)
+#define METRIC_HIST_BUCKET	(2)
+#define METRIC_HIST_SLOTS	(METRIC_HIST_BUCKET + METRIC_HIST_BUCKETS)
+
+typedef _Atomic(uint64_t) metric_slot_t;
+
+/** A group of metrics with the same name, differing only by labels
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< In the list of families.
+	char const		*name;
+	char const		*help;
+	fr_metric_type_t	type;
+	fr_dlist_head_t		metrics;		//!< Members of this family.
+} metric_family_t;
+
+struct fr_metric_s {
+	fr_dlist_t		entry;			//!< In the family's list of metrics.
+	metric_family_t		*family;
+	char const		*labels;		//!< Pre-formatted, and escaped.
+	unsigned int		chunk;			//!< Which chunk our slots are in.
+	size_t			offset;			//!< Of our slots within the chunk.
+};
+
+/** One thread's copy of every metric
+ *
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< In the list of threads.
+	_Atomic(uint8_t *)	chunks[METRIC_MAX_CHUNKS];
+} metric_thread_t;
+
+static struct {
+	pthread_mutex_t		mutex;			//!< Protects everything here.
+	bool			init;
+	TALLOC_CTX		*ctx;
+	fr_dlist_head_t		families;
+	fr_dlist_head_t		threads;
+	metric_thread_t		*retired;		//!< Values from threads which have exited.
+	unsigned int		chunk;			//!< Chunk new metrics are allocated from.
+	size_t			offset;			//!< Next free offset in that chunk.
+} metrics = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER
+};
+
+static _Thread_local metric_thread_t *metric_thread;
+
+static inline CC_HINT(always_inline) unsigned int metric_hist_bucket(uint64_t ns)
+{
+	uint64_t	v = ns >> METRIC_HIST_SHIFT;
+	unsigned int	e, idx;
+
+	if (v < METRIC_HIST_SUB) return v;
+
+	e = fr_high_bit_pos(v) - 1;
+	idx = ((e - METRIC_HIST_SUB_BITS + 1) << METRIC_HIST_SUB_BITS) +
+	      ((v >> (e - METRIC_HIST_SUB_BITS)) & (METRIC_HIST_SUB - 1));
+
+	return (idx < METRIC_HIST_BUCKETS) ? idx : METRIC_HIST_BUCKETS - 1;
+}
+
+/** Return the exclusive upper bound of a bucket in nanoseconds
+ *
+ */
+static uint64_t metric_hist_bucket_upper(unsigned int idx)
+{
+	unsigned int	group, e;
+
+	if (idx < METRIC_HIST_SUB) return ((uint64_t)idx + 1) << METRIC_HIST_SHIFT;
+
+	group = idx >> METRIC_HIST_SUB_BITS;
+	e = group + METRIC_HIST_SUB_BITS - 1;
+
+	return ((uint64_t)(METRIC_HIST_SUB + (idx & (METRIC_HIST_SUB - 1)) + 1) << (e - METRIC_HIST_SUB_BITS))
+		<< METRIC_HIST_SHIFT;
+}
+
+static size_t metric_slots(fr_metric_type_t type)
+{
+	return (type == FR_METRIC_TYPE_HISTOGRAM) ? METRIC_HIST_SLOTS : 1;
+}
+
+static int _metrics_free(UNUSED void *uctx)
+{
+	pthread_mutex_lock(&metrics.mutex);
+	TALLOC_FREE(metrics.ctx);
+	metrics.retired = NULL;
+	metrics.init = false;
+	pthread_mutex_unlock(&metrics.mutex);
+
+	return 0;
+}
+
+/** Allocate a chunk of slots for a thread
+ *
+ * Must be called with the registry mutex held, or by the owning thread.
+ */
+static uint8_t *metric_chunk_alloc(metric_thread_t *t, unsigned int chunk)
+{
+	void	*start;
+
+	if (!talloc_aligned_array(t, &start, METRIC_CACHE_LINE, METRIC_CHUNK_SIZE)) return NULL;
+	memset(start, 0, METRIC_CHUNK_SIZE);
+
+	atomic_store_explicit(&t->chunks[chunk], start, memory_order_release);
+
+	return start;
+}
+
+static void metric_registry_init(void)
+{
+	if (metrics.init) return;
+
+	metrics.ctx = talloc_init_const("metrics");
+	fr_dlist_talloc_init(&metrics.families, metric_family_t, entry);
+	fr_dlist_init(&metrics.threads, metric_thread_t, entry);
+	metrics.retired = talloc_zero(metrics.ctx, metric_thread_t);
+	metrics.init = true;
+
+	fr_atexit_global(_metrics_free, NULL);
+}
+
+/** Fold an exiting thread's values into the retired totals
+ *
+ */
+static int _metric_thread_free(void *uctx)
+{
+	metric_thread_t	*t = talloc_get_type_abort(uctx, metric_thread_t);
+	unsigned int	i;
+
+	pthread_mutex_lock(&metrics.mutex);
+	if (metrics.init) {
+		for (i = 0; i < METRIC_MAX_CHUNKS; i++) {
+			metric_slot_t	*in, *out;
+			uint8_t		*chunk;
+			size_t		j;
+
+			chunk = atomic_load_explicit(&t->chunks[i], memory_order_relaxed);
+			if (!chunk) continue;
+
+			in = (metric_slot_t *)chunk;
+			chunk = atomic_load_explicit(&metrics.retired->chunks[i], memory_order_relaxed);
+			if (!chunk) chunk = metric_chunk_alloc(metrics.retired, i);
+			if (!chunk) continue;
+
+			out = (metric_slot_t *)chunk;
+			for (j = 0; j < (METRIC_CHUNK_SIZE / sizeof(metric_slot_t)); j++) {
+				atomic_fetch_add_explicit(&out[j], atomic_load_explicit(&in[j], memory_order_relaxed),
+							  memory_order_relaxed);
+			}
+		}
+		fr_dlist_remove(&metrics.threads, t);
+	}
+	pthread_mutex_unlock(&metrics.mutex);
+
+	metric_thread = NULL;
+
+	return talloc_free(t);
+}
+
+static metric_thread_t *metric_thread_alloc(void)
+{
+	metric_thread_t *t;
+
+	if (fr_atexit_is_exiting()) return NULL;
+
+	t = talloc_zero(NULL, metric_thread_t);
+	if (unlikely(!t)) return NULL;
+
+	pthread_mutex_lock(&metrics.mutex);
+	if (!metrics.init) {
+		pthread_mutex_unlock(&metrics.mutex);
+		talloc_free(t);
+		return NULL;
+	}
+	fr_dlist_insert_tail(&metrics.threads, t);
+	pthread_mutex_unlock(&metrics.mutex);
+
+	fr_atexit_thread_local(metric_thread, _metric_thread_free, t);
+
+	return t;
+}
+
+/** Find this thread's slots for a metric
+ *
+ */
+static inline CC_HINT(always_inline) metric_slot_t *metric_slot(fr_metric_t const *metric)
+{
+	metric_thread_t	*t = metric_thread;
+	uint8_t		*chunk;
+
+	if (unlikely(!t)) {
+		t = metric_thread_alloc();
+		if (!t) return NULL;
+	}
+
+	chunk = atomic_load_explicit(&t->chunks[metric->chunk], memory_order_relaxed);
+	if (unlikely(!chunk)) {
+		chunk = metric_chunk_alloc(t, metric->chunk);
+		if (!chunk) return NULL;
+	}
+
+	return (metric_slot_t *)(chunk + metric->offset);
+}
+
+/** Add to a slot
+ *
+ * Only the owning thread writes to its slots, so this doesn't need
+ * to be an atomic read-modify-write.  It only needs to be atomic
+ * enough that readers never see a torn value.
+ */
+static inline CC_HINT(always_inline) void metric_slot_add(metric_slot_t *slot, uint64_t n)
+{
+	atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static void metric_thread_read(uint64_t *out, metric_thread_t *t, fr_metric_t const *metric, size_t slots)
+{
+	metric_slot_t	*in;
+	uint8_t		*chunk;
+	size_t		i;
+
+	chunk = atomic_load_explicit(&t->chunks[metric->chunk], memory_order_acquire);
+	if (!chunk) return;
+
+	in = (metric_slot_t *)(chunk + metric->offset);
+	for (i = 0; i < slots; i++) out[i] += atomic_load_explicit(&in[i], memory_order_relaxed);
+}
+
+/** Sum every thread's copy of a metric
+ *
+ * Must be called with metrics.mutex held, as threads may exit, and
+ * retire their copies, at any time.  All the public read functions
+ * take it.
+ */
+static void metric_read(uint64_t *out, fr_metric_t const *metric)
+{
+	metric_thread_t	*t = NULL;
+	size_t		slots = metric_slots(metric->family->type);
+
+	memset(out, 0, sizeof(uint64_t) * slots);
+
+	if (!metrics.init) return;
+
+	metric_thread_read(out, metrics.retired, metric, slots);
+	while ((t = fr_dlist_next(&metrics.threads, t))) metric_thread_read(out, t, metric, slots);
+}
+
+static fr_time_delta_t metric_hist_quantile(uint64_t const *hist, double q)
+{
+	uint64_t	rank, seen = 0;
+	unsigned int	i;
+
+	if (hist[METRIC_HIST_COUNT] == 0) return fr_time_delta_wrap(0);
+
+	rank = (uint64_t)(q * (double)hist[METRIC_HIST_COUNT]);
+	if (rank < 1) rank = 1;
+	if (rank > hist[METRIC_HIST_COUNT]) rank = hist[METRIC_HIST_COUNT];
+
+	for (i = 0; i < METRIC_HIST_BUCKETS; i++) {
+		seen += hist[METRIC_HIST_BUCKET + i];
+		if (seen >= rank) break;
+	}
+	if (i == METRIC_HIST_BUCKETS) i--;
+
+	return fr_time_delta_wrap((int64_t)metric_hist_bucket_upper(i));
+}
+
+/** Append a label to a label string, escaping the value
+ *
+ */
+static char *metric_label_append(char *labels, char const *name, char const *value)
+{
+	char const *p;
+
+	labels = talloc_asprintf_append_buffer(labels, "%s%s=\"", labels[0] ? "," : "", name);
+
+	for (p = value; *p; p++) {
+		switch (*p) {
+		case '\\':
+			labels = talloc_strdup_append_buffer(labels, "\\\\");
+			break;
+
+		case '"':
+			labels = talloc_strdup_append_buffer(labels, "\\\"");
+			break;
+
+		case '\n':
+			labels = talloc_strdup_append_buffer(labels, "\\n");
+			break;
+
+		default:
+			labels = talloc_strndup_append_buffer(labels, p, 1);
+			break;
+		}
+	}
+
+	return talloc_strdup_append_buffer(labels, "\"");
+}
+
+/** Register a metric
+ *
+ * Registering a metric with the same name and labels as an existing
+ * one returns the existing metric.
+ *
+ * @param[in] type	of metric.
+ * @param[in] name	of the metric, e.g. "freeradius_module_call_duration_seconds".
+ * @param[in] help	text describing the metric.
+ * @param[in] ...	label name/value pairs, terminated by NULL.
+ * @return
+ *	- The metric on success.
+ *	- NULL on error.
+ */
+fr_metric_t *fr_metric_register(fr_metric_type_t type, char const *name, char const *help, ...)
+{
+	metric_family_t	*family = NULL;
+	fr_metric_t	*metric = NULL;
+	char		*labels;
+	char const	*label_name;
+	size_t		size;
+	va_list		ap;
+
+	pthread_mutex_lock(&metrics.mutex);
+	metric_registry_init();
+
+	labels = talloc_strdup(metrics.ctx, "");
+	va_start(ap, help);
+	while ((label_name = va_arg(ap, char const *))) {
+		char const *value = va_arg(ap, char const *);
+
+		labels = metric_label_append(labels, label_name, value ? value : "");
+	}
+	va_end(ap);
+
+	while ((family = fr_dlist_next(&metrics.families, family))) {
+		if (strcmp(family->name, name) == 0) break;
+	}
+
+	if (family) {
+		if (family->type != type) {
+			fr_strerror_printf("Metric %s already registered with a different type", name);
+			talloc_free(labels);
+			goto done;
+		}
+
+		while ((metric = fr_dlist_next(&family->metrics, metric))) {
+			if (strcmp(metric->labels, labels) == 0) {
+				talloc_free(labels);
+				goto done;
+			}
+		}
+	} else {
+		family = talloc_zero(metrics.ctx, metric_family_t);
+		family->name = talloc_strdup(family, name);
+		family->help = talloc_strdup(family, help);
+		family->type = type;
+		fr_dlist_talloc_init(&family->metrics, fr_metric_t, entry);
+		fr_dlist_insert_tail(&metrics.families, family);
+	}
+
+	size = ROUND_UP(metric_slots(type) * sizeof(metric_slot_t), METRIC_CACHE_LINE);
+	if ((metrics.offset + size) > METRIC_CHUNK_SIZE) {
+		if ((metrics.chunk + 1) >= METRIC_MAX_CHUNKS) {
+			fr_strerror_const("Too many metrics");
+			talloc_free(labels);
+			goto done;
+		}
+		metrics.chunk++;
+		metrics.offset = 0;
+	}
+
+	metric = talloc_zero(family, fr_metric_t);
+	metric->family = family;
+	metric->labels = talloc_steal(metric, labels);
+	metric->chunk = metrics.chunk;
+	metric->offset = metrics.offset;
+	metrics.offset += size;
+
+	fr_dlist_insert_tail(&family->metrics, metric);
+
+done:
+	pthread_mutex_unlock(&metrics.mutex);
+
+	return metric;
+}
+
+/** Increment a counter
+ *
+ * @param[in] metric	to increment.  May be NULL, in which case this is a noop.
+ * @param[in] n		amount to add.
+ */
+void fr_metric_inc(fr_metric_t *metric, uint64_t n)
+{
+	metric_slot_t *slot;
+
+	if (!metric) return;
+
+	slot = metric_slot(metric);
+	if (unlikely(!slot)) return;
+
+	metric_slot_add(slot, n);
+}
+
+/** Record a duration in a histogram
+ *
+ * @param[in] metric	to update.  May be NULL, in which case this is a noop.
+ *			Must be a histogram, counters don't have space
+ *			for the buckets.
+ * @param[in] value	to record.  Negative values are recorded as zero.
+ */
+void fr_metric_observe(fr_metric_t *metric, fr_time_delta_t value)
+{
+	metric_slot_t	*slot;
+	int64_t		ns = fr_time_delta_unwrap(value);
+
+	if (!metric) return;
+
+	if (!fr_cond_assert_msg(metric->family->type == FR_METRIC_TYPE_HISTOGRAM,
+				"Metric %s is not a histogram", metric->family->name)) return;
+
+	slot = metric_slot(metric);
+	if (unlikely(!slot)) return;
+
+	if (ns < 0) ns = 0;
+
+	metric_slot_add(&slot[METRIC_HIST_COUNT], 1);
+	metric_slot_add(&slot[METRIC_HIST_SUM], (uint64_t)ns);
+	metric_slot_add(&slot[METRIC_HIST_BUCKET + metric_hist_bucket((uint64_t)ns)], 1);
+}
+
+/** Return the value of a counter, or the number of values recorded in a histogram
+ *
+ * Takes metrics.mutex.
+ */
+uint64_t fr_metric_count(fr_metric_t const *metric)
+{
+	uint64_t	values[METRIC_HIST_SLOTS];
+
+	pthread_mutex_lock(&metrics.mutex);
+	metric_read(values, metric);
+	pthread_mutex_unlock(&metrics.mutex);
+
+	return values[0];
+}
+
+/** Estimate a quantile of a histogram
+ *
+ * Takes metrics.mutex.
+ *
+ * @param[in] metric	to read.
+ * @param[in] q		quantile, between 0 and 1.
+ * @return the upper bound of the bucket containing the quantile.
+ */
+fr_time_delta_t fr_metric_quantile(fr_metric_t const *metric, double q)
+{
+	uint64_t	values[METRIC_HIST_SLOTS];
+
+	if (metric->family->type != FR_METRIC_TYPE_HISTOGRAM) return fr_time_delta_wrap(0);
+
+	pthread_mutex_lock(&metrics.mutex);
+	metric_read(values, metric);
+	pthread_mutex_unlock(&metrics.mutex);
+
+	return metric_hist_quantile(values, q);
+}
+
+/** Print all metrics in the Prometheus text exposition format
+ *
+ * Histograms are printed as summaries, with the quantiles of interest
+ * for latency monitoring.
+ *
+ * Holds metrics.mutex while printing, so registering metrics, and
+ * threads recording their first value or exiting, wait until it's
+ * done.  Recording values doesn't.
+ *
+ * @param[in] fp	to print to.
+ */
+void fr_metrics_print(FILE *fp)
+{
+	static double const	quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	metric_family_t		*family = NULL;
+	uint64_t		values[METRIC_HIST_SLOTS];
+
+	pthread_mutex_lock(&metrics.mutex);
+	if (!metrics.init) goto done;
+
+	while ((family = fr_dlist_next(&metrics.families, family))) {
+		fr_metric_t *metric = NULL;
+
+		fprintf(fp, "# HELP %s %s\n", family->name, family->help);
+		fprintf(fp, "# TYPE %s %s\n", family->name,
+			(family->type == FR_METRIC_TYPE_HISTOGRAM) ? "summary" : "counter");
+
+		while ((metric = fr_dlist_next(&family->metrics, metric))) {
+			char const	*sep = metric->labels[0] ? "," : "";
+			size_t		i;
+
+			metric_read(values, metric);
+
+			if (family->type == FR_METRIC_TYPE_COUNTER) {
+				fprintf(fp, "%s{%s} %" PRIu64 "\n", family->name, metric->labels, values[0]);
+				continue;
+			}
+
+			for (i = 0; i < NUM_ELEMENTS(quantiles); i++) {
+				fprintf(fp, "%s{%s%squantile=\"%g\"} %.9f\n", family->name, metric->labels, sep,
+					quantiles[i],
+					fr_time_delta_unwrap(metric_hist_quantile(values, quantiles[i])) / (double)NSEC);
+			}
+			fprintf(fp, "%s_sum{%s} %.9f\n", family->name, metric->labels,
+				values[METRIC_HIST_SUM] / (double)NSEC);
+			fprintf(fp, "%s_count{%s} %" PRIu64 "\n", family->name, metric->labels,
+				values[METRIC_HIST_COUNT]);
+		}
+	}
+
+done:
+	pthread_mutex_unlock(&metrics.mutex);
+}
@@ -0,0 +1,59 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Per-thread counters and latency histograms
+ *
+ * @file src/lib/util/metrics.h
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(metrics_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/time.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+	FR_METRIC_TYPE_COUNTER = 0,		//!< Monotonically increasing count.
+	FR_METRIC_TYPE_HISTOGRAM		//!< Distribution of durations.
+} fr_metric_type_t;
+
+typedef struct fr_metric_s fr_metric_t;
+
+fr_metric_t	*fr_metric_register(fr_metric_type_t type, char const *name, char const *help, ...)
+				    CC_HINT(nonnull(2,3)) CC_HINT(sentinel);
+
+void		fr_metric_inc(fr_metric_t *metric, uint64_t n);
+
+void		fr_metric_observe(fr_metric_t *metric, fr_time_delta_t value);
+
+uint64_t	fr_metric_count(fr_metric_t const *metric) CC_HINT(nonnull);
+
+fr_time_delta_t	fr_metric_quantile(fr_metric_t const *metric, double q) CC_HINT(nonnull);
+
+void		fr_metrics_print(FILE *fp) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,176 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for per-thread metrics
+ *
+ * @file src/lib/util/metrics_tests.c
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/metrics.h>
+
+#include <pthread.h>
+
+#define METRIC_TEST_THREADS	4
+#define METRIC_TEST_ITERATIONS	100000
+
+static void metrics_test_register(void)
+{
+	fr_metric_t *a, *b, *c;
+
+	a = fr_metric_register(FR_METRIC_TYPE_COUNTER, "test_register_total", "Test counter",
+			       "server", "default", NULL);
+	TEST_ASSERT(a != NULL);
+
+	b = fr_metric_register(FR_METRIC_TYPE_COUNTER, "test_register_total", "Test counter",
+			       "server", "default", NULL);
+	TEST_CHECK(a == b);
+	TEST_MSG("expected registering the same labels to return the same metric");
+
+	c = fr_metric_register(FR_METRIC_TYPE_COUNTER, "test_register_total", "Test counter",
+			       "server", "other", NULL);
+	TEST_CHECK((c != NULL) && (c != a));
+
+	TEST_CHECK(fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "test_register_total", "Test counter", NULL) == NULL);
+	TEST_MSG("expected registering a different type under the same name to fail");
+
+	fr_metric_inc(a, 3);
+	fr_metric_inc(NULL, 1);
+	TEST_CHECK(fr_metric_count(a) == 3);
+	TEST_CHECK(fr_metric_count(c) == 0);
+}
+
+static void *metrics_test_worker(void *arg)
+{
+	fr_metric_t	*metric = arg;
+	unsigned int	i;
+
+	for (i = 0; i < METRIC_TEST_ITERATIONS; i++) fr_metric_inc(metric, 1);
+
+	return NULL;
+}
+
+/** Counts from all threads, including ones which have exited, must be summed
+ *
+ */
+static void metrics_test_threads(void)
+{
+	pthread_t	threads[METRIC_TEST_THREADS];
+	fr_metric_t	*metric;
+	unsigned int	i;
+
+	metric = fr_metric_register(FR_METRIC_TYPE_COUNTER, "test_threads_total", "Test counter", NULL);
+	TEST_ASSERT(metric != NULL);
+
+	for (i = 0; i < METRIC_TEST_THREADS; i++) {
+		TEST_CHECK(pthread_create(&threads[i], NULL, metrics_test_worker, metric) == 0);
+	}
+	for (i = 0; i < METRIC_TEST_THREADS; i++) pthread_join(threads[i], NULL);
+
+	metrics_test_worker(metric);
+
+	TEST_CHECK(fr_metric_count(metric) == ((METRIC_TEST_THREADS + 1) * METRIC_TEST_ITERATIONS));
+	TEST_MSG("expected %u, got %" PRIu64, (METRIC_TEST_THREADS + 1) * METRIC_TEST_ITERATIONS,
+		 fr_metric_count(metric));
+}
+
+/** Quantiles must be within one bucket of the true value
+ *
+ */
+static void metrics_test_quantile(void)
+{
+	fr_metric_t	*metric;
+	int64_t		i, p50, p99;
+
+	metric = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "test_quantile_seconds", "Test histogram", NULL);
+	TEST_ASSERT(metric != NULL);
+
+	TEST_CHECK(fr_time_delta_unwrap(fr_metric_quantile(metric, 0.5)) == 0);
+
+	/*
+	 *	1ms, 2ms ... 1000ms
+	 */
+	for (i = 1; i <= 1000; i++) fr_metric_observe(metric, fr_time_delta_from_msec(i));
+
+	TEST_CHECK(fr_metric_count(metric) == 1000);
+
+	p50 = fr_time_delta_to_msec(fr_metric_quantile(metric, 0.5));
+	TEST_CHECK((p50 >= 500) && (p50 <= 563));
+	TEST_MSG("p50 %" PRId64 "ms", p50);
+
+	p99 = fr_time_delta_to_msec(fr_metric_quantile(metric, 0.99));
+	TEST_CHECK((p99 >= 990) && (p99 <= 1114));
+	TEST_MSG("p99 %" PRId64 "ms", p99);
+
+	fr_metric_observe(metric, fr_time_delta_wrap(-1));
+	fr_metric_observe(metric, fr_time_delta_from_sec(86400));
+	TEST_CHECK(fr_metric_count(metric) == 1002);
+}
+
+static void metrics_test_print(void)
+{
+	fr_metric_t	*metric;
+	char		*buffer = NULL;
+	size_t		len = 0;
+	FILE		*fp;
+
+	metric = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "test_print_seconds", "Test histogram",
+				    "module", "sql \"main\"", NULL);
+	TEST_ASSERT(metric != NULL);
+	fr_metric_observe(metric, fr_time_delta_from_usec(100));
+
+	fp = open_memstream(&buffer, &len);
+	TEST_ASSERT(fp != NULL);
+	fr_metrics_print(fp);
+	fclose(fp);
+
+	TEST_CHECK(strstr(buffer, "# TYPE test_print_seconds summary\n") != NULL);
+	TEST_CHECK(strstr(buffer, "test_print_seconds{module=\"sql \\\"main\\\"\",quantile=\"0.99\"}") != NULL);
+	TEST_CHECK(strstr(buffer, "test_print_seconds_count{module=\"sql \\\"main\\\"\"} 1\n") != NULL);
+	TEST_MSG("%s", buffer);
+
+	free(buffer);
+}
+
+/** Cost of recording a duration
+ *
+ */
+static void metrics_bench_observe(void)
+{
+	fr_metric_t	*metric;
+	fr_time_t	start, end;
+	unsigned int	i;
+
+	metric = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "test_bench_seconds", "Test histogram", NULL);
+	TEST_ASSERT(metric != NULL);
+
+	start = fr_time();
+	for (i = 0; i < 10000000; i++) fr_metric_observe(metric, fr_time_delta_wrap(i));
+	end = fr_time();
+
+	TEST_MSG_ALWAYS("observe: %.1fns per call", fr_time_delta_unwrap(fr_time_sub(end, start)) / 10000000.0);
+}
+
+TEST_LIST = {
+	{ "metrics_test_register",	metrics_test_register },
+	{ "metrics_test_threads",	metrics_test_threads },
+	{ "metrics_test_quantile",	metrics_test_quantile },
+	{ "metrics_test_print",		metrics_test_print },
+	{ "metrics_bench_observe",	metrics_bench_observe },
+	{ NULL }
+};
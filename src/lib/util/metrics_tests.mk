@@ -0,0 +1,9 @@
+TARGET		:= metrics_tests$(E)
+SOURCES		:= metrics_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+
+TGT_PREREQS	+= libfreeradius-util$(L)
+
+TGT_INSTALLDIR	:=
@@ -26,6 +26,7 @@ RCSID("$Id$")
 #define _PAIR_PRIVATE 1
 #define _PAIR_INLINE 1
 
+#include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair.h>
@@ -107,6 +108,143 @@ static int _fr_pair_free(fr_pair_t *vp)
 	return 0;
 }
 
+/** Per-thread cache of pair allocations
+ *
+ * Pairs allocated whilst a cache is active are given a destructor which,
+ * instead of freeing the pair, frees its children, and parents it to
+ * the cache, so the memory can be reused by the next allocation.
+ *
+ * Each pair is also a small talloc pool, so short value buffers, and
+ * other children of the pair don't need allocations of their own.
+ */
+typedef struct {
+	fr_pair_t	**free;				//!< Pairs available for reuse.
+	unsigned int	num_free;			//!< How many pairs are available for reuse.
+	unsigned int	max_free;			//!< Maximum number of pairs to hold for reuse.
+	size_t		pool_size;			//!< Size of the pool allocated with each pair.
+} fr_pair_cache_t;
+
+static _Thread_local fr_pair_cache_t *pair_cache;
+
+/** Return a pair to the thread's cache, instead of freeing it
+ *
+ * @note Do not call directly, use talloc_free instead.
+ *
+ * @param vp to free.
+ * @return
+ *	- 0 if the pair should be freed.
+ *	- -1 if the pair was returned to the cache.
+ */
+static int _fr_pair_free_to_cache(fr_pair_t *vp)
+{
+	fr_pair_cache_t *cache = pair_cache;
+
+	(void)_fr_pair_free(vp);
+
+	if (!cache || (cache->num_free >= cache->max_free)) return 0;
+
+	/*
+	 *	Talloc leaves the pair alone if the
+	 *	destructor has reparented it.
+	 */
+	talloc_free_children(vp);
+	talloc_steal(cache, vp);
+	memset(vp, 0, sizeof(*vp));
+
+	cache->free[cache->num_free++] = vp;
+
+	return -1;
+}
+
+static int _pair_cache_free(void *uctx)
+{
+	fr_pair_cache_t *cache = talloc_get_type_abort(uctx, fr_pair_cache_t);
+
+	/*
+	 *	Stop pairs being returned to the
+	 *	cache as we free it.
+	 */
+	if (pair_cache == cache) pair_cache = NULL;
+
+	return talloc_free(cache);
+}
+
+/** Enable reuse of pair allocations for the current thread
+ *
+ * Once enabled, pairs freed by this thread are kept for reuse, up to
+ * max_free, and new pairs are taken from those kept, instead of being
+ * allocated.  Pairs remain normal talloc chunks, and are parented by
+ * the ctx passed to the allocation functions.  Freeing a request, or
+ * any other ctx, returns all the pairs it contains to the cache.
+ *
+ * The cache is freed when the thread exits.
+ *
+ * @param[in] max_free		Maximum number of pairs to keep for reuse.
+ * @param[in] pool_size		Bytes to allocate with each pair for value
+ *				buffers.  May be 0.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the cache has already been enabled for this thread.
+ */
+int fr_pair_thread_cache_init(unsigned int max_free, size_t pool_size)
+{
+	fr_pair_cache_t *cache;
+
+	if (pair_cache) {
+		fr_strerror_const("Pair cache already enabled for this thread");
+		return -1;
+	}
+
+	cache = talloc_zero(NULL, fr_pair_cache_t);
+	if (unlikely(!cache)) {
+	oom:
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	cache->free = talloc_array(cache, fr_pair_t *, max_free);
+	if (unlikely(!cache->free)) {
+		talloc_free(cache);
+		goto oom;
+	}
+	cache->max_free = max_free;
+	cache->pool_size = pool_size;
+
+	fr_atexit_thread_local(pair_cache, _pair_cache_free, cache);
+
+	return 0;
+}
+
+/** Allocate a pair from the thread's cache
+ *
+ */
+static inline CC_HINT(always_inline) fr_pair_t *pair_cache_alloc(fr_pair_cache_t *cache, TALLOC_CTX *ctx)
+{
+	fr_pair_t *vp;
+
+	if (cache->num_free > 0) {
+		vp = cache->free[--cache->num_free];
+		talloc_steal(ctx, vp);
+		return vp;
+	}
+
+	/*
+	 *	Allocate outside of ctx, so the pair is never
+	 *	carved out of a talloc pool, which it would
+	 *	pin in memory when cached.
+	 */
+	if (cache->pool_size) {
+		vp = talloc_pooled_object(NULL, fr_pair_t, 1, cache->pool_size);
+		if (unlikely(!vp)) return NULL;
+		memset(vp, 0, sizeof(*vp));
+	} else {
+		vp = talloc_zero(NULL, fr_pair_t);
+		if (unlikely(!vp)) return NULL;
+	}
+	talloc_set_destructor(vp, _fr_pair_free_to_cache);
+
+	return talloc_steal(ctx, vp);
+}
+
 /** Allocate a new pair list on the heap
  *
  * @param[in] ctx	to allocate the pair list in.
@@ -168,6 +306,17 @@ fr_pair_t *fr_pair_alloc_null(TALLOC_CTX *ctx)
 {
 	fr_pair_t *vp;
 
+	if (pair_cache) {
+		vp = pair_cache_alloc(pair_cache, ctx);
+		if (!vp) {
+			fr_strerror_printf("Out of memory");
+			return NULL;
+		}
+		pair_init_null(vp);
+
+		return vp;
+	}
+
 	vp = talloc_zero(ctx, fr_pair_t);
 	if (!vp) {
 		fr_strerror_printf("Out of memory");
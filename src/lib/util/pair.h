@@ -438,6 +438,16 @@ void fr_pair_list_init(fr_pair_list_t *head) CC_HINT(nonnull);
 void fr_pair_init_null(fr_pair_t *vp) CC_HINT(nonnull);
 
 /* Allocation and management */
+
+/** Bytes of value storage allocated with each pair in the thread cache
+ *
+ * Enough for most string and octets values, e.g. User-Name or
+ * Called-Station-Id, to be stored without a separate allocation.
+ */
+#define FR_PAIR_CACHE_VALUE_SIZE	64
+
+int		fr_pair_thread_cache_init(unsigned int max_free, size_t pool_size);
+
 fr_pair_t	*fr_pair_alloc_null(TALLOC_CTX *ctx) CC_HINT(warn_unused_result);
 
 fr_pair_list_t	*fr_pair_list_alloc(TALLOC_CTX *ctx) CC_HINT(warn_unused_result);
@@ -553,6 +553,31 @@ done:
 	FR_SBUFF_SET_RETURN(in, &our_in);
 }
 
+/** Skip blank lines and comments following a list of pairs
+ *
+ * @param[in] fp	to read from.
+ * @return true if there are no more pairs in the file.
+ */
+static bool pair_list_file_done(FILE *fp)
+{
+	int c;
+
+	while ((c = getc(fp)) != EOF) {
+		if ((c == '\n') || (c == '\r')) continue;
+
+		if (c != '#') {
+			ungetc(c, fp);
+			return false;
+		}
+
+		do {
+			c = getc(fp);
+		} while ((c != EOF) && (c != '\n'));
+	}
+
+	return true;
+}
+
 /** Read valuepairs from the fp up to End-Of-File.
  *
  * @param[in] ctx		for talloc
@@ -594,8 +619,9 @@ int fr_pair_list_afrom_file(TALLOC_CTX *ctx, fr_dict_t const *dict, fr_pair_list
 		 */
 		if ((buf[0] == '\n') || (buf[0] == '\r')) {
 			if (found) {
-				*pfiledone = false;
-				break;
+				fr_pair_list_append(out, &tmp_list);
+				*pfiledone = pair_list_file_done(fp);
+				return 0;
 			}
 			continue;
 		}
@@ -482,6 +482,139 @@ static void do_test_fr_pair_list_free(unsigned int len, unsigned int perc, unsig
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
+static void do_test_fr_pair_copy_free(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	fr_pair_list_t  test_vps;
+	unsigned int	i, j;
+	fr_pair_t	*new_vp;
+	fr_time_t	start, end;
+	fr_time_delta_t	used = fr_time_delta_wrap(0);
+	size_t		input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t	rand_ctx;
+	TALLOC_CTX	*ctx;
+
+	fr_pair_list_init(&test_vps);
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *  Copy pairs into a ctx, and free the ctx, in the same way
+	 *  pairs are decoded into, and released with, a request.
+	 */
+	for (i = 0; i < reps; i++) {
+		ctx = talloc_init_const("request");
+
+		start = fr_time();
+		for (j = 0; j < len; j++) {
+			int idx = fr_fast_rand(&rand_ctx) % input_count;
+			new_vp = fr_pair_copy(ctx, source_vps[idx]);
+			fr_pair_append(&test_vps, new_vp);
+		}
+		fr_pair_list_init(&test_vps);
+		talloc_free(ctx);
+		end = fr_time();
+		used = fr_time_delta_add(used, fr_time_sub(end, start));
+	}
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+/*
+ *  Must run after all tests which don't use the pair cache, as it
+ *  can't be disabled once enabled for a thread.
+ */
+static void do_test_fr_pair_copy_free_cached(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	static bool cache_init = false;
+
+	if (!cache_init) {
+		TEST_CHECK(fr_pair_thread_cache_init(1024, FR_PAIR_CACHE_VALUE_SIZE) == 0);
+		cache_init = true;
+	}
+
+	do_test_fr_pair_copy_free(len, perc, reps, source_vps);
+}
+
+#define FAN_OUT_CHILDREN	3
+
+/*
+ *  Clone a list into several children, and return each child's
+ *  list to the parent, in the same way as a parallel section
+ *  with subrequests.  per_sec counts the pairs handled by every
+ *  child.
+ */
+static void do_test_fan_out(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[], bool move)
+{
+	fr_pair_list_t  parent_vps, child_vps, result_vps;
+	unsigned int	i, j;
+	fr_pair_t	*new_vp;
+	fr_time_t	start, end;
+	fr_time_delta_t	used = fr_time_delta_wrap(0);
+	size_t		input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t	rand_ctx;
+	TALLOC_CTX	*ctx, *child_ctx;
+
+	fr_pair_list_init(&parent_vps);
+	fr_pair_list_init(&child_vps);
+	fr_pair_list_init(&result_vps);
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	for (i = 0; i < reps; i++) {
+		ctx = talloc_init_const("request");
+
+		for (j = 0; j < len; j++) {
+			int idx = fr_fast_rand(&rand_ctx) % input_count;
+			new_vp = fr_pair_copy(ctx, source_vps[idx]);
+			fr_pair_append(&parent_vps, new_vp);
+		}
+
+		start = fr_time();
+		for (j = 0; j < FAN_OUT_CHILDREN; j++) {
+			child_ctx = talloc_init_const("child");
+
+			TEST_CHECK(fr_pair_list_copy(child_ctx, &child_vps, &parent_vps) == (int)len);
+
+			if (move) {
+				fr_pair_list_steal(ctx, &child_vps);
+				fr_pair_list_append(&result_vps, &child_vps);
+			} else {
+				TEST_CHECK(fr_pair_list_copy(ctx, &result_vps, &child_vps) == (int)len);
+				fr_pair_list_init(&child_vps);
+			}
+
+			talloc_free(child_ctx);
+		}
+		end = fr_time();
+		used = fr_time_delta_add(used, fr_time_sub(end, start));
+
+		TEST_CHECK(fr_pair_list_num_elements(&result_vps) == (FAN_OUT_CHILDREN * len));
+		fr_pair_list_init(&parent_vps);
+		fr_pair_list_init(&result_vps);
+		talloc_free(ctx);
+	}
+	TEST_MSG_ALWAYS("repetitions=%d", reps);
+	TEST_MSG_ALWAYS("perc_rep=%d", perc);
+	TEST_MSG_ALWAYS("list_length=%d", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len * FAN_OUT_CHILDREN)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_fan_out_copy(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_fan_out(len, perc, reps, source_vps, false);
+}
+
+static void do_test_fan_out_move(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	do_test_fan_out(len, perc, reps, source_vps, true);
+}
+
 #define test_func(_func, _count, _perc, _source_vps) \
 static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 {\
@@ -506,6 +639,10 @@ all_test_funcs(fr_pair_append)
 all_test_funcs(fr_pair_find_by_da_idx)
 all_test_funcs(find_nth)
 all_test_funcs(fr_pair_list_free)
+all_test_funcs(fr_pair_copy_free)
+all_test_funcs(fan_out_copy)
+all_test_funcs(fan_out_move)
+all_test_funcs(fr_pair_copy_free_cached)
 
 #define repetition_tests(_func, _perc) \
 	{ #_func "_20_" #_perc, test_ ## _func ## _20_ ## _perc},\
@@ -526,6 +663,10 @@ TEST_LIST = {
 	all_repetition_tests(fr_pair_find_by_da_idx)
 	all_repetition_tests(find_nth)
 	all_repetition_tests(fr_pair_list_free)
+	all_repetition_tests(fr_pair_copy_free)
+	all_repetition_tests(fan_out_copy)
+	all_repetition_tests(fan_out_move)
+	all_repetition_tests(fr_pair_copy_free_cached)
 
 	{ NULL }
 };
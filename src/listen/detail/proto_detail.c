@@ -25,7 +25,9 @@
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/internal/internal.h>
 #include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/util/pair_legacy.h>
 
 #include "proto_detail.h"
@@ -188,6 +190,90 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent,
 	return 0;
 }
 
+/** Decode a binary detail record
+ *
+ * The record header carries the original addresses, protocol and
+ * timestamp.  The rest of the record is the internal encoding of the
+ * request pairs.
+ */
+static int decode_binary(proto_detail_t const *inst, request_t *request, uint8_t *const data, size_t data_len)
+{
+	fr_detail_record_t	rec;
+	fr_pair_t		*vp;
+	fr_pair_list_t		tmp_list;
+	fr_dbuff_t		dbuff;
+
+	if (fr_detail_record_hdr_decode(&rec, data, data_len) < 0) {
+		REDEBUG("Malformed binary record header");
+		return -1;
+	}
+
+	if ((FR_DETAIL_RECORD_HDR_LEN + rec.length) > data_len) {
+		REDEBUG("Truncated binary record, expected %u bytes of pairs, got %zu",
+			rec.length, data_len - FR_DETAIL_RECORD_HDR_LEN);
+		return -1;
+	}
+
+	/*
+	 *	The record's pairs are decoded with the listener's
+	 *	dictionary, and processed by its virtual server, so
+	 *	records written by a different protocol can't be
+	 *	replayed here.
+	 */
+	if (fr_dict_by_protocol_num(rec.protocol) != inst->dict) {
+		fr_dict_t const *dict = fr_dict_by_protocol_num(rec.protocol);
+
+		if (!dict) {
+			REDEBUG("Invalid protocol: %u", rec.protocol);
+		} else {
+			REDEBUG("Record is for protocol %s, but this listener uses %s",
+				fr_dict_root(dict)->name, fr_dict_root(inst->dict)->name);
+		}
+		return -1;
+	}
+
+	if (rec.src_ipaddr.af != AF_UNSPEC) {
+		request->packet->socket.inet.src_ipaddr = rec.src_ipaddr;
+		request->packet->socket.inet.dst_ipaddr = rec.dst_ipaddr;
+	}
+	request->packet->socket.inet.src_port = rec.src_port;
+	request->packet->socket.inet.dst_port = rec.dst_port;
+
+	fr_pair_list_init(&tmp_list);
+
+	vp = fr_pair_afrom_da(request->request_ctx, attr_packet_original_timestamp);
+	if (vp) {
+		vp->vp_date = rec.timestamp;
+		fr_pair_append(&tmp_list, vp);
+	}
+
+	/*
+	 *	Same as the "Packet-Type = ..." line in text records.
+	 */
+	if (rec.code) {
+		vp = fr_pair_afrom_da(request->request_ctx, inst->attr_packet_type);
+		if (vp) {
+			vp->vp_uint32 = rec.code;
+			fr_pair_append(&tmp_list, vp);
+		}
+	}
+
+	fr_dbuff_init(&dbuff, data + FR_DETAIL_RECORD_HDR_LEN, (size_t) rec.length);
+	if (fr_internal_decode_list_dbuff(request->request_ctx, &tmp_list,
+					  fr_dict_root(request->dict), &dbuff, NULL) < 0) {
+		RPEDEBUG("Failed decoding binary record");
+		fr_pair_list_free(&tmp_list);
+		return -1;
+	}
+
+	fr_pair_list_append(&request->request_pairs, &tmp_list);
+
+	/*
+	 *	Let the app_io take care of populating additional fields in the request
+	 */
+	return inst->app_io->decode(inst->app_io_instance, request, data, data_len);
+}
+
 /** Decode the packet, and set the request->process function
  *
  */
@@ -218,6 +304,8 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	request->reply->socket.inet.src_ipaddr = request->packet->socket.inet.src_ipaddr;
 	request->reply->socket.inet.dst_ipaddr = request->packet->socket.inet.src_ipaddr;
 
+	if (fr_detail_record_is_binary(data, data_len)) return decode_binary(inst, request, data, data_len);
+
 	end = data + data_len;
 
 	MPRINT("HEADER %s", data);
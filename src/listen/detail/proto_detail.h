@@ -90,6 +90,7 @@ struct proto_detail_work_s {
 
 	fr_retry_config_t		retry_config;		//!< retry config with irt, mrt, etc.
 	uint16_t			max_outstanding;	//!< number of packets to run in parallel
+	bool				max_outstanding_is_set;	//!< otherwise binary files use a larger default
 
 	bool				track_progress;		//!< do we track progress by writing?
 	bool				retransmit;		//!< are we retransmitting on error?
@@ -120,11 +121,15 @@ struct proto_detail_work_thread_s {
 	fr_dlist_head_t			list;			//!< for retransmissions
 
 	uint32_t       			outstanding;		//!< number of currently outstanding records;
+	uint16_t			max_outstanding;	//!< for this file, which depends on its format.
 	fr_time_delta_t			lock_interval;		//!< interval between trying the locks.
 
 	bool				eof;			//!< are we at EOF on reading?
 	bool				closing;		//!< we should be closing the file
 	bool				paused;			//!< Is reading paused?
+	bool				binary;			//!< Is this a binary detail file?
+
+	uint8_t const			*map;			//!< of a binary file, file_size bytes long.
 
 	int				count;			//!< number of packets we read from this file.
 
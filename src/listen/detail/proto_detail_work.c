@@ -23,6 +23,7 @@
  * @copyright 2017 Alan DeKok (aland@deployingradius.com)
  */
 #include <netdb.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/server/main_loop.h>
@@ -32,6 +33,7 @@
 #include "proto_detail.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef NDEBUG
@@ -49,12 +51,21 @@
 #define MPRINT(_x, ...)
 #endif
 
+/*
+ *	Binary records are cheap to read, and the reader doesn't have to
+ *	re-parse anything.  So unless told otherwise, we keep many of
+ *	them in flight.
+ */
+#define DETAIL_BINARY_MAX_OUTSTANDING	64
+
 typedef struct {
 	proto_detail_work_thread_t	*parent;		//!< talloc_parent is SLOW!
 	fr_time_t			timestamp;		//!< when we read the entry.
 	off_t				done_offset;		//!< where we're tracking the status
+								///< for binary files, the start of the record.
 
 	int				id;			//!< for retransmission counters
+	uint32_t			transmit_count;		//!< from previous runs over a binary file.
 
 	uint8_t				*packet;		//!< for retransmissions
 	size_t				packet_len;		//!< for retransmissions
@@ -76,7 +87,7 @@ static conf_parser_t limit_config[] = {
 	 *	...again same as v2 and v3.
 	 */
 	{ FR_CONF_OFFSET("max_rtx_duration", proto_detail_work_t, retry_config.mrd), .dflt = STRINGIFY(0) },
-	{ FR_CONF_OFFSET("max_outstanding", proto_detail_work_t, max_outstanding), .dflt = STRINGIFY(1) },
+	{ FR_CONF_OFFSET_IS_SET("max_outstanding", FR_TYPE_UINT16, 0, proto_detail_work_t, max_outstanding), .dflt = STRINGIFY(1) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -126,7 +137,7 @@ static int mod_decode(void const *instance, request_t *request, UNUSED uint8_t *
 	REQUEST_VERIFY(request);
 
 	MEM(pair_update_request(&vp, attr_packet_transmit_counter) >= 0);
-	vp->vp_uint32 = track->retry.count;
+	vp->vp_uint32 = track->transmit_count + track->retry.count;
 
 	return 0;
 }
@@ -141,6 +152,85 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+/** Find the next pending record in a binary detail file
+ *
+ * The file is mapped into memory, so we just walk the record headers,
+ * and copy the record we want into the buffer.
+ *
+ * @return
+ *	- <0 on error.
+ *	- 0 if there are no more records to read.
+ *	- >0 the length of the record copied into the buffer.
+ */
+static ssize_t work_read_binary(proto_detail_work_thread_t *thread, void **packet_ctx, fr_time_t *recv_time_p,
+				uint8_t *buffer, size_t buffer_len)
+{
+	proto_detail_work_t const	*inst = thread->inst;
+	fr_detail_record_t		rec;
+	fr_detail_entry_t		*track;
+	uint8_t const			*p;
+	size_t				record_len;
+	off_t				record_offset;
+
+	while ((thread->read_offset + FR_DETAIL_RECORD_HDR_LEN) <= thread->file_size) {
+		p = thread->map + thread->read_offset;
+
+		if (fr_detail_record_hdr_decode(&rec, p, thread->file_size - thread->read_offset) < 0) {
+			ERROR("proto_detail (%s): Malformed record found at offset %zu in file %s",
+			      thread->name, (size_t) thread->read_offset, thread->filename_work);
+			return -1;
+		}
+
+		record_len = FR_DETAIL_RECORD_HDR_LEN + rec.length;
+
+		/*
+		 *	The writer died part way through the last record.
+		 */
+		if ((thread->read_offset + record_len) > (size_t) thread->file_size) {
+			DEBUG("Ignoring truncated entry at offset %zu of %s",
+			      (size_t) thread->read_offset, thread->filename_work);
+			break;
+		}
+
+		record_offset = thread->read_offset;
+		thread->read_offset += record_len;
+
+		if (rec.status == FR_DETAIL_RECORD_DONE) continue;
+
+		if ((record_len > buffer_len) || (record_len > inst->parent->max_packet_size)) {
+			DEBUG("Ignoring 'too large' entry at offset %zu of %s",
+			      (size_t) record_offset, thread->filename_work);
+			DEBUG("Entry size %zu is greater than allowed maximum %u",
+			      record_len, inst->parent->max_packet_size);
+			continue;
+		}
+
+		memcpy(buffer, p, record_len);
+
+		track = talloc_zero(thread, fr_detail_entry_t);
+		track->parent = thread;
+		track->timestamp = fr_time();
+		track->id = thread->count++;
+		track->done_offset = record_offset;
+		track->transmit_count = rec.transmit_count;
+
+		if (inst->retransmit) {
+			track->packet = talloc_memdup(track, buffer, record_len);
+			track->packet_len = record_len;
+		}
+
+		thread->header_offset = thread->read_offset;
+		thread->eof = (thread->read_offset >= thread->file_size);
+
+		*packet_ctx = track;
+		*recv_time_p = track->timestamp;
+		return record_len;
+	}
+
+	thread->eof = true;
+	return 0;
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
@@ -203,11 +293,31 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 *	many packets.  So if we want to stop it from reading,
 	 *	we have to check this ourselves.
 	 */
-	if (thread->outstanding >= inst->max_outstanding) {
+	if (thread->outstanding >= thread->max_outstanding) {
 		fr_assert(thread->paused);
 		return 0;
 	}
 
+	if (thread->binary) {
+		*leftover = 0;
+
+		data_size = work_read_binary(thread, packet_ctx, recv_time_p, buffer, buffer_len);
+		if (data_size < 0) return -1;
+
+		/*
+		 *	Nothing left to replay.  If nothing is in
+		 *	flight, then we're done with the file.
+		 */
+		if (data_size == 0) {
+			thread->closing = true;
+			if (!thread->outstanding) return -1;
+			return 0;
+		}
+
+		packet_len = data_size;
+		goto done;
+	}
+
 	/*
 	 *	If we've cached leftover data from the ring buffer,
 	 *	copy it back.
@@ -516,7 +626,7 @@ done:
 	/*
 	 *	Pause reading until such time as we need more packets.
 	 */
-	if (!thread->paused && (thread->outstanding >= inst->max_outstanding)) {
+	if (!thread->paused && (thread->outstanding >= thread->max_outstanding)) {
 		(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, pause_read);
 		thread->paused = true;
 
@@ -546,7 +656,7 @@ static void work_retransmit(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, vo
 
 	fr_dlist_insert_tail(&thread->list, track);
 
-	if (thread->paused && (thread->outstanding < thread->inst->max_outstanding)) {
+	if (thread->paused && (thread->outstanding < thread->max_outstanding)) {
 		(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, resume_read);
 		thread->paused = false;
 	}
@@ -614,7 +724,20 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 			goto free_track;
 		}
 
-		if (!thread->paused && (thread->outstanding >= inst->max_outstanding)) {
+		/*
+		 *	Remember the retransmissions, so that they're
+		 *	not lost if the server restarts.
+		 */
+		if (thread->binary && inst->track_progress) {
+			uint8_t count[4];
+
+			fr_nbo_from_uint32(count, track->transmit_count + track->retry.count);
+			if (pwrite(thread->fd, count, sizeof(count), track->done_offset + FR_DETAIL_RECORD_COUNT_OFFSET) < 0) {
+				ERROR("%s - Failed updating entry: %s", thread->name, fr_syserror(errno));
+			}
+		}
+
+		if (!thread->paused && (thread->outstanding >= thread->max_outstanding)) {
 			(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, pause_read);
 			thread->paused = true;
 		}
@@ -623,6 +746,20 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
+		/*
+		 *	Binary records have a status byte, which we can
+		 *	update without disturbing the file offset.
+		 */
+		if (thread->binary) {
+			uint8_t status = FR_DETAIL_RECORD_DONE;
+
+			if (inst->track_progress &&
+			    (pwrite(thread->fd, &status, 1, track->done_offset + FR_DETAIL_RECORD_STATUS_OFFSET) < 0)) {
+				ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
+			}
+			goto free_track;
+		}
+
 		/*
 		 *	Seek to the entry, mark it as done, and then seek to
 		 *	the point in the file where we were reading from.
@@ -640,7 +777,7 @@ free_track:
 	/*
 	 *	If we need to read some more packet, let's do so.
 	 */
-	if (thread->paused && (thread->outstanding < inst->max_outstanding)) {
+	if (thread->paused && (thread->outstanding < thread->max_outstanding)) {
 		(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, resume_read);
 		thread->paused = false;
 
@@ -677,6 +814,8 @@ static int mod_open(fr_listen_t *li)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
 	proto_detail_work_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_detail_work_thread_t);
+	uint8_t				hdr[FR_DETAIL_FILE_HDR_LEN];
+	struct stat			buf;
 
 	fr_dlist_init(&thread->list, fr_detail_entry_t, entry);
 
@@ -693,12 +832,38 @@ static int mod_open(fr_listen_t *li)
 		}
 	}
 
+	thread->max_outstanding = inst->max_outstanding;
+
 	/*
-	 *	If we're tracking progress, learn where the EOF is.
+	 *	Binary files are mapped into memory, and we walk
+	 *	through the records without calling read().
 	 */
-	if (inst->track_progress) {
-		struct stat buf;
+	thread->binary = (pread(thread->fd, hdr, sizeof(hdr), 0) == sizeof(hdr)) &&
+			 fr_detail_file_is_binary(hdr, sizeof(hdr));
+	if (thread->binary) {
+		if (fstat(thread->fd, &buf) < 0) {
+			cf_log_err(inst->cs, "Failed examining %s: %s", thread->filename_work, fr_syserror(errno));
+			return -1;
+		}
 
+		thread->file_size = buf.st_size;
+		thread->map = mmap(NULL, thread->file_size, PROT_READ, MAP_SHARED, thread->fd, 0);
+		if (thread->map == MAP_FAILED) {
+			thread->map = NULL;
+			cf_log_err(inst->cs, "Failed mapping %s: %s", thread->filename_work, fr_syserror(errno));
+			return -1;
+		}
+#ifdef MADV_SEQUENTIAL
+		(void) madvise(UNCONST(uint8_t *, thread->map), thread->file_size, MADV_SEQUENTIAL);
+#endif
+
+		thread->header_offset = thread->read_offset = FR_DETAIL_FILE_HDR_LEN;
+		if (!inst->max_outstanding_is_set) thread->max_outstanding = DETAIL_BINARY_MAX_OUTSTANDING;
+
+	/*
+	 *	If we're tracking progress, learn where the EOF is.
+	 */
+	} else if (inst->track_progress) {
 		if (fstat(thread->fd, &buf) < 0) {
 			cf_log_err(inst->cs, "Failed examining %s: %s", thread->filename_work, fr_syserror(errno));
 			return -1;
@@ -756,6 +921,11 @@ static int mod_close_internal(proto_detail_work_thread_t *thread)
 
 	if (thread->outstanding == 0) unlink(thread->filename_work);
 
+	if (thread->map) {
+		(void) munmap(UNCONST(uint8_t *, thread->map), thread->file_size);
+		thread->map = NULL;
+	}
+
 	close(thread->fd);
 	thread->fd = -1;
 
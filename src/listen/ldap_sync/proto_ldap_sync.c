@@ -37,6 +37,14 @@ extern fr_app_t proto_ldap_sync;
 
 static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent, CONF_ITEM *ci, conf_parser_t const *rule);
 
+static conf_parser_t const ldap_sync_replica_config[] = {
+	{ FR_CONF_OFFSET("name", sync_config_t, replica_name) },
+	{ FR_CONF_OFFSET_FLAGS("attribute", CONF_FLAG_MULTI, sync_config_t, replica_attrs) },
+	{ FR_CONF_OFFSET_FLAGS("index", CONF_FLAG_MULTI, sync_config_t, replica_index) },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static conf_parser_t const ldap_sync_search_config[] = {
 	{ FR_CONF_OFFSET("base_dn", sync_config_t, base_dn), .dflt = "", .quote = T_SINGLE_QUOTED_STRING },
 
@@ -46,6 +54,8 @@ static conf_parser_t const ldap_sync_search_config[] = {
 	/* For persistent search directories, setting this to "no" will load the whole directory. */
 	{ FR_CONF_OFFSET("changes_only", sync_config_t, changes_only), .dflt = "yes" },
 
+	{ FR_CONF_POINTER("replica", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) ldap_sync_replica_config },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -353,7 +363,41 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		sync_conf->attrs = talloc_array(sync_conf, char const *, 1);
 		sync_conf->attrs[0] = NULL;
 
-		if (map_list_empty(&sync_conf->entry_map)) {
+		/*
+		 *	Changes are applied to an in-memory replica as well as
+		 *	being passed to the virtual server.
+		 */
+		if (sync_conf->replica_name) {
+			char const * const	*attr;
+
+			/*
+			 *	The replica can only be used once it holds
+			 *	every entry, so always load the whole directory.
+			 */
+			sync_conf->changes_only = false;
+
+			if (sync_conf->replica_attrs) {
+				for (attr = sync_conf->replica_attrs; *attr; attr++) ldap_sync_conf_attr_add(sync_conf, *attr);
+			}
+			if (sync_conf->replica_index) {
+				for (attr = sync_conf->replica_index; *attr; attr++) ldap_sync_conf_attr_add(sync_conf, *attr);
+			}
+
+			sync_conf->replica = fr_ldap_replica_alloc(sync_conf, sync_conf->replica_name);
+			if (!sync_conf->replica) {
+			replica_error:
+				cf_log_perr(sync_cs, "Failed initialising replica \"%s\"", sync_conf->replica_name);
+				return -1;
+			}
+
+			if (sync_conf->replica_index) {
+				for (attr = sync_conf->replica_index; *attr; attr++) {
+					if (fr_ldap_replica_index_add(sync_conf->replica, *attr) < 0) goto replica_error;
+				}
+			}
+		}
+
+		if (map_list_empty(&sync_conf->entry_map) && !sync_conf->replica) {
 			cf_log_warn(conf, "LDAP sync specified without update map");
 			continue;
 		}
@@ -385,6 +429,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 			ldap_sync_conf_attr_add(sync_conf, map->rhs->name);
 		}
 
+		/*
+		 *	The replica holds whichever attributes the sync retrieves,
+		 *	with an empty list the directory returns them all.
+		 */
+		if (sync_conf->replica &&
+		    (fr_ldap_replica_source_add(sync_conf->replica, sync_conf,
+						sync_conf->base_dn, sync_conf->scope, sync_conf->filter,
+						sync_conf->attrs[0] ? sync_conf->attrs : NULL) < 0)) {
+			cf_log_perr(sync_cs, "Failed initialising replica \"%s\"", sync_conf->replica_name);
+			return -1;
+		}
+
 		/*
 		 *	Build the list of pairs representing the sync config
 		 */
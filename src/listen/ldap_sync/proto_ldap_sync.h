@@ -129,6 +129,11 @@ struct sync_config_s {
 
 	char const		*root_dn;		//!< The root DN for the directory.
 
+	char const		*replica_name;		//!< Name of the replica to apply changes to.
+	char const		**replica_attrs;	//!< Attributes to copy into the replica.
+	char const		**replica_index;	//!< Attributes to index in the replica.
+	fr_ldap_replica_t	*replica;		//!< Replica to apply changes to.
+
 	CONF_SECTION		*cs;			//!< Config section where this sync was defined.
 							//!< Used for logging.
 
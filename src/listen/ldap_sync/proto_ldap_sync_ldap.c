@@ -403,6 +403,52 @@ static fr_ldap_sync_packet_code_t const sync_packet_code_table[4] = {
 	FR_LDAP_SYNC_CODE_DELETE
 };
 
+/** Apply a change to the replica the sync feeds
+ *
+ * @param[in] sync	notification has arrived for.
+ * @param[in] uuid	of the entry (RFC 4533 only).
+ * @param[in] orig_dn	original DN of the entry, if it was renamed.
+ * @param[in] msg	containing the entry.
+ * @param[in] op	The type of modification.
+ */
+static void ldap_sync_replica_apply(sync_state_t *sync, uint8_t const uuid[SYNC_UUID_LENGTH], struct berval *orig_dn,
+				    LDAPMessage *msg, sync_op_t op)
+{
+	fr_ldap_replica_t	*replica = sync->config->replica;
+	size_t			uuid_len = uuid ? SYNC_UUID_LENGTH : 0;
+	char			*dn = NULL;
+
+	switch (op) {
+	case SYNC_OP_ADD:
+	case SYNC_OP_MODIFY:
+		if (!msg) return;
+
+		/*
+		 *	Renamed entries are replaced by the entry with the new DN
+		 */
+		if (orig_dn && (orig_dn->bv_len > 0)) {
+			char *old_dn = talloc_bstrndup(NULL, orig_dn->bv_val, orig_dn->bv_len);
+
+			fr_ldap_replica_entry_delete(replica, NULL, 0, old_dn);
+			talloc_free(old_dn);
+		}
+
+		if (fr_ldap_replica_entry_update(replica, sync->config, uuid, uuid_len, sync->conn->handle, msg) < 0) {
+			PERROR("Failed updating replica \"%s\"", sync->config->replica_name);
+		}
+		break;
+
+	case SYNC_OP_DELETE:
+		if (msg) dn = ldap_get_dn(sync->conn->handle, msg);
+		fr_ldap_replica_entry_delete(replica, uuid, uuid_len, dn);
+		if (dn) ldap_memfree(dn);
+		break;
+
+	default:
+		break;
+	}
+}
+
 /** Enqueue a new entry change packet.
  *
  * @param[in] sync	notification has arrived for.
@@ -439,6 +485,8 @@ int ldap_sync_entry_send(sync_state_t *sync, uint8_t const uuid[SYNC_UUID_LENGTH
 
 	pcode = sync_packet_code_table[op];
 
+	if (sync->config->replica) ldap_sync_replica_apply(sync, uuid, orig_dn, msg, op);
+
 	fr_pair_list_append_by_da(sync_packet_ctx, vp, pairs, attr_packet_type, (uint32_t)pcode, false);
 	if (!vp) goto error;
 
@@ -754,6 +802,17 @@ static ssize_t proto_ldap_child_mod_read(fr_listen_t *li, UNUSED void **packet_c
 	}
 	if (ret < 0) goto sync_error;
 
+	/*
+	 *	Once the initial refresh has completed the replica
+	 *	holds every entry from this sync.
+	 */
+	if (sync->config->replica && !sync->replica_ready && (sync->phase == SYNC_PHASE_DONE)) {
+		fr_ldap_replica_source_ready(sync->config->replica, sync->config, true);
+		sync->replica_ready = true;
+		trigger_exec(unlang_interpret_get_thread_default(), sync->config->cs, "ldap_sync.replica_ready",
+			     true, &sync->trigger_args);
+	}
+
 	ldap_controls_free(ctrls);
 
 	return 0;
@@ -850,6 +909,35 @@ static int proto_ldap_cookie_load_send(TALLOC_CTX *ctx, proto_ldap_sync_ldap_t c
 	return 0;
 }
 
+/** Start a sync
+ *
+ * Replicas are not persistent, so syncs which feed one always start without a
+ * cookie, and the directory sends every entry again.  Any entries the replica
+ * holds from a previous run of the sync are discarded.
+ *
+ * @param[in] conn	to start the sync on.
+ * @param[in] sync_no	number of the sync in the array of configs.
+ * @param[in] inst	instance of ldap_sync the sync relates to.
+ * @param[in] cookie	to resume the sync from.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int ldap_sync_start(fr_ldap_connection_t *conn, size_t sync_no, proto_ldap_sync_t const *inst,
+			   uint8_t const *cookie)
+{
+	sync_config_t const	*config = inst->sync_config[sync_no];
+
+	if (config->replica) {
+		if (cookie) DEBUG2("Ignoring cookie for sync %zu, replica \"%s\" requires a full refresh",
+				   sync_no, config->replica_name);
+		fr_ldap_replica_clear(config->replica, config);
+		cookie = NULL;
+	}
+
+	return config->init(conn, sync_no, inst, cookie);
+}
+
 /** Timer event to retry running "load Cookie" on failures
  *
  */
@@ -930,7 +1018,7 @@ static ssize_t proto_ldap_child_mod_write(fr_listen_t *li, void *packet_ctx, UNU
 		vp = fr_pair_find_by_da_nested(&tmp, NULL, attr_ldap_sync_cookie);
 		if (vp) cookie = talloc_memdup(inst, vp->vp_octets, vp->vp_length);
 
-		if (inst->parent->sync_config[packet_id]->init(thread->conn->h, packet_id, inst->parent, cookie) < 0) {
+		if (ldap_sync_start(thread->conn->h, packet_id, inst->parent, cookie) < 0) {
 			ret = -1;
 			goto finish;
 		}
@@ -952,8 +1040,7 @@ static ssize_t proto_ldap_child_mod_write(fr_listen_t *li, void *packet_ctx, UNU
 		sync_config = sync_packet_ctx->sync->config;
 		DEBUG3("Restarting sync with base %s", sync_config->base_dn);
 		talloc_free(sync_packet_ctx->sync);
-		if (inst->parent->sync_config[packet_id]->init(thread->conn->h, packet_id, inst->parent,
-								  sync_packet_ctx->cookie) < 0) {
+		if (ldap_sync_start(thread->conn->h, packet_id, inst->parent, sync_packet_ctx->cookie) < 0) {
 			ret = -1;
 			goto finish;
 		}
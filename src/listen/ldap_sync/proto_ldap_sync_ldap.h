@@ -56,6 +56,8 @@ struct sync_state_s {
 
 	sync_phases_t			phase;		//!< Phase this sync is in.
 
+	bool				replica_ready;	//!< Replica has been told the refresh completed.
+
 	fr_dlist_head_t			*filter;	//!< Parsed filter to be applied on the network side
 							//!< before passing packets to the worker.
 							//!< Predominantly to overcome Active Directory's lack
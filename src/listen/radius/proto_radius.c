@@ -80,6 +80,8 @@ static conf_parser_t const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("tunnel_password_zeros", proto_radius_t, tunnel_password_zeros) } ,
 
+	{ FR_CONF_OFFSET("pass_through", proto_radius_t, pass_through), .dflt = "no" } ,
+
 	{ FR_CONF_POINTER("limit", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	{ FR_CONF_POINTER("priority", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) priority_config },
 
@@ -197,8 +199,9 @@ static int transport_parse(TALLOC_CTX *ctx, void *out, UNUSED void *parent, CONF
 /** Decode the packet
  *
  */
-static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *const data, size_t data_len)
+static int mod_decode(void const *instance, request_t *request, uint8_t *const data, size_t data_len)
 {
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
 	fr_io_track_t const	*track = talloc_get_type_abort_const(request->async->packet_ctx, fr_io_track_t);
 	fr_io_address_t const  	*address = track->address;
 	fr_client_t const	*client;
@@ -306,6 +309,25 @@ static int mod_decode(UNUSED void const *instance, request_t *request, uint8_t *
 		}
 	}
 
+	/*
+	 *	Remember the packet, so that it can be proxied without
+	 *	re-encoding it, if nothing changes its attributes.
+	 */
+	if (inst->pass_through && client->active) {
+		fr_radius_pass_through_t *pt;
+
+		MEM(pt = talloc_zero(request, fr_radius_pass_through_t));
+		pt->data = request->packet->data;
+		pt->data_len = request->packet->data_len;
+		pt->secret = client->secret;
+		pt->secret_length = talloc_array_length(client->secret) - 1;
+		pt->hash = fr_radius_pass_through_hash(&request->request_pairs, true);
+
+		(void) request_data_talloc_add(request, (void const *)fr_radius_encode_pass_through,
+					       FR_RADIUS_PASS_THROUGH_REQUEST, fr_radius_pass_through_t, pt,
+					       true, false, false);
+	}
+
 	/*
 	 *	Set the sequence to be at least one.  This will
 	 *	prioritize replies to Access-Challenges over other
@@ -333,6 +355,7 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 	fr_io_address_t const  	*address = track->address;
 	ssize_t			data_len;
 	fr_client_t const		*client;
+	fr_radius_pass_through_t const	*pt;
 
 	/*
 	 *	Process layer NAK, or "Do not respond".
@@ -395,6 +418,23 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 		request->reply->socket.inet.src_ipaddr = client->src_ipaddr;
 	}
 
+	/*
+	 *	If the reply came from a home server, and nothing has
+	 *	changed it, forward the attributes we received.
+	 */
+	pt = request_data_reference(request, (void const *)fr_radius_encode_pass_through, FR_RADIUS_PASS_THROUGH_REPLY);
+	if (pt && (pt->data[0] == request->reply->code) &&
+	    (pt->hash == fr_radius_pass_through_hash(&request->reply_pairs, false))) {
+		data_len = fr_radius_encode_pass_through(buffer, buffer_len, request->packet->data, pt,
+							 client->secret, talloc_array_length(client->secret) - 1,
+							 request->reply->code, request->reply->id,
+							 &request->reply_pairs, false);
+		if (data_len > 0) {
+			RDEBUG3("Reply attributes are unchanged, forwarding the attributes received from the home server");
+			goto sign;
+		}
+	}
+
 	data_len = fr_radius_encode(buffer, buffer_len, request->packet->data,
 				    client->secret, talloc_array_length(client->secret) - 1,
 				    request->reply->code, request->reply->id, &request->reply_pairs);
@@ -403,6 +443,7 @@ static ssize_t mod_encode(UNUSED void const *instance, request_t *request, uint8
 		return -1;
 	}
 
+sign:
 	if (fr_radius_sign(buffer, request->packet->data + 4,
 			   (uint8_t const *) client->secret, talloc_array_length(client->secret) - 1) < 0) {
 		RPEDEBUG("Failed signing RADIUS reply");
@@ -37,6 +37,9 @@ typedef struct {
 
 	bool				tunnel_password_zeros;		//!< check for trailing zeroes in Tunnel-Password.
 
+	bool				pass_through;			//!< Remember received packets, so that they can
+									///< be proxied without being re-encoded.
+
 	uint32_t			priorities[FR_RADIUS_CODE_MAX];	//!< priorities for individual packets
 
 	char const			**allowed_types;		//!< names for for 'type = ...'
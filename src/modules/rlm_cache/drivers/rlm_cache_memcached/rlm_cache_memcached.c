@@ -181,7 +181,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
+	if (!cache_serialized_is_binary((uint8_t *)from_store, len)) RDEBUG2("%s", from_store);
 
 	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
 	ret = cache_deserialize(c, request->dict, from_store, len);
@@ -206,7 +206,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, UNUSED void *instance,
 					 request_t *request, void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_memcached_handle_t *mandle = handle;
@@ -215,19 +215,31 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 
 	TALLOC_CTX *pool;
 	char *to_store;
+	size_t to_store_len;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
-		talloc_free(pool);
+	switch (config->serialize) {
+	case CACHE_SERIALIZE_BINARY:
+		if (cache_serialize_binary(pool, (uint8_t **)&to_store, c) < 0) {
+		error:
+			RPERROR("Failed serializing entry");
+			talloc_free(pool);
 
-		return CACHE_ERROR;
+			return CACHE_ERROR;
+		}
+		to_store_len = talloc_array_length(to_store);
+		break;
+
+	default:
+		if (cache_serialize(pool, &to_store, c) < 0) goto error;
+		to_store_len = to_store ? talloc_array_length(to_store) - 1 : 0;
+		break;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key.vb_strvalue, c->key.vb_length,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, fr_unix_time_to_sec(c->expires), 0);
+		            to_store ? to_store : "", to_store_len, fr_unix_time_to_sec(c->expires), 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
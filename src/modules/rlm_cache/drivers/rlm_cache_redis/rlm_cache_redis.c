@@ -28,6 +28,7 @@
 #include <freeradius-devel/util/value.h>
 
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
 static conf_parser_t driver_config[] = {
@@ -174,6 +175,24 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_MISS;
 	}
 
+	/*
+	 *	Binary entries are stored as a single element,
+	 *	text entries are always triplets.
+	 */
+	if ((reply->elements == 1) && (reply->element[0]->type == REDIS_REPLY_STRING) &&
+	    cache_serialized_is_binary((uint8_t const *)reply->element[0]->str, reply->element[0]->len)) {
+		MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+		map_list_init(&c->maps);
+
+		if (cache_deserialize_binary(c, (uint8_t const *)reply->element[0]->str, reply->element[0]->len) < 0) {
+			RPERROR("Invalid entry");
+			talloc_free(c);
+			goto error;
+		}
+		fr_redis_reply_free(&reply);
+		goto finish;
+	}
+
 	if (reply->elements % 3) {
 		REDEBUG("Invalid number of reply elements (%zu).  "
 			"Reply must contain triplets of keys operators and values",
@@ -237,9 +256,13 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		talloc_free(map);
 	}
 
-	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) goto error;
-
 	map_list_move(&c->maps, &head);
+
+finish:
+	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) {
+		talloc_free(c);
+		goto error;
+	}
 	*out = c;
 
 	return CACHE_OK;
@@ -250,7 +273,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
 					 request_t *request, UNUSED void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_redis_t	*driver = instance;
@@ -317,6 +340,32 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	pool = talloc_pool(request, 1024);
 	if (!pool) return CACHE_ERROR;
 
+	/*
+	 *	Binary entries are a single list element, which
+	 *	lets find() distinguish them from text entries.
+	 */
+	if (config->serialize == CACHE_SERIALIZE_BINARY) {
+		uint8_t	*to_store;
+
+		if (cache_serialize_binary(pool, &to_store, c) < 0) {
+			RPERROR("Failed serializing entry");
+			talloc_free(pool);
+			return CACHE_ERROR;
+		}
+
+		argv = talloc_array(pool, char const *, 3);
+		argv_len = talloc_array(pool, size_t, 3);
+
+		argv[0] = command;
+		argv_len[0] = sizeof(command) - 1;
+		argv[1] = (char const *)c->key.vb_strvalue;
+		argv_len[1] = c->key.vb_length;
+		argv[2] = (char const *)to_store;
+		argv_len[2] = talloc_array_length(to_store);
+
+		goto send;
+	}
+
 	argv_p = argv = talloc_array(pool, char const *, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 	argv_len_p = argv_len = talloc_array(pool, size_t, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 
@@ -353,6 +402,7 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		argv_len_p += 3;
 	}
 
+send:
 	RDEBUG3("Pipelining commands");
 
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, (uint8_t const *)c->key.vb_strvalue, c->key.vb_length, false);
@@ -40,6 +40,12 @@ extern module_rlm_t rlm_cache;
 
 static int cache_update_section_parse(TALLOC_CTX *ctx, call_env_parsed_head_t *out, tmpl_rules_t const *t_rules, CONF_ITEM *ci, UNUSED call_env_parser_t const *rule);
 
+static fr_table_num_sorted_t const cache_serialize_table[] = {
+	{ L("binary"),	CACHE_SERIALIZE_BINARY	},
+	{ L("text"),	CACHE_SERIALIZE_TEXT	}
+};
+static size_t cache_serialize_table_len = NUM_ELEMENTS(cache_serialize_table);
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("driver", FR_TYPE_VOID, 0, rlm_cache_t, driver_submodule), .dflt = "rbtree",
 			 .func = module_rlm_submodule_parse },
@@ -49,6 +55,9 @@ static const conf_parser_t module_config[] = {
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", rlm_cache_config_t, stats), .dflt = "no" },
+	{ FR_CONF_OFFSET("serialize", rlm_cache_config_t, serialize), .dflt = "text",
+			 .func = cf_table_parse_int,
+			 .uctx = &(cf_table_parse_ctx_t){ .table = cache_serialize_table, .len = &cache_serialize_table_len } },
 	CONF_PARSER_TERMINATOR
 };
 
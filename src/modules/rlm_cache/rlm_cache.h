@@ -43,6 +43,14 @@ typedef enum {
 	CACHE_MISS	= 1				//!< Cache entry notfound
 } cache_status_t;
 
+/** Formats drivers may use to store cache entries
+ *
+ */
+typedef enum {
+	CACHE_SERIALIZE_TEXT = 0,			//!< Human readable "<attr> <op> <value>" lines.
+	CACHE_SERIALIZE_BINARY				//!< Compact binary encoding, much cheaper to decode.
+} cache_serialize_t;
+
 /** Configuration for the rlm_cache module
  *
  * This is separate from the #rlm_cache_t struct, to limit driver's visibility of
@@ -53,6 +61,7 @@ typedef struct {
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+	cache_serialize_t	serialize;		//!< Format used by drivers which have to serialize entries.
 } rlm_cache_config_t;
 
 /*
@@ -28,6 +28,29 @@ RCSID("$Id$")
 #include "rlm_cache.h"
 #include "serialize.h"
 
+#include <freeradius-devel/util/proto.h>
+
+/** Leading bytes of a binary cache entry
+ *
+ * Starts with a NUL so it can never be confused with a text entry, which
+ * always starts with an attribute name.
+ */
+static uint8_t const cache_binary_magic[] = { 0x00, 'F', 'R', 'C' };
+
+#define CACHE_BINARY_VERSION	1
+
+/** Lists which may appear on the LHS of a binary cache entry
+ *
+ * The index into this array is what's written to the entry, so new
+ * lists must only ever be added to the end.
+ */
+static fr_dict_attr_t const **cache_binary_lists[] = {
+	[1] = &request_attr_request,
+	[2] = &request_attr_reply,
+	[3] = &request_attr_control,
+	[4] = &request_attr_state
+};
+
 /** Serialize a cache entry as a humanly readable string
  *
  * @param ctx to alloc new string in. Should be a talloc pool a little bigger
@@ -106,6 +129,12 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 
 	if (inlen < 0) inlen = strlen(in);
 
+	/*
+	 *	Entries written in the binary format can be
+	 *	read back regardless of the configured format.
+	 */
+	if (cache_serialized_is_binary((uint8_t *)in, inlen)) return cache_deserialize_binary(c, (uint8_t *)in, inlen);
+
 	p = in;
 
 	while (((size_t)(p - in)) < (size_t)inlen) {
@@ -178,3 +207,275 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 
 	return 0;
 }
+
+/** Check whether a serialized cache entry is in the binary format
+ *
+ * @param[in] in	Serialized cache entry.
+ * @param[in] inlen	Length of the serialized cache entry.
+ * @return
+ *	- true if the entry starts with the binary magic.
+ *	- false if it's (probably) a text entry.
+ */
+bool cache_serialized_is_binary(uint8_t const *in, size_t inlen)
+{
+	if (inlen < sizeof(cache_binary_magic)) return false;
+
+	return (memcmp(in, cache_binary_magic, sizeof(cache_binary_magic)) == 0);
+}
+
+/** Encode a single cache map
+ *
+ * Each map is encoded as:
+ *
+ @verbatim
+   list (1) | op (1) | protocol (4) | depth (1) | attr (4) * depth | value len (4) | value
+ @endverbatim
+ *
+ * The value is in the network format of the attribute, as produced by
+ * #fr_value_box_to_network.
+ *
+ * @param[in] dbuff	to write the map to.
+ * @param[in] map	to encode.
+ * @return
+ *	- >0 the number of bytes written.
+ *	- <0 on error.
+ */
+static ssize_t cache_map_to_network(fr_dbuff_t *dbuff, map_t const *map)
+{
+	fr_dbuff_t		work_dbuff = FR_DBUFF(dbuff);
+	fr_dbuff_marker_t	len_m;
+	fr_dict_attr_t const	*da = tmpl_attr_tail_da(map->lhs);
+	fr_dict_attr_t const	*list = tmpl_list(map->lhs);
+	fr_dict_t const		*dict;
+	fr_da_stack_t		da_stack;
+	uint8_t			list_num = 0;
+	unsigned int		i;
+	ssize_t			slen;
+
+	if (!tmpl_request_ref_is_current(tmpl_request(map->lhs))) {
+		fr_strerror_printf("Can't serialize \"%s\", only attributes in the current request may be cached",
+				   map->lhs->name);
+		return FR_VALUE_BOX_NET_ERROR;
+	}
+
+	if (da->flags.is_unknown || fr_type_is_structural(da->type)) {
+		fr_strerror_printf("Can't serialize \"%s\", binary format only supports known leaf attributes",
+				   map->lhs->name);
+		return FR_VALUE_BOX_NET_ERROR;
+	}
+
+	if (list) {
+		for (i = 1; i < NUM_ELEMENTS(cache_binary_lists); i++) {
+			if (*cache_binary_lists[i] == list) {
+				list_num = i;
+				break;
+			}
+		}
+		if (!list_num) {
+			fr_strerror_printf("Can't serialize \"%s\", list \"%s\" not supported",
+					   map->lhs->name, list->name);
+			return FR_VALUE_BOX_NET_ERROR;
+		}
+	}
+
+	/*
+	 *	The internal dictionary doesn't have a protocol
+	 *	number, so it gets 0, which no protocol uses.
+	 */
+	dict = fr_dict_by_da(da);
+	FR_DBUFF_IN_RETURN(&work_dbuff, list_num);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t)map->op);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t)((dict == fr_dict_internal()) ? 0 : fr_dict_root(dict)->attr));
+
+	fr_proto_da_stack_build(&da_stack, da);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint8_t)da_stack.depth);
+	for (i = 0; i < da_stack.depth; i++) FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t)da_stack.da[i]->attr);
+
+	/*
+	 *	Value length gets filled in once we know it
+	 */
+	fr_dbuff_marker(&len_m, &work_dbuff);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint32_t)0);
+
+	slen = fr_value_box_to_network(&work_dbuff, tmpl_value(map->rhs));
+	if (slen < 0) return slen;
+
+	fr_dbuff_in(&len_m, (uint32_t)slen);
+
+	return fr_dbuff_set(dbuff, &work_dbuff);
+}
+
+/** Serialize a cache entry in a compact binary format
+ *
+ * This is much cheaper to decode than the text format as no parsing is
+ * required, attributes are located by number, and values are in their
+ * network format.
+ *
+ * @param[in] ctx	to allocate the serialized entry in.
+ * @param[out] out	Where to write pointer to serialized cache entry.
+ *			The length of the entry is the length of the talloc array.
+ * @param[in] c		Cache entry to serialize.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	map_t			*map = NULL;
+	ssize_t			slen;
+
+	if (unlikely(!fr_dbuff_init_talloc(ctx, &dbuff, &tctx, 256, SIZE_MAX))) return -1;
+
+	if ((fr_dbuff_in_memcpy(&dbuff, cache_binary_magic, sizeof(cache_binary_magic)) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint8_t)CACHE_BINARY_VERSION) < 0) ||
+	    (fr_dbuff_in(&dbuff, fr_unix_time_unwrap(c->created)) < 0) ||
+	    (fr_dbuff_in(&dbuff, fr_unix_time_unwrap(c->expires)) < 0)) {
+	oom:
+		fr_strerror_const("Out of memory serializing cache entry");
+	error:
+		talloc_free(fr_dbuff_buff(&dbuff));
+		return -1;
+	}
+
+	while ((map = map_list_next(&c->maps, map))) {
+		slen = cache_map_to_network(&dbuff, map);
+		if (slen == FR_VALUE_BOX_NET_ERROR) goto error;
+		if (slen < 0) goto oom;
+	}
+
+	if (fr_dbuff_trim_talloc(&dbuff, fr_dbuff_used(&dbuff)) < 0) goto oom;
+
+	*out = fr_dbuff_buff(&dbuff);
+
+	return 0;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param[in] c		Cache entry to populate (should already be allocated)
+ * @param[in] in	Binary representation of cache entry.
+ * @param[in] inlen	Length of binary data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen)
+{
+	fr_dbuff_t		dbuff = FR_DBUFF_TMP(in, inlen);
+	tmpl_t			*list_vpt[NUM_ELEMENTS(cache_binary_lists)] = { NULL };
+	uint8_t			version;
+	int64_t			created, expires;
+	map_t			*map = NULL;
+	unsigned int		i;
+	int			ret = -1;
+
+	if (!cache_serialized_is_binary(in, inlen)) {
+		fr_strerror_const("Missing binary cache entry header");
+		return -1;
+	}
+	fr_dbuff_advance(&dbuff, sizeof(cache_binary_magic));
+
+	if ((fr_dbuff_out(&version, &dbuff) < 0) ||
+	    (fr_dbuff_out(&created, &dbuff) < 0) ||
+	    (fr_dbuff_out(&expires, &dbuff) < 0)) {
+	truncated:
+		fr_strerror_const("Binary cache entry truncated");
+		goto finish;
+	}
+
+	if (version != CACHE_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported binary cache entry version %u", version);
+		goto finish;
+	}
+
+	c->created = fr_unix_time_wrap(created);
+	c->expires = fr_unix_time_wrap(expires);
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		uint8_t			list_num, op, depth;
+		uint32_t		proto, num, len;
+		fr_dict_t const		*dict;
+		fr_dict_attr_t const	*da;
+
+		if ((fr_dbuff_out(&list_num, &dbuff) < 0) ||
+		    (fr_dbuff_out(&op, &dbuff) < 0) ||
+		    (fr_dbuff_out(&proto, &dbuff) < 0) ||
+		    (fr_dbuff_out(&depth, &dbuff) < 0)) goto truncated;
+
+		if ((list_num >= NUM_ELEMENTS(cache_binary_lists)) || (op >= T_TOKEN_LAST) ||
+		    (depth == 0) || (depth > FR_DICT_MAX_TLV_STACK)) {
+			fr_strerror_const("Malformed binary cache entry");
+			goto finish;
+		}
+
+		dict = proto ? fr_dict_by_protocol_num(proto) : fr_dict_internal();
+		if (!dict) {
+			fr_strerror_printf("No dictionary loaded for protocol %u", proto);
+			goto finish;
+		}
+
+		da = fr_dict_root(dict);
+		for (i = 0; i < depth; i++) {
+			fr_dict_attr_t const *parent = da;
+
+			if (fr_dbuff_out(&num, &dbuff) < 0) goto truncated;
+
+			da = fr_dict_attr_child_by_num(parent, num);
+			if (!da) {
+				fr_strerror_printf("No attribute %u in %s.  Check local dictionaries", num, parent->name);
+				goto finish;
+			}
+		}
+
+		if (fr_dbuff_out(&len, &dbuff) < 0) goto truncated;
+		if (len > fr_dbuff_remaining(&dbuff)) goto truncated;
+
+		MEM(map = talloc_zero(c, map_t));
+		map->op = op;
+		map_list_init(&map->child);
+
+		/*
+		 *	Lists are all the same, so we build the
+		 *	head of the reference once and copy it
+		 *	for every attribute.
+		 */
+		if (list_num) {
+			if (!list_vpt[list_num]) {
+				MEM(list_vpt[list_num] = tmpl_alloc(NULL, TMPL_TYPE_ATTR, T_BARE_WORD, NULL, 0));
+				tmpl_attr_set_da(list_vpt[list_num], *cache_binary_lists[list_num]);
+				tmpl_attr_set_request_ref(list_vpt[list_num], &tmpl_request_def_current);
+			}
+			if (tmpl_attr_afrom_list(map, &map->lhs, list_vpt[list_num], da) < 0) {
+			error:
+				talloc_free(map);
+				goto finish;
+			}
+		} else {
+			MEM(map->lhs = tmpl_alloc(map, TMPL_TYPE_ATTR, T_BARE_WORD, da->name, -1));
+			tmpl_attr_set_da(map->lhs, da);
+			tmpl_attr_set_request_ref(map->lhs, &tmpl_request_def_current);
+		}
+
+		MEM(map->rhs = tmpl_alloc(map, TMPL_TYPE_DATA,
+					  (da->type == FR_TYPE_STRING) ? T_DOUBLE_QUOTED_STRING : T_BARE_WORD,
+					  NULL, 0));
+		if (fr_value_box_from_network(map->rhs, tmpl_value(map->rhs), da->type, da,
+					      &dbuff, len, false) < 0) {
+			fr_strerror_printf_push("Failed decoding value for %s", da->name);
+			goto error;
+		}
+
+		MAP_VERIFY(map);
+
+		map_list_insert_tail(&c->maps, map);
+	}
+
+	ret = 0;
+
+finish:
+	for (i = 0; i < NUM_ELEMENTS(list_vpt); i++) talloc_free(list_vpt[i]);
+
+	return ret;
+}
@@ -27,10 +27,12 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/cf_util.h>
+#include <freeradius-devel/server/detail.h>
 #include <freeradius-devel/server/exfile.h>
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/perm.h>
+#include <freeradius-devel/internal/internal.h>
 
 #include <ctype.h>
 #include <fcntl.h>
@@ -46,12 +48,24 @@ RCSID("$Id$")
 
 #define DIRLEN	8192		//!< Maximum path length.
 
+typedef enum {
+	DETAIL_FORMAT_TEXT = 0,		//!< "Attr = value" lines, readable by humans.
+	DETAIL_FORMAT_BINARY		//!< Length prefixed records, see lib/server/detail.h.
+} rlm_detail_format_t;
+
+static fr_table_num_sorted_t const detail_format_table[] = {
+	{ L("binary"),	DETAIL_FORMAT_BINARY	},
+	{ L("text"),	DETAIL_FORMAT_TEXT	},
+};
+static size_t detail_format_table_len = NUM_ELEMENTS(detail_format_table);
+
 /** Instance configuration for rlm_detail
  *
  * Holds the configuration and preparsed data for a instance of rlm_detail.
  */
 typedef struct {
 	char const	*filename;	//!< File/path to write to.
+	rlm_detail_format_t	format;	//!< Text or binary records.
 	uint32_t	perm;		//!< Permissions to use for new files.
 	gid_t		group;		//!< Resolved group.
 	bool		group_is_set;	//!< Whether group was set.
@@ -75,6 +89,8 @@ int detail_group_parse(UNUSED TALLOC_CTX *ctx, void *out, void *parent,
 
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_OUTPUT | CONF_FLAG_XLAT, rlm_detail_t, filename), .dflt = "%A/%{Net.Src.IP}/detail" },
+	{ FR_CONF_OFFSET("format", rlm_detail_t, format), .dflt = "text",
+			 .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = detail_format_table, .len = &detail_format_table_len } },
 	{ FR_CONF_OFFSET_FLAGS("header", CONF_FLAG_XLAT, rlm_detail_t, header), .dflt = "%t", .quote = T_DOUBLE_QUOTED_STRING },
 	{ FR_CONF_OFFSET("permissions", rlm_detail_t, perm), .dflt = "0600" },
 	{ FR_CONF_OFFSET_IS_SET("group", FR_TYPE_VOID, 0, rlm_detail_t, group), .func = detail_group_parse },
@@ -390,6 +406,107 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	return 0;
 }
 
+/** Write a single binary detail record to a file descriptor
+ *
+ * The record is built in memory and written with a single write(),
+ * so that concurrent writers to the same file don't interleave
+ * partial records.
+ *
+ * @param[in] fd Where to write the record.
+ * @param[in] offset of the end of the file.  If zero, the file header is written first.
+ * @param[in] inst Instance of rlm_detail.
+ * @param[in] request The current request.
+ * @param[in] packet associated with the request (request, reply...).
+ * @param[in] list of pairs to write.
+ * @param[in] compat Write out entry in compatibility mode.
+ */
+static int detail_write_binary(int fd, off_t offset, rlm_detail_t const *inst, request_t *request,
+			       fr_radius_packet_t *packet, fr_pair_list_t *list, bool compat)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	fr_dcursor_t		cursor;
+	fr_pair_t		*vp;
+	fr_detail_record_t	rec;
+	uint8_t			*start;
+	size_t			hdr_len, len;
+	ssize_t			slen;
+	int			ret = -1;
+
+	if (fr_pair_list_empty(list)) {
+		RWDEBUG("Skipping empty packet");
+		return 0;
+	}
+
+	hdr_len = FR_DETAIL_RECORD_HDR_LEN;
+	if (offset == 0) hdr_len += FR_DETAIL_FILE_HDR_LEN;
+
+	MEM(fr_dbuff_init_talloc(NULL, &dbuff, &tctx, 1024, 65536));
+
+	/*
+	 *	Leave room for the headers, they're filled in once we
+	 *	know how long the encoded pairs are.
+	 */
+	if (fr_dbuff_memset(&dbuff, 0, hdr_len) < 0) {
+		RERROR("Failed allocating detail record");
+		goto done;
+	}
+
+	/*
+	 *	Only pairs from the request's own dictionary can be
+	 *	decoded by the reader.  The source and destination
+	 *	addresses go into the record header instead.
+	 */
+	for (vp = fr_pair_dcursor_init(&cursor, list);
+	     vp;
+	     vp = fr_dcursor_current(&cursor)) {
+		if ((fr_dict_by_da(vp->da) != request->dict) ||
+		    (inst->ht && fr_hash_table_find(inst->ht, vp->da)) ||
+		    (compat && (vp->da == attr_user_password))) {
+			fr_dcursor_next(&cursor);
+			continue;
+		}
+
+		slen = fr_internal_encode_pair(&dbuff, &cursor, NULL);
+		if (slen < 0) {
+			RPERROR("Failed encoding detail record");
+			goto done;
+		}
+	}
+
+	start = fr_dbuff_start(&dbuff);
+	len = fr_dbuff_used(&dbuff);
+
+	if (offset == 0) {
+		fr_detail_file_hdr_encode(start);
+		start += FR_DETAIL_FILE_HDR_LEN;
+	}
+
+	rec = (fr_detail_record_t) {
+		.status = FR_DETAIL_RECORD_PENDING,
+		.length = len - hdr_len,
+		.timestamp = fr_time_to_unix_time(request->packet->timestamp),
+		.protocol = fr_dict_root(request->dict)->attr,
+		.code = compat ? 0 : packet->code,
+		.src_ipaddr = request->packet->socket.inet.src_ipaddr,
+		.dst_ipaddr = request->packet->socket.inet.dst_ipaddr,
+		.src_port = request->packet->socket.inet.src_port,
+		.dst_port = request->packet->socket.inet.dst_port,
+	};
+	fr_detail_record_hdr_encode(start, &rec);
+
+	if (write(fd, fr_dbuff_start(&dbuff), len) != (ssize_t) len) {
+		RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+		goto done;
+	}
+
+	ret = 0;
+
+done:
+	fr_dbuff_free_talloc(&dbuff);
+	return ret;
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -398,6 +515,7 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 						  bool compat)
 {
 	int		outfd, dupfd;
+	off_t		offset;
 	char		buffer[DIRLEN];
 
 	FILE		*outfp = NULL;
@@ -415,7 +533,7 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 
 	RDEBUG2("%s expands to %s", inst->filename, buffer);
 
-	outfd = exfile_open(inst->ef, buffer, inst->perm, NULL);
+	outfd = exfile_open(inst->ef, buffer, inst->perm, &offset);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %s", buffer);
 		*p_result = RLM_MODULE_FAIL;
@@ -430,6 +548,13 @@ static unlang_action_t CC_HINT(nonnull) detail_do(rlm_rcode_t *p_result, module_
 		}
 	}
 
+	if (inst->format == DETAIL_FORMAT_BINARY) {
+		if (detail_write_binary(outfd, offset, inst, request, packet, list, compat) < 0) goto fail;
+
+		exfile_close(inst->ef, outfd);
+		RETURN_MODULE_OK;
+	}
+
 	dupfd = dup(outfd);
 	if (dupfd < 0) {
 		RERROR("Failed to dup() file descriptor for detail file");
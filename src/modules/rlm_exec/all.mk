@@ -1,6 +1,6 @@
 TARGETNAME	:= rlm_exec
 
 TARGET		:= $(TARGETNAME)$(L)
-SOURCES		:= $(TARGETNAME).c
+SOURCES		:= $(TARGETNAME).c coproc.c
 
 LOG_ID_LIB	= 17
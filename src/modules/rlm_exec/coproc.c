@@ -0,0 +1,896 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file coproc.c
+ * @brief Persistent helper processes for rlm_exec.
+ *
+ * Instead of forking the server for every call, each worker thread
+ * starts a small pool of helpers with posix_spawn(), and passes
+ * requests to them over pipes.
+ *
+ * All integers are in network byte order.  A request is:
+ *
+ @verbatim
+	uint32	length of everything which follows
+	uint8	type (1 = call, 2 = ping)
+	uint16	number of arguments
+	uint16	number of environment variables
+	char	arguments, then environment variables, each \0 terminated
+ @endverbatim
+ *
+ * and the response is:
+ *
+ @verbatim
+	uint32	length of everything which follows
+	int32	status, interpreted as an exit code
+	char	output, interpreted as program output
+ @endverbatim
+ *
+ * A helper handles one request at a time, and must send exactly one
+ * response for each request it reads, including pings.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#define LOG_PREFIX pool->name
+
+#include <freeradius-devel/server/log.h>
+#include <freeradius-devel/unlang/interpret.h>
+#include <freeradius-devel/util/dict.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#if defined(__linux__) && defined(HAVE_DIRENT_H)
+#  include <dirent.h>
+#endif
+
+#ifdef __FreeBSD__
+#  include <sys/param.h>
+#endif
+
+#include "coproc.h"
+
+#if defined(__APPLE__) || defined(__FreeBSD__)
+extern char **environ;
+#endif
+
+#ifdef __GLIBC__
+#  if __GLIBC_PREREQ(2, 34)
+#    define HAVE_SPAWN_CLOSEFROM
+#  endif
+#elif defined(__FreeBSD_version) && (__FreeBSD_version >= 1301000)
+#  define HAVE_SPAWN_CLOSEFROM
+#endif
+
+#define EXEC_COPROC_MAX_ARGV	(64)		//!< Maximum number of words in the helper command line.
+
+#define EXEC_COPROC_HDR_LEN	(4)		//!< Length prefix.
+#define EXEC_COPROC_REQ_HDR_LEN	(EXEC_COPROC_HDR_LEN + 5)
+#define EXEC_COPROC_RES_HDR_LEN	(EXEC_COPROC_HDR_LEN + 4)
+
+typedef enum {
+	EXEC_COPROC_STATE_DEAD = 0,		//!< Not running, waiting to be respawned.
+	EXEC_COPROC_STATE_CLOSED,		//!< Pipes closed, waiting for the process to exit.
+	EXEC_COPROC_STATE_IDLE,			//!< Waiting for a request.
+	EXEC_COPROC_STATE_BUSY			//!< Waiting for a response to a call, or a ping.
+} exec_coproc_state_t;
+
+typedef struct {
+	exec_coproc_pool_t	*pool;			//!< Pool this helper belongs to.
+	unsigned int		id;			//!< Index of the helper in the pool.
+	exec_coproc_state_t	state;			//!< What the helper is doing.
+
+	pid_t			pid;			//!< Of the helper, or -1.
+	int			to_fd;			//!< We write requests here.
+	int			from_fd;		//!< We read responses from here.
+	fr_event_pid_t const	*ev_pid;		//!< Exit notification.
+	fr_event_timer_t const	*ev;			//!< Response timeout, or respawn timer.
+
+	exec_coproc_call_t	*call;			//!< Call in progress.  NULL if this is a ping,
+							///< or the call was cancelled.
+
+	uint8_t const		*out;			//!< Request being written, NULL once it's all sent.
+	size_t			out_len;		//!< Length of the request.
+	size_t			written;		//!< How much of the request has been written.
+	uint8_t			*out_owned;		//!< Request of a call which was cancelled while it
+							///< was being written.  Freed once it's all sent.
+	bool			writing;		//!< Waiting for to_fd to become writable.
+
+	uint8_t			*buff;			//!< Response being read.
+	size_t			used;			//!< How much of the buffer holds data.
+} exec_coproc_t;
+
+struct exec_coproc_pool_s {
+	exec_coproc_conf_t const *conf;			//!< Pool configuration.
+	char const		*name;			//!< Module instance name, for logging.
+	fr_event_list_t		*el;			//!< Worker thread's event list.
+
+	char			**argv;			//!< Helper command line.
+	char			**envp;			//!< Helper environment.
+
+	exec_coproc_t		**procs;		//!< Array of helpers.
+	fr_dlist_head_t		backlog;		//!< Calls waiting for an idle helper.
+	fr_event_timer_t const	*ev_health;		//!< Health check timer.
+};
+
+struct exec_coproc_call_s {
+	fr_dlist_t		entry;			//!< Entry in the backlog.
+	exec_coproc_pool_t	*pool;			//!< Pool the call was made to.
+	exec_coproc_t		*proc;			//!< Helper handling the call, if any.
+	request_t		*request;		//!< To resume when the call completes.
+
+	uint8_t			*frame;			//!< Encoded request.
+	size_t			frame_len;		//!< Length of the encoded request.
+
+	fr_event_timer_t const	*ev;			//!< Call timeout.
+	exec_coproc_result_t	result;			//!< Filled in when the call completes.
+};
+
+conf_parser_t const exec_coproc_config[] = {
+	{ FR_CONF_OFFSET("program", exec_coproc_conf_t, program) },
+	{ FR_CONF_OFFSET("processes", exec_coproc_conf_t, processes), .dflt = "2" },
+	{ FR_CONF_OFFSET("health_check_interval", exec_coproc_conf_t, health_check_interval), .dflt = "30s" },
+	{ FR_CONF_OFFSET("respawn_delay", exec_coproc_conf_t, respawn_delay), .dflt = "1s" },
+	CONF_PARSER_TERMINATOR
+};
+
+static int exec_coproc_spawn(exec_coproc_t *proc);
+static void exec_coproc_run_backlog(exec_coproc_t *proc);
+
+/** Complete a call, and resume the request which made it
+ *
+ */
+static void exec_coproc_call_finish(exec_coproc_call_t *call, char const *error)
+{
+	exec_coproc_pool_t	*pool = call->pool;
+
+	if (fr_dlist_entry_in_list(&call->entry)) fr_dlist_remove(&pool->backlog, call);
+	if (call->proc) {
+		call->proc->call = NULL;
+		call->proc = NULL;
+	}
+	if (call->ev) fr_event_timer_delete(&call->ev);
+
+	if (error) MEM(call->result.error = talloc_strdup(call, error));
+	unlang_interpret_mark_runnable(call->request);
+}
+
+/** Close our side of a helper, failing any call in progress, and kill it
+ *
+ * The exit notification will reap the process and schedule a respawn.
+ */
+static void exec_coproc_close(exec_coproc_t *proc, char const *error)
+{
+	exec_coproc_pool_t	*pool = proc->pool;
+
+	if ((proc->state == EXEC_COPROC_STATE_DEAD) || (proc->state == EXEC_COPROC_STATE_CLOSED)) return;
+
+	WARN("Closing co-process %u (PID %u): %s", proc->id, (unsigned int) proc->pid, error);
+
+	if (proc->from_fd >= 0) {
+		(void) fr_event_fd_delete(pool->el, proc->from_fd, FR_EVENT_FILTER_IO);
+		close(proc->from_fd);
+		proc->from_fd = -1;
+	}
+	if (proc->to_fd >= 0) {
+		if (proc->writing) (void) fr_event_fd_delete(pool->el, proc->to_fd, FR_EVENT_FILTER_IO);
+		close(proc->to_fd);
+		proc->to_fd = -1;
+	}
+	if (proc->ev) fr_event_timer_delete(&proc->ev);
+	proc->writing = false;
+	proc->out = NULL;
+	TALLOC_FREE(proc->out_owned);
+	proc->used = 0;
+	proc->state = EXEC_COPROC_STATE_CLOSED;
+
+	if (proc->call) exec_coproc_call_finish(proc->call, error);
+
+	if (proc->pid > 0) kill(proc->pid, SIGKILL);
+}
+
+static void exec_coproc_response_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	exec_coproc_t	*proc = talloc_get_type_abort(uctx, exec_coproc_t);
+
+	exec_coproc_close(proc, proc->call ? "Timeout waiting for response" : "Timeout waiting for health check response");
+}
+
+static void exec_coproc_write(fr_event_list_t *el, int fd, int flags, void *uctx);
+static void exec_coproc_error(fr_event_list_t *el, int fd, int flags, int fd_errno, void *uctx);
+
+/** Write as much of the current request as the pipe will take
+ *
+ * Pipe buffers can be smaller than a request, so anything left over is
+ * written when to_fd becomes writable.
+ *
+ * @param[in] proc	to write to.
+ * @return
+ *	- 0 on success, including if some of the request is still to be written.
+ *	- -1 on failure.  The helper should be closed.
+ */
+static int exec_coproc_flush(exec_coproc_t *proc)
+{
+	exec_coproc_pool_t	*pool = proc->pool;
+	ssize_t			slen;
+
+	while (proc->written < proc->out_len) {
+		slen = write(proc->to_fd, proc->out + proc->written, proc->out_len - proc->written);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+
+			fr_strerror_printf("Failed writing to co-process: %s", fr_syserror(errno));
+			return -1;
+		}
+		proc->written += slen;
+	}
+
+	if (proc->written < proc->out_len) {
+		if (proc->writing) return 0;
+
+		if (fr_event_fd_insert(proc, pool->el, proc->to_fd, NULL, exec_coproc_write,
+				       exec_coproc_error, proc) < 0) return -1;
+		proc->writing = true;
+		return 0;
+	}
+
+	if (proc->writing) {
+		(void) fr_event_fd_delete(pool->el, proc->to_fd, FR_EVENT_FILTER_IO);
+		proc->writing = false;
+	}
+	proc->out = NULL;
+	TALLOC_FREE(proc->out_owned);
+
+	return 0;
+}
+
+static void exec_coproc_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	exec_coproc_t	*proc = talloc_get_type_abort(uctx, exec_coproc_t);
+
+	if (exec_coproc_flush(proc) < 0) exec_coproc_close(proc, fr_strerror());
+}
+
+/** Write a request to an idle helper
+ *
+ * @param[in] proc	to write to.
+ * @param[in] call	to send, or NULL to send a ping.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The helper should be closed.
+ */
+static int exec_coproc_send(exec_coproc_t *proc, exec_coproc_call_t *call)
+{
+	exec_coproc_pool_t	*pool = proc->pool;
+	static uint8_t const	ping[EXEC_COPROC_REQ_HDR_LEN] = { 0x00, 0x00, 0x00, 0x05, EXEC_COPROC_TYPE_PING };
+
+	fr_assert(proc->state == EXEC_COPROC_STATE_IDLE);
+	fr_assert(!proc->out);
+
+	/*
+	 *	The timeout covers writing the request, too.
+	 */
+	if (fr_event_timer_in(proc, pool->el, &proc->ev, pool->conf->timeout,
+			      exec_coproc_response_timeout, proc) < 0) return -1;
+
+	proc->out = call ? call->frame : ping;
+	proc->out_len = call ? call->frame_len : sizeof(ping);
+	proc->written = 0;
+
+	proc->state = EXEC_COPROC_STATE_BUSY;
+	proc->call = call;
+	if (call) call->proc = proc;
+
+	if (exec_coproc_flush(proc) < 0) {
+		proc->call = NULL;
+		if (call) call->proc = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Read a response from a helper
+ *
+ */
+static void exec_coproc_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	exec_coproc_t		*proc = talloc_get_type_abort(uctx, exec_coproc_t);
+	exec_coproc_call_t	*call;
+	ssize_t			slen;
+	size_t			len;
+
+	slen = read(fd, proc->buff + proc->used, EXEC_COPROC_MAX_FRAME - proc->used);
+	if (slen < 0) {
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return;
+
+		exec_coproc_close(proc, fr_syserror(errno));
+		return;
+	}
+	if (slen == 0) {
+		exec_coproc_close(proc, "Co-process closed its output");
+		return;
+	}
+	proc->used += slen;
+
+	if (proc->used < EXEC_COPROC_HDR_LEN) return;
+
+	len = fr_nbo_to_uint32(proc->buff);
+	if ((len < (EXEC_COPROC_RES_HDR_LEN - EXEC_COPROC_HDR_LEN)) ||
+	    (len > (EXEC_COPROC_MAX_FRAME - EXEC_COPROC_HDR_LEN))) {
+		exec_coproc_close(proc, "Co-process sent a response with an invalid length");
+		return;
+	}
+	if (proc->used < (EXEC_COPROC_HDR_LEN + len)) return;
+
+	if ((proc->state != EXEC_COPROC_STATE_BUSY) || proc->out || (proc->used > (EXEC_COPROC_HDR_LEN + len))) {
+		exec_coproc_close(proc, "Co-process sent an unexpected response");
+		return;
+	}
+
+	if (proc->ev) fr_event_timer_delete(&proc->ev);
+	proc->used = 0;
+	proc->state = EXEC_COPROC_STATE_IDLE;
+
+	call = proc->call;
+	if (call) {
+		char const	*output = (char const *) proc->buff + EXEC_COPROC_RES_HDR_LEN;
+		size_t		output_len = len - (EXEC_COPROC_RES_HDR_LEN - EXEC_COPROC_HDR_LEN);
+
+		/*
+		 *	Remove trailing line endings, as we do for
+		 *	the output of programs.
+		 */
+		while ((output_len > 0) && ((output[output_len - 1] == '\n') || (output[output_len - 1] == '\r'))) {
+			output_len--;
+		}
+
+		call->result.status = fr_nbo_to_int32(proc->buff + EXEC_COPROC_HDR_LEN);
+		MEM(call->result.output = talloc_bstrndup(call, output, output_len));
+		call->result.output_len = output_len;
+
+		exec_coproc_call_finish(call, NULL);
+	}
+
+	exec_coproc_run_backlog(proc);
+}
+
+static void exec_coproc_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	exec_coproc_t	*proc = talloc_get_type_abort(uctx, exec_coproc_t);
+
+	exec_coproc_close(proc, fd_errno ? fr_syserror(fd_errno) : "Co-process closed its output");
+}
+
+static void exec_coproc_respawn(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	exec_coproc_t		*proc = talloc_get_type_abort(uctx, exec_coproc_t);
+	exec_coproc_pool_t	*pool = proc->pool;
+
+	if (exec_coproc_spawn(proc) < 0) {
+		PERROR("Failed restarting co-process %u", proc->id);
+
+		if (fr_event_timer_in(proc, pool->el, &proc->ev, pool->conf->respawn_delay,
+				      exec_coproc_respawn, proc) < 0) {
+			PERROR("Failed scheduling restart of co-process %u", proc->id);
+		}
+		return;
+	}
+
+	INFO("Restarted co-process %u (PID %u)", proc->id, (unsigned int) proc->pid);
+
+	exec_coproc_run_backlog(proc);
+}
+
+/** Reap a helper which has exited, and schedule a respawn
+ *
+ */
+static void exec_coproc_exited(fr_event_list_t *el, pid_t pid, int status, void *uctx)
+{
+	exec_coproc_t		*proc = talloc_get_type_abort(uctx, exec_coproc_t);
+	exec_coproc_pool_t	*pool = proc->pool;
+	int			wait_status = status;
+
+	/*
+	 *	kqueue notifies, but doesn't reap.
+	 */
+	if (waitpid(pid, &wait_status, WNOHANG) <= 0) wait_status = status;
+
+	/*
+	 *	Exit notifications and read events can race, so pick
+	 *	up any response which was written before the helper
+	 *	exited.
+	 */
+	if (proc->state == EXEC_COPROC_STATE_BUSY) exec_coproc_read(el, proc->from_fd, 0, proc);
+
+	if ((proc->state == EXEC_COPROC_STATE_IDLE) || (proc->state == EXEC_COPROC_STATE_BUSY)) {
+		if (WIFEXITED(wait_status)) {
+			exec_coproc_close(proc, "Co-process exited");
+			WARN("Co-process %u (PID %u) exited with status %d",
+			     proc->id, (unsigned int) pid, WEXITSTATUS(wait_status));
+		} else {
+			exec_coproc_close(proc, "Co-process was killed");
+			WARN("Co-process %u (PID %u) was killed by signal %d",
+			     proc->id, (unsigned int) pid, WIFSIGNALED(wait_status) ? WTERMSIG(wait_status) : 0);
+		}
+	}
+
+	proc->pid = -1;
+	proc->state = EXEC_COPROC_STATE_DEAD;
+
+	if (fr_event_timer_in(proc, el, &proc->ev, pool->conf->respawn_delay, exec_coproc_respawn, proc) < 0) {
+		PERROR("Failed scheduling restart of co-process %u", proc->id);
+	}
+}
+
+/** Create a pipe whose ends aren't inherited by anything we start
+ *
+ * Other threads may spawn at the same time, so the flag has to be
+ * set when the pipe is created.  dup2() in the child clears it on
+ * stdin and stdout.
+ */
+static int exec_coproc_pipe(int fds[2])
+{
+#ifdef HAVE_PIPE2
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if (pipe(fds) < 0) return -1;
+
+	(void) fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	(void) fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	return 0;
+#endif
+}
+
+/** Don't let helpers inherit descriptors other than stdin, stdout and stderr
+ *
+ * Libraries don't always open sockets and files close-on-exec.  Where
+ * posix_spawn() can't close everything itself, we ask it to close each
+ * descriptor which is open now.
+ *
+ * @param[in] actions	to add the close operations to.  Must be called
+ *			after the dup2() operations have been added.
+ * @param[in] attr	to set flags in.
+ * @param[in] flags	already set in attr.
+ */
+static void exec_coproc_closefrom(posix_spawn_file_actions_t *actions, UNUSED posix_spawnattr_t *attr, UNUSED short flags)
+{
+#if defined(HAVE_SPAWN_CLOSEFROM)
+	posix_spawn_file_actions_addclosefrom_np(actions, STDERR_FILENO + 1);
+#elif defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
+	/*
+	 *	Everything is closed except the targets of dup2(),
+	 *	and anything explicitly inherited.
+	 */
+	posix_spawn_file_actions_addinherit_np(actions, STDERR_FILENO);
+	posix_spawnattr_setflags(attr, flags | POSIX_SPAWN_CLOEXEC_DEFAULT);
+#else
+	int	fd, maxfd = 256;
+
+#  if defined(__linux__) && defined(HAVE_DIRENT_H)
+	DIR	*dir;
+
+	dir = opendir("/proc/self/fd");
+	if (dir) {
+		struct dirent	*dp;
+		char		*end;
+
+		while ((dp = readdir(dir)) != NULL) {
+			fd = (int) strtol(dp->d_name, &end, 10);
+			if (*end || (fd <= STDERR_FILENO) || (fd == dirfd(dir))) continue;
+
+			posix_spawn_file_actions_addclose(actions, fd);
+		}
+		closedir(dir);
+		return;
+	}
+#  endif
+
+#  ifdef _SC_OPEN_MAX
+	maxfd = (int) sysconf(_SC_OPEN_MAX);
+	if (maxfd < 0) maxfd = 256;
+#  endif
+
+	for (fd = STDERR_FILENO + 1; fd < maxfd; fd++) {
+		if (fcntl(fd, F_GETFD) < 0) continue;
+
+		posix_spawn_file_actions_addclose(actions, fd);
+	}
+#endif
+}
+
+/** Start a helper
+ *
+ * @param[in] proc	to start.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Error retrievable with fr_strerror().
+ */
+static int exec_coproc_spawn(exec_coproc_t *proc)
+{
+	exec_coproc_pool_t		*pool = proc->pool;
+	int				to_child[2] = { -1, -1 };
+	int				from_child[2] = { -1, -1 };
+	posix_spawn_file_actions_t	actions;
+	posix_spawnattr_t		attr;
+	sigset_t			sigs;
+	pid_t				pid;
+	int				ret;
+
+	fr_assert(proc->state == EXEC_COPROC_STATE_DEAD);
+
+	if ((exec_coproc_pipe(to_child) < 0) || (exec_coproc_pipe(from_child) < 0)) {
+		fr_strerror_printf("Failed creating pipes: %s", fr_syserror(errno));
+	error:
+		if (to_child[0] >= 0) close(to_child[0]);
+		if (to_child[1] >= 0) close(to_child[1]);
+		if (from_child[0] >= 0) close(from_child[0]);
+		if (from_child[1] >= 0) close(from_child[1]);
+		return -1;
+	}
+
+	/*
+	 *	The server blocks, and ignores, signals the helper
+	 *	will expect to be able to use.
+	 */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+	sigfillset(&sigs);
+	sigdelset(&sigs, SIGKILL);
+	sigdelset(&sigs, SIGSTOP);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, to_child[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, from_child[1], STDOUT_FILENO);
+	exec_coproc_closefrom(&actions, &attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+	ret = posix_spawn(&pid, pool->argv[0], &actions, &attr, pool->argv, pool->envp);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	close(to_child[0]);
+	to_child[0] = -1;
+	close(from_child[1]);
+	from_child[1] = -1;
+
+	if (ret != 0) {
+		fr_strerror_printf("Failed starting \"%s\": %s", pool->argv[0], fr_syserror(ret));
+		goto error;
+	}
+
+	if ((fr_nonblock(to_child[1]) < 0) || (fr_nonblock(from_child[0]) < 0)) {
+	error_kill:
+		kill(pid, SIGKILL);
+		if (fr_event_pid_reap(pool->el, pid, NULL, NULL) < 0) waitpid(pid, &ret, WNOHANG);
+		goto error;
+	}
+
+	proc->pid = pid;
+	proc->to_fd = to_child[1];
+	proc->from_fd = from_child[0];
+	proc->used = 0;
+	proc->state = EXEC_COPROC_STATE_IDLE;
+
+	/*
+	 *	The exit notification may fire immediately if the
+	 *	helper has already exited, so the read handler must
+	 *	be in place first.
+	 */
+	if (fr_event_fd_insert(proc, pool->el, proc->from_fd, exec_coproc_read, NULL, exec_coproc_error, proc) < 0) {
+	error_state:
+		proc->pid = -1;
+		proc->to_fd = -1;
+		proc->from_fd = -1;
+		proc->state = EXEC_COPROC_STATE_DEAD;
+		goto error_kill;
+	}
+
+	if (fr_event_pid_wait(proc, pool->el, &proc->ev_pid, pid, exec_coproc_exited, proc) < 0) {
+		(void) fr_event_fd_delete(pool->el, from_child[0], FR_EVENT_FILTER_IO);
+		goto error_state;
+	}
+
+	DEBUG2("Started co-process %u (PID %u)", proc->id, (unsigned int) pid);
+
+	return 0;
+}
+
+/** Give an idle helper the oldest call in the backlog
+ *
+ */
+static void exec_coproc_run_backlog(exec_coproc_t *proc)
+{
+	exec_coproc_pool_t	*pool = proc->pool;
+	exec_coproc_call_t	*call;
+
+	if (proc->state != EXEC_COPROC_STATE_IDLE) return;
+
+	call = fr_dlist_pop_head(&pool->backlog);
+	if (!call) return;
+
+	if (exec_coproc_send(proc, call) < 0) {
+		char const *error = fr_strerror();
+
+		exec_coproc_close(proc, error);
+		exec_coproc_call_finish(call, error);
+	}
+}
+
+static void exec_coproc_health_check(fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	exec_coproc_pool_t	*pool = talloc_get_type_abort(uctx, exec_coproc_pool_t);
+	uint32_t		i;
+
+	for (i = 0; i < pool->conf->processes; i++) {
+		exec_coproc_t *proc = pool->procs[i];
+
+		if (proc->state != EXEC_COPROC_STATE_IDLE) continue;
+
+		if (exec_coproc_send(proc, NULL) < 0) exec_coproc_close(proc, fr_strerror());
+	}
+
+	if (fr_event_timer_in(pool, el, &pool->ev_health, pool->conf->health_check_interval,
+			      exec_coproc_health_check, pool) < 0) {
+		PERROR("Failed scheduling co-process health check");
+	}
+}
+
+static int _exec_coproc_call_free(exec_coproc_call_t *call)
+{
+	exec_coproc_pool_t *pool = call->pool;
+
+	if (fr_dlist_entry_in_list(&call->entry)) fr_dlist_remove(&pool->backlog, call);
+
+	/*
+	 *	The helper is still working on the call, so it stays
+	 *	busy, and we discard the response when it arrives.
+	 *	If the request is still being written, the helper
+	 *	takes ownership of it.
+	 */
+	if (call->proc) {
+		if (call->proc->out == call->frame) call->proc->out_owned = talloc_steal(call->proc, call->frame);
+		call->proc->call = NULL;
+	}
+
+	return 0;
+}
+
+static void exec_coproc_call_timeout(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	exec_coproc_call_t	*call = talloc_get_type_abort(uctx, exec_coproc_call_t);
+
+	/*
+	 *	The helper is stuck, so replace it.
+	 */
+	if (call->proc) {
+		exec_coproc_close(call->proc, "Timeout running program");
+		return;
+	}
+
+	exec_coproc_call_finish(call, "Timeout waiting for a free co-process");
+}
+
+/** Send a call to a helper, or queue it until one is idle
+ *
+ * The request is marked runnable when the call completes, at which
+ * point the result can be retrieved with #exec_coproc_call_result.
+ * Freeing the call cancels it.
+ *
+ * @param[in] ctx	to allocate the call in.
+ * @param[in] pool	to send the call to.
+ * @param[in] request	to resume when the call completes.
+ * @param[in] argv	NULL terminated arguments to pass.  May be NULL.
+ * @param[in] envp	NULL terminated environment to pass.  May be NULL.
+ * @return
+ *	- The new call.
+ *	- NULL on error.  Error retrievable with fr_strerror().
+ */
+exec_coproc_call_t *exec_coproc_call(TALLOC_CTX *ctx, exec_coproc_pool_t *pool, request_t *request,
+				     char **argv, char **envp)
+{
+	exec_coproc_call_t	*call;
+	size_t			len = EXEC_COPROC_REQ_HDR_LEN;
+	size_t			argc = 0, envc = 0, i;
+	uint8_t			*p;
+
+	if (argv) for (argc = 0; argv[argc]; argc++) len += strlen(argv[argc]) + 1;
+	if (envp) for (envc = 0; envp[envc]; envc++) len += strlen(envp[envc]) + 1;
+
+	if ((len > EXEC_COPROC_MAX_FRAME) || (argc > UINT16_MAX) || (envc > UINT16_MAX)) {
+		fr_strerror_printf("Request too large for co-process (%zu bytes, maximum %u)",
+				   len, EXEC_COPROC_MAX_FRAME);
+		return NULL;
+	}
+
+	MEM(call = talloc_zero(ctx, exec_coproc_call_t));
+	call->pool = pool;
+	call->request = request;
+	fr_dlist_entry_init(&call->entry);
+	talloc_set_destructor(call, _exec_coproc_call_free);
+
+	MEM(call->frame = p = talloc_array(call, uint8_t, len));
+	call->frame_len = len;
+
+	fr_nbo_from_uint32(p, len - EXEC_COPROC_HDR_LEN);
+	p[4] = EXEC_COPROC_TYPE_CALL;
+	fr_nbo_from_uint16(p + 5, argc);
+	fr_nbo_from_uint16(p + 7, envc);
+	p += EXEC_COPROC_REQ_HDR_LEN;
+
+	for (i = 0; i < argc; i++) {
+		size_t arg_len = strlen(argv[i]) + 1;
+
+		memcpy(p, argv[i], arg_len);
+		p += arg_len;
+	}
+	for (i = 0; i < envc; i++) {
+		size_t env_len = strlen(envp[i]) + 1;
+
+		memcpy(p, envp[i], env_len);
+		p += env_len;
+	}
+
+	if (fr_event_timer_in(call, pool->el, &call->ev, pool->conf->timeout, exec_coproc_call_timeout, call) < 0) {
+		talloc_free(call);
+		return NULL;
+	}
+
+	for (i = 0; i < pool->conf->processes; i++) {
+		exec_coproc_t *proc = pool->procs[i];
+
+		if (proc->state != EXEC_COPROC_STATE_IDLE) continue;
+
+		if (exec_coproc_send(proc, call) < 0) {
+			exec_coproc_close(proc, fr_strerror());
+			continue;
+		}
+
+		RDEBUG2("Sent request to co-process %u (PID %u)", proc->id, (unsigned int) proc->pid);
+		return call;
+	}
+
+	RDEBUG2("No idle co-processes, queueing request");
+	fr_dlist_insert_tail(&pool->backlog, call);
+
+	return call;
+}
+
+/** Return the result of a completed call
+ *
+ */
+exec_coproc_result_t const *exec_coproc_call_result(exec_coproc_call_t const *call)
+{
+	return &call->result;
+}
+
+static int _exec_coproc_pool_free(exec_coproc_pool_t *pool)
+{
+	uint32_t i;
+
+	for (i = 0; i < pool->conf->processes; i++) {
+		exec_coproc_t *proc = pool->procs[i];
+
+		if (proc->from_fd >= 0) {
+			(void) fr_event_fd_delete(pool->el, proc->from_fd, FR_EVENT_FILTER_IO);
+			close(proc->from_fd);
+		}
+
+		/*
+		 *	Closing stdin is enough for well behaved
+		 *	helpers, the signal is for the rest.
+		 */
+		if (proc->to_fd >= 0) {
+			if (proc->writing) (void) fr_event_fd_delete(pool->el, proc->to_fd, FR_EVENT_FILTER_IO);
+			close(proc->to_fd);
+		}
+
+		if (proc->pid > 0) {
+			talloc_const_free(proc->ev_pid);
+			kill(proc->pid, SIGTERM);
+
+			if (fr_event_pid_reap(pool->el, proc->pid, NULL, NULL) < 0) {
+				int status;
+
+				kill(proc->pid, SIGKILL);
+				waitpid(proc->pid, &status, WNOHANG);
+			}
+		}
+	}
+
+	return 0;
+}
+
+/** Start the helpers for a worker thread
+ *
+ * @param[in] ctx	to allocate the pool in.  Freeing the pool stops the helpers.
+ * @param[in] el	worker thread's event list.
+ * @param[in] conf	pool configuration.
+ * @param[in] name	to prefix log messages with.
+ * @return
+ *	- The new pool.
+ *	- NULL on error.  Error retrievable with fr_strerror().
+ */
+exec_coproc_pool_t *exec_coproc_pool_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+					   exec_coproc_conf_t const *conf, char const *name)
+{
+	exec_coproc_pool_t	*pool;
+	char			*program;
+	int			argc;
+	uint32_t		i;
+
+	MEM(pool = talloc_zero(ctx, exec_coproc_pool_t));
+	pool->conf = conf;
+	pool->name = name;
+	pool->el = el;
+	fr_dlist_talloc_init(&pool->backlog, exec_coproc_call_t, entry);
+
+	MEM(program = talloc_strdup(pool, conf->program));
+	MEM(pool->argv = talloc_zero_array(pool, char *, EXEC_COPROC_MAX_ARGV + 1));
+	argc = fr_dict_str_to_argv(program, pool->argv, EXEC_COPROC_MAX_ARGV);
+	if (argc < 1) {
+		fr_strerror_const("Co-process program is empty");
+	error:
+		talloc_free(pool);
+		return NULL;
+	}
+
+	if (conf->env_inherit) {
+		pool->envp = environ;
+	} else {
+		MEM(pool->envp = talloc_zero_array(pool, char *, 1));
+	}
+
+	MEM(pool->procs = talloc_zero_array(pool, exec_coproc_t *, conf->processes));
+	for (i = 0; i < conf->processes; i++) {
+		exec_coproc_t *proc;
+
+		MEM(proc = pool->procs[i] = talloc_zero(pool->procs, exec_coproc_t));
+		proc->pool = pool;
+		proc->id = i;
+		proc->pid = -1;
+		proc->to_fd = -1;
+		proc->from_fd = -1;
+		MEM(proc->buff = talloc_array(proc, uint8_t, EXEC_COPROC_MAX_FRAME));
+	}
+	talloc_set_destructor(pool, _exec_coproc_pool_free);
+
+	for (i = 0; i < conf->processes; i++) {
+		if (exec_coproc_spawn(pool->procs[i]) < 0) goto error;
+	}
+
+	if (fr_time_delta_ispos(conf->health_check_interval) &&
+	    (fr_event_timer_in(pool, el, &pool->ev_health, conf->health_check_interval,
+			       exec_coproc_health_check, pool) < 0)) goto error;
+
+	return pool;
+}
@@ -0,0 +1,75 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file coproc.h
+ * @brief Persistent helper processes for rlm_exec.
+ *
+ * @copyright 2024 The FreeRADIUS server project
+ */
+RCSIDH(exec_coproc_h, "$Id$")
+
+#include <freeradius-devel/server/module_rlm.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/time.h>
+
+/** Largest frame, including the length prefix, which may be sent to, or received from, a helper
+ *
+ * Frames may be larger than the pipe buffer, in which case they're
+ * written as the helper reads them.
+ */
+#define EXEC_COPROC_MAX_FRAME	(65536)
+
+#define EXEC_COPROC_TYPE_CALL	(1)		//!< Run a request.
+#define EXEC_COPROC_TYPE_PING	(2)		//!< Health check.
+
+typedef struct {
+	char const		*program;		//!< Command line of the helper.  Enables co-process mode.
+	uint32_t		processes;		//!< Number of helpers per worker thread.
+	fr_time_delta_t		health_check_interval;	//!< How often idle helpers are pinged.
+	fr_time_delta_t		respawn_delay;		//!< How long to wait before restarting a helper.
+
+	fr_time_delta_t		timeout;		//!< Maximum time to wait for a response.
+	bool			env_inherit;		//!< Whether helpers inherit our environment.
+} exec_coproc_conf_t;
+
+typedef struct exec_coproc_pool_s exec_coproc_pool_t;
+typedef struct exec_coproc_call_s exec_coproc_call_t;
+
+/** The result of a call
+ *
+ */
+typedef struct {
+	int			status;			//!< Status returned by the helper.
+	char			*output;		//!< Output returned by the helper.  Always \0 terminated.
+	size_t			output_len;		//!< Length of the output.
+	char const		*error;			//!< Why the call failed, or NULL if it succeeded.
+} exec_coproc_result_t;
+
+extern conf_parser_t const exec_coproc_config[];
+
+exec_coproc_pool_t		*exec_coproc_pool_alloc(TALLOC_CTX *ctx, fr_event_list_t *el,
+							exec_coproc_conf_t const *conf, char const *name)
+							CC_HINT(nonnull);
+
+exec_coproc_call_t		*exec_coproc_call(TALLOC_CTX *ctx, exec_coproc_pool_t *pool, request_t *request,
+						  char **argv, char **envp) CC_HINT(nonnull(2,3));
+
+exec_coproc_result_t const	*exec_coproc_call_result(exec_coproc_call_t const *call) CC_HINT(nonnull);
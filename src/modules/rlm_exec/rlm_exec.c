@@ -42,6 +42,8 @@ RCSID("$Id$")
 #include <freeradius-devel/unlang/xlat.h>
 #include <freeradius-devel/unlang/module.h>
 
+#include "coproc.h"
+
 /*
  *	Define a structure for our module configuration.
  */
@@ -53,8 +55,13 @@ typedef struct {
 	bool			env_inherit;
 	fr_time_delta_t		timeout;
 	bool			timeout_is_set;
+	exec_coproc_conf_t	coproc;
 } rlm_exec_t;
 
+typedef struct {
+	exec_coproc_pool_t	*pool;		//!< Helpers for this thread, if co-process mode is enabled.
+} rlm_exec_thread_t;
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("wait", rlm_exec_t, wait), .dflt = "yes" },
 	{ FR_CONF_OFFSET("input_pairs", rlm_exec_t, input_list) },
@@ -62,6 +69,7 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("shell_escape", rlm_exec_t, shell_escape), .dflt = "yes" },
 	{ FR_CONF_OFFSET("env_inherit", rlm_exec_t, env_inherit), .dflt = "no" },
 	{ FR_CONF_OFFSET_IS_SET("timeout", FR_TYPE_TIME_DELTA, 0, rlm_exec_t, timeout) },
+	{ FR_CONF_OFFSET_SUBSECTION("coprocess", 0, rlm_exec_t, coproc, exec_coproc_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -116,6 +124,75 @@ static xlat_action_t exec_xlat_oneshot_wait_resume(TALLOC_CTX *ctx, fr_dcursor_t
 	return XLAT_ACTION_DONE;
 }
 
+static xlat_action_t exec_xlat_coproc_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
+					     xlat_ctx_t const *xctx,
+					     request_t *request, UNUSED fr_value_box_list_t *in)
+{
+	exec_coproc_call_t		*call = talloc_get_type_abort(xctx->rctx, exec_coproc_call_t);
+	exec_coproc_result_t const	*result = exec_coproc_call_result(call);
+	fr_value_box_t			*vb;
+
+	if (result->error) {
+		REDEBUG("Execution of external program failed: %s", result->error);
+	fail:
+		talloc_free(call);
+		return XLAT_ACTION_FAIL;
+	}
+
+	if ((result->status != 0) && (result->status != 3)) {
+		REDEBUG("Execution of external program returned %d", result->status);
+		goto fail;
+	}
+
+	MEM(vb = fr_value_box_alloc_null(ctx));
+	if (fr_value_box_bstrndup(vb, vb, NULL, result->output, result->output_len, true) < 0) {
+		talloc_free(vb);
+		goto fail;
+	}
+	fr_dcursor_append(out, vb);
+
+	talloc_free(call);
+
+	return XLAT_ACTION_DONE;
+}
+
+static void exec_xlat_coproc_cancel(xlat_ctx_t const *xctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	talloc_free(xctx->rctx);
+}
+
+/** Pass the arguments and environment to a co-process
+ *
+ */
+static xlat_action_t exec_xlat_coproc(request_t *request, rlm_exec_t const *inst, rlm_exec_thread_t *t,
+				      fr_pair_list_t *env_pairs, fr_value_box_list_t *in)
+{
+	TALLOC_CTX		*ctx = unlang_interpret_frame_talloc_ctx(request);
+	exec_coproc_call_t	*call;
+	char			**argv, **envp;
+
+	if (fr_exec_value_box_list_to_argv(ctx, &argv, in) < 0) {
+		RPEDEBUG("Failed converting arguments");
+		return XLAT_ACTION_FAIL;
+	}
+
+	envp = fr_exec_pair_to_env(request, env_pairs, inst->shell_escape);
+	if (!envp) {
+		RPEDEBUG("Failed creating environment");
+		talloc_free(argv);
+		return XLAT_ACTION_FAIL;
+	}
+
+	call = exec_coproc_call(ctx, t->pool, request, argv, envp);
+	talloc_free(argv);
+	if (!call) {
+		RPEDEBUG("Failed calling co-process");
+		return XLAT_ACTION_FAIL;
+	}
+
+	return unlang_xlat_yield(request, exec_xlat_coproc_resume, exec_xlat_coproc_cancel, ~FR_SIGNAL_CANCEL, call);
+}
+
 static xlat_arg_parser_t const exec_xlat_args[] = {
 	{ .required = true, .type = FR_TYPE_STRING },
 	{ .variadic = XLAT_ARG_VARIADIC_EMPTY_KEEP, .type = FR_TYPE_VOID},
@@ -130,7 +207,8 @@ static xlat_arg_parser_t const exec_xlat_args[] = {
 @endverbatim
  *
  * Exactly one request is consumed during the process lifetime,
- * after which the process exits.
+ * after which the process exits.  In co-process mode the arguments
+ * are instead passed to one of the module's long running helpers.
  *
  * @ingroup xlat_functions
  */
@@ -139,6 +217,7 @@ static xlat_action_t exec_xlat_oneshot(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out
 				       request_t *request, fr_value_box_list_t *in)
 {
 	rlm_exec_t const	*inst = talloc_get_type_abort_const(xctx->mctx->inst->data, rlm_exec_t);
+	rlm_exec_thread_t	*t = talloc_get_type_abort(xctx->mctx->thread, rlm_exec_thread_t);
 	fr_pair_list_t		*env_pairs = NULL;
 	fr_exec_state_t		*exec;
 
@@ -150,6 +229,8 @@ static xlat_action_t exec_xlat_oneshot(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out
 		}
 	}
 
+	if (t->pool) return exec_xlat_coproc(request, inst, t, env_pairs, in);
+
 	if (!inst->wait) {
 		if (unlikely(fr_exec_oneshot_nowait(request, in, env_pairs, inst->shell_escape, inst->env_inherit) < 0)) {
 			RPEDEBUG("Failed executing program");
@@ -176,6 +257,8 @@ static xlat_action_t exec_xlat_oneshot(TALLOC_CTX *ctx, UNUSED fr_dcursor_t *out
 typedef struct {
 	fr_value_box_list_t	box;
 	int			status;
+	fr_value_box_list_t	args;		//!< Expanded program, passed to a co-process.
+	exec_coproc_call_t	*call;		//!< Call in progress to a co-process.
 } rlm_exec_ctx_t;
 
 static const rlm_rcode_t status2rcode[] = {
@@ -379,6 +462,81 @@ static unlang_action_t mod_exec_oneshot_wait_resume(rlm_rcode_t *p_result, modul
 	RETURN_MODULE_RCODE(rcode);
 }
 
+/** Process the status and output returned by a co-process
+ *
+ */
+static unlang_action_t mod_exec_coproc_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_exec_ctx_t			*m = talloc_get_type_abort(mctx->rctx, rlm_exec_ctx_t);
+	exec_coproc_result_t const	*result = exec_coproc_call_result(m->call);
+
+	if (result->error) {
+		REDEBUG("Execution of external program failed: %s", result->error);
+		TALLOC_FREE(m->call);
+		RETURN_MODULE_FAIL;
+	}
+
+	m->status = result->status;
+	if (result->output_len > 0) {
+		fr_value_box_t *box;
+
+		MEM(box = fr_value_box_alloc_null(m));
+		if (fr_value_box_bstrndup(box, box, NULL, result->output, result->output_len, true) < 0) {
+			TALLOC_FREE(m->call);
+			RETURN_MODULE_FAIL;
+		}
+		fr_value_box_list_insert_tail(&m->box, box);
+	}
+	TALLOC_FREE(m->call);
+
+	return mod_exec_oneshot_wait_resume(p_result, mctx, request);
+}
+
+static void mod_exec_coproc_cancel(module_ctx_t const *mctx, UNUSED request_t *request, UNUSED fr_signal_t action)
+{
+	rlm_exec_ctx_t	*m = talloc_get_type_abort(mctx->rctx, rlm_exec_ctx_t);
+
+	TALLOC_FREE(m->call);
+}
+
+/** Pass the expanded program, and the environment, to a co-process
+ *
+ */
+static unlang_action_t mod_exec_coproc_dispatch(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	rlm_exec_t const       	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_exec_t);
+	rlm_exec_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_exec_thread_t);
+	rlm_exec_ctx_t		*m = talloc_get_type_abort(mctx->rctx, rlm_exec_ctx_t);
+	fr_pair_list_t		*env_pairs = NULL;
+	char			**argv, **envp;
+
+	if (inst->input_list) {
+		env_pairs = tmpl_list_head(request, tmpl_list(inst->input_list));
+		if (!env_pairs) RETURN_MODULE_INVALID;
+	}
+
+	if (fr_exec_value_box_list_to_argv(m, &argv, &m->args) < 0) {
+		RPEDEBUG("Failed converting arguments");
+		RETURN_MODULE_FAIL;
+	}
+
+	envp = fr_exec_pair_to_env(request, env_pairs, inst->shell_escape);
+	if (!envp) {
+		RPEDEBUG("Failed creating environment");
+		talloc_free(argv);
+		RETURN_MODULE_FAIL;
+	}
+
+	m->call = exec_coproc_call(m, t->pool, request, argv, envp);
+	talloc_free(argv);
+	if (!m->call) {
+		RPEDEBUG("Failed calling co-process");
+		RETURN_MODULE_FAIL;
+	}
+
+	return unlang_module_yield(request, mod_exec_coproc_resume, mod_exec_coproc_cancel, ~FR_SIGNAL_CANCEL, m);
+}
+
 /** Dispatch one request using a short lived process
  *
  */
@@ -388,6 +546,7 @@ static unlang_action_t CC_HINT(nonnull) mod_exec_dispatch_oneshot(rlm_rcode_t *p
 	fr_pair_list_t		*env_pairs = NULL;
 	TALLOC_CTX		*ctx;
 	rlm_exec_t const       	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_exec_t);
+	rlm_exec_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_exec_thread_t);
 	exec_call_env_t		*env_data = talloc_get_type_abort(mctx->env_data, exec_call_env_t);
 
 	if (!env_data->program) {
@@ -400,6 +559,24 @@ static unlang_action_t CC_HINT(nonnull) mod_exec_dispatch_oneshot(rlm_rcode_t *p
 	 */
 	ctx = unlang_interpret_frame_talloc_ctx(request);
 
+	/*
+	 *	Expand the program, and pass the result to a
+	 *	co-process as its arguments.
+	 */
+	if (t->pool) {
+		if (inst->output_list && !tmpl_list_head(request, tmpl_list(inst->output_list))) {
+			RETURN_MODULE_INVALID;
+		}
+
+		MEM(m = talloc_zero(ctx, rlm_exec_ctx_t));
+		m->status = 2;
+		fr_value_box_list_init(&m->box);
+		fr_value_box_list_init(&m->args);
+
+		return unlang_module_yield_to_xlat(m, NULL, &m->args, request, tmpl_xlat(env_data->program),
+						   mod_exec_coproc_dispatch, NULL, 0, m);
+	}
+
 	/*
 	 *	Do the asynchronous xlat expansion.
 	 */
@@ -504,6 +681,53 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 		}
 	}
 
+	if (inst->coproc.program) {
+		if (!inst->wait) {
+			cf_log_err(conf, "Co-processes cannot be used if wait = no");
+			return -1;
+		}
+
+		if (inst->coproc.program[0] != '/') {
+			cf_log_err(conf, "Co-process program '%s' must be an absolute path", inst->coproc.program);
+			return -1;
+		}
+
+		FR_INTEGER_BOUND_CHECK("coprocess.processes", inst->coproc.processes, >=, 1);
+		FR_INTEGER_BOUND_CHECK("coprocess.processes", inst->coproc.processes, <=, 256);
+		FR_TIME_DELTA_BOUND_CHECK("coprocess.respawn_delay", inst->coproc.respawn_delay, >=, fr_time_delta_from_msec(100));
+
+		inst->coproc.timeout = inst->timeout;
+		inst->coproc.env_inherit = inst->env_inherit;
+	}
+
+	return 0;
+}
+
+/** Start the co-processes for this thread
+ *
+ */
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_exec_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_exec_t);
+	rlm_exec_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_exec_thread_t);
+
+	if (!inst->coproc.program) return 0;
+
+	t->pool = exec_coproc_pool_alloc(t, mctx->el, &inst->coproc, mctx->inst->name);
+	if (!t->pool) {
+		PERROR("Failed starting co-processes");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_exec_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_exec_thread_t);
+
+	TALLOC_FREE(t->pool);
+
 	return 0;
 }
 
@@ -525,6 +749,11 @@ module_rlm_t rlm_exec = {
 		.inst_size	= sizeof(rlm_exec_t),
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
+
+		.thread_inst_size	= sizeof(rlm_exec_thread_t),
+		.thread_inst_type	= "rlm_exec_thread_t",
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
         .method_names = (module_method_name_t[]){
                 { .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,		.method = mod_exec_dispatch_oneshot,
@@ -36,18 +36,81 @@ RCSID("$Id$")
 #include <ctype.h>
 #include <fcntl.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+typedef struct rlm_files_reload_s rlm_files_reload_t;
+
+typedef struct {
+	bool			enable;		//!< Allow the file to be re-read at run time.
+	bool			watch;		//!< Re-read the file when it changes.
+	fr_time_delta_t		delay;		//!< How long to wait for writes to settle.
+} rlm_files_reload_conf_t;
+
 typedef struct {
-	char const	*filename;
+	char const		*filename;
+	rlm_files_reload_conf_t	reload;		//!< Reload configuration.
+	rlm_files_reload_t	*reloader;	//!< Reload thread and the list of call sites.
 } rlm_files_t;
 
+/** One generation of parsed files data
+ *
+ * Snapshots are immutable once published.  Each request pins the snapshot
+ * it first sees, and the snapshot is freed when the last pin is released.
+ */
+typedef struct {
+	fr_htrie_t		*htrie;		//!< parsed files "user" data.
+	PAIR_LIST_LIST		*def;		//!< parsed files DEFAULT data.
+	uint64_t		generation;	//!< Which load of the file this is.
+	fr_time_delta_t		parse_time;	//!< How long it took to read and index the file.
+	size_t			size;		//!< Memory used by this snapshot.
+	atomic_uint_fast32_t	refs;		//!< One for the call site, plus one per request.
+} rlm_files_snapshot_t;
+
 /**  Structure produced by custom call_env parser
  */
 typedef struct {
-	tmpl_t		*key_tmpl;	//!< tmpl used to evaluate lookup key.
-	fr_htrie_t	*htrie;		//!< parsed files "user" data.
-	PAIR_LIST_LIST	*def;		//!< parsed files DEFAULT data.
+	tmpl_t			*key_tmpl;	//!< tmpl used to evaluate lookup key.
+	fr_type_t		key_type;	//!< Type of the key, which determines the htrie type.
+	fr_dict_t const		*dict;		//!< To resolve attributes in the file.
+
+	_Atomic(rlm_files_snapshot_t *)	snapshot;	//!< Current generation.
+
+	rlm_files_reload_t	*reloader;	//!< NULL if reloading is disabled.
+	atomic_uint_fast32_t	pinning[2];	//!< Requests currently taking a reference,
+						///< indexed by the low bit of epoch.
+	atomic_uint_fast32_t	epoch;		//!< Incremented each time a snapshot is published.
+	fr_dlist_t		entry;		//!< Entry in the reloader's list of call sites.
 } rlm_files_data_t;
 
+/** Reference held by a request to the snapshot it's using
+ */
+typedef struct {
+	rlm_files_snapshot_t	*snapshot;
+} rlm_files_pin_t;
+
+struct rlm_files_reload_s {
+	rlm_files_t const	*inst;		//!< Module instance we're reloading data for.
+	char const		*name;		//!< Module instance name, for log messages.
+
+	pthread_mutex_t		mutex;		//!< Protects the list of call sites.
+	fr_dlist_head_t		sites;		//!< Call sites, each with its own snapshot.
+	unsigned int		version;	//!< Incremented when a call site is added or removed.
+	uint64_t		generation;	//!< Last generation successfully loaded.
+
+	fr_event_list_t		*el;		//!< Event list for the reload thread.
+	fr_event_user_t		*reload_ev;	//!< Triggered by radmin to request a reload.
+	fr_event_user_t		*exit_ev;	//!< Triggered to stop the reload thread.
+	fr_event_timer_t const	*delay_ev;	//!< Pending reload after the file changed.
+	int			fd;		//!< Watched file, or -1.
+	bool			running;	//!< Whether the thread was started.
+	atomic_bool		exiting;	//!< Tells the reload thread to stop.
+	pthread_t		thread;		//!< Reload thread.
+};
+
 /**  Call_env structure
  */
 typedef struct {
@@ -75,8 +138,16 @@ fr_dict_attr_autoload_t rlm_files_dict_attr[] = {
 	{ NULL }
 };
 
+static const conf_parser_t reload_config[] = {
+	{ FR_CONF_OFFSET("enable", rlm_files_reload_conf_t, enable), .dflt = "no" },
+	{ FR_CONF_OFFSET("watch", rlm_files_reload_conf_t, watch), .dflt = "no" },
+	{ FR_CONF_OFFSET("delay", rlm_files_reload_conf_t, delay), .dflt = "1s" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_REQUIRED | CONF_FLAG_FILE_INPUT, rlm_files_t, filename) },
+	{ FR_CONF_OFFSET_SUBSECTION("reload", 0, rlm_files_t, reload, reload_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -100,7 +171,7 @@ static int pairlist_to_key(uint8_t **out, size_t *outlen, void const *a)
 }
 
 static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **ptree, PAIR_LIST_LIST **pdefault,
-			    fr_type_t data_type, fr_dict_t const *dict)
+			    fr_type_t data_type, fr_dict_t const *dict, fr_event_list_t *el)
 {
 	int			rcode;
 	PAIR_LIST_LIST		users;
@@ -118,7 +189,11 @@ static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **
 	}
 
 	pairlist_list_init(&users);
-	rcode = pairlist_read(ctx, dict, filename, &users);
+	if (el) {
+		rcode = pairlist_read_shared(ctx, el, dict, filename, &users);
+	} else {
+		rcode = pairlist_read(ctx, dict, filename, &users);
+	}
 	if (rcode < 0) {
 		return -1;
 	}
@@ -392,6 +467,153 @@ static int getrecv_filename(TALLOC_CTX *ctx, char const *filename, fr_htrie_t **
 	return 0;
 }
 
+/** Read the file, and build a new snapshot for a call site
+ *
+ * @param[in] key_type	of the call site, which determines the htrie type.
+ * @param[in] dict	to resolve attributes in the file.
+ * @param[in] filename	to read.
+ * @param[in] el	The reload thread's event list, or NULL
+ *			if reloading is disabled.
+ * @return
+ *	- A new snapshot with a single reference.
+ *	- NULL on error.
+ */
+static rlm_files_snapshot_t *files_snapshot_alloc(fr_type_t key_type, fr_dict_t const *dict, char const *filename,
+						  fr_event_list_t *el)
+{
+	rlm_files_snapshot_t	*snapshot;
+	fr_time_t		start = fr_time();
+
+	/*
+	 *	The last reference may be dropped by any worker, so
+	 *	snapshots can't be parented by anything owned by a
+	 *	particular thread.
+	 */
+	MEM(snapshot = talloc_zero(NULL, rlm_files_snapshot_t));
+	if (getrecv_filename(snapshot, filename, &snapshot->htrie, &snapshot->def, key_type, dict, el) < 0) {
+		talloc_free(snapshot);
+		return NULL;
+	}
+	snapshot->parse_time = fr_time_sub(fr_time(), start);
+	snapshot->size = talloc_total_size(snapshot);
+	atomic_init(&snapshot->refs, 1);
+
+	return snapshot;
+}
+
+static inline CC_HINT(always_inline) void files_snapshot_release(rlm_files_snapshot_t *snapshot)
+{
+	if (atomic_fetch_sub(&snapshot->refs, 1) == 1) talloc_free(snapshot);
+}
+
+/** Take a reference to the current snapshot for a call site
+ *
+ * Readers announce themselves in one of two counters before loading the
+ * snapshot pointer.  The reload thread swaps the pointer, flips the epoch,
+ * and waits for the counter readers were using to drain before dropping
+ * its reference to the old snapshot.  New readers use the other counter,
+ * so the wait is bounded by the few instructions below.
+ *
+ * @param[in] data	Call site to get the snapshot for.
+ * @return The current snapshot, which must be released with
+ *	#files_snapshot_release.
+ */
+static rlm_files_snapshot_t *files_snapshot_acquire(rlm_files_data_t *data)
+{
+	rlm_files_snapshot_t	*snapshot;
+	uint_fast32_t		epoch;
+	unsigned int		idx;
+
+	for (;;) {
+		epoch = atomic_load(&data->epoch);
+		idx = epoch & 0x01;
+
+		atomic_fetch_add(&data->pinning[idx], 1);
+		if (atomic_load(&data->epoch) == epoch) break;
+
+		/*
+		 *	A snapshot was published between loading
+		 *	the epoch and announcing ourselves.
+		 */
+		atomic_fetch_sub(&data->pinning[idx], 1);
+	}
+
+	snapshot = atomic_load(&data->snapshot);
+	atomic_fetch_add(&snapshot->refs, 1);
+	atomic_fetch_sub(&data->pinning[idx], 1);
+
+	return snapshot;
+}
+
+/** Publish a new snapshot, releasing the previous one
+ *
+ * Must only be called from the reload thread.
+ *
+ * @param[in] data	Call site to publish the snapshot for.
+ * @param[in] snapshot	to publish.  The call site takes
+ *			ownership of the caller's reference.
+ */
+static void files_snapshot_publish(rlm_files_data_t *data, rlm_files_snapshot_t *snapshot)
+{
+	rlm_files_snapshot_t	*old;
+	unsigned int		idx;
+
+	old = atomic_exchange(&data->snapshot, snapshot);
+
+	/*
+	 *	Once the counter for the previous epoch drains,
+	 *	every reader which could have seen the old pointer
+	 *	holds its own reference to it.
+	 */
+	idx = atomic_fetch_add(&data->epoch, 1) & 0x01;
+	while (atomic_load(&data->pinning[idx]) > 0) sched_yield();
+
+	files_snapshot_release(old);
+}
+
+static int _files_pin_free(rlm_files_pin_t *pin)
+{
+	files_snapshot_release(pin->snapshot);
+	return 0;
+}
+
+/** Find the snapshot a request should use
+ *
+ * The first call for a request takes a reference to the current snapshot.
+ * Later calls for the same request get the same snapshot, even if a new
+ * one has been published in the meantime.
+ *
+ * @param[in] request	The current request.
+ * @param[in] data	Call site to find the snapshot for.
+ * @return
+ *	- The snapshot to use.
+ *	- NULL on error.
+ */
+static rlm_files_snapshot_t *files_snapshot_pin(request_t *request, rlm_files_data_t *data)
+{
+	rlm_files_pin_t		*pin;
+
+	/*
+	 *	The snapshot never changes, so there's no need
+	 *	to track references.
+	 */
+	if (!data->reloader) return atomic_load_explicit(&data->snapshot, memory_order_relaxed);
+
+	pin = request_data_reference(request, data, 0);
+	if (pin) return pin->snapshot;
+
+	MEM(pin = talloc(request, rlm_files_pin_t));
+	pin->snapshot = files_snapshot_acquire(data);
+	talloc_set_destructor(pin, _files_pin_free);
+
+	if (request_data_talloc_add(request, data, 0, rlm_files_pin_t, pin, true, false, false) < 0) {
+		talloc_free(pin);
+		return NULL;
+	}
+
+	return pin->snapshot;
+}
+
 /** Lookup the expanded key value in files data.
  *
  */
@@ -405,8 +627,9 @@ static unlang_action_t CC_HINT(nonnull) mod_files_resume(rlm_rcode_t *p_result,
 	uint8_t			key_buffer[16], *key;
 	size_t			keylen = 0;
 	fr_edit_list_t		*el, *child;
-	fr_htrie_t		*tree = env->data->htrie;
-	PAIR_LIST_LIST		*default_list = env->data->def;
+	rlm_files_snapshot_t	*snapshot;
+	fr_htrie_t		*tree;
+	PAIR_LIST_LIST		*default_list;
 	fr_value_box_t		*key_vb = fr_value_box_list_head(&env->values);
 
 	if (!key_vb) {
@@ -414,6 +637,14 @@ static unlang_action_t CC_HINT(nonnull) mod_files_resume(rlm_rcode_t *p_result,
 		RETURN_MODULE_FAIL;
 	}
 
+	snapshot = files_snapshot_pin(request, env->data);
+	if (!snapshot) {
+		RPERROR("Failed recording files data in use");
+		RETURN_MODULE_FAIL;
+	}
+	tree = snapshot->htrie;
+	default_list = snapshot->def;
+
 	if (!tree && !default_list) RETURN_MODULE_NOOP;
 
 	RDEBUG2("%s - Looking for key \"%pV\"", env->name, key_vb);
@@ -623,6 +854,18 @@ static unlang_action_t CC_HINT(nonnull) mod_files(rlm_rcode_t *p_result, module_
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+static int _files_data_free(rlm_files_data_t *files_data)
+{
+	pthread_mutex_lock(&files_data->reloader->mutex);
+	fr_dlist_remove(&files_data->reloader->sites, files_data);
+	files_data->reloader->version++;
+	pthread_mutex_unlock(&files_data->reloader->mutex);
+
+	files_snapshot_release(atomic_load(&files_data->snapshot));
+
+	return 0;
+}
+
 /** Custom call_env parser for loading files data
  *
  */
@@ -632,7 +875,7 @@ static int call_env_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rule
 	rlm_files_t const	*inst = talloc_get_type_abort_const(data, rlm_files_t);
 	CONF_PAIR const		*to_parse = cf_item_to_pair(ci);
 	rlm_files_data_t	*files_data;
-	fr_type_t		keytype;
+	rlm_files_snapshot_t	*snapshot;
 
 	MEM(files_data = talloc_zero(ctx, rlm_files_data_t));
 
@@ -640,21 +883,426 @@ static int call_env_parse(TALLOC_CTX *ctx, void *out, tmpl_rules_t const *t_rule
 			      &FR_SBUFF_IN(cf_pair_value(to_parse), talloc_array_length(cf_pair_value(to_parse)) - 1),
 			      cf_pair_value_quote(to_parse), NULL, t_rules) < 0) return -1;
 
-	keytype = tmpl_expanded_type(files_data->key_tmpl);
-	if (fr_htrie_hint(keytype) == FR_HTRIE_INVALID) {
-		cf_log_err(ci, "Invalid data type '%s' for 'files' module", fr_type_to_str(keytype));
+	files_data->key_type = tmpl_expanded_type(files_data->key_tmpl);
+	if (fr_htrie_hint(files_data->key_type) == FR_HTRIE_INVALID) {
+		cf_log_err(ci, "Invalid data type '%s' for 'files' module", fr_type_to_str(files_data->key_type));
 	error:
 		talloc_free(files_data);
 		return -1;
 	}
+	files_data->dict = t_rules->attr.dict_def;
+
+	/*
+	 *	If the file can be reloaded, parse it here exactly
+	 *	as the reload thread will, so that a file which
+	 *	loads at startup can also be reloaded.
+	 */
+	snapshot = files_snapshot_alloc(files_data->key_type, files_data->dict, inst->filename,
+					inst->reloader ? inst->reloader->el : NULL);
+	if (!snapshot) goto error;
+	snapshot->generation = 1;
+
+	cf_log_debug(ci, "Loaded %s in %pVs, using %zu bytes", inst->filename,
+		     fr_box_time_delta(snapshot->parse_time), snapshot->size);
 
-	if (getrecv_filename(files_data, inst->filename, &files_data->htrie, &files_data->def,
-			     keytype, t_rules->attr.dict_def) < 0) goto error;
+	atomic_init(&files_data->snapshot, snapshot);
+
+	/*
+	 *	The data never changes, so it can be freed along
+	 *	with the call site.
+	 */
+	if (!inst->reloader) {
+		talloc_steal(files_data, snapshot);
+		*(void **)out = files_data;
+		return 0;
+	}
+
+	/*
+	 *	Register the call site so the reload thread
+	 *	can build new snapshots for it.
+	 */
+	files_data->reloader = inst->reloader;
+	talloc_set_destructor(files_data, _files_data_free);
+
+	pthread_mutex_lock(&inst->reloader->mutex);
+	fr_dlist_insert_tail(&inst->reloader->sites, files_data);
+	inst->reloader->version++;
+	pthread_mutex_unlock(&inst->reloader->mutex);
 
 	*(void **)out = files_data;
 	return 0;
 }
 
+/** What the reload thread needs to read the file for a call site
+ */
+typedef struct {
+	fr_type_t		key_type;	//!< Copied from the call site.
+	fr_dict_t const		*dict;		//!< Copied from the call site.
+	rlm_files_snapshot_t	*snapshot;	//!< New snapshot, or NULL once it's been published.
+} rlm_files_site_t;
+
+/** Build new snapshots for every call site, and publish them
+ *
+ * Either all call sites move to the new generation, or none do.  The file
+ * is read without holding the lock, which is only taken to copy the list
+ * of call sites, and again to publish the results.
+ */
+static void files_reload(rlm_files_reload_t *reloader)
+{
+	rlm_files_data_t	*files_data = NULL;
+	rlm_files_site_t	*sites;
+	unsigned int		i = 0, num, version;
+	uint64_t		generation = reloader->generation + 1;
+
+	pthread_mutex_lock(&reloader->mutex);
+	version = reloader->version;
+	num = fr_dlist_num_elements(&reloader->sites);
+	MEM(sites = talloc_zero_array(NULL, rlm_files_site_t, num));
+	while ((files_data = fr_dlist_next(&reloader->sites, files_data))) {
+		sites[i].key_type = files_data->key_type;
+		sites[i++].dict = files_data->dict;
+	}
+	pthread_mutex_unlock(&reloader->mutex);
+
+	INFO("%s - Reading %s for generation %" PRIu64, reloader->name, reloader->inst->filename, generation);
+
+	for (i = 0; i < num; i++) {
+		sites[i].snapshot = files_snapshot_alloc(sites[i].key_type, sites[i].dict,
+							 reloader->inst->filename, reloader->el);
+		if (!sites[i].snapshot) {
+			PERROR("%s - Failed reading %s, continuing with generation %" PRIu64,
+			       reloader->name, reloader->inst->filename, reloader->generation);
+			goto done;
+		}
+		sites[i].snapshot->generation = generation;
+	}
+
+	pthread_mutex_lock(&reloader->mutex);
+
+	/*
+	 *	Call sites are only added or removed when the
+	 *	configuration is loaded or freed, but check anyway.
+	 */
+	if (reloader->version != version) {
+		pthread_mutex_unlock(&reloader->mutex);
+		WARN("%s - Call sites changed while reading %s, continuing with generation %" PRIu64,
+		     reloader->name, reloader->inst->filename, reloader->generation);
+		goto done;
+	}
+
+	for (i = 0, files_data = NULL; (files_data = fr_dlist_next(&reloader->sites, files_data)); i++) {
+		INFO("%s - Loaded generation %" PRIu64 " of %s in %pVs, using %zu bytes", reloader->name,
+		     generation, reloader->inst->filename,
+		     fr_box_time_delta(sites[i].snapshot->parse_time), sites[i].snapshot->size);
+		files_snapshot_publish(files_data, sites[i].snapshot);
+		sites[i].snapshot = NULL;
+	}
+	pthread_mutex_unlock(&reloader->mutex);
+
+	reloader->generation = generation;
+
+done:
+	for (i = 0; i < num; i++) talloc_free(sites[i].snapshot);
+	talloc_free(sites);
+}
+
+static void files_watch_changed(fr_event_list_t *el, int fd, int flags, void *uctx);
+static void files_watch_replaced(fr_event_list_t *el, int fd, int flags, void *uctx);
+
+/** Start watching the file for changes
+ *
+ */
+static int files_watch_start(rlm_files_reload_t *reloader)
+{
+	fr_event_vnode_func_t	funcs = {
+					.write = files_watch_changed,
+					.attrib = files_watch_changed,
+					.delete = files_watch_replaced,
+					.rename = files_watch_replaced
+				};
+
+	fr_assert(reloader->fd < 0);
+
+	reloader->fd = open(reloader->inst->filename, O_RDONLY);
+	if (reloader->fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", reloader->inst->filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fr_event_filter_insert(reloader, NULL, reloader->el, reloader->fd, FR_EVENT_FILTER_VNODE,
+				   &funcs, NULL, reloader) < 0) {
+		close(reloader->fd);
+		reloader->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void files_watch_stop(rlm_files_reload_t *reloader)
+{
+	if (reloader->fd < 0) return;
+
+	(void) fr_event_fd_delete(reloader->el, reloader->fd, FR_EVENT_FILTER_VNODE);
+	close(reloader->fd);
+	reloader->fd = -1;
+}
+
+static void _files_reload_delayed(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	rlm_files_reload_t *reloader = talloc_get_type_abort(uctx, rlm_files_reload_t);
+
+	/*
+	 *	The file was replaced.  Watch the new one.
+	 */
+	if (reloader->fd < 0) {
+		if (files_watch_start(reloader) < 0) {
+			PWARN("%s - Not watching for changes, retrying in %pVs", reloader->name,
+			      fr_box_time_delta(reloader->inst->reload.delay));
+			goto retry;
+		}
+	}
+
+	files_reload(reloader);
+	return;
+
+retry:
+	if (fr_event_timer_in(reloader, reloader->el, &reloader->delay_ev, reloader->inst->reload.delay,
+			      _files_reload_delayed, reloader) < 0) {
+		PERROR("%s - Failed inserting reload timer", reloader->name);
+	}
+}
+
+/** The watched file changed
+ *
+ * Editors and provisioning systems often write files in several steps,
+ * so wait for writes to settle before reading it.
+ */
+static void files_watch_changed(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rlm_files_reload_t *reloader = talloc_get_type_abort(uctx, rlm_files_reload_t);
+
+	DEBUG2("%s - %s changed, reloading in %pVs", reloader->name, reloader->inst->filename,
+	       fr_box_time_delta(reloader->inst->reload.delay));
+
+	if (fr_event_timer_in(reloader, reloader->el, &reloader->delay_ev, reloader->inst->reload.delay,
+			      _files_reload_delayed, reloader) < 0) {
+		PERROR("%s - Failed inserting reload timer", reloader->name);
+	}
+}
+
+/** The watched file was deleted or renamed
+ *
+ * The file we have open is no longer the one at the configured path,
+ * so stop watching it.  The new file is opened after the delay.
+ */
+static void files_watch_replaced(fr_event_list_t *el, int fd, int flags, void *uctx)
+{
+	files_watch_stop(talloc_get_type_abort(uctx, rlm_files_reload_t));
+	files_watch_changed(el, fd, flags, uctx);
+}
+
+static void _files_reload_requested(UNUSED fr_event_list_t *el, void *uctx)
+{
+	files_reload(talloc_get_type_abort(uctx, rlm_files_reload_t));
+}
+
+static void _files_reload_exit(UNUSED fr_event_list_t *el, void *uctx)
+{
+	rlm_files_reload_t *reloader = talloc_get_type_abort(uctx, rlm_files_reload_t);
+
+	atomic_store(&reloader->exiting, true);
+}
+
+/** Service the reload event list until told to exit
+ *
+ * This doesn't use fr_event_loop() as the module is detached after
+ * thread local data has been freed for all threads, including this one.
+ * Once woken to exit, the thread must not log or set errors.
+ */
+static void *files_reload_thread(void *arg)
+{
+	rlm_files_reload_t *reloader = talloc_get_type_abort(arg, rlm_files_reload_t);
+
+	DEBUG2("%s - Reload thread started", reloader->name);
+
+	while (!atomic_load(&reloader->exiting)) {
+		if (fr_event_corral(reloader->el, fr_time(), true) < 0) break;
+		fr_event_service(reloader->el);
+	}
+
+	return NULL;
+}
+
+static int cmd_reload(UNUSED FILE *fp, FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_files_reload_t *reloader = talloc_get_type_abort(ctx, rlm_files_reload_t);
+
+	if (fr_event_user_trigger(reloader->el, reloader->reload_ev) < 0) {
+		fprintf(fp_err, "Failed requesting reload: %s\n", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cmd_show_data(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_files_reload_t	*reloader = talloc_get_type_abort(ctx, rlm_files_reload_t);
+	rlm_files_data_t	*files_data = NULL;
+
+	pthread_mutex_lock(&reloader->mutex);
+	while ((files_data = fr_dlist_next(&reloader->sites, files_data))) {
+		rlm_files_snapshot_t *snapshot = files_snapshot_acquire(files_data);
+
+		fr_fprintf(fp, "%s\tgeneration %" PRIu64 "\tparse_time %pVs\tsize %zu\n",
+			   files_data->key_tmpl->name, snapshot->generation,
+			   fr_box_time_delta(snapshot->parse_time), snapshot->size);
+
+		files_snapshot_release(snapshot);
+	}
+	pthread_mutex_unlock(&reloader->mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "data",
+		.func = cmd_show_data,
+		.help = "Show the generation of files data in use, how long it took to read, and its size.",
+		.read_only = true
+	},
+
+	{
+		.parent = "set module",
+		.add_name = true,
+		.name = "reload",
+		.func = cmd_reload,
+		.help = "Re-read the files data in the background, and switch to it if there are no errors.",
+		.read_only = false
+	},
+
+	CMD_TABLE_END
+};
+
+static int _files_reload_free(rlm_files_reload_t *reloader)
+{
+	pthread_mutex_destroy(&reloader->mutex);
+	return 0;
+}
+
+static int mod_bootstrap(module_inst_ctx_t const *mctx)
+{
+	rlm_files_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+	rlm_files_reload_t	*reloader;
+
+	if (inst->reload.watch) inst->reload.enable = true;
+	if (!inst->reload.enable) return 0;
+
+	FR_TIME_DELTA_BOUND_CHECK("reload.delay", inst->reload.delay, >=, fr_time_delta_from_msec(10));
+	FR_TIME_DELTA_BOUND_CHECK("reload.delay", inst->reload.delay, <=, fr_time_delta_from_sec(60));
+
+	/*
+	 *	Call sites register themselves with this when
+	 *	they're parsed, which happens before instantiation.
+	 */
+	MEM(inst->reloader = reloader = talloc_zero(inst, rlm_files_reload_t));
+	reloader->inst = inst;
+	reloader->name = mctx->inst->name;
+	reloader->generation = 1;
+	reloader->fd = -1;
+	pthread_mutex_init(&reloader->mutex, NULL);
+	fr_dlist_talloc_init(&reloader->sites, rlm_files_data_t, entry);
+	talloc_set_destructor(reloader, _files_reload_free);
+
+	/*
+	 *	Expansions in the file are instantiated with the
+	 *	reload thread's event list, both when call sites
+	 *	are parsed and when the file is reloaded.
+	 */
+	reloader->el = fr_event_list_alloc(reloader, NULL, NULL);
+	if (!reloader->el) {
+		PERROR("Failed allocating event list for reload thread");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_files_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+	rlm_files_reload_t	*reloader = inst->reloader;
+	int			ret;
+
+	if (!reloader) return 0;
+
+	if ((fr_event_user_insert(reloader, reloader->el, &reloader->reload_ev, false,
+				  _files_reload_requested, reloader) < 0) ||
+	    (fr_event_user_insert(reloader, reloader->el, &reloader->exit_ev, false,
+				  _files_reload_exit, reloader) < 0)) {
+		PERROR("Failed adding reload events");
+		return -1;
+	}
+
+	if (inst->reload.watch && (files_watch_start(reloader) < 0)) {
+		PERROR("Failed watching %s for changes", inst->filename);
+		return -1;
+	}
+
+	if (fr_command_register_hook(NULL, mctx->inst->name, reloader, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands for %s", mctx->inst->name);
+		return -1;
+	}
+
+	ret = pthread_create(&reloader->thread, NULL, files_reload_thread, reloader);
+	if (ret != 0) {
+		ERROR("Failed starting reload thread: %s", fr_syserror(ret));
+		return -1;
+	}
+	reloader->running = true;
+
+	return 0;
+}
+
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_files_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_files_t);
+	rlm_files_reload_t	*reloader = inst->reloader;
+	rlm_files_data_t	*files_data;
+
+	if (!reloader) return 0;
+
+	if (reloader->running) {
+		if (fr_event_user_trigger(reloader->el, reloader->exit_ev) < 0) {
+			PERROR("Failed stopping reload thread");
+		} else {
+			pthread_join(reloader->thread, NULL);
+		}
+		reloader->running = false;
+	}
+	files_watch_stop(reloader);
+
+	/*
+	 *	Call sites may be freed after the module is
+	 *	unloaded, so release their data now, and remove
+	 *	the destructor which would otherwise do it.
+	 */
+	pthread_mutex_lock(&reloader->mutex);
+	reloader->version++;
+	while ((files_data = fr_dlist_pop_head(&reloader->sites))) {
+		talloc_set_destructor(files_data, NULL);
+		files_snapshot_release(atomic_exchange(&files_data->snapshot, NULL));
+		files_data->reloader = NULL;
+	}
+	pthread_mutex_unlock(&reloader->mutex);
+
+	return 0;
+}
+
 static const call_env_method_t method_env = {
 	FR_CALL_ENV_METHOD_OUT(rlm_files_env_t),
 	.env = (call_env_parser_t[]){
@@ -673,6 +1321,9 @@ module_rlm_t rlm_files = {
 		.name		= "files",
 		.inst_size	= sizeof(rlm_files_t),
 		.config		= module_config,
+		.bootstrap	= mod_bootstrap,
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach
 	},
 	.method_names = (module_method_name_t[]){
 		{ .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,		.method = mod_files,
@@ -0,0 +1,527 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file group_cache.c
+ * @brief Cache of group DN/name mappings and group membership results.
+ *
+ * Group checks frequently need to resolve the same group DNs to names (and
+ * names to DNs), and check the same users against the same groups.  The
+ * results are stored here, shared between all worker threads, so repeated
+ * checks don't need to go back to the directory.
+ *
+ * Failed resolutions and non-membership are also cached, with a separate
+ * (usually shorter) TTL.
+ *
+ * @copyright 2024 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/heap.h>
+
+#define LOG_PREFIX "rlm_ldap group cache"
+
+#include "rlm_ldap.h"
+
+typedef enum {
+	LDAP_GROUP_CACHE_DN2NAME = 0,				//!< Group DN to group name.
+	LDAP_GROUP_CACHE_NAME2DN,				//!< Group name to group DN.
+	LDAP_GROUP_CACHE_MEMBER					//!< User DN and group to membership.
+} ldap_group_cache_type_t;
+
+typedef struct {
+	ldap_group_cache_type_t	type;				//!< What kind of mapping this is.
+	char const		*key;				//!< Group DN, group name or user DN.
+	char const		*group;				//!< Group DN or name, for membership entries.
+	bool			group_is_dn;			//!< Whether group is a DN.
+
+	char const		*value;				//!< Resolved group name or DN, or NULL
+								///< if it didn't resolve.
+	bool			member;				//!< Whether the user is a member of the group.
+
+	fr_time_t		expires;			//!< When the entry should be removed.
+
+	fr_rb_node_t		node;				//!< Entry in the lookup tree.
+	fr_heap_index_t		heap_id;			//!< Entry in the expiry heap.
+} ldap_group_cache_entry_t;
+
+struct rlm_ldap_group_cache_s {
+	rlm_ldap_group_cache_conf_t const	*config;	//!< TTLs and size limit.
+
+	pthread_mutex_t		mutex;				//!< Protects the tree and heap.
+	fr_rb_tree_t		*tree;				//!< Entries, for lookups.
+	fr_heap_t		*heap;				//!< Entries, ordered by expiry.
+};
+
+/** Compare DNs, which are case insensitive, or group names, which are case sensitive
+ *
+ */
+static inline CC_HINT(always_inline) int8_t group_cache_strcmp(char const *a, char const *b, bool is_dn)
+{
+	int ret = is_dn ? strcasecmp(a, b) : strcmp(a, b);
+
+	return CMP(ret, 0);
+}
+
+static int8_t group_cache_entry_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+	int8_t ret;
+
+	ret = CMP(a->type, b->type);
+	if (ret != 0) return ret;
+
+	ret = group_cache_strcmp(a->key, b->key, (a->type != LDAP_GROUP_CACHE_NAME2DN));
+	if ((ret != 0) || (a->type != LDAP_GROUP_CACHE_MEMBER)) return ret;
+
+	ret = CMP(a->group_is_dn, b->group_is_dn);
+	if (ret != 0) return ret;
+
+	return group_cache_strcmp(a->group, b->group, a->group_is_dn);
+}
+
+static int8_t group_cache_heap_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+
+	return fr_time_cmp(a->expires, b->expires);
+}
+
+/** Remove an entry from the tree and heap, and free it
+ *
+ * @note Called with the mutex held.
+ */
+static void group_cache_entry_free(rlm_ldap_group_cache_t *cache, ldap_group_cache_entry_t *entry)
+{
+	fr_rb_remove(cache->tree, entry);
+	fr_heap_extract(&cache->heap, entry);
+	talloc_free(entry);
+}
+
+/** Remove entries which have expired
+ *
+ * @note Called with the mutex held.
+ */
+static void group_cache_expire(rlm_ldap_group_cache_t *cache, fr_time_t now)
+{
+	ldap_group_cache_entry_t *entry;
+
+	while ((entry = fr_heap_peek(cache->heap)) && fr_time_lteq(entry->expires, now)) {
+		group_cache_entry_free(cache, entry);
+	}
+}
+
+/** Find an entry, removing it if it's expired
+ *
+ * @note Called with the mutex held.
+ */
+static ldap_group_cache_entry_t *group_cache_find(rlm_ldap_group_cache_t *cache, ldap_group_cache_entry_t const *find)
+{
+	ldap_group_cache_entry_t *entry;
+
+	entry = fr_rb_find(cache->tree, find);
+	if (!entry) return NULL;
+
+	if (fr_time_lteq(entry->expires, fr_time())) {
+		group_cache_entry_free(cache, entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/** Add an entry, replacing any existing entry with the same key
+ *
+ * @note Called with the mutex held.
+ */
+static void group_cache_insert(rlm_ldap_group_cache_t *cache, ldap_group_cache_entry_t *entry, bool positive)
+{
+	fr_time_t			now = fr_time();
+	ldap_group_cache_entry_t	*old;
+
+	group_cache_expire(cache, now);
+
+	old = fr_rb_find(cache->tree, entry);
+	if (old) group_cache_entry_free(cache, old);
+
+	/*
+	 *	Negative caching is disabled
+	 */
+	if (!positive && !fr_time_delta_ispos(cache->config->negative_ttl)) {
+		talloc_free(entry);
+		return;
+	}
+
+	/*
+	 *	Make room by evicting whatever
+	 *	would have expired soonest.
+	 */
+	if (cache->config->max_entries && (fr_rb_num_elements(cache->tree) >= cache->config->max_entries)) {
+		group_cache_entry_free(cache, fr_heap_peek(cache->heap));
+	}
+
+	entry->expires = fr_time_add(now, positive ? cache->config->ttl : cache->config->negative_ttl);
+
+	if (!fr_cond_assert(fr_rb_insert(cache->tree, entry))) {
+		talloc_free(entry);
+		return;
+	}
+	fr_heap_insert(&cache->heap, entry);
+}
+
+/** Look up a group name or DN
+ *
+ * @param[in] ctx	to allocate the result in.
+ * @param[out] out	Where to write the name or DN.  Will be NULL unless
+ *			#LDAP_GROUP_CACHE_HIT is returned.
+ * @param[in] cache	to search in.
+ * @param[in] type	of lookup.
+ * @param[in] key	DN or name to resolve.
+ */
+static ldap_group_cache_status_t group_cache_resolve(TALLOC_CTX *ctx, char **out, rlm_ldap_group_cache_t *cache,
+						     ldap_group_cache_type_t type, char const *key)
+{
+	ldap_group_cache_entry_t	find = { .type = type, .key = key }, *entry;
+	ldap_group_cache_status_t	status = LDAP_GROUP_CACHE_MISS;
+
+	*out = NULL;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = group_cache_find(cache, &find);
+	if (entry) {
+		if (entry->value) {
+			MEM(*out = talloc_strdup(ctx, entry->value));
+			status = LDAP_GROUP_CACHE_HIT;
+		} else {
+			status = LDAP_GROUP_CACHE_NEGATIVE;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return status;
+}
+
+/** Store a group name or DN
+ *
+ */
+static void group_cache_resolve_store(rlm_ldap_group_cache_t *cache, ldap_group_cache_type_t type,
+				      char const *key, char const *value, size_t value_len)
+{
+	ldap_group_cache_entry_t *entry;
+
+	MEM(entry = talloc_zero(NULL, ldap_group_cache_entry_t));
+	entry->type = type;
+	MEM(entry->key = talloc_strdup(entry, key));
+	if (value) MEM(entry->value = talloc_bstrndup(entry, value, value_len));
+
+	pthread_mutex_lock(&cache->mutex);
+	group_cache_insert(cache, entry, (value != NULL));
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Look up the name of a group, by its DN
+ *
+ * @param[in] ctx	to allocate the name in.
+ * @param[out] out	The group's name, if #LDAP_GROUP_CACHE_HIT is returned.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	of the group.
+ * @return
+ *	- #LDAP_GROUP_CACHE_HIT if the name was found.
+ *	- #LDAP_GROUP_CACHE_NEGATIVE if the DN is known not to resolve.
+ *	- #LDAP_GROUP_CACHE_MISS if nothing is cached, or caching is disabled.
+ */
+ldap_group_cache_status_t rlm_ldap_group_cache_dn2name(TALLOC_CTX *ctx, char **out,
+						       rlm_ldap_t const *inst, char const *dn)
+{
+	if (!inst->group_cache) {
+		*out = NULL;
+		return LDAP_GROUP_CACHE_MISS;
+	}
+
+	return group_cache_resolve(ctx, out, inst->group_cache, LDAP_GROUP_CACHE_DN2NAME, dn);
+}
+
+/** Store the name of a group
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	of the group.
+ * @param[in] name	of the group, or NULL if the DN did not resolve.
+ * @param[in] name_len	Length of name.
+ */
+void rlm_ldap_group_cache_dn2name_store(rlm_ldap_t const *inst, char const *dn, char const *name, size_t name_len)
+{
+	if (!inst->group_cache) return;
+
+	group_cache_resolve_store(inst->group_cache, LDAP_GROUP_CACHE_DN2NAME, dn, name, name_len);
+}
+
+/** Look up the DN of a group, by its name
+ *
+ * @param[in] ctx	to allocate the DN in.
+ * @param[out] out	The group's DN, if #LDAP_GROUP_CACHE_HIT is returned.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] name	of the group.
+ * @return
+ *	- #LDAP_GROUP_CACHE_HIT if the DN was found.
+ *	- #LDAP_GROUP_CACHE_NEGATIVE if the name is known not to resolve.
+ *	- #LDAP_GROUP_CACHE_MISS if nothing is cached, or caching is disabled.
+ */
+ldap_group_cache_status_t rlm_ldap_group_cache_name2dn(TALLOC_CTX *ctx, char **out,
+						       rlm_ldap_t const *inst, char const *name)
+{
+	if (!inst->group_cache) {
+		*out = NULL;
+		return LDAP_GROUP_CACHE_MISS;
+	}
+
+	return group_cache_resolve(ctx, out, inst->group_cache, LDAP_GROUP_CACHE_NAME2DN, name);
+}
+
+/** Store the DN of a group
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] name	of the group.
+ * @param[in] dn	of the group, or NULL if the name did not resolve.
+ */
+void rlm_ldap_group_cache_name2dn_store(rlm_ldap_t const *inst, char const *name, char const *dn)
+{
+	if (!inst->group_cache) return;
+
+	group_cache_resolve_store(inst->group_cache, LDAP_GROUP_CACHE_NAME2DN, name, dn, dn ? strlen(dn) : 0);
+}
+
+/** Look up whether a user is a member of a group
+ *
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] user_dn		of the user.
+ * @param[in] group		Name or DN of the group.
+ * @param[in] group_is_dn	Whether group is a DN.
+ * @return
+ *	- #LDAP_GROUP_CACHE_HIT if the user is a member.
+ *	- #LDAP_GROUP_CACHE_NEGATIVE if the user is not a member.
+ *	- #LDAP_GROUP_CACHE_MISS if nothing is cached, or caching is disabled.
+ */
+ldap_group_cache_status_t rlm_ldap_group_cache_member(rlm_ldap_t const *inst, char const *user_dn,
+						      fr_value_box_t const *group, bool group_is_dn)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	find = {
+						.type = LDAP_GROUP_CACHE_MEMBER,
+						.key = user_dn,
+						.group = group->vb_strvalue,
+						.group_is_dn = group_is_dn
+					}, *entry;
+	ldap_group_cache_status_t	status = LDAP_GROUP_CACHE_MISS;
+
+	if (!cache) return LDAP_GROUP_CACHE_MISS;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = group_cache_find(cache, &find);
+	if (entry) status = entry->member ? LDAP_GROUP_CACHE_HIT : LDAP_GROUP_CACHE_NEGATIVE;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return status;
+}
+
+/** Store whether a user is a member of a group
+ *
+ * @param[in] inst		rlm_ldap configuration.
+ * @param[in] user_dn		of the user.
+ * @param[in] group		Name or DN of the group.
+ * @param[in] group_is_dn	Whether group is a DN.
+ * @param[in] member		Whether the user is a member of the group.
+ */
+void rlm_ldap_group_cache_member_store(rlm_ldap_t const *inst, char const *user_dn,
+				       fr_value_box_t const *group, bool group_is_dn, bool member)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	*entry;
+
+	if (!cache) return;
+
+	MEM(entry = talloc_zero(NULL, ldap_group_cache_entry_t));
+	entry->type = LDAP_GROUP_CACHE_MEMBER;
+	MEM(entry->key = talloc_strdup(entry, user_dn));
+	MEM(entry->group = talloc_bstrndup(entry, group->vb_strvalue, group->vb_length));
+	entry->group_is_dn = group_is_dn;
+	entry->member = member;
+
+	pthread_mutex_lock(&cache->mutex);
+	group_cache_insert(cache, entry, member);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Remove entries referencing an object
+ *
+ * If the object is a group we know about, its membership may have changed, so
+ * the membership results for that group, and its DN/name mappings, are removed.
+ * Membership results which reference the group by name can only be matched if
+ * the group's name is cached.  If it isn't, all membership results which
+ * reference a group by name are removed.
+ *
+ * Membership results for the object as a user are always removed.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	of the object which changed.  If NULL, all entries are removed.
+ * @return The number of entries removed.
+ */
+uint32_t rlm_ldap_group_cache_invalidate(rlm_ldap_t const *inst, char const *dn)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	fr_rb_iter_inorder_t		iter;
+	ldap_group_cache_entry_t	*entry;
+	char const			*name = NULL;
+	bool				is_group = false;
+	uint32_t			removed = 0;
+
+	if (!cache) return 0;
+
+	pthread_mutex_lock(&cache->mutex);
+
+	/*
+	 *	Is this a group we know about?  If so we also
+	 *	need to remove results which reference it by name.
+	 */
+	if (dn) {
+		for (entry = fr_rb_iter_init_inorder(&iter, cache->tree);
+		     entry;
+		     entry = fr_rb_iter_next_inorder(&iter)) {
+			switch (entry->type) {
+			case LDAP_GROUP_CACHE_DN2NAME:
+				if (strcasecmp(entry->key, dn) != 0) continue;
+				name = entry->value;
+				break;
+
+			case LDAP_GROUP_CACHE_NAME2DN:
+				if (!entry->value || (strcasecmp(entry->value, dn) != 0)) continue;
+				name = entry->key;
+				break;
+
+			case LDAP_GROUP_CACHE_MEMBER:
+				if (!entry->group_is_dn || (strcasecmp(entry->group, dn) != 0)) continue;
+				break;
+			}
+
+			is_group = true;
+			if (name) break;
+		}
+		if (name) MEM(name = talloc_strdup(NULL, name));	/* Entry is about to be freed */
+	}
+
+	for (entry = fr_rb_iter_init_inorder(&iter, cache->tree);
+	     entry;
+	     entry = fr_rb_iter_next_inorder(&iter)) {
+		if (dn) {
+			switch (entry->type) {
+			case LDAP_GROUP_CACHE_DN2NAME:
+				if (strcasecmp(entry->key, dn) != 0) continue;
+				break;
+
+			case LDAP_GROUP_CACHE_NAME2DN:
+				if ((!name || (strcmp(entry->key, name) != 0)) &&
+				    (!entry->value || (strcasecmp(entry->value, dn) != 0))) continue;
+				break;
+
+			case LDAP_GROUP_CACHE_MEMBER:
+				if (strcasecmp(entry->key, dn) == 0) break;		/* Object is the user */
+				if (!is_group) continue;
+
+				if (entry->group_is_dn) {
+					if (strcasecmp(entry->group, dn) != 0) continue;
+				} else {
+					if (name && (strcmp(entry->group, name) != 0)) continue;
+				}
+				break;
+			}
+		}
+
+		fr_rb_iter_delete_inorder(&iter);
+		fr_heap_extract(&cache->heap, entry);
+		talloc_free(entry);
+		removed++;
+	}
+
+	pthread_mutex_unlock(&cache->mutex);
+
+	talloc_const_free(name);
+
+	return removed;
+}
+
+static int _group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+	ldap_group_cache_entry_t *entry;
+
+	/*
+	 *	Entries are allocated in the NULL ctx, as talloc
+	 *	isn't thread safe when allocating from a shared parent.
+	 */
+	while ((entry = fr_heap_pop(&cache->heap))) {
+		fr_rb_remove(cache->tree, entry);
+		talloc_free(entry);
+	}
+
+	pthread_mutex_destroy(&cache->mutex);
+	return 0;
+}
+
+/** Allocate the group cache for a module instance
+ *
+ * Does nothing if the cache is disabled, i.e. the TTL is 0.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	rlm_ldap_group_cache_t	*cache;
+	int			ret;
+
+	if (!fr_time_delta_ispos(inst->group.cache.ttl)) return 0;
+
+	MEM(cache = talloc_zero(inst, rlm_ldap_group_cache_t));
+	cache->config = &inst->group.cache;
+
+	cache->tree = fr_rb_inline_talloc_alloc(cache, ldap_group_cache_entry_t, node, group_cache_entry_cmp, NULL);
+	if (!cache->tree) {
+		ERROR("Failed creating group cache");
+	error:
+		talloc_free(cache);
+		return -1;
+	}
+
+	cache->heap = fr_heap_talloc_alloc(cache, group_cache_heap_cmp, ldap_group_cache_entry_t, heap_id, 0);
+	if (!cache->heap) {
+		ERROR("Failed creating group cache expiry heap");
+		goto error;
+	}
+
+	if ((ret = pthread_mutex_init(&cache->mutex, NULL)) != 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(ret));
+		goto error;
+	}
+	talloc_set_destructor(cache, _group_cache_free);
+
+	inst->group_cache = cache;
+
+	return 0;
+}
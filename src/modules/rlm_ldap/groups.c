@@ -146,9 +146,47 @@ static unlang_action_t ldap_group_name2dn_start(rlm_rcode_t *p_result, UNUSED in
 					       inst->group.obj_filter ? ")" : "",
 					       group_ctx->group_name[0] && group_ctx->group_name[1] ? ")" : "");
 
+	/*
+	 *	If we're caching the results we need to know which
+	 *	group object corresponds to which name.
+	 */
 	return fr_ldap_trunk_search(group_ctx, &group_ctx->query, request, group_ctx->ttrunk,
 				    group_ctx->base_dn->vb_strvalue, inst->group.obj_scope, filter,
-				    null_attrs, NULL, NULL);
+				    inst->group_cache ? group_ctx->attrs : null_attrs, NULL, NULL);
+}
+
+/** Record which group names a group object matched, so the mapping can be cached
+ *
+ * @param[in] group_ctx		Group lookup context.
+ * @param[in] handle		the entry was retrieved with.
+ * @param[in] entry		Group object.
+ * @param[in] dn		Normalised DN of the group object.
+ * @param[in,out] resolved	Which names have been resolved.
+ */
+static void ldap_group_name2dn_cache_store(ldap_group_userobj_ctx_t *group_ctx, LDAP *handle, LDAPMessage *entry,
+					   char const *dn, bool resolved[])
+{
+	rlm_ldap_t const	*inst = group_ctx->inst;
+	struct berval		**values;
+	int			i, count;
+	unsigned int		j;
+
+	values = ldap_get_values_len(handle, entry, inst->group.obj_name_attr);
+	if (!values) return;
+
+	count = ldap_count_values_len(values);
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < group_ctx->name_cnt; j++) {
+			if (resolved[j]) continue;
+			if ((strlen(group_ctx->group_name[j]) != values[i]->bv_len) ||
+			    (strncasecmp(group_ctx->group_name[j], values[i]->bv_val, values[i]->bv_len) != 0)) continue;
+
+			rlm_ldap_group_cache_name2dn_store(inst, group_ctx->group_name[j], dn);
+			resolved[j] = true;
+		}
+	}
+
+	ldap_value_free_len(values);
 }
 
 /** Process the results of looking up group DNs from names
@@ -171,6 +209,9 @@ static unlang_action_t ldap_group_name2dn_resume(rlm_rcode_t *p_result, UNUSED i
 	int				ldap_errno;
 	char				*dn;
 	fr_pair_t			*vp;
+	bool				resolved[LDAP_MAX_CACHEABLE + 1] = { false };
+	bool				cache_negative = false;
+	unsigned int			i;
 
 	switch (query->ret) {
 	case LDAP_RESULT_SUCCESS:
@@ -179,6 +220,7 @@ static unlang_action_t ldap_group_name2dn_resume(rlm_rcode_t *p_result, UNUSED i
 	case LDAP_RESULT_NO_RESULT:
 	case LDAP_RESULT_BAD_DN:
 		RDEBUG2("Tried to resolve group name(s) to DNs but got no results");
+		cache_negative = true;
 		goto finish;
 
 	default:
@@ -223,10 +265,24 @@ static unlang_action_t ldap_group_name2dn_resume(rlm_rcode_t *p_result, UNUSED i
 		MEM(vp = fr_pair_afrom_da(group_ctx->list_ctx, inst->group.cache_da));
 		fr_pair_value_bstrndup(vp, dn, strlen(dn), true);
 		fr_pair_append(&group_ctx->groups, vp);
+
+		if (inst->group_cache) ldap_group_name2dn_cache_store(group_ctx, query->ldap_conn->handle, entry,
+								       dn, resolved);
 		ldap_memfree(dn);
 	} while((entry = ldap_next_entry(query->ldap_conn->handle, entry)));
+	cache_negative = true;
 
 finish:
+	/*
+	 *	Any names which didn't match a group object
+	 *	don't resolve.
+	 */
+	if (cache_negative && inst->group_cache) {
+		for (i = 0; i < group_ctx->name_cnt; i++) {
+			if (!resolved[i]) rlm_ldap_group_cache_name2dn_store(inst, group_ctx->group_name[i], NULL);
+		}
+	}
+
 	/*
 	 *	Remove pointer to group name to resolve so we don't
 	 *	try to do it again
@@ -296,6 +352,7 @@ static unlang_action_t ldap_group_dn2name_resume(rlm_rcode_t *p_result, UNUSED i
 	case LDAP_RESULT_BAD_DN:
 		REDEBUG("Group DN \"%s\" did not resolve to an object", *group_ctx->dn);
 		rcode = (inst->group.allow_dangling_refs ? RLM_MODULE_NOOP : RLM_MODULE_INVALID);
+		rlm_ldap_group_cache_dn2name_store(inst, *group_ctx->dn, NULL, 0);
 		goto finish;
 
 	default:
@@ -323,6 +380,8 @@ static unlang_action_t ldap_group_dn2name_resume(rlm_rcode_t *p_result, UNUSED i
 	fr_pair_append(&group_ctx->groups, vp);
 	RDEBUG2("Group DN \"%s\" resolves to name \"%pV\"", *group_ctx->dn, &vp->data);
 
+	rlm_ldap_group_cache_dn2name_store(inst, *group_ctx->dn, values[0]->bv_val, values[0]->bv_len);
+
 finish:
 	/*
 	 *	Walk the pointer to the DN being resolved forward
@@ -369,6 +428,83 @@ static unlang_action_t ldap_cacheable_userobj_store(rlm_rcode_t *p_result, reque
 	RETURN_MODULE_OK;
 }
 
+/** Resolve as many group DNs to names as possible using the group cache
+ *
+ * Walks the pointer to the DN being resolved forward past any DNs with cached results.
+ *
+ * @param[in] request		Current request.
+ * @param[in] group_ctx		The group resolution context.
+ * @return
+ *	- 0 on success.
+ *	- -1 if a DN is known not to resolve, and dangling references are not allowed.
+ */
+static int ldap_group_dn2name_cached(request_t *request, ldap_group_userobj_ctx_t *group_ctx)
+{
+	rlm_ldap_t const	*inst = group_ctx->inst;
+	char			*name;
+	fr_pair_t		*vp;
+
+	while (*group_ctx->dn) {
+		switch (rlm_ldap_group_cache_dn2name(group_ctx, &name, inst, *group_ctx->dn)) {
+		case LDAP_GROUP_CACHE_MISS:
+			return 0;
+
+		case LDAP_GROUP_CACHE_HIT:
+			MEM(vp = fr_pair_afrom_da(group_ctx->list_ctx, inst->group.cache_da));
+			fr_pair_value_bstrndup(vp, name, talloc_array_length(name) - 1, true);
+			fr_pair_append(&group_ctx->groups, vp);
+			RDEBUG2("Group DN \"%s\" resolves to name \"%pV\" (cached)", *group_ctx->dn, &vp->data);
+			talloc_free(name);
+			break;
+
+		case LDAP_GROUP_CACHE_NEGATIVE:
+			REDEBUG("Group DN \"%s\" did not resolve to an object (cached)", *group_ctx->dn);
+			if (!inst->group.allow_dangling_refs) return -1;
+			break;
+		}
+
+		group_ctx->dn++;
+	}
+
+	return 0;
+}
+
+/** Resolve as many group names to DNs as possible using the group cache
+ *
+ * Names with cached results are removed from the list of names which need resolving.
+ *
+ * @param[in] request		Current request.
+ * @param[in] group_ctx		The group resolution context.
+ */
+static void ldap_group_name2dn_cached(request_t *request, ldap_group_userobj_ctx_t *group_ctx)
+{
+	rlm_ldap_t const	*inst = group_ctx->inst;
+	char			**in, **out;
+	char			*dn;
+	fr_pair_t		*vp;
+
+	for (in = out = group_ctx->group_name; *in; in++) {
+		switch (rlm_ldap_group_cache_name2dn(group_ctx, &dn, inst, *in)) {
+		case LDAP_GROUP_CACHE_MISS:
+			*out++ = *in;
+			continue;
+
+		case LDAP_GROUP_CACHE_HIT:
+			MEM(vp = fr_pair_afrom_da(group_ctx->list_ctx, inst->group.cache_da));
+			fr_pair_value_bstrndup(vp, dn, talloc_array_length(dn) - 1, true);
+			fr_pair_append(&group_ctx->groups, vp);
+			RDEBUG2("Group name \"%s\" resolves to DN \"%pV\" (cached)", *in, &vp->data);
+			talloc_free(dn);
+			break;
+
+		case LDAP_GROUP_CACHE_NEGATIVE:
+			RDEBUG2("Group name \"%s\" did not resolve to a DN (cached)", *in);
+			break;
+		}
+	}
+	*out = NULL;
+}
+
 /** Initiate DN to name and name to DN group lookups
  *
  * Called repeatedly until there are no more lookups to perform
@@ -397,6 +533,11 @@ static unlang_action_t ldap_cacheable_userobj_resolve(rlm_rcode_t *p_result, UNU
 		break;
 	}
 
+	if (group_ctx->inst->group_cache && (ldap_group_dn2name_cached(request, group_ctx) < 0)) {
+		talloc_free(group_ctx);
+		RETURN_MODULE_INVALID;
+	}
+
 	/*
 	 *	Are there any DN to resolve to names?
 	 *	These are resolved one at a time as most directories don't allow for
@@ -413,6 +554,7 @@ static unlang_action_t ldap_cacheable_userobj_resolve(rlm_rcode_t *p_result, UNU
 	/*
 	 *	Are there any names to resolve to DN?
 	 */
+	if (group_ctx->inst->group_cache) ldap_group_name2dn_cached(request, group_ctx);
 	if (*group_ctx->group_name) {
 		if (unlang_function_repeat_set(request, ldap_cacheable_userobj_resolve) < 0) RETURN_MODULE_FAIL;
 		if (unlang_function_push(request, ldap_group_name2dn_start, ldap_group_name2dn_resume,
@@ -444,7 +586,6 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, request_t *req
 					   char const *attr)
 {
 	rlm_ldap_t const		*inst = autz_ctx->inst;
-	LDAPMessage			*entry = autz_ctx->entry;
 	fr_ldap_thread_trunk_t		*ttrunk = autz_ctx->ttrunk;
 	ldap_group_userobj_ctx_t	*group_ctx;
 	struct berval			**values;
@@ -453,13 +594,13 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, request_t *req
 	fr_pair_t			*vp;
 	int				is_dn, i, count, name2dn = 0, dn2name = 0;
 
-	fr_assert(entry);
+	fr_assert(autz_ctx->entry || autz_ctx->replica_entry);
 	fr_assert(attr);
 
 	/*
 	 *	Parse the membership information we got in the initial user query.
 	 */
-	values = ldap_get_values_len(fr_ldap_handle_thread_local(), entry, attr);
+	values = rlm_ldap_user_values(autz_ctx, attr);
 	if (!values) {
 		RDEBUG2("No cacheable group memberships found in user object");
 
@@ -509,7 +650,7 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, request_t *req
 				if (++name2dn > LDAP_MAX_CACHEABLE) {
 					REDEBUG("Too many groups require name to DN resolution");
 				invalid:
-					ldap_value_free_len(values);
+					rlm_ldap_user_values_free(autz_ctx, values);
 					talloc_free(group_ctx);
 					RETURN_MODULE_INVALID;
 				}
@@ -539,7 +680,7 @@ unlang_action_t rlm_ldap_cacheable_userobj(rlm_rcode_t *p_result, request_t *req
 		}
 	}
 
-	ldap_value_free_len(values);
+	rlm_ldap_user_values_free(autz_ctx, values);
 
 	/*
 	 *	We either have group names which need converting to DNs or
@@ -139,6 +139,32 @@ unlang_action_t rlm_ldap_map_profile(fr_ldap_result_code_t *ret,
 
 	if (!dn || !*dn) return UNLANG_ACTION_CALCULATE_RESULT;
 
+	if (inst->replica) {
+		fr_ldap_replica_entry_t	*entry;
+
+		switch (fr_ldap_replica_search(NULL, &entry, inst->replica, dn, scope, filter, expanded->attrs)) {
+		case LDAP_REPLICA_FOUND:
+			if (ret) *ret = LDAP_RESULT_SUCCESS;
+
+			RDEBUG2("Processing profile attributes from replica \"%s\"", inst->replica_name);
+			RINDENT();
+			if ((fr_ldap_map_do_replica(request, inst->valuepair_attr, expanded, entry) < 0) && ret) {
+				*ret = LDAP_RESULT_ERROR;
+			}
+			REXDENT();
+			talloc_free(entry);
+			return UNLANG_ACTION_CALCULATE_RESULT;
+
+		case LDAP_REPLICA_NOT_FOUND:
+			if (ret) *ret = LDAP_RESULT_NO_RESULT;
+			RDEBUG2("Profile object \"%s\" not found in replica \"%s\"", dn, inst->replica_name);
+			return UNLANG_ACTION_CALCULATE_RESULT;
+
+		case LDAP_REPLICA_UNAVAILABLE:
+			break;
+		}
+	}
+
 	MEM(profile_ctx = talloc(unlang_interpret_frame_talloc_ctx(request), ldap_profile_ctx_t));
 	*profile_ctx = (ldap_profile_ctx_t) {
 		.ret = ret,
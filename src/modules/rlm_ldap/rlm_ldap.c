@@ -107,6 +107,16 @@ static conf_parser_t user_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Group cache configuration
+ */
+static conf_parser_t group_cache_config[] = {
+	{ FR_CONF_OFFSET("ttl", rlm_ldap_t, group.cache.ttl), .dflt = "0" },
+	{ FR_CONF_OFFSET("negative_ttl", rlm_ldap_t, group.cache.negative_ttl), .dflt = "30" },
+	{ FR_CONF_OFFSET("max_entries", rlm_ldap_t, group.cache.max_entries), .dflt = "10000" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Group configuration
  */
@@ -124,6 +134,7 @@ static conf_parser_t group_config[] = {
 	{ FR_CONF_OFFSET("group_attribute", rlm_ldap_t, group.attribute) },
 	{ FR_CONF_OFFSET("allow_dangling_group_ref", rlm_ldap_t, group.allow_dangling_refs), .dflt = "no" },
 	{ FR_CONF_OFFSET("skip_on_suspend", rlm_ldap_t, group.skip_on_suspend), .dflt = "yes"},
+	{ FR_CONF_POINTER("cache", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) group_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -148,6 +159,8 @@ static const conf_parser_t module_config[] = {
 
 	{ FR_CONF_OFFSET("valuepair_attribute", rlm_ldap_t, valuepair_attr) },
 
+	{ FR_CONF_OFFSET("replica", rlm_ldap_t, replica_name) },
+
 #ifdef LDAP_CONTROL_X_SESSION_TRACKING
 	{ FR_CONF_OFFSET("session_tracking", rlm_ldap_t, session_tracking), .dflt = "no" },
 #endif
@@ -810,6 +823,23 @@ static void ldap_memberof_xlat_cancel(UNUSED request_t *request, UNUSED fr_signa
 		goto finish; \
 	} while (0)
 
+/** Record whether a membership lookup failed, in which case the result can't be cached
+ *
+ */
+static inline CC_HINT(always_inline) void ldap_memberof_xlat_check_failed(ldap_memberof_xlat_ctx_t *xlat_ctx,
+									  rlm_rcode_t rcode)
+{
+	switch (rcode) {
+	case RLM_MODULE_FAIL:
+	case RLM_MODULE_INVALID:
+		xlat_ctx->failed = true;
+		break;
+
+	default:
+		break;
+	}
+}
+
 /** Run the state machine for the LDAP membership xlat
  *
  * This is called after each async lookup is completed
@@ -826,19 +856,37 @@ static unlang_action_t ldap_memberof_xlat_results(rlm_rcode_t *p_result, UNUSED
 		if (!xlat_ctx->dn) xlat_ctx->dn = rlm_find_user_dn_cached(request);
 		if (!xlat_ctx->dn) RETURN_MODULE_FAIL;
 
+		switch (rlm_ldap_group_cache_member(inst, xlat_ctx->dn, xlat_ctx->group, xlat_ctx->group_is_dn)) {
+		case LDAP_GROUP_CACHE_HIT:
+			RDEBUG2("User is a member of \"%pV\" (cached)", xlat_ctx->group);
+			xlat_ctx->found = true;
+			RETURN_MODULE_OK;
+
+		case LDAP_GROUP_CACHE_NEGATIVE:
+			RDEBUG2("User is not a member of \"%pV\" (cached)", xlat_ctx->group);
+			RETURN_MODULE_NOTFOUND;
+
+		case LDAP_GROUP_CACHE_MISS:
+			break;
+		}
+
 		if (inst->group.obj_membership_filter) {
 			REPEAT_LDAP_MEMBEROF_XLAT_RESULTS;
 			if (rlm_ldap_check_groupobj_dynamic(&rcode, request, xlat_ctx) == UNLANG_ACTION_PUSHED_CHILD) {
 				xlat_ctx->status = GROUP_XLAT_MEMB_FILTER;
 				return UNLANG_ACTION_PUSHED_CHILD;
 			}
+			ldap_memberof_xlat_check_failed(xlat_ctx, rcode);
 		}
-		FALL_THROUGH;
+		goto check_found;
 
 	case GROUP_XLAT_MEMB_FILTER:
+		ldap_memberof_xlat_check_failed(xlat_ctx, *p_result);
+
+	check_found:
 		if (xlat_ctx->found) {
 			rcode = RLM_MODULE_OK;
-			goto finish;
+			break;
 		}
 
 		if (inst->group.userobj_membership_attr) {
@@ -847,14 +895,25 @@ static unlang_action_t ldap_memberof_xlat_results(rlm_rcode_t *p_result, UNUSED
 				xlat_ctx->status = GROUP_XLAT_MEMB_ATTR;
 				return UNLANG_ACTION_PUSHED_CHILD;
 			}
+			ldap_memberof_xlat_check_failed(xlat_ctx, rcode);
 		}
-		FALL_THROUGH;
+		goto done;
 
 	case GROUP_XLAT_MEMB_ATTR:
+		ldap_memberof_xlat_check_failed(xlat_ctx, *p_result);
+
+	done:
 		if (xlat_ctx->found) rcode = RLM_MODULE_OK;
 		break;
 	}
 
+	/*
+	 *	Only cache definitive answers, a failed lookup
+	 *	may have hidden the user's membership.
+	 */
+	if (!xlat_ctx->failed) rlm_ldap_group_cache_member_store(inst, xlat_ctx->dn, xlat_ctx->group,
+								 xlat_ctx->group_is_dn, xlat_ctx->found);
+
 finish:
 	RETURN_MODULE_RCODE(rcode);
 }
@@ -973,6 +1032,56 @@ static xlat_action_t ldap_memberof_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat
 	return XLAT_ACTION_PUSH_UNLANG;
 }
 
+static xlat_arg_parser_t const ldap_group_cache_invalidate_xlat_arg[] = {
+	{ .concat = true, .type = FR_TYPE_STRING },
+	XLAT_ARG_PARSER_TERMINATOR
+};
+
+/** Remove entries from the group cache
+ *
+ * Intended to be called when the directory notifies us that an object has changed,
+ * e.g. from a proto_ldap_sync virtual server.  If the DN is a group, the membership
+ * results for that group are removed.  Membership results for the DN as a user are
+ * always removed.
+ *
+ * If no DN is provided, all entries are removed.
+ *
+ * Returns the number of entries removed.
+ *
+ * Example:
+@verbatim
+%ldap.group.cache.invalidate(%{LDAP-Sync.Entry-DN})
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t ldap_group_cache_invalidate_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat_ctx_t const *xctx,
+						      request_t *request, fr_value_box_list_t *in)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(xctx->mctx->inst->data, rlm_ldap_t);
+	fr_value_box_t		*dn_vb = fr_value_box_list_head(in);
+	fr_value_box_t		*vb;
+	char			*dn = NULL;
+
+	if (dn_vb) {
+		MEM(dn = talloc_array(ctx, char, dn_vb->vb_length + 1));
+		fr_ldap_util_normalise_dn(dn, dn_vb->vb_strvalue);
+	}
+
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL));
+	vb->vb_uint32 = rlm_ldap_group_cache_invalidate(inst, dn);
+	fr_dcursor_append(out, vb);
+
+	if (dn) {
+		RDEBUG2("Removed %u group cache entries for \"%s\"", vb->vb_uint32, dn);
+		talloc_free(dn);
+	} else {
+		RDEBUG2("Removed %u group cache entries", vb->vb_uint32);
+	}
+
+	return XLAT_ACTION_DONE;
+}
+
 typedef struct {
 	fr_ldap_result_code_t	ret;
 	LDAPURLDesc		*url;
@@ -1470,10 +1579,31 @@ static unlang_action_t CC_HINT(nonnull) mod_authenticate(rlm_rcode_t *p_result,
 /** Start LDAP authorization with async lookup of user DN
  *
  */
-static unlang_action_t mod_authorize_start(UNUSED rlm_rcode_t *p_result, UNUSED int *priority,
+static unlang_action_t mod_authorize_start(rlm_rcode_t *p_result, UNUSED int *priority,
 					   request_t *request, void *uctx)
 {
 	ldap_autz_ctx_t	*autz_ctx = talloc_get_type_abort(uctx, ldap_autz_ctx_t);
+
+	/*
+	 *	Answer from the replica if it can, without any network I/O
+	 */
+	if (autz_ctx->inst->replica) {
+		switch (rlm_ldap_find_user_replica(autz_ctx, &autz_ctx->replica_entry, autz_ctx->inst, request,
+						   &autz_ctx->call_env->user_base, &autz_ctx->call_env->user_filter,
+						   autz_ctx->expanded.attrs)) {
+		case LDAP_REPLICA_FOUND:
+			*p_result = RLM_MODULE_OK;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+
+		case LDAP_REPLICA_NOT_FOUND:
+			*p_result = RLM_MODULE_NOTFOUND;
+			return UNLANG_ACTION_CALCULATE_RESULT;
+
+		case LDAP_REPLICA_UNAVAILABLE:
+			break;
+		}
+	}
+
 	return rlm_ldap_find_user_async(autz_ctx, autz_ctx->inst, request, &autz_ctx->call_env->user_base,
 					&autz_ctx->call_env->user_filter, autz_ctx->ttrunk, autz_ctx->expanded.attrs,
 					&autz_ctx->query);
@@ -1530,6 +1660,8 @@ static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, UNUSED int *p
 		 */
 		if (*p_result != RLM_MODULE_OK) return UNLANG_ACTION_CALCULATE_RESULT;
 
+		if (autz_ctx->replica_entry) goto check_access;
+
 		autz_ctx->entry = ldap_first_entry(handle, autz_ctx->query->result);
 		if (!autz_ctx->entry) {
 			ldap_get_option(handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
@@ -1538,11 +1670,12 @@ static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, UNUSED int *p
 			goto finish;
 		}
 
+	check_access:
 		/*
 		 *	Check for access.
 		 */
 		if (inst->userobj_access_attr) {
-			autz_ctx->access_state = rlm_ldap_check_access(inst, request, autz_ctx->entry);
+			autz_ctx->access_state = rlm_ldap_check_access(inst, request, autz_ctx);
 			switch (autz_ctx->access_state) {
 			case LDAP_ACCESS_ALLOWED:
 				break;
@@ -1675,7 +1808,7 @@ static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, UNUSED int *p
 			if (inst->profile_attr) {
 				int count;
 
-				autz_ctx->profile_values = ldap_get_values_len(handle, autz_ctx->entry, inst->profile_attr);
+				autz_ctx->profile_values = rlm_ldap_user_values(autz_ctx, inst->profile_attr);
 				count = ldap_count_values_len(autz_ctx->profile_values);
 				if (count > 0) {
 					RDEBUG2("Processing %i profile(s) found in attribute \"%s\"", count, inst->profile_attr);
@@ -1694,7 +1827,7 @@ static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, UNUSED int *p
 			if (inst->profile_attr_suspend) {
 				int count;
 
-				autz_ctx->profile_values = ldap_get_values_len(handle, autz_ctx->entry, inst->profile_attr_suspend);
+				autz_ctx->profile_values = rlm_ldap_user_values(autz_ctx, inst->profile_attr_suspend);
 				count = ldap_count_values_len(autz_ctx->profile_values);
 				if (count > 0) {
 					RDEBUG2("Processing %i suspension profile(s) found in attribute \"%s\"", count, inst->profile_attr_suspend);
@@ -1749,8 +1882,11 @@ static unlang_action_t mod_authorize_resume(rlm_rcode_t *p_result, UNUSED int *p
 		if (!map_list_empty(call_env->user_map) || inst->valuepair_attr) {
 			RDEBUG2("Processing user attributes");
 			RINDENT();
-			if (fr_ldap_map_do(request, inst->valuepair_attr,
-					   &autz_ctx->expanded, autz_ctx->entry) > 0) rcode = RLM_MODULE_UPDATED;
+			if (autz_ctx->replica_entry) {
+				if (fr_ldap_map_do_replica(request, inst->valuepair_attr,
+							   &autz_ctx->expanded, autz_ctx->replica_entry) > 0) rcode = RLM_MODULE_UPDATED;
+			} else if (fr_ldap_map_do(request, inst->valuepair_attr,
+						  &autz_ctx->expanded, autz_ctx->entry) > 0) rcode = RLM_MODULE_UPDATED;
 			REXDENT();
 			rlm_ldap_check_reply(request, autz_ctx->dlinst->name, call_env->expect_password->vb_bool, autz_ctx->ttrunk);
 		}
@@ -1778,7 +1914,7 @@ static void mod_authorize_cancel(UNUSED request_t *request, UNUSED fr_signal_t a
 static int autz_ctx_free(ldap_autz_ctx_t *autz_ctx)
 {
 	talloc_free(autz_ctx->expanded.ctx);
-	if (autz_ctx->profile_values) ldap_value_free_len(autz_ctx->profile_values);
+	rlm_ldap_user_values_free(autz_ctx, autz_ctx->profile_values);
 	return 0;
 }
 
@@ -2355,6 +2491,10 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	xlat_func_args_set(xlat, ldap_xlat_arg);
 	xlat_func_call_env_set(xlat, &xlat_profile_method_env);
 
+	if (unlikely(!(xlat = xlat_func_register_module(NULL, mctx, "group.cache.invalidate",
+							ldap_group_cache_invalidate_xlat, FR_TYPE_UINT32)))) return -1;
+	xlat_func_args_set(xlat, ldap_group_cache_invalidate_xlat_arg);
+
 	map_proc_register(inst, mctx->inst->name, mod_map_proc, ldap_map_verify, 0, LDAP_URI_SAFE_FOR);
 
 	return 0;
@@ -2646,6 +2786,16 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		}
 	}
 
+	if (rlm_ldap_group_cache_init(inst) < 0) goto error;
+
+	if (inst->replica_name) {
+		inst->replica = fr_ldap_replica_alloc(inst, inst->replica_name);
+		if (!inst->replica) {
+			cf_log_perr(conf, "Failed initialising replica \"%s\"", inst->replica_name);
+			goto error;
+		}
+	}
+
 	return 0;
 
 error:
@@ -23,6 +23,19 @@ typedef struct {
 	char const	*reference;			//!< Configuration reference string.
 } ldap_acct_section_t;
 
+/** Configuration for the group cache
+ *
+ */
+typedef struct {
+	fr_time_delta_t	ttl;				//!< How long to cache group DN/name mappings and
+							///< membership results for.  0 disables the cache.
+	fr_time_delta_t	negative_ttl;			//!< How long to cache failed resolutions and
+							///< non-membership for.  0 disables negative caching.
+	uint32_t	max_entries;			//!< Maximum number of entries to cache.
+} rlm_ldap_group_cache_conf_t;
+
+typedef struct rlm_ldap_group_cache_s rlm_ldap_group_cache_t;
+
 typedef struct {
 	/*
 	 *	Options
@@ -94,8 +107,17 @@ typedef struct {
 								///< from a user object.
 
 		bool		skip_on_suspend;		//!< Don't process groups if the user is suspended.
+
+		rlm_ldap_group_cache_conf_t	cache;		//!< Group cache configuration.
 	} group;
 
+	rlm_ldap_group_cache_t	*group_cache;		//!< Shared cache of group DN/name mappings and
+							///< membership results.  NULL if disabled.
+
+	char const	*replica_name;			//!< Name of the replica to answer user and profile
+							///< searches from.
+	fr_ldap_replica_t	*replica;		//!< Replica fed by proto_ldap_sync.  NULL if not used.
+
 	/*
 	 *	Profiles
 	 */
@@ -192,6 +214,7 @@ typedef struct {
 	fr_ldap_thread_trunk_t	*ttrunk;
 	ldap_autz_call_env_t	*call_env;
 	LDAPMessage		*entry;
+	fr_ldap_replica_entry_t	*replica_entry;		//!< User object from the replica, used instead of entry.
 	ldap_autz_status_t	status;
 	struct berval		**profile_values;
 	int			value_idx;
@@ -224,8 +247,18 @@ typedef struct {
 	fr_ldap_query_t			*query;
 	ldap_group_xlat_status_t	status;
 	bool				found;
+	bool				failed;		//!< A lookup failed, so the result can't be cached.
 } ldap_memberof_xlat_ctx_t;
 
+/** Result of a group cache lookup
+ *
+ */
+typedef enum {
+	LDAP_GROUP_CACHE_MISS = 0,			//!< Nothing cached.
+	LDAP_GROUP_CACHE_HIT,				//!< Found the mapping, or the user is a member.
+	LDAP_GROUP_CACHE_NEGATIVE			//!< Mapping doesn't resolve, or the user is not a member.
+} ldap_group_cache_status_t;
+
 extern HIDDEN fr_dict_attr_t const *attr_password;
 extern HIDDEN fr_dict_attr_t const *attr_cleartext_password;
 extern HIDDEN fr_dict_attr_t const *attr_crypt_password;
@@ -255,7 +288,15 @@ unlang_action_t rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst
 					 fr_ldap_thread_trunk_t *ttrunk, char const *attrs[],
 					 fr_ldap_query_t **query_out);
 
-ldap_access_state_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LDAPMessage *entry);
+fr_ldap_replica_rcode_t rlm_ldap_find_user_replica(TALLOC_CTX *ctx, fr_ldap_replica_entry_t **out,
+						   rlm_ldap_t const *inst, request_t *request,
+						   fr_value_box_t *base, fr_value_box_t *filter_box, char const * const *attrs);
+
+struct berval **rlm_ldap_user_values(ldap_autz_ctx_t const *autz_ctx, char const *attr);
+
+void rlm_ldap_user_values_free(ldap_autz_ctx_t const *autz_ctx, struct berval **values);
+
+ldap_access_state_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, ldap_autz_ctx_t const *autz_ctx);
 
 void rlm_ldap_check_reply(request_t *request, char const *inst_name, bool expect_password, fr_ldap_thread_trunk_t const *ttrunk);
 
@@ -276,6 +317,29 @@ unlang_action_t rlm_ldap_check_userobj_dynamic(rlm_rcode_t *p_result, request_t
 unlang_action_t rlm_ldap_check_cached(rlm_rcode_t *p_result,
 				      rlm_ldap_t const *inst, request_t *request, fr_value_box_t const *check);
 
+/*
+ *	group_cache.c - Shared cache of group DN/name mappings and membership results.
+ */
+ldap_group_cache_status_t rlm_ldap_group_cache_dn2name(TALLOC_CTX *ctx, char **out,
+						       rlm_ldap_t const *inst, char const *dn);
+
+void rlm_ldap_group_cache_dn2name_store(rlm_ldap_t const *inst, char const *dn, char const *name, size_t name_len);
+
+ldap_group_cache_status_t rlm_ldap_group_cache_name2dn(TALLOC_CTX *ctx, char **out,
+						       rlm_ldap_t const *inst, char const *name);
+
+void rlm_ldap_group_cache_name2dn_store(rlm_ldap_t const *inst, char const *name, char const *dn);
+
+ldap_group_cache_status_t rlm_ldap_group_cache_member(rlm_ldap_t const *inst, char const *user_dn,
+						      fr_value_box_t const *group, bool group_is_dn);
+
+void rlm_ldap_group_cache_member_store(rlm_ldap_t const *inst, char const *user_dn,
+				       fr_value_box_t const *group, bool group_is_dn, bool member);
+
+uint32_t rlm_ldap_group_cache_invalidate(rlm_ldap_t const *inst, char const *dn);
+
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
 unlang_action_t rlm_ldap_map_profile(fr_ldap_result_code_t *ret,
 				     rlm_ldap_t const *inst, request_t *request, fr_ldap_thread_trunk_t *ttrunk,
 				     char const *dn, int scope, char const *filter, fr_ldap_map_exp_t const *expanded);
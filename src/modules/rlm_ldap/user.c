@@ -183,21 +183,95 @@ unlang_action_t rlm_ldap_find_user_async(TALLOC_CTX *ctx, rlm_ldap_t const *inst
 				    user_ctx->attrs, serverctrls, NULL);
 }
 
+/** Look for a user object in the directory replica
+ *
+ * Uses the same base, scope and filter as a directory search.  If the user is
+ * found, their DN is added to the control list as LDAP-UserDN.
+ *
+ * @param[in] ctx	in which to allocate the copy of the user object.
+ * @param[out] out	Where to write the user object.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] request	Current request.
+ * @param[in] base	DN to search in.
+ * @param[in] filter	to use in the search.
+ * @param[in] attrs	Attributes which will be read from the user object, may be NULL.
+ * @return
+ *	- LDAP_REPLICA_FOUND if the user object was found.
+ *	- LDAP_REPLICA_NOT_FOUND if no user object matched.
+ *	- LDAP_REPLICA_UNAVAILABLE if the directory must be searched instead.
+ */
+fr_ldap_replica_rcode_t rlm_ldap_find_user_replica(TALLOC_CTX *ctx, fr_ldap_replica_entry_t **out,
+						   rlm_ldap_t const *inst, request_t *request,
+						   fr_value_box_t *base, fr_value_box_t *filter, char const * const *attrs)
+{
+	fr_ldap_replica_rcode_t	rcode;
+	fr_pair_t		*vp;
+
+	rcode = fr_ldap_replica_search(ctx, out, inst->replica, base->vb_strvalue, inst->userobj_scope,
+				       filter ? filter->vb_strvalue : NULL, attrs);
+	switch (rcode) {
+	case LDAP_REPLICA_UNAVAILABLE:
+		RDEBUG2("Replica \"%s\" can't answer the search, searching the directory", inst->replica_name);
+		break;
+
+	case LDAP_REPLICA_NOT_FOUND:
+		RDEBUG2("User object not found in replica \"%s\"", inst->replica_name);
+		break;
+
+	case LDAP_REPLICA_FOUND:
+		RDEBUG2("User object found in replica \"%s\" at DN \"%s\"", inst->replica_name, (*out)->dn);
+
+		MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
+		fr_pair_value_strdup(vp, (*out)->dn, false);
+		break;
+	}
+
+	return rcode;
+}
+
+/** Retrieve the values of an attribute of the user object
+ *
+ * The user object may have been retrieved from the directory or the replica.
+ *
+ * @param[in] autz_ctx	holding the user object.
+ * @param[in] attr	to retrieve values for.
+ * @return
+ *	- NULL terminated array of values.  Must be freed with #rlm_ldap_user_values_free.
+ *	- NULL if the user object doesn't have the attribute.
+ */
+struct berval **rlm_ldap_user_values(ldap_autz_ctx_t const *autz_ctx, char const *attr)
+{
+	if (autz_ctx->replica_entry) return fr_ldap_replica_entry_values(autz_ctx->replica_entry, attr);
+
+	return ldap_get_values_len(fr_ldap_handle_thread_local(), autz_ctx->entry, attr);
+}
+
+/** Free values returned by #rlm_ldap_user_values
+ *
+ * Values from the replica belong to the user object, and are freed with it.
+ */
+void rlm_ldap_user_values_free(ldap_autz_ctx_t const *autz_ctx, struct berval **values)
+{
+	if (!values || autz_ctx->replica_entry) return;
+
+	ldap_value_free_len(values);
+}
+
 /** Check for presence of access attribute in result
  *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
- * @param[in] entry retrieved by rlm_ldap_find_user or fr_ldap_search.
+ * @param[in] autz_ctx holding the user object retrieved by rlm_ldap_find_user_async or rlm_ldap_find_user_replica.
  * @return
  *	- #RLM_MODULE_DISALLOW if the user was denied access.
  *	- #RLM_MODULE_OK otherwise.
  */
-ldap_access_state_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LDAPMessage *entry)
+ldap_access_state_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, ldap_autz_ctx_t const *autz_ctx)
 {
 	ldap_access_state_t ret = LDAP_ACCESS_ALLOWED;
 	struct berval **values = NULL;
 
-	values = ldap_get_values_len(fr_ldap_handle_thread_local(), entry, inst->userobj_access_attr);
+	values = rlm_ldap_user_values(autz_ctx, inst->userobj_access_attr);
 	if (values) {
 		size_t negate_value_len = talloc_array_length(inst->access_value_negate) - 1;
 		if (inst->access_positive) {
@@ -225,7 +299,7 @@ ldap_access_state_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *req
 			}
 		}
 	done:
-		ldap_value_free_len(values);
+		rlm_ldap_user_values_free(autz_ctx, values);
 	} else if (inst->access_positive) {
 		REDEBUG("No \"%s\" attribute - user locked out", inst->userobj_access_attr);
 		ret = LDAP_ACCESS_DISALLOWED;
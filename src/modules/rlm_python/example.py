@@ -21,6 +21,8 @@ def authorize(p):
     print("")
     print(p)
     print("")
+    print(p.request.get("User-Name"))
+    print("")
     print(freeradius.config)
     print("")
     return freeradius.RLM_MODULE_OK
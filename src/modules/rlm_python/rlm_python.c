@@ -70,6 +70,8 @@ typedef struct {
 
 	PyObject	*pythonconf_dict;	//!< Configuration parameters defined in the module
 						//!< made available to the python script.
+
+	bool		per_thread;		//!< Give each worker thread its own interpreter and GIL.
 } rlm_python_t;
 
 /** Global config for python library
@@ -84,17 +86,28 @@ typedef struct {
  *
  * Multiple instances of python create multiple interpreters and each
  * thread must have a PyThreadState per interpreter, to track execution.
+ *
+ * If `per_thread` is set, each thread instead gets its own interpreter,
+ * with its own copy of the user's module, and its own GIL.
  */
 typedef struct {
 	PyThreadState	*state;			//!< Module instance/thread specific state.
+
+	PyThreadState	*interpreter;		//!< Thread specific interpreter, if we have one.
+	PyObject	*module;		//!< Thread specific "freeradius" module.
+	PyObject	*pythonconf_dict;	//!< Thread specific copy of the config.
+
+	python_func_def_t
+	authorize,
+	authenticate,
+	preacct,
+	accounting,
+	post_auth;
 } rlm_python_thread_t;
 
 static void			*python_dlhandle;
 static PyThreadState		*global_interpreter;	//!< Our first interpreter.
 
-static module_ctx_t const	*current_mctx;		//!< Used for communication with inittab functions.
-static CONF_SECTION		*current_conf;		//!< Used for communication with inittab functions.
-
 static libpython_global_config_t libpython_global_config = {
 	.path = NULL,
 	.path_include_default = true
@@ -159,6 +172,8 @@ static conf_parser_t module_config[] = {
 
 #undef A
 
+	{ FR_CONF_OFFSET("per_thread_interpreter", rlm_python_t, per_thread), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -366,74 +381,56 @@ static void mod_vptuple(TALLOC_CTX *ctx, module_ctx_t const *mctx, request_t *re
 }
 
 
-/*
- *	This is the core Python function that the others wrap around.
- *	Pass the value-pair print strings in a tuple.
+/** Convert the value of a pair to a Python object
+ *
+ * @return
+ *	- A new reference on success.
+ *	- NULL on failure, with the Python error set.
  */
-static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, PyObject *pp, fr_pair_t *vp)
+static PyObject *python_value_from_pair(fr_pair_t const *vp)
 {
-	PyObject *attribute = NULL;
-	PyObject *value = NULL;
-
-	attribute = PyUnicode_FromString(vp->da->name);
-	if (!attribute) return -1;
-
 	switch (vp->vp_type) {
 	case FR_TYPE_STRING:
-		value = PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
-		break;
+		return PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
 
 	case FR_TYPE_OCTETS:
-		value = PyBytes_FromStringAndSize((char const *)vp->vp_octets, vp->vp_length);
-		break;
+		return PyBytes_FromStringAndSize((char const *)vp->vp_octets, vp->vp_length);
 
 	case FR_TYPE_BOOL:
-		value = PyBool_FromLong(vp->vp_bool);
-		break;
+		return PyBool_FromLong(vp->vp_bool);
 
 	case FR_TYPE_UINT8:
-		value = PyLong_FromUnsignedLong(vp->vp_uint8);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_uint8);
 
 	case FR_TYPE_UINT16:
-		value = PyLong_FromUnsignedLong(vp->vp_uint16);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_uint16);
 
 	case FR_TYPE_UINT32:
-		value = PyLong_FromUnsignedLong(vp->vp_uint32);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_uint32);
 
 	case FR_TYPE_UINT64:
-		value = PyLong_FromUnsignedLongLong(vp->vp_uint64);
-		break;
+		return PyLong_FromUnsignedLongLong(vp->vp_uint64);
 
 	case FR_TYPE_INT8:
-		value = PyLong_FromLong(vp->vp_int8);
-		break;
+		return PyLong_FromLong(vp->vp_int8);
 
 	case FR_TYPE_INT16:
-		value = PyLong_FromLong(vp->vp_int16);
-		break;
+		return PyLong_FromLong(vp->vp_int16);
 
 	case FR_TYPE_INT32:
-		value = PyLong_FromLong(vp->vp_int32);
-		break;
+		return PyLong_FromLong(vp->vp_int32);
 
 	case FR_TYPE_INT64:
-		value = PyLong_FromLongLong(vp->vp_int64);
-		break;
+		return PyLong_FromLongLong(vp->vp_int64);
 
 	case FR_TYPE_FLOAT32:
-		value = PyFloat_FromDouble((double) vp->vp_float32);
-		break;
+		return PyFloat_FromDouble((double) vp->vp_float32);
 
 	case FR_TYPE_FLOAT64:
-		value = PyFloat_FromDouble(vp->vp_float64);
-		break;
+		return PyFloat_FromDouble(vp->vp_float64);
 
 	case FR_TYPE_SIZE:
-		value = PyLong_FromSize_t(vp->vp_size);
-		break;
+		return PyLong_FromSize_t(vp->vp_size);
 
 	case FR_TYPE_TIME_DELTA:
 	case FR_TYPE_DATE:
@@ -451,21 +448,98 @@ static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, Py
 
 		slen = fr_value_box_print(&FR_SBUFF_OUT(buffer, sizeof(buffer)), &vp->data, NULL);
 		if (slen < 0) {
-		error:
-			ROPTIONAL(REDEBUG, ERROR, "Failed marshalling %pP to Python value", vp);
-			python_error_log(mctx, request);
-			Py_XDECREF(attribute);
-			return -1;
+			PyErr_Format(PyExc_ValueError, "Failed printing value of \"%s\"", vp->da->name);
+			return NULL;
 		}
-		value = PyUnicode_FromStringAndSize(buffer, (size_t)slen);
+		return PyUnicode_FromStringAndSize(buffer, (size_t)slen);
 	}
-		break;
 
 	case FR_TYPE_NON_LEAF:
-		return 0;
+		break;
 	}
 
-	if (value == NULL) goto error;
+	Py_RETURN_NONE;
+}
+
+/** Set the value of a pair from a Python object
+ *
+ * Strings are parsed as the pair's type, and bytes are copied as-is
+ * to octets pairs.  Anything else is converted to a string first.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with the Python error set.
+ */
+static int python_value_to_pair(fr_pair_t *vp, PyObject *value)
+{
+	PyObject	*p_str;
+	char const	*str;
+	Py_ssize_t	len;
+	int		ret;
+
+	if (PyBytes_Check(value)) {
+		char *data;
+
+		if (PyBytes_AsStringAndSize(value, &data, &len) < 0) return -1;
+
+		if (vp->vp_type == FR_TYPE_OCTETS) {
+			ret = fr_pair_value_memdup(vp, (uint8_t const *)data, (size_t)len, false);
+		} else {
+			ret = fr_pair_value_from_str(vp, data, (size_t)len, NULL, false);
+		}
+		goto done;
+	}
+
+	if (PyBool_Check(value)) {
+		str = (value == Py_True) ? "yes" : "no";
+		ret = fr_pair_value_from_str(vp, str, strlen(str), NULL, false);
+		goto done;
+	}
+
+	if (PyUnicode_Check(value)) {
+		Py_INCREF(value);
+		p_str = value;
+	} else {
+		p_str = PyObject_Str(value);
+		if (!p_str) return -1;
+	}
+
+	str = PyUnicode_AsUTF8AndSize(p_str, &len);
+	if (!str) {
+		Py_DECREF(p_str);
+		return -1;
+	}
+	ret = fr_pair_value_from_str(vp, str, (size_t)len, NULL, false);
+	Py_DECREF(p_str);
+
+done:
+	if (ret < 0) {
+		PyErr_Format(PyExc_ValueError, "Failed setting \"%s\": %s", vp->da->name, fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	This is the core Python function that the others wrap around.
+ *	Pass the value-pair print strings in a tuple.
+ */
+static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, PyObject *pp, fr_pair_t *vp)
+{
+	PyObject *attribute = NULL;
+	PyObject *value = NULL;
+
+	attribute = PyUnicode_FromString(vp->da->name);
+	if (!attribute) return -1;
+
+	value = python_value_from_pair(vp);
+	if (!value) {
+		ROPTIONAL(REDEBUG, ERROR, "Failed marshalling %pP to Python value", vp);
+		python_error_log(mctx, request);
+		Py_XDECREF(attribute);
+		return -1;
+	}
 
 	PyTuple_SET_ITEM(pp, 0, attribute);
 	PyTuple_SET_ITEM(pp, 1, value);
@@ -473,58 +547,573 @@ static int mod_populate_vptuple(module_ctx_t const *mctx, request_t *request, Py
 	return 0;
 }
 
+/*
+ *	Lazy access to the request's pair lists.
+ *
+ *	Instead of converting every pair to a tuple before calling
+ *	the function, it gets a freeradius.Request object, whose
+ *	request, reply, control and session_state members are
+ *	mappings of attribute names to values.  Values are only
+ *	converted when they're read, and writes go straight to
+ *	the pairs.
+ *
+ *	Both types are heap types, created when the "freeradius"
+ *	module is imported, so each interpreter has its own.
+ */
+typedef enum {
+	PYTHON_LIST_REQUEST = 0,
+	PYTHON_LIST_REPLY,
+	PYTHON_LIST_CONTROL,
+	PYTHON_LIST_SESSION_STATE,
+	PYTHON_LIST_MAX
+} python_list_t;
+
+/** A mapping of attribute names to values, over one of a request's pair lists
+ *
+ */
+typedef struct {
+	PyObject_HEAD
+	request_t		*request;		//!< NULL once the function has returned.
+	python_list_t		list;			//!< Which of the request's lists this is.
+} python_pair_list_t;
+
+/** The argument passed to the python function
+ *
+ * For compatibility, it can also be iterated over and indexed like
+ * the tuple of (name, value) tuples which used to be passed.  That's
+ * only built if it's used.
+ */
+typedef struct {
+	PyObject_HEAD
+	request_t		*request;		//!< NULL once the function has returned.
+	PyTypeObject		*pair_list_type;	//!< Type to create the lists with.
+	PyObject		*lists[PYTHON_LIST_MAX];	//!< Created on first access.
+	PyObject		*tuple;			//!< (name, value) tuples of the request list.
+	module_ctx_t const	*mctx;			//!< For logging errors.
+} python_request_t;
+
+/** Per-interpreter state of the "freeradius" module
+ *
+ */
+typedef struct {
+	PyTypeObject		*request_type;		//!< freeradius.Request
+	PyTypeObject		*pair_list_type;	//!< freeradius.PairList
+} python_module_state_t;
+
+/** Return the pair list a python_pair_list_t refers to
+ *
+ * @return
+ *	- The pair list, with ctx set to where new pairs should be allocated.
+ *	- NULL if the function has returned, with the Python error set.
+ */
+static fr_pair_list_t *python_pair_list_get(TALLOC_CTX **ctx, python_pair_list_t const *self)
+{
+	request_t *request = self->request;
+
+	if (!request) {
+		PyErr_SetString(PyExc_RuntimeError, "Pair lists can't be used after the function has returned");
+		return NULL;
+	}
+
+	switch (self->list) {
+	case PYTHON_LIST_REQUEST:
+		*ctx = request->request_ctx;
+		return &request->request_pairs;
+
+	case PYTHON_LIST_REPLY:
+		*ctx = request->reply_ctx;
+		return &request->reply_pairs;
+
+	case PYTHON_LIST_CONTROL:
+		*ctx = request->control_ctx;
+		return &request->control_pairs;
+
+	case PYTHON_LIST_SESSION_STATE:
+		*ctx = request->session_state_ctx;
+		return &request->session_state_pairs;
+
+	case PYTHON_LIST_MAX:
+		break;
+	}
+
+	fr_assert(0);
+	PyErr_SetString(PyExc_RuntimeError, "Invalid pair list");
+	return NULL;
+}
+
+/** Resolve an attribute name to a dictionary attribute
+ *
+ * @return
+ *	- The attribute.
+ *	- NULL with KeyError set if it doesn't exist, or TypeError if it's not a leaf.
+ */
+static fr_dict_attr_t const *python_attr_find(request_t *request, PyObject *key)
+{
+	char const		*name;
+	fr_dict_attr_t const	*da;
+
+	if (!PyUnicode_Check(key)) {
+		PyErr_SetString(PyExc_TypeError, "Attribute names must be strings");
+		return NULL;
+	}
+
+	name = PyUnicode_AsUTF8(key);
+	if (!name) return NULL;
+
+	da = fr_dict_attr_search_by_qualified_oid(NULL, request->dict, name, true, true);
+	if (!da) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return NULL;
+	}
+
+	if (!fr_type_is_leaf(da->type)) {
+		PyErr_Format(PyExc_TypeError, "Attribute \"%s\" is of type %s, only leaf attributes are supported",
+			     name, fr_type_to_str(da->type));
+		return NULL;
+	}
+
+	return da;
+}
+
+static Py_ssize_t python_pair_list_length(PyObject *self)
+{
+	fr_pair_list_t	*list;
+	TALLOC_CTX	*ctx;
+
+	list = python_pair_list_get(&ctx, (python_pair_list_t *)self);
+	if (!list) return -1;
+
+	return fr_pair_list_num_elements(list);
+}
+
+/** Return the value of the first instance of an attribute
+ *
+ */
+static PyObject *python_pair_list_subscript(PyObject *self, PyObject *key)
+{
+	python_pair_list_t	*pl = (python_pair_list_t *)self;
+	fr_pair_list_t		*list;
+	TALLOC_CTX		*ctx;
+	fr_dict_attr_t const	*da;
+	fr_pair_t		*vp;
+
+	list = python_pair_list_get(&ctx, pl);
+	if (!list) return NULL;
+
+	da = python_attr_find(pl->request, key);
+	if (!da) return NULL;
+
+	vp = fr_pair_find_by_da_nested(list, NULL, da);
+	if (!vp) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return NULL;
+	}
+
+	return python_value_from_pair(vp);
+}
+
+/** Set the first instance of an attribute, creating it if needed, or delete all instances
+ *
+ */
+static int python_pair_list_ass_subscript(PyObject *self, PyObject *key, PyObject *value)
+{
+	python_pair_list_t	*pl = (python_pair_list_t *)self;
+	fr_pair_list_t		*list;
+	TALLOC_CTX		*ctx;
+	fr_dict_attr_t const	*da;
+	fr_pair_t		*vp;
+
+	list = python_pair_list_get(&ctx, pl);
+	if (!list) return -1;
+
+	da = python_attr_find(pl->request, key);
+	if (!da) return -1;
+
+	if (!value) {
+		if (fr_pair_delete_by_da_nested(list, da) <= 0) {
+			PyErr_SetObject(PyExc_KeyError, key);
+			return -1;
+		}
+		return 0;
+	}
+
+	vp = fr_pair_find_by_da_nested(list, NULL, da);
+	if (vp) return python_value_to_pair(vp, value);
+
+	if (fr_pair_append_by_da_parent(ctx, &vp, list, da) < 0) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	if (python_value_to_pair(vp, value) < 0) {
+		fr_pair_delete_by_da_nested(list, da);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int python_pair_list_contains(PyObject *self, PyObject *key)
+{
+	python_pair_list_t	*pl = (python_pair_list_t *)self;
+	fr_pair_list_t		*list;
+	TALLOC_CTX		*ctx;
+	fr_dict_attr_t const	*da;
+
+	list = python_pair_list_get(&ctx, pl);
+	if (!list) return -1;
+
+	da = python_attr_find(pl->request, key);
+	if (!da) {
+		if (!PyErr_ExceptionMatches(PyExc_KeyError)) return -1;
+		PyErr_Clear();
+		return 0;
+	}
+
+	return (fr_pair_find_by_da_nested(list, NULL, da) != NULL);
+}
+
+/** Build a list of the names, or the (name, value) tuples, of the pairs in a list
+ *
+ */
+static PyObject *python_pair_list_to_list(python_pair_list_t *pl, bool values)
+{
+	fr_pair_list_t		*list;
+	TALLOC_CTX		*ctx;
+	fr_pair_t		*vp;
+	PyObject		*out;
+
+	list = python_pair_list_get(&ctx, pl);
+	if (!list) return NULL;
+
+	out = PyList_New(0);
+	if (!out) return NULL;
+
+	for (vp = fr_pair_list_head(list);
+	     vp;
+	     vp = fr_pair_list_next(list, vp)) {
+		PyObject	*item;
+		int		ret;
+
+		if (values) {
+			PyObject *value;
+
+			value = python_value_from_pair(vp);
+			if (!value) goto error;
+
+			item = Py_BuildValue("(sN)", vp->da->name, value);
+		} else {
+			item = PyUnicode_FromString(vp->da->name);
+		}
+		if (!item) goto error;
+
+		ret = PyList_Append(out, item);
+		Py_DECREF(item);
+		if (ret < 0) {
+		error:
+			Py_DECREF(out);
+			return NULL;
+		}
+	}
+
+	return out;
+}
+
+static PyObject *python_pair_list_iter(PyObject *self)
+{
+	PyObject *keys, *iter;
+
+	keys = python_pair_list_to_list((python_pair_list_t *)self, false);
+	if (!keys) return NULL;
+
+	iter = PyObject_GetIter(keys);
+	Py_DECREF(keys);
+
+	return iter;
+}
+
+static PyObject *python_pair_list_keys(PyObject *self, UNUSED PyObject *args)
+{
+	return python_pair_list_to_list((python_pair_list_t *)self, false);
+}
+
+static PyObject *python_pair_list_items(PyObject *self, UNUSED PyObject *args)
+{
+	return python_pair_list_to_list((python_pair_list_t *)self, true);
+}
+
+static PyObject *python_pair_list_get_method(PyObject *self, PyObject *args)
+{
+	PyObject *key, *dflt = Py_None, *value;
+
+	if (!PyArg_ParseTuple(args, "O|O", &key, &dflt)) return NULL;
+
+	value = python_pair_list_subscript(self, key);
+	if (!value && PyErr_ExceptionMatches(PyExc_KeyError)) {
+		PyErr_Clear();
+		Py_INCREF(dflt);
+		return dflt;
+	}
+
+	return value;
+}
+
+static void python_pair_list_dealloc(PyObject *self)
+{
+	PyTypeObject *type = Py_TYPE(self);
+
+	type->tp_free(self);
+	Py_DECREF(type);
+}
+
+static PyMethodDef python_pair_list_methods[] = {
+	{ "get", python_pair_list_get_method, METH_VARARGS,
+	  "get(name[, default])\n\nReturn the value of the first instance of an attribute, or default." },
+	{ "keys", python_pair_list_keys, METH_NOARGS,
+	  "keys()\n\nReturn the names of all the attributes in the list." },
+	{ "items", python_pair_list_items, METH_NOARGS,
+	  "items()\n\nReturn (name, value) tuples for all the attributes in the list." },
+	{ NULL, NULL, 0, NULL }
+};
+
+/*
+ *	Both types wrap pointers which only we can fill in, so python
+ *	code mustn't be able to create instances of them.
+ */
+#ifdef Py_TPFLAGS_DISALLOW_INSTANTIATION
+#  define PYTHON_TYPE_FLAGS	(Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION)
+#else
+#  define PYTHON_TYPE_FLAGS	Py_TPFLAGS_DEFAULT
+#endif
+
+static PyType_Slot python_pair_list_slots[] = {
+	{ Py_tp_doc, (void *)(uintptr_t)"Attributes in one of the request's lists, by name." },
+	{ Py_tp_dealloc, python_pair_list_dealloc },
+	{ Py_tp_iter, python_pair_list_iter },
+	{ Py_tp_methods, python_pair_list_methods },
+	{ Py_mp_length, python_pair_list_length },
+	{ Py_mp_subscript, python_pair_list_subscript },
+	{ Py_mp_ass_subscript, python_pair_list_ass_subscript },
+	{ Py_sq_contains, python_pair_list_contains },
+	{ 0, NULL }
+};
+
+static PyType_Spec python_pair_list_spec = {
+	.name = "freeradius.PairList",
+	.basicsize = sizeof(python_pair_list_t),
+	.flags = PYTHON_TYPE_FLAGS,
+	.slots = python_pair_list_slots
+};
+
+/** Return one of the request's lists, creating the mapping object the first time
+ *
+ */
+static PyObject *python_request_list(PyObject *self, void *closure)
+{
+	python_request_t	*pr = (python_request_t *)self;
+	python_list_t		list = (python_list_t)(uintptr_t)closure;
+	python_pair_list_t	*pl;
+
+	if (!pr->request) {
+		PyErr_SetString(PyExc_RuntimeError, "Pair lists can't be used after the function has returned");
+		return NULL;
+	}
+
+	if (!pr->lists[list]) {
+		pl = PyObject_New(python_pair_list_t, pr->pair_list_type);
+		if (!pl) return NULL;
+
+		pl->request = pr->request;
+		pl->list = list;
+		pr->lists[list] = (PyObject *)pl;
+	}
+
+	Py_INCREF(pr->lists[list]);
+	return pr->lists[list];
+}
+
+/** Build the (name, value) tuples of the request list, for older scripts
+ *
+ */
+static PyObject *python_request_tuple(python_request_t *pr)
+{
+	request_t	*request = pr->request;
+	fr_pair_t	*vp;
+	Py_ssize_t	i = 0;
+
+	if (pr->tuple) return pr->tuple;
+
+	if (!request) {
+		PyErr_SetString(PyExc_RuntimeError, "Pair lists can't be used after the function has returned");
+		return NULL;
+	}
+
+	pr->tuple = PyTuple_New(fr_pair_list_num_elements(&request->request_pairs));
+	if (!pr->tuple) return NULL;
+
+	for (vp = fr_pair_list_head(&request->request_pairs);
+	     vp;
+	     vp = fr_pair_list_next(&request->request_pairs, vp), i++) {
+		PyObject *pp;
+
+		/* The inside tuple has two only: */
+		if ((pp = PyTuple_New(2)) == NULL) {
+			Py_CLEAR(pr->tuple);
+			return NULL;
+		}
+
+		if (mod_populate_vptuple(pr->mctx, request, pp, vp) == 0) {
+			/* Put the tuple inside the container */
+			PyTuple_SET_ITEM(pr->tuple, i, pp);
+		} else {
+			Py_INCREF(Py_None);
+			PyTuple_SET_ITEM(pr->tuple, i, Py_None);
+			Py_DECREF(pp);
+		}
+	}
+
+	return pr->tuple;
+}
+
+static Py_ssize_t python_request_length(PyObject *self)
+{
+	PyObject *tuple = python_request_tuple((python_request_t *)self);
+
+	if (!tuple) return -1;
+
+	return PyTuple_GET_SIZE(tuple);
+}
+
+static PyObject *python_request_item(PyObject *self, Py_ssize_t i)
+{
+	PyObject *tuple = python_request_tuple((python_request_t *)self);
+
+	if (!tuple) return NULL;
+
+	return PySequence_GetItem(tuple, i);
+}
+
+static PyObject *python_request_iter(PyObject *self)
+{
+	PyObject *tuple = python_request_tuple((python_request_t *)self);
+
+	if (!tuple) return NULL;
+
+	return PyObject_GetIter(tuple);
+}
+
+static PyObject *python_request_repr(PyObject *self)
+{
+	PyObject *tuple = python_request_tuple((python_request_t *)self);
+
+	if (!tuple) return NULL;
+
+	return PyObject_Repr(tuple);
+}
+
+static void python_request_dealloc(PyObject *self)
+{
+	python_request_t	*pr = (python_request_t *)self;
+	PyTypeObject		*type = Py_TYPE(self);
+	size_t			i;
+
+	for (i = 0; i < NUM_ELEMENTS(pr->lists); i++) Py_XDECREF(pr->lists[i]);
+	Py_XDECREF(pr->tuple);
+	Py_XDECREF(pr->pair_list_type);
+
+	type->tp_free(self);
+	Py_DECREF(type);
+}
+
+static PyGetSetDef python_request_getset[] = {
+	{ "request", python_request_list, NULL, "Attributes in the request.", (void *)(uintptr_t)PYTHON_LIST_REQUEST },
+	{ "reply", python_request_list, NULL, "Attributes in the reply.", (void *)(uintptr_t)PYTHON_LIST_REPLY },
+	{ "control", python_request_list, NULL, "Control attributes.", (void *)(uintptr_t)PYTHON_LIST_CONTROL },
+	{ "session_state", python_request_list, NULL, "Session state attributes.", (void *)(uintptr_t)PYTHON_LIST_SESSION_STATE },
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyType_Slot python_request_slots[] = {
+	{ Py_tp_doc, (void *)(uintptr_t)"The request being processed." },
+	{ Py_tp_dealloc, python_request_dealloc },
+	{ Py_tp_repr, python_request_repr },
+	{ Py_tp_iter, python_request_iter },
+	{ Py_tp_getset, python_request_getset },
+	{ Py_sq_length, python_request_length },
+	{ Py_sq_item, python_request_item },
+	{ 0, NULL }
+};
+
+static PyType_Spec python_request_spec = {
+	.name = "freeradius.Request",
+	.basicsize = sizeof(python_request_t),
+	.flags = PYTHON_TYPE_FLAGS,
+	.slots = python_request_slots
+};
+
+/** Create the argument for a python function call
+ *
+ * Must be called with a valid thread state set.
+ */
+static PyObject *python_request_alloc(module_ctx_t const *mctx, request_t *request)
+{
+	rlm_python_t const		*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_python_t);
+	rlm_python_thread_t const	*t = talloc_get_type_abort_const(mctx->thread, rlm_python_thread_t);
+	python_module_state_t		*state;
+	python_request_t		*pr;
+
+	state = PyModule_GetState(t->interpreter ? t->module : inst->module);
+	if (!state) return NULL;
+
+	pr = PyObject_New(python_request_t, state->request_type);
+	if (!pr) return NULL;
+
+	pr->request = request;
+	Py_INCREF(state->pair_list_type);
+	pr->pair_list_type = state->pair_list_type;
+	memset(pr->lists, 0, sizeof(pr->lists));
+	pr->tuple = NULL;
+	pr->mctx = mctx;
+
+	return (PyObject *)pr;
+}
+
+/** Stop the argument, and any lists taken from it, referring to the request
+ *
+ * The script may keep references to them, but the request will be freed.
+ */
+static void python_request_invalidate(PyObject *self)
+{
+	python_request_t	*pr = (python_request_t *)self;
+	size_t			i;
+
+	pr->request = NULL;
+	pr->mctx = NULL;
+	for (i = 0; i < NUM_ELEMENTS(pr->lists); i++) {
+		if (pr->lists[i]) ((python_pair_list_t *)pr->lists[i])->request = NULL;
+	}
+}
+
 static unlang_action_t do_python_single(rlm_rcode_t *p_result, module_ctx_t const *mctx,
 					request_t *request, PyObject *p_func, char const *funcname)
 {
-	fr_pair_t	*vp;
 	PyObject	*p_ret = NULL;
 	PyObject	*p_arg = NULL;
-	int		tuple_len;
 	rlm_rcode_t	rcode = RLM_MODULE_OK;
 
 	/*
-	 *	We will pass a tuple containing (name, value) tuples
-	 *	We can safely use the Python function to build up a
-	 *	tuple, since the tuple is not used elsewhere.
-	 *
-	 *	Determine the size of our tuple by walking through the packet.
-	 *	If request is NULL, pass None.
+	 *	Pass a freeradius.Request which gives access to
+	 *	the request's pairs, or None if there's no request.
 	 */
-	tuple_len = 0;
-	if (request != NULL) {
-		tuple_len = fr_pair_list_num_elements(&request->request_pairs);
-	}
-
-	if (tuple_len == 0) {
+	if (!request) {
 		Py_INCREF(Py_None);
 		p_arg = Py_None;
 	} else {
-		int i = 0;
-		if ((p_arg = PyTuple_New(tuple_len)) == NULL) {
+		p_arg = python_request_alloc(mctx, request);
+		if (!p_arg) {
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
-
-		for (vp = fr_pair_list_head(&request->request_pairs);
-		     vp;
-		     vp = fr_pair_list_next(&request->request_pairs, vp), i++) {
-			PyObject *pp;
-
-			/* The inside tuple has two only: */
-			if ((pp = PyTuple_New(2)) == NULL) {
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-
-			if (mod_populate_vptuple(mctx, request, pp, vp) == 0) {
-				/* Put the tuple inside the container */
-				PyTuple_SET_ITEM(p_arg, i, pp);
-			} else {
-				Py_INCREF(Py_None);
-				PyTuple_SET_ITEM(p_arg, i, Py_None);
-				Py_DECREF(pp);
-			}
-		}
 	}
 
 	/* Call Python function. */
@@ -594,6 +1183,7 @@ static unlang_action_t do_python_single(rlm_rcode_t *p_result, module_ctx_t cons
 
 finish:
 	if (rcode == RLM_MODULE_FAIL) python_error_log(mctx, request);
+	if (p_arg && (p_arg != Py_None)) python_request_invalidate(p_arg);
 	Py_XDECREF(p_arg);
 	Py_XDECREF(p_ret);
 
@@ -628,7 +1218,8 @@ static unlang_action_t do_python(rlm_rcode_t *p_result, module_ctx_t const *mctx
 static unlang_action_t CC_HINT(nonnull) mod_##x(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request) \
 { \
 	rlm_python_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_python_t); \
-	return do_python(p_result, mctx, request, inst->x.function, #x);\
+	rlm_python_thread_t const *t = talloc_get_type_abort_const(mctx->thread, rlm_python_thread_t); \
+	return do_python(p_result, mctx, request, t->interpreter ? t->x.function : inst->x.function, #x);\
 }
 
 MOD_FUNC(authenticate)
@@ -774,21 +1365,21 @@ static int python_parse_config(module_inst_ctx_t const *mctx, CONF_SECTION *cs,
 /** Make the current instance's config available within the module we're initialising
  *
  */
-static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTION *conf, PyObject *module)
+static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTION *conf, PyObject *module,
+				       PyObject **pythonconf_dict)
 {
-	rlm_python_t *inst = talloc_get_type_abort(mctx->inst->data, rlm_python_t);
 	CONF_SECTION *cs;
 
 	/*
 	 *	Convert a FreeRADIUS config structure into a python
 	 *	dictionary.
 	 */
-	inst->pythonconf_dict = PyDict_New();
-	if (!inst->pythonconf_dict) {
+	*pythonconf_dict = PyDict_New();
+	if (!*pythonconf_dict) {
 		ERROR("Unable to create python dict for config");
 	error:
-		Py_XDECREF(inst->pythonconf_dict);
-		inst->pythonconf_dict = NULL;
+		Py_XDECREF(*pythonconf_dict);
+		*pythonconf_dict = NULL;
 		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
 		return -1;
 	}
@@ -796,13 +1387,13 @@ static int python_module_import_config(module_inst_ctx_t const *mctx, CONF_SECTI
 	cs = cf_section_find(conf, "config", NULL);
 	if (cs) {
 		DEBUG("Inserting \"config\" section into python environment as radiusd.config");
-		if (python_parse_config(mctx, cs, 0, inst->pythonconf_dict) < 0) goto error;
+		if (python_parse_config(mctx, cs, 0, *pythonconf_dict) < 0) goto error;
 	}
 
 	/*
 	 *	Add module configuration as a dict
 	 */
-	if (PyModule_AddObject(module, "config", inst->pythonconf_dict) < 0) goto error;
+	if (PyModule_AddObject(module, "config", *pythonconf_dict) < 0) goto error;
 
 	return 0;
 }
@@ -828,24 +1419,126 @@ static int python_module_import_constants(module_inst_ctx_t const *mctx, PyObjec
 /*
  *	Python 3 interpreter initialisation and destruction
  */
-static PyObject *python_module_init(void)
+/** Create the types used to pass requests to python functions
+ *
+ */
+static int python_module_exec(PyObject *module)
+{
+	python_module_state_t *state = PyModule_GetState(module);
+
+	state->pair_list_type = (PyTypeObject *)PyType_FromSpec(&python_pair_list_spec);
+	if (!state->pair_list_type) return -1;
+
+	state->request_type = (PyTypeObject *)PyType_FromSpec(&python_request_spec);
+	if (!state->request_type) return -1;
+
+#ifndef Py_TPFLAGS_DISALLOW_INSTANTIATION
+	/*
+	 *	Before Python 3.10, this is how a type says it
+	 *	can't be instantiated.
+	 */
+	state->pair_list_type->tp_new = NULL;
+	state->request_type->tp_new = NULL;
+#endif
+
+	Py_INCREF(state->pair_list_type);
+	if (PyModule_AddObject(module, "PairList", (PyObject *)state->pair_list_type) < 0) {
+		Py_DECREF(state->pair_list_type);
+		return -1;
+	}
+
+	Py_INCREF(state->request_type);
+	if (PyModule_AddObject(module, "Request", (PyObject *)state->request_type) < 0) {
+		Py_DECREF(state->request_type);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int python_module_traverse(PyObject *module, visitproc visit, void *arg)
 {
-	PyObject		*module;
+	python_module_state_t *state = PyModule_GetState(module);
+
+	if (!state) return 0;
+
+	Py_VISIT(state->request_type);
+	Py_VISIT(state->pair_list_type);
+
+	return 0;
+}
+
+static int python_module_clear(PyObject *module)
+{
+	python_module_state_t *state = PyModule_GetState(module);
+
+	if (!state) return 0;
 
+	Py_CLEAR(state->request_type);
+	Py_CLEAR(state->pair_list_type);
+
+	return 0;
+}
+
+static void python_module_free(void *module)
+{
+	(void)python_module_clear(module);
+}
+
+static PyModuleDef_Slot module_slots[] = {
+	{ Py_mod_exec, (void *)python_module_exec },
+#if PY_VERSION_HEX >= 0x030C0000
+	/*
+	 *	The module has no global state, and its types are
+	 *	per-interpreter, so it can be imported into
+	 *	interpreters with their own GIL.
+	 */
+	{ Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED },
+#endif
+	{ 0, NULL }
+};
+
+/** Return the definition of the "freeradius" module
+ *
+ * This uses multi-phase initialisation, so each interpreter which
+ * imports the module gets a fresh copy, which python_module_import_config
+ * and python_module_import_constants then populate.
+ */
+static PyObject *python_module_init(void)
+{
 	static struct PyModuleDef py_module_def = {
 		PyModuleDef_HEAD_INIT,
 		.m_name = "freeradius",
 		.m_doc = "freeRADIUS python module",
-		.m_size = -1,
-		.m_methods = module_methods
+		.m_size = sizeof(python_module_state_t),
+		.m_methods = module_methods,
+		.m_slots = module_slots,
+		.m_traverse = python_module_traverse,
+		.m_clear = python_module_clear,
+		.m_free = python_module_free
 	};
 
-	fr_assert(current_mctx);
+	return PyModuleDef_Init(&py_module_def);
+}
+
+/** Import the "freeradius" module into the current interpreter, and add the config and constants
+ *
+ * Must be called with a valid thread state set.
+ */
+static PyObject *python_module_import(module_inst_ctx_t const *mctx, PyObject **pythonconf_dict)
+{
+	PyObject *module;
 
-	module = PyModule_Create(&py_module_def);
+	module = PyImport_ImportModule("freeradius");
 	if (!module) {
-		python_error_log(current_mctx, NULL);
-		Py_RETURN_NONE;
+		ERROR("Failed importing \"freeradius\" module into interpreter %p", PyThreadState_Get());
+		python_error_log(MODULE_CTX_FROM_INST(mctx), NULL);
+		return NULL;
+	}
+	if ((python_module_import_config(mctx, mctx->inst->conf, module, pythonconf_dict) < 0) ||
+	    (python_module_import_constants(mctx, module) < 0)) {
+		Py_DECREF(module);
+		return NULL;
 	}
 
 	return module;
@@ -854,17 +1547,6 @@ static PyObject *python_module_init(void)
 static int python_interpreter_init(module_inst_ctx_t const *mctx)
 {
 	rlm_python_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_python_t);
-	CONF_SECTION	*conf = mctx->inst->conf;
-	PyObject	*module;
-
-	/*
-	 *	python_module_init takes no args, so we need
-	 *	to set these globals so that when it's
-	 *	called during interpreter initialisation
-	 *	it can get at the current instance config.
-	 */
-	current_mctx = MODULE_CTX_FROM_INST(mctx);
-	current_conf = conf;
 
 	PyEval_RestoreThread(global_interpreter);
 	LSAN_DISABLE(inst->interpreter = Py_NewInterpreter());
@@ -883,17 +1565,8 @@ static int python_interpreter_init(module_inst_ctx_t const *mctx)
 	 *	own copy which it can mutate as much as
 	 *      it wants.
 	 */
- 	module = PyImport_ImportModule("freeradius");
- 	if (!module) {
- 		ERROR("Failed importing \"freeradius\" module into interpreter %p", inst->interpreter);
- 		return -1;
- 	}
-	if ((python_module_import_config(mctx, conf, module) < 0) ||
-	    (python_module_import_constants(mctx, module) < 0)) {
-		Py_DECREF(module);
-		return -1;
-	}
-	inst->module = module;
+	inst->module = python_module_import(mctx, &inst->pythonconf_dict);
+	if (!inst->module) return -1;
 	PyEval_SaveThread();
 
 	return 0;
@@ -928,6 +1601,14 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
 	rlm_python_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_python_t);
 
+#if PY_VERSION_HEX < 0x030C0000
+	if (inst->per_thread) {
+		cf_log_warn(mctx->inst->conf, "'per_thread_interpreter' requires Python >= 3.12, "
+			    "all threads will share one interpreter");
+		inst->per_thread = false;
+	}
+#endif
+
 	if (python_interpreter_init(mctx) < 0) return -1;
 
 	/*
@@ -1020,12 +1701,98 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	return 0;
 }
 
+#if PY_VERSION_HEX >= 0x030C0000
+/** Create an interpreter with its own GIL for the current thread
+ *
+ * The user's module is imported into the new interpreter, so any
+ * state it has at module level is per-thread.  The instantiate and
+ * detach functions are only called in the instance's interpreter.
+ */
+static int python_thread_interpreter_init(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_python_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_python_t);
+	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
+	module_inst_ctx_t const	*inst_mctx = MODULE_INST_CTX(mctx->inst);
+	PyThreadState		*main_state;
+	PyStatus		status;
+	PyInterpreterConfig	config = {
+					.use_main_obmalloc = 0,
+					.allow_fork = 0,
+					.allow_exec = 0,
+					.allow_threads = 1,
+					.allow_daemon_threads = 0,
+					.check_multi_interp_extensions = 1,
+					.gil = PyInterpreterConfig_OWN_GIL
+				};
+
+	/*
+	 *	Interpreters can only be created from within another
+	 *	interpreter, so borrow the main one.  Its GIL is
+	 *	released once the new interpreter is running.
+	 */
+	main_state = PyThreadState_New(global_interpreter->interp);
+	if (!main_state) {
+		ERROR("Failed initialising local PyThreadState");
+		return -1;
+	}
+	PyEval_RestoreThread(main_state);
+
+	LSAN_DISABLE(status = Py_NewInterpreterFromConfig(&t->interpreter, &config));
+	if (PyStatus_Exception(status)) {
+		ERROR("Failed creating thread interpreter: %s", status.err_msg ? status.err_msg : "unknown error");
+		PyThreadState_Clear(main_state);
+		PyThreadState_DeleteCurrent();
+		t->interpreter = NULL;
+		return -1;
+	}
+	DEBUG3("Created new thread interpreter %p", t->interpreter);
+	PyEval_SaveThread();
+
+	/*
+	 *	Done with the main interpreter
+	 */
+	PyEval_RestoreThread(main_state);
+	PyThreadState_Clear(main_state);
+	PyThreadState_DeleteCurrent();
+
+	PyEval_RestoreThread(t->interpreter);
+	t->state = t->interpreter;
+
+	t->module = python_module_import(inst_mctx, &t->pythonconf_dict);
+	if (!t->module) {
+	error:
+		PyEval_SaveThread();
+		return -1;
+	}
+
+#define PYTHON_FUNC_THREAD_LOAD(_x) \
+	do { \
+		t->_x.module_name = inst->_x.module_name; \
+		t->_x.function_name = inst->_x.function_name; \
+		if (python_function_load(inst_mctx, &t->_x) < 0) goto error; \
+	} while (0)
+	PYTHON_FUNC_THREAD_LOAD(authenticate);
+	PYTHON_FUNC_THREAD_LOAD(authorize);
+	PYTHON_FUNC_THREAD_LOAD(preacct);
+	PYTHON_FUNC_THREAD_LOAD(accounting);
+	PYTHON_FUNC_THREAD_LOAD(post_auth);
+
+	PyEval_SaveThread();
+
+	return 0;
+}
+#endif
+
 static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 {
 	PyThreadState		*state;
 	rlm_python_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_python_t);
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 
+#if PY_VERSION_HEX >= 0x030C0000
+	if (inst->per_thread) return python_thread_interpreter_init(mctx);
+#endif
+
 	state = PyThreadState_New(inst->interpreter->interp);
 	if (!state) {
 		ERROR("Failed initialising local PyThreadState");
@@ -1042,6 +1809,24 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_python_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_python_thread_t);
 
+	/*
+	 *	Destroying the interpreter also frees
+	 *	its thread state.
+	 */
+	if (t->interpreter) {
+		PyEval_RestoreThread(t->interpreter);
+		python_function_destroy(&t->authorize);
+		python_function_destroy(&t->authenticate);
+		python_function_destroy(&t->preacct);
+		python_function_destroy(&t->accounting);
+		python_function_destroy(&t->post_auth);
+		Py_XDECREF(t->module);
+		Py_EndInterpreter(t->interpreter);	/* Destroys interpreter - sets thread state to NULL */
+		return 0;
+	}
+
+	if (!t->state) return 0;
+
 	PyEval_RestoreThread(t->state);	/* Swap in our local thread state */
 	PyThreadState_Clear(t->state);
 	PyEval_SaveThread();
@@ -111,6 +111,8 @@ static conf_parser_t const module_config[] = {
 
 	{ FR_CONF_OFFSET("originate", rlm_radius_t, originate) },
 
+	{ FR_CONF_OFFSET("pass_through", rlm_radius_t, pass_through), .dflt = "no" },
+
 	{ FR_CONF_POINTER("status_check", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) status_check_config },
 
 	{ FR_CONF_OFFSET("max_attributes", rlm_radius_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) },
@@ -349,6 +351,20 @@ static void mod_radius_signal(module_ctx_t const *mctx, request_t *request, fr_s
 			      mctx->rctx), request, action);
 }
 
+/** Report the load on the home server, as seen by this thread
+ *
+ */
+static int mod_load_report(module_load_t *out, module_ctx_t const *mctx)
+{
+	rlm_radius_t const	*inst = talloc_get_type_abort_const(mctx->inst->data, rlm_radius_t);
+	module_instance_t	*io_submodule = inst->io_submodule;
+
+	if (!io_submodule->module->load_report) return -1;
+
+	return io_submodule->module->load_report(out, MODULE_CTX(io_submodule->dl_inst,
+								 module_thread(io_submodule)->data, NULL, NULL));
+}
+
 /** Do any RADIUS-layer fixups for proxying.
  *
  */
@@ -465,7 +481,6 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	 *	These limits are specific to RADIUS, and cannot be over-ridden
 	 */
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, >=, 2);
-	FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", inst->trunk_conf.max_req_per_conn, <=, 255);
 	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", inst->trunk_conf.target_req_per_conn, <=, inst->trunk_conf.max_req_per_conn / 2);
 
 	FR_TIME_DELTA_BOUND_CHECK("response_window", inst->zombie_period, >=, fr_time_delta_from_sec(1));
@@ -663,6 +678,8 @@ module_rlm_t rlm_radius = {
 		.unload		= mod_unload,
 
 		.bootstrap	= mod_bootstrap,
+
+		.load_report	= mod_load_report,
 	},
 	.method_names = (module_method_name_t[]){
 		{ .name1 = CF_IDENT_ANY,	.name2 = CF_IDENT_ANY,	.method = mod_process },
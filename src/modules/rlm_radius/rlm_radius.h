@@ -53,6 +53,8 @@ struct rlm_radius_s {
 	bool			originate;  		//!< Originating packets, instead of proxying existing ones.
 							///< Controls whether Proxy-State is added to the outbound
 							///< request.
+	bool			pass_through;		//!< Remember replies, so that they can be forwarded
+							///< without re-encoding them.
 
 	uint32_t		max_attributes;   	//!< Maximum number of attributes to decode in response.
 
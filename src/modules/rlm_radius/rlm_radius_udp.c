@@ -31,6 +31,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/metrics.h>
 #include <freeradius-devel/util/udp.h>
 
 #include <sys/socket.h>
@@ -45,6 +46,9 @@ RCSID("$Id$")
 #define check(_handle, _len_p) fr_radius_ok((_handle)->buffer, (size_t *)(_len_p), \
 					    (_handle)->thread->inst->parent->max_attributes, false, NULL)
 
+#define UDP_MAX_SOCKETS		64	//!< Most sockets a connection can use.
+#define UDP_MAX_REQUESTS_PER_ID	8	//!< Most requests sharing an ID, per socket, with use_authenticator.
+
 /** Static configuration for the module.
  *
  */
@@ -65,11 +69,19 @@ typedef struct {
 	uint32_t		max_packet_size;	//!< Maximum packet size.
 	uint16_t		max_send_coalesce;	//!< Maximum number of packets to coalesce into one mmsg call.
 
+	uint16_t		num_sockets;		//!< How many sockets (source ports) each connection uses.
+	bool			use_authenticator;	//!< Allow more than one outstanding request per ID,
+							///< matching responses using the Request Authenticator.
+	uint32_t		socket_max_requests;	//!< Outstanding requests we try to put on each socket
+							///< before moving on to the next.
+
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
 	bool			replicate;		//!< Copied from parent->replicate
 
 	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
+
+	fr_metric_t		*response_time;		//!< Time from first sending a request to receiving the reply.
 } rlm_radius_udp_t;
 
 typedef struct {
@@ -92,14 +104,32 @@ typedef struct {
 	fr_trunk_request_t	*treq;			//!< Used for signalling.
 } udp_coalesced_t;
 
-/** Track the handle, which is tightly correlated with the FD
+typedef struct udp_handle_s udp_handle_t;
+
+/** One of the sockets belonging to a connection
  *
+ * Each socket has its own source port, and so its own set of IDs.
  */
 typedef struct {
+	int			fd;			//!< File descriptor.
+	uint16_t		src_port;		//!< Source port of this socket.
+	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
+} udp_socket_t;
+
+/** Track the handle, which is tightly correlated with the FD
+ *
+ */
+struct udp_handle_s {
 	char const     		*name;			//!< From IP PORT to IP PORT.
 	char const		*module_name;		//!< the module that opened the connection
 
-	int			fd;			//!< File descriptor.
+	int			fd;			//!< File descriptor of the first socket.  Status checks
+							///< are sent on this socket.
+
+	udp_socket_t		*socket;		//!< All sockets for the connection, including the first.
+	uint16_t		num_sockets;		//!< How many sockets we have.
+	uint16_t		send_socket;		//!< Socket new requests are being sent on.
+	udp_socket_t		*readable;		//!< Socket which signalled it was readable.
 
 	struct mmsghdr		*mmsgvec;		//!< Vector of inbound/outbound packets.
 	udp_coalesced_t		*coalesced;		//!< Outbound coalesced requests.
@@ -120,12 +150,12 @@ typedef struct {
 							//!< to be the actual IP address packets will be
 							//!< sent on.  This is why we can't use the inst
 							//!< src_ipaddr field.
-	uint16_t		src_port;		//!< Source port specific to this connection.
+	uint16_t		src_port;		//!< Source port of the first socket.
 
 	uint8_t			*buffer;		//!< Receive buffer.
 	size_t			buflen;			//!< Receive buffer length.
 
-	radius_track_t		*tt;			//!< RADIUS ID tracking structure.
+	radius_track_t		*tt;			//!< RADIUS ID tracking structure of the first socket.
 
 	fr_time_t		mrs_time;		//!< Most recent sent time which had a reply.
 	fr_time_t		last_reply;		//!< When we last received a reply.
@@ -139,7 +169,7 @@ typedef struct {
 	udp_request_t		*status_u;		//!< for sending status check packets
 	udp_result_t		*status_r;		//!< for faking out status checks as real packets
 	request_t		*status_request;
-} udp_handle_t;
+};
 
 
 /** Connect request_t to local tracking structure
@@ -164,6 +194,8 @@ struct udp_request_s {
 	size_t			packet_len;		//!< Length of the packet.
 
 	radius_track_entry_t	*rr;			//!< ID tracking, resend count, etc.
+	udp_socket_t		*socket;		//!< Socket the ID in rr belongs to.
+							///< Only valid while rr is set.
 	fr_event_timer_t const	*ev;			//!< timer for retransmissions
 	fr_retry_t		retry;			//!< retransmission timers
 };
@@ -185,6 +217,9 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 	{ FR_CONF_OFFSET("max_send_coalesce", rlm_radius_udp_t, max_send_coalesce), .dflt = "1024" },
 
+	{ FR_CONF_OFFSET("num_sockets", rlm_radius_udp_t, num_sockets), .dflt = "1" },
+	{ FR_CONF_OFFSET("use_authenticator", rlm_radius_udp_t, use_authenticator), .dflt = "no" },
+
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, 0, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipv4addr", FR_TYPE_IPV4_ADDR, 0, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipv6addr", FR_TYPE_IPV6_ADDR, 0, rlm_radius_udp_t, src_ipaddr) },
@@ -255,7 +290,7 @@ static int 		encode(rlm_radius_udp_t const *inst, request_t *request, udp_reques
 static decode_fail_t	decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			       udp_handle_t *h, request_t *request, udp_request_t *u,
 			       uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
-			       uint8_t *data, size_t data_len);
+			       bool verify, uint8_t *data, size_t data_len);
 
 static void		protocol_error_reply(udp_request_t *u, udp_result_t *r, udp_handle_t *h);
 
@@ -567,7 +602,7 @@ static void conn_readable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
 
 	if (decode(h, &reply, &code,
 		   h, h->status_request, h->status_u, u->packet + RADIUS_AUTH_VECTOR_OFFSET,
-		   h->buffer, slen) != DECODE_FAIL_NONE) return;
+		   true, h->buffer, slen) != DECODE_FAIL_NONE) return;
 
 	fr_pair_list_free(&reply);	/* FIXME - Do something with these... */
 
@@ -680,10 +715,30 @@ static void conn_writable_status_check(fr_event_list_t *el, UNUSED int fd, UNUSE
  */
 static int _udp_handle_free(udp_handle_t *h)
 {
+	uint16_t	i;
+
 	fr_assert(h->fd >= 0);
 
 	if (h->status_u) fr_event_timer_delete(&h->status_u->ev);
 
+	/*
+	 *	The first socket is h->fd, and is closed below.
+	 */
+	for (i = 1; i < h->num_sockets; i++) {
+		udp_socket_t *s = &h->socket[i];
+
+		if (s->fd < 0) continue;
+
+		fr_event_fd_delete(h->thread->el, s->fd, FR_EVENT_FILTER_IO);
+
+		if (close(s->fd) < 0) {
+			DEBUG3("%s - Failed closing socket with source port %u for connection %s: %s",
+			       h->module_name, s->src_port, h->name, fr_syserror(errno));
+		}
+
+		s->fd = -1;
+	}
+
 	fr_event_fd_delete(h->thread->el, h->fd, FR_EVENT_FILTER_IO);
 
 	if (shutdown(h->fd, SHUT_RDWR) < 0) {
@@ -703,6 +758,35 @@ static int _udp_handle_free(udp_handle_t *h)
 	return 0;
 }
 
+/** Set the kernel buffer sizes for one of a connection's sockets
+ *
+ */
+static void udp_socket_buff_set(udp_handle_t *h, int fd)
+{
+#ifdef SO_RCVBUF
+	if (h->inst->recv_buff_is_set) {
+		int opt;
+
+		opt = h->inst->recv_buff;
+		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(int)) < 0) {
+			WARN("%s - Failed setting 'SO_RCVBUF': %s", h->module_name, fr_syserror(errno));
+		}
+	}
+#endif
+
+#ifdef SO_SNDBUF
+	if (h->inst->send_buff_is_set) {
+		int opt;
+
+		opt = h->inst->send_buff;
+		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(int)) < 0) {
+			WARN("%s - Failed setting 'SO_SNDBUF', write performance may be sub-optimal: %s",
+			     h->module_name, fr_syserror(errno));
+		}
+	}
+#endif
+}
+
 /** Initialise a new outbound connection
  *
  * @param[out] h_out	Where to write the new file descriptor.
@@ -741,7 +825,10 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	MEM(h->buffer = talloc_array(h, uint8_t, h->max_packet_size));
 	h->buflen = h->max_packet_size;
 
-	if (!h->inst->replicate) MEM(h->tt = radius_track_alloc(h));
+	if (!h->inst->replicate) {
+		MEM(h->tt = radius_track_alloc(h));
+		radius_track_use_authenticator(h->tt, h->inst->use_authenticator);
+	}
 
 	/*
 	 *	Open the outgoing socket.
@@ -764,30 +851,13 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 
 	talloc_set_destructor(h, _udp_handle_free);
 
-#ifdef SO_RCVBUF
-	if (h->inst->recv_buff_is_set) {
-		int opt;
-
-		opt = h->inst->recv_buff;
-		if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt, sizeof(int)) < 0) {
-			WARN("%s - Failed setting 'SO_RCVBUF': %s", h->module_name, fr_syserror(errno));
-		}
-	}
-#endif
+	udp_socket_buff_set(h, fd);
 
 #ifdef SO_SNDBUF
 	{
 		int opt;
 		socklen_t socklen = sizeof(int);
 
-		if (h->inst->send_buff_is_set) {
-			opt = h->inst->send_buff;
-			if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(int)) < 0) {
-				WARN("%s - Failed setting 'SO_SNDBUF', write performance may be sub-optimal: %s",
-				     h->module_name, fr_syserror(errno));
-			}
-		}
-
 		if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, &socklen) < 0) {
 			WARN("%s - Failed getting 'SO_SNDBUF', write performance may be sub-optimal: %s",
 			     h->module_name, fr_syserror(errno));
@@ -826,6 +896,35 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 
 	h->fd = fd;
 
+	/*
+	 *	Open any additional sockets.  Each has its own source
+	 *	port, and so its own set of IDs, but they all share the
+	 *	status checks and liveness of the first socket.
+	 */
+	MEM(h->socket = talloc_zero_array(h, udp_socket_t, h->inst->num_sockets));
+	h->socket[0] = (udp_socket_t){ .fd = fd, .src_port = h->src_port, .tt = h->tt };
+	for (i = 1; i < h->inst->num_sockets; i++) h->socket[i].fd = -1;
+	h->num_sockets = h->inst->num_sockets;
+
+	for (i = 1; i < h->num_sockets; i++) {
+		udp_socket_t	*s = &h->socket[i];
+		fr_ipaddr_t	src_ipaddr = h->src_ipaddr;
+
+		s->fd = fr_socket_client_udp(h->inst->interface, &src_ipaddr, &s->src_port,
+					     &h->inst->dst_ipaddr, h->inst->dst_port, true);
+		if (s->fd < 0) {
+			PERROR("%s - Failed opening socket %u for connection %s", h->module_name, i, h->name);
+			goto fail;
+		}
+
+		udp_socket_buff_set(h, s->fd);
+
+		MEM(s->tt = radius_track_alloc(h));
+		radius_track_use_authenticator(s->tt, h->inst->use_authenticator);
+
+		DEBUG2("%s - Connection %s also using local port %u", h->module_name, h->name, s->src_port);
+	}
+
 	/*
 	 *	If we're doing status checks, then we want at least
 	 *	one positive response before signalling that the
@@ -864,23 +963,41 @@ static fr_connection_state_t conn_init(void **h_out, fr_connection_t *conn, void
 	return FR_CONNECTION_STATE_CONNECTING;
 }
 
+/** Count the requests outstanding on all of a connection's sockets
+ *
+ */
+static inline uint32_t udp_handle_num_requests(udp_handle_t const *h)
+{
+	uint32_t	num = 0;
+	uint16_t	i;
+
+	for (i = 0; i < h->num_sockets; i++) if (h->socket[i].tt) num += h->socket[i].tt->num_requests;
+
+	return num;
+}
+
 /** Shutdown/close a file descriptor
  *
  */
 static void conn_close(UNUSED fr_event_list_t *el, void *handle, UNUSED void *uctx)
 {
-	udp_handle_t *h = talloc_get_type_abort(handle, udp_handle_t);
+	udp_handle_t	*h = talloc_get_type_abort(handle, udp_handle_t);
+	uint16_t	i;
 
 	/*
 	 *	There's tracking entries still allocated
 	 *	this is bad, they should have all been
 	 *	released.
 	 */
-	if (h->tt && (h->tt->num_requests != 0)) {
+	for (i = 0; i < h->num_sockets; i++) {
+		radius_track_t *tt = h->socket[i].tt;
+
+		if (!tt || (tt->num_requests == 0)) continue;
+
 #ifndef NDEBUG
-		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__, h->tt, udp_tracking_entry_log);
+		radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__, tt, udp_tracking_entry_log);
 #endif
-		fr_assert_fail("%u tracking entries still allocated at conn close", h->tt->num_requests);
+		fr_assert_fail("%u tracking entries still allocated at conn close", tt->num_requests);
 	}
 
 	DEBUG4("Freeing rlm_radius_udp handle %p", handle);
@@ -944,6 +1061,26 @@ static fr_connection_t *thread_conn_alloc(fr_trunk_connection_t *tconn, fr_event
 	return conn;
 }
 
+/** One of the connection's sockets is readable
+ *
+ * Record which one, so that request_demux() knows which socket to drain.
+ */
+static void conn_readable(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	fr_trunk_connection_t	*tconn = talloc_get_type_abort(uctx, fr_trunk_connection_t);
+	udp_handle_t		*h = talloc_get_type_abort(tconn->conn->h, udp_handle_t);
+	uint16_t		i;
+
+	for (i = 0; i < h->num_sockets; i++) {
+		if (h->socket[i].fd != fd) continue;
+
+		h->readable = &h->socket[i];
+		break;
+	}
+
+	fr_trunk_connection_signal_readable(tconn);
+}
+
 /** Read and discard data
  *
  */
@@ -1000,6 +1137,7 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
 	fr_event_fd_cb_t	read_fn = NULL;
 	fr_event_fd_cb_t	write_fn = NULL;
+	uint16_t		i;
 
 	switch (notify_on) {
 		/*
@@ -1014,7 +1152,7 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 		break;
 
 	case FR_TRUNK_CONN_EVENT_READ:
-		read_fn = fr_trunk_connection_callback_readable;
+		read_fn = conn_readable;
 		break;
 
 	case FR_TRUNK_CONN_EVENT_WRITE:
@@ -1022,23 +1160,26 @@ static void thread_conn_notify(fr_trunk_connection_t *tconn, fr_connection_t *co
 		break;
 
 	case FR_TRUNK_CONN_EVENT_BOTH:
-		read_fn = fr_trunk_connection_callback_readable;
+		read_fn = conn_readable;
 		write_fn = fr_trunk_connection_callback_writable;
 		break;
 
 	}
 
-	if (fr_event_fd_insert(h, el, h->fd,
-			       read_fn,
-			       write_fn,
-			       conn_error,
-			       tconn) < 0) {
-		PERROR("%s - Failed inserting FD event", h->module_name);
+	for (i = 0; i < h->num_sockets; i++) {
+		if (fr_event_fd_insert(h, el, h->socket[i].fd,
+				       read_fn,
+				       write_fn,
+				       conn_error,
+				       tconn) < 0) {
+			PERROR("%s - Failed inserting FD event", h->module_name);
 
-		/*
-		 *	May free the connection!
-		 */
-		fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			/*
+			 *	May free the connection!
+			 */
+			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
+			return;
+		}
 	}
 }
 
@@ -1126,6 +1267,8 @@ static int8_t request_prioritise(void const *one, void const *two)
  * @param[in] request			the request.
  * @param[in] u				UDP request.
  * @param[in] request_authenticator	from the original request.
+ * @param[in] verify			whether the Response Authenticator still needs
+ *					to be checked.
  * @param[in] data			to decode.
  * @param[in] data_len			Length of input data.
  * @return
@@ -1135,7 +1278,7 @@ static int8_t request_prioritise(void const *one, void const *two)
 static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *response_code,
 			    udp_handle_t *h, request_t *request, udp_request_t *u,
 			    uint8_t const request_authenticator[static RADIUS_AUTH_VECTOR_LENGTH],
-			    uint8_t *data, size_t data_len)
+			    bool verify, uint8_t *data, size_t data_len)
 {
 	rlm_radius_udp_t const *inst = h->thread->inst;
 	uint8_t			code;
@@ -1157,15 +1300,14 @@ static decode_fail_t decode(TALLOC_CTX *ctx, fr_pair_list_t *reply, uint8_t *res
 		.request_authenticator = request_authenticator,
 		.tmp_ctx = talloc(ctx, uint8_t),
 		.end = data + data_len,
-		.verify = true,
+		.verify = verify,
 	};
 
 	/*
 	 *	!client->active means a fake packet defining a dynamic client - so there will
 	 *	be no secret defined yet - so can't verify.
 	 */
-	if (fr_radius_decode(request->request_ctx, &request->request_pairs,
-			     data, data_len, &decode_ctx) < 0) {
+	if (fr_radius_decode(ctx, reply, data, data_len, &decode_ctx) < 0) {
 		talloc_free(decode_ctx.tmp_ctx);
 		RPEDEBUG("Failed reading packet");
 		return DECODE_FAIL_UNKNOWN;
@@ -1274,13 +1416,35 @@ static int encode(rlm_radius_udp_t const *inst, request_t *request, udp_request_
 	 */
 	fr_assert(u->packet_len >= (size_t) (RADIUS_HEADER_LENGTH + proxy_state + message_authenticator));
 
+	/*
+	 *	If we're proxying, and nothing has changed the
+	 *	attributes of the request, then copy them from the
+	 *	packet we received.
+	 */
+	packet_len = 0;
+	if (proxy_state) {
+		fr_radius_pass_through_t const *pt;
+
+		pt = request_data_reference(request, (void const *)fr_radius_encode_pass_through,
+					    FR_RADIUS_PASS_THROUGH_REQUEST);
+		if (pt && (pt->data[0] == u->code) &&
+		    (pt->hash == fr_radius_pass_through_hash(&request->request_pairs, true))) {
+			packet_len = fr_radius_encode_pass_through(u->packet, u->packet_len - (proxy_state + message_authenticator),
+								   NULL, pt, inst->secret, talloc_array_length(inst->secret) - 1,
+								   u->code, id, &request->request_pairs, true);
+			if (packet_len > 0) RDEBUG3("Request attributes are unchanged, forwarding the attributes we received");
+		}
+	}
+
 	/*
 	 *	Encode it, leaving room for Proxy-State and
 	 *	Message-Authenticator if necessary.
 	 */
-	packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
-				      inst->secret, talloc_array_length(inst->secret) - 1,
-				      u->code, id, &request->request_pairs);
+	if (packet_len == 0) {
+		packet_len = fr_radius_encode(u->packet, u->packet_len - (proxy_state + message_authenticator), NULL,
+					      inst->secret, talloc_array_length(inst->secret) - 1,
+					      u->code, id, &request->request_pairs);
+	}
 	if (fr_pair_encode_is_error(packet_len)) {
 		RPERROR("Failed encoding packet");
 
@@ -1707,127 +1871,40 @@ static void status_check_retry(UNUSED fr_event_list_t *el, fr_time_t now, void *
         fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
 }
 
-static void request_mux(fr_event_list_t *el,
-			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+/** Choose the socket to send a new request on
+ *
+ * We keep sending on one socket until it has its share of the
+ * outstanding requests, so that packets can still be coalesced,
+ * then move on to the least loaded socket.
+ */
+static udp_socket_t *udp_socket_select(udp_handle_t *h)
 {
-	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
-	rlm_radius_udp_t const	*inst = h->inst;
-	int			sent;
-	uint16_t		i, queued;
-	size_t			total_len = 0;
-
-	/*
-	 *	Encode multiple packets in preparation
-	 *      for transmission with sendmmsg.
-	 */
-	for (i = 0, queued = 0; (i < inst->max_send_coalesce) && (total_len < h->send_buff_actual); i++) {
-		fr_trunk_request_t	*treq;
-		udp_request_t		*u;
-		request_t		*request;
-
- 		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
-
-		/*
-		 *	No more requests to send
-		 */
-		if (!treq) break;
-
- 		fr_assert((treq->state == FR_TRUNK_REQUEST_STATE_PENDING) ||
-			   (treq->state == FR_TRUNK_REQUEST_STATE_PARTIAL));
-
-		request = treq->request;
-		u = talloc_get_type_abort(treq->preq, udp_request_t);
-
-		/*
-		 *	Start retransmissions from when the socket is writable.
-		 */
-		if (fr_time_eq(u->retry.start, fr_time_wrap(0))) {
-			(void) fr_retry_init(&u->retry, fr_time(), &h->inst->parent->retry[u->code]);
-			fr_assert(fr_time_delta_ispos(u->retry.rt));
-			fr_assert(fr_time_gt(u->retry.next, fr_time_wrap(0)));
-		}
+	udp_socket_t	*s = &h->socket[h->send_socket];
+	uint16_t	i;
 
-		/*
-		 *	No previous packet, OR can't retransmit the
-		 *	existing one.  Oh well.
-		 *
-		 *	Note that if we can't retransmit the previous
-		 *	packet, then u->rr MUST already have been
-		 *	deleted in the request_cancel() function
-		 *	or request_release_conn() function when
-		 *	the REQUEUE signal was received.
-		 */
-		if (!u->packet || !u->can_retransmit) {
-			fr_assert(!u->rr);
+	if (s->tt->num_requests < h->inst->socket_max_requests) return s;
 
-			if (unlikely(radius_track_entry_reserve(&u->rr, treq, h->tt, request, u->code, treq) < 0)) {
-#ifndef NDEBUG
-				radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
-						       h->tt, udp_tracking_entry_log);
-#endif
-				fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
-				fr_trunk_request_signal_fail(treq);
-				continue;
-			}
-			u->id = u->rr->id;
-
-			RDEBUG("Sending %s ID %d length %ld over connection %s",
-			       fr_radius_packet_names[u->code], u->id, u->packet_len, h->name);
-
-			if (encode(h->inst, request, u, u->id) < 0) {
-				/*
-				 *	Need to do this because request_conn_release
-				 *	may not be called.
-				 */
-				udp_request_reset(u);
-				if (u->ev) (void) fr_event_timer_delete(&u->ev);
-				fr_trunk_request_signal_fail(treq);
-				continue;
-			}
-			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
-
-			/*
-			 *	Remember the authentication vector, which now has the
-			 *	packet signature.
-			 */
-			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
-		} else {
-			RDEBUG("Retransmitting %s ID %d length %ld over connection %s",
-			       fr_radius_packet_names[u->code], u->id, u->packet_len, h->name);
-		}
-
-		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->request_pairs, NULL);
-		if (!fr_pair_list_empty(&u->extra)) log_request_pair_list(L_DBG_LVL_2, request, NULL, &u->extra, NULL);
-
-		/*
-		 *	Record pointers to the buffer we'll be writing
-		 *	We store the treq so we can place it back in
-		 *      the pending state if the sendmmsg call fails.
-		 */
-		h->coalesced[queued].treq = treq;
-		h->coalesced[queued].out.iov_base = u->packet;
-		h->coalesced[queued].out.iov_len = u->packet_len;
+	for (i = 0; i < h->num_sockets; i++) {
+		if (h->socket[i].tt->num_requests < s->tt->num_requests) s = &h->socket[i];
+	}
+	h->send_socket = s - h->socket;
 
-		/*
-		 *	Record how much data we have in total.
-		 *
-		 *	Try not to exceed the SO_SNDBUF value of the
-		 *	socket as we potentially just waste CPU
-		 *	time re-encoding the packets.
-		 */
-		total_len += u->packet_len;
+	return s;
+}
 
-		/*
-		 *	Tell the trunk API that this request is now in
-		 *	the "sent" state.  And we don't want to see
-		 *	this request again. The request hasn't actually
-		 *	been sent, but it's the only way to get at the
-		 *	next entry in the heap.
-		 */
-		fr_trunk_request_signal_sent(treq);
-		queued++;
-	}
-	if (queued == 0) return;	/* No work */
+/** Send requests which have been coalesced for one of the connection's sockets
+ *
+ * @return
+ *	- 0 if all the requests were sent.
+ *	- 1 if some requests were put back in the pending state.
+ *	- -1 if the connection failed.  The handle must not be used.
+ */
+static int request_mux_send(fr_event_list_t *el, fr_trunk_connection_t *tconn, udp_handle_t *h,
+			    udp_socket_t *s, uint16_t queued)
+{
+	rlm_radius_udp_t const	*inst = h->inst;
+	int			sent;
+	uint16_t		i;
 
 	/*
 	 *	Verify nothing accidentally freed the connection handle
@@ -1837,7 +1914,7 @@ static void request_mux(fr_event_list_t *el,
 	/*
 	 *	Send the coalesced datagrams
 	 */
-	sent = sendmmsg(h->fd, h->mmsgvec, queued, 0);
+	sent = sendmmsg(s->fd, h->mmsgvec, queued, 0);
 	if (sent < 0) {		/* Error means no messages were sent */
 		sent = 0;
 
@@ -1881,7 +1958,7 @@ static void request_mux(fr_event_list_t *el,
 			ERROR("%s - Failed sending data over connection %s: %s",
 			      h->module_name, h->name, fr_syserror(errno));
 			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
-			return;
+			return -1;
 		}
 	}
 
@@ -1961,6 +2038,154 @@ static void request_mux(fr_event_list_t *el,
 	 *	the request ready for sending again...
 	 */
 	for (i = sent; i < queued; i++) fr_trunk_request_requeue(h->coalesced[i].treq);
+
+	return (sent < queued) ? 1 : 0;
+}
+
+static void request_mux(fr_event_list_t *el,
+			fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
+{
+	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
+	rlm_radius_udp_t const	*inst = h->inst;
+	udp_socket_t		*s = NULL;
+	uint16_t		i, queued;
+	size_t			total_len = 0;
+
+	/*
+	 *	Encode multiple packets in preparation
+	 *      for transmission with sendmmsg.
+	 */
+	for (i = 0, queued = 0; (i < inst->max_send_coalesce) && (total_len < h->send_buff_actual); i++) {
+		fr_trunk_request_t	*treq;
+		udp_request_t		*u;
+		request_t		*request;
+		udp_socket_t		*send_s;
+
+ 		if (unlikely(fr_trunk_connection_pop_request(&treq, tconn) < 0)) return;
+
+		/*
+		 *	No more requests to send
+		 */
+		if (!treq) break;
+
+ 		fr_assert((treq->state == FR_TRUNK_REQUEST_STATE_PENDING) ||
+			   (treq->state == FR_TRUNK_REQUEST_STATE_PARTIAL));
+
+		request = treq->request;
+		u = talloc_get_type_abort(treq->preq, udp_request_t);
+
+		/*
+		 *	Start retransmissions from when the socket is writable.
+		 */
+		if (fr_time_eq(u->retry.start, fr_time_wrap(0))) {
+			(void) fr_retry_init(&u->retry, fr_time(), &h->inst->parent->retry[u->code]);
+			fr_assert(fr_time_delta_ispos(u->retry.rt));
+			fr_assert(fr_time_gt(u->retry.next, fr_time_wrap(0)));
+		}
+
+		/*
+		 *	Retransmissions have to go out on the socket
+		 *	their ID was allocated from.
+		 */
+		send_s = (u->packet && u->can_retransmit) ? u->socket : udp_socket_select(h);
+
+		/*
+		 *	All the packets passed to sendmmsg have to
+		 *	use the same socket.  The request hasn't been
+		 *	signalled yet, so it's still at the head of
+		 *	the pending queue if we stop here.
+		 */
+		if (queued && (send_s != s)) {
+			if (request_mux_send(el, tconn, h, s, queued) != 0) return;
+			queued = 0;
+			total_len = 0;
+		}
+		s = send_s;
+
+		/*
+		 *	No previous packet, OR can't retransmit the
+		 *	existing one.  Oh well.
+		 *
+		 *	Note that if we can't retransmit the previous
+		 *	packet, then u->rr MUST already have been
+		 *	deleted in the request_cancel() function
+		 *	or request_release_conn() function when
+		 *	the REQUEUE signal was received.
+		 */
+		if (!u->packet || !u->can_retransmit) {
+			fr_assert(!u->rr);
+
+			if (unlikely(radius_track_entry_reserve(&u->rr, treq, s->tt, request, u->code, treq) < 0)) {
+#ifndef NDEBUG
+				radius_track_state_log(&default_log, L_ERR, __FILE__, __LINE__,
+						       s->tt, udp_tracking_entry_log);
+#endif
+				fr_assert_fail("Tracking entry allocation failed: %s", fr_strerror());
+				fr_trunk_request_signal_fail(treq);
+				continue;
+			}
+			u->id = u->rr->id;
+			u->socket = s;
+
+			RDEBUG("Sending %s ID %d length %ld over connection %s",
+			       fr_radius_packet_names[u->code], u->id, u->packet_len, h->name);
+
+			if (encode(h->inst, request, u, u->id) < 0) {
+				/*
+				 *	Need to do this because request_conn_release
+				 *	may not be called.
+				 */
+				udp_request_reset(u);
+				if (u->ev) (void) fr_event_timer_delete(&u->ev);
+				fr_trunk_request_signal_fail(treq);
+				continue;
+			}
+			RHEXDUMP3(u->packet, u->packet_len, "Encoded packet");
+
+			/*
+			 *	Remember the authentication vector, which now has the
+			 *	packet signature.
+			 */
+			(void) radius_track_entry_update(u->rr, u->packet + RADIUS_AUTH_VECTOR_OFFSET);
+		} else {
+			RDEBUG("Retransmitting %s ID %d length %ld over connection %s",
+			       fr_radius_packet_names[u->code], u->id, u->packet_len, h->name);
+		}
+
+		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->request_pairs, NULL);
+		if (!fr_pair_list_empty(&u->extra)) log_request_pair_list(L_DBG_LVL_2, request, NULL, &u->extra, NULL);
+
+		/*
+		 *	Record pointers to the buffer we'll be writing
+		 *	We store the treq so we can place it back in
+		 *      the pending state if the sendmmsg call fails.
+		 */
+		h->coalesced[queued].treq = treq;
+		h->coalesced[queued].out.iov_base = u->packet;
+		h->coalesced[queued].out.iov_len = u->packet_len;
+
+		/*
+		 *	Record how much data we have in total.
+		 *
+		 *	Try not to exceed the SO_SNDBUF value of the
+		 *	socket as we potentially just waste CPU
+		 *	time re-encoding the packets.
+		 */
+		total_len += u->packet_len;
+
+		/*
+		 *	Tell the trunk API that this request is now in
+		 *	the "sent" state.  And we don't want to see
+		 *	this request again. The request hasn't actually
+		 *	been sent, but it's the only way to get at the
+		 *	next entry in the heap.
+		 */
+		fr_trunk_request_signal_sent(treq);
+		queued++;
+	}
+	if (queued == 0) return;	/* No work */
+
+	(void) request_mux_send(el, tconn, h, s, queued);
 }
 
 static void request_mux_replicate(UNUSED fr_event_list_t *el,
@@ -2280,11 +2505,26 @@ static void status_check_reply(fr_trunk_request_t *treq, fr_time_t now)
 	fr_trunk_connection_signal_active(treq->tconn);
 }
 
+/** Check a response against one of the requests sent with its ID
+ *
+ */
+static bool response_match(radius_track_entry_t const *te, void *uctx)
+{
+	udp_handle_t		*h = talloc_get_type_abort(uctx, udp_handle_t);
+	rlm_radius_udp_t const	*inst = h->inst;
+
+	return (fr_radius_verify(h->buffer, te->vector, (uint8_t const *) inst->secret,
+				 talloc_array_length(inst->secret) - 1, false) == 0);
+}
+
 static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tconn, fr_connection_t *conn, UNUSED void *uctx)
 {
 	udp_handle_t		*h = talloc_get_type_abort(conn->h, udp_handle_t);
+	udp_socket_t		*s = h->readable ? h->readable : &h->socket[0];
 
-	DEBUG3("%s - Reading data for connection %s", h->module_name, h->name);
+	h->readable = NULL;
+
+	DEBUG3("%s - Reading data for connection %s port %u", h->module_name, h->name, s->src_port);
 
 	while (true) {
 		ssize_t			slen;
@@ -2306,7 +2546,7 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		 *	saves a round through the event loop.  If we're not
 		 *	busy, a few extra system calls don't matter.
 		 */
-		slen = read(h->fd, h->buffer, h->buflen);
+		slen = read(s->fd, h->buffer, h->buflen);
 		if (slen == 0) return;
 
 		if (slen < 0) {
@@ -2325,14 +2565,34 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		}
 
 		/*
-		 *	Note that we don't care about packet codes.  All
-		 *	packet codes share the same ID space.
+		 *	Many requests may share this ID.  The only way
+		 *	to tell which one the response is for, is to
+		 *	check its Response Authenticator against each
+		 *	of them.
 		 */
-		rr = radius_track_entry_find(h->tt, h->buffer[1], NULL);
-		if (!rr) {
-			WARN("%s - Ignoring reply with ID %i that arrived too late",
-			     h->module_name, h->buffer[1]);
-			continue;
+		if (h->inst->use_authenticator) {
+			if (!check(h, &slen)) {
+				WARN("%s - Ignoring malformed packet", h->module_name);
+				continue;
+			}
+
+			rr = radius_track_entry_match(s->tt, h->buffer[1], response_match, h);
+			if (!rr) {
+				WARN("%s - Ignoring reply with ID %i that arrived too late, or has an invalid signature",
+				     h->module_name, h->buffer[1]);
+				continue;
+			}
+		} else {
+			/*
+			 *	Note that we don't care about packet codes.  All
+			 *	packet codes share the same ID space.
+			 */
+			rr = radius_track_entry_find(s->tt, h->buffer[1], NULL);
+			if (!rr) {
+				WARN("%s - Ignoring reply with ID %i that arrived too late",
+				     h->module_name, h->buffer[1]);
+				continue;
+			}
 		}
 
 		treq = talloc_get_type_abort(rr->uctx, fr_trunk_request_t);
@@ -2345,12 +2605,13 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		 *	Validate and decode the incoming packet
 		 */
 
-		if (!check(h, &slen)) {
+		if (!h->inst->use_authenticator && !check(h, &slen)) {
 			RWARN("Ignoring malformed packet");
 			continue;
 		}
 
-		reason = decode(request->reply_ctx, &reply, &code, h, request, u, rr->vector, h->buffer, (size_t)slen);
+		reason = decode(request->reply_ctx, &reply, &code, h, request, u, rr->vector,
+				!h->inst->use_authenticator, h->buffer, (size_t)slen);
 		if (reason != DECODE_FAIL_NONE) continue;
 
 		/*
@@ -2376,6 +2637,8 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 			continue;
 		}
 
+		fr_metric_observe(h->inst->response_time, fr_time_sub(now, u->retry.start));
+
 		/*
 		 *	Handle any state changes, etc. needed by receiving a
 		 *	Protocol-Error reply packet.
@@ -2434,6 +2697,27 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 			fr_pair_append(&request->reply_pairs, vp);
 		}
 
+		/*
+		 *	Remember the reply, so that it can be forwarded
+		 *	without re-encoding it, if nothing changes its
+		 *	attributes.
+		 */
+		if (h->inst->parent->pass_through && !h->inst->parent->originate && !u->status_check) {
+			fr_radius_pass_through_t *pt;
+
+			MEM(pt = talloc_zero(request, fr_radius_pass_through_t));
+			MEM(pt->data = talloc_memdup(pt, h->buffer, slen));
+			pt->data_len = slen;
+			pt->secret = h->inst->secret;
+			pt->secret_length = talloc_array_length(h->inst->secret) - 1;
+			memcpy(pt->vector, rr->vector, sizeof(pt->vector));
+			pt->hash = fr_radius_pass_through_hash(&reply, false);
+
+			(void) request_data_talloc_add(request, (void const *)fr_radius_encode_pass_through,
+						       FR_RADIUS_PASS_THROUGH_REPLY, fr_radius_pass_through_t, pt,
+						       true, false, false);
+		}
+
 		treq->request->reply->code = code;
 		r->rcode = radius_code_to_rcode[code];
 		fr_pair_list_append(&request->reply_pairs, &reply);
@@ -2492,7 +2776,7 @@ static void request_conn_release(fr_connection_t *conn, void *preq_to_reset, UNU
 	 *	If there are no outstanding tracking entries
 	 *	allocated then the connection is "idle".
 	 */
-	if (!h->tt || (h->tt->num_requests == 0)) h->last_idle = fr_time();
+	if (udp_handle_num_requests(h) == 0) h->last_idle = fr_time();
 }
 
 /** Clear out anything associated with the handle from the request
@@ -2748,6 +3032,24 @@ static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, void
 	return UNLANG_ACTION_YIELD;
 }
 
+/** Report the load on the home server, from this thread's trunk
+ *
+ * A home server we have no active connections to can't take requests
+ * quickly, however idle it looks, so its load is reported as unavailable.
+ */
+static int mod_load_report(module_load_t *out, module_ctx_t const *mctx)
+{
+	udp_thread_t		*thread = talloc_get_type_abort(mctx->thread, udp_thread_t);
+
+	if (!thread->trunk) return -1;
+	if (fr_trunk_connection_count_by_state(thread->trunk, FR_TRUNK_CONN_ACTIVE) == 0) return -1;
+
+	out->outstanding = thread->trunk->req_alloc;
+	out->latency = thread->trunk->latency;
+
+	return 0;
+}
+
 /** Instantiate thread data for the submodule.
  *
  */
@@ -2799,6 +3101,8 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	rlm_radius_t		*parent = talloc_get_type_abort(mctx->inst->parent->data, rlm_radius_t);
 	rlm_radius_udp_t	*inst = talloc_get_type_abort(mctx->inst->data, rlm_radius_udp_t);
 	CONF_SECTION		*conf = mctx->inst->conf;
+	char			buffer[FR_IPADDR_STRLEN];
+	char			home_server[FR_IPADDR_STRLEN + sizeof(":65535")];
 
 	if (!parent) {
 		ERROR("IO module cannot be instantiated directly");
@@ -2848,6 +3152,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	fr_inet_ntop(buffer, sizeof(buffer), &inst->dst_ipaddr);
+	snprintf(home_server, sizeof(home_server), "%s:%u", buffer, inst->dst_port);
+	inst->response_time = fr_metric_register(FR_METRIC_TYPE_HISTOGRAM, "freeradius_home_server_response_seconds",
+						 "Time from first sending a request to a home server to receiving the reply.",
+						 "module", parent->name, "home_server", home_server, NULL);
+
 	/*
 	 *	Clamp max_packet_size first before checking recv_buff and send_buff
 	 */
@@ -2884,6 +3194,40 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
 	}
 
+	/*
+	 *	When replicating, IDs are reused freely, so one socket
+	 *	is always enough.
+	 */
+	if (inst->replicate) {
+		inst->num_sockets = 1;
+		inst->use_authenticator = false;
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", parent->trunk_conf.max_req_per_conn, <=, 255);
+		return 0;
+	}
+
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->num_sockets, >=, 1);
+	FR_INTEGER_BOUND_CHECK("num_sockets", inst->num_sockets, <=, UDP_MAX_SOCKETS);
+
+	/*
+	 *	Each socket has 256 IDs.  One is kept spare for
+	 *	status checks, which ignore the per-connection limit.
+	 *
+	 *	With use_authenticator, many requests can share an ID,
+	 *	but each response has to be checked against every
+	 *	request using its ID, so we limit how many there are.
+	 */
+	if (inst->use_authenticator) {
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", parent->trunk_conf.max_req_per_conn, <=,
+				       (uint32_t)inst->num_sockets * UDP_MAX_REQUESTS_PER_ID * 256);
+	} else {
+		FR_INTEGER_BOUND_CHECK("trunk.per_connection_max", parent->trunk_conf.max_req_per_conn, <=,
+				       ((uint32_t)inst->num_sockets * 256) - 1);
+	}
+	FR_INTEGER_BOUND_CHECK("trunk.per_connection_target", parent->trunk_conf.target_req_per_conn, <=,
+			       parent->trunk_conf.max_req_per_conn / 2);
+
+	inst->socket_max_requests = ROUND_UP_DIV(parent->trunk_conf.max_req_per_conn, inst->num_sockets);
+
 
 	return 0;
 }
@@ -2901,6 +3245,8 @@ rlm_radius_io_t rlm_radius_udp = {
 		.config			= module_config,
 		.instantiate		= mod_instantiate,
 		.thread_instantiate 	= mod_thread_instantiate,
+
+		.load_report		= mod_load_report,
 	},
 	.enqueue		= mod_enqueue,
 	.signal			= mod_signal,
@@ -157,11 +157,12 @@ retry:
 	tt->next_id &= 0xff;
 
 	/*
-	 *	If needed, allocate a subtree.
+	 *	If needed, allocate a subtree.  It also holds entries
+	 *	from the static array, which aren't talloc'd.
 	 */
 	if (!tt->subtree[tt->next_id]) {
-		MEM(tt->subtree[tt->next_id] = fr_rb_inline_talloc_alloc(tt, radius_track_entry_t, node,
-									 te_cmp, NULL));
+		MEM(tt->subtree[tt->next_id] = fr_rb_inline_alloc(tt, radius_track_entry_t, node,
+								  te_cmp, NULL));
 	}
 
 	/*
@@ -314,6 +315,15 @@ int radius_track_entry_update(radius_track_entry_t *te, uint8_t const *vector)
 		return 0;
 	}
 
+	/*
+	 *	Static entries may be used before any dynamic entry
+	 *	with the same ID, so the subtree may not exist yet.
+	 */
+	if (!tt->subtree[te->id]) {
+		MEM(tt->subtree[te->id] = fr_rb_inline_alloc(tt, radius_track_entry_t, node,
+							     te_cmp, NULL));
+	}
+
 	/*
 	 *	Insert it into the tree of authenticators
 	 *
@@ -399,6 +409,48 @@ radius_track_entry_t *radius_track_entry_find(radius_track_t *tt, uint8_t packet
 	return te;
 }
 
+/** Find a tracking entry by checking each request sent with an ID
+ *
+ * When the Request Authenticator is used to extend the ID space, many
+ * requests may be outstanding with the same ID.  Responses don't carry
+ * a copy of the Request Authenticator, so the caller checks each
+ * candidate, usually by verifying the Response Authenticator.
+ *
+ * @param tt		The radius_track_t tracking table
+ * @param packet_id	The ID from the RADIUS header
+ * @param match		Called for each request sent with packet_id.
+ * @param uctx		Passed to match.
+ * @return
+ *	- NULL on "not found"
+ *	- radius_track_entry_t on success
+ */
+radius_track_entry_t *radius_track_entry_match(radius_track_t *tt, uint8_t packet_id,
+					       radius_track_match_t match, void *uctx)
+{
+	radius_track_entry_t *te;
+
+	(void) talloc_get_type_abort(tt, radius_track_t);
+
+	/*
+	 *	Only the static entry can be in use.
+	 */
+	if (!tt->use_authenticator || !tt->subtree[packet_id]) {
+		te = &tt->id[packet_id];
+
+		if (!te->request || !match(te, uctx)) return NULL;
+
+		return te;
+	}
+
+	fr_rb_inorder_foreach(tt->subtree[packet_id], radius_track_entry_t, candidate) {
+		fr_assert(candidate->request != NULL);
+
+		if (match(candidate, uctx)) return candidate;
+	}
+	endforeach
+
+	return NULL;
+}
 
 /** Use Request Authenticator (or not) as an Identifier
  *
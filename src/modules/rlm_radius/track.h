@@ -120,4 +120,15 @@ int			radius_track_entry_update(radius_track_entry_t *te,
 radius_track_entry_t	*radius_track_entry_find(radius_track_t *tt, uint8_t packet_id,
 						 uint8_t const *vector) CC_HINT(nonnull(1));
 
+/** Check whether a response matches the request sent for a tracking entry
+ *
+ * @param[in] te	to check.
+ * @param[in] uctx	passed to radius_track_entry_match().
+ * @return true if the response matches.
+ */
+typedef bool (*radius_track_match_t)(radius_track_entry_t const *te, void *uctx);
+
+radius_track_entry_t	*radius_track_entry_match(radius_track_t *tt, uint8_t packet_id,
+						  radius_track_match_t match, void *uctx) CC_HINT(nonnull(1,3));
+
 void			radius_track_use_authenticator(radius_track_t *te, bool flag) CC_HINT(nonnull);
@@ -26,6 +26,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/pair.h>
+#include <freeradius-devel/io/trunk_shared.h>
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/server/connection.h>
 #include <freeradius-devel/util/debug.h>
@@ -61,7 +62,11 @@ typedef struct {
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
 
+	uint32_t		io_threads;		//!< Number of dedicated I/O threads.  0 for per-worker trunks.
+
 	fr_trunk_conf_t		*trunk_conf;		//!< trunk configuration
+
+	fr_trunk_shared_t	*shared;		//!< Trunks shared between workers, if io_threads is set.
 } rlm_tacacs_tcp_t;
 
 typedef struct {
@@ -70,10 +75,12 @@ typedef struct {
 	rlm_tacacs_tcp_t const	*inst;			//!< our instance
 
 	fr_trunk_t		*trunk;			//!< trunk handler
+	fr_trunk_shared_worker_t *shared;		//!< Handle for the shared trunks.
 } udp_thread_t;
 
 typedef struct {
 	fr_trunk_request_t	*treq;
+	fr_trunk_shared_request_t *sreq;		//!< Used instead of treq with shared trunks.
 	rlm_rcode_t		rcode;			//!< from the transport
 } udp_result_t;
 
@@ -150,6 +157,9 @@ struct udp_request_s {
 
 	fr_event_timer_t const	*ev;			//!< timer for retransmissions
 	fr_retry_t		retry;			//!< retransmission timers
+
+	fr_pair_t		*session_id;		//!< Session-ID created by the worker, with shared trunks.
+	fr_pair_list_t		reply;			//!< Decoded reply, with shared trunks.
 };
 
 static const conf_parser_t module_config[] = {
@@ -173,6 +183,8 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipv4addr", FR_TYPE_IPV4_ADDR, 0, rlm_tacacs_tcp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("src_ipv6addr", FR_TYPE_IPV6_ADDR, 0, rlm_tacacs_tcp_t, src_ipaddr) },
 
+	{ FR_CONF_OFFSET("io_threads", rlm_tacacs_tcp_t, io_threads), .dflt = "0" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -601,6 +613,16 @@ static int encode(udp_handle_t *h, request_t *request, udp_request_t *u)
 	 */
 	u->packet = h->send.write;
 
+	/*
+	 *	With shared trunks we're not in the thread which owns
+	 *	the request, so we can't allocate pairs in it.  The
+	 *	worker created the Session-ID for us.
+	 */
+	if (u->session_id) {
+		u->session_id->vp_uint32 = h->session_id;
+		goto do_encode;
+	}
+
 	/*
 	 *	Set the session ID, if it hasn't already been set.
 	 */
@@ -619,6 +641,7 @@ static int encode(udp_handle_t *h, request_t *request, udp_request_t *u)
 	/*
 	 *	Encode the packet.
 	 */
+do_encode:
 	packet_len = fr_tacacs_encode(&FR_DBUFF_TMP(u->packet, (size_t) inst->max_packet_size), NULL,
 				      inst->secret, inst->secretlen, request->reply->code, &request->request_pairs);
 	if (packet_len < 0) {
@@ -1162,9 +1185,13 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		fr_pair_list_init(&reply);
 
 		/*
-		 *	Validate and decode the incoming packet
+		 *	Validate and decode the incoming packet.  With
+		 *	shared trunks the reply is decoded into the
+		 *	udp_request_t, and moved to the request by
+		 *	request_complete in the worker.
 		 */
-		slen = decode(request->reply_ctx, &reply, &code, h, request, u, h->recv.read, packet_len);
+		slen = decode(h->inst->shared ? (TALLOC_CTX *)u : request->reply_ctx, &reply, &code,
+			      h, request, u, h->recv.read, packet_len);
 		if (slen < 0) {
 			// @todo - give real decode error?
 			fr_trunk_connection_signal_reconnect(tconn, FR_CONNECTION_FAILED);
@@ -1182,7 +1209,7 @@ static void request_demux(UNUSED fr_event_list_t *el, fr_trunk_connection_t *tco
 		// @todo - check various random locations for status of the reply: error, etc.
 		r->rcode = RLM_MODULE_OK;
 //		r->rcode = radius_code_to_rcode[code];
-		fr_pair_list_append(&request->reply_pairs, &reply);
+		fr_pair_list_append(h->inst->shared ? &u->reply : &request->reply_pairs, &reply);
 		fr_trunk_request_signal_complete(treq);
 	}
 }
@@ -1249,6 +1276,7 @@ static void request_fail(request_t *request, NDEBUG_UNUSED void *preq, void *rct
 
 	r->rcode = RLM_MODULE_FAIL;
 	r->treq = NULL;
+	r->sreq = NULL;
 
 	unlang_interpret_mark_runnable(request);
 }
@@ -1256,16 +1284,20 @@ static void request_fail(request_t *request, NDEBUG_UNUSED void *preq, void *rct
 /** Response has already been written to the rctx at this point
  *
  */
-static void request_complete(request_t *request, NDEBUG_UNUSED void *preq, void *rctx, UNUSED void *uctx)
+static void request_complete(request_t *request, void *preq, void *rctx, UNUSED void *uctx)
 {
 	udp_result_t		*r = talloc_get_type_abort(rctx, udp_result_t);
-#ifndef NDEBUG
 	udp_request_t		*u = talloc_get_type_abort(preq, udp_request_t);
-#endif
 
 	fr_assert(!u->packet && !u->ev);	/* Dealt with by request_conn_release */
 
+	if (!fr_pair_list_empty(&u->reply)) {
+		fr_pair_list_steal(request->reply_ctx, &u->reply);
+		fr_pair_list_append(&request->reply_pairs, &u->reply);
+	}
+
 	r->treq = NULL;
+	r->sreq = NULL;
 
 	unlang_interpret_mark_runnable(request);
 }
@@ -1310,6 +1342,24 @@ static void mod_signal(module_ctx_t const *mctx, UNUSED request_t *request, fr_s
 	 *	unlang_request_is_scheduled will return false
 	 *	(don't use it).
 	 */
+	if (r->sreq) {
+		/*
+		 *	The I/O thread deals with retransmissions
+		 *	for shared trunks, so only cancellations
+		 *	are passed on.
+		 */
+		if (action != FR_SIGNAL_CANCEL) return;
+
+		/*
+		 *	The I/O thread may still write to the rctx.
+		 *	It's allocated in the request, which is held
+		 *	until the I/O thread is done with it.
+		 */
+		fr_trunk_shared_request_signal_cancel(r->sreq);
+		r->sreq = NULL;
+		return;
+	}
+
 	if (!r->treq) {
 		talloc_free(r);
 		return;
@@ -1368,6 +1418,55 @@ static int _udp_result_free(udp_result_t *r)
 }
 #endif
 
+/** Pass the request to one of the I/O threads
+ *
+ */
+static unlang_action_t mod_enqueue_shared(rlm_rcode_t *p_result, void **rctx_out, udp_thread_t *t, request_t *request)
+{
+	udp_result_t			*r;
+	udp_request_t			*u;
+	fr_trunk_shared_request_t	*sreq;
+	fr_pair_t			*hdr;
+
+	sreq = fr_trunk_shared_request_alloc(t->shared, request);
+	if (!sreq) RETURN_MODULE_FAIL;
+
+	MEM(r = talloc_zero(request, udp_result_t));
+	MEM(u = talloc_zero(sreq, udp_request_t));
+	u->code = request->packet->code;
+	u->priority = request->async->priority;
+	u->recv_time = request->async->recv_time;
+	fr_pair_list_init(&u->reply);
+
+	/*
+	 *	The I/O thread can't allocate pairs in the request,
+	 *	so add the Session-ID here, and let encode() fill it in.
+	 */
+	hdr = fr_pair_find_by_da(&request->request_pairs, NULL, attr_packet_hdr);
+	if (!hdr) hdr = request->request_ctx;
+
+	if (!fr_pair_find_by_da_nested(&hdr->vp_group, NULL, attr_session_id)) {
+		MEM(u->session_id = fr_pair_afrom_da(hdr, attr_session_id));
+		fr_pair_append(&hdr->vp_group, u->session_id);
+		fr_pair_list_sort(&hdr->vp_group, fr_pair_cmp_by_parent_num);
+	}
+
+	r->rcode = RLM_MODULE_FAIL;
+
+	if (fr_trunk_shared_request_enqueue(sreq, u, r) != FR_TRUNK_ENQUEUE_OK) {
+		RWDEBUG("Too many requests queued for I/O threads");
+		talloc_free(sreq);
+		talloc_free(r);
+		RETURN_MODULE_FAIL;
+	}
+
+	r->sreq = sreq;	/* Remember for signalling purposes */
+
+	*rctx_out = r;
+
+	return UNLANG_ACTION_YIELD;
+}
+
 static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, UNUSED void *instance, void *thread, request_t *request)
 {
 	udp_thread_t			*t = talloc_get_type_abort(thread, udp_thread_t);
@@ -1378,6 +1477,8 @@ static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, UNUSE
 
 	fr_assert(FR_TACACS_PACKET_CODE_VALID(request->packet->code));
 
+	if (t->shared) return mod_enqueue_shared(p_result, rctx_out, t, request);
+
 	treq = fr_trunk_request_alloc(t->trunk, request);
 	if (!treq) RETURN_MODULE_FAIL;
 
@@ -1393,6 +1494,7 @@ static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, UNUSE
 	u->code = request->packet->code;
 	u->priority = request->async->priority;
 	u->recv_time = request->async->recv_time;
+	fr_pair_list_init(&u->reply);
 
 	r->rcode = RLM_MODULE_FAIL;
 
@@ -1420,6 +1522,34 @@ static unlang_action_t mod_enqueue(rlm_rcode_t *p_result, void **rctx_out, UNUSE
 	return UNLANG_ACTION_YIELD;
 }
 
+static fr_trunk_io_funcs_t const io_funcs = {
+	.connection_alloc = thread_conn_alloc,
+	.connection_notify = thread_conn_notify,
+	.request_prioritise = request_prioritise,
+	.request_mux = request_mux,
+	.request_demux = request_demux,
+	.request_conn_release = request_conn_release,
+	.request_complete = request_complete,
+	.request_fail = request_fail,
+	.request_cancel = request_cancel,
+	.request_free = request_free
+};
+
+/** Allocate the data passed to the I/O functions of a shared trunk
+ *
+ * Called in each I/O thread.
+ */
+static void *shared_uctx_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, void *uctx)
+{
+	udp_thread_t			*thread;
+
+	MEM(thread = talloc_zero(ctx, udp_thread_t));
+	thread->el = el;
+	thread->inst = talloc_get_type_abort(uctx, rlm_tacacs_tcp_t);
+
+	return thread;
+}
+
 /** Instantiate thread data for the submodule.
  *
  */
@@ -1428,39 +1558,21 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	rlm_tacacs_tcp_t		*inst = talloc_get_type_abort(mctx->inst->data, rlm_tacacs_tcp_t);
 	udp_thread_t			*thread = talloc_get_type_abort(mctx->thread, udp_thread_t);
 
-	static fr_trunk_io_funcs_t	io_funcs = {
-						.connection_alloc = thread_conn_alloc,
-						.connection_notify = thread_conn_notify,
-						.request_prioritise = request_prioritise,
-						.request_mux = request_mux,
-						.request_demux = request_demux,
-						.request_conn_release = request_conn_release,
-						.request_complete = request_complete,
-						.request_fail = request_fail,
-						.request_cancel = request_cancel,
-						.request_free = request_free
-					};
-
-	inst->trunk_conf = &inst->parent->trunk_conf;
-
-	inst->trunk_conf->req_pool_headers = 2;	/* One for the request, one for the buffer */
-	inst->trunk_conf->req_pool_size = sizeof(udp_request_t) + inst->max_packet_size;
-
 	thread->el = mctx->el;
 	thread->inst = inst;
-	thread->trunk = fr_trunk_alloc(thread, mctx->el, &io_funcs,
-				       inst->trunk_conf, inst->parent->name, thread, false);
-	if (!thread->trunk) return -1;
 
-	/*
-	 *	Empty secrets don't exist
-	 */
-	if (inst->secret && !*inst->secret) {
-		talloc_const_free(inst->secret);
-		inst->secret = NULL;
+	if (inst->shared) {
+		thread->shared = fr_trunk_shared_worker_alloc(thread, inst->shared, mctx->el);
+		if (!thread->shared) {
+			PERROR("%s - Failed attaching to I/O threads", inst->parent->name);
+			return -1;
+		}
+		return 0;
 	}
 
-	if (inst->secret) inst->secretlen = talloc_array_length(inst->secret) - 1;
+	thread->trunk = fr_trunk_alloc(thread, mctx->el, &io_funcs,
+				       inst->trunk_conf, inst->parent->name, thread, false);
+	if (!thread->trunk) return -1;
 
 	return 0;
 }
@@ -1535,6 +1647,31 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		FR_INTEGER_BOUND_CHECK("send_buff", inst->send_buff, <=, (1 << 30));
 	}
 
+	FR_INTEGER_BOUND_CHECK("io_threads", inst->io_threads, <=, 64);
+
+	inst->trunk_conf = &inst->parent->trunk_conf;
+
+	inst->trunk_conf->req_pool_headers = 2;	/* One for the request, one for the buffer */
+	inst->trunk_conf->req_pool_size = sizeof(udp_request_t) + inst->max_packet_size;
+
+	/*
+	 *	Empty secrets don't exist
+	 */
+	if (inst->secret && !*inst->secret) {
+		talloc_const_free(inst->secret);
+		inst->secret = NULL;
+	}
+
+	if (inst->secret) inst->secretlen = talloc_array_length(inst->secret) - 1;
+
+	if (inst->io_threads > 0) {
+		inst->shared = fr_trunk_shared_alloc(inst, &io_funcs, inst->trunk_conf, inst->parent->name,
+						     inst->io_threads, shared_uctx_alloc, inst);
+		if (!inst->shared) {
+			cf_log_perr(conf, "Failed creating shared trunks");
+			return -1;
+		}
+	}
 
 	return 0;
 }
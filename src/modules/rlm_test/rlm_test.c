@@ -110,6 +110,9 @@ typedef struct {
 
 	fr_time_delta_t	time_delta;
 	fr_time_delta_t	*time_delta_m;
+
+	uint64_t	load_outstanding;	//!< Outstanding requests to report to load-balance sections.
+	fr_time_delta_t	load_latency;		//!< Latency to report to load-balance sections.
 } rlm_test_t;
 
 typedef struct {
@@ -175,6 +178,9 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("time_delta", rlm_test_t, time_delta) },
 	{ FR_CONF_OFFSET("time_delta_t", rlm_test_t, time_delta_m) },
 
+	{ FR_CONF_OFFSET("load_outstanding", rlm_test_t, load_outstanding), .dflt = "0" },
+	{ FR_CONF_OFFSET("load_latency", rlm_test_t, load_latency), .dflt = "0" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -274,6 +280,19 @@ static unlang_action_t CC_HINT(nonnull) mod_return(rlm_rcode_t *p_result, UNUSED
 	RETURN_MODULE_OK;
 }
 
+/*
+ *	Report whatever load we were configured with.
+ */
+static int mod_load_report(module_load_t *out, module_ctx_t const *mctx)
+{
+	rlm_test_t const *inst = talloc_get_type_abort_const(mctx->inst->data, rlm_test_t);
+
+	out->outstanding = inst->load_outstanding;
+	out->latency = inst->load_latency;
+
+	return 0;
+}
+
 static void mod_retry_signal(module_ctx_t const *mctx, request_t *request, fr_signal_t action);
 
 /** Continue after marked runnable
@@ -528,7 +547,8 @@ module_rlm_t rlm_test = {
 		.onload			= mod_load,
 		.unload			= mod_unload,
 		.thread_instantiate	= mod_thread_instantiate,
-		.thread_detach		= mod_thread_detach
+		.thread_detach		= mod_thread_detach,
+		.load_report		= mod_load_report
 	},
 	.method_names = (module_method_name_t[]){
 		{ .name1 = "authorize",		.name2 = CF_IDENT_ANY,		.method = mod_authorize },
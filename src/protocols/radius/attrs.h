@@ -38,6 +38,7 @@ extern HIDDEN fr_dict_attr_t const *attr_chap_challenge;
 extern HIDDEN fr_dict_attr_t const *attr_chargeable_user_identity;
 extern HIDDEN fr_dict_attr_t const *attr_eap_message;
 extern HIDDEN fr_dict_attr_t const *attr_message_authenticator;
+extern HIDDEN fr_dict_attr_t const *attr_proxy_state;
 extern HIDDEN fr_dict_attr_t const *attr_state;
 extern HIDDEN fr_dict_attr_t const *attr_vendor_specific;
 extern HIDDEN fr_dict_attr_t const *attr_nas_filter_rule;
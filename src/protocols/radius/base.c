@@ -56,6 +56,7 @@ fr_dict_attr_t const *attr_chap_challenge;
 fr_dict_attr_t const *attr_chargeable_user_identity;
 fr_dict_attr_t const *attr_eap_message;
 fr_dict_attr_t const *attr_message_authenticator;
+fr_dict_attr_t const *attr_proxy_state;
 fr_dict_attr_t const *attr_state;
 fr_dict_attr_t const *attr_vendor_specific;
 fr_dict_attr_t const *attr_nas_filter_rule;
@@ -69,6 +70,7 @@ fr_dict_attr_autoload_t libfreeradius_radius_dict_attr[] = {
 
 	{ .out = &attr_eap_message, .name = "EAP-Message", .type = FR_TYPE_OCTETS, .dict = &dict_radius },
 	{ .out = &attr_message_authenticator, .name = "Message-Authenticator", .type = FR_TYPE_OCTETS, .dict = &dict_radius },
+	{ .out = &attr_proxy_state, .name = "Proxy-State", .type = FR_TYPE_OCTETS, .dict = &dict_radius },
 	{ .out = &attr_state, .name = "State", .type = FR_TYPE_OCTETS, .dict = &dict_radius },
 	{ .out = &attr_vendor_specific, .name = "Vendor-Specific", .type = FR_TYPE_VSA, .dict = &dict_radius },
 	{ .out = &attr_nas_filter_rule, .name = "NAS-Filter-Rule", .type = FR_TYPE_STRING, .dict = &dict_radius },
@@ -993,6 +995,459 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 	return fr_dbuff_set(dbuff, &work_dbuff);
 }
 
+/*
+ *	SipHash-2-4, keyed with a random key when the library is
+ *	initialised.  The attributes hashed may come from the
+ *	network, so the hash must not be predictable, or someone
+ *	could craft a modification which leaves it unchanged.
+ */
+static uint64_t pass_through_key[2];
+
+typedef struct {
+	uint64_t	v0, v1, v2, v3;
+	uint64_t	tail;			//!< Bytes not yet hashed as part of a word.
+	uint64_t	len;			//!< Total bytes hashed.
+} pass_through_hash_t;
+
+#define SIP_ROTL(_x, _b) (uint64_t)(((_x) << (_b)) | ((_x) >> (64 - (_b))))
+#define SIP_ROUND(_h) \
+do { \
+	(_h)->v0 += (_h)->v1; (_h)->v1 = SIP_ROTL((_h)->v1, 13); (_h)->v1 ^= (_h)->v0; (_h)->v0 = SIP_ROTL((_h)->v0, 32); \
+	(_h)->v2 += (_h)->v3; (_h)->v3 = SIP_ROTL((_h)->v3, 16); (_h)->v3 ^= (_h)->v2; \
+	(_h)->v0 += (_h)->v3; (_h)->v3 = SIP_ROTL((_h)->v3, 21); (_h)->v3 ^= (_h)->v0; \
+	(_h)->v2 += (_h)->v1; (_h)->v1 = SIP_ROTL((_h)->v1, 17); (_h)->v1 ^= (_h)->v2; (_h)->v2 = SIP_ROTL((_h)->v2, 32); \
+} while (0)
+
+static void pass_through_hash_init(pass_through_hash_t *h)
+{
+	*h = (pass_through_hash_t) {
+		.v0 = 0x736f6d6570736575ULL ^ pass_through_key[0],
+		.v1 = 0x646f72616e646f6dULL ^ pass_through_key[1],
+		.v2 = 0x6c7967656e657261ULL ^ pass_through_key[0],
+		.v3 = 0x7465646279746573ULL ^ pass_through_key[1]
+	};
+}
+
+static inline void pass_through_hash_word(pass_through_hash_t *h, uint64_t m)
+{
+	h->v3 ^= m;
+	SIP_ROUND(h);
+	SIP_ROUND(h);
+	h->v0 ^= m;
+}
+
+static void pass_through_hash_update(pass_through_hash_t *h, void const *data, size_t size)
+{
+	uint8_t const *p = data, *end = p + size;
+
+	while (p < end) {
+		h->tail |= ((uint64_t) *p++) << (8 * (h->len & 0x07));
+		if ((++h->len & 0x07) == 0) {
+			pass_through_hash_word(h, h->tail);
+			h->tail = 0;
+		}
+	}
+}
+
+static uint64_t pass_through_hash_final(pass_through_hash_t *h)
+{
+	pass_through_hash_word(h, (h->len << 56) | h->tail);
+
+	h->v2 ^= 0xff;
+	SIP_ROUND(h);
+	SIP_ROUND(h);
+	SIP_ROUND(h);
+	SIP_ROUND(h);
+
+	return h->v0 ^ h->v1 ^ h->v2 ^ h->v3;
+}
+
+static void pass_through_hash_pair(pass_through_hash_t *h, fr_pair_t const *vp)
+{
+	pass_through_hash_update(h, &vp->da, sizeof(vp->da));
+
+	switch (vp->vp_type) {
+	case FR_TYPE_STRUCTURAL:
+		fr_pair_list_foreach(&vp->vp_group, child) pass_through_hash_pair(h, child);
+		break;
+
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		pass_through_hash_update(h, &vp->vp_length, sizeof(vp->vp_length));
+		pass_through_hash_update(h, vp->vp_ptr, vp->vp_length);
+		break;
+
+	case FR_TYPE_FIXED_SIZE:
+		pass_through_hash_update(h, fr_value_box_raw(&vp->data, vp->vp_type),
+					 fr_value_box_field_sizes[vp->vp_type]);
+		break;
+
+	default:
+		break;
+	}
+}
+
+/** Hash the attributes which would be encoded into a RADIUS packet
+ *
+ * The hash is taken when a packet is decoded, and again before a
+ * copy of it is sent.  If the two match, nothing has changed the
+ * attributes, and fr_radius_encode_pass_through() can be used.
+ *
+ * Message-Authenticator is ignored, as it's always re-calculated.
+ *
+ * The hash is keyed, and the key changes every time the server starts,
+ * so it can't be used to compare lists across processes.
+ *
+ * @param[in] vps		to hash.
+ * @param[in] proxy_state	Whether to include Proxy-State attributes.
+ * @return the hash of the list.
+ */
+uint64_t fr_radius_pass_through_hash(fr_pair_list_t *vps, bool proxy_state)
+{
+	fr_pair_t		*vp;
+	fr_dcursor_t		cursor;
+	pass_through_hash_t	h;
+
+	pass_through_hash_init(&h);
+
+	for (vp = fr_pair_dcursor_iter_init(&cursor, vps, fr_radius_next_encodable, dict_radius);
+	     vp;
+	     vp = fr_dcursor_next(&cursor)) {
+		if (vp->da == attr_message_authenticator) continue;
+		if (!proxy_state && (vp->da == attr_proxy_state)) continue;
+
+		pass_through_hash_pair(&h, vp);
+	}
+
+	return pass_through_hash_final(&h);
+}
+
+typedef struct {
+	char const	*old_secret;
+	size_t		old_secret_len;
+	uint8_t const	*old_vector;		//!< Encrypted attributes in the original packet are hidden with.
+
+	char const	*secret;
+	size_t		secret_len;
+	uint8_t const	*vector;		//!< Encrypted attributes in the new packet are hidden with.
+
+	bool		disallow_tunnel_passwords;
+} pass_through_ctx_t;
+
+/** Re-hide an encrypted value with a new secret and authenticator
+ *
+ * User-Password and Tunnel-Password use the same construction, the
+ * only difference being the salt which is added to the first key.
+ * The value keeps its length and padding, so it can be done in place.
+ */
+static void pass_through_rehide(uint8_t *value, size_t len, uint8_t const *salt, size_t salt_len,
+				pass_through_ctx_t const *ctx)
+{
+	fr_md5_ctx_t	*md5_ctx;
+	uint8_t		old_digest[AUTH_PASS_LEN], digest[AUTH_PASS_LEN], old_block[AUTH_PASS_LEN];
+	size_t		i, n;
+
+	md5_ctx = fr_md5_ctx_alloc_from_list();
+
+	for (n = 0; n < len; n += AUTH_PASS_LEN) {
+		/*
+		 *	b(1) = MD5(secret + vector [+ salt]), b(n) = MD5(secret + c(n - 1))
+		 */
+		fr_md5_ctx_reset(md5_ctx);
+		fr_md5_update(md5_ctx, (uint8_t const *) ctx->old_secret, ctx->old_secret_len);
+		if (n == 0) {
+			fr_md5_update(md5_ctx, ctx->old_vector, RADIUS_AUTH_VECTOR_LENGTH);
+			if (salt_len) fr_md5_update(md5_ctx, salt, salt_len);
+		} else {
+			fr_md5_update(md5_ctx, old_block, AUTH_PASS_LEN);
+		}
+		fr_md5_final(old_digest, md5_ctx);
+
+		fr_md5_ctx_reset(md5_ctx);
+		fr_md5_update(md5_ctx, (uint8_t const *) ctx->secret, ctx->secret_len);
+		if (n == 0) {
+			fr_md5_update(md5_ctx, ctx->vector, RADIUS_AUTH_VECTOR_LENGTH);
+			if (salt_len) fr_md5_update(md5_ctx, salt, salt_len);
+		} else {
+			fr_md5_update(md5_ctx, value + n - AUTH_PASS_LEN, AUTH_PASS_LEN);
+		}
+		fr_md5_final(digest, md5_ctx);
+
+		/*
+		 *	The next block's old key is derived from this
+		 *	block's old ciphertext.
+		 */
+		memcpy(old_block, value + n, AUTH_PASS_LEN);
+
+		for (i = 0; i < AUTH_PASS_LEN; i++) value[n + i] ^= old_digest[i] ^ digest[i];
+	}
+
+	fr_md5_ctx_free_from_list(&md5_ctx);
+}
+
+/** Re-hide any encrypted attributes in a value copied from the original packet
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the value can't be passed through.
+ */
+static int pass_through_value(uint8_t *value, size_t len, fr_dict_attr_t const *da, pass_through_ctx_t const *ctx)
+{
+	uint8_t *p, *end;
+
+	/*
+	 *	Extended attributes can't be encrypted.
+	 */
+	if (flag_extended(&da->flags)) return 0;
+
+	if (flag_encrypted(&da->flags)) switch (da->flags.subtype) {
+	case FLAG_ENCRYPT_USER_PASSWORD:
+		if ((len == 0) || (len > RADIUS_MAX_PASS_LENGTH) || ((len % AUTH_PASS_LEN) != 0)) return -1;
+
+		pass_through_rehide(value, len, NULL, 0, ctx);
+		return 0;
+
+	case FLAG_TAGGED_TUNNEL_PASSWORD:
+	case FLAG_ENCRYPT_TUNNEL_PASSWORD:
+		if (ctx->disallow_tunnel_passwords) return -1;
+
+		/*
+		 *	The salt always has the high bit set, so
+		 *	it can't be mistaken for a tag.
+		 */
+		if (flag_has_tag(&da->flags) && (len > 0) && (value[0] < 0x20)) {
+			value++;
+			len--;
+		}
+		if ((len < (2 + AUTH_PASS_LEN)) || (((len - 2) % AUTH_PASS_LEN) != 0)) return -1;
+
+		pass_through_rehide(value + 2, len - 2, value, 2, ctx);
+		return 0;
+
+	default:
+		return -1;
+	}
+
+	switch (da->type) {
+	case FR_TYPE_VSA:
+	{
+		uint32_t		vendor_pen;
+		fr_dict_vendor_t const	*dv;
+
+		/*
+		 *	Anything which doesn't look like a VSA is
+		 *	decoded as a raw attribute.
+		 */
+		if ((len < 5) || (value[0] != 0)) return 0;
+
+		memcpy(&vendor_pen, value, sizeof(vendor_pen));
+		vendor_pen = ntohl(vendor_pen);
+
+		da = fr_dict_attr_child_by_num(da, vendor_pen);
+		if (!da) return 0;
+
+		/*
+		 *	We can't walk non-standard VSAs, so we can't
+		 *	tell if they contain encrypted attributes.
+		 */
+		dv = fr_dict_vendor_by_num(dict_radius, vendor_pen);
+		if (!dv || dv->continuation || (dv->type != 1) || (dv->length != 1)) return -1;
+
+		value += 4;
+		len -= 4;
+	}
+		break;
+
+	case FR_TYPE_TLV:
+		break;
+
+	default:
+		return 0;
+	}
+
+	if (fr_radius_decode_tlv_ok(value, len, 1, 1) < 0) return 0;
+
+	end = value + len;
+	for (p = value; p < end; p += p[1]) {
+		fr_dict_attr_t const *child;
+
+		child = fr_dict_attr_child_by_num(da, p[0]);
+		if (!child) continue;
+
+		if (pass_through_value(p + 2, p[1] - 2, child, ctx) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Encode a packet by copying the attributes of a previously received one
+ *
+ * Used when proxying, if fr_radius_pass_through_hash() shows that
+ * the attributes decoded from the received packet haven't been
+ * modified.  Copying the attributes is much cheaper than encoding
+ * them again.
+ *
+ * The header is filled in the same way as fr_radius_encode().  All
+ * attributes are copied verbatim, with encrypted attributes re-hidden
+ * using the new secret and authenticator.  Message-Authenticator, and
+ * Proxy-State if it isn't being copied, are encoded from vps.
+ *
+ * @param[out] packet		Where to write the packet.  For Access-Request and
+ *				Status-Server, it must contain the Request Authenticator.
+ * @param[in] packet_len	Length of the packet buffer.
+ * @param[in] original		The request being replied to, if we're encoding a reply.
+ * @param[in] pt		The received packet.
+ * @param[in] secret		Of the new packet.
+ * @param[in] secret_len	Length of the secret.
+ * @param[in] code		Of the new packet.
+ * @param[in] id		Of the new packet.
+ * @param[in] vps		The attributes decoded from the received packet.
+ * @param[in] proxy_state	Whether Proxy-State attributes are copied from the
+ *				received packet, or encoded from vps.
+ * @return
+ *	- >0 the length of the encoded packet.
+ *	- 0 if the packet can't be passed through, and must be encoded from vps.
+ *	- <0 on error.
+ */
+ssize_t fr_radius_encode_pass_through(uint8_t *packet, size_t packet_len, uint8_t const *original,
+				      fr_radius_pass_through_t const *pt,
+				      char const *secret, size_t secret_len, int code, int id,
+				      fr_pair_list_t *vps, bool proxy_state)
+{
+	fr_dbuff_t		work_dbuff = FR_DBUFF_TMP(packet, packet_len > 65535 ? 65535 : packet_len);
+	fr_dbuff_t		length_dbuff;
+	fr_pair_t const		*vp;
+	fr_dcursor_t		cursor;
+	fr_radius_ctx_t		common_ctx = {};
+	fr_radius_encode_ctx_t	packet_ctx = {};
+	pass_through_ctx_t	ctx;
+	uint8_t const		*attr, *end;
+	static const uint8_t	zeros[RADIUS_AUTH_VECTOR_LENGTH] = {};
+
+	if ((pt->data_len < RADIUS_HEADER_LENGTH) || (code <= 0) || (code >= FR_RADIUS_CODE_MAX)) return 0;
+
+	ctx = (pass_through_ctx_t) {
+		.old_secret = pt->secret,
+		.old_secret_len = pt->secret_length,
+		.secret = secret,
+		.secret_len = secret_len,
+		.disallow_tunnel_passwords = disallow_tunnel_passwords[code]
+	};
+
+	switch (pt->data[0]) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		ctx.old_vector = pt->data + 4;
+		break;
+
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+		ctx.old_vector = zeros;
+		break;
+
+	default:
+		ctx.old_vector = pt->vector;
+		break;
+	}
+
+	common_ctx.secret = secret;
+	common_ctx.secret_length = secret_len;
+
+	packet_ctx.common = &common_ctx;
+	packet_ctx.request_authenticator = common_ctx.vector;
+	packet_ctx.rand_ctx.a = fr_rand();
+	packet_ctx.rand_ctx.b = fr_rand();
+	packet_ctx.disallow_tunnel_passwords = ctx.disallow_tunnel_passwords;
+
+	FR_DBUFF_IN_BYTES_RETURN(&work_dbuff, code, id);
+	length_dbuff = FR_DBUFF(&work_dbuff);
+	FR_DBUFF_IN_RETURN(&work_dbuff, (uint16_t) RADIUS_HEADER_LENGTH);
+
+	switch (code) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+		FR_DBUFF_OUT_MEMCPY_RETURN(common_ctx.vector, &work_dbuff, sizeof(common_ctx.vector));
+		break;
+
+	case FR_RADIUS_CODE_ACCESS_ACCEPT:
+	case FR_RADIUS_CODE_ACCESS_REJECT:
+	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+	case FR_RADIUS_CODE_COA_ACK:
+	case FR_RADIUS_CODE_COA_NAK:
+	case FR_RADIUS_CODE_DISCONNECT_ACK:
+	case FR_RADIUS_CODE_DISCONNECT_NAK:
+		if (!original) return 0;
+
+		memcpy(common_ctx.vector, original + 4, sizeof(common_ctx.vector));
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, common_ctx.vector, RADIUS_AUTH_VECTOR_LENGTH);
+		break;
+
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+		FR_DBUFF_MEMSET_RETURN(&work_dbuff, 0, RADIUS_AUTH_VECTOR_LENGTH);
+		break;
+
+	/*
+	 *	Protocol-Error needs Original-Packet-Code, which
+	 *	isn't in the received packet.
+	 */
+	default:
+		return 0;
+	}
+	ctx.vector = common_ctx.vector;
+
+	/*
+	 *	Copy the attributes.  The received packet was checked
+	 *	by fr_radius_ok(), but we don't want to trust that.
+	 */
+	end = pt->data + pt->data_len;
+	for (attr = pt->data + RADIUS_HEADER_LENGTH; attr < end; attr += attr[1]) {
+		fr_dict_attr_t const	*da;
+		uint8_t			*value;
+
+		if (((attr + 2) > end) || (attr[1] < 2) || ((attr + attr[1]) > end)) return 0;
+
+		if (attr[0] == FR_MESSAGE_AUTHENTICATOR) continue;
+		if (!proxy_state && (attr[0] == FR_PROXY_STATE)) continue;
+
+		value = fr_dbuff_current(&work_dbuff) + 2;
+		FR_DBUFF_IN_MEMCPY_RETURN(&work_dbuff, attr, attr[1]);
+
+		da = fr_dict_attr_child_by_num(fr_dict_root(dict_radius), attr[0]);
+		if (!da) continue;
+
+		if (pass_through_value(value, attr[1] - 2, da, &ctx) < 0) return 0;
+	}
+
+	/*
+	 *	Add the attributes we didn't copy.
+	 */
+	fr_pair_dcursor_iter_init(&cursor, vps, fr_radius_next_encodable, dict_radius);
+	while ((vp = fr_dcursor_current(&cursor))) {
+		ssize_t slen;
+
+		if ((vp->da != attr_message_authenticator) && (proxy_state || (vp->da != attr_proxy_state))) {
+			fr_dcursor_next(&cursor);
+			continue;
+		}
+
+		slen = fr_radius_encode_pair(&work_dbuff, &cursor, &packet_ctx);
+		if (slen < 0) {
+			if (slen == PAIR_ENCODE_SKIPPED) continue;
+			return slen;
+		}
+	}
+
+	fr_dbuff_in(&length_dbuff, (uint16_t) (fr_dbuff_used(&work_dbuff)));
+
+	FR_PROTO_HEX_DUMP(fr_dbuff_start(&work_dbuff), fr_dbuff_used(&work_dbuff), "%s encoded packet", __FUNCTION__);
+
+	return fr_dbuff_used(&work_dbuff);
+}
+
 ssize_t	fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 			 uint8_t *packet, size_t packet_len,
 			 fr_radius_decode_ctx_t *decode_ctx)
@@ -1135,6 +1590,8 @@ int fr_radius_global_init(void)
 		goto fail;
 	}
 
+	fr_rand_buffer(pass_through_key, sizeof(pass_through_key));
+
 	return 0;
 }
 
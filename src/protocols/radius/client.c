@@ -68,7 +68,7 @@ fr_radius_client_fd_bio_t *fr_radius_client_fd_bio_alloc(TALLOC_CTX *ctx, size_t
 	}
 	my->fd = fd;
 
-	my->mem = mem = fr_bio_mem_alloc(ctx, read_size, 2 * 4096, fd);
+	my->mem = mem = fr_bio_mem_alloc(my, read_size, 2 * 4096, fd);
 	if (!mem) goto fail;
 
 	my->cfg = *cfg;
@@ -141,13 +141,9 @@ int fr_radius_client_fd_bio_read(fr_bio_packet_t *bio, UNUSED void *packet_ctx,
 	fr_bio_fd_packet_ctx_t fd_ctx;
 
 	slen = fr_bio_read(my->common.bio, &fd_ctx, &my->buffer, sizeof(my->buffer));
-	if (!slen) return 0;
+	if (!slen || (slen == fr_bio_error(IO_WOULD_BLOCK))) return 0;
 
-	if (slen < 0) {
-		fr_assert(slen != fr_bio_error(IO_WOULD_BLOCK));
-
-		return slen;
-	}
+	if (slen < 0) return slen;
 
 	/*
 	 *	We now have a complete packet in our buffer.  Check if it is one we expect.
@@ -2215,6 +2215,82 @@ static ssize_t fr_radius_decode_proto(TALLOC_CTX *ctx, fr_pair_list_t *out,
 	return fr_radius_decode(ctx, out, UNCONST(uint8_t *, data), packet_len, test_ctx);
 }
 
+/** Pass a packet through with a new secret and authenticator, and decode the result
+ *
+ * The attributes decoded should be the same as those decoded from the
+ * original packet, as encrypted attributes must have been re-hidden.
+ * Replies are passed through as if they were answering a request
+ * with a different Request Authenticator.
+ */
+static ssize_t fr_radius_decode_pass_through(TALLOC_CTX *ctx, fr_pair_list_t *out,
+					     uint8_t const *data, size_t data_len, void *proto_ctx)
+{
+	fr_radius_decode_ctx_t		*test_ctx = talloc_get_type_abort(proto_ctx, fr_radius_decode_ctx_t);
+	static uint8_t const		vector[RADIUS_AUTH_VECTOR_LENGTH] = {
+						0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+						0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+	static char const		secret[] = "pass-through";
+	uint8_t				original[RADIUS_HEADER_LENGTH] = { FR_RADIUS_CODE_ACCESS_REQUEST };
+	uint8_t				*packet;
+	fr_radius_pass_through_t	pt;
+	fr_pair_list_t			vps;
+	decode_fail_t			reason;
+	size_t				packet_len = data_len;
+	ssize_t				slen;
+
+	if (!fr_radius_ok(data, &packet_len, 200, false, &reason)) {
+		fr_strerror_printf("Packet failed verification - %s", reason_name[reason]);
+		return -1;
+	}
+
+	pt = (fr_radius_pass_through_t) {
+		.data = data,
+		.data_len = packet_len,
+		.secret = test_ctx->common->secret,
+		.secret_length = test_ctx->common->secret_length
+	};
+	memcpy(pt.vector, test_ctx->request_authenticator, sizeof(pt.vector));
+	memcpy(original + 4, vector, sizeof(vector));
+
+	packet = talloc_zero_array(ctx, uint8_t, MAX_PACKET_LEN);
+	if (!packet) return -1;
+	memcpy(packet + 4, vector, sizeof(vector));
+
+	fr_pair_list_init(&vps);
+	slen = fr_radius_encode_pass_through(packet, MAX_PACKET_LEN, original, &pt, secret, sizeof(secret) - 1,
+					     data[0], data[1], &vps, true);
+	if (slen <= 0) {
+		if (slen == 0) fr_strerror_const("Packet can't be passed through");
+		return -1;
+	}
+
+	/*
+	 *	Sign the packet as the server would.  Requests carry
+	 *	their own authenticator, replies use the one from
+	 *	the new request.
+	 */
+	test_ctx->common->secret = secret;
+	test_ctx->common->secret_length = sizeof(secret) - 1;
+	switch (packet[0]) {
+	case FR_RADIUS_CODE_ACCESS_REQUEST:
+	case FR_RADIUS_CODE_STATUS_SERVER:
+	case FR_RADIUS_CODE_ACCOUNTING_REQUEST:
+	case FR_RADIUS_CODE_COA_REQUEST:
+	case FR_RADIUS_CODE_DISCONNECT_REQUEST:
+		test_ctx->request_authenticator = NULL;
+		break;
+
+	default:
+		test_ctx->request_authenticator = vector;
+		break;
+	}
+
+	if (fr_radius_sign(packet, test_ctx->request_authenticator,
+			   (uint8_t const *) secret, sizeof(secret) - 1) < 0) return -1;
+
+	return fr_radius_decode_proto(ctx, out, packet, slen, test_ctx);
+}
+
 static ssize_t decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *out, NDEBUG_UNUSED fr_dict_attr_t const *parent,
 			   uint8_t const *data, size_t data_len, void *decode_ctx)
 {
@@ -2241,3 +2317,9 @@ fr_test_point_proto_decode_t radius_tp_decode_proto = {
 	.test_ctx	= decode_test_ctx,
 	.func		= fr_radius_decode_proto
 };
+
+extern fr_test_point_proto_decode_t radius_tp_decode_pass_through;
+fr_test_point_proto_decode_t radius_tp_decode_pass_through = {
+	.test_ctx	= decode_test_ctx,
+	.func		= fr_radius_decode_pass_through
+};
@@ -58,7 +58,7 @@ fr_radius_id_t *fr_radius_id_alloc(TALLOC_CTX *ctx)
 		track->ids[i] = i;
 	}
 
-	return 0;
+	return track;
 }
 
 /** Allocate an ID for a packet, using LRU
@@ -68,6 +68,11 @@ int fr_radius_id_pop(fr_radius_id_t *track, fr_radius_packet_t *packet)
 {
 	int id;
 
+	if (!track->free) {
+		fr_strerror_const("No free IDs");
+		return -1;
+	}
+
 	id = track->ids[track->free_start];
 	fr_assert(id >= 0);
 	fr_assert(id < 256);
@@ -97,7 +102,6 @@ int fr_radius_id_push(fr_radius_id_t *track, fr_radius_packet_t const *packet)
 
 	fr_assert(track->packet[packet->id] == packet);
 	fr_assert(track->free < 256);
-	fr_assert(track->free_start != track->free_end);
 	fr_assert(track->free_end >= 0);
 	fr_assert(track->free_end < 256);
 	fr_assert(track->ids[track->free_end] == -1);
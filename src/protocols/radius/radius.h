@@ -152,6 +152,29 @@ typedef struct {
 	TALLOC_CTX		*tag_root_ctx;		//!< Where to allocate new tag attributes.
 } fr_radius_decode_ctx_t;
 
+/** A received packet, which may be forwarded without re-encoding its attributes
+ *
+ */
+typedef struct {
+	uint8_t const		*data;			//!< Packet as it was received.
+	size_t			data_len;		//!< Length of the packet.
+
+	char const		*secret;		//!< Secret the packet was received with.
+	size_t			secret_length;
+
+	uint8_t			vector[RADIUS_AUTH_VECTOR_LENGTH]; //!< Request Authenticator of the original
+							///< request, if the packet is a reply.
+
+	uint64_t		hash;			//!< Of the attributes decoded from the packet.
+} fr_radius_pass_through_t;
+
+/*
+ *	request_data identifiers for fr_radius_pass_through_t.  The
+ *	unique pointer is fr_radius_encode_pass_through.
+ */
+#define FR_RADIUS_PASS_THROUGH_REQUEST	(1)
+#define FR_RADIUS_PASS_THROUGH_REPLY	(2)
+
 /*
  *	protocols/radius/base.c
  */
@@ -173,6 +196,13 @@ ssize_t		fr_radius_encode(uint8_t *packet, size_t packet_len, uint8_t const *ori
 ssize_t		fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 				 char const *secret, UNUSED size_t secret_len, int code, int id, fr_pair_list_t *vps);
 
+uint64_t	fr_radius_pass_through_hash(fr_pair_list_t *vps, bool proxy_state) CC_HINT(nonnull);
+
+ssize_t		fr_radius_encode_pass_through(uint8_t *packet, size_t packet_len, uint8_t const *original,
+					      fr_radius_pass_through_t const *pt,
+					      char const *secret, size_t secret_len, int code, int id,
+					      fr_pair_list_t *vps, bool proxy_state) CC_HINT(nonnull(1,4,5,9));
+
 ssize_t		fr_radius_decode(TALLOC_CTX *ctx, fr_pair_list_t *out,
 				 uint8_t *packet, size_t packet_len,
 				 fr_radius_decode_ctx_t *decode_ctx) CC_HINT(nonnull);
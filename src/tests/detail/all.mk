@@ -26,6 +26,38 @@ $(OUTPUT)/%: $(DIR)/% $(addprefix ${BUILD_DIR}/lib/,proto_detail.la proto_detail
 	fi
 	${Q}touch $@
 
+#
+#	Write the entries of a text detail file to a binary one, then
+#	replay the binary file and check that the attributes survived.
+#
+#	The writer adds a new Timestamp, so that isn't compared.  Only
+#	attributes from the protocol dictionary are written to binary
+#	files, so the input doesn't contain any internal attributes.
+#
+$(OUTPUT)/binary.txt: $(DIR)/binary.txt $(DIR)/config/binary_write.conf $(DIR)/config/binary_replay.conf $(addprefix ${BUILD_DIR}/lib/,proto_detail.la proto_detail_file.la proto_detail_work.la rlm_detail.la)
+	${Q}echo "DETAIL binary.txt"
+	${Q}rm -rf $(BUILD_DIR)/tests/detail/binary
+	${Q}mkdir -p $(BUILD_DIR)/tests/detail/binary/replay
+	${Q}cp $< $(BUILD_DIR)/tests/detail/binary/detail.txt
+	${Q}if ! $(TEST_BIN)/radiusd -d src/tests/detail/config -n binary_write -D ${top_srcdir}/share/dictionary -X > $@.write.log; then \
+		tail $@.write.log; \
+		echo "$(TEST_BIN)/radiusd -d src/tests/detail/config -n binary_write -D ${top_srcdir}/share/dictionary -X"; \
+		exit 1; \
+	fi
+	${Q}if ! $(TEST_BIN)/radiusd -d src/tests/detail/config -n binary_replay -D ${top_srcdir}/share/dictionary -X > $@.replay.log; then \
+		tail $@.replay.log; \
+		echo "$(TEST_BIN)/radiusd -d src/tests/detail/config -n binary_replay -D ${top_srcdir}/share/dictionary -X"; \
+		exit 1; \
+	fi
+	${Q}grep '^[[:space:]]' $< | grep -v 'Timestamp = ' | while read -r line; do \
+		if ! grep -qxF "	$$line" $(BUILD_DIR)/tests/detail/binary/replayed; then \
+			echo "DETAIL FAILED binary.txt - missing \"$$line\""; \
+			cat $(BUILD_DIR)/tests/detail/binary/replayed; \
+			exit 1; \
+		fi; \
+	done
+	${Q}touch $@
+
 .NO_PARALLEL: $(TEST)
 $(TEST):
 	@touch $(BUILD_DIR)/tests/$@
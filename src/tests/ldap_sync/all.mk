@@ -3,6 +3,11 @@
 #
 TEST := test.ldap_sync
 
+#
+#  The replica tests are fed by the RFC 4533 directory
+#
+REPLICA_TEST_SERVER ?= $(RFC4533_TEST_SERVER)
+
 #
 #  Find all the LDAP syncs for which we have a configured server
 #
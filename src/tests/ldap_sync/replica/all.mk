@@ -0,0 +1,73 @@
+#
+#	Tests that the ldap module answers searches from a replica fed
+#	by LDAP sync, and sends searches the replica doesn't cover to
+#	the directory.
+#
+
+#
+#	Test name
+#
+TEST := test.ldap_sync/replica
+FILES := $(subst $(DIR)/,,$(wildcard $(DIR)/*.txt))
+
+$(eval $(call TEST_BOOTSTRAP))
+
+#
+#	Client port
+#
+REPLICA_CLIENT_PORT = 1334
+
+#
+#	Generic rules to start /stop the radius service
+#
+CLIENT := radclient
+include src/tests/radiusd.mk
+$(eval $(call RADIUSD_SERVICE,radiusd,$(OUTPUT)))
+
+$(TEST).trigger_clear:
+	${Q}rm -f $(BUILD_DIR)/tests/ldap_sync/replica/replica_ready
+
+$(OUTPUT)/%: $(DIR)/% $(BUILD_DIR)/bin/local/radclient | $(TEST).trigger_clear $(TEST).radiusd_kill $(TEST).radiusd_start
+	$(eval TARGET   := $(notdir $<))
+	$(eval EXPECTED := $(patsubst %.txt,%.out,$<))
+	$(eval FOUND    := $(patsubst %.txt,%.out,$@))
+	$(eval ARGV     := $(shell grep "#.*ARGV:" $< | cut -f2 -d ':'))
+	$(eval OUT_DIR  := $(BUILD_DIR)/tests/ldap_sync/replica)
+	$(eval REPLICA_CLIENT_PORT := $(shell echo $$(($(REPLICA_CLIENT_PORT)+1))))
+
+	${Q}echo "LDAPSYNC-TEST replica $(TARGET)"
+	${Q}[ -f $(dir $@)/radiusd.pid ] || exit 1
+
+#	Wait for the initial refresh to complete
+	${Q}i=0; while [ $$i -lt 100 ] ; \
+		do if [ -e $(OUT_DIR)/replica_ready ];	\
+		then					\
+		break;					\
+		fi;					\
+		sleep .1;				\
+		i=$$((i+1));				\
+	done ;
+	${Q}if [ ! -e $(OUT_DIR)/replica_ready ]; then				\
+		$(MAKE) --no-print-directory test.ldap_sync/replica.radiusd_kill;	\
+		cat $(OUT_DIR)/radiusd.log;					\
+		echo "LDAP_SYNC FAILED $(TARGET) - replica not ready";		\
+		exit 1;								\
+	fi
+
+	${Q}if ! $(TEST_BIN)/radclient $(ARGV) -C $(REPLICA_CLIENT_PORT) -f $< -d src/tests/radclient/config -D share/dictionary 127.0.0.1:$(ldap_sync/replica_port) auth $(SECRET) 1> $(FOUND) 2>&1; then \
+		cat $(FOUND);							\
+		$(MAKE) --no-print-directory test.ldap_sync/replica.radiusd_kill;	\
+		echo "LDAP_SYNC FAILED $(TARGET) - radclient failed";		\
+		exit 1;								\
+	fi
+	${Q}if ! diff -I 'Sent' -I 'Received' $(EXPECTED) $(FOUND); then	\
+		$(MAKE) --no-print-directory test.ldap_sync/replica.radiusd_kill;	\
+		cat $(OUT_DIR)/radiusd.log;					\
+		echo "LDAP_SYNC FAILED $(TARGET)";				\
+		exit 1;								\
+	fi
+	${Q}touch $@
+
+$(TEST):
+	${Q}$(MAKE) --no-print-directory $@.radiusd_stop
+	@touch $(BUILD_DIR)/tests/$@
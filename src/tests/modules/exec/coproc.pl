@@ -0,0 +1,74 @@
+#!/usr/bin/perl
+#
+#  Co-process used by the exec module tests.
+#
+#  Reads length prefixed requests on stdin, and writes length prefixed
+#  responses to stdout.  The first argument of a call selects what to do.
+#
+use strict;
+use warnings;
+
+binmode(STDIN);
+binmode(STDOUT);
+$| = 1;
+
+#
+#  Use a small pipe buffer, as some platforms do, so that large
+#  requests have to be written in several parts.  F_SETPIPE_SZ is 1031.
+#
+fcntl(STDIN, 1031, 4096) if ($^O eq 'linux');
+
+sub read_exactly {
+	my ($len) = @_;
+	my $buff = '';
+
+	while (length($buff) < $len) {
+		my $got = sysread(STDIN, $buff, $len - length($buff), length($buff));
+		exit(0) if !$got;
+	}
+
+	return $buff;
+}
+
+sub respond {
+	my ($status, $output) = @_;
+
+	syswrite(STDOUT, pack('Nl>', length($output) + 4, $status) . $output);
+}
+
+while (1) {
+	my $len = unpack('N', read_exactly(4));
+	my ($type, $argc, $envc, $strings) = unpack('Cnna*', read_exactly($len));
+	my @strings = split(/\0/, $strings, -1);
+	my @argv = @strings[0 .. $argc - 1];
+	my %env = map { split(/=/, $_, 2) } @strings[$argc .. $argc + $envc - 1];
+
+	if ($type == 2) {
+		respond(0, '');
+		next;
+	}
+
+	my $cmd = shift(@argv) // '';
+
+	if ($cmd eq 'echo') {
+		respond(0, join(' ', @argv) . "\n");
+
+	} elsif ($cmd eq 'attrs') {
+		respond(0, "Filter-Id := $argv[0]\nCallback-Id := $env{CALLED_STATION_ID}\n");
+
+	} elsif ($cmd eq 'fail') {
+		respond(7, "NAS-Identifier := Failure\n");
+
+	} elsif ($cmd eq 'length') {
+		respond(0, length($argv[0]) . "\n");
+
+	} elsif ($cmd eq 'pid') {
+		respond(0, "$$\n");
+
+	} elsif ($cmd eq 'exit') {
+		exit(1);
+
+	} else {
+		respond(2, "Unknown command $cmd\n");
+	}
+}
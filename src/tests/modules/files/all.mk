@@ -1,3 +1,24 @@
 #
 #  Test the "files" module
 #
+
+#
+#  This file is included once for each test, so only define the rules once.
+#
+ifndef FILES_RELOAD_USERS
+FILES_RELOAD_USERS := src/tests/modules/files/reload_users.watched
+
+#
+#  Every test loads the "files_reload_watch" instance, so the file
+#  it watches has to exist before they run.
+#
+$(addprefix $(BUILD_DIR)/tests/modules/,$(filter files/%,$(FILES))): | $(FILES_RELOAD_USERS)
+
+$(FILES_RELOAD_USERS): src/tests/modules/files/reload_users
+	${Q}cp $< $@
+
+#
+#  reload_watch.unlang replaces the file using the "exec" module.
+#
+$(BUILD_DIR)/tests/modules/files/reload_watch: $(BUILD_DIR)/lib/local/rlm_exec.la
+endif
@@ -0,0 +1,32 @@
+import freeradius
+
+
+def authorize(p):
+    if p.request["User-Name"] != "bob":
+        return freeradius.RLM_MODULE_FAIL
+
+    if "User-Password" not in p.request or "Reply-Message" in p.request:
+        return freeradius.RLM_MODULE_FAIL
+
+    if p.request.get("Reply-Message", "missing") != "missing":
+        return freeradius.RLM_MODULE_FAIL
+
+    # Older scripts iterate over (name, value) tuples
+    if ("User-Name", "bob") not in list(p):
+        return freeradius.RLM_MODULE_FAIL
+
+    # The objects can only be created by the module
+    for t in (type(p), type(p.request)):
+        try:
+            t()
+            return freeradius.RLM_MODULE_FAIL
+        except TypeError:
+            pass
+
+    p.reply["Reply-Message"] = "hello from python"
+    p.reply["Session-Timeout"] = 3600
+    p.control["Tmp-String-0"] = "to be deleted"
+    del p.control["Tmp-String-0"]
+    p.control["Tmp-String-1"] = p.request["User-Password"]
+
+    return freeradius.RLM_MODULE_UPDATED
@@ -0,0 +1,13 @@
+import freeradius
+
+
+def authorize(p):
+    #
+    #  Enough work that the time is spent in Python,
+    #  and not in the server.
+    #
+    n = 0
+    for i in range(20000):
+        n += i * i
+
+    return freeradius.RLM_MODULE_OK
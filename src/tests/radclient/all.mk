@@ -30,7 +30,8 @@ CLIENT := radclient
 include src/tests/radiusd.mk
 $(eval $(call RADIUSD_SERVICE,radiusd,$(OUTPUT)))
 
-$(OUTPUT)/auth_proxy.txt: $(BUILD_DIR)/lib/local/rlm_radius.la
+$(OUTPUT)/auth_proxy.txt $(OUTPUT)/auth_proxy_pass_through.txt: $(BUILD_DIR)/lib/local/rlm_radius.la
+$(OUTPUT)/auth_proxy_multi_socket.txt: $(BUILD_DIR)/lib/local/rlm_radius.la $(BUILD_DIR)/lib/local/rlm_delay.la
 
 #
 #	Run the radclient commands against the radiusd.
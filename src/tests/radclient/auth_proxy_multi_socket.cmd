@@ -0,0 +1,15 @@
+#!/bin/sh
+#
+#	All of the requests should be accepted, which means
+#	each proxied reply was matched to the request it answers.
+#
+
+test_in="build/tests/radclient/auth_proxy_multi_socket.out"
+expected=200
+
+accepted=$(grep "Accepted" ${test_in} | awk '{print $3}')
+
+if [ "$accepted" != "$expected" ]; then
+	echo "ERROR: We expected ${expected} accepted requests in '${test_in}', got '${accepted}'"
+	exit 1
+fi